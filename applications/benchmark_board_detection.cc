@@ -0,0 +1,461 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+// Replays a folder of recorded frames through the board detection for every
+// combination of detector parameter file, downsample factor, track block
+// size, full resolution refinement and thread count. Reports the latency
+// percentiles per frame, the throughput, the detected corners and the
+// fraction of frames with a detection. The corners of every configuration
+// are compared to those of the first one, in full resolution pixels, to pick
+// the fastest configuration that is still accurate enough.
+
+DEFINE_string(image_folder,
+              "",
+              "Folder with the recorded png frames, sorted by name.");
+DEFINE_int32(max_frames,
+             300,
+             "Frames loaded from the folder, they are kept in memory. 0 "
+             "loads all.");
+DEFINE_string(board_type, "charuco", "Board type. (charuco, radon, apriltag)");
+DEFINE_string(aruco_detector_params,
+              "",
+              "Comma separated detector yaml files of the charuco board. "
+              "Empty uses the default parameters.");
+DEFINE_double(checker_square_length_m,
+              0.022,
+              "Size of one square on the checkerboard in [m].");
+DEFINE_int32(num_squares_x, 9, "Number of squares in x.");
+DEFINE_int32(num_squares_y, 7, "Number of squares in y");
+DEFINE_int32(aruco_dict,
+             cv::aruco::DICT_ARUCO_ORIGINAL,
+             "Aruco dictionary id.");
+DEFINE_int32(apriltag_num_threads,
+             1,
+             "Threads of the apriltag detector within one image.");
+DEFINE_int32(apriltag_quad_decimate,
+             1,
+             "Quad decimation of the apriltag detector.");
+DEFINE_string(downsample_factors,
+              "1,2",
+              "Comma separated downsample factors. I_new = 1/factor * I");
+DEFINE_string(track_block_sizes,
+              "0,30",
+              "Comma separated track block sizes, 0 searches every full "
+              "image.");
+DEFINE_string(refine_full_resolution,
+              "0,1",
+              "Comma separated full resolution refinement modes (0 or 1). "
+              "Only used with a downsample factor other than 1.");
+DEFINE_string(adaptive_min_corner_spacing_px,
+              "0",
+              "Comma separated corner spacings of the adaptive downsampling, "
+              "the downsample factor is its largest factor. 0 uses the fixed "
+              "factor. Only used with a track block size.");
+DEFINE_string(thread_counts,
+              "1,4",
+              "Comma separated numbers of detector threads. Each thread "
+              "detects a contiguous part of the frames.");
+DEFINE_string(use_opencl,
+              "0",
+              "Comma separated modes (0 or 1) of the OpenCL preprocessing.");
+DEFINE_string(radon_fast_path,
+              "0",
+              "Comma separated modes (0 or 1) of the Radon fast path. Only "
+              "used for Radon boards.");
+DEFINE_string(output_json, "", "Write the results to this json file.");
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using nlohmann::json;
+
+namespace {
+
+std::vector<std::string> SplitCommaList(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+struct DetectorConfig {
+  std::string detector_params;
+  double downsample_factor = 1.0;
+  int track_block_size = 0;
+  bool refine_full_resolution = false;
+  double adaptive_min_corner_spacing_px = 0.0;
+  bool use_opencl = false;
+  bool radon_fast_path = false;
+  int num_threads = 1;
+};
+
+//! Every combination of the configurations with the values
+std::vector<DetectorConfig> Expand(
+    const std::vector<DetectorConfig>& configs,
+    const std::vector<std::string>& values,
+    const std::function<void(const std::string&, DetectorConfig&)>& set_value) {
+  std::vector<DetectorConfig> expanded;
+  for (const auto& config : configs) {
+    for (const auto& value : values) {
+      expanded.push_back(config);
+      set_value(value, expanded.back());
+    }
+  }
+  return expanded;
+}
+
+//! Detections of one frame in full resolution pixels
+struct FrameDetection {
+  double latency_ms = 0.0;
+  std::unordered_map<int, Eigen::Vector2d> corners;
+};
+
+bool InitializeBoard(const DetectorConfig& config,
+                     BoardExtractor& board_extractor) {
+  board_extractor.SetTrackBlockSize(config.track_block_size);
+  board_extractor.SetRefineFullResolution(config.refine_full_resolution);
+  board_extractor.SetAdaptiveDownsample(config.adaptive_min_corner_spacing_px);
+  board_extractor.SetUseOpenCL(config.use_opencl);
+  board_extractor.SetRadonFastPath(config.radon_fast_path);
+  const BoardType board_type = StringToBoardType(FLAGS_board_type);
+  if (board_type == BoardType::CHARUCO) {
+    return board_extractor.InitializeCharucoBoard(
+        config.detector_params,
+        FLAGS_checker_square_length_m / 2.0f,
+        FLAGS_checker_square_length_m,
+        FLAGS_num_squares_x,
+        FLAGS_num_squares_y,
+        FLAGS_aruco_dict);
+  } else if (board_type == BoardType::RADON) {
+    return board_extractor.InitializeRadonBoard(FLAGS_checker_square_length_m,
+                                                FLAGS_num_squares_x,
+                                                FLAGS_num_squares_y);
+  }
+  ApriltagDetectorOptions april_options;
+  april_options.num_threads = FLAGS_apriltag_num_threads;
+  april_options.quad_decimate = FLAGS_apriltag_quad_decimate;
+  return board_extractor.InitializeAprilBoard(FLAGS_checker_square_length_m,
+                                              0.3,
+                                              FLAGS_num_squares_x,
+                                              FLAGS_num_squares_y,
+                                              april_options);
+}
+
+//! Detects all frames with one board extractor per thread. The tracking
+//! restarts every track block like in the extraction.
+bool DetectFrames(const std::vector<cv::Mat>& images,
+                  const DetectorConfig& config,
+                  std::vector<FrameDetection>& detections,
+                  double& wall_time_s,
+                  double& radon_escalation_rate) {
+  std::vector<std::unique_ptr<BoardExtractor>> extractors;
+  for (int t = 0; t < config.num_threads; ++t) {
+    extractors.emplace_back(new BoardExtractor());
+    if (!InitializeBoard(config, *extractors.back())) {
+      return false;
+    }
+  }
+  const bool full_res_corners =
+      (config.refine_full_resolution && config.downsample_factor != 1.0) ||
+      config.adaptive_min_corner_spacing_px > 0.0;
+  const double corner_scale = full_res_corners ? 1.0 : config.downsample_factor;
+
+  detections.assign(images.size(), FrameDetection());
+  const auto start = std::chrono::steady_clock::now();
+  utils::ParallelFor(
+      images.size(),
+      config.num_threads,
+      [&](size_t begin, size_t end, int thread_idx) {
+        BoardExtractor& extractor = *extractors[thread_idx];
+        BoardTrackingState tracking_state;
+        aligned_vector<Eigen::Vector2d> corners;
+        std::vector<int> ids;
+        for (size_t i = begin; i < end; ++i) {
+          if (config.track_block_size > 0 &&
+              i % config.track_block_size == 0) {
+            tracking_state = BoardTrackingState();
+          }
+          const auto frame_start = std::chrono::steady_clock::now();
+          extractor.DetectImage(images[i],
+                                config.downsample_factor,
+                                tracking_state,
+                                corners,
+                                ids);
+          detections[i].latency_ms =
+              std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - frame_start)
+                  .count();
+          for (size_t c = 0; c < ids.size(); ++c) {
+            detections[i].corners[ids[c]] = corner_scale * corners[c];
+          }
+        }
+      });
+  wall_time_s = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  // the threads detect chunks of the same size
+  radon_escalation_rate = 0.0;
+  for (const auto& extractor : extractors) {
+    radon_escalation_rate +=
+        extractor->RadonEscalationRate() / extractors.size();
+  }
+  return true;
+}
+
+double Percentile(std::vector<double> values, const double percentile) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  const size_t idx = std::min(
+      values.size() - 1, static_cast<size_t>(percentile * values.size()));
+  std::nth_element(values.begin(), values.begin() + idx, values.end());
+  return values[idx];
+}
+
+//! Latency, detection rate and the corner deviation to the reference
+json Evaluate(const std::vector<FrameDetection>& detections,
+              const std::vector<FrameDetection>& reference) {
+  std::vector<double> latencies_ms;
+  size_t num_detected = 0;
+  size_t num_corners = 0;
+  size_t num_reference_corners = 0;
+  size_t num_matched = 0;
+  double sum_deviation_px = 0.0;
+  double max_deviation_px = 0.0;
+  for (size_t i = 0; i < detections.size(); ++i) {
+    latencies_ms.push_back(detections[i].latency_ms);
+    num_detected += detections[i].corners.empty() ? 0 : 1;
+    num_corners += detections[i].corners.size();
+    num_reference_corners += reference[i].corners.size();
+    for (const auto& ref_corner : reference[i].corners) {
+      const auto corner = detections[i].corners.find(ref_corner.first);
+      if (corner == detections[i].corners.end()) {
+        continue;
+      }
+      const double deviation_px =
+          (corner->second - ref_corner.second).norm();
+      sum_deviation_px += deviation_px;
+      max_deviation_px = std::max(max_deviation_px, deviation_px);
+      ++num_matched;
+    }
+  }
+  const double num_frames = std::max<size_t>(1, detections.size());
+  double mean_latency_ms = 0.0;
+  for (const double latency_ms : latencies_ms) {
+    mean_latency_ms += latency_ms / num_frames;
+  }
+  json result;
+  result["latency_mean_ms"] = mean_latency_ms;
+  result["latency_p50_ms"] = Percentile(latencies_ms, 0.5);
+  result["latency_p90_ms"] = Percentile(latencies_ms, 0.9);
+  result["latency_p99_ms"] = Percentile(latencies_ms, 0.99);
+  result["latency_max_ms"] = Percentile(latencies_ms, 1.0);
+  result["detection_rate"] = num_detected / num_frames;
+  result["mean_corners"] = num_corners / num_frames;
+  result["reference_recall"] =
+      num_reference_corners > 0
+          ? double(num_matched) / double(num_reference_corners)
+          : 0.0;
+  result["mean_deviation_px"] =
+      num_matched > 0 ? sum_deviation_px / num_matched : 0.0;
+  result["max_deviation_px"] = max_deviation_px;
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::vector<std::string> filenames;
+  cv::glob(FLAGS_image_folder + "/*.png", filenames, false);
+  std::sort(filenames.begin(), filenames.end());
+  if (FLAGS_max_frames > 0 && filenames.size() > size_t(FLAGS_max_frames)) {
+    filenames.resize(FLAGS_max_frames);
+  }
+  std::vector<cv::Mat> images;
+  for (const auto& filename : filenames) {
+    images.push_back(cv::imread(filename));
+    if (images.back().empty()) {
+      LOG(ERROR) << "Could not read " << filename;
+      return -1;
+    }
+  }
+  if (images.empty()) {
+    LOG(ERROR) << "No png images found in " << FLAGS_image_folder;
+    return -1;
+  }
+  std::cout << "Loaded " << images.size() << " frames of "
+            << images[0].cols << "x" << images[0].rows << "\n";
+
+  // the detector parameters only exist for the charuco board
+  std::vector<std::string> detector_params = {""};
+  if (StringToBoardType(FLAGS_board_type) == BoardType::CHARUCO &&
+      FLAGS_aruco_detector_params != "") {
+    detector_params = SplitCommaList(FLAGS_aruco_detector_params);
+  }
+  std::vector<DetectorConfig> configs(1);
+  configs = Expand(
+      configs, detector_params, [](const std::string& v, DetectorConfig& c) {
+        c.detector_params = v;
+      });
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_downsample_factors),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.downsample_factor = std::stod(v);
+                   });
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_track_block_sizes),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.track_block_size = std::stoi(v);
+                   });
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_refine_full_resolution),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.refine_full_resolution = std::stoi(v) != 0;
+                   });
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_adaptive_min_corner_spacing_px),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.adaptive_min_corner_spacing_px = std::stod(v);
+                   });
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_use_opencl),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.use_opencl = std::stoi(v) != 0;
+                   });
+  if (StringToBoardType(FLAGS_board_type) == BoardType::RADON) {
+    configs = Expand(configs,
+                     SplitCommaList(FLAGS_radon_fast_path),
+                     [](const std::string& v, DetectorConfig& c) {
+                       c.radon_fast_path = std::stoi(v) != 0;
+                     });
+  }
+  configs = Expand(configs,
+                   SplitCommaList(FLAGS_thread_counts),
+                   [](const std::string& v, DetectorConfig& c) {
+                     c.num_threads = std::max(1, std::stoi(v));
+                   });
+  // the refinement does nothing without downsampling, the adaptive
+  // downsampling nothing without tracking
+  configs.erase(std::remove_if(configs.begin(),
+                               configs.end(),
+                               [](const DetectorConfig& c) {
+                                 return (c.refine_full_resolution &&
+                                         c.downsample_factor == 1.0) ||
+                                        (c.adaptive_min_corner_spacing_px >
+                                             0.0 &&
+                                         c.track_block_size == 0);
+                               }),
+                configs.end());
+
+  json results;
+  results["config"] = {{"image_folder", FLAGS_image_folder},
+                       {"num_frames", images.size()},
+                       {"image_width", images[0].cols},
+                       {"image_height", images[0].rows},
+                       {"board_type", FLAGS_board_type},
+                       {"num_squares_x", FLAGS_num_squares_x},
+                       {"num_squares_y", FLAGS_num_squares_y}};
+  results["runs"] = json::array();
+  std::cout << std::setw(8) << "factor" << std::setw(7) << "track"
+            << std::setw(7) << "refine" << std::setw(7) << "adapt"
+            << std::setw(7) << "ocl" << std::setw(8) << "threads"
+            << std::setw(9) << "p50_ms" << std::setw(9) << "p90_ms"
+            << std::setw(9) << "p99_ms" << std::setw(9) << "fps"
+            << std::setw(9) << "det" << std::setw(9) << "corners"
+            << std::setw(9) << "recall" << std::setw(9) << "dev_px"
+            << "  params\n";
+  std::vector<FrameDetection> reference;
+  for (const auto& config : configs) {
+    std::vector<FrameDetection> detections;
+    double wall_time_s = 0.0;
+    double radon_escalation_rate = 0.0;
+    if (!DetectFrames(
+            images, config, detections, wall_time_s, radon_escalation_rate)) {
+      LOG(ERROR) << "Could not initialize the board detector.";
+      return -1;
+    }
+    if (reference.empty()) {
+      reference = detections;
+    }
+    json run = Evaluate(detections, reference);
+    run["detector_params"] = config.detector_params;
+    run["downsample_factor"] = config.downsample_factor;
+    run["track_block_size"] = config.track_block_size;
+    run["refine_full_resolution"] = config.refine_full_resolution;
+    run["adaptive_min_corner_spacing_px"] =
+        config.adaptive_min_corner_spacing_px;
+    run["use_opencl"] = config.use_opencl;
+    if (config.radon_fast_path) {
+      run["radon_fast_path"] = true;
+      run["radon_escalation_rate"] = radon_escalation_rate;
+    }
+    run["num_threads"] = config.num_threads;
+    run["wall_time_s"] = wall_time_s;
+    run["frames_per_s"] = images.size() / std::max(wall_time_s, 1e-9);
+    std::cout << std::setw(8) << config.downsample_factor << std::setw(7)
+              << config.track_block_size << std::setw(7)
+              << (config.refine_full_resolution ? "yes" : "no")
+              << std::setw(7) << config.adaptive_min_corner_spacing_px
+              << std::setw(7) << (config.use_opencl ? "yes" : "no")
+              << std::setw(8) << config.num_threads << std::setw(9)
+              << run["latency_p50_ms"].get<double>() << std::setw(9)
+              << run["latency_p90_ms"].get<double>() << std::setw(9)
+              << run["latency_p99_ms"].get<double>() << std::setw(9)
+              << run["frames_per_s"].get<double>() << std::setw(9)
+              << run["detection_rate"].get<double>() << std::setw(9)
+              << run["mean_corners"].get<double>() << std::setw(9)
+              << run["reference_recall"].get<double>() << std::setw(9)
+              << run["mean_deviation_px"].get<double>() << "  "
+              << (config.detector_params == "" ? "default"
+                                               : config.detector_params)
+              << "\n";
+    results["runs"].push_back(run);
+  }
+
+  if (FLAGS_output_json != "") {
+    std::ofstream output(FLAGS_output_json);
+    CHECK(output.is_open()) << "Could not open " << FLAGS_output_json;
+    output << std::setw(2) << results << std::endl;
+  }
+  return 0;
+}
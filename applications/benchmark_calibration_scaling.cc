@@ -0,0 +1,475 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/rd_spline.h"
+#include "OpenCameraCalibrator/basalt_spline/so3_spline.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include "theia/sfm/reconstruction.h"
+
+// Generates synthetic board recordings with camera and IMU measurements of a
+// random trajectory and runs the spline calibration of ImuCameraCalibrator
+// on them for every duration and thread count. Reports time, memory and the
+// errors of T_i_c, gravity and the trajectory to find scaling regressions.
+// With --compare_deterministic every run is repeated in deterministic mode,
+// which reports its overhead and whether its results are identical for all
+// thread counts.
+
+DEFINE_string(durations_s,
+              "60,300,900",
+              "Comma separated durations of the synthetic recordings in "
+              "seconds, e.g. 60,600,3600.");
+DEFINE_string(thread_counts,
+              "1,2,4,8",
+              "Comma separated thread counts every recording is calibrated "
+              "with.");
+DEFINE_double(imu_rate, 200.0, "IMU rate in Hz.");
+DEFINE_double(camera_rate, 30.0, "Camera frame rate in Hz.");
+DEFINE_int32(num_corners,
+             100,
+             "Corners of the board, rounded down to a square grid.");
+DEFINE_int32(spline_order,
+             6,
+             "Order of the ground truth trajectory spline (4, 5 or 6). The "
+             "calibrated spline always has order SPLINE_N.");
+DEFINE_double(trajectory_knot_spacing_s,
+              0.5,
+              "Knot spacing of the random ground truth trajectory.");
+DEFINE_double(knot_spacing_s, 0.1, "Knot spacing of the calibrated spline.");
+DEFINE_double(pixel_noise, 0.5, "Corner noise standard deviation in pixels.");
+DEFINE_double(gyro_noise, 0.005, "Gyroscope noise in rad/s.");
+DEFINE_double(accl_noise, 0.05, "Accelerometer noise in m/s^2.");
+DEFINE_double(init_rotation_error_deg,
+              2.0,
+              "Rotation error of the initial T_i_c, the translation starts "
+              "at zero.");
+DEFINE_int32(iterations, 20, "Iterations of the spline optimization.");
+DEFINE_int32(seed, 42, "Seed of the trajectory and the measurement noise.");
+DEFINE_string(solver_profile,
+              "sparse_normal_cholesky",
+              "Linear solver of the spline optimization (see "
+              "continuous_time_imu_to_camera_calibration).");
+DEFINE_string(sparse_backend,
+              "SUITE_SPARSE",
+              "Sparse linear algebra library of the solver.");
+DEFINE_bool(compare_deterministic,
+            false,
+            "Repeats every run in deterministic mode and reports its "
+            "overhead.");
+DEFINE_string(output_json,
+              "",
+              "Writes the configuration and the results of all runs to "
+              "this path.");
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using nlohmann::json;
+
+namespace {
+
+const double kFocalLength = 500.0;
+const int kImageWidth = 640;
+const int kImageHeight = 480;
+const double kBoardSpacing = 0.04;
+//! views with fewer corners are dropped
+const int kMinCornersPerView = 4;
+
+std::vector<double> SplitCommaList(const std::string& list) {
+  std::vector<double> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    items.push_back(std::stod(item));
+  }
+  return items;
+}
+
+//! board views and IMU samples of a random trajectory with the ground truth
+struct SyntheticRecording {
+  std::shared_ptr<theia::Reconstruction> recon =
+      std::make_shared<theia::Reconstruction>();
+  CameraTelemetryData telemetry;
+  Sophus::SE3d T_i_c;
+  Eigen::Vector3d gravity = Eigen::Vector3d(0.0, 0.0, GRAVITY_MAGN);
+  //! ground truth T_w_i at every 10th IMU sample
+  std::vector<int64_t> pose_times_ns;
+  std::vector<Sophus::SE3d, Eigen::aligned_allocator<Sophus::SE3d>> poses;
+};
+
+//! camera at position looking at the board center, rotated by rotation_noise
+Sophus::SE3d LookAtBoard(const Eigen::Vector3d& position,
+                         const Eigen::Vector3d& rotation_noise,
+                         const Eigen::Vector3d& board_center) {
+  const Eigen::Vector3d z = (board_center - position).normalized();
+  const Eigen::Vector3d x =
+      (Eigen::Vector3d::UnitX() - z.x() * z).normalized();
+  Eigen::Matrix3d R_w_c;
+  R_w_c << x, z.cross(x), z;
+  return Sophus::SE3d(Sophus::SO3d(R_w_c) * Sophus::SO3d::exp(rotation_noise),
+                      position);
+}
+
+//! The knots are camera poses looking at the board from 0.3 to 0.7 m,
+//! drawn like So3Spline::genRandomTrajectory with static_init: the first N
+//! knots are equal, so the recording starts at rest.
+template <int N>
+void GenerateRecording(const double duration_s,
+                       std::mt19937& rng,
+                       SyntheticRecording& recording) {
+  recording.T_i_c =
+      Sophus::SE3d(Sophus::SO3d::exp(Eigen::Vector3d(0.1, -0.2, M_PI / 2)),
+                   Eigen::Vector3d(0.01, -0.02, 0.005));
+  const int grid = std::max(2, static_cast<int>(std::sqrt(FLAGS_num_corners)));
+  const Eigen::Vector3d board_center(
+      0.5 * (grid - 1) * kBoardSpacing, 0.5 * (grid - 1) * kBoardSpacing, 0.0);
+
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  const auto random_vector = [&](const double scale) {
+    return Eigen::Vector3d(uniform(rng), uniform(rng), uniform(rng)) * scale;
+  };
+  const int64_t dt_ns = FLAGS_trajectory_knot_spacing_s * S_TO_NS;
+  So3Spline<N> so3_spline(dt_ns);
+  RdSpline<3, N> r3_spline(dt_ns);
+  const int num_knots = duration_s * S_TO_NS / dt_ns + N + 1;
+  Sophus::SE3d T_w_c;
+  for (int i = 0; i < num_knots; ++i) {
+    if (i == 0 || i >= N) {
+      const Eigen::Vector3d offset(0.3 * uniform(rng),
+                                   0.3 * uniform(rng),
+                                   -0.5 + 0.2 * uniform(rng));
+      T_w_c = LookAtBoard(
+          board_center + offset, random_vector(0.1), board_center);
+    }
+    const Sophus::SE3d T_w_i = T_w_c * recording.T_i_c.inverse();
+    so3_spline.knots_push_back(T_w_i.so3());
+    r3_spline.knots_push_back(T_w_i.translation());
+  }
+
+  theia::Reconstruction& recon = *recording.recon;
+  for (int i = 0; i < grid * grid; ++i) {
+    recon.AddTrack(i);
+    theia::Track* track = recon.MutableTrack(i);
+    track->SetEstimated(true);
+    *track->MutablePoint() = Eigen::Vector4d(
+        (i % grid) * kBoardSpacing, (i / grid) * kBoardSpacing, 0.0, 1.0);
+  }
+
+  std::normal_distribution<double> pixel_noise(0.0, FLAGS_pixel_noise);
+  const Eigen::Vector2d principal_point(0.5 * kImageWidth, 0.5 * kImageHeight);
+  const int64_t duration_ns = duration_s * S_TO_NS;
+  const int64_t cam_dt_ns = S_TO_NS / FLAGS_camera_rate;
+  for (int64_t t_ns = 0; t_ns < duration_ns; t_ns += cam_dt_ns) {
+    const Sophus::SE3d T_w_c_t =
+        Sophus::SE3d(so3_spline.evaluate(t_ns),
+                     r3_spline.template evaluate<0>(t_ns)) *
+        recording.T_i_c;
+    const Sophus::SE3d T_c_w = T_w_c_t.inverse();
+    std::vector<std::pair<theia::TrackId, Eigen::Vector2d>> corners;
+    for (int i = 0; i < grid * grid; ++i) {
+      const Eigen::Vector3d p_c =
+          T_c_w * recon.Track(i)->Point().hnormalized();
+      if (p_c[2] < 0.05) continue;
+      const Eigen::Vector2d pixel =
+          kFocalLength * p_c.hnormalized() + principal_point;
+      if (pixel[0] < 0 || pixel[0] >= kImageWidth || pixel[1] < 0 ||
+          pixel[1] >= kImageHeight) {
+        continue;
+      }
+      corners.emplace_back(
+          i, pixel + Eigen::Vector2d(pixel_noise(rng), pixel_noise(rng)));
+    }
+    if (static_cast<int>(corners.size()) < kMinCornersPerView) {
+      continue;
+    }
+
+    const theia::ViewId view_id =
+        recon.AddView(std::to_string(t_ns), 0, t_ns * NS_TO_S);
+    theia::Camera* cam = recon.MutableView(view_id)->MutableCamera();
+    cam->SetCameraIntrinsicsModelType(
+        theia::CameraIntrinsicsModelType::PINHOLE);
+    cam->SetFocalLength(kFocalLength);
+    cam->SetPrincipalPoint(principal_point[0], principal_point[1]);
+    cam->SetImageSize(kImageWidth, kImageHeight);
+    cam->SetOrientationFromRotationMatrix(T_c_w.so3().matrix());
+    cam->SetPosition(T_w_c_t.translation());
+    for (const auto& corner : corners) {
+      recon.AddObservation(
+          view_id,
+          corner.first,
+          theia::Feature(corner.second, Eigen::Matrix2d::Identity()));
+    }
+  }
+
+  std::normal_distribution<double> gyro_noise(0.0, FLAGS_gyro_noise);
+  std::normal_distribution<double> accl_noise(0.0, FLAGS_accl_noise);
+  const int64_t imu_dt_ns = S_TO_NS / FLAGS_imu_rate;
+  int sample = 0;
+  for (int64_t t_ns = 0; t_ns < duration_ns; t_ns += imu_dt_ns, ++sample) {
+    const Sophus::SO3d R_w_i = so3_spline.evaluate(t_ns);
+    const Eigen::Vector3d gyro =
+        so3_spline.velocityBody(t_ns) +
+        Eigen::Vector3d(gyro_noise(rng), gyro_noise(rng), gyro_noise(rng));
+    const Eigen::Vector3d accl =
+        R_w_i.inverse() * (r3_spline.acceleration(t_ns) + recording.gravity) +
+        Eigen::Vector3d(accl_noise(rng), accl_noise(rng), accl_noise(rng));
+    recording.telemetry.gyroscope.emplace_back(t_ns * NS_TO_S, gyro);
+    recording.telemetry.accelerometer.emplace_back(t_ns * NS_TO_S, accl);
+    if (sample % 10 == 0) {
+      recording.pose_times_ns.push_back(t_ns);
+      recording.poses.emplace_back(R_w_i, r3_spline.template evaluate<0>(t_ns));
+    }
+  }
+}
+
+bool GenerateRecording(const double duration_s,
+                       const int spline_order,
+                       std::mt19937& rng,
+                       SyntheticRecording& recording) {
+  switch (spline_order) {
+    case 4:
+      GenerateRecording<4>(duration_s, rng, recording);
+      return true;
+    case 5:
+      GenerateRecording<5>(duration_s, rng, recording);
+      return true;
+    case 6:
+      GenerateRecording<6>(duration_s, rng, recording);
+      return true;
+    default:
+      LOG(ERROR) << "Unsupported spline order " << spline_order;
+      return false;
+  }
+}
+
+double AngleDeg(const Sophus::SO3d& R) { return R.log().norm() * 180. / M_PI; }
+
+//! Calibrates the recording with num_threads and measures time, memory and
+//! the errors to the ground truth
+json CalibrateRecording(const SyntheticRecording& recording,
+                        const int num_threads,
+                        const SplineSolverProfile& solver_profile) {
+  using Clock = std::chrono::steady_clock;
+  const int64_t rss_before_kb = utils::ResidentSetSizeKb();
+  const int64_t cpu_before_us = utils::ProcessCpuTimeUs();
+  const Clock::time_point start = Clock::now();
+
+  ImuCameraCalibrator calibrator;
+  calibrator.SetSolverProfile(solver_profile);
+  calibrator.trajectory_.SetNumThreads(num_threads);
+  // the board is exact
+  calibrator.SetRigidBoard(true);
+  SplineWeightingData weight_data;
+  weight_data.dt_r3 = FLAGS_knot_spacing_s;
+  weight_data.dt_so3 = FLAGS_knot_spacing_s;
+  weight_data.std_r3 = FLAGS_accl_noise;
+  weight_data.std_so3 = FLAGS_gyro_noise;
+  weight_data.cam_fps = FLAGS_camera_rate;
+  const Eigen::Vector3d init_rotation_error =
+      Eigen::Vector3d(1.0, 1.0, 1.0).normalized() *
+      FLAGS_init_rotation_error_deg * M_PI / 180.;
+  const Sophus::SE3d T_i_c_init(
+      recording.T_i_c.so3() * Sophus::SO3d::exp(init_rotation_error),
+      Eigen::Vector3d::Zero());
+  calibrator.BatchInitSpline(recording.recon,
+                             T_i_c_init,
+                             weight_data,
+                             0.0,
+                             recording.telemetry,
+                             0.0,
+                             ThreeAxisSensorCalibParams<double>(),
+                             ThreeAxisSensorCalibParams<double>());
+  const double build_time_s =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const int64_t rss_problem_kb = utils::ResidentSetSizeKb();
+
+  const Clock::time_point solve_start = Clock::now();
+  const double reprojection_error = calibrator.Optimize(
+      FLAGS_iterations,
+      SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C |
+          SplineOptimFlags::GRAVITY_DIR);
+  const double solve_time_s =
+      std::chrono::duration<double>(Clock::now() - solve_start).count();
+
+  const SplineTrajectoryEstimator<SPLINE_N>& trajectory =
+      calibrator.trajectory_;
+  const Sophus::SE3d T_i_c = trajectory.GetT_i_c();
+  const Eigen::Vector3d gravity = trajectory.GetGravity();
+  TrajectorySamples samples;
+  double rotation_sq_sum = 0.0, position_sq_sum = 0.0;
+  int num_samples = 0;
+  if (trajectory.EvaluateTrajectory(
+          recording.pose_times_ns, SAMPLE_POSE, samples)) {
+    for (size_t i = 0; i < recording.poses.size(); ++i) {
+      if (!samples.valid[i]) continue;
+      const Sophus::SE3d error = recording.poses[i].inverse() * samples.Pose(i);
+      rotation_sq_sum += std::pow(AngleDeg(error.so3()), 2);
+      position_sq_sum += error.translation().squaredNorm();
+      ++num_samples;
+    }
+  }
+
+  json run;
+  run["num_threads"] = num_threads;
+  run["deterministic"] = utils::Executor::Global().Deterministic();
+  run["num_residual_blocks"] = trajectory.GetNumResidualBlocks();
+  run["build_time_s"] = build_time_s;
+  run["solve_time_s"] = solve_time_s;
+  run["cpu_time_s"] = (utils::ProcessCpuTimeUs() - cpu_before_us) * 1e-6;
+  run["problem_memory_kb"] = rss_problem_kb - rss_before_kb;
+  run["peak_rss_kb"] = utils::PeakResidentSetSizeKb();
+  run["reprojection_error_px"] = reprojection_error;
+  run["T_i_c_rotation_error_deg"] =
+      AngleDeg(recording.T_i_c.so3().inverse() * T_i_c.so3());
+  run["T_i_c_translation_error_mm"] =
+      1e3 * (recording.T_i_c.translation() - T_i_c.translation()).norm();
+  run["gravity_error_deg"] =
+      std::acos(std::min(
+          1.0, gravity.normalized().dot(recording.gravity.normalized()))) *
+      180. / M_PI;
+  run["trajectory_rotation_rmse_deg"] =
+      num_samples > 0 ? std::sqrt(rotation_sq_sum / num_samples) : -1.0;
+  run["trajectory_position_rmse_mm"] =
+      num_samples > 0 ? 1e3 * std::sqrt(position_sq_sum / num_samples) : -1.0;
+  return run;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  SplineSolverProfile solver_profile;
+  CHECK(SplineSolverProfileFromString(
+      FLAGS_solver_profile, FLAGS_sparse_backend, solver_profile))
+      << "Invalid solver profile " << FLAGS_solver_profile << " or backend "
+      << FLAGS_sparse_backend;
+  const std::vector<double> durations_s = SplitCommaList(FLAGS_durations_s);
+  const std::vector<double> thread_counts =
+      SplitCommaList(FLAGS_thread_counts);
+  CHECK(!durations_s.empty() && !thread_counts.empty())
+      << "Need at least one duration and one thread count";
+
+  json results;
+  results["config"] = {{"imu_rate", FLAGS_imu_rate},
+                       {"camera_rate", FLAGS_camera_rate},
+                       {"num_corners", FLAGS_num_corners},
+                       {"spline_order", FLAGS_spline_order},
+                       {"knot_spacing_s", FLAGS_knot_spacing_s},
+                       {"iterations", FLAGS_iterations},
+                       {"solver_profile", FLAGS_solver_profile},
+                       {"seed", FLAGS_seed},
+                       {"compare_deterministic", FLAGS_compare_deterministic}};
+  results["runs"] = json::array();
+  std::cout << std::setw(10) << "duration" << std::setw(8) << "threads"
+            << std::setw(10) << "build_s" << std::setw(10) << "solve_s"
+            << std::setw(12) << "memory_mb" << std::setw(10) << "reproj"
+            << std::setw(10) << "rot_deg" << std::setw(10) << "trans_mm"
+            << std::setw(6) << "det" << std::setw(10) << "overhead\n";
+  for (const double duration_s : durations_s) {
+    // the same recording for every thread count
+    std::mt19937 rng(FLAGS_seed);
+    SyntheticRecording recording;
+    CHECK(GenerateRecording(duration_s, FLAGS_spline_order, rng, recording));
+    LOG(INFO) << "Generated " << duration_s << "s recording with "
+              << recording.recon->NumViews() << " views and "
+              << recording.telemetry.gyroscope.size() << " IMU samples";
+
+    // results of the first deterministic run, all others must match them
+    json reference;
+    for (const double num_threads : thread_counts) {
+      std::vector<bool> modes = {false};
+      if (FLAGS_compare_deterministic) {
+        modes.push_back(true);
+      }
+      double parallel_solve_time_s = 0.0;
+      for (const bool deterministic : modes) {
+        utils::Executor::Global().SetDeterministic(deterministic);
+        json run = CalibrateRecording(
+            recording, static_cast<int>(num_threads), solver_profile);
+        utils::Executor::Global().SetDeterministic(false);
+        run["duration_s"] = duration_s;
+        run["num_views"] = recording.recon->NumViews();
+        run["num_imu_samples"] = recording.telemetry.gyroscope.size();
+        double overhead = 1.0;
+        if (deterministic) {
+          overhead = run["solve_time_s"].get<double>() /
+                     std::max(parallel_solve_time_s, 1e-9);
+          run["overhead"] = overhead;
+          if (reference.is_null()) {
+            reference = run;
+          }
+          // bitwise, the errors are computed from the calibrated values
+          run["reproducible"] =
+              run["reprojection_error_px"] ==
+                  reference["reprojection_error_px"] &&
+              run["T_i_c_rotation_error_deg"] ==
+                  reference["T_i_c_rotation_error_deg"] &&
+              run["T_i_c_translation_error_mm"] ==
+                  reference["T_i_c_translation_error_mm"] &&
+              run["gravity_error_deg"] == reference["gravity_error_deg"];
+          if (!run["reproducible"].get<bool>()) {
+            LOG(ERROR) << "Deterministic run with " << num_threads
+                       << " threads differs from the one with "
+                       << reference["num_threads"].get<int>() << " threads";
+          }
+        } else {
+          parallel_solve_time_s = run["solve_time_s"].get<double>();
+        }
+        std::cout << std::setw(10) << duration_s << std::setw(8)
+                  << run["num_threads"].get<int>() << std::setw(10)
+                  << run["build_time_s"].get<double>() << std::setw(10)
+                  << run["solve_time_s"].get<double>() << std::setw(12)
+                  << run["problem_memory_kb"].get<int64_t>() / 1024.0
+                  << std::setw(10)
+                  << run["reprojection_error_px"].get<double>()
+                  << std::setw(10)
+                  << run["T_i_c_rotation_error_deg"].get<double>()
+                  << std::setw(10)
+                  << run["T_i_c_translation_error_mm"].get<double>()
+                  << std::setw(6) << (deterministic ? "yes" : "no")
+                  << std::setw(10) << overhead << "\n";
+        results["runs"].push_back(run);
+      }
+    }
+  }
+
+  if (FLAGS_output_json != "") {
+    std::ofstream output(FLAGS_output_json);
+    CHECK(output.is_open()) << "Could not open " << FLAGS_output_json;
+    output << std::setw(2) << results << std::endl;
+  }
+  return 0;
+}
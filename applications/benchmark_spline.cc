@@ -0,0 +1,768 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <benchmark/benchmark.h>
+#include <ceres/ceres.h>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_spline_helper.h"
+#include "OpenCameraCalibrator/basalt_spline/rd_spline.h"
+#include "OpenCameraCalibrator/basalt_spline/so3_spline.h"
+#include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
+#include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+#include "theia/sfm/camera/pinhole_camera_model.h"
+#include "theia/sfm/reconstruction.h"
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+
+namespace {
+
+const int64_t kKnotSpacingNs = 0.1 * S_TO_NS;
+const int kNumKnots = 100;
+const double kCameraRate = 30.0;
+const double kImuRate = 200.0;
+const int kPointsPerView = 40;
+const double kFocalLength = 500.0;
+const Eigen::Vector3d kGravity(0.0, 0.0, GRAVITY_MAGN);
+
+//! random times inside the valid range of a spline
+std::vector<int64_t> RandomTimesNs(const int64_t min_time_ns,
+                                   const int64_t max_time_ns,
+                                   const int num_times) {
+  std::vector<int64_t> times_ns(num_times);
+  const Eigen::VectorXd rnd = Eigen::VectorXd::Random(num_times);
+  for (int i = 0; i < num_times; ++i) {
+    const double u = 0.5 * (rnd[i] + 1.0);
+    times_ns[i] = min_time_ns + u * (max_time_ns - min_time_ns);
+  }
+  return times_ns;
+}
+
+//! camera views with points in front of the camera and imu samples of a
+//! random trajectory. The imu frame coincides with the camera frame.
+template <int N>
+struct SyntheticDataset {
+  explicit SyntheticDataset(const double duration_s)
+      : so3_spline(kKnotSpacingNs), r3_spline(kKnotSpacingNs) {
+    const int64_t duration_ns = duration_s * S_TO_NS;
+    so3_spline.genRandomTrajectory(duration_ns / kKnotSpacingNs + N);
+    r3_spline.genRandomTrajectory(duration_ns / kKnotSpacingNs + N);
+
+    theia::TrackId track_id = 0;
+    const int64_t cam_dt_ns = S_TO_NS / kCameraRate;
+    for (int64_t t_ns = 0; t_ns < duration_ns; t_ns += cam_dt_ns) {
+      const Sophus::SE3d T_w_c(so3_spline.evaluate(t_ns),
+                               r3_spline.template evaluate<0>(t_ns));
+      const theia::ViewId view_id =
+          recon.AddView(std::to_string(t_ns), 0, t_ns * NS_TO_S);
+      theia::Camera* cam = recon.MutableView(view_id)->MutableCamera();
+      cam->SetCameraIntrinsicsModelType(
+          theia::CameraIntrinsicsModelType::PINHOLE);
+      cam->SetFocalLength(kFocalLength);
+      cam->SetPrincipalPoint(320.0, 240.0);
+      cam->SetImageSize(640, 480);
+      cam->SetOrientationFromRotationMatrix(T_w_c.so3().inverse().matrix());
+      cam->SetPosition(T_w_c.translation());
+
+      for (int i = 0; i < kPointsPerView; ++i, ++track_id) {
+        Eigen::Vector3d p_c = Eigen::Vector3d::Random();
+        p_c[2] += 3.0;
+        recon.AddTrack(track_id);
+        theia::Track* track = recon.MutableTrack(track_id);
+        track->SetEstimated(true);
+        *track->MutablePoint() = (T_w_c * p_c).homogeneous();
+
+        const Eigen::Vector2d pixel =
+            kFocalLength * p_c.hnormalized() + Eigen::Vector2d(320.0, 240.0);
+        recon.AddObservation(
+            view_id,
+            track_id,
+            theia::Feature(pixel, Eigen::Matrix2d::Identity()));
+      }
+      views.push_back(recon.View(view_id));
+    }
+
+    const int64_t imu_dt_ns = S_TO_NS / kImuRate;
+    for (int64_t t_ns = 0; t_ns < duration_ns; t_ns += imu_dt_ns) {
+      imu_times_ns.push_back(t_ns);
+      gyro.push_back(so3_spline.velocityBody(t_ns));
+      accl.push_back(so3_spline.evaluate(t_ns).inverse() *
+                     (r3_spline.acceleration(t_ns) + kGravity));
+    }
+  }
+
+  So3Spline<N> so3_spline;
+  RdSpline<3, N> r3_spline;
+  theia::Reconstruction recon;
+  std::vector<const theia::View*> views;
+
+  std::vector<int64_t> imu_times_ns;
+  vec3_vector gyro;
+  vec3_vector accl;
+};
+
+template <int N>
+void BM_So3SplineEvaluate(benchmark::State& state) {
+  So3Spline<N> spline(kKnotSpacingNs);
+  spline.genRandomTrajectory(kNumKnots);
+  const std::vector<int64_t> times_ns =
+      RandomTimesNs(spline.minTimeNs(), spline.maxTimeNs(), 1024);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(spline.evaluate(times_ns[i++ % times_ns.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <int N>
+void BM_So3SplineVelocityBody(benchmark::State& state) {
+  So3Spline<N> spline(kKnotSpacingNs);
+  spline.genRandomTrajectory(kNumKnots);
+  const std::vector<int64_t> times_ns =
+      RandomTimesNs(spline.minTimeNs(), spline.maxTimeNs(), 1024);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        spline.velocityBody(times_ns[i++ % times_ns.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <int N>
+void BM_RdSplineEvaluate(benchmark::State& state) {
+  RdSpline<3, N> spline(kKnotSpacingNs);
+  spline.genRandomTrajectory(kNumKnots);
+  const std::vector<int64_t> times_ns =
+      RandomTimesNs(spline.minTimeNs(), spline.maxTimeNs(), 1024);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        spline.template evaluate<0>(times_ns[i++ % times_ns.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <int N>
+void BM_RdSplineAcceleration(benchmark::State& state) {
+  RdSpline<3, N> spline(kKnotSpacingNs);
+  spline.genRandomTrajectory(kNumKnots);
+  const std::vector<int64_t> times_ns =
+      RandomTimesNs(spline.minTimeNs(), spline.maxTimeNs(), 1024);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        spline.acceleration(times_ns[i++ % times_ns.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+//! evaluate_lie with T = double or with Jets that carry the derivatives
+//! w.r.t. all knot parameters, as used by the autodiff cost functions
+template <int N, class T>
+void BM_EvaluateLie(benchmark::State& state) {
+  So3Spline<N> spline(kKnotSpacingNs);
+  spline.genRandomTrajectory(N);
+
+  std::vector<T> knot_data(4 * N);
+  for (int i = 0; i < N; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      knot_data[4 * i + j] = T(spline.getKnot(i).data()[j]);
+      if constexpr (!std::is_same<T, double>::value) {
+        knot_data[4 * i + j].v[4 * i + j] = 1.0;
+      }
+    }
+  }
+  std::vector<const T*> knots(N);
+  for (int i = 0; i < N; ++i) {
+    knots[i] = knot_data.data() + 4 * i;
+  }
+
+  const T inv_dt = T(S_TO_NS / kKnotSpacingNs);
+  double u = 0.0;
+  for (auto _ : state) {
+    Sophus::SO3<T> rot;
+    Eigen::Matrix<T, 3, 1> vel, accel;
+    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
+        knots.data(), T(u), inv_dt, &rot, &vel, &accel);
+    benchmark::DoNotOptimize(rot);
+    benchmark::DoNotOptimize(vel);
+    benchmark::DoNotOptimize(accel);
+    u = u < 0.99 ? u + 0.01 : 0.0;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+//! num rotation vectors of random direction with angle_rad
+std::vector<Eigen::Vector3d> RandomRotationVectors(const double angle_rad,
+                                                   const int num) {
+  std::vector<Eigen::Vector3d> omegas(num);
+  for (int i = 0; i < num; ++i) {
+    omegas[i] = angle_rad * Eigen::Vector3d::Random().normalized();
+  }
+  return omegas;
+}
+
+//! largest difference of the rotation matrices of R and its long double
+//! reference
+double MaxRotationError(const Sophus::SO3d& R,
+                        const Sophus::SO3<long double>& R_ref) {
+  return static_cast<double>(
+      (R.matrix().cast<long double>() - R_ref.matrix()).cwiseAbs().maxCoeff());
+}
+
+//! Sophus::SO3::exp or so3_exp_fast of range(0) milliradians. Angles below
+//! 223 mrad take the polynomial path of so3_exp_fast
+template <bool FAST>
+void BM_So3Exp(benchmark::State& state) {
+  const std::vector<Eigen::Vector3d> omegas =
+      RandomRotationVectors(state.range(0) * 1e-3, 1024);
+  double max_error = 0.0;
+  for (const Eigen::Vector3d& omega : omegas) {
+    const Sophus::SO3d R =
+        FAST ? Sophus::so3_exp_fast(omega) : Sophus::SO3d::exp(omega);
+    max_error = std::max(
+        max_error,
+        MaxRotationError(
+            R, Sophus::SO3<long double>::exp(omega.cast<long double>())));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const Eigen::Vector3d& omega = omegas[i++ % omegas.size()];
+    if (FAST) {
+      benchmark::DoNotOptimize(Sophus::so3_exp_fast(omega));
+    } else {
+      benchmark::DoNotOptimize(Sophus::SO3d::exp(omega));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["max_error"] = max_error;
+}
+
+//! Sophus::SO3::log or so3_log_fast of rotations of range(0) milliradians
+template <bool FAST>
+void BM_So3Log(benchmark::State& state) {
+  const std::vector<Eigen::Vector3d> omegas =
+      RandomRotationVectors(state.range(0) * 1e-3, 1024);
+  so3_vector rotations;
+  double max_error = 0.0;
+  for (const Eigen::Vector3d& omega : omegas) {
+    rotations.push_back(Sophus::SO3d::exp(omega));
+    const Eigen::Vector3d log = FAST ? Sophus::so3_log_fast(rotations.back())
+                                     : rotations.back().log();
+    const Eigen::Matrix<long double, 3, 1> log_ref =
+        rotations.back().cast<long double>().log();
+    max_error = std::max(
+        max_error,
+        static_cast<double>(
+            (log.cast<long double>() - log_ref).cwiseAbs().maxCoeff()));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const Sophus::SO3d& R = rotations[i++ % rotations.size()];
+    if (FAST) {
+      benchmark::DoNotOptimize(Sophus::so3_log_fast(R));
+    } else {
+      benchmark::DoNotOptimize(R.log());
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["max_error"] = max_error;
+}
+
+//! rightJacobianSO3 and rightJacobianInvSO3 of range(0) milliradians, above
+//! 223 mrad they evaluate the trigonometric functions
+void BM_RightJacobianSO3(benchmark::State& state) {
+  const std::vector<Eigen::Vector3d> omegas =
+      RandomRotationVectors(state.range(0) * 1e-3, 1024);
+  double max_error = 0.0;
+  for (const Eigen::Vector3d& omega : omegas) {
+    Eigen::Matrix3d J, J_inv;
+    Sophus::rightJacobianSO3(omega, J);
+    Sophus::rightJacobianInvSO3(omega, J_inv);
+    const Eigen::Matrix3d residual = J * J_inv - Eigen::Matrix3d::Identity();
+    max_error = std::max(max_error, residual.cwiseAbs().maxCoeff());
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const Eigen::Vector3d& omega = omegas[i++ % omegas.size()];
+    Eigen::Matrix3d J, J_inv;
+    Sophus::rightJacobianSO3(omega, J);
+    Sophus::rightJacobianInvSO3(omega, J_inv);
+    benchmark::DoNotOptimize(J);
+    benchmark::DoNotOptimize(J_inv);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["max_inverse_error"] = max_error;
+}
+
+//! blending weights of the value and the first two derivatives
+template <int N>
+void BM_ComputeCoeffs(benchmark::State& state) {
+  using Helper = CeresSplineHelper<double, N>;
+  const double inv_dt = S_TO_NS / kKnotSpacingNs;
+  double u = 0.0;
+  for (auto _ : state) {
+    Eigen::Matrix<double, N, 1> coeff, dcoeff, ddcoeff;
+    Helper::template computeCoeffs<0, true>(u, inv_dt, coeff);
+    Helper::template computeCoeffs<1, true>(u, inv_dt, dcoeff);
+    Helper::template computeCoeffs<2, false>(u, inv_dt, ddcoeff);
+    benchmark::DoNotOptimize(coeff);
+    benchmark::DoNotOptimize(dcoeff);
+    benchmark::DoNotOptimize(ddcoeff);
+    u = u < 0.99 ? u + 0.01 : 0.0;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+//! parameter blocks of random spline, bias and calibration parameters. Every
+//! cost functor takes a subset of these in its own order.
+template <int N>
+struct FunctorParameters {
+  FunctorParameters() : so3(kKnotSpacingNs), r3(kKnotSpacingNs) {
+    so3.genRandomTrajectory(N);
+    r3.genRandomTrajectory(N);
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      accl_bias[i] = Eigen::Vector3d::Random() * 0.1;
+      gyro_bias[i] = Eigen::Vector3d::Random() * 0.01;
+    }
+    accl_intrinsics << 0, 0, 0, 1, 1, 1;
+    gyro_intrinsics << 0, 0, 0, 0, 0, 0, 1, 1, 1;
+  }
+
+  void AddSO3Knots(std::vector<double*>& blocks) {
+    for (int i = 0; i < N; ++i) {
+      blocks.push_back(so3.getKnot(i).data());
+    }
+  }
+  void AddR3Knots(std::vector<double*>& blocks) {
+    for (int i = 0; i < N; ++i) {
+      blocks.push_back(r3.getKnot(i).data());
+    }
+  }
+  void AddBiasKnots(vec3_vector& bias, std::vector<double*>& blocks) {
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      blocks.push_back(bias[i].data());
+    }
+  }
+
+  So3Spline<N> so3;
+  RdSpline<3, N> r3;
+  vec3_vector accl_bias = vec3_vector(BIAS_SPLINE_N);
+  vec3_vector gyro_bias = vec3_vector(BIAS_SPLINE_N);
+  Eigen::Vector3d gravity = kGravity;
+  Eigen::Matrix<double, 6, 1> accl_intrinsics;
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics;
+  Sophus::SE3d T_i_c;
+  double line_delay = 1e-5;
+};
+
+//! residuals and Jacobians, i.e. what the solver evaluates per iteration
+void EvaluateCostFunction(benchmark::State& state,
+                          ceres::CostFunction* cost_function,
+                          const std::vector<double*>& blocks) {
+  std::vector<double> residuals(cost_function->num_residuals());
+  std::vector<std::vector<double>> jacobian_data;
+  std::vector<double*> jacobians;
+  for (const int32_t block_size : cost_function->parameter_block_sizes()) {
+    jacobian_data.emplace_back(block_size * residuals.size());
+    jacobians.push_back(jacobian_data.back().data());
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cost_function->Evaluate(
+        blocks.data(), residuals.data(), jacobians.data()));
+  }
+  state.SetItemsProcessed(state.iterations());
+  delete cost_function;
+}
+
+template <int N>
+void BM_GyroCostFunctor(benchmark::State& state) {
+  using FunctorT = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+  FunctorParameters<N> params;
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(Eigen::Vector3d::Random(), 0.3, 10.0, 1.0, 0.3, 0.1));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddBiasKnots(params.gyro_bias, blocks);
+  blocks.push_back(params.gyro_intrinsics.data());
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->AddParameterBlock(9);
+  cost_function->SetNumResiduals(3);
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+template <int N>
+void BM_AccelerationCostFunctor(benchmark::State& state) {
+  using FunctorT = AccelerationCostFunctorSplit<N>;
+  FunctorParameters<N> params;
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(Eigen::Vector3d::Random(),
+                   0.3,
+                   10.0,
+                   0.3,
+                   10.0,
+                   1.0,
+                   0.3,
+                   0.1));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddR3Knots(blocks);
+  params.AddBiasKnots(params.accl_bias, blocks);
+  blocks.push_back(params.gravity.data());
+  blocks.push_back(params.accl_intrinsics.data());
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->AddParameterBlock(3);
+  cost_function->AddParameterBlock(6);
+  cost_function->SetNumResiduals(3);
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+//! gyroscope and accelerometer residual of one sample, compare with the sum
+//! of BM_GyroCostFunctor and BM_AccelerationCostFunctor
+template <int N>
+void BM_ImuCostFunctor(benchmark::State& state) {
+  using FunctorT = ImuCostFunctorSplit<N>;
+  FunctorParameters<N> params;
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(Eigen::Vector3d::Random(),
+                   Eigen::Vector3d::Random(),
+                   0.3,
+                   10.0,
+                   0.3,
+                   10.0,
+                   0.3,
+                   0.1,
+                   0.3,
+                   0.1,
+                   1.0,
+                   1.0));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddR3Knots(blocks);
+  params.AddBiasKnots(params.gyro_bias, blocks);
+  params.AddBiasKnots(params.accl_bias, blocks);
+  blocks.push_back(params.gravity.data());
+  blocks.push_back(params.gyro_intrinsics.data());
+  blocks.push_back(params.accl_intrinsics.data());
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < N + 2 * BIAS_SPLINE_N + 1; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->AddParameterBlock(9);
+  cost_function->AddParameterBlock(6);
+  cost_function->SetNumResiduals(6);
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+//! range(0) gyroscope samples in one residual block
+template <int N>
+void BM_ImuBatchCostFunctor(benchmark::State& state) {
+  using SampleFunctorT = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+  using FunctorT = ImuBatchCostFunctorSplit<SampleFunctorT>;
+  FunctorParameters<N> params;
+  const int num_samples = state.range(0);
+  std::vector<SampleFunctorT> samples;
+  for (int i = 0; i < num_samples; ++i) {
+    const double u = static_cast<double>(i) / num_samples;
+    samples.emplace_back(Eigen::Vector3d::Random(), u, 10.0, 1.0, u, 0.1);
+  }
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(std::move(samples)));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddBiasKnots(params.gyro_bias, blocks);
+  blocks.push_back(params.gyro_intrinsics.data());
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->AddParameterBlock(9);
+  cost_function->SetNumResiduals(3 * num_samples);
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+template <int N>
+void BM_ImuPreintegrationCostFunctor(benchmark::State& state) {
+  using FunctorT = ImuPreintegrationCostFunctorSplit<N>;
+  FunctorParameters<N> params;
+  utils::ImuPreintegration preintegration;
+  preintegration.delta_t_s = 0.05;
+  preintegration.num_samples = 10;
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(preintegration,
+                   0.2,
+                   0.7,
+                   10.0,
+                   0.2,
+                   0.7,
+                   10.0,
+                   0.3,
+                   0.1,
+                   0.3,
+                   0.1,
+                   1.0,
+                   1.0));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddR3Knots(blocks);
+  params.AddBiasKnots(params.gyro_bias, blocks);
+  params.AddBiasKnots(params.accl_bias, blocks);
+  blocks.push_back(params.gravity.data());
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < N + 2 * BIAS_SPLINE_N + 1; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->SetNumResiduals(6);
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+//! reprojection of all points of one synthetic view. The linearized rolling
+//! shutter variant also reports its largest residual difference to the exact
+//! functor
+template <int N, bool ROLLING_SHUTTER, bool LINEARIZED = false>
+void BM_ReprojectionCostFunctor(benchmark::State& state) {
+  using CameraModel = theia::PinholeCameraModel;
+  using RSFunctorT = std::conditional_t<
+      LINEARIZED,
+      RSLinearizedReprojectionCostFunctorSplit<N, CameraModel>,
+      RSReprojectionCostFunctorSplit<N, CameraModel>>;
+  using FunctorT =
+      std::conditional_t<ROLLING_SHUTTER,
+                         RSFunctorT,
+                         GSReprojectionCostFunctorSplit<N, CameraModel>>;
+  FunctorParameters<N> params;
+  SyntheticDataset<N> dataset(1.0);
+  utils::ObservationStore store;
+  store.Build(&dataset.recon);
+  const int v = store.ViewIndex(dataset.views.front());
+  const size_t first = store.GetView(v).first;
+  const size_t nr_obs = store.GetView(v).num;
+
+  auto* cost_function = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+      new FunctorT(store, v, first, nr_obs, 0.3, 0.3, 10.0, 10.0));
+  std::vector<double*> blocks;
+  params.AddSO3Knots(blocks);
+  params.AddR3Knots(blocks);
+  blocks.push_back(params.T_i_c.data());
+  if (ROLLING_SHUTTER) {
+    blocks.push_back(&params.line_delay);
+  }
+  for (size_t i = 0; i < nr_obs; ++i) {
+    blocks.push_back(store.Point(first + i));
+  }
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  for (int i = 0; i < N; ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  cost_function->AddParameterBlock(7);
+  if (ROLLING_SHUTTER) {
+    cost_function->AddParameterBlock(1);
+  }
+  for (size_t i = 0; i < nr_obs; ++i) {
+    cost_function->AddParameterBlock(4);
+  }
+  cost_function->SetNumResiduals(2 * nr_obs);
+  if (LINEARIZED) {
+    const RSReprojectionCostFunctorSplit<N, CameraModel> exact(
+        store, v, first, nr_obs, 0.3, 0.3, 10.0, 10.0);
+    const RSFunctorT linearized(store, v, first, nr_obs, 0.3, 0.3, 10.0, 10.0);
+    Eigen::VectorXd exact_residuals(2 * nr_obs);
+    Eigen::VectorXd linearized_residuals(2 * nr_obs);
+    exact(blocks.data(), exact_residuals.data());
+    linearized(blocks.data(), linearized_residuals.data());
+    state.counters["max_linearization_error_px"] =
+        (exact_residuals - linearized_residuals).cwiseAbs().maxCoeff();
+  }
+  EvaluateCostFunction(state, cost_function, blocks);
+}
+
+//! dense evaluation of poses, angular velocities and accelerations at the
+//! imu rate of a random trajectory of range(0) seconds
+template <int N>
+void BM_EvaluateTrajectory(benchmark::State& state) {
+  const SyntheticDataset<N> dataset(state.range(0));
+  const int64_t end_time_ns = dataset.imu_times_ns.back() + 1;
+
+  SplineTrajectoryEstimator<N> estimator;
+  estimator.SetNumThreads(1);
+  estimator.SetTimes(kKnotSpacingNs, kKnotSpacingNs, 0, end_time_ns);
+  estimator.SetImageData(dataset.recon);
+  estimator.BatchInitSO3R3VisPoses();
+
+  TrajectorySamples samples;
+  for (auto _ : state) {
+    estimator.EvaluateTrajectory(dataset.imu_times_ns,
+                                 SAMPLE_POSE | SAMPLE_ANGULAR_VELOCITY |
+                                     SAMPLE_ACCELERATION,
+                                 samples);
+    benchmark::DoNotOptimize(samples.rotation.data());
+  }
+  state.SetItemsProcessed(state.iterations() * dataset.imu_times_ns.size());
+}
+
+//! least squares fit of the knots to the views and gyroscope samples of a
+//! random trajectory of range(0) seconds, starting from the interpolation
+template <int N>
+void BM_FitKnotsToVisPoses(benchmark::State& state) {
+  const SyntheticDataset<N> dataset(state.range(0));
+  const int64_t end_time_ns = dataset.imu_times_ns.back() + 1;
+
+  SplineTrajectoryEstimator<N> estimator;
+  estimator.SetT_i_c(Sophus::SE3d());
+  estimator.SetTimes(kKnotSpacingNs, kKnotSpacingNs, 0, end_time_ns);
+  estimator.SetImageData(dataset.recon);
+  estimator.InitBiasSplines(
+      Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), 10 * 1e9, 10 * 1e9);
+  for (auto _ : state) {
+    state.PauseTiming();
+    estimator.BatchInitSO3R3VisPoses();
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(estimator.FitKnotsToVisPoses(
+        KnotFitOptions(), dataset.imu_times_ns, dataset.gyro, 1.0));
+  }
+}
+
+//! full spline optimization with camera and imu residuals of a random
+//! trajectory of range(0) seconds, range(1) is the CameraResidualLayout.
+//! Building the problem is not timed.
+template <int N>
+void BM_SplineOptimize(benchmark::State& state) {
+  const SyntheticDataset<N> dataset(state.range(0));
+  const int64_t end_time_ns = dataset.imu_times_ns.back() + 1;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    SplineTrajectoryEstimator<N> estimator;
+    estimator.SetT_i_c(Sophus::SE3d());
+    estimator.SetGravity(kGravity);
+    estimator.SetTimes(kKnotSpacingNs, kKnotSpacingNs, 0, end_time_ns);
+    estimator.SetImageData(dataset.recon);
+    estimator.SetCameraResidualLayout(
+        static_cast<CameraResidualLayout>(state.range(1)));
+    estimator.BatchInitSO3R3VisPoses();
+    estimator.InitBiasSplines(
+        Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), 10 * 1e9, 10 * 1e9);
+    estimator.AddCameraMeasurements(dataset.views, false);
+    estimator.AddGyroscopeMeasurements(dataset.gyro, dataset.imu_times_ns, 1.0);
+    estimator.AddAccelerometerMeasurements(
+        dataset.accl, dataset.imu_times_ns, 1.0);
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(estimator.Optimize(10, SplineOptimFlags::SPLINE));
+  }
+}
+
+}  // namespace
+
+#define SPLINE_ORDER_BENCHMARK(name) \
+  BENCHMARK_TEMPLATE(name, 4);       \
+  BENCHMARK_TEMPLATE(name, 5);       \
+  BENCHMARK_TEMPLATE(name, 6)
+
+SPLINE_ORDER_BENCHMARK(BM_So3SplineEvaluate);
+SPLINE_ORDER_BENCHMARK(BM_So3SplineVelocityBody);
+SPLINE_ORDER_BENCHMARK(BM_RdSplineEvaluate);
+SPLINE_ORDER_BENCHMARK(BM_RdSplineAcceleration);
+
+SPLINE_ORDER_BENCHMARK(BM_ComputeCoeffs);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 4, double);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 5, double);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 6, double);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 4, ceres::Jet<double, 16>);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 5, ceres::Jet<double, 20>);
+BENCHMARK_TEMPLATE(BM_EvaluateLie, 6, ceres::Jet<double, 24>);
+
+BENCHMARK_TEMPLATE(BM_So3Exp, false)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK_TEMPLATE(BM_So3Exp, true)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK_TEMPLATE(BM_So3Log, false)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK_TEMPLATE(BM_So3Log, true)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK(BM_RightJacobianSO3)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK_TEMPLATE(BM_EvaluateTrajectory, 4)->Arg(10);
+BENCHMARK_TEMPLATE(BM_EvaluateTrajectory, 5)->Arg(10);
+BENCHMARK_TEMPLATE(BM_EvaluateTrajectory, 6)->Arg(10);
+BENCHMARK_TEMPLATE(BM_FitKnotsToVisPoses, 6)->Arg(10);
+
+SPLINE_ORDER_BENCHMARK(BM_GyroCostFunctor);
+SPLINE_ORDER_BENCHMARK(BM_AccelerationCostFunctor);
+SPLINE_ORDER_BENCHMARK(BM_ImuCostFunctor);
+SPLINE_ORDER_BENCHMARK(BM_ImuPreintegrationCostFunctor);
+BENCHMARK_TEMPLATE(BM_ImuBatchCostFunctor, 4)->Arg(4)->Arg(16);
+BENCHMARK_TEMPLATE(BM_ImuBatchCostFunctor, 5)->Arg(4)->Arg(16);
+BENCHMARK_TEMPLATE(BM_ImuBatchCostFunctor, 6)->Arg(4)->Arg(16);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 4, false);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 5, false);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 6, false);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 4, true);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 5, true);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 6, true);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 4, true, true);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 5, true, true);
+BENCHMARK_TEMPLATE(BM_ReprojectionCostFunctor, 6, true, true);
+
+BENCHMARK_TEMPLATE(BM_SplineOptimize, 4)
+    ->Args({2, VIEW_RESIDUALS})
+    ->Args({5, VIEW_RESIDUALS})
+    ->Args({5, FEATURE_RESIDUALS})
+    ->Args({5, CHUNK_RESIDUALS})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SplineOptimize, 5)
+    ->Args({2, VIEW_RESIDUALS})
+    ->Args({5, VIEW_RESIDUALS})
+    ->Args({5, FEATURE_RESIDUALS})
+    ->Args({5, CHUNK_RESIDUALS})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SplineOptimize, 6)
+    ->Args({2, VIEW_RESIDUALS})
+    ->Args({5, VIEW_RESIDUALS})
+    ->Args({5, FEATURE_RESIDUALS})
+    ->Args({5, CHUNK_RESIDUALS})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -16,9 +16,16 @@
 #include <gflags/gflags.h>
 
 #include "OpenCameraCalibrator/core/camera_calibrator.h"
-#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
 #include "OpenCameraCalibrator/utils/intrinsic_initializer.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
+
+#include <fstream>
+#include <sstream>
 
 using namespace OpenICC;
 using namespace OpenICC::core;
@@ -35,28 +42,192 @@ DEFINE_string(save_path_calib_dataset,
 DEFINE_double(grid_size,
               0.04,
               "Only take images that are at least grid_size apart");
+DEFINE_int32(max_calibration_views,
+             200,
+             "Bundle adjust at most this many views, selected by board "
+             "coverage and pose diversity. The others validate the result. 0 "
+             "uses all views.");
+DEFINE_int32(max_corners_per_view,
+             0,
+             "Bundle adjust at most this many corners per view, selected "
+             "evenly over the image. 0 uses all corners.");
+DEFINE_double(corner_border_fraction,
+              0.0,
+              "With max_corners_per_view, all corners closer to the image "
+              "border than this fraction of the smaller image side are "
+              "kept.");
+DEFINE_int32(bootstrap_replicas,
+             0,
+             "Bundle adjust this many replicas of the calibrated views drawn "
+             "with replacement and write the spread of the intrinsics to the "
+             "calibration json. 0 disables the bootstrap.");
 DEFINE_bool(optimize_board_points,
             false,
             "If in the end also the scene points should be adjusted. (if the "
             "board is not planar)");
+DEFINE_string(prior_calibration_json,
+              "",
+              "Calibration json of a previous calibration of this camera. "
+              "Poses are initialized with its intrinsics and the staged "
+              "intrinsics optimization is skipped.");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_string(cache_dir,
+              "",
+              "Cache the calibration outputs in this directory, keyed by the "
+              "corner file content and the calibration flags. A run with the "
+              "same key fetches them instead of calibrating. Empty disables "
+              "the cache.");
+DEFINE_string(batch_corners_list,
+              "",
+              "Text file with one corner file per line, optionally followed "
+              "by the output path prefix of its calibration. All cameras are "
+              "calibrated concurrently, one per thread, with the flags above. "
+              "Replaces input_corners.");
+DEFINE_string(batch_output_dir,
+              "",
+              "Output folder of the batch calibrations without an output "
+              "path, they are written to cam_calib_<corner file name>.");
+DEFINE_string(batch_results_csv,
+              "",
+              "Write one row per camera of the batch with its reprojection "
+              "error and intrinsics to this csv file.");
+DEFINE_int32(num_threads,
+             0,
+             "Cameras of a batch calibrated at the same time, 0 uses all "
+             "hardware threads.");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
+
+void ConfigureCalibrator(CameraCalibrator& camera_calibrator,
+                         const theia::Camera* prior_camera) {
+  camera_calibrator.SetGridSize(FLAGS_grid_size);
+  camera_calibrator.SetMaxCalibrationViews(FLAGS_max_calibration_views);
+  utils::CornerSubsamplingOptions corner_subsampling;
+  corner_subsampling.max_corners_per_view = FLAGS_max_corners_per_view;
+  corner_subsampling.border_fraction = FLAGS_corner_border_fraction;
+  camera_calibrator.SetCornerSubsampling(corner_subsampling);
+  CameraBootstrapOptions bootstrap_options;
+  bootstrap_options.num_replicas = FLAGS_bootstrap_replicas;
+  camera_calibrator.SetBootstrap(bootstrap_options);
+  if (prior_camera) {
+    camera_calibrator.SetPriorCamera(*prior_camera);
+  }
+  if (FLAGS_verbose) {
+    camera_calibrator.SetVerbose();
+  }
+}
+
+bool ReadBatchJobs(const std::string& list_path,
+                   std::vector<CameraBatchJob>& jobs) {
+  std::ifstream list_file(list_path);
+  if (!list_file.is_open()) {
+    LOG(ERROR) << "Could not open " << list_path;
+    return false;
+  }
+  std::string line;
+  while (std::getline(list_file, line)) {
+    std::istringstream line_stream(line);
+    CameraBatchJob job;
+    if (!(line_stream >> job.input_corners) || job.input_corners[0] == '#') {
+      continue;
+    }
+    const size_t name_begin = job.input_corners.find_last_of('/') + 1;
+    const size_t name_end = job.input_corners.find_last_of('.');
+    job.name = job.input_corners.substr(
+        name_begin,
+        name_end == std::string::npos || name_end < name_begin
+            ? std::string::npos
+            : name_end - name_begin);
+    if (!(line_stream >> job.output_path)) {
+      job.output_path = FLAGS_batch_output_dir.empty()
+                            ? "cam_calib_" + job.name
+                            : FLAGS_batch_output_dir + "/cam_calib_" + job.name;
+    }
+    jobs.push_back(job);
+  }
+  return !jobs.empty();
+}
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "calibrate_camera");
 
-  nlohmann::json scene_json;
-  CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
+  theia::Camera prior_camera;
+  bool has_prior = false;
+  if (FLAGS_prior_calibration_json != "") {
+    double prior_fps;
+    has_prior = io::read_camera_calibration(
+        FLAGS_prior_calibration_json, prior_camera, prior_fps);
+    if (!has_prior) {
+      LOG(WARNING) << "Could not read " << FLAGS_prior_calibration_json
+                   << ". Calibrating without prior.";
+    }
+  }
+
+  if (FLAGS_batch_corners_list != "") {
+    std::vector<CameraBatchJob> jobs;
+    CHECK(ReadBatchJobs(FLAGS_batch_corners_list, jobs))
+        << "No corner files in " << FLAGS_batch_corners_list;
+    if (FLAGS_num_threads > 0) {
+      OpenICC::utils::Executor::Global().SetMaxConcurrency(FLAGS_num_threads);
+    }
+    std::vector<CameraBatchResult> results;
+    const bool all_calibrated = CalibrateCameraBatch(
+        jobs,
+        FLAGS_camera_model_to_calibrate,
+        FLAGS_optimize_board_points,
+        [&](CameraCalibrator& camera_calibrator) {
+          ConfigureCalibrator(camera_calibrator,
+                              has_prior ? &prior_camera : nullptr);
+        },
+        results);
+    for (const CameraBatchResult& result : results) {
+      std::cout << result.name << ": "
+                << (result.success ? "calibrated" : "failed") << " with "
+                << result.reproj_error << "px from " << result.num_views
+                << " views in " << result.wall_time_s << "s.\n";
+    }
+    if (FLAGS_batch_results_csv != "") {
+      WriteCameraBatchResults(results, FLAGS_batch_results_csv);
+    }
+    return all_calibrated ? 0 : -1;
+  }
+
+  OpenICC::utils::StageCache cache(FLAGS_cache_dir, "calibrate_camera");
+  cache.AddFile(FLAGS_input_corners);
+  cache.AddValue("camera_model", FLAGS_camera_model_to_calibrate);
+  cache.AddValue("grid_size", FLAGS_grid_size);
+  cache.AddValue("max_calibration_views", FLAGS_max_calibration_views);
+  cache.AddValue("max_corners_per_view", FLAGS_max_corners_per_view);
+  cache.AddValue("corner_border_fraction", FLAGS_corner_border_fraction);
+  cache.AddValue("optimize_board_points", FLAGS_optimize_board_points);
+  cache.AddValue("bootstrap_replicas", FLAGS_bootstrap_replicas);
+  cache.AddFile(FLAGS_prior_calibration_json);
+  const std::string& output = FLAGS_save_path_calib_dataset;
+  const std::vector<std::string> outputs{output + ".calibdata",
+                                         output + ".json",
+                                         output + "_ransac_poses.ply",
+                                         output + "_final_poses.ply"};
+  if (!output.empty() && cache.Fetch(outputs)) {
+    return 0;
+  }
+
+  io::MappedScene scene;
+  CHECK(scene.Open(FLAGS_input_corners))
       << "Failed to load " << FLAGS_input_corners;
 
   CameraCalibrator camera_calibrator(FLAGS_camera_model_to_calibrate,
                                      FLAGS_optimize_board_points);
-  camera_calibrator.SetGridSize(FLAGS_grid_size);
-  if (FLAGS_verbose) {
-    camera_calibrator.SetVerbose();
+  ConfigureCalibrator(camera_calibrator, has_prior ? &prior_camera : nullptr);
+  if (camera_calibrator.CalibrateCameraFromScene(
+          scene, FLAGS_save_path_calib_dataset) &&
+      !output.empty()) {
+    cache.Store(outputs);
   }
-  camera_calibrator.CalibrateCameraFromJson(scene_json,
-                                            FLAGS_save_path_calib_dataset);
   camera_calibrator.PrintResult();
 
   return 0;
@@ -0,0 +1,367 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_misc.h"
+#include "OpenCameraCalibrator/utils/build_profile.h"
+#include "OpenCameraCalibrator/utils/cpu_affinity.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/spline_error_weighting.h"
+#include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+#include "theia/io/reconstruction_writer.h"
+#include "theia/sfm/reconstruction.h"
+
+// Runs camera calibration, pose estimation, imu to camera rotation
+// initialization and the spline calibration in one process. The corner files
+// and the telemetry are parsed once and all intermediate results stay in
+// memory.
+
+// Input files.
+DEFINE_string(cam_corners,
+              "",
+              "Corners of the camera calibration video file.");
+DEFINE_string(cam_imu_corners,
+              "",
+              "Corners of the imu to camera calibration video file.");
+DEFINE_string(
+    telemetry_json,
+    "",
+    "Path to gopro telemetry json extracted with Sparsnet extractor.");
+DEFINE_string(imu_bias_file,
+              "",
+              "IMU bias json. If empty, the gyroscope bias is estimated.");
+DEFINE_string(imu_intrinsics,
+              "",
+              "IMU intrinsics, scale and misalignment matrices. E.g. estimated "
+              "with static_imu_calibration or from a datasheet.");
+DEFINE_string(spline_error_weighting_json,
+              "",
+              "Path to spline error weighting data. If empty, knot spacings "
+              "and weighting are estimated from the telemetry.");
+DEFINE_double(q_so3,
+              0.99,
+              "Quality of the rotational spline, i.e. the fraction of the "
+              "gyroscope signal energy it keeps. Only used without "
+              "spline_error_weighting_json.");
+DEFINE_double(q_r3,
+              0.99,
+              "Quality of the translational spline, i.e. the fraction of the "
+              "accelerometer signal energy it keeps. Only used without "
+              "spline_error_weighting_json.");
+// Output files.
+DEFINE_string(save_path_calib_dataset,
+              "",
+              "Where to save the camera calibration to.");
+DEFINE_string(output_pose_dataset,
+              "",
+              "Path to write the pose calibration dataset to. Optional.");
+DEFINE_string(imu_rotation_init_output,
+              "",
+              "Initial gyroscope to camera calibration output path. Optional.");
+DEFINE_string(result_output_json, "", "Path to result json file");
+// Camera calibration.
+DEFINE_string(camera_model_to_calibrate,
+              "DOUBLE_SPHERE",
+              "What camera model do you want to calibrate. Options:"
+              "PINHOLE,PINHOLE_RADIAL_TANGENTIAL,DIVISION_UNDISTORTION,DOUBLE_"
+              "SPHERE,EXTENDED_UNIFIED,FISHEYE");
+DEFINE_double(grid_size,
+              0.04,
+              "Only take images that are at least grid_size apart");
+DEFINE_int32(max_calibration_views,
+             200,
+             "Bundle adjust at most this many views, selected by board "
+             "coverage and pose diversity. The others validate the result. 0 "
+             "uses all views.");
+DEFINE_bool(optimize_board_points,
+            false,
+            "If board points should be optimized during camera calibration "
+            "and after pose estimation.");
+DEFINE_bool(alternating_board_refinement,
+            false,
+            "Refine the board points by alternating parallel point and pose "
+            "updates on a subset of well conditioned views instead of one "
+            "bundle adjustment over all views.");
+DEFINE_int32(max_board_refinement_views,
+             200,
+             "Views used by the alternating board refinement, 0 uses all.");
+DEFINE_bool(independent_pose_refinement,
+            false,
+            "Refine the poses after the board point optimization as one small "
+            "problem per view in parallel instead of one bundle adjustment.");
+// Imu to camera calibration.
+DEFINE_double(delta_t_imu_to_cam,
+              0.0,
+              "Initial time offset guess t_cam=t_imu+delta_t. 0 takes the "
+              "negative first imu timestamp, which is a good guess for GoPro "
+              "cameras.");
+DEFINE_bool(global_shutter, false, "If camera has a global shutter.");
+DEFINE_bool(calibrate_cam_line_delay,
+            false,
+            "If camera rolling shutter line delay should be calibrated.");
+DEFINE_bool(reestimate_biases,
+            false,
+            "If accelerometer and gyroscope biases should be estimated during "
+            "spline optim");
+DEFINE_double(gravity_const, 9.81, "gravity constant");
+DEFINE_string(known_grav_dir_axis,
+              "Z",
+              "Possible values (X,Y,Z,UNKNOWN) if the gravity direction of "
+              "your calibration board is exactly known (e.g. supplying Z we "
+              "will fix gravity to [0,0,gravity_const]. UNKNOWN means it is "
+              "not known and will be estimated.");
+DEFINE_string(solver_profile,
+              "sparse_normal_cholesky",
+              "Linear solver of the spline optimization. Possible values "
+              "(sparse_normal_cholesky, ordered_normal_cholesky, "
+              "sparse_schur, iterative_schur, dense_normal_cholesky, "
+              "dense_schur).");
+DEFINE_string(sparse_backend,
+              "SUITE_SPARSE",
+              "Sparse linear algebra library of the solver (SUITE_SPARSE, "
+              "CX_SPARSE, EIGEN_SPARSE, ACCELERATE_SPARSE).");
+DEFINE_string(dense_backend,
+              "EIGEN",
+              "Dense linear algebra library of the dense solver profiles "
+              "(EIGEN, LAPACK, CUDA). CUDA factorizes on the GPU and needs a "
+              "ceres build with CUDA.");
+DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
+DEFINE_int64(memory_budget_mb,
+             OpenICC::utils::kDefaultMemoryBudgetMb,
+             "Resident memory the process should stay below. Large "
+             "intermediate arrays beyond it are spilled to memory mapped "
+             "files in spill_dir. 0 disables the budget.");
+DEFINE_string(spill_dir,
+              "",
+              "Directory of the spill files, defaults to TMPDIR or /tmp.");
+DEFINE_string(cpu_placement,
+              "",
+              "Run on these cpus, either node:<n> for all cpus of a NUMA node "
+              "or a cpu list like 0-15,32-47. The data is loaded on them, so "
+              "it is allocated on their node.");
+DEFINE_bool(deterministic,
+            false,
+            "Bit-reproducible results independent of the threads. The "
+            "solvers run single threaded.");
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using namespace OpenICC::io;
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::MemoryBudget::Instance().SetBudgetMb(
+      FLAGS_memory_budget_mb);
+  OpenICC::utils::MemoryBudget::Instance().SetSpillDirectory(FLAGS_spill_dir);
+  std::vector<int> cpus;
+  CHECK(OpenICC::utils::ResolveCpuPlacement(FLAGS_cpu_placement, cpus));
+  if (!cpus.empty()) {
+    // pin before anything is loaded, memory is placed on first touch
+    OpenICC::utils::PinCurrentThread(cpus);
+    OpenICC::utils::Executor::Global().SetMaxConcurrency(cpus.size());
+    OpenICC::utils::Executor::Global().SetWorkerCpuSets({cpus});
+  }
+  OpenICC::utils::Executor::Global().SetDeterministic(FLAGS_deterministic);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "calibrate_imu_camera_pipeline");
+
+  SplineWeightingData weight_data;
+  if (FLAGS_spline_error_weighting_json != "") {
+    CHECK(ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json,
+                                   weight_data))
+        << "Could not open " << FLAGS_spline_error_weighting_json;
+  }
+  SplineSolverProfile solver_profile;
+  CHECK(SplineSolverProfileFromString(
+      FLAGS_solver_profile, FLAGS_sparse_backend, solver_profile))
+      << "Invalid solver profile " << FLAGS_solver_profile << " or backend "
+      << FLAGS_sparse_backend;
+  CHECK(SplineDenseBackendFromString(FLAGS_dense_backend, solver_profile))
+      << "Invalid dense backend " << FLAGS_dense_backend;
+
+  // 1. Calibrate camera. The calibration scene is only needed here.
+  theia::Camera camera;
+  double fps;
+  {
+    MappedScene cam_scene;
+    CHECK(cam_scene.Open(FLAGS_cam_corners))
+        << "Failed to load " << FLAGS_cam_corners;
+    CameraCalibrator camera_calibrator(FLAGS_camera_model_to_calibrate,
+                                       FLAGS_optimize_board_points);
+    camera_calibrator.SetGridSize(FLAGS_grid_size);
+    camera_calibrator.SetMaxCalibrationViews(FLAGS_max_calibration_views);
+    if (FLAGS_verbose) {
+      camera_calibrator.SetVerbose();
+    }
+    CHECK(camera_calibrator.CalibrateCameraFromScene(
+        cam_scene, FLAGS_save_path_calib_dataset))
+        << "Camera calibration failed.";
+    camera_calibrator.PrintResult();
+    CHECK(camera_calibrator.GetCalibratedCamera(camera, fps));
+  }
+
+  // 2. Estimate the camera poses of the imu to camera calibration video
+  MappedScene cam_imu_scene;
+  CHECK(cam_imu_scene.Open(FLAGS_cam_imu_corners))
+      << "Failed to load " << FLAGS_cam_imu_corners;
+  theia::Reconstruction pose_dataset;
+  {
+    LOG(INFO) << "Start pose estimation.\n";
+    PoseEstimator pose_estimator;
+    pose_estimator.SetIndependentPoseRefinement(
+        FLAGS_independent_pose_refinement);
+    pose_estimator.SetAlternatingBoardRefinement(
+        FLAGS_alternating_board_refinement, FLAGS_max_board_refinement_views);
+    pose_estimator.EstimatePosesFromScene(cam_imu_scene, camera);
+    if (FLAGS_optimize_board_points) {
+      LOG(INFO) << "Optimizing board points.\n";
+      pose_estimator.OptimizeBoardPoints();
+      pose_estimator.OptimizeAllPoses();
+    }
+    LOG(INFO) << "Filtering bad poses.\n";
+    pose_estimator.FilterBadPoses();
+    pose_estimator.GetPoseDataset(pose_dataset);
+  }
+
+  // 3. Initialize the imu to camera rotation and time offset
+  CameraTelemetryData telemetry_data;
+  CHECK(ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
+      << "Could not read: " << FLAGS_telemetry_json;
+  CHECK(!telemetry_data.gyroscope.empty())
+      << "No gyroscope measurements in " << FLAGS_telemetry_json;
+  if (FLAGS_spline_error_weighting_json == "") {
+    CHECK(OpenICC::utils::SplineWeightingFromTelemetry(
+        telemetry_data,
+        FLAGS_q_so3,
+        FLAGS_q_r3,
+        weight_data,
+        OpenICC::utils::Executor::Global().MaxConcurrency()))
+        << "Could not estimate the spline error weighting from the telemetry.";
+    weight_data.cam_fps = fps;
+    LOG(INFO) << "Estimated knot spacing so3/r3: " << weight_data.dt_so3 << "/"
+              << weight_data.dt_r3 << "s";
+  }
+
+  ImuToCameraRotationEstimator rotation_estimator;
+  Eigen::Vector3d accl_bias(0, 0, 0), gyro_bias(0, 0, 0);
+  if (FLAGS_imu_bias_file != "") {
+    CHECK(ReadIMUBias(FLAGS_imu_bias_file, gyro_bias, accl_bias))
+        << "Could not open " << FLAGS_imu_bias_file;
+  } else {
+    rotation_estimator.EnableGyroBiasEstimation();
+  }
+  const double t_imu_to_cam_0 =
+      FLAGS_delta_t_imu_to_cam != 0.0
+          ? FLAGS_delta_t_imu_to_cam
+          : -telemetry_data.gyroscope[0].timestamp_s();
+  double imu_dt_s = 0.0;
+  CHECK(rotation_estimator.SetMeasurementsFromPoseDataset(
+      pose_dataset, telemetry_data, gyro_bias, t_imu_to_cam_0, imu_dt_s));
+  Eigen::Matrix3d R_imu_to_camera;
+  double time_offset_imu_to_cam;
+  vec3_vector ang_vel, imu_vel;
+  rotation_estimator.EstimateCameraImuRotation(imu_dt_s,
+                                               R_imu_to_camera,
+                                               time_offset_imu_to_cam,
+                                               gyro_bias,
+                                               imu_vel,
+                                               ang_vel);
+  const Eigen::Quaterniond imu2cam(R_imu_to_camera);
+
+  // 4. Continuous time imu to camera calibration
+  auto recon_calib_dataset = std::make_shared<theia::Reconstruction>();
+  CHECK(SplineDatasetFromPoseDataset(
+      pose_dataset, cam_imu_scene, camera, *recon_calib_dataset));
+
+  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
+  CHECK(ReadIMUIntrinsics(
+      FLAGS_imu_intrinsics, FLAGS_imu_bias_file, acc_intr, gyr_intr))
+      << "Could not open " << FLAGS_imu_intrinsics;
+
+  double init_line_delay_s = 1. / fps / camera.ImageHeight();
+  if (FLAGS_global_shutter) {
+    init_line_delay_s = 0.0;
+  }
+
+  ImuCameraCalibrator imu_cam_calibrator;
+  imu_cam_calibrator.SetSolverProfile(solver_profile);
+  imu_cam_calibrator.BatchInitSpline(
+      recon_calib_dataset,
+      Sophus::SE3<double>(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0)),
+      weight_data,
+      time_offset_imu_to_cam,
+      telemetry_data,
+      init_line_delay_s,
+      acc_intr,
+      gyr_intr);
+  const int grav_dir_axis =
+      utils::GravDirStringToInt(FLAGS_known_grav_dir_axis);
+  int flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  if (FLAGS_reestimate_biases) {
+    flags |= SplineOptimFlags::IMU_BIASES;
+  }
+  if (grav_dir_axis != -1) {
+    Eigen::Vector3d grav_dir(0, 0, 0);
+    grav_dir[grav_dir_axis] = FLAGS_gravity_const;
+    imu_cam_calibrator.SetKnownGravityDir(grav_dir);
+  } else {
+    flags |= SplineOptimFlags::GRAVITY_DIR;
+  }
+  double reproj_error = imu_cam_calibrator.Optimize(50, flags);
+  if (FLAGS_calibrate_cam_line_delay && !FLAGS_global_shutter) {
+    reproj_error =
+        imu_cam_calibrator.Optimize(10, SplineOptimFlags::CAM_LINE_DELAY);
+  }
+  LOG(INFO) << "Mean reprojection error " << reproj_error << "px\n";
+
+  // 5. Serialize the results
+  if (FLAGS_output_pose_dataset != "") {
+    CHECK(theia::WriteReconstruction(pose_dataset, FLAGS_output_pose_dataset))
+        << "Could not write " << FLAGS_output_pose_dataset;
+  }
+  if (FLAGS_imu_rotation_init_output != "") {
+    CHECK(WriteIMU2CamInit(FLAGS_imu_rotation_init_output,
+                           gyro_bias,
+                           imu2cam,
+                           time_offset_imu_to_cam))
+        << "Could not write " << FLAGS_imu_rotation_init_output;
+  }
+  CHECK(imu_cam_calibrator.WriteCalibrationResult(
+      FLAGS_result_output_json, reproj_error, time_offset_imu_to_cam))
+      << "Could not write " << FLAGS_result_output_json;
+
+  return 0;
+}
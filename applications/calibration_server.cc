@@ -0,0 +1,294 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <gflags/gflags.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/calibration_service.h"
+#include "OpenCameraCalibrator/utils/build_profile.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+// Keeps the calibration state of one process resident and accepts jobs over
+// tcp. Every line a client sends is one json job (see CalibrationService),
+// every line it receives is one json status message of one of its jobs, e.g.
+//   {"id": 1, "stage": "calibrate_camera", "input_corners": "cam.json",
+//    "save_path_calib_dataset": "cam_calib"}
+// is answered with queued, running, progress and done or failed. With
+// --metrics_port the service metrics are served over http at /metrics in the
+// Prometheus text format and at /metrics.json.
+
+DEFINE_string(bind_address, "127.0.0.1", "Address to listen on.");
+DEFINE_int32(port, 5757, "Port to listen on.");
+DEFINE_int32(num_workers, 1, "Jobs that run at the same time.");
+DEFINE_int32(max_queued_jobs,
+             16,
+             "Jobs waiting for a worker. Further jobs are rejected until a "
+             "worker is free.");
+DEFINE_int32(threads_per_job,
+             0,
+             "Threads of one job. 0 splits the concurrency cap among the "
+             "workers.");
+DEFINE_int32(max_concurrency,
+             0,
+             "Threads that run parallel work of all jobs together. 0 uses "
+             "the hardware threads.");
+DEFINE_bool(deterministic,
+            false,
+            "Bit-reproducible results independent of the threads. The "
+            "solvers run single threaded.");
+DEFINE_bool(numa_placement,
+            false,
+            "Pin worker i and its share of the parallel work to NUMA node "
+            "i % num_nodes, so the memory of its jobs is node local.");
+DEFINE_string(worker_cpu_sets,
+              "",
+              "Cpu sets of the workers separated by ';', e.g. "
+              "\"0-15;16-31\". Overrides numa_placement.");
+DEFINE_int64(memory_budget_mb,
+             OpenICC::utils::kDefaultMemoryBudgetMb,
+             "Resident memory the jobs should stay below. Large intermediate "
+             "arrays beyond it are spilled to memory mapped files in "
+             "spill_dir. 0 disables the budget.");
+DEFINE_string(spill_dir,
+              "",
+              "Directory of the spill files, defaults to TMPDIR or /tmp.");
+DEFINE_int32(metrics_port,
+             0,
+             "Port of the http metrics endpoint, 0 disables it.");
+
+using nlohmann::json;
+
+namespace {
+
+std::atomic<bool> stop_requested(false);
+int listen_fd = -1;
+int metrics_fd = -1;
+
+void HandleStopSignal(int) {
+  stop_requested = true;
+  // unblocks accept
+  shutdown(listen_fd, SHUT_RDWR);
+  if (metrics_fd >= 0) {
+    shutdown(metrics_fd, SHUT_RDWR);
+  }
+}
+
+int ListenOn(const int port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "Could not create socket.";
+  const int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  CHECK_EQ(inet_pton(AF_INET, FLAGS_bind_address.c_str(), &address.sin_addr),
+           1)
+      << "Invalid bind address " << FLAGS_bind_address;
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+           0)
+      << "Could not bind to " << FLAGS_bind_address << ":" << port;
+  CHECK_EQ(listen(fd, 16), 0);
+  return fd;
+}
+
+//! Client socket, shared by the reader thread and the status callbacks of
+//! its jobs, which may outlive the client
+class Connection {
+ public:
+  explicit Connection(const int fd) : fd_(fd) {}
+  ~Connection() { close(fd_); }
+
+  //! Sends one message line, fails silently once the client is gone
+  void Send(const json& message) {
+    const std::string line = message.dump() + "\n";
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    size_t sent = 0;
+    while (sent < line.size()) {
+      const ssize_t n =
+          send(fd_, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        return;
+      }
+      sent += n;
+    }
+  }
+
+  //! Blocks until a full line arrived, false once the client disconnected
+  bool ReadLine(std::string& line) {
+    size_t end;
+    while ((end = buffer_.find('\n')) == std::string::npos) {
+      char chunk[4096];
+      const ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        return false;
+      }
+      buffer_.append(chunk, n);
+    }
+    line = buffer_.substr(0, end);
+    buffer_.erase(0, end + 1);
+    return true;
+  }
+
+  void ShutdownRead() { shutdown(fd_, SHUT_RD); }
+
+ private:
+  const int fd_;
+  std::mutex send_mutex_;
+  std::string buffer_;
+};
+
+void ServeClient(std::shared_ptr<Connection> connection,
+                 OpenICC::core::CalibrationService& service) {
+  std::string line;
+  while (connection->ReadLine(line)) {
+    if (line.empty()) {
+      continue;
+    }
+    json job = json::parse(line, nullptr, false);
+    if (job.is_discarded() || !job.is_object()) {
+      connection->Send({{"status", "rejected"}, {"error", "invalid json"}});
+      continue;
+    }
+    service.Submit(job,
+                   [connection](const json& status) {
+                     connection->Send(status);
+                   });
+  }
+}
+
+void SendAll(const int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+//! Answers GET /metrics and /metrics.json, one request per connection
+void ServeMetrics(OpenICC::core::CalibrationService& service) {
+  while (!stop_requested) {
+    const int client_fd = accept(metrics_fd, nullptr, nullptr);
+    if (client_fd < 0) {
+      continue;
+    }
+    std::string request;
+    char chunk[4096];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.size() < 65536) {
+      const ssize_t n = recv(client_fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        break;
+      }
+      request.append(chunk, n);
+    }
+    const std::string request_line = request.substr(0, request.find('\r'));
+    std::string status = "200 OK";
+    std::string content_type;
+    std::string body;
+    if (request_line.rfind("GET /metrics.json ", 0) == 0) {
+      content_type = "application/json";
+      body = service.MetricsJson().dump();
+    } else if (request_line.rfind("GET /metrics ", 0) == 0) {
+      content_type = "text/plain; version=0.0.4";
+      body = service.MetricsText();
+    } else {
+      status = "404 Not Found";
+      content_type = "text/plain";
+      body = "not found\n";
+    }
+    SendAll(client_fd,
+            "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type +
+                "\r\nContent-Length: " + std::to_string(body.size()) +
+                "\r\nConnection: close\r\n\r\n" + body);
+    close(client_fd);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  listen_fd = ListenOn(FLAGS_port);
+  if (FLAGS_metrics_port > 0) {
+    metrics_fd = ListenOn(FLAGS_metrics_port);
+  }
+  signal(SIGINT, HandleStopSignal);
+  signal(SIGTERM, HandleStopSignal);
+
+  OpenICC::core::CalibrationServiceOptions options;
+  options.num_workers = FLAGS_num_workers;
+  options.max_queued_jobs = FLAGS_max_queued_jobs;
+  options.threads_per_job = FLAGS_threads_per_job;
+  options.max_concurrency = FLAGS_max_concurrency;
+  options.deterministic = FLAGS_deterministic;
+  options.numa_placement = FLAGS_numa_placement;
+  options.worker_cpu_sets = FLAGS_worker_cpu_sets;
+  options.memory_budget_mb = FLAGS_memory_budget_mb;
+  options.spill_dir = FLAGS_spill_dir;
+  options.metrics = FLAGS_metrics_port > 0;
+  OpenICC::core::CalibrationService service(options);
+  LOG(INFO) << "Calibration service listening on " << FLAGS_bind_address
+            << ":" << FLAGS_port;
+  std::thread metrics_thread;
+  if (metrics_fd >= 0) {
+    metrics_thread = std::thread(ServeMetrics, std::ref(service));
+    LOG(INFO) << "Serving metrics on " << FLAGS_bind_address << ":"
+              << FLAGS_metrics_port << "/metrics";
+  }
+
+  std::vector<std::shared_ptr<Connection>> connections;
+  std::vector<std::thread> client_threads;
+  while (!stop_requested) {
+    const int client_fd = accept(listen_fd, nullptr, nullptr);
+    if (client_fd < 0) {
+      continue;
+    }
+    connections.push_back(std::make_shared<Connection>(client_fd));
+    client_threads.emplace_back(
+        ServeClient, connections.back(), std::ref(service));
+  }
+
+  LOG(INFO) << "Stopping, finishing the queued jobs.";
+  for (auto& connection : connections) {
+    connection->ShutdownRead();
+  }
+  for (auto& client_thread : client_threads) {
+    client_thread.join();
+  }
+  if (metrics_thread.joinable()) {
+    metrics_thread.join();
+    close(metrics_fd);
+  }
+  service.Stop();
+  close(listen_fd);
+  return 0;
+}
@@ -13,19 +13,36 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <limits>
 #include <gflags/gflags.h>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
+#include "OpenCameraCalibrator/core/excitation_monitor.h"
 #include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/reprojection_video_renderer.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
 #include "OpenCameraCalibrator/io/read_gopro_imu_json.h"
 #include "OpenCameraCalibrator/io/read_misc.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
-
-#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/build_profile.h"
+#include "OpenCameraCalibrator/utils/corner_subsampling.h"
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/spline_error_weighting.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -33,6 +50,7 @@
 #include "theia/io/reconstruction_writer.h"
 #include "theia/io/write_ply_file.h"
 #include "theia/sfm/reconstruction.h"
+#include "theia/util/timer.h"
 
 // Input/output files.
 DEFINE_string(
@@ -54,20 +72,80 @@ DEFINE_string(imu_intrinsics,
               "with static_imu_calibration or from a datasheet.");
 DEFINE_string(imu_bias_file, "", "IMU bias json");
 DEFINE_bool(global_shutter, false, "If camera has a global shutter.");
+DEFINE_string(rig_cameras_json,
+              "",
+              "Json list of further cameras of the rig that are calibrated "
+              "on the same IMU trajectory. Every entry has the input_corners, "
+              "input_pose_dataset, camera_calibration_json and "
+              "gyro_to_cam_initial_calibration of the camera.");
 
 DEFINE_string(spline_error_weighting_json,
               "",
-              "Path to spline error weighting data");
+              "Path to spline error weighting data. If empty, knot spacings "
+              "and weighting are estimated from the telemetry.");
+DEFINE_double(q_so3,
+              0.98,
+              "Quality of the rotational spline, i.e. the fraction of the "
+              "gyroscope signal energy it keeps. Only used without "
+              "spline_error_weighting_json.");
+DEFINE_double(q_r3,
+              0.96,
+              "Quality of the translational spline, i.e. the fraction of the "
+              "accelerometer signal energy it keeps. Only used without "
+              "spline_error_weighting_json.");
 DEFINE_string(output_path, "", "");
 DEFINE_bool(calibrate_cam_line_delay,
             false,
             "If camera rolling shutter line delay should be calibrated.");
+DEFINE_bool(rigid_board,
+            true,
+            "Keep the board points as constants inside the camera residuals "
+            "instead of parameter blocks. The points are not optimized by "
+            "the spline optimization either way.");
+DEFINE_bool(rotation_only,
+            false,
+            "Only calibrate the gyroscope to camera rotation, time offset and "
+            "line delay. Uses the rotation spline and gyroscope residuals, "
+            "the positions stay at the vision poses and the accelerometer, "
+            "gravity and board points are left out.");
+DEFINE_int32(max_corners_per_view,
+             0,
+             "Add at most this many corners per view to the camera residuals, "
+             "selected evenly over the image. 0 uses all corners.");
+DEFINE_double(corner_border_fraction,
+              0.0,
+              "With max_corners_per_view, all corners closer to the image "
+              "border than this fraction of the smaller image side are "
+              "kept.");
+DEFINE_string(camera_residual_layout,
+              "view",
+              "Residual blocks of the reprojection errors: view (one dynamic "
+              "autodiff block per view), feature (one fixed-size block per "
+              "feature) or chunk (fixed-size blocks of 4 features).");
+DEFINE_bool(linearize_rolling_shutter,
+            false,
+            "Evaluate the spline once per view at the center row and move "
+            "the features to their rows with constant velocities. The "
+            "reported reprojection error uses the exact rolling shutter "
+            "model.");
 DEFINE_string(result_output_json, "", "Path to result json file");
-DEFINE_double(max_t, 1000., "Maximum nr of seconds to take");
+DEFINE_double(start_t,
+              0.,
+              "First second of the telemetry and the views to read.");
+DEFINE_double(max_t,
+              0.,
+              "Seconds after --start_t to read, 0 reads up to the end. Only "
+              "this range of binary telemetry and of the corners is "
+              "decoded.");
 DEFINE_bool(reestimate_biases,
             false,
             "If accelerometer and gyroscope biases should be estimated during "
             "spline optim");
+DEFINE_double(bias_spline_dt_s,
+              10.0,
+              "Knot spacing of the accelerometer and gyroscope bias splines "
+              "in seconds. 0 estimates one constant bias per sensor for the "
+              "recording.");
 DEFINE_double(gravity_const, 9.81, "gravity constant");
 DEFINE_string(known_grav_dir_axis,
               "Z",
@@ -75,9 +153,247 @@ DEFINE_string(known_grav_dir_axis,
               "your calibration board is exactly known (e.g. supplying Z we "
               "will fix gravity to [0,0,gravity_const]. UNKNOWN means it is "
               "not known and will be estimated.");
+DEFINE_bool(analytic_imu_jacobians,
+            true,
+            "Use closed-form Jacobians for the IMU residuals. Set to false to "
+            "use the autodiff reference implementation.");
+DEFINE_bool(float_imu_jacobians,
+            false,
+            "Compute the spline knot Jacobians of the analytic IMU residuals "
+            "in single precision. Residuals stay double precision.");
+DEFINE_bool(share_knot_evaluations,
+            false,
+            "Compute the rotation knot differences once per solver "
+            "evaluation for all analytic IMU residuals. Disables the inner "
+            "iterations of the solver.");
+DEFINE_bool(batch_imu_residuals,
+            true,
+            "Add all IMU samples of a spline segment as one residual block.");
+DEFINE_bool(fuse_imu_residuals,
+            true,
+            "Add the gyroscope and accelerometer sample of a timestamp as one "
+            "residual that evaluates the rotation spline once.");
+DEFINE_bool(imu_preintegration,
+            false,
+            "Preintegrate the IMU samples of a spline segment into one "
+            "rotation and velocity factor. Keeps the IMU intrinsics fixed.");
+DEFINE_int32(knot_spacing_levels,
+             1,
+             "Number of knot spacings to optimize from coarse to fine. Each "
+             "level doubles the spacing of the next finer one.");
+DEFINE_double(gate_outliers_mads,
+              0.0,
+              "Before every spline solve that follows another one, remove "
+              "the residual blocks whose RMS error lies more than this many "
+              "median absolute deviations above the median. 0 disables it.");
+DEFINE_double(gate_max_reprojection_error,
+              0.0,
+              "Also remove camera residual blocks above this RMS "
+              "reprojection error in pixels when gating. 0 disables it.");
+DEFINE_double(imu_decimation_rate,
+              OpenICC::utils::kDefaultImuDecimationRateHz,
+              "Average the IMU samples down to this rate in Hz before adding "
+              "them as residuals, with weights that keep their information. "
+              "0 adds every sample.");
+DEFINE_int32(max_views_per_knot_interval,
+             0,
+             "Keep at most this many views per knot interval as camera "
+             "residuals, selected by board coverage, feature count and "
+             "motion. 0 keeps all views.");
+DEFINE_bool(fit_knots_to_poses,
+            false,
+            "Initialize the spline by a least squares fit to the vision "
+            "poses and the gyroscope samples instead of interpolating the "
+            "poses.");
+DEFINE_int32(knot_fit_iterations,
+             5,
+             "Gauss-Newton iterations of the rotation knot fit.");
+DEFINE_bool(init_grid_search,
+            false,
+            "Start the optimization from the best line delay and imu to "
+            "camera time offset of a grid around the initial values, "
+            "evaluated on the initialized spline.");
+DEFINE_int32(init_grid_line_delays,
+             11,
+             "Line delay candidates of the grid search between 0.25 and "
+             "1.25 times the initial line delay.");
+DEFINE_int32(init_grid_time_offsets,
+             21,
+             "Time offset candidates of the grid search.");
+DEFINE_double(init_grid_time_offset_range_s,
+              0.02,
+              "The time offset candidates lie within +- this many seconds of "
+              "the initial time offset.");
+DEFINE_double(fixed_lag_window_s,
+              0.0,
+              "Length of the fixed-lag optimization window in seconds. 0 "
+              "optimizes the whole spline at once.");
+DEFINE_double(fixed_lag_step_s,
+              0.0,
+              "Step the fixed-lag window advances in seconds. Defaults to the "
+              "window length.");
+DEFINE_double(decomposition_segment_s,
+              0.0,
+              "Length of the segments in seconds whose spline knots are "
+              "solved in parallel, alternating with a solve of the shared "
+              "calibration parameters. 0 optimizes the whole spline at once.");
+DEFINE_double(decomposition_overlap_s,
+              1.0,
+              "Measurements of this many seconds before and after a segment "
+              "enter its solve.");
+DEFINE_int32(decomposition_rounds,
+             2,
+             "Number of segment and shared parameter solve rounds.");
+DEFINE_int32(decomposition_sample_stride,
+             10,
+             "Only every n-th view and IMU sample enters the solve of the "
+             "shared parameters.");
+DEFINE_int32(spline_iterations,
+             50,
+             "Iterations of the main spline optimization. Can be lowered or "
+             "set to 0 when resuming from --load_spline_state.");
+DEFINE_string(save_spline_state,
+              "",
+              "Write the spline knots and calibration parameters after the "
+              "optimization to this binary file.");
+DEFINE_string(load_spline_state,
+              "",
+              "Resume from a --save_spline_state file of the same recording "
+              "and spline settings instead of the spline initialization.");
+DEFINE_string(warm_start_spline_state,
+              "",
+              "Initialize T_i_c, the line delay and the IMU intrinsics from "
+              "the --save_spline_state file of another recording of the "
+              "same rig.");
+DEFINE_string(solver_profile,
+              "sparse_normal_cholesky",
+              "Linear solver of the spline optimization. Possible values "
+              "(sparse_normal_cholesky, ordered_normal_cholesky, "
+              "sparse_schur, iterative_schur, dense_normal_cholesky, "
+              "dense_schur). ordered_normal_cholesky "
+              "orders points first, then bias knots, then pose knots.");
+DEFINE_string(sparse_backend,
+              "SUITE_SPARSE",
+              "Sparse linear algebra library of the solver (SUITE_SPARSE, "
+              "CX_SPARSE, EIGEN_SPARSE, ACCELERATE_SPARSE).");
+DEFINE_string(dense_backend,
+              "EIGEN",
+              "Dense linear algebra library of the dense solver profiles "
+              "(EIGEN, LAPACK, CUDA). CUDA factorizes on the GPU and needs a "
+              "ceres build with CUDA.");
+DEFINE_bool(profile_residuals,
+            false,
+            "Print evaluation count and time of every residual kind (gs/rs "
+            "reprojection, accelerometer, gyroscope, ...) after each spline "
+            "solve.");
+DEFINE_bool(compute_covariance,
+            false,
+            "Compute the marginal covariance of T_i_c, the line delay and the "
+            "IMU intrinsics after the batch solve and write their standard "
+            "deviations to the result json.");
+DEFINE_int32(bootstrap_replicas,
+             0,
+             "Solve this many replicas of the calibration on blocks of the "
+             "recording resampled with replacement and write the spread of "
+             "T_i_c, the line delay and the IMU intrinsics to the result "
+             "json. 0 disables the bootstrap.");
+DEFINE_double(bootstrap_block_s,
+              2.0,
+              "Length of the blocks the bootstrap resamples in seconds.");
+DEFINE_double(min_reprojection_improvement,
+              0.0,
+              "Stop a spline solve if the mean reprojection error improved by "
+              "less than this fraction over the last convergence_window "
+              "iterations. 0 runs the full iteration budget.");
+DEFINE_int32(convergence_window,
+             3,
+             "Number of successful iterations min_reprojection_improvement "
+             "is measured over.");
+DEFINE_double(target_reprojection_error,
+              0.0,
+              "Stop a spline solve once the mean reprojection error in pixels "
+              "is below this value. 0 disables it.");
+DEFINE_string(graduated_loss_widths,
+              "",
+              "Comma separated, shrinking Huber widths of the camera "
+              "residuals in pixels, e.g. 16,4,1. The first spline solve runs "
+              "a stage per width and keeps the last one. Empty disables it.");
+DEFINE_int32(graduated_loss_iterations,
+             5,
+             "Maximum iterations of every graduated loss stage but the last.");
+DEFINE_bool(print_iteration_progress,
+            false,
+            "Print cost, mean reprojection error and step norm after every "
+            "spline solver iteration.");
 DEFINE_string(debug_video_path,
               "",
               "Load the video to display the reprojection error.");
+DEFINE_string(debug_video_output,
+              "",
+              "Encode the debug video to this file instead of showing every "
+              "frame in a window.");
+DEFINE_int32(debug_video_num_threads,
+             std::thread::hardware_concurrency(),
+             "Number of threads that render the debug video frames.");
+DEFINE_int32(debug_video_frame_step,
+             1,
+             "Render only every k-th frame of the debug video.");
+DEFINE_double(debug_video_start_s,
+              0.0,
+              "Start of the rendered debug video window in seconds.");
+DEFINE_double(debug_video_end_s,
+              0.0,
+              "End of the rendered debug video window in seconds, 0 renders "
+              "until the end of the video.");
+DEFINE_int32(debug_video_max_frames,
+             500,
+             "Maximum number of rendered debug video frames, 0 renders all.");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
+DEFINE_int64(memory_budget_mb,
+             OpenICC::utils::kDefaultMemoryBudgetMb,
+             "Resident memory the process should stay below. Large "
+             "intermediate arrays beyond it are spilled to memory mapped "
+             "files in spill_dir. 0 disables the budget.");
+DEFINE_string(spill_dir,
+              "",
+              "Directory of the spill files, defaults to TMPDIR or /tmp.");
+
+DEFINE_bool(trim_to_sufficient_data,
+            false,
+            "Drop the views after the point at which the excitation, board "
+            "coverage and information on T_i_c, line delay and intrinsics "
+            "are sufficient, see ExcitationMonitorOptions.");
+DEFINE_string(export_trajectory,
+              "",
+              "Write the pose, angular velocity, acceleration and IMU biases "
+              "of the optimized spline to this binary file, see "
+              "SplineTrajectoryEstimator::ExportTrajectory.");
+DEFINE_string(export_trajectory_times,
+              "imu",
+              "Timestamps of --export_trajectory: imu, camera or a sample "
+              "rate in Hz.");
+DEFINE_string(sweep_json,
+              "",
+              "Json of spline configurations to run concurrently on the data "
+              "loaded once, a list of objects or an object of value lists "
+              "whose cartesian product is run. Keys: dt_so3, dt_r3, std_so3, "
+              "std_r3, calibrate_cam_line_delay, reestimate_biases, "
+              "bias_spline_dt_s, knot_spacing_levels, spline_iterations. "
+              "Prints the runs ranked "
+              "by reprojection error instead of writing a calibration.");
+DEFINE_string(sweep_output_json,
+              "",
+              "Write the ranked table of --sweep_json to this file.");
+DEFINE_int32(sweep_parallel_runs,
+             0,
+             "Number of sweep configurations solved at the same time, they "
+             "share the threads. 0 runs as many as there are threads.");
+DEFINE_string(export_trajectory_compression,
+              "none",
+              "Chunk compression of --export_trajectory: none, zstd or lz4.");
 
 using json = nlohmann::json;
 
@@ -88,70 +404,384 @@ using namespace OpenICC::core;
 using namespace OpenICC::utils;
 using namespace OpenICC::io;
 
+namespace {
+
+//! Applies the solver, residual and initialization flags to a calibrator
+void ConfigureCalibrator(const double time_offset_imu_to_cam,
+                         ImuCameraCalibrator& calibrator) {
+  calibrator.SetUseAnalyticImuJacobians(FLAGS_analytic_imu_jacobians);
+  calibrator.SetUseFloatImuJacobians(FLAGS_float_imu_jacobians);
+  calibrator.SetShareKnotEvaluations(FLAGS_share_knot_evaluations);
+  calibrator.SetBatchImuResiduals(FLAGS_batch_imu_residuals);
+  calibrator.SetFuseImuResiduals(FLAGS_fuse_imu_residuals);
+  calibrator.SetLinearizeRollingShutter(FLAGS_linearize_rolling_shutter);
+  calibrator.SetRigidBoard(FLAGS_rigid_board);
+  calibrator.SetRotationOnly(FLAGS_rotation_only);
+  calibrator.SetBiasSplineKnotSpacing(FLAGS_bias_spline_dt_s,
+                                      FLAGS_bias_spline_dt_s);
+  calibrator.SetCameraResidualLayout(
+      StringToCameraResidualLayout(FLAGS_camera_residual_layout));
+  calibrator.SetUseImuPreintegration(FLAGS_imu_preintegration);
+  calibrator.SetFixedLagWindow(FLAGS_fixed_lag_window_s,
+                               FLAGS_fixed_lag_step_s);
+  calibrator.SetDomainDecomposition(FLAGS_decomposition_segment_s,
+                                    FLAGS_decomposition_overlap_s,
+                                    FLAGS_decomposition_rounds,
+                                    FLAGS_decomposition_sample_stride);
+  calibrator.SetKnotSpacingLevels(FLAGS_knot_spacing_levels);
+  calibrator.SetMaxViewsPerKnotInterval(FLAGS_max_views_per_knot_interval);
+  calibrator.SetImuDecimationRate(FLAGS_imu_decimation_rate);
+  OutlierGatingOptions gating_options;
+  gating_options.num_mads = FLAGS_gate_outliers_mads;
+  gating_options.max_camera_rms_px = FLAGS_gate_max_reprojection_error;
+  calibrator.SetOutlierGating(FLAGS_gate_outliers_mads > 0.0,
+                              gating_options);
+  KnotFitOptions knot_fit_options;
+  knot_fit_options.so3_iterations = FLAGS_knot_fit_iterations;
+  calibrator.SetFitKnotsToPoses(FLAGS_fit_knots_to_poses, knot_fit_options);
+  InitGridSearchOptions grid_search_options;
+  grid_search_options.num_line_delays = FLAGS_init_grid_line_delays;
+  grid_search_options.num_time_offsets = FLAGS_init_grid_time_offsets;
+  grid_search_options.time_offset_range_s = FLAGS_init_grid_time_offset_range_s;
+  calibrator.SetInitGridSearch(FLAGS_init_grid_search, grid_search_options);
+  if (!FLAGS_warm_start_spline_state.empty()) {
+    CHECK(calibrator.SetWarmStartSplineState(FLAGS_warm_start_spline_state))
+        << "Could not read " << FLAGS_warm_start_spline_state;
+  }
+  SplineSolverProfile solver_profile;
+  CHECK(SplineSolverProfileFromString(
+      FLAGS_solver_profile, FLAGS_sparse_backend, solver_profile))
+      << "Invalid solver profile " << FLAGS_solver_profile << " or backend "
+      << FLAGS_sparse_backend;
+  CHECK(SplineDenseBackendFromString(FLAGS_dense_backend, solver_profile))
+      << "Invalid dense backend " << FLAGS_dense_backend;
+  calibrator.SetSolverProfile(solver_profile);
+  calibrator.SetProfileResiduals(FLAGS_profile_residuals);
+  SplineConvergenceCriteria convergence_criteria;
+  convergence_criteria.min_relative_reprojection_improvement =
+      FLAGS_min_reprojection_improvement;
+  convergence_criteria.window = FLAGS_convergence_window;
+  convergence_criteria.target_reprojection_error =
+      FLAGS_target_reprojection_error;
+  calibrator.SetConvergenceCriteria(convergence_criteria);
+  std::vector<double> graduated_loss_widths;
+  std::stringstream widths_stream(FLAGS_graduated_loss_widths);
+  std::string width;
+  while (std::getline(widths_stream, width, ',')) {
+    graduated_loss_widths.push_back(std::stod(width));
+  }
+  calibrator.SetGraduatedCameraLoss(graduated_loss_widths,
+                                    FLAGS_graduated_loss_iterations);
+  if (FLAGS_print_iteration_progress) {
+    calibrator.SetIterationCallback(
+        [](const SplineIterationSummary& iteration) {
+          std::cout << "Spline iteration " << iteration.iteration
+                    << " cost: " << iteration.cost
+                    << " step norm: " << iteration.step_norm;
+          if (iteration.reprojection_error >= 0.0) {
+            std::cout << " reprojection error: "
+                      << iteration.reprojection_error << "px";
+          }
+          std::cout << "\n";
+          return true;
+        });
+  }
+  if (!FLAGS_rig_cameras_json.empty()) {
+    std::ifstream rig_cameras_file(FLAGS_rig_cameras_json);
+    CHECK(rig_cameras_file.is_open())
+        << "Could not open " << FLAGS_rig_cameras_json;
+    for (const auto& rig_camera : json::parse(rig_cameras_file)) {
+      CHECK(calibrator.AddRigCameraFromFiles(
+          rig_camera.value("input_corners", ""),
+          rig_camera.value("input_pose_dataset", ""),
+          rig_camera.value("camera_calibration_json", ""),
+          rig_camera.value("gyro_to_cam_initial_calibration", ""),
+          time_offset_imu_to_cam,
+          FLAGS_global_shutter))
+          << "Could not add the rig camera " << rig_camera.dump();
+    }
+  }
+}
+
+//! Optimization flags of the main spline solve. Fixes the gravity direction
+//! if it is known
+int SplineOptimizationFlags(ImuCameraCalibrator& calibrator,
+                            const bool reestimate_biases) {
+  const int grav_dir_axis = GravDirStringToInt(FLAGS_known_grav_dir_axis);
+  int flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  if (FLAGS_rotation_only) {
+    // no accelerometer residuals observe the gravity or accelerometer bias
+    return reestimate_biases ? flags | SplineOptimFlags::GYR_BIAS : flags;
+  }
+  if (reestimate_biases) {
+    flags |= SplineOptimFlags::IMU_BIASES;
+  }
+  if (grav_dir_axis != -1) {
+    Eigen::Vector3d grav_dir(0, 0, 0);
+    grav_dir[grav_dir_axis] = FLAGS_gravity_const;
+    calibrator.SetKnownGravityDir(grav_dir);
+    std::cout << "Setting a-priori gravity direction supplied by the user to: "
+              << grav_dir.transpose() << "\n";
+  } else {
+    flags |= SplineOptimFlags::GRAVITY_DIR;
+  }
+  return flags;
+}
+
+//! Data of a sweep, loaded once and shared read only by all runs
+struct SweepInputs {
+  std::shared_ptr<theia::Reconstruction> vision_dataset;
+  const CameraTelemetryData* telemetry_data = nullptr;
+  SplineWeightingData weight_data;
+  Sophus::SE3<double> T_i_c_init;
+  double time_offset_imu_to_cam = 0.0;
+  double init_line_delay_s = 0.0;
+  ThreeAxisSensorCalibParams<double> acc_intr;
+  ThreeAxisSensorCalibParams<double> gyr_intr;
+};
+
+struct SweepRun {
+  json configuration;
+  bool success = false;
+  double reprojection_error = std::numeric_limits<double>::max();
+  double gyro_rms = 0.0;
+  double accl_rms = 0.0;
+  double line_delay_us = 0.0;
+  double runtime_s = 0.0;
+};
+
+const char* const kSweepKeys[] = {"dt_so3",
+                                  "dt_r3",
+                                  "std_so3",
+                                  "std_r3",
+                                  "calibrate_cam_line_delay",
+                                  "reestimate_biases",
+                                  "bias_spline_dt_s",
+                                  "knot_spacing_levels",
+                                  "spline_iterations"};
+
+//! A sweep is a list of configuration objects or an object that maps every
+//! swept key to a list of values, whose cartesian product is run. Keys
+//! missing from a configuration keep the value of the flags
+bool ExpandSweep(const json& sweep, std::vector<json>& configurations) {
+  configurations.clear();
+  if (sweep.is_array()) {
+    configurations.assign(sweep.begin(), sweep.end());
+  } else if (sweep.is_object()) {
+    configurations.push_back(json::object());
+    for (const auto& key_values : sweep.items()) {
+      const json values = key_values.value().is_array()
+                              ? key_values.value()
+                              : json::array({key_values.value()});
+      std::vector<json> expanded;
+      for (const json& configuration : configurations) {
+        for (const json& value : values) {
+          expanded.push_back(configuration);
+          expanded.back()[key_values.key()] = value;
+        }
+      }
+      configurations.swap(expanded);
+    }
+  } else {
+    LOG(ERROR) << "A sweep is a list or an object of lists";
+    return false;
+  }
+  for (const json& configuration : configurations) {
+    if (!configuration.is_object()) {
+      LOG(ERROR) << "Sweep configuration " << configuration.dump()
+                 << " is not an object";
+      return false;
+    }
+    for (const auto& key_value : configuration.items()) {
+      if (std::find(std::begin(kSweepKeys),
+                    std::end(kSweepKeys),
+                    key_value.key()) == std::end(kSweepKeys)) {
+        LOG(ERROR) << "Unknown sweep key " << key_value.key();
+        return false;
+      }
+    }
+  }
+  return !configurations.empty();
+}
+
+void RunSweepConfiguration(const SweepInputs& inputs,
+                           const int num_threads,
+                           SweepRun& run) {
+  utils::ScopedStageTimer stage_timer("RunSweepConfiguration");
+  theia::Timer timer;
+  const json& configuration = run.configuration;
+  SplineWeightingData weight_data = inputs.weight_data;
+  weight_data.dt_so3 = configuration.value("dt_so3", weight_data.dt_so3);
+  weight_data.dt_r3 = configuration.value("dt_r3", weight_data.dt_r3);
+  weight_data.std_so3 = configuration.value("std_so3", weight_data.std_so3);
+  weight_data.std_r3 = configuration.value("std_r3", weight_data.std_r3);
+
+  ImuCameraCalibrator calibrator;
+  ConfigureCalibrator(inputs.time_offset_imu_to_cam, calibrator);
+  calibrator.SetKnotSpacingLevels(
+      configuration.value("knot_spacing_levels", FLAGS_knot_spacing_levels));
+  const double bias_spline_dt_s =
+      configuration.value("bias_spline_dt_s", FLAGS_bias_spline_dt_s);
+  calibrator.SetBiasSplineKnotSpacing(bias_spline_dt_s, bias_spline_dt_s);
+  // the runs share the board points, they have to stay constants
+  calibrator.SetRigidBoard(true);
+  calibrator.trajectory_.SetNumThreads(num_threads);
+  calibrator.BatchInitSpline(inputs.vision_dataset,
+                             inputs.T_i_c_init,
+                             weight_data,
+                             inputs.time_offset_imu_to_cam,
+                             *inputs.telemetry_data,
+                             inputs.init_line_delay_s,
+                             inputs.acc_intr,
+                             inputs.gyr_intr);
+  const int flags = SplineOptimizationFlags(
+      calibrator,
+      configuration.value("reestimate_biases", FLAGS_reestimate_biases));
+  run.reprojection_error = calibrator.Optimize(
+      configuration.value("spline_iterations", FLAGS_spline_iterations),
+      flags);
+  if (configuration.value("calibrate_cam_line_delay",
+                          FLAGS_calibrate_cam_line_delay) &&
+      !FLAGS_global_shutter) {
+    run.reprojection_error =
+        calibrator.Optimize(10, SplineOptimFlags::CAM_LINE_DELAY);
+  }
+  run.success = std::isfinite(run.reprojection_error) &&
+                calibrator.GetImuResidualRms(run.gyro_rms, run.accl_rms);
+  run.line_delay_us = calibrator.GetCalibratedRSLineDelay() * S_TO_US;
+  run.runtime_s = timer.ElapsedTimeInSeconds();
+}
+
+//! Runs the configurations of --sweep_json concurrently, ranks them by the
+//! reprojection error and writes the table to --sweep_output_json
+bool RunSweep(const SweepInputs& inputs) {
+  std::ifstream sweep_file(FLAGS_sweep_json);
+  if (!sweep_file.is_open()) {
+    LOG(ERROR) << "Could not open " << FLAGS_sweep_json;
+    return false;
+  }
+  std::vector<json> configurations;
+  if (!ExpandSweep(json::parse(sweep_file, nullptr, false), configurations)) {
+    LOG(ERROR) << "Invalid sweep " << FLAGS_sweep_json;
+    return false;
+  }
+  const int max_threads = utils::Executor::Global().MaxConcurrency();
+  const int num_parallel_runs = std::min<int>(
+      configurations.size(),
+      FLAGS_sweep_parallel_runs > 0 ? FLAGS_sweep_parallel_runs : max_threads);
+  const int threads_per_run = std::max(1, max_threads / num_parallel_runs);
+  LOG(INFO) << "Sweeping " << configurations.size() << " configurations, "
+            << num_parallel_runs << " at a time on " << threads_per_run
+            << " threads each";
+
+  std::vector<SweepRun> runs(configurations.size());
+  for (size_t i = 0; i < runs.size(); ++i) {
+    runs[i].configuration = configurations[i];
+  }
+  // runs take very different times, the workers pull the next one
+  std::atomic<size_t> next_run(0);
+  utils::ParallelFor(
+      num_parallel_runs, num_parallel_runs, [&](size_t, size_t, int) {
+        for (size_t i = next_run++; i < runs.size(); i = next_run++) {
+          RunSweepConfiguration(inputs, threads_per_run, runs[i]);
+        }
+      });
+
+  std::stable_sort(
+      runs.begin(), runs.end(), [](const SweepRun& a, const SweepRun& b) {
+        if (a.success != b.success) return a.success;
+        return a.reprojection_error < b.reprojection_error;
+      });
+  json table = json::array();
+  std::cout << "rank reprojection[px] gyro_rms[rad/s] accl_rms[m/s^2] "
+               "line_delay[us] runtime[s] configuration\n";
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const SweepRun& run = runs[i];
+    std::cout << i + 1 << " ";
+    if (run.success) {
+      std::cout << run.reprojection_error << " " << run.gyro_rms << " "
+                << run.accl_rms << " " << run.line_delay_us << " ";
+    } else {
+      std::cout << "failed - - - ";
+    }
+    std::cout << run.runtime_s << " " << run.configuration.dump() << "\n";
+    table.push_back({{"rank", i + 1},
+                     {"configuration", run.configuration},
+                     {"success", run.success},
+                     {"reprojection_error", run.reprojection_error},
+                     {"gyro_rms", run.gyro_rms},
+                     {"accl_rms", run.accl_rms},
+                     {"line_delay_us", run.line_delay_us},
+                     {"runtime_s", run.runtime_s}});
+  }
+  if (!FLAGS_sweep_output_json.empty()) {
+    std::ofstream output(FLAGS_sweep_output_json);
+    if (!output.is_open()) {
+      LOG(ERROR) << "Could not write " << FLAGS_sweep_output_json;
+      return false;
+    }
+    output << table.dump(2);
+  }
+  return true;
+}
+
+}  // namespace
+
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "continuous_time_imu_to_camera_calibration");
+  OpenICC::utils::MemoryBudget::Instance().SetBudgetMb(
+      FLAGS_memory_budget_mb);
+  OpenICC::utils::MemoryBudget::Instance().SetSpillDirectory(FLAGS_spill_dir);
 
   // Get pose dataset
-  theia::Reconstruction pose_dataset;
-  CHECK(theia::ReadReconstruction(FLAGS_input_pose_dataset, &pose_dataset))
+  auto pose_dataset = std::make_unique<theia::Reconstruction>();
+  CHECK(theia::ReadReconstruction(FLAGS_input_pose_dataset, pose_dataset.get()))
       << "Could not read Reconstruction file.";
-  nlohmann::json scene_json;
-  CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
-      << "Failed to load " << FLAGS_input_corners;
-
+  // time range of the telemetry and the views
+  const double t_begin_s = FLAGS_start_t > 0.0
+                               ? FLAGS_start_t
+                               : std::numeric_limits<double>::lowest();
+  const double t_end_s = FLAGS_max_t > 0.0
+                             ? FLAGS_start_t + FLAGS_max_t
+                             : std::numeric_limits<double>::max();
   theia::Camera camera;
   double fps;
   CHECK(io::read_camera_calibration(FLAGS_camera_calibration_json, camera, fps))
       << "Could not read camera calibration: " << FLAGS_camera_calibration_json;
 
-  // fill tracks. we use the ones from pose estimation because they might have
-  // been optimized (to account for non planarity of the target)
-  theia::Reconstruction recon_calib_dataset;
-  // io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset);
-  for (const auto& old_track_id : pose_dataset.TrackIds()) {
-    recon_calib_dataset.AddTrack(old_track_id);
-    theia::Track* new_track = recon_calib_dataset.MutableTrack(old_track_id);
-    const theia::Track* old_track = pose_dataset.Track(old_track_id);
-    Eigen::Vector4d* new_point = new_track->MutablePoint();
-    for (int j = 0; j < 4; ++j) {
-      (*new_point)[j] = old_track->Point()[j];
-    }
+  // poses and corners are combined once, only the indexed views of the time
+  // range are parsed. The calibration and the debug video share the result,
+  // the calibrator optimizes on it without a copy
+  auto recon_calib_dataset = std::make_shared<theia::Reconstruction>();
+  {
+    io::MappedScene scene;
+    CHECK(scene.Open(FLAGS_input_corners))
+        << "Failed to load " << FLAGS_input_corners;
+    CHECK(SplineDatasetFromPoseDataset(*pose_dataset,
+                                       scene,
+                                       camera,
+                                       *recon_calib_dataset,
+                                       t_begin_s,
+                                       t_end_s));
   }
-  for (const auto& view : scene_json["views"].items()) {
-    const double timestamp_us = std::stod(view.key());
-    const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
-    std::string view_name = std::to_string((uint64_t)timestamp_us);
-    theia::ViewId view_id =
-        recon_calib_dataset.AddView(view_name, 0, timestamp_s);
-
-    theia::ViewId old_view_id = pose_dataset.ViewIdFromName(view_name);
-    if (old_view_id == theia::kInvalidViewId) {
-      recon_calib_dataset.RemoveView(view_id);
-      continue;
-    }
-    theia::View* view_new = recon_calib_dataset.MutableView(view_id);
-    theia::Camera* mutable_cam = view_new->MutableCamera();
-    const theia::Camera cam_old = pose_dataset.View(old_view_id)->Camera();
-    mutable_cam->SetOrientationFromAngleAxis(
-        cam_old.GetOrientationAsAngleAxis());
-    mutable_cam->SetPosition(cam_old.GetPosition());
-    mutable_cam->SetFromCameraIntrinsicsPriors(
-        camera.CameraIntrinsicsPriorFromIntrinsics());
-
-    const auto image_points = view.value()["image_points"];
-    for (const auto& img_pts : image_points.items()) {
-      const int board_pt3_id = std::stoi(img_pts.key());
-      const Eigen::Vector2d corner(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-      Eigen::Matrix2d cov = Eigen::Matrix2d::Identity();
-      theia::Feature feat(corner, cov);
-      recon_calib_dataset.AddObservation(view_id, board_pt3_id, feat);
-    }
+  if (FLAGS_max_corners_per_view > 0) {
+    utils::CornerSubsamplingOptions corner_subsampling;
+    corner_subsampling.max_corners_per_view = FLAGS_max_corners_per_view;
+    corner_subsampling.border_fraction = FLAGS_corner_border_fraction;
+    LOG(INFO) << "Removed "
+              << utils::SubsampleViewCorners(corner_subsampling,
+                                             *recon_calib_dataset)
+              << " corners beyond " << FLAGS_max_corners_per_view
+              << " per view.";
   }
+  // converted, drop it before the telemetry and the problem
+  pose_dataset.reset();
 
   // read gopro telemetry
   CameraTelemetryData telemetry_data;
-  CHECK(ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
+  CHECK(ReadTelemetry(FLAGS_telemetry_json, t_begin_s, t_end_s, telemetry_data))
       << "Could not read: " << FLAGS_telemetry_json;
 
   // read a gyro to cam calibration json to initialize rotation between imu and
@@ -163,26 +793,81 @@ int main(int argc, char* argv[]) {
       << "Could not read: " << FLAGS_gyro_to_cam_initial_calibration;
   Sophus::SE3<double> T_i_c_init(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0));
 
+  if (FLAGS_trim_to_sufficient_data) {
+    ExcitationMonitorOptions excitation_options;
+    excitation_options.focal_length_px = camera.FocalLength();
+    excitation_options.image_width = camera.ImageWidth();
+    excitation_options.image_height = camera.ImageHeight();
+    excitation_options.check_line_delay = !FLAGS_global_shutter;
+    double end_time_s;
+    ExcitationReport excitation_report;
+    if (FindSufficientDataEnd(telemetry_data,
+                              *recon_calib_dataset,
+                              time_offset_imu_to_cam,
+                              excitation_options,
+                              end_time_s,
+                              excitation_report)) {
+      for (const theia::ViewId view_id : recon_calib_dataset->ViewIds()) {
+        if (recon_calib_dataset->View(view_id)->GetTimestamp() > end_time_s) {
+          recon_calib_dataset->RemoveView(view_id);
+        }
+      }
+      std::cout << "Data is sufficient after " << end_time_s
+                << "s, keeping " << recon_calib_dataset->NumViews()
+                << " views.\n";
+    } else {
+      std::cout << "Data never becomes sufficient, using all views: "
+                << excitation_report.ToJson().dump() << "\n";
+    }
+  }
+
   // Read a imu intrinsics
   ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
   CHECK(ReadIMUIntrinsics(
       FLAGS_imu_intrinsics, FLAGS_imu_bias_file, acc_intr, gyr_intr))
       << "Could not open " << FLAGS_imu_intrinsics;
   std::cout << "Loaded IMU intrinsics.\n";
-  CHECK(FLAGS_spline_error_weighting_json != "")
-      << "You need to provide spline error weighting factors. Create with "
-         "get_sew_for_dataset.py.";
   SplineWeightingData weight_data;
-  CHECK(
-      ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json, weight_data))
-      << "Could not open " << FLAGS_spline_error_weighting_json;
+  if (FLAGS_spline_error_weighting_json != "") {
+    CHECK(ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json,
+                                   weight_data))
+        << "Could not open " << FLAGS_spline_error_weighting_json;
+  } else {
+    CHECK(utils::SplineWeightingFromTelemetry(
+        telemetry_data,
+        FLAGS_q_so3,
+        FLAGS_q_r3,
+        weight_data,
+        utils::Executor::Global().MaxConcurrency()))
+        << "Could not estimate the spline error weighting from the telemetry.";
+    weight_data.cam_fps = fps;
+    std::cout << "Estimated knot spacing so3/r3: " << weight_data.dt_so3 << "/"
+              << weight_data.dt_r3 << "s, weighting factors so3/r3: "
+              << weight_data.std_so3 << "/" << weight_data.std_r3 << "\n";
+  }
 
   double init_line_delay_us = 1. / fps / camera.ImageHeight();
   if (FLAGS_global_shutter) {
     init_line_delay_us = 0.0;
   }
 
+  if (!FLAGS_sweep_json.empty()) {
+    CHECK(FLAGS_rig_cameras_json.empty() && FLAGS_load_spline_state.empty())
+        << "A sweep does not support rig cameras or a resumed spline state.";
+    SweepInputs sweep_inputs;
+    sweep_inputs.vision_dataset = recon_calib_dataset;
+    sweep_inputs.telemetry_data = &telemetry_data;
+    sweep_inputs.weight_data = weight_data;
+    sweep_inputs.T_i_c_init = T_i_c_init;
+    sweep_inputs.time_offset_imu_to_cam = time_offset_imu_to_cam;
+    sweep_inputs.init_line_delay_s = init_line_delay_us;
+    sweep_inputs.acc_intr = acc_intr;
+    sweep_inputs.gyr_intr = gyr_intr;
+    return RunSweep(sweep_inputs) ? 0 : 1;
+  }
+
   ImuCameraCalibrator imu_cam_calibrator;
+  ConfigureCalibrator(time_offset_imu_to_cam, imu_cam_calibrator);
   imu_cam_calibrator.BatchInitSpline(recon_calib_dataset,
                                      T_i_c_init,
                                      weight_data,
@@ -191,28 +876,74 @@ int main(int argc, char* argv[]) {
                                      init_line_delay_us,
                                      acc_intr,
                                      gyr_intr);
-  const int grav_dir_axis = GravDirStringToInt(FLAGS_known_grav_dir_axis);
-  int flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
-  if (FLAGS_reestimate_biases) {
-    flags |= SplineOptimFlags::IMU_BIASES;
-  }
-  if (grav_dir_axis != -1) {
-    Eigen::Vector3d grav_dir(0, 0, 0);
-    grav_dir[grav_dir_axis] = FLAGS_gravity_const;
-    imu_cam_calibrator.SetKnownGravityDir(grav_dir);
-    std::cout << "Setting a-priori gravity direction supplied by the user to: "
-              << grav_dir.transpose() << "\n";
-  } else {
-    flags |= SplineOptimFlags::GRAVITY_DIR;
+  int flags =
+      SplineOptimizationFlags(imu_cam_calibrator, FLAGS_reestimate_biases);
+
+  if (!FLAGS_load_spline_state.empty()) {
+    CHECK(imu_cam_calibrator.LoadSplineState(FLAGS_load_spline_state))
+        << "Could not resume from " << FLAGS_load_spline_state;
   }
 
-  double reproj_error = imu_cam_calibrator.Optimize(50, flags);
+  double reproj_error =
+      imu_cam_calibrator.Optimize(FLAGS_spline_iterations, flags);
 
   double reproj_error_after_ld = reproj_error;
   if (FLAGS_calibrate_cam_line_delay && !FLAGS_global_shutter) {
     flags = SplineOptimFlags::CAM_LINE_DELAY;
     reproj_error_after_ld = imu_cam_calibrator.Optimize(10, flags);
   }
+  if (FLAGS_compute_covariance &&
+      !imu_cam_calibrator.ComputeCalibrationCovariance()) {
+    LOG(WARNING) << "Could not compute the calibration covariance.";
+  }
+  if (FLAGS_bootstrap_replicas > 0) {
+    ImuCameraBootstrapOptions bootstrap_options;
+    bootstrap_options.num_replicas = FLAGS_bootstrap_replicas;
+    bootstrap_options.block_s = FLAGS_bootstrap_block_s;
+    if (!imu_cam_calibrator.Bootstrap(bootstrap_options)) {
+      LOG(WARNING) << "Could not bootstrap the calibration.";
+    }
+  }
+  if (!FLAGS_save_spline_state.empty()) {
+    CHECK(imu_cam_calibrator.SaveSplineState(FLAGS_save_spline_state))
+        << "Could not write " << FLAGS_save_spline_state;
+  }
+  if (!FLAGS_export_trajectory.empty()) {
+    io::ChunkCodec codec;
+    CHECK(io::ParseChunkCodec(FLAGS_export_trajectory_compression, codec))
+        << "Unknown compression " << FLAGS_export_trajectory_compression;
+    std::vector<int64_t> export_times_ns;
+    if (FLAGS_export_trajectory_times == "imu" ||
+        FLAGS_export_trajectory_times == "camera") {
+      const std::vector<double> times_s =
+          FLAGS_export_trajectory_times == "imu"
+              ? imu_cam_calibrator.GetImuTimestamps()
+              : imu_cam_calibrator.GetCamTimestamps();
+      for (const double t_s : times_s) {
+        export_times_ns.push_back(SecondsToNs(t_s));
+      }
+      std::sort(export_times_ns.begin(), export_times_ns.end());
+    } else {
+      const double rate_hz = std::atof(FLAGS_export_trajectory_times.c_str());
+      CHECK_GT(rate_hz, 0.0) << "Unknown --export_trajectory_times "
+                             << FLAGS_export_trajectory_times;
+      const int64_t min_t_ns = imu_cam_calibrator.trajectory_.GetMinTimeNs();
+      const int64_t max_t_ns = imu_cam_calibrator.trajectory_.GetMaxTimeNs();
+      const double dt_ns = S_TO_NS / rate_hz;
+      for (int64_t i = 0; min_t_ns + i * dt_ns <= max_t_ns; ++i) {
+        export_times_ns.push_back(min_t_ns + i * dt_ns);
+      }
+    }
+    CHECK(imu_cam_calibrator.trajectory_.ExportTrajectory(
+        FLAGS_export_trajectory,
+        export_times_ns,
+        SAMPLE_POSE | SAMPLE_ANGULAR_VELOCITY | SAMPLE_ACCELERATION |
+            SAMPLE_BIASES,
+        codec))
+        << "Could not write " << FLAGS_export_trajectory;
+    LOG(INFO) << "Exported " << export_times_ns.size()
+              << " trajectory samples to " << FLAGS_export_trajectory;
+  }
   LOG(INFO) << "Mean reprojection error " << reproj_error << "px\n";
   LOG(INFO) << "Mean reprojection error after line delay optim "
             << reproj_error_after_ld << "px\n";
@@ -235,101 +966,38 @@ int main(int argc, char* argv[]) {
             << q_i_c.y() << " " << q_i_c.z() << std::endl;
   std::cout << "T_i_c t: " << t_i_c.transpose() << std::endl;
   std::cout << "T_i_c R: " << q_i_c.matrix() << std::endl;
-  std::cout << "Initialized line delay [us]: " << init_line_delay_us * S_TO_US
-            << "\n";
+  std::cout << "Initialized line delay [us]: "
+            << imu_cam_calibrator.GetInitialRSLineDelay() * S_TO_US << "\n";
   std::cout << "Calibrated line delay [us]: " << calib_line_delay_us << "\n";
-  nlohmann::json json_calibspline_results_out;
-
-  json_calibspline_results_out["q_i_c"]["w"] = q_i_c.w();
-  json_calibspline_results_out["q_i_c"]["x"] = q_i_c.x();
-  json_calibspline_results_out["q_i_c"]["y"] = q_i_c.y();
-  json_calibspline_results_out["q_i_c"]["z"] = q_i_c.z();
-  json_calibspline_results_out["t_i_c"]["x"] = t_i_c[0];
-  json_calibspline_results_out["t_i_c"]["y"] = t_i_c[1];
-  json_calibspline_results_out["t_i_c"]["z"] = t_i_c[2];
-  json_calibspline_results_out["final_reproj_error"] = reproj_error;
-  json_calibspline_results_out["r3_dt"] = weight_data.dt_r3;
-  json_calibspline_results_out["so3_dt"] = weight_data.dt_so3;
-  json_calibspline_results_out["init_line_delay_us"] =
-      init_line_delay_us * S_TO_US;
-  json_calibspline_results_out["calib_line_delay_us"] = calib_line_delay_us;
-  json_calibspline_results_out["time_offset_imu_to_cam_s"] =
-      time_offset_imu_to_cam;
+  for (int c = 1; c < imu_cam_calibrator.trajectory_.GetNumCameras(); ++c) {
+    const Sophus::SE3d T_i_c = imu_cam_calibrator.trajectory_.GetCameraT_i_c(c);
+    const Eigen::Quaterniond q = T_i_c.so3().unit_quaternion();
+    std::cout << "Rig camera " << c << " T_i_c qw,qx,qy,qz: " << q.w() << " "
+              << q.x() << " " << q.y() << " " << q.z()
+              << " t: " << T_i_c.translation().transpose() << "\n";
+  }
 
   std::vector<double> cam_timestamps_s = imu_cam_calibrator.GetCamTimestamps();
   std::sort(cam_timestamps_s.begin(), cam_timestamps_s.end(), std::less<>());
 
-  aligned_map<double, Eigen::Vector3d> gyro_meas =
-      imu_cam_calibrator.GetGyroMeasurements();
-  aligned_map<double, Eigen::Vector3d> accl_meas =
-      imu_cam_calibrator.GetAcclMeasurements();
-
-  // Evaluate spline for all accelerometer and gyro and output them
-  for (auto& g : gyro_meas) {
-    const int64_t t_ns = g.first * S_TO_NS;
-    const std::string t_ns_s = std::to_string(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["x"] =
-        g.second[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["y"] =
-        g.second[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["z"] =
-        g.second[2];
-    // write out spline estimates
-    Eigen::Vector3d gyro_spline;
-    imu_cam_calibrator.trajectory_.GetAngularVelocity(t_ns, gyro_spline);
-    const auto bias = imu_cam_calibrator.trajectory_.GetGyroBias(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["x"] =
-        gyro_spline[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["y"] =
-        gyro_spline[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["z"] =
-        gyro_spline[2];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["x"] =
-        bias[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["y"] =
-        bias[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["z"] =
-        bias[2];
-  }
-  for (auto& a : accl_meas) {
-    const int64_t t_ns = a.first * S_TO_NS;
-    const std::string t_ns_s = std::to_string(t_ns);
-    // accelerometer
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["x"] =
-        a.second[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["y"] =
-        a.second[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["z"] =
-        a.second[2];
-    // write out spline estimates
-    Eigen::Vector3d accl_spline;
-    imu_cam_calibrator.trajectory_.GetAcceleration(t_ns, accl_spline);
-    const auto bias = imu_cam_calibrator.trajectory_.GetAcclBias(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["x"] =
-        accl_spline[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["y"] =
-        accl_spline[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["z"] =
-        accl_spline[2];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["x"] =
-        bias[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["y"] =
-        bias[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["z"] =
-        bias[2];
-  }
-
-  std::ofstream calibspline_output_json_file(FLAGS_result_output_json);
-  calibspline_output_json_file << std::setw(4) << json_calibspline_results_out
-                               << std::endl;
-  calibspline_output_json_file.close();
+  CHECK(imu_cam_calibrator.WriteCalibrationResult(
+      FLAGS_result_output_json,
+      reproj_error,
+      imu_cam_calibrator.GetTimeOffsetImuToCam()))
+      << "Could not write " << FLAGS_result_output_json;
 
   // read camera calibration
   theia::Reconstruction output_spline_recon;
+  std::vector<int64_t> cam_timestamps_ns(cam_timestamps_s.size());
+  for (size_t i = 0; i < cam_timestamps_s.size(); ++i) {
+    cam_timestamps_ns[i] = SecondsToNs(cam_timestamps_s[i]);
+  }
+  OpenICC::core::TrajectorySamples cam_poses;
+  imu_cam_calibrator.trajectory_.EvaluateTrajectory(
+      cam_timestamps_ns, OpenICC::core::SAMPLE_POSE, cam_poses);
   for (size_t i = 0; i < cam_timestamps_s.size(); ++i) {
-    const int64_t t_ns = cam_timestamps_s[i] * S_TO_NS;
-    Sophus::SE3d T_w_i;
-    imu_cam_calibrator.trajectory_.GetPose(t_ns, T_w_i);
+    const int64_t t_ns = cam_timestamps_ns[i];
+    const Sophus::SE3d T_w_i = cam_poses.Pose(i);
     Sophus::SE3d T_w_c = T_w_i * imu_cam_calibrator.trajectory_.GetT_i_c();
     theia::ViewId v_id_theia =
         output_spline_recon.AddView(std::to_string(t_ns), 0, t_ns);
@@ -352,98 +1020,42 @@ int main(int argc, char* argv[]) {
                             2));
   CHECK(theia::WritePlyFile(
       FLAGS_output_path + "/" + "sparse_recon_calib_dataset.ply",
-      recon_calib_dataset,
+      *recon_calib_dataset,
       cam_recon_calib_color,
       2));
 
   if (FLAGS_debug_video_path != "") {
-    nlohmann::json scene_json;
-    CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
-        << "Failed to load " << FLAGS_input_corners;
-
-    theia::Reconstruction recon_calib_dataset;
-
-    io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset);
-    for (const auto& view : scene_json["views"].items()) {
-      const double timestamp_us = std::stod(view.key());
-      const double timestamp_s = timestamp_us * 1e-6;  // to seconds
-      const auto image_points = view.value()["image_points"];
-      std::string view_name = std::to_string((uint64_t)(timestamp_s * S_TO_NS));
-      theia::ViewId view_id =
-          recon_calib_dataset.AddView(view_name, 0, timestamp_s);
-
-      for (const auto& img_pts : image_points.items()) {
-        const int board_pt3_id = std::stoi(img_pts.key());
-        const Eigen::Vector2d corner(
-            Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-        Eigen::Matrix2d cov;
-        cov << 0.5, 0, 0, 0.5;
-        const theia::Feature feat(corner, cov);
-        recon_calib_dataset.AddObservation(view_id, board_pt3_id, feat);
-      }
+    // spline camera poses of all calibration views in one batch
+    const std::vector<theia::ViewId> corner_view_ids =
+        recon_calib_dataset->ViewIds();
+    std::vector<int64_t> corner_timestamps_ns(corner_view_ids.size());
+    for (size_t i = 0; i < corner_view_ids.size(); ++i) {
+      corner_timestamps_ns[i] = SecondsToNs(
+          recon_calib_dataset->View(corner_view_ids[i])->GetTimestamp());
     }
-    VideoCapture input_video;
-    input_video.open(FLAGS_debug_video_path);
-    int cnt_wrong = 0;
-    int nr_frames = 0;
-    while (true) {
-      Mat image;
-      if (!input_video.read(image)) {
-        cnt_wrong++;
-        if (cnt_wrong > 500) break;
-        continue;
-      }
-
-      const double timstamp_s =
-          input_video.get(cv::CAP_PROP_POS_MSEC) * MS_TO_S;
-
-      const int64_t t_ns = timstamp_s * S_TO_NS;
-
-      const theia::ViewId view_id_spline =
-          output_spline_recon.ViewIdFromName(std::to_string(t_ns));
-      const theia::ViewId view_id_calib =
-          recon_calib_dataset.ViewIdFromName(std::to_string(t_ns));
-
-      if (view_id_spline == theia::kInvalidViewId &&
-          view_id_calib == theia::kInvalidViewId)
-        continue;
-
-      theia::View* view_spline =
-          output_spline_recon.MutableView(view_id_spline);
-      const theia::View* view_calib = recon_calib_dataset.View(view_id_calib);
-      if (!view_spline || !view_calib) continue;
-      cv::resize(
-          image, image, cv::Size(camera.ImageWidth(), camera.ImageHeight()));
-
-      double reproj_error = 0.0;
-      for (size_t i = 0; i < view_calib->TrackIds().size(); ++i) {
-        theia::TrackId id = view_calib->TrackIds()[i];
-        Eigen::Vector2d pixel;
-        view_spline->Camera().ProjectPoint(
-            recon_calib_dataset.Track(id)->Point(), &pixel);
-        const theia::Feature measurement = (*view_calib->GetFeature(id));
-        cv::drawMarker(image,
-                       cv::Point(cvRound(pixel[0]), cvRound(pixel[1])),
-                       cv::Scalar(0, 0, 255),
-                       cv::MARKER_CROSS,
-                       10,
-                       1);
-
-        reproj_error += (measurement.point_ - pixel).norm();
-      }
-      reproj_error /= (double)view_calib->TrackIds().size();
-      cv::putText(
-          image,
-          "Reprojection error: " + std::to_string(reproj_error) + " pixel",
-          cv::Point(20, 20),
-          cv::FONT_HERSHEY_COMPLEX_SMALL,
-          1.0,
-          cv::Scalar(255, 0, 0));
-      cv::imshow("spline reprojection", image);
-      cv::waitKey(0);
-      ++nr_frames;
-      if (nr_frames > 500) break;
+    OpenICC::core::TrajectorySamples corner_poses;
+    imu_cam_calibrator.trajectory_.EvaluateTrajectory(
+        corner_timestamps_ns, OpenICC::core::SAMPLE_POSE, corner_poses);
+    std::unordered_map<theia::ViewId, Sophus::SE3d> T_w_c;
+    for (size_t i = 0; i < corner_view_ids.size(); ++i) {
+      if (!corner_poses.valid[i]) continue;
+      T_w_c[corner_view_ids[i]] =
+          corner_poses.Pose(i) * imu_cam_calibrator.trajectory_.GetT_i_c();
     }
+
+    ReprojectionVideoOptions video_options;
+    video_options.num_threads = FLAGS_debug_video_num_threads;
+    video_options.frame_step = FLAGS_debug_video_frame_step;
+    video_options.start_s = FLAGS_debug_video_start_s;
+    video_options.end_s = FLAGS_debug_video_end_s;
+    video_options.max_frames = FLAGS_debug_video_max_frames;
+    video_options.output_path = FLAGS_debug_video_output;
+    CHECK(RenderReprojectionVideo(FLAGS_debug_video_path,
+                                  *recon_calib_dataset,
+                                  T_w_c,
+                                  camera,
+                                  video_options))
+        << "Could not render the debug video.";
   }
   return 0;
 }
@@ -0,0 +1,59 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/observation_dataset.h"
+
+using namespace OpenICC;
+
+DEFINE_string(input_corners, "", "Path to the extracted corners (ubjson).");
+DEFINE_string(output_observations,
+              "",
+              "Where to write the binary columnar observation dataset to.");
+DEFINE_string(compression,
+              "none",
+              "Block compression of the output: none, zstd or lz4. "
+              "Compressed files are chunked, so readers can decompress in "
+              "parallel and read time ranges.");
+DEFINE_int32(chunk_views,
+             static_cast<int>(io::kObservationViewsPerChunk),
+             "Views per compressed chunk.");
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  io::ChunkCodec codec;
+  CHECK(io::ParseChunkCodec(FLAGS_compression, codec))
+      << "Unknown compression " << FLAGS_compression;
+
+  io::MappedScene scene;
+  CHECK(scene.Open(FLAGS_input_corners))
+      << "Failed to load " << FLAGS_input_corners;
+
+  io::ObservationDataset dataset;
+  CHECK(io::SceneToObservationDataset(scene, dataset))
+      << "Failed to convert " << FLAGS_input_corners;
+  CHECK(io::WriteObservationDataset(
+      FLAGS_output_observations, dataset, codec, FLAGS_chunk_views))
+      << "Failed to write " << FLAGS_output_observations;
+
+  LOG(INFO) << "Converted " << dataset.NumViews() << " views with "
+            << dataset.NumObservations() << " observations.";
+  return 0;
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <string>
+
+#include "OpenCameraCalibrator/io/read_gpmf.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/read_telemetry_lines.h"
+
+using namespace OpenICC;
+
+DEFINE_string(input_telemetry, "", "Path to the input telemetry.");
+DEFINE_string(input_format,
+              "auto",
+              "Format of the input telemetry: csv (t_ns, gyro, accl rows), "
+              "zed_jsonl (ZED recorder log), json, binary, gopro_mp4 or auto. "
+              "auto picks csv and zed_jsonl by the file extension and detects "
+              "the other formats from the file content.");
+DEFINE_string(output_telemetry,
+              "",
+              "Where to write the binary telemetry file to.");
+DEFINE_string(compression,
+              "none",
+              "Block compression of the output: none, zstd or lz4. "
+              "Compressed files are chunked, so readers can decompress in "
+              "parallel and read time ranges.");
+DEFINE_int32(chunk_samples,
+             static_cast<int>(io::kTelemetrySamplesPerChunk),
+             "Imu samples per compressed chunk.");
+
+namespace {
+
+bool HasExtension(const std::string& path, const std::string& extension) {
+  return path.size() >= extension.size() &&
+         path.compare(path.size() - extension.size(),
+                      extension.size(),
+                      extension) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::string format = FLAGS_input_format;
+  if (format == "auto") {
+    if (HasExtension(FLAGS_input_telemetry, ".csv")) {
+      format = "csv";
+    } else if (HasExtension(FLAGS_input_telemetry, ".jsonl")) {
+      format = "zed_jsonl";
+    }
+  }
+
+  io::ChunkCodec codec;
+  CHECK(io::ParseChunkCodec(FLAGS_compression, codec))
+      << "Unknown compression " << FLAGS_compression;
+
+  // samples go straight from the parser to the output file
+  io::TelemetryBinaryWriter writer;
+  writer.SetCompression(codec, FLAGS_chunk_samples);
+  CHECK(writer.Open(FLAGS_output_telemetry))
+      << "Could not write: " << FLAGS_output_telemetry;
+  bool parsed = false;
+  if (format == "csv") {
+    parsed = io::StreamTelemetryCSV(FLAGS_input_telemetry, writer);
+  } else if (format == "zed_jsonl") {
+    parsed = io::StreamZedTelemetryJSONL(FLAGS_input_telemetry, writer);
+  } else if (format == "json") {
+    parsed = io::StreamTelemetryJSON(FLAGS_input_telemetry, writer);
+  } else if (format == "binary") {
+    parsed = io::StreamTelemetryBinary(FLAGS_input_telemetry, writer);
+  } else if (format == "gopro_mp4") {
+    parsed = io::StreamGoProMP4Telemetry(FLAGS_input_telemetry, writer);
+  } else if (format == "auto") {
+    parsed = io::StreamTelemetry(FLAGS_input_telemetry, writer);
+  } else {
+    LOG(FATAL) << "Unknown telemetry format " << FLAGS_input_format;
+  }
+  CHECK(parsed) << "Could not read: " << FLAGS_input_telemetry;
+  CHECK(writer.Close()) << "Could not write: " << FLAGS_output_telemetry;
+
+  LOG(INFO) << "Converted " << writer.NumDatapoints() << " imu samples.";
+  return 0;
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+
+using namespace OpenICC;
+
+DEFINE_string(telemetry_json,
+              "",
+              "Path to the telemetry json or a GoPro MP4 with GPMF telemetry.");
+DEFINE_string(output_telemetry,
+              "",
+              "Where to write the binary telemetry file to.");
+DEFINE_string(compression,
+              "none",
+              "Block compression of the output: none, zstd or lz4. "
+              "Compressed files are chunked, so readers can decompress in "
+              "parallel and read time ranges.");
+DEFINE_int32(chunk_samples,
+             static_cast<int>(io::kTelemetrySamplesPerChunk),
+             "Imu samples per compressed chunk.");
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  io::ChunkCodec codec;
+  CHECK(io::ParseChunkCodec(FLAGS_compression, codec))
+      << "Unknown compression " << FLAGS_compression;
+
+  CameraTelemetryData telemetry_data;
+  CHECK(io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
+      << "Could not read: " << FLAGS_telemetry_json;
+  CHECK(io::WriteTelemetryBinary(FLAGS_output_telemetry,
+                                 telemetry_data,
+                                 codec,
+                                 FLAGS_chunk_samples))
+      << "Could not write: " << FLAGS_output_telemetry;
+
+  LOG(INFO) << "Converted " << telemetry_data.accelerometer.size()
+            << " imu samples.";
+  return 0;
+}
@@ -20,8 +20,10 @@
 
 #include "OpenCameraCalibrator/core/pose_estimator.h"
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
-#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
 #include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 #include <theia/io/reconstruction_writer.h>
@@ -39,13 +41,66 @@ DEFINE_string(output_pose_dataset,
 DEFINE_bool(optimize_board_points,
             false,
             "If board points should be optimized.");
+DEFINE_bool(alternating_board_refinement,
+            false,
+            "Refine the board points by alternating parallel point and pose "
+            "updates on a subset of well conditioned views instead of one "
+            "bundle adjustment over all views.");
+DEFINE_int32(max_board_refinement_views,
+             200,
+             "Views used by the alternating board refinement, 0 uses all.");
+DEFINE_bool(independent_pose_refinement,
+            false,
+            "Refine the poses after the board point optimization as one small "
+            "problem per view in parallel instead of one bundle adjustment.");
+DEFINE_double(undistortion_map_cell_px,
+              0.0,
+              "Undistort the corners for the pose estimation through a lookup "
+              "table of the camera sampled every this many pixels instead of "
+              "the iterative undistortion of the camera model, 0 disables "
+              "it.");
+DEFINE_string(cache_dir,
+              "",
+              "Cache the pose dataset in this directory, keyed by the corner "
+              "and camera calibration content. A run with the same key "
+              "fetches it instead of estimating the poses. Empty disables "
+              "the cache.");
+DEFINE_bool(pose_tracking,
+            false,
+            "Start the pose of a view from the pose of the previous frame and "
+            "only run RANSAC if the refined pose gates too many corners.");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "estimate_camera_poses_from_checkerboard");
+
+  OpenICC::utils::StageCache cache(FLAGS_cache_dir,
+                                   "estimate_camera_poses_from_checkerboard");
+  cache.AddFile(FLAGS_input_corners);
+  cache.AddFile(FLAGS_camera_calibration_json);
+  cache.AddValue("optimize_board_points", FLAGS_optimize_board_points);
+  cache.AddValue("independent_pose_refinement",
+                 FLAGS_independent_pose_refinement);
+  cache.AddValue("alternating_board_refinement",
+                 FLAGS_alternating_board_refinement);
+  cache.AddValue("max_board_refinement_views",
+                 FLAGS_max_board_refinement_views);
+  cache.AddValue("undistortion_map_cell_px", FLAGS_undistortion_map_cell_px);
+  cache.AddValue("pose_tracking", FLAGS_pose_tracking);
+  const std::vector<std::string> outputs{FLAGS_output_pose_dataset,
+                                         FLAGS_output_pose_dataset + ".ply"};
+  if (cache.Fetch(outputs)) {
+    return 0;
+  }
 
-  nlohmann::json scene_json;
-  CHECK(read_scene_bson(FLAGS_input_corners, scene_json))
+  MappedScene scene;
+  CHECK(scene.Open(FLAGS_input_corners))
       << "Failed to load " << FLAGS_input_corners;
 
   // read camera calibration
@@ -56,7 +111,13 @@ int main(int argc, char* argv[]) {
 
   LOG(INFO) << "Start pose estimation.\n";
   PoseEstimator pose_estimator;
-  pose_estimator.EstimatePosesFromJson(scene_json, camera);
+  pose_estimator.SetIndependentPoseRefinement(
+      FLAGS_independent_pose_refinement);
+  pose_estimator.SetAlternatingBoardRefinement(
+      FLAGS_alternating_board_refinement, FLAGS_max_board_refinement_views);
+  pose_estimator.SetUndistortionMapCellSize(FLAGS_undistortion_map_cell_px);
+  pose_estimator.SetPoseTracking(FLAGS_pose_tracking);
+  pose_estimator.EstimatePosesFromScene(scene, camera);
   LOG(INFO) << "Finished pose estimation.\n";
   if (FLAGS_optimize_board_points) {
     LOG(INFO) << "Optimizing board points.\n";
@@ -73,6 +134,7 @@ int main(int argc, char* argv[]) {
                       pose_dataset,
                       Eigen::Vector3i(255, 0, 0),
                       2);
+  cache.Store(outputs);
 
   return 0;
 }
@@ -19,13 +19,17 @@
 #include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
 #include "OpenCameraCalibrator/io/read_misc.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_misc.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 #include "theia/io/reconstruction_reader.h"
 #include "theia/sfm/reconstruction.h"
 
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
 
 using json = nlohmann::json;
 
@@ -52,10 +56,61 @@ DEFINE_double(delta_t_imu_to_cam,
               0.0,
               "You can supply a time offset guess if you have one available. "
               "t_cam=t_imu+delta_t.");
+DEFINE_string(smoothing_filter,
+              "moving_average",
+              "Filter for the angular velocities before the estimation: "
+              "moving_average, savitzky_golay or butterworth.");
+DEFINE_int32(smoothing_window,
+             15,
+             "Window in samples of the moving average and Savitzky-Golay "
+             "filter.");
+DEFINE_double(smoothing_cutoff,
+              0.05,
+              "Cutoff of the Butterworth filter as a fraction of the imu "
+              "sample rate.");
+DEFINE_int32(ransac_hypotheses,
+             0,
+             "Fit the rotation with a RANSAC over time windows of the angular "
+             "velocities, robust to segments with tracking loss. Number of "
+             "hypotheses, 0 fits the rotation to all samples.");
+DEFINE_double(ransac_window_s,
+              1.0,
+              "Length of the RANSAC time windows in seconds.");
+DEFINE_double(ransac_inlier_threshold,
+              0.1,
+              "RMS angular velocity residual in rad/s below which a window is "
+              "an inlier.");
+DEFINE_string(cache_dir,
+              "",
+              "Cache the rotation initialization in this directory, keyed by "
+              "the pose dataset, telemetry and bias content and the time "
+              "offset guess. A run with the same key fetches it instead of "
+              "estimating it. Empty disables the cache.");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "estimate_imu_to_camera_rotation");
+
+  StageCache cache(FLAGS_cache_dir, "estimate_imu_to_camera_rotation");
+  cache.AddFile(FLAGS_input_pose_calibration_dataset);
+  cache.AddFile(FLAGS_telemetry_json);
+  cache.AddFile(FLAGS_imu_bias_estimate);
+  cache.AddValue("delta_t_imu_to_cam", FLAGS_delta_t_imu_to_cam);
+  cache.AddValue("smoothing_filter", FLAGS_smoothing_filter);
+  cache.AddValue("smoothing_window", FLAGS_smoothing_window);
+  cache.AddValue("smoothing_cutoff", FLAGS_smoothing_cutoff);
+  cache.AddValue("ransac_hypotheses", FLAGS_ransac_hypotheses);
+  cache.AddValue("ransac_window_s", FLAGS_ransac_window_s);
+  cache.AddValue("ransac_inlier_threshold", FLAGS_ransac_inlier_threshold);
+  if (cache.Fetch({FLAGS_imu_rotation_init_output})) {
+    return 0;
+  }
 
   // Load camera calibration reconstuction.
   theia::Reconstruction pose_dataset;
@@ -63,6 +118,17 @@ int main(int argc, char* argv[]) {
                                   &pose_dataset));
 
   ImuToCameraRotationEstimator rotation_estimator;
+  SmoothingFilterOptions smoothing_options;
+  smoothing_options.type = StringToSmoothingFilterType(FLAGS_smoothing_filter);
+  smoothing_options.window = FLAGS_smoothing_window;
+  smoothing_options.cutoff = FLAGS_smoothing_cutoff;
+  rotation_estimator.SetSmoothingFilter(smoothing_options);
+  RotationRansacOptions ransac_options;
+  ransac_options.num_hypotheses = FLAGS_ransac_hypotheses;
+  ransac_options.window_s = FLAGS_ransac_window_s;
+  ransac_options.inlier_threshold = FLAGS_ransac_inlier_threshold;
+  rotation_estimator.SetRansac(ransac_options);
+  rotation_estimator.SetNumThreads(Executor::Global().MaxConcurrency());
 
   Eigen::Vector3d accl_bias, gyro_bias;
   accl_bias.setZero();
@@ -78,7 +144,7 @@ int main(int argc, char* argv[]) {
 
   // read gopro telemetry
   OpenICC::CameraTelemetryData telemetry_data;
-  if (!OpenICC::io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data)) {
+  if (!OpenICC::io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data)) {
     std::cout << "Could not read: " << FLAGS_telemetry_json << std::endl;
   }
 
@@ -87,75 +153,16 @@ int main(int argc, char* argv[]) {
     LOG(INFO) << "Using supplied initial imu 2 camera time offset: "
               << t_imu_to_cam_0 << std::endl;
   }
-  // fill measurementes
-  vec3_map angular_velocities;
-  for (size_t i = 0; i < telemetry_data.gyroscope.size(); ++i) {
-    angular_velocities[telemetry_data.gyroscope[i].timestamp_s() +
-                       t_imu_to_cam_0] =
-        telemetry_data.gyroscope[i].data() - gyro_bias;
-  }
-
-  // get mean hz imu
   double imu_dt_s = 0.0;
-  for (size_t i = 1; i < telemetry_data.gyroscope.size(); ++i) {
-    imu_dt_s += telemetry_data.gyroscope[i].timestamp_s() -
-                telemetry_data.gyroscope[i - 1].timestamp_s();
-  }
-  imu_dt_s /= static_cast<double>(telemetry_data.gyroscope.size() - 1);
-  LOG(INFO) << "Mean IMU data rate: "<<1./imu_dt_s<<"Hz";
-
-  quat_map visual_rotations;
-  for (size_t i = 0; i < pose_dataset.ViewIds().size(); ++i) {
-    const theia::View* view = pose_dataset.View(pose_dataset.ViewIds()[i]);
-    const double timestamp_s = view->GetTimestamp();
-    // cam to world trafo, so transposed rotation matrix
-    Eigen::Quaterniond vis_quat(
-        view->Camera().GetOrientationAsRotationMatrix());
-    visual_rotations[timestamp_s] = vis_quat;
-  }
-  std::vector<double> timestamps_images;
-  for (const auto& vis_rot : visual_rotations) {
-    timestamps_images.push_back(vis_rot.first);
-  }
-
-  // get mean hz camera
-  std::vector<double> cams_dt_s;
-  for (size_t i = 1; i < timestamps_images.size(); ++i) {
-    cams_dt_s.push_back(timestamps_images[i] - timestamps_images[i - 1]);
-  }
-  // we take the median as some images might not have been estimated
-  const double cam_dt_s = OpenICC::utils::MedianOfDoubleVec(cams_dt_s);
-
-  std::vector<double> tVis_all_frames, tVis_missing_frames;
-  for (double t = visual_rotations.begin()->first;
-       t < visual_rotations.rbegin()->first;
-       t += cam_dt_s) {
-    tVis_all_frames.push_back(t);
-  }
-  quat_vector visual_rotations_missing_frames;
-  for (auto const& vis : visual_rotations) {
-    tVis_missing_frames.push_back(vis.first);
-    visual_rotations_missing_frames.push_back(vis.second);
-  }
-  LOG(INFO) << "Interpolating visual quaternions to IMU rate.";
-  // interpolate visual rotations as some views might be missing
-  quat_vector visual_rotations_interpolated_vec;
-  OpenICC::utils::InterpolateQuaternions(tVis_missing_frames,
-                                         tVis_all_frames,
-                                         visual_rotations_missing_frames,
-                                         visual_rotations_interpolated_vec);
-  quat_map visual_rotations_interpolated;
-  for (size_t i = 0; i < visual_rotations_interpolated_vec.size(); ++i) {
-    visual_rotations_interpolated[tVis_all_frames[i]] =
-        visual_rotations_interpolated_vec[i];
-  }
+  CHECK(rotation_estimator.SetMeasurementsFromPoseDataset(
+      pose_dataset, telemetry_data, gyro_bias, t_imu_to_cam_0, imu_dt_s))
+      << "Could not set measurements from "
+      << FLAGS_input_pose_calibration_dataset;
 
   Eigen::Matrix3d R_gyro_to_camera;
   double time_offset_gyro_to_camera;
   vec3_vector ang_vel, imu_vel;
 
-  rotation_estimator.SetAngularVelocities(angular_velocities);
-  rotation_estimator.SetVisualRotations(visual_rotations_interpolated);
   rotation_estimator.EstimateCameraImuRotation(imu_dt_s,
                                                R_gyro_to_camera,
                                                time_offset_gyro_to_camera,
@@ -163,18 +170,13 @@ int main(int argc, char* argv[]) {
                                                imu_vel,
                                                ang_vel);
 
-  json output_json;
-  output_json["gyro_bias"] = {gyro_bias[0], gyro_bias[1], gyro_bias[2]};
-  Eigen::Quaterniond q_gyro_to_cam(R_gyro_to_camera);
-  output_json["gyro_to_camera_rotation"]["w"] = q_gyro_to_cam.w();
-  output_json["gyro_to_camera_rotation"]["x"] = q_gyro_to_cam.x();
-  output_json["gyro_to_camera_rotation"]["y"] = q_gyro_to_cam.y();
-  output_json["gyro_to_camera_rotation"]["z"] = q_gyro_to_cam.z();
-  output_json["time_offset_gyro_to_cam"] = time_offset_gyro_to_camera;
-
-  // write prettified JSON to another file
-  std::ofstream out_file(FLAGS_imu_rotation_init_output);
-  out_file << std::setw(4) << output_json << std::endl;
+  const Eigen::Quaterniond q_gyro_to_cam(R_gyro_to_camera);
+  CHECK(WriteIMU2CamInit(FLAGS_imu_rotation_init_output,
+                         gyro_bias,
+                         q_gyro_to_cam,
+                         time_offset_gyro_to_camera))
+      << "Could not write " << FLAGS_imu_rotation_init_output;
+  cache.Store({FLAGS_imu_rotation_init_output});
 
 //  // write to txt for testing
 //  // std::ofstream
@@ -13,21 +13,44 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <gflags/gflags.h>
 #include <ios>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 #include <vector>
 
 #include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/dataset_preflight.h"
+#include "OpenCameraCalibrator/core/detector_tuner.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_gpmf.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/remote_file.h"
+#include "OpenCameraCalibrator/io/session_file.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
+#include <theia/io/reconstruction_writer.h>
+#include <theia/io/write_ply_file.h>
+
 using namespace cv;
 
-DEFINE_string(input_path, "", "Input path.");
+DEFINE_string(input_path,
+              "",
+              "Input path. Videos can also be http(s) URLs, e.g. presigned "
+              "object storage URLs.");
 DEFINE_string(board_type, "charuco", "Board type. (charuco, radon, apriltag)");
 DEFINE_string(aruco_detector_params, "", "Path detector yaml.");
 DEFINE_double(downsample_factor,
@@ -47,26 +70,245 @@ DEFINE_int32(aruco_dict,
              "Aruco dictionary id.");
 DEFINE_bool(recompute_corners, false, "If corners should be extracted again.");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_int32(num_threads,
+             1,
+             "Number of board detector threads. 1 extracts serially.");
+DEFINE_int32(track_block_size,
+             0,
+             "Track the board between consecutive frames and only search it "
+             "around its last position. Every track_block_size frames the "
+             "full image is searched again. 0 searches every full image.");
+DEFINE_bool(refine_full_resolution,
+            false,
+            "Detect the board on the downsampled image and refine the "
+            "corners on the full resolution image. Corners are saved in full "
+            "resolution pixels.");
+DEFINE_double(adaptive_min_corner_spacing_px,
+              0.0,
+              "Choose the downsample factor of every frame from the board "
+              "size in the previous frame, such that the corners are this "
+              "many pixels apart. downsample_factor is the largest factor. "
+              "Needs track_block_size, corners are saved in full resolution "
+              "pixels. 0 uses the fixed downsample_factor.");
+DEFINE_bool(hardware_decoding,
+            false,
+            "Decode videos with a hardware decoder (VAAPI, NVDEC, ...) if "
+            "available. Needs OpenCV >= 4.5.2 with FFmpeg.");
+DEFINE_bool(reduced_decode,
+            false,
+            "Decode the images of an image folder in gray directly at 1/2, "
+            "1/4 or 1/8 resolution if the downsample factor is 2, 4 or 8.");
+DEFINE_bool(use_opencl,
+            false,
+            "Resize and convert the frames to gray on the OpenCL device of "
+            "OpenCV, if there is one.");
+DEFINE_int32(frame_stride,
+             1,
+             "Only decode every frame_stride-th frame, the others are grabbed "
+             "without decoding them.");
+DEFINE_double(target_fps,
+              0.0,
+              "Decode about this many frames per second of a video, "
+              "overrides frame_stride. 0 uses frame_stride.");
+DEFINE_double(min_blur_score,
+              0.0,
+              "Drop frames whose variance of the Laplacian on a thumbnail is "
+              "below this value before the board detection. 0 disables it.");
+DEFINE_double(min_frame_difference,
+              0.0,
+              "Drop frames whose mean absolute gray value difference to the "
+              "last accepted frame is below this value. 0 disables it.");
+DEFINE_bool(radon_fast_path,
+            false,
+            "Detect the Radon board without the exhaustive search on a "
+            "downsampled image first and only search exhaustively if that "
+            "fails.");
+DEFINE_double(radon_fast_downsample_factor,
+              2.0,
+              "Downsample factor of the Radon fast path.");
+DEFINE_double(detection_budget_s,
+              0.0,
+              "Frames whose detection takes longer skip the remaining "
+              "expensive detection steps and are dropped as timed out. 0 "
+              "disables it.");
+DEFINE_int32(apriltag_num_threads,
+             1,
+             "Threads of the apriltag detector within one image.");
+DEFINE_int32(apriltag_quad_decimate,
+             1,
+             "Detect the apriltag quads on an image downsampled by this "
+             "factor. The tags are decoded on the full image. 1 disables it.");
+DEFINE_int32(coverage_target_views,
+             0,
+             "Stop the extraction once every cell of a coverage_grid_cols x "
+             "coverage_grid_rows image grid and every board pose bin (tilt "
+             "and scale) has this many views, e.g. for the camera "
+             "calibration. 0 extracts all frames.");
+DEFINE_int32(coverage_grid_cols, 8, "Image grid columns of the coverage.");
+DEFINE_int32(coverage_grid_rows, 6, "Image grid rows of the coverage.");
+DEFINE_double(coverage_max_stale_s,
+              0.0,
+              "With coverage_target_views, also stop if no view added "
+              "coverage for this many seconds of the recording. 0 waits for "
+              "all bins.");
+DEFINE_int32(start_frame,
+             0,
+             "First frame to extract. Together with end_frame a recording "
+             "can be split across several processes.");
+DEFINE_int32(end_frame,
+             -1,
+             "Extract frames before this index. -1 extracts until the end.");
+DEFINE_int32(checkpoint_interval,
+             0,
+             "Write a checkpoint every this many frames next to the output "
+             "file. 0 disables checkpoints.");
+DEFINE_bool(resume,
+            false,
+            "Continue an interrupted extraction from its last checkpoint.");
+DEFINE_string(merge_scene_files,
+              "",
+              "Comma separated list of scene files extracted from frame "
+              "ranges. They are merged into save_corners_json_path and "
+              "nothing is extracted.");
+DEFINE_string(chapter_videos,
+              "",
+              "Comma separated list of the chapter videos of a split GoPro "
+              "recording, in recording order. The chapters are extracted "
+              "concurrently and merged into save_corners_json_path with the "
+              "chapter start times added to the view timestamps. The "
+              "num_threads detector threads are split across the chapters.");
+DEFINE_string(camera_videos,
+              "",
+              "Comma separated list of the synchronized videos of a multi "
+              "camera rig. All cameras are extracted at the same time, their "
+              "frames share the num_threads detector threads. "
+              "save_corners_json_path becomes a session file with the "
+              "corners of every camera and their common view timeline.");
+DEFINE_string(camera_time_offsets_s,
+              "",
+              "Comma separated offsets added to the view timestamps of the "
+              "camera_videos to move them to the common timeline. Empty "
+              "uses 0 for all cameras.");
+DEFINE_string(save_telemetry_path,
+              "",
+              "Together with chapter_videos, also merge the GPMF telemetry "
+              "of the chapters into this binary telemetry file.");
+DEFINE_string(cache_dir,
+              "",
+              "Cache the extracted corners in this directory, keyed by the "
+              "input content and the board and extraction parameters. A run "
+              "with the same key fetches the corners instead of extracting "
+              "them. Empty disables the cache.");
+DEFINE_bool(preflight,
+            false,
+            "Only validate the dataset in seconds instead of extracting the "
+            "corners: the video metadata, the board detection on a few "
+            "frames and, with preflight_telemetry, the telemetry. Exits with "
+            "1 if the dataset can not be calibrated.");
+DEFINE_string(preflight_telemetry,
+              "",
+              "Telemetry of the video that the preflight checks.");
+DEFINE_int32(preflight_num_frames,
+             20,
+             "Number of frames evenly spread over the video that the "
+             "preflight runs through the board detector.");
+DEFINE_string(preflight_report_json,
+              "",
+              "Write the preflight report to this json file.");
+DEFINE_string(tune_detector_params_output,
+              "",
+              "Only tune the charuco detector parameters instead of "
+              "extracting the corners: searches the parameters with the "
+              "lowest detection time that find the corners of "
+              "aruco_detector_params on sample frames of the video and writes "
+              "them to this yaml, for the extractions of this camera and "
+              "board. An existing file is kept unless recompute_corners.");
+DEFINE_int32(tune_num_frames,
+             30,
+             "Number of frames evenly spread over the video that the "
+             "detector parameters are tuned on.");
+DEFINE_double(tune_min_recall,
+              1.0,
+              "Fraction of the corners of aruco_detector_params that the "
+              "tuned parameters have to find.");
+DEFINE_string(camera_calibration_json,
+              "",
+              "Estimate the camera poses with this camera calibration while "
+              "the corners are extracted. The views go from the writer "
+              "straight to the PnP of the pose estimation, only the board "
+              "point optimization and the filtering wait for the last frame. "
+              "Writes output_pose_dataset like "
+              "estimate_camera_poses_from_checkerboard.");
+DEFINE_string(output_pose_dataset,
+              "",
+              "Path to write the pose calibration dataset to.");
+DEFINE_bool(optimize_board_points,
+            false,
+            "If board points should be optimized after the pose estimation.");
+DEFINE_double(undistortion_map_cell_px,
+              0.0,
+              "Undistort the corners for the pose estimation through a lookup "
+              "table of the camera sampled every this many pixels instead of "
+              "the iterative undistortion of the camera model, 0 disables "
+              "it.");
+DEFINE_bool(pose_tracking,
+            false,
+            "Start the pose of a view from the pose of the previous frame and "
+            "only run RANSAC if the refined pose gates too many corners.");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
 
 using namespace OpenICC;
 using namespace OpenICC::utils;
 using namespace OpenICC::core;
 using nlohmann::json;
 
-int main(int argc, char* argv[]) {
-  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
-  ::google::InitGoogleLogging(argv[0]);
+namespace {
 
-  if (DoesFileExist(FLAGS_save_corners_json_path) && !FLAGS_recompute_corners) {
-    LOG(INFO) << "Skipping corner extraction. Already extracted for: "
-              << FLAGS_input_path << "\n";
-    return 0;
+std::vector<std::string> SplitCommaList(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    items.push_back(item);
   }
+  return items;
+}
 
-  BoardExtractor board_extractor;
+bool ConfigureBoardExtractor(const int num_threads,
+                             BoardExtractor& board_extractor) {
   if (FLAGS_verbose) {
     board_extractor.SetVerbosePlot();
   }
+  board_extractor.SetNumThreads(num_threads);
+  board_extractor.SetTrackBlockSize(FLAGS_track_block_size);
+  board_extractor.SetRefineFullResolution(FLAGS_refine_full_resolution);
+  board_extractor.SetAdaptiveDownsample(FLAGS_adaptive_min_corner_spacing_px);
+  if (FLAGS_adaptive_min_corner_spacing_px > 0.0 &&
+      FLAGS_track_block_size <= 0) {
+    LOG(WARNING) << "adaptive_min_corner_spacing_px needs a track_block_size, "
+                    "using the fixed downsample_factor.";
+  }
+  board_extractor.SetHardwareDecoding(FLAGS_hardware_decoding);
+  board_extractor.SetReducedDecode(FLAGS_reduced_decode);
+  board_extractor.SetUseOpenCL(FLAGS_use_opencl);
+  board_extractor.SetFrameRange(FLAGS_start_frame, FLAGS_end_frame);
+  board_extractor.SetCheckpointInterval(FLAGS_checkpoint_interval);
+  board_extractor.SetResume(FLAGS_resume);
+  board_extractor.SetFrameFilter(FLAGS_min_blur_score,
+                                 FLAGS_min_frame_difference);
+  board_extractor.SetFrameStride(FLAGS_frame_stride, FLAGS_target_fps);
+  board_extractor.SetRadonFastPath(FLAGS_radon_fast_path,
+                                   FLAGS_radon_fast_downsample_factor);
+  board_extractor.SetDetectionBudget(FLAGS_detection_budget_s);
+  BoardCoverageOptions coverage_options;
+  coverage_options.target_views_per_bin = FLAGS_coverage_target_views;
+  coverage_options.grid_cols = FLAGS_coverage_grid_cols;
+  coverage_options.grid_rows = FLAGS_coverage_grid_rows;
+  coverage_options.max_stale_s = FLAGS_coverage_max_stale_s;
+  board_extractor.SetCoverageTermination(coverage_options);
   BoardType board_type = StringToBoardType(FLAGS_board_type);
   if (board_type == BoardType::CHARUCO) {
     const float aruco_marker_length = FLAGS_checker_square_length_m / 2.0f;
@@ -81,23 +323,536 @@ int main(int argc, char* argv[]) {
                                          FLAGS_num_squares_x,
                                          FLAGS_num_squares_y);
   } else if (board_type == BoardType::APRILTAG) {
+    ApriltagDetectorOptions april_options;
+    april_options.num_threads = FLAGS_apriltag_num_threads;
+    april_options.quad_decimate = FLAGS_apriltag_quad_decimate;
     board_extractor.InitializeAprilBoard(FLAGS_checker_square_length_m,
                                          0.3,
                                          FLAGS_num_squares_x,
-                                         FLAGS_num_squares_y);
+                                         FLAGS_num_squares_y,
+                                         april_options);
   } else {
     LOG(ERROR) << "This board type does not exist! Choose Charuco or Radon";
+    return false;
   }
+  return true;
+}
 
-  LOG(INFO) << "Starting board extraction. This might take a while...";
-  if (IsPathAFile(FLAGS_input_path)) {
-    board_extractor.ExtractVideoToJson(FLAGS_input_path,
-                                       FLAGS_save_corners_json_path,
-                                       FLAGS_downsample_factor);
-  } else {
-    board_extractor.ExtractImageFolderToJson(FLAGS_input_path,
-                                             FLAGS_save_corners_json_path,
+//! Checks the telemetry and a sample of the video before any expensive
+//! stage runs on them
+bool RunPreflight() {
+  PreflightOptions options;
+  options.num_sample_frames = FLAGS_preflight_num_frames;
+  options.img_downsample_factor = FLAGS_downsample_factor;
+  PreflightReport report;
+  if (!FLAGS_preflight_telemetry.empty()) {
+    PreflightTelemetry(FLAGS_preflight_telemetry, options, report);
+  }
+  if (IsPathAFile(FLAGS_input_path) || io::IsRemoteUrl(FLAGS_input_path)) {
+    BoardExtractor board_extractor;
+    if (!ConfigureBoardExtractor(1, board_extractor)) {
+      return false;
+    }
+    PreflightVideo(FLAGS_input_path, options, board_extractor, report);
+  } else if (!FLAGS_input_path.empty()) {
+    report.warnings.push_back("Image folders are not sampled");
+  }
+  for (const std::string& warning : report.warnings) {
+    LOG(WARNING) << "Preflight: " << warning;
+  }
+  for (const std::string& error : report.errors) {
+    LOG(ERROR) << "Preflight: " << error;
+  }
+  if (!FLAGS_preflight_report_json.empty()) {
+    std::ofstream report_file(FLAGS_preflight_report_json);
+    if (!report_file.is_open()) {
+      LOG(ERROR) << "Could not write " << FLAGS_preflight_report_json;
+      return false;
+    }
+    report_file << report.ToJson().dump(2);
+  }
+  LOG(INFO) << "Preflight " << (report.Passed() ? "passed" : "failed")
+            << ", sampled " << report.num_sampled_views << " views in "
+            << report.num_sampled_frames << " frames";
+  return report.Passed();
+}
+
+//! Tunes the charuco detector parameters on a sample of the video and
+//! writes them for later extractions
+bool RunDetectorTuning() {
+  if (DoesFileExist(FLAGS_tune_detector_params_output) &&
+      !FLAGS_recompute_corners) {
+    LOG(INFO) << "Skipping detector tuning. Already tuned: "
+              << FLAGS_tune_detector_params_output;
+    return true;
+  }
+  if (StringToBoardType(FLAGS_board_type) != BoardType::CHARUCO) {
+    LOG(ERROR) << "Only the charuco detector parameters can be tuned.";
+    return false;
+  }
+  BoardExtractor board_extractor;
+  if (!ConfigureBoardExtractor(1, board_extractor)) {
+    return false;
+  }
+  std::vector<cv::Mat> detection_images;
+  if (!board_extractor.SampleVideoFrames(FLAGS_input_path,
+                                         FLAGS_tune_num_frames,
+                                         FLAGS_downsample_factor,
+                                         detection_images)) {
+    LOG(ERROR) << "Could not sample frames of " << FLAGS_input_path;
+    return false;
+  }
+  DetectorTuningOptions options;
+  options.min_recall = FLAGS_tune_min_recall;
+  DetectorTuningResult result;
+  if (!TuneDetectorParameters(
+          detection_images, options, board_extractor, result)) {
+    return false;
+  }
+  std::stringstream comment;
+  comment << "Tuned on " << detection_images.size() << " frames of "
+          << FLAGS_input_path << " with downsample factor "
+          << FLAGS_downsample_factor << ": " << 1e3 * result.tuned_frame_time_s
+          << "ms per frame instead of " << 1e3 * result.initial_frame_time_s
+          << "ms, " << result.tuned_num_corners << " of "
+          << result.initial_num_corners << " corners";
+  if (!WriteDetectorParameters(FLAGS_tune_detector_params_output,
+                               *result.detector_params,
+                               comment.str())) {
+    LOG(ERROR) << "Could not write " << FLAGS_tune_detector_params_output;
+    return false;
+  }
+  return true;
+}
+
+//! Extracts all chapters of a split recording at the same time, each into
+//! its own scene file, and merges them once all are done
+bool ExtractChapters(const std::vector<std::string>& chapter_videos) {
+  std::vector<double> offsets_s;
+  if (!io::GoProChapterOffsets(chapter_videos, offsets_s)) {
+    return false;
+  }
+
+  // the telemetry is parsed next to the board extraction
+  bool telemetry_ok = true;
+  std::thread telemetry_thread;
+  if (!FLAGS_save_telemetry_path.empty()) {
+    telemetry_thread = std::thread([&]() {
+      CameraTelemetryData telemetry;
+      telemetry_ok =
+          io::ReadGoProChapterTelemetry(chapter_videos, offsets_s, telemetry) &&
+          io::WriteTelemetryBinary(FLAGS_save_telemetry_path, telemetry);
+      if (telemetry_ok) {
+        LOG(INFO) << "Merged " << telemetry.accelerometer.size()
+                  << " imu samples of " << chapter_videos.size()
+                  << " chapters.";
+      }
+    });
+  }
+
+  const int nr_chapters = static_cast<int>(chapter_videos.size());
+  const int threads_per_chapter = std::max(1, FLAGS_num_threads / nr_chapters);
+  std::vector<std::string> chapter_scenes(nr_chapters);
+  std::vector<char> chapter_ok(nr_chapters, 0);
+  std::vector<std::thread> chapter_threads;
+  for (int i = 0; i < nr_chapters; ++i) {
+    chapter_scenes[i] =
+        FLAGS_save_corners_json_path + ".chapter" + std::to_string(i);
+    chapter_threads.emplace_back([&, i]() {
+      BoardExtractor board_extractor;
+      chapter_ok[i] =
+          ConfigureBoardExtractor(threads_per_chapter, board_extractor) &&
+          board_extractor.ExtractVideoToJson(chapter_videos[i],
+                                             chapter_scenes[i],
                                              FLAGS_downsample_factor);
+    });
+  }
+  for (auto& chapter_thread : chapter_threads) {
+    chapter_thread.join();
+  }
+  if (telemetry_thread.joinable()) {
+    telemetry_thread.join();
+  }
+
+  for (int i = 0; i < nr_chapters; ++i) {
+    if (!chapter_ok[i]) {
+      LOG(ERROR) << "Board extraction failed for " << chapter_videos[i];
+      return false;
+    }
+  }
+  if (!telemetry_ok) {
+    LOG(ERROR) << "Could not merge the chapter telemetry to "
+               << FLAGS_save_telemetry_path;
+    return false;
+  }
+  if (!io::MergeSceneFiles(
+          chapter_scenes, offsets_s, FLAGS_save_corners_json_path)) {
+    return false;
+  }
+  for (const std::string& chapter_scene : chapter_scenes) {
+    std::remove(chapter_scene.c_str());
+  }
+  return true;
+}
+
+//! Groups the views of all cameras whose timestamps are less than half a
+//! frame apart. Every entry of the timeline holds the view key of each
+//! camera, or null if the camera has no view at that time.
+bool CameraRigToJson(const std::vector<std::string>& camera_videos,
+                     const std::vector<std::string>& camera_scenes,
+                     const std::vector<double>& offsets_s,
+                     json& rig_json) {
+  struct CameraView {
+    double timestamp_us;
+    int camera_idx;
+    std::string key;
+  };
+  std::vector<CameraView> views;
+  double max_fps = 0.0;
+  for (size_t i = 0; i < camera_scenes.size(); ++i) {
+    io::MappedScene scene;
+    if (!scene.Open(camera_scenes[i])) {
+      return false;
+    }
+    for (size_t v = 0; v < scene.NumViews(); ++v) {
+      views.push_back(CameraView{
+          std::stod(scene.ViewKey(v)), static_cast<int>(i), scene.ViewKey(v)});
+    }
+    const double fps = scene.Header().value("camera_fps", 0.0);
+    max_fps = std::max(max_fps, fps);
+    rig_json["cameras"].push_back(
+        {{"video", camera_videos[i]},
+         {"section", io::CameraCornersSection(i)},
+         {"time_offset_s", offsets_s[i]},
+         {"camera_fps", fps},
+         {"num_views", scene.NumViews()}});
+  }
+  std::sort(views.begin(),
+            views.end(),
+            [](const CameraView& a, const CameraView& b) {
+              return a.timestamp_us < b.timestamp_us;
+            });
+
+  const double tolerance_us = max_fps > 0.0 ? 0.5e6 / max_fps : 0.0;
+  rig_json["timeline"] = json::array();
+  json entry;
+  double entry_us = 0.0;
+  for (const CameraView& view : views) {
+    if (entry.is_null() || view.timestamp_us - entry_us > tolerance_us ||
+        !entry["views"][view.camera_idx].is_null()) {
+      if (!entry.is_null()) {
+        rig_json["timeline"].push_back(entry);
+      }
+      entry_us = view.timestamp_us;
+      entry = {{"timestamp_us", entry_us},
+               {"views", json(camera_scenes.size(), nullptr)}};
+    }
+    entry["views"][view.camera_idx] = view.key;
+  }
+  if (!entry.is_null()) {
+    rig_json["timeline"].push_back(entry);
+  }
+  return true;
+}
+
+//! Extracts the synchronized videos of a camera rig at the same time and
+//! packs the corners of all cameras into one session file
+bool ExtractCameras(const std::vector<std::string>& camera_videos) {
+  const int nr_cameras = static_cast<int>(camera_videos.size());
+  std::vector<double> offsets_s(nr_cameras, 0.0);
+  if (!FLAGS_camera_time_offsets_s.empty()) {
+    const std::vector<std::string> offsets =
+        SplitCommaList(FLAGS_camera_time_offsets_s);
+    if (offsets.size() != camera_videos.size()) {
+      LOG(ERROR) << "camera_time_offsets_s needs one offset per camera.";
+      return false;
+    }
+    for (int i = 0; i < nr_cameras; ++i) {
+      offsets_s[i] = std::stod(offsets[i]);
+    }
+  }
+
+  // every camera keeps num_threads frame blocks in flight, the executor
+  // limits how many of them are detected at the same time
+  utils::Executor::Global().SetMaxConcurrency(FLAGS_num_threads);
+  std::vector<std::string> raw_scenes(nr_cameras);
+  std::vector<std::string> camera_scenes(nr_cameras);
+  std::vector<char> camera_ok(nr_cameras, 0);
+  std::vector<std::thread> camera_threads;
+  for (int i = 0; i < nr_cameras; ++i) {
+    raw_scenes[i] = FLAGS_save_corners_json_path + ".cam" + std::to_string(i);
+    camera_scenes[i] = raw_scenes[i] + ".shifted";
+    camera_threads.emplace_back([&, i]() {
+      BoardExtractor board_extractor;
+      camera_ok[i] =
+          ConfigureBoardExtractor(FLAGS_num_threads, board_extractor) &&
+          board_extractor.ExtractVideoToJson(
+              camera_videos[i], raw_scenes[i], FLAGS_downsample_factor) &&
+          io::MergeSceneFiles(
+              {raw_scenes[i]}, {offsets_s[i]}, camera_scenes[i]);
+    });
+  }
+  for (auto& camera_thread : camera_threads) {
+    camera_thread.join();
+  }
+  for (int i = 0; i < nr_cameras; ++i) {
+    if (!camera_ok[i]) {
+      LOG(ERROR) << "Board extraction failed for " << camera_videos[i];
+      return false;
+    }
+  }
+
+  json rig_json;
+  if (!CameraRigToJson(camera_videos, camera_scenes, offsets_s, rig_json)) {
+    return false;
+  }
+  const std::string rig_dump = rig_json.dump();
+  io::SessionWriter session;
+  bool packed = session.Open(FLAGS_save_corners_json_path);
+  for (int i = 0; packed && i < nr_cameras; ++i) {
+    packed = session.AddFile(io::CameraCornersSection(i), camera_scenes[i]);
+  }
+  packed = packed &&
+           session.AddSection(
+               io::kSessionCameraRig, rig_dump.data(), rig_dump.size()) &&
+           session.Close();
+  if (!packed) {
+    return false;
+  }
+  LOG(INFO) << "Extracted " << nr_cameras << " cameras with "
+            << rig_json["timeline"].size() << " common view times.";
+  for (int i = 0; i < nr_cameras; ++i) {
+    std::remove(raw_scenes[i].c_str());
+    std::remove(camera_scenes[i].c_str());
+  }
+  return true;
+}
+
+//! Adds everything the extracted corners depend on to the cache key
+void AddExtractionKey(StageCache& cache) {
+  if (!FLAGS_chapter_videos.empty()) {
+    for (const std::string& chapter : SplitCommaList(FLAGS_chapter_videos)) {
+      cache.AddFile(chapter);
+    }
+  } else if (!FLAGS_camera_videos.empty()) {
+    for (const std::string& camera : SplitCommaList(FLAGS_camera_videos)) {
+      cache.AddFile(camera);
+    }
+    cache.AddValue("camera_time_offsets_s", FLAGS_camera_time_offsets_s);
+  } else {
+    cache.AddFile(FLAGS_input_path);
+  }
+  cache.AddValue("board_type", FLAGS_board_type);
+  cache.AddFile(FLAGS_aruco_detector_params);
+  cache.AddValue("downsample_factor", FLAGS_downsample_factor);
+  cache.AddValue("checker_square_length_m", FLAGS_checker_square_length_m);
+  cache.AddValue("num_squares_x", FLAGS_num_squares_x);
+  cache.AddValue("num_squares_y", FLAGS_num_squares_y);
+  cache.AddValue("aruco_dict", FLAGS_aruco_dict);
+  cache.AddValue("track_block_size", FLAGS_track_block_size);
+  cache.AddValue("refine_full_resolution", FLAGS_refine_full_resolution);
+  cache.AddValue("adaptive_min_corner_spacing_px",
+                 FLAGS_adaptive_min_corner_spacing_px);
+  cache.AddValue("hardware_decoding", FLAGS_hardware_decoding);
+  cache.AddValue("reduced_decode", FLAGS_reduced_decode);
+  cache.AddValue("use_opencl", FLAGS_use_opencl);
+  cache.AddValue("min_blur_score", FLAGS_min_blur_score);
+  cache.AddValue("min_frame_difference", FLAGS_min_frame_difference);
+  cache.AddValue("frame_stride", FLAGS_frame_stride);
+  cache.AddValue("target_fps", FLAGS_target_fps);
+  cache.AddValue("apriltag_quad_decimate", FLAGS_apriltag_quad_decimate);
+  cache.AddValue("radon_fast_path", FLAGS_radon_fast_path);
+  cache.AddValue("radon_fast_downsample_factor",
+                 FLAGS_radon_fast_downsample_factor);
+  cache.AddValue("detection_budget_s", FLAGS_detection_budget_s);
+  cache.AddValue("coverage_target_views", FLAGS_coverage_target_views);
+  cache.AddValue("coverage_grid_cols", FLAGS_coverage_grid_cols);
+  cache.AddValue("coverage_grid_rows", FLAGS_coverage_grid_rows);
+  cache.AddValue("coverage_max_stale_s", FLAGS_coverage_max_stale_s);
+  cache.AddValue("start_frame", FLAGS_start_frame);
+  cache.AddValue("end_frame", FLAGS_end_frame);
+  cache.AddValue("save_telemetry", !FLAGS_save_telemetry_path.empty());
+}
+
+//! Extracts input_path, a video or an image folder, to
+//! save_corners_json_path
+bool ExtractInput(BoardExtractor& board_extractor) {
+  if (IsPathAFile(FLAGS_input_path) || io::IsRemoteUrl(FLAGS_input_path)) {
+    return board_extractor.ExtractVideoToJson(FLAGS_input_path,
+                                              FLAGS_save_corners_json_path,
+                                              FLAGS_downsample_factor);
+  }
+  return board_extractor.ExtractImageFolderToJson(FLAGS_input_path,
+                                                  FLAGS_save_corners_json_path,
+                                                  FLAGS_downsample_factor);
+}
+
+//! Extracts the corners and estimates the camera poses of the views while
+//! the extraction is still running
+bool ExtractAndEstimatePoses() {
+  if (!FLAGS_chapter_videos.empty() || !FLAGS_camera_videos.empty()) {
+    LOG(ERROR) << "The pose estimation during the extraction needs a single "
+                  "input_path.";
+    return false;
+  }
+  if (FLAGS_output_pose_dataset.empty()) {
+    LOG(ERROR) << "camera_calibration_json needs an output_pose_dataset.";
+    return false;
+  }
+
+  StageCache cache(FLAGS_cache_dir, "extract_board_to_json_poses");
+  AddExtractionKey(cache);
+  cache.AddFile(FLAGS_camera_calibration_json);
+  cache.AddValue("optimize_board_points", FLAGS_optimize_board_points);
+  cache.AddValue("undistortion_map_cell_px", FLAGS_undistortion_map_cell_px);
+  cache.AddValue("pose_tracking", FLAGS_pose_tracking);
+  const std::vector<std::string> outputs{FLAGS_save_corners_json_path,
+                                         FLAGS_output_pose_dataset,
+                                         FLAGS_output_pose_dataset + ".ply"};
+  if (cache.Fetch(outputs)) {
+    return true;
+  }
+
+  theia::Camera camera;
+  double fps;
+  if (!io::read_camera_calibration(
+          FLAGS_camera_calibration_json, camera, fps)) {
+    LOG(ERROR) << "Could not read camera calibration: "
+               << FLAGS_camera_calibration_json;
+    return false;
+  }
+
+  PoseEstimator pose_estimator;
+  pose_estimator.SetNumThreads(FLAGS_num_threads);
+  pose_estimator.SetUndistortionMapCellSize(FLAGS_undistortion_map_cell_px);
+  pose_estimator.SetPoseTracking(FLAGS_pose_tracking);
+  const bool corners_exist = DoesFileExist(FLAGS_save_corners_json_path) &&
+                             !FLAGS_recompute_corners;
+  BoardExtractor board_extractor;
+  if (!corners_exist && !ConfigureBoardExtractor(FLAGS_num_threads,
+                                                 board_extractor)) {
+    return false;
+  }
+  // a resumed extraction does not write the views of the interrupted run
+  // again, so the poses are estimated from the finished file
+  if (corners_exist || FLAGS_resume) {
+    if (!corners_exist) {
+      LOG(INFO) << "Starting board extraction. This might take a while...";
+      if (!ExtractInput(board_extractor)) {
+        return false;
+      }
+    }
+    io::MappedScene scene;
+    if (!scene.Open(FLAGS_save_corners_json_path)) {
+      LOG(ERROR) << "Failed to load " << FLAGS_save_corners_json_path;
+      return false;
+    }
+    pose_estimator.EstimatePosesFromScene(scene, camera);
+  } else {
+    json scene_header;
+    board_extractor.BoardToJson(scene_header);
+    pose_estimator.StartViews(scene_header, camera);
+    board_extractor.SetViewCallback(
+        [&pose_estimator](const std::string& view_key, const json& view) {
+          pose_estimator.AddView(view_key, view);
+        });
+    LOG(INFO) << "Starting board extraction and pose estimation. This might "
+                 "take a while...";
+    const bool extracted = ExtractInput(board_extractor);
+    pose_estimator.FinishViews();
+    if (!extracted) {
+      return false;
+    }
+  }
+  LOG(INFO) << "Finished pose estimation.";
+  if (FLAGS_optimize_board_points) {
+    LOG(INFO) << "Optimizing board points.";
+    pose_estimator.OptimizeBoardPoints();
+    pose_estimator.OptimizeAllPoses();
+  }
+  pose_estimator.FilterBadPoses();
+
+  theia::Reconstruction pose_dataset;
+  pose_estimator.GetPoseDataset(pose_dataset);
+  if (!theia::WriteReconstruction(pose_dataset, FLAGS_output_pose_dataset)) {
+    LOG(ERROR) << "Could not write " << FLAGS_output_pose_dataset;
+    return false;
+  }
+  theia::WritePlyFile(FLAGS_output_pose_dataset + ".ply",
+                      pose_dataset,
+                      Eigen::Vector3i(255, 0, 0),
+                      2);
+  cache.Store(outputs);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "extract_board_to_json");
+
+  if (FLAGS_preflight) {
+    return RunPreflight() ? 0 : 1;
+  }
+
+  if (!FLAGS_tune_detector_params_output.empty()) {
+    return RunDetectorTuning() ? 0 : 1;
+  }
+
+  if (!FLAGS_merge_scene_files.empty()) {
+    return io::MergeSceneFiles(SplitCommaList(FLAGS_merge_scene_files),
+                               FLAGS_save_corners_json_path)
+               ? 0
+               : 1;
+  }
+
+  if (!FLAGS_camera_calibration_json.empty()) {
+    return ExtractAndEstimatePoses() ? 0 : 1;
+  }
+
+  if (DoesFileExist(FLAGS_save_corners_json_path) && !FLAGS_recompute_corners) {
+    LOG(INFO) << "Skipping corner extraction. Already extracted for: "
+              << FLAGS_input_path << "\n";
+    return 0;
+  }
+
+  StageCache cache(FLAGS_cache_dir, "extract_board_to_json");
+  AddExtractionKey(cache);
+  std::vector<std::string> outputs{FLAGS_save_corners_json_path};
+  if (!FLAGS_chapter_videos.empty() && !FLAGS_save_telemetry_path.empty()) {
+    outputs.push_back(FLAGS_save_telemetry_path);
+  }
+  if (cache.Fetch(outputs)) {
+    return 0;
+  }
+
+  if (!FLAGS_chapter_videos.empty()) {
+    LOG(INFO) << "Starting chapter extraction. This might take a while...";
+    if (!ExtractChapters(SplitCommaList(FLAGS_chapter_videos))) {
+      return 1;
+    }
+    cache.Store(outputs);
+    return 0;
+  }
+
+  if (!FLAGS_camera_videos.empty()) {
+    LOG(INFO) << "Starting multi camera extraction. This might take a while...";
+    if (!ExtractCameras(SplitCommaList(FLAGS_camera_videos))) {
+      return 1;
+    }
+    cache.Store(outputs);
+    return 0;
+  }
+
+  BoardExtractor board_extractor;
+  ConfigureBoardExtractor(FLAGS_num_threads, board_extractor);
+
+  LOG(INFO) << "Starting board extraction. This might take a while...";
+  if (ExtractInput(board_extractor)) {
+    cache.Store(outputs);
   }
   return 0;
 }
@@ -12,12 +12,18 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <filesystem>
+#include <fstream>
 #include <gflags/gflags.h>
+#include <iomanip>
 #include <glog/logging.h>
 
 #include "OpenCameraCalibrator/core/allan_variance_fitter.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/build_profile.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
 
 using namespace OpenICC;
 using namespace OpenICC::core;
@@ -27,15 +33,73 @@ DEFINE_string(telemetry_json,
               "CameraCalibrationStudy/AllanVariance/merged_telemetry.json",
               "Path to the telemetry json.");
 
+DEFINE_bool(streaming,
+            OpenICC::utils::kDefaultStreaming,
+            "Stream the telemetry through an octave spaced allan variance "
+            "instead of loading it. Memory does not grow with the length of "
+            "the recording.");
+DEFINE_string(output_json,
+              "",
+              "Write the fitted noise parameters of the six axes to this json "
+              "file.");
+DEFINE_int64(memory_budget_mb,
+             OpenICC::utils::kDefaultMemoryBudgetMb,
+             "Resident memory the process should stay below. Large "
+             "intermediate arrays beyond it are spilled to memory mapped "
+             "files in spill_dir. 0 disables the budget.");
+DEFINE_string(spill_dir,
+              "",
+              "Directory of the spill files, defaults to TMPDIR or /tmp.");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_string(profile_json,
+              "",
+              "Write wall time, cpu time, peak memory and item counts of the "
+              "calibration stages as a chrome trace json to this path.");
+
+bool WriteResult(const nlohmann::json& result) {
+  if (FLAGS_output_json.empty()) {
+    return true;
+  }
+  std::ofstream output(FLAGS_output_json);
+  if (!output.is_open()) {
+    LOG(ERROR) << "Could not open " << FLAGS_output_json;
+    return false;
+  }
+  output << std::setw(4) << result << std::endl;
+  return true;
+}
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::ScopedProfileWriter profile_writer(
+      FLAGS_profile_json, "fit_allan_variance");
+  utils::MemoryBudget::Instance().SetBudgetMb(FLAGS_memory_budget_mb);
+  utils::MemoryBudget::Instance().SetSpillDirectory(FLAGS_spill_dir);
+
+  // the loaded telemetry and the six axes take about the size of the file
+  std::error_code size_error;
+  const auto telemetry_bytes =
+      std::filesystem::file_size(FLAGS_telemetry_json, size_error);
+  const bool streaming =
+      FLAGS_streaming ||
+      (!size_error &&
+       utils::MemoryBudget::Instance().WouldExceed(telemetry_bytes));
+  if (streaming && !FLAGS_streaming) {
+    LOG(INFO) << "The telemetry exceeds the memory budget, streaming it.";
+  }
+  if (streaming) {
+    StreamingAllanVarianceFitter fitter;
+    CHECK(io::StreamTelemetry(FLAGS_telemetry_json, fitter))
+        << "Could not read: " << FLAGS_telemetry_json;
+    CHECK(fitter.RunFit());
+    CHECK(WriteResult(fitter.ResultToJson()));
+    return 0;
+  }
 
   // read telemetry
   CameraTelemetryData telemetry_data;
-  CHECK(io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
+  CHECK(io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
       << "Could not read: " << FLAGS_telemetry_json;
 
   AllanVarianceFitter fitter(telemetry_data, 10000);
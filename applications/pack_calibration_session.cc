@@ -0,0 +1,183 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/observation_dataset.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/session_file.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+using namespace OpenICC;
+
+// Packs the files of a calibration session into one container with a table
+// of contents, or lists and extracts the sections of one. The applications
+// accept the session in place of the files of its sections.
+
+DEFINE_string(output_session, "", "Session file to write.");
+DEFINE_string(corners, "", "Corner ubjson of the board extractor.");
+DEFINE_string(observations, "", "Observation dataset.");
+DEFINE_string(telemetry,
+              "",
+              "Telemetry in any format ReadTelemetry reads, it is stored "
+              "as binary telemetry.");
+DEFINE_string(telemetry_compression,
+              "none",
+              "Block compression of the telemetry section: none, zstd or "
+              "lz4.");
+DEFINE_string(camera_calibration, "", "Camera calibration json.");
+DEFINE_string(pose_dataset, "", "Pose dataset of the camera pose estimation.");
+DEFINE_string(imu_intrinsics, "", "IMU intrinsics json.");
+DEFINE_string(imu_bias, "", "IMU bias json.");
+DEFINE_string(gyro_to_cam, "", "Gyro to camera initial calibration json.");
+DEFINE_string(spline_weighting, "", "Spline error weighting json.");
+DEFINE_string(calibration_result, "", "Imu to camera calibration json.");
+DEFINE_string(spline_state, "", "Spline state of a calibration.");
+DEFINE_string(input_session,
+              "",
+              "Session to list, or to extract a section of.");
+DEFINE_string(extract_section, "", "Name of the section to extract.");
+DEFINE_string(extract_to, "", "Where to write the extracted section to.");
+
+namespace {
+
+bool CornersTimeRange(const std::string& path,
+                      int64_t& first_ns,
+                      int64_t& last_ns) {
+  io::MappedScene scene;
+  if (!scene.Open(path)) {
+    return false;
+  }
+  first_ns = 0;
+  last_ns = 0;
+  // views are sorted by their key string, not by time
+  for (size_t v = 0; v < scene.NumViews(); ++v) {
+    const int64_t t_ns =
+        std::llround(std::stod(scene.ViewKey(v)) * US_TO_S * S_TO_NS);
+    first_ns = v == 0 ? t_ns : std::min(first_ns, t_ns);
+    last_ns = v == 0 ? t_ns : std::max(last_ns, t_ns);
+  }
+  return true;
+}
+
+bool AddTelemetry(io::SessionWriter& writer) {
+  io::ChunkCodec codec;
+  CHECK(io::ParseChunkCodec(FLAGS_telemetry_compression, codec))
+      << "Unknown compression " << FLAGS_telemetry_compression;
+  CameraTelemetryData telemetry;
+  if (!io::ReadTelemetry(FLAGS_telemetry, telemetry) ||
+      telemetry.accelerometer.empty()) {
+    LOG(ERROR) << "Could not read " << FLAGS_telemetry;
+    return false;
+  }
+  const std::string part_path = FLAGS_output_session + ".telemetry.part";
+  const bool added =
+      io::WriteTelemetryBinary(
+          part_path, telemetry, codec, io::kTelemetrySamplesPerChunk) &&
+      writer.AddFile(
+          io::kSessionTelemetry,
+          part_path,
+          std::llround(telemetry.accelerometer.front().timestamp_s() *
+                       S_TO_NS),
+          std::llround(telemetry.accelerometer.back().timestamp_s() *
+                       S_TO_NS));
+  std::remove(part_path.c_str());
+  return added;
+}
+
+int ListOrExtract() {
+  io::SessionReader session;
+  CHECK(session.Open(FLAGS_input_session))
+      << "Could not open " << FLAGS_input_session;
+  if (!FLAGS_extract_section.empty()) {
+    CHECK(session.ExtractSection(FLAGS_extract_section, FLAGS_extract_to))
+        << "Could not extract " << FLAGS_extract_section;
+    return 0;
+  }
+  for (const io::SessionSection& section : session.Sections()) {
+    std::cout << section.name << ": " << section.bytes << " bytes";
+    if (section.first_key != section.last_key) {
+      std::cout << ", " << section.first_key * NS_TO_S << "s to "
+                << section.last_key * NS_TO_S << "s";
+    }
+    std::cout << "\n";
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  if (!FLAGS_input_session.empty()) {
+    return ListOrExtract();
+  }
+
+  io::SessionWriter writer;
+  CHECK(writer.Open(FLAGS_output_session))
+      << "Could not open " << FLAGS_output_session;
+  if (!FLAGS_corners.empty()) {
+    int64_t first_ns, last_ns;
+    CHECK(CornersTimeRange(FLAGS_corners, first_ns, last_ns) &&
+          writer.AddFile(
+              io::kSessionCorners, FLAGS_corners, first_ns, last_ns))
+        << "Could not add " << FLAGS_corners;
+  }
+  if (!FLAGS_observations.empty()) {
+    io::ObservationDataset dataset;
+    CHECK(io::ReadObservationDataset(FLAGS_observations, dataset))
+        << "Could not read " << FLAGS_observations;
+    const auto range = std::minmax_element(dataset.timestamps_ns.begin(),
+                                           dataset.timestamps_ns.end());
+    CHECK(writer.AddFile(io::kSessionObservations,
+                         FLAGS_observations,
+                         dataset.NumViews() > 0 ? *range.first : 0,
+                         dataset.NumViews() > 0 ? *range.second : 0))
+        << "Could not add " << FLAGS_observations;
+  }
+  if (!FLAGS_telemetry.empty()) {
+    CHECK(AddTelemetry(writer)) << "Could not add " << FLAGS_telemetry;
+  }
+
+  const std::vector<std::pair<const char*, std::string>> files = {
+      {io::kSessionCameraCalibration, FLAGS_camera_calibration},
+      {io::kSessionPoseDataset, FLAGS_pose_dataset},
+      {io::kSessionImuIntrinsics, FLAGS_imu_intrinsics},
+      {io::kSessionImuBias, FLAGS_imu_bias},
+      {io::kSessionGyroToCam, FLAGS_gyro_to_cam},
+      {io::kSessionSplineWeighting, FLAGS_spline_weighting},
+      {io::kSessionCalibrationResult, FLAGS_calibration_result},
+      {io::kSessionSplineState, FLAGS_spline_state}};
+  for (const auto& [name, path] : files) {
+    if (!path.empty()) {
+      CHECK(writer.AddFile(name, path)) << "Could not add " << path;
+    }
+  }
+  CHECK(writer.Close()) << "Could not write " << FLAGS_output_session;
+  LOG(INFO) << "Wrote session " << FLAGS_output_session;
+  return 0;
+}
@@ -15,17 +15,38 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 
 #include "OpenCameraCalibrator/core/static_imu_calibrator.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 
 using namespace OpenICC;
 using namespace OpenICC::core;
 
 DEFINE_string(telemetry_json, "", "Path to the telemetry json.");
 
+DEFINE_string(telemetry_jsons,
+              "",
+              "Batch mode: comma separated telemetry jsons of IMUs recorded "
+              "simultaneously through the same static multi-pose sequence. "
+              "The devices are calibrated concurrently and written to one "
+              "result file, keyed by device name.");
+
+DEFINE_string(device_names,
+              "",
+              "Comma separated names of the batch mode devices. Defaults to "
+              "the telemetry file names.");
+
+DEFINE_bool(share_static_intervals,
+            true,
+            "Batch mode: detect the static intervals on the first device and "
+            "reuse them for all others. Needs co-mounted IMUs on one time "
+            "base.");
+
 DEFINE_double(gravity_magnitude, 9.811107, "Gravity magnitude.");
 
 DEFINE_double(initial_static_interval_s,
@@ -35,28 +56,23 @@ DEFINE_double(initial_static_interval_s,
 DEFINE_string(output_calibration_path, "", "path to output calibration json");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
 
-int main(int argc, char* argv[]) {
-  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
-  ::google::InitGoogleLogging(argv[0]);
-
-  // read telemetry
-  CameraTelemetryData telemetry_data;
-  CHECK(io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
-      << "Could not read: " << FLAGS_telemetry_json;
+namespace {
 
-  StaticImuCalibrator multi_pose_calibrator;
-  multi_pose_calibrator.SetGravityMagnitude(FLAGS_gravity_magnitude);
-  multi_pose_calibrator.SetInitStaticIntervalDuration(
-      FLAGS_initial_static_interval_s);
-  multi_pose_calibrator.EnableVerboseOutput(FLAGS_verbose);
-  multi_pose_calibrator.CalibrateAccGyro(telemetry_data.accelerometer,
-                                         telemetry_data.gyroscope);
+std::vector<std::string> SplitCommaList(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    items.push_back(item);
+  }
+  return items;
+}
 
-  // write result
-  ThreeAxisSensorCalibParams<double> acc_calib =
-      multi_pose_calibrator.getAccCalib();
-  ThreeAxisSensorCalibParams<double> gyr_calib =
-      multi_pose_calibrator.getGyroCalib();
+nlohmann::json CalibrationToJson(const StaticImuCalibrator& calibrator) {
+  const ThreeAxisSensorCalibParams<double>& acc_calib =
+      calibrator.getAccCalib();
+  const ThreeAxisSensorCalibParams<double>& gyr_calib =
+      calibrator.getGyroCalib();
   nlohmann::json output;
 
   Eigen::Matrix3d acc_m_mat = acc_calib.GetMisalignmentMatrix();
@@ -80,6 +96,110 @@ int main(int argc, char* argv[]) {
                                          {0.0, 0.0, gyr_calib.scaleZ()}};
   output["gyroscope"]["bias"] = {
       gyr_calib.biasX(), gyr_calib.biasY(), gyr_calib.biasZ()};
+  return output;
+}
+
+void SetupCalibrator(StaticImuCalibrator& calibrator) {
+  calibrator.SetGravityMagnitude(FLAGS_gravity_magnitude);
+  calibrator.SetInitStaticIntervalDuration(FLAGS_initial_static_interval_s);
+  calibrator.EnableVerboseOutput(FLAGS_verbose);
+}
+
+//! Calibrates all devices of --telemetry_jsons
+nlohmann::json CalibrateBatch() {
+  const std::vector<std::string> telemetry_jsons =
+      SplitCommaList(FLAGS_telemetry_jsons);
+  std::vector<std::string> device_names = SplitCommaList(FLAGS_device_names);
+  CHECK(device_names.empty() || device_names.size() == telemetry_jsons.size())
+      << "Need one device name per telemetry json.";
+  const size_t num_devices = telemetry_jsons.size();
+  if (device_names.empty()) {
+    for (const std::string& telemetry_json : telemetry_jsons) {
+      const size_t begin = telemetry_json.find_last_of('/') + 1;
+      device_names.push_back(telemetry_json.substr(
+          begin, telemetry_json.find_last_of('.') - begin));
+    }
+  }
+
+  std::vector<CameraTelemetryData> telemetry(num_devices);
+  utils::ParallelFor(
+      num_devices,
+      num_devices,
+      [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+        for (size_t d = begin; d < end; ++d) {
+          CHECK(io::ReadTelemetry(telemetry_jsons[d], telemetry[d]))
+              << "Could not read: " << telemetry_jsons[d];
+        }
+      });
+
+  // the devices run concurrently, each fits its candidates on its share of
+  // the hardware threads
+  const int num_threads = utils::Executor::Global().MaxConcurrency();
+  std::vector<StaticImuCalibrator> calibrators(num_devices);
+  std::vector<char> calibrated(num_devices, 0);
+  for (StaticImuCalibrator& calibrator : calibrators) {
+    SetupCalibrator(calibrator);
+    calibrator.SetNumThreads(std::max<int>(1, num_threads / num_devices));
+  }
+  size_t first_concurrent = 0;
+  if (FLAGS_share_static_intervals) {
+    // the first device detects the static intervals for all devices
+    calibrators[0].SetNumThreads(num_threads);
+    calibrated[0] = calibrators[0].CalibrateAccGyro(telemetry[0].accelerometer,
+                                                    telemetry[0].gyroscope);
+    CHECK(calibrated[0]) << "Static interval detection failed on "
+                         << device_names[0];
+    for (size_t d = 1; d < num_devices; ++d) {
+      calibrators[d].SetStaticIntervals(calibrators[0].GetStaticIntervals());
+    }
+    first_concurrent = 1;
+  }
+  utils::ParallelFor(
+      num_devices - first_concurrent,
+      num_devices,
+      [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+        for (size_t d = first_concurrent + begin; d < first_concurrent + end;
+             ++d) {
+          calibrated[d] = calibrators[d].CalibrateAccGyro(
+              telemetry[d].accelerometer, telemetry[d].gyroscope);
+        }
+      });
+
+  nlohmann::json output;
+  for (size_t d = 0; d < num_devices; ++d) {
+    if (!calibrated[d]) {
+      LOG(ERROR) << "Calibration of " << device_names[d] << " failed.";
+      output["failed_devices"].push_back(device_names[d]);
+      continue;
+    }
+    output["devices"][device_names[d]] = CalibrationToJson(calibrators[d]);
+  }
+  return output;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  nlohmann::json output;
+  if (!FLAGS_telemetry_jsons.empty()) {
+    output = CalibrateBatch();
+  } else {
+    // read telemetry
+    CameraTelemetryData telemetry_data;
+    CHECK(io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
+        << "Could not read: " << FLAGS_telemetry_json;
+
+    StaticImuCalibrator multi_pose_calibrator;
+    SetupCalibrator(multi_pose_calibrator);
+    multi_pose_calibrator.CalibrateAccGyro(telemetry_data.accelerometer,
+                                           telemetry_data.gyroscope);
+    output = CalibrationToJson(multi_pose_calibrator);
+  }
+
+  // write result
   std::ofstream output_json(FLAGS_output_calibration_path);
   output_json << std::setw(4) << output << std::endl;
   output_json.close();
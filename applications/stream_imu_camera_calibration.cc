@@ -0,0 +1,281 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <opencv2/videoio.hpp>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/streaming_calibrator.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+// Calibrates the imu to camera transformation while recording. Frames are
+// read from a camera device, stream url or video file, IMU samples line by
+// line from a csv (or a named pipe a recorder writes to) with the rows
+// t_ns, gx, gy, gz, ax, ay, az. The estimate is printed after every window
+// solve and written to result_output_json when the stream ends.
+
+DEFINE_string(video,
+              "0",
+              "Camera device index, stream url or video file.");
+DEFINE_string(imu_csv,
+              "",
+              "IMU csv or named pipe with the rows t_ns, gx, gy, gz, ax, ay, "
+              "az. The timestamps start with the recording.");
+DEFINE_string(camera_calibration_json,
+              "",
+              "Camera calibration of the downsampled images.");
+DEFINE_string(gyro_to_cam_initial_calibration,
+              "",
+              "Initial gyro to camera calibration json.");
+DEFINE_string(imu_intrinsics, "", "IMU intrinsics.");
+DEFINE_string(imu_bias_file, "", "IMU bias json");
+DEFINE_string(spline_error_weighting_json,
+              "",
+              "Spline error weighting data, e.g. of an earlier recording of "
+              "the same device.");
+DEFINE_bool(global_shutter, false, "If camera has a global shutter.");
+DEFINE_string(board_type, "charuco", "Board type. (charuco, radon, apriltag)");
+DEFINE_string(aruco_detector_params, "", "Path detector yaml.");
+DEFINE_double(checker_square_length_m,
+              0.022,
+              "Size of one square on the checkerboard in [m].");
+DEFINE_int32(num_squares_x, 9, "Number of squares in x.");
+DEFINE_int32(num_squares_y, 7, "Number of squares in y");
+DEFINE_int32(aruco_dict,
+             cv::aruco::DICT_ARUCO_ORIGINAL,
+             "Aruco dictionary id.");
+DEFINE_double(downsample_factor,
+              1.0,
+              "Downsample factor for images. I_new = 1/factor * I");
+DEFINE_double(init_duration_s,
+              5.0,
+              "Seconds of views the spline is initialized with.");
+DEFINE_double(window_s, 10.0, "Seconds of the recording a solve optimizes.");
+DEFINE_double(step_s, 1.0, "Seconds of new views between two solves.");
+DEFINE_int32(iterations, 5, "Solver iterations per window.");
+DEFINE_bool(drop_frames,
+            true,
+            "Drop frames while the detection is behind. Set to false for "
+            "video files to use every frame.");
+DEFINE_bool(reestimate_biases,
+            false,
+            "If accelerometer and gyroscope biases should be estimated.");
+DEFINE_double(gravity_const, 9.81, "gravity constant");
+DEFINE_string(known_grav_dir_axis,
+              "Z",
+              "Possible values (X,Y,Z,UNKNOWN) if the gravity direction of "
+              "your calibration board is exactly known.");
+DEFINE_bool(stop_when_sufficient,
+            false,
+            "Stop recording once the excitation, board coverage and "
+            "information on T_i_c, line delay and intrinsics are "
+            "sufficient.");
+DEFINE_string(result_output_json, "", "Path to result json file");
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+
+namespace {
+
+bool InitializeBoard(BoardExtractor& board_extractor) {
+  const BoardType board_type = StringToBoardType(FLAGS_board_type);
+  if (board_type == BoardType::CHARUCO) {
+    return board_extractor.InitializeCharucoBoard(
+        FLAGS_aruco_detector_params,
+        FLAGS_checker_square_length_m / 2.0f,
+        FLAGS_checker_square_length_m,
+        FLAGS_num_squares_x,
+        FLAGS_num_squares_y,
+        FLAGS_aruco_dict);
+  } else if (board_type == BoardType::RADON) {
+    return board_extractor.InitializeRadonBoard(FLAGS_checker_square_length_m,
+                                                FLAGS_num_squares_x,
+                                                FLAGS_num_squares_y);
+  }
+  return board_extractor.InitializeAprilBoard(FLAGS_checker_square_length_m,
+                                              0.3,
+                                              FLAGS_num_squares_x,
+                                              FLAGS_num_squares_y);
+}
+
+//! Pushes the samples of the csv until it ends or stop is set
+void ReadImuCsv(const std::string& path,
+                const std::atomic<bool>& stop,
+                StreamingCalibrator& calibrator) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open " << path;
+    return;
+  }
+  std::string line;
+  while (!stop && std::getline(file, line)) {
+    // skips a header
+    if (line.empty() ||
+        !(std::isdigit(static_cast<unsigned char>(line[0])) ||
+          line[0] == '-')) {
+      continue;
+    }
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::stringstream ss(line);
+    double t_ns;
+    Eigen::Vector3d gyro, accl;
+    if (!(ss >> t_ns >> gyro[0] >> gyro[1] >> gyro[2] >> accl[0] >> accl[1] >>
+          accl[2])) {
+      LOG(WARNING) << "Skipping invalid IMU line: " << line;
+      continue;
+    }
+    if (!calibrator.PushImuSample(t_ns * NS_TO_S, accl, gyro)) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  theia::Camera camera;
+  double fps;
+  CHECK(io::read_camera_calibration(FLAGS_camera_calibration_json, camera, fps))
+      << "Could not read camera calibration: " << FLAGS_camera_calibration_json;
+  Eigen::Quaterniond imu2cam;
+  double time_offset_imu_to_cam;
+  CHECK(io::ReadIMU2CamInit(
+      FLAGS_gyro_to_cam_initial_calibration, imu2cam, time_offset_imu_to_cam))
+      << "Could not read: " << FLAGS_gyro_to_cam_initial_calibration;
+  const Sophus::SE3d T_i_c_init(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0));
+  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
+  CHECK(io::ReadIMUIntrinsics(
+      FLAGS_imu_intrinsics, FLAGS_imu_bias_file, acc_intr, gyr_intr))
+      << "Could not open " << FLAGS_imu_intrinsics;
+  SplineWeightingData weight_data;
+  CHECK(io::ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json,
+                                     weight_data))
+      << "Could not open " << FLAGS_spline_error_weighting_json;
+  const double init_line_delay =
+      FLAGS_global_shutter ? 0.0 : 1. / fps / camera.ImageHeight();
+
+  BoardExtractor board_extractor;
+  CHECK(InitializeBoard(board_extractor)) << "Could not initialize the board.";
+
+  StreamingCalibratorOptions options;
+  options.downsample_factor = FLAGS_downsample_factor;
+  options.init_duration_s = FLAGS_init_duration_s;
+  options.window_s = FLAGS_window_s;
+  options.step_s = FLAGS_step_s;
+  options.iterations = FLAGS_iterations;
+  options.optim_flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  options.excitation.check_line_delay = !FLAGS_global_shutter;
+  if (FLAGS_reestimate_biases) {
+    options.optim_flags |= SplineOptimFlags::IMU_BIASES;
+  }
+  const int grav_dir_axis =
+      utils::GravDirStringToInt(FLAGS_known_grav_dir_axis);
+  if (grav_dir_axis == -1) {
+    options.optim_flags |= SplineOptimFlags::GRAVITY_DIR;
+  }
+  StreamingCalibrator streaming_calibrator(options);
+  if (grav_dir_axis != -1) {
+    Eigen::Vector3d grav_dir(0, 0, 0);
+    grav_dir[grav_dir_axis] = FLAGS_gravity_const;
+    streaming_calibrator.Calibrator().SetKnownGravityDir(grav_dir);
+  }
+  streaming_calibrator.SetEstimateCallback(
+      [](const StreamingEstimate& estimate) {
+        const Eigen::Quaterniond q_i_c = estimate.T_i_c.unit_quaternion();
+        std::cout << "t=" << estimate.time_s << "s views "
+                  << estimate.num_views << " reprojection error "
+                  << estimate.reprojection_error << "px T_i_c qw,qx,qy,qz: "
+                  << q_i_c.w() << " " << q_i_c.x() << " " << q_i_c.y() << " "
+                  << q_i_c.z() << " line delay [us]: "
+                  << estimate.line_delay_s * S_TO_US << "\n";
+      });
+  CHECK(streaming_calibrator.Start(&board_extractor,
+                                   camera,
+                                   T_i_c_init,
+                                   weight_data,
+                                   time_offset_imu_to_cam,
+                                   init_line_delay,
+                                   acc_intr,
+                                   gyr_intr));
+
+  cv::VideoCapture capture;
+  const bool device =
+      !FLAGS_video.empty() &&
+      std::all_of(FLAGS_video.begin(), FLAGS_video.end(), [](unsigned char c) {
+        return std::isdigit(c);
+      });
+  if (device) {
+    capture.open(std::stoi(FLAGS_video));
+  } else {
+    capture.open(FLAGS_video);
+  }
+  CHECK(capture.isOpened()) << "Could not open " << FLAGS_video;
+
+  std::atomic<bool> stop(false);
+  std::thread imu_reader(ReadImuCsv,
+                         FLAGS_imu_csv,
+                         std::cref(stop),
+                         std::ref(streaming_calibrator));
+  // live cameras have no stream position, their frames are timed from here
+  const auto start = std::chrono::steady_clock::now();
+  cv::Mat frame;
+  while (capture.read(frame)) {
+    if (FLAGS_stop_when_sufficient && streaming_calibrator.DataSufficient()) {
+      std::cout << "The data is sufficient, stopping the recording.\n";
+      break;
+    }
+    const double timestamp_s =
+        device ? std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+               : capture.get(cv::CAP_PROP_POS_MSEC) * 1e-3;
+    if (FLAGS_drop_frames) {
+      streaming_calibrator.TryPushFrame(timestamp_s, frame.clone());
+    } else {
+      streaming_calibrator.PushFrame(timestamp_s, frame.clone());
+    }
+  }
+  stop = true;
+  const bool calibrated = streaming_calibrator.Finish();
+  imu_reader.join();
+  CHECK(calibrated) << "The recording was too short to calibrate.";
+
+  ImuCameraCalibrator& calibrator = streaming_calibrator.Calibrator();
+  StreamingEstimate estimate;
+  streaming_calibrator.GetEstimate(estimate);
+  CHECK(calibrator.WriteCalibrationResult(FLAGS_result_output_json,
+                                          estimate.reprojection_error,
+                                          calibrator.GetTimeOffsetImuToCam()))
+      << "Could not write " << FLAGS_result_output_json;
+  return 0;
+}
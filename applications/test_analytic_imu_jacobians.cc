@@ -0,0 +1,488 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <ceres/ceres.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <sophus/so3.hpp>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+
+// Accuracy checks of the analytic gyroscope, accelerometer and fused IMU cost
+// functions on random spline segments:
+//  - against the autodiff functors they replace, which stay the verification
+//    reference, with spline and constant biases and with and without the
+//    shared knot differences of So3KnotDeltaCache
+//  - the single precision knot Jacobians that SetUseFloatImuJacobians
+//    selects against the double ones, the residuals have to be identical
+// Jacobians are compared in the tangent space of the SO(3) knots the solver
+// works in. Every Jacobian row has to agree to tolerance relative to the
+// largest entry of the reference row. Exits with 1 on a failure.
+
+DEFINE_int32(num_trials, 500, "Random spline segments per check.");
+DEFINE_double(float_tolerance,
+              1e-5,
+              "Largest allowed difference of a float Jacobian row, relative to "
+              "the largest entry of the double row.");
+DEFINE_double(autodiff_tolerance,
+              1e-8,
+              "Largest allowed difference of an analytic residual or Jacobian "
+              "row, relative to the largest entry of the autodiff row.");
+
+namespace {
+
+//! random knots, biases, gravity and intrinsics for the parameter blocks of
+//! a cost function, quaternion blocks have 4 entries
+struct RandomBlocks {
+  explicit RandomBlocks(const std::vector<int32_t>& block_sizes) {
+    for (const int32_t size : block_sizes) {
+      std::vector<double> values(size);
+      if (size == 4) {
+        const Sophus::SO3d R = Sophus::SO3d::exp(Eigen::Vector3d::Random());
+        std::copy(R.data(), R.data() + 4, values.begin());
+      } else if (size == 9 || size == 6) {
+        // small misalignments, scales close to 1
+        const Eigen::VectorXd v = 0.01 * Eigen::VectorXd::Random(size);
+        for (int i = 0; i < size; ++i) {
+          values[i] = i < size - 3 ? v[i] : 1.0 + v[i];
+        }
+      } else {
+        const Eigen::Vector3d v = Eigen::Vector3d::Random();
+        std::copy(v.data(), v.data() + size, values.begin());
+      }
+      data.push_back(std::move(values));
+    }
+    for (const auto& values : data) {
+      blocks.push_back(values.data());
+    }
+  }
+
+  std::vector<std::vector<double>> data;
+  std::vector<const double*> blocks;
+};
+
+//! residuals and row major Jacobians of one evaluation, the Jacobians of the
+//! quaternion blocks are taken to the tangent space of the right perturbation
+struct Evaluation {
+  bool Evaluate(const ceres::CostFunction& cost_function,
+                const std::vector<const double*>& blocks) {
+    residuals.assign(cost_function.num_residuals(), 0.0);
+    block_sizes = cost_function.parameter_block_sizes();
+    jacobian_data.clear();
+    std::vector<double*> jacobians;
+    for (const int32_t size : block_sizes) {
+      jacobian_data.emplace_back(size * residuals.size(), 0.0);
+      jacobians.push_back(jacobian_data.back().data());
+    }
+    if (!cost_function.Evaluate(
+            blocks.data(), residuals.data(), jacobians.data())) {
+      return false;
+    }
+    using RowMajorX4 =
+        Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::RowMajor>;
+    using RowMajorX3 =
+        Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>;
+    for (size_t b = 0; b < block_sizes.size(); ++b) {
+      if (block_sizes[b] != 4) continue;
+      Eigen::Map<Sophus::SO3d const> const R(blocks[b]);
+      const RowMajorX3 J_local =
+          Eigen::Map<const RowMajorX4>(jacobian_data[b].data(),
+                                       residuals.size(),
+                                       4) *
+          R.Dx_this_mul_exp_x_at_0();
+      jacobian_data[b].assign(J_local.data(), J_local.data() + J_local.size());
+      block_sizes[b] = 3;
+    }
+    return true;
+  }
+
+  std::vector<double> residuals;
+  std::vector<int32_t> block_sizes;
+  std::vector<std::vector<double>> jacobian_data;
+};
+
+//! Largest difference of the Jacobian row r over all blocks, relative to the
+//! largest entry of the reference row. Single knot blocks can nearly cancel,
+//! so they are not compared to their own magnitude.
+double RowError(const Evaluation& eval_reference,
+                const Evaluation& eval_tested,
+                const int r) {
+  const std::vector<int32_t>& block_sizes = eval_reference.block_sizes;
+  double max_diff = 0.0;
+  double max_abs = 0.0;
+  for (size_t b = 0; b < block_sizes.size(); ++b) {
+    for (int i = r * block_sizes[b]; i < (r + 1) * block_sizes[b]; ++i) {
+      const double jac_reference = eval_reference.jacobian_data[b][i];
+      const double jac_tested = eval_tested.jacobian_data[b][i];
+      max_diff = std::max(max_diff, std::abs(jac_reference - jac_tested));
+      max_abs = std::max(max_abs, std::abs(jac_reference));
+    }
+  }
+  return max_diff / std::max(max_abs, std::numeric_limits<double>::min());
+}
+
+//! So3KnotDeltaCache over the SO(3) knot blocks of a single segment
+struct SegmentKnotCache {
+  SegmentKnotCache(const std::vector<const double*>& blocks, const int N)
+      : in_problem(N, true) {
+    for (int i = 0; i < N; ++i) {
+      knots.push_back(Eigen::Map<Sophus::SO3d const>(blocks[i]));
+    }
+    cache.reset(new So3KnotDeltaCache(knots, in_problem));
+    cache->PrepareForEvaluation(true, true);
+  }
+
+  OpenICC::so3_vector knots;
+  std::vector<bool> in_problem;
+  std::unique_ptr<So3KnotDeltaCache> cache;
+};
+
+//! Compares the cost function of make_tested with the one of make_reference
+//! on num_trials random segments. Both are created for the blending
+//! parameters u and the measurement. If use_cache is set, the tested cost
+//! function takes the knot differences from a So3KnotDeltaCache. The
+//! residuals have to be identical if bitwise_residuals is set, else they
+//! are compared to tolerance like the Jacobian rows.
+template <class TestedCostFunction, class MakeTested, class MakeReference>
+bool CompareCostFunctions(const std::string& name,
+                          MakeTested make_tested,
+                          MakeReference make_reference,
+                          const double tolerance,
+                          const bool bitwise_residuals,
+                          const bool use_cache) {
+  double max_error = 0.0;
+  bool ok = true;
+  for (int trial = 0; trial < FLAGS_num_trials && ok; ++trial) {
+    const Eigen::Vector3d u = 0.5 * (Eigen::Vector3d::Random().array() + 1.0);
+    const Eigen::Vector3d measurement = Eigen::Vector3d::Random();
+    std::unique_ptr<TestedCostFunction> tested(make_tested(u, measurement));
+    std::unique_ptr<ceres::CostFunction> reference(
+        make_reference(u, measurement, tested->parameter_block_sizes()));
+    const RandomBlocks params(tested->parameter_block_sizes());
+
+    std::unique_ptr<SegmentKnotCache> knot_cache;
+    if (use_cache) {
+      knot_cache.reset(
+          new SegmentKnotCache(params.blocks, TestedCostFunction::N));
+      tested->knot_cache = knot_cache->cache.get();
+      if (!knot_cache->cache->Segment(params.blocks.data(),
+                                      0,
+                                      TestedCostFunction::N - 1,
+                                      true)) {
+        LOG(ERROR) << "FAILED: " << name << " cache not used in trial "
+                   << trial;
+        ok = false;
+        break;
+      }
+    }
+
+    Evaluation eval_reference, eval_tested;
+    if (!eval_reference.Evaluate(*reference, params.blocks) ||
+        !eval_tested.Evaluate(*tested, params.blocks)) {
+      LOG(ERROR) << "FAILED: " << name << " evaluation of trial " << trial;
+      ok = false;
+      break;
+    }
+    if (bitwise_residuals) {
+      if (eval_reference.residuals != eval_tested.residuals) {
+        LOG(ERROR) << "FAILED: " << name << " residuals of trial " << trial
+                   << " differ";
+        ok = false;
+      }
+    } else {
+      const double scale =
+          std::max(1.0,
+                   Eigen::Map<const Eigen::VectorXd>(
+                       eval_reference.residuals.data(),
+                       eval_reference.residuals.size())
+                       .lpNorm<Eigen::Infinity>());
+      for (size_t r = 0; r < eval_reference.residuals.size(); ++r) {
+        const double error =
+            std::abs(eval_reference.residuals[r] - eval_tested.residuals[r]) /
+            scale;
+        max_error = std::max(max_error, error);
+        if (error > tolerance) {
+          LOG(ERROR) << "FAILED: " << name << " residual " << r
+                     << " of trial " << trial << " differs by " << error;
+          ok = false;
+        }
+      }
+    }
+    for (int r = 0; ok && r < tested->num_residuals(); ++r) {
+      const double error = RowError(eval_reference, eval_tested, r);
+      max_error = std::max(max_error, error);
+      if (error > tolerance) {
+        LOG(ERROR) << "FAILED: " << name << " Jacobian row " << r
+                   << " of trial " << trial << " differs by " << error;
+        ok = false;
+      }
+    }
+  }
+  std::cout << name << ": largest relative difference " << max_error
+            << " (tolerance " << tolerance << ")\n";
+  return ok;
+}
+
+//! Dynamic autodiff cost function of functor with the blocks of the analytic
+//! cost function it is compared with
+template <class Functor>
+ceres::CostFunction* AutoDiff(Functor* functor,
+                              const std::vector<int32_t>& block_sizes,
+                              const int num_residuals) {
+  auto* cost_function =
+      new ceres::DynamicAutoDiffCostFunction<Functor>(functor);
+  for (const int32_t size : block_sizes) {
+    cost_function->AddParameterBlock(size);
+  }
+  cost_function->SetNumResiduals(num_residuals);
+  return cost_function;
+}
+
+//! Blending parameter and inverse knot spacing of a bias, the estimator
+//! passes 0 for both if the bias is constant
+std::pair<double, double> BiasTime(const double u, const int num_bias_blocks) {
+  return num_bias_blocks == 1 ? std::make_pair(0.0, 0.0)
+                              : std::make_pair(u, 10.0);
+}
+
+template <int N, typename JacScalar>
+GyroCostFunctionSplitAnalytic<N, JacScalar>* MakeGyro(
+    const Eigen::Vector3d& u,
+    const Eigen::Vector3d& measurement,
+    const int num_bias_blocks) {
+  const auto bias = BiasTime(u[1], num_bias_blocks);
+  return new GyroCostFunctionSplitAnalytic<N, JacScalar>(
+      measurement, u[0], 10.0, 2.0, bias.first, bias.second, num_bias_blocks);
+}
+
+template <int N, typename JacScalar>
+AccelerationCostFunctionSplitAnalytic<N, JacScalar>* MakeAccelerometer(
+    const Eigen::Vector3d& u,
+    const Eigen::Vector3d& measurement,
+    const int num_bias_blocks) {
+  const auto bias = BiasTime(u[2], num_bias_blocks);
+  return new AccelerationCostFunctionSplitAnalytic<N, JacScalar>(
+      measurement,
+      u[0],
+      10.0,
+      u[1],
+      10.0,
+      2.0,
+      bias.first,
+      bias.second,
+      num_bias_blocks);
+}
+
+template <int N, typename JacScalar>
+ImuCostFunctionSplitAnalytic<N, JacScalar>* MakeImu(
+    const Eigen::Vector3d& u,
+    const Eigen::Vector3d& measurement,
+    const int num_bias_blocks) {
+  const auto gyro_bias = BiasTime(u[2], num_bias_blocks);
+  const auto accl_bias = BiasTime(1.0 - u[2], num_bias_blocks);
+  return new ImuCostFunctionSplitAnalytic<N, JacScalar>(measurement,
+                                                        measurement.reverse(),
+                                                        u[0],
+                                                        10.0,
+                                                        u[1],
+                                                        10.0,
+                                                        gyro_bias.first,
+                                                        gyro_bias.second,
+                                                        accl_bias.first,
+                                                        accl_bias.second,
+                                                        2.0,
+                                                        3.0,
+                                                        num_bias_blocks,
+                                                        num_bias_blocks);
+}
+
+template <int N>
+bool TestGyroAutoDiff(const int num_bias_blocks, const bool use_cache) {
+  using FunctorT = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+  return CompareCostFunctions<GyroCostFunctionSplitAnalytic<N, double>>(
+      "gyroscope autodiff",
+      [&](const Eigen::Vector3d& u, const Eigen::Vector3d& measurement) {
+        return MakeGyro<N, double>(u, measurement, num_bias_blocks);
+      },
+      [&](const Eigen::Vector3d& u,
+          const Eigen::Vector3d& measurement,
+          const std::vector<int32_t>& block_sizes) {
+        const auto bias = BiasTime(u[1], num_bias_blocks);
+        return AutoDiff(new FunctorT(measurement,
+                                     u[0],
+                                     10.0,
+                                     2.0,
+                                     bias.first,
+                                     bias.second,
+                                     num_bias_blocks),
+                        block_sizes,
+                        3);
+      },
+      FLAGS_autodiff_tolerance,
+      false,
+      use_cache);
+}
+
+template <int N>
+bool TestAccelerometerAutoDiff(const int num_bias_blocks,
+                               const bool use_cache) {
+  using FunctorT = AccelerationCostFunctorSplit<N>;
+  return CompareCostFunctions<AccelerationCostFunctionSplitAnalytic<N, double>>(
+      "accelerometer autodiff",
+      [&](const Eigen::Vector3d& u, const Eigen::Vector3d& measurement) {
+        return MakeAccelerometer<N, double>(u, measurement, num_bias_blocks);
+      },
+      [&](const Eigen::Vector3d& u,
+          const Eigen::Vector3d& measurement,
+          const std::vector<int32_t>& block_sizes) {
+        const auto bias = BiasTime(u[2], num_bias_blocks);
+        return AutoDiff(new FunctorT(measurement,
+                                     u[0],
+                                     10.0,
+                                     u[1],
+                                     10.0,
+                                     2.0,
+                                     bias.first,
+                                     bias.second,
+                                     num_bias_blocks),
+                        block_sizes,
+                        3);
+      },
+      FLAGS_autodiff_tolerance,
+      false,
+      use_cache);
+}
+
+template <int N>
+bool TestImuAutoDiff(const int num_bias_blocks, const bool use_cache) {
+  using FunctorT = ImuCostFunctorSplit<N>;
+  return CompareCostFunctions<ImuCostFunctionSplitAnalytic<N, double>>(
+      "imu autodiff",
+      [&](const Eigen::Vector3d& u, const Eigen::Vector3d& measurement) {
+        return MakeImu<N, double>(u, measurement, num_bias_blocks);
+      },
+      [&](const Eigen::Vector3d& u,
+          const Eigen::Vector3d& measurement,
+          const std::vector<int32_t>& block_sizes) {
+        const auto gyro_bias = BiasTime(u[2], num_bias_blocks);
+        const auto accl_bias = BiasTime(1.0 - u[2], num_bias_blocks);
+        return AutoDiff(new FunctorT(measurement,
+                                     measurement.reverse(),
+                                     u[0],
+                                     10.0,
+                                     u[1],
+                                     10.0,
+                                     gyro_bias.first,
+                                     gyro_bias.second,
+                                     accl_bias.first,
+                                     accl_bias.second,
+                                     2.0,
+                                     3.0,
+                                     num_bias_blocks,
+                                     num_bias_blocks),
+                        block_sizes,
+                        6);
+      },
+      FLAGS_autodiff_tolerance,
+      false,
+      use_cache);
+}
+
+//! float against double knot Jacobians with spline biases
+template <class FloatCostFunction, class MakeFloat, class MakeDouble>
+bool TestFloat(const std::string& name,
+               MakeFloat make_float,
+               MakeDouble make_double) {
+  return CompareCostFunctions<FloatCostFunction>(
+      name,
+      [&](const Eigen::Vector3d& u, const Eigen::Vector3d& measurement) {
+        return make_float(u, measurement, BIAS_SPLINE_N);
+      },
+      [&](const Eigen::Vector3d& u,
+          const Eigen::Vector3d& measurement,
+          const std::vector<int32_t>&) {
+        return make_double(u, measurement, BIAS_SPLINE_N);
+      },
+      FLAGS_float_tolerance,
+      true,
+      false);
+}
+
+template <int N>
+void AddTests(std::vector<std::pair<std::string, std::function<bool()>>>*
+                  tests) {
+  const std::string order = "_" + std::to_string(N);
+  for (const int num_bias_blocks : {BIAS_SPLINE_N, 1}) {
+    for (const bool use_cache : {false, true}) {
+      const std::string layout =
+          std::string(num_bias_blocks == 1 ? "_constant_bias" : "") +
+          (use_cache ? "_knot_cache" : "");
+      tests->emplace_back("gyroscope_autodiff" + order + layout, [=]() {
+        return TestGyroAutoDiff<N>(num_bias_blocks, use_cache);
+      });
+      tests->emplace_back("accelerometer_autodiff" + order + layout, [=]() {
+        return TestAccelerometerAutoDiff<N>(num_bias_blocks, use_cache);
+      });
+      tests->emplace_back("imu_autodiff" + order + layout, [=]() {
+        return TestImuAutoDiff<N>(num_bias_blocks, use_cache);
+      });
+    }
+  }
+  tests->emplace_back("gyroscope_float" + order, []() {
+    return TestFloat<GyroCostFunctionSplitAnalytic<N, float>>(
+        "gyroscope float", &MakeGyro<N, float>, &MakeGyro<N, double>);
+  });
+  tests->emplace_back("accelerometer_float" + order, []() {
+    return TestFloat<AccelerationCostFunctionSplitAnalytic<N, float>>(
+        "accelerometer float",
+        &MakeAccelerometer<N, float>,
+        &MakeAccelerometer<N, double>);
+  });
+  tests->emplace_back("imu_float" + order, []() {
+    return TestFloat<ImuCostFunctionSplitAnalytic<N, float>>(
+        "imu float", &MakeImu<N, float>, &MakeImu<N, double>);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::vector<std::pair<std::string, std::function<bool()>>> tests;
+  AddTests<4>(&tests);
+  AddTests<5>(&tests);
+  AddTests<6>(&tests);
+  bool ok = true;
+  for (const auto& test : tests) {
+    const bool passed = test.second();
+    std::cout << (passed ? "PASSED " : "FAILED ") << test.first << "\n";
+    ok &= passed;
+  }
+  return ok ? 0 : 1;
+}
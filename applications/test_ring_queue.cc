@@ -0,0 +1,216 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/ring_queue.h"
+
+// Stress test of the lock-free rings of ring_queue.h. Several producers push
+// numbered move-only items into an MpscQueue, one producer into an
+// SpscQueue, the consumer checks that no item is lost or duplicated and that
+// the items of every producer arrive in order. Also checks that Close lets
+// the consumer drain the outstanding items and that pushes into a closed
+// ring leave the items with the caller. Exits with 1 on a failure.
+
+DEFINE_int32(num_producers, 4, "Producers of the MPSC run.");
+DEFINE_int32(items_per_producer, 200000, "Items every producer pushes.");
+DEFINE_int32(capacity, 64, "Capacity of the rings of the stress runs.");
+DEFINE_int32(batch_size,
+             16,
+             "Every second batch of a producer is pushed with PushBatch, the "
+             "consumer pops batches of twice this size.");
+
+using namespace OpenICC::utils;
+
+namespace {
+
+//! move-only like a frame with its image
+struct TestItem {
+  int producer = -1;
+  int64_t sequence = -1;
+  std::unique_ptr<int64_t> payload;
+};
+
+TestItem MakeItem(const int producer, const int64_t sequence) {
+  TestItem item;
+  item.producer = producer;
+  item.sequence = sequence;
+  item.payload = std::make_unique<int64_t>(sequence);
+  return item;
+}
+
+bool Check(const bool condition, const std::string& message) {
+  if (!condition) {
+    LOG(ERROR) << "FAILED: " << message;
+  }
+  return condition;
+}
+
+//! Pushes items_per_producer items, alternating single pushes and batches
+template <class Queue>
+void Produce(Queue& queue, const int producer) {
+  const int64_t batch_size = std::max(1, FLAGS_batch_size);
+  std::vector<TestItem> batch;
+  int64_t sequence = 0;
+  while (sequence < FLAGS_items_per_producer) {
+    const int64_t end =
+        std::min<int64_t>(FLAGS_items_per_producer, sequence + batch_size);
+    if ((sequence / batch_size) % 2 == 0) {
+      for (; sequence < end; ++sequence) {
+        CHECK(queue.Push(MakeItem(producer, sequence)));
+      }
+    } else {
+      for (; sequence < end; ++sequence) {
+        batch.push_back(MakeItem(producer, sequence));
+      }
+      CHECK(queue.PushBatch(batch));
+    }
+  }
+}
+
+//! Pops until the ring is closed and empty, true if every producer delivered
+//! all of its items exactly once and in order
+template <class Queue>
+bool Consume(Queue& queue, const int num_producers) {
+  std::vector<int64_t> next_sequence(num_producers, 0);
+  std::vector<TestItem> batch;
+  bool ok = true;
+  while (queue.PopBatch(batch, 2 * std::max(1, FLAGS_batch_size))) {
+    for (const TestItem& item : batch) {
+      if (item.producer < 0 || item.producer >= num_producers ||
+          !item.payload || *item.payload != item.sequence) {
+        ok = Check(false, "item with a broken payload");
+        continue;
+      }
+      int64_t& expected = next_sequence[item.producer];
+      if (item.sequence != expected) {
+        ok = Check(false,
+                   "producer " + std::to_string(item.producer) + " item " +
+                       std::to_string(item.sequence) + " instead of " +
+                       std::to_string(expected));
+      }
+      expected = item.sequence + 1;
+    }
+  }
+  for (int p = 0; p < num_producers; ++p) {
+    ok &= Check(next_sequence[p] == FLAGS_items_per_producer,
+                "producer " + std::to_string(p) + " delivered " +
+                    std::to_string(next_sequence[p]) + " items");
+  }
+  return ok;
+}
+
+bool TestMpsc() {
+  MpscQueue<TestItem> queue(FLAGS_capacity);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < FLAGS_num_producers; ++p) {
+    producers.emplace_back([&queue, p]() { Produce(queue, p); });
+  }
+  std::thread closer([&]() {
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    queue.Close();
+  });
+  const bool ok = Consume(queue, FLAGS_num_producers);
+  closer.join();
+  return Check(ok, "MPSC run") && Check(queue.Size() == 0, "MPSC drained");
+}
+
+bool TestSpsc() {
+  SpscQueue<TestItem> queue(FLAGS_capacity);
+  std::thread producer([&]() {
+    Produce(queue, 0);
+    queue.Close();
+  });
+  const bool ok = Consume(queue, 1);
+  producer.join();
+  return Check(ok, "SPSC run") && Check(queue.Size() == 0, "SPSC drained");
+}
+
+bool TestCloseWithOutstandingItems() {
+  MpscQueue<TestItem> queue(8);
+  bool ok = true;
+  for (int i = 0; i < 5; ++i) {
+    ok &= Check(queue.TryPush(MakeItem(0, i)), "TryPush into an open ring");
+  }
+  queue.Close();
+  ok &= Check(!queue.TryPush(MakeItem(0, 5)), "TryPush into a closed ring");
+  ok &= Check(!queue.Push(MakeItem(0, 5)), "Push into a closed ring");
+  TestItem item;
+  for (int i = 0; i < 5; ++i) {
+    ok &= Check(queue.Pop(item) && item.sequence == i && item.payload &&
+                    *item.payload == i,
+                "Pop of outstanding item " + std::to_string(i));
+  }
+  ok &= Check(!queue.Pop(item), "Pop of a closed and empty ring");
+  return ok;
+}
+
+bool TestPushBatchOnClosedRing() {
+  MpscQueue<TestItem> queue(4);
+  std::vector<TestItem> items;
+  for (int i = 0; i < 4; ++i) {
+    items.push_back(MakeItem(0, i));
+  }
+  bool ok = Check(queue.PushBatch(items) && items.empty(),
+                  "PushBatch into an open ring");
+  queue.Close();
+  for (int i = 4; i < 7; ++i) {
+    items.push_back(MakeItem(0, i));
+  }
+  ok &= Check(!queue.PushBatch(items), "PushBatch into a closed ring");
+  ok &= Check(items.size() == 3, "items left after PushBatch");
+  for (size_t i = 0; i < items.size(); ++i) {
+    ok &= Check(items[i].payload && *items[i].payload == int64_t(4 + i),
+                "payload of left item " + std::to_string(i));
+  }
+  TestItem item;
+  for (int i = 0; i < 4; ++i) {
+    ok &= Check(queue.Pop(item) && item.sequence == i,
+                "Pop of batch item " + std::to_string(i));
+  }
+  ok &= Check(!queue.Pop(item), "Pop after the batch");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  const std::vector<std::pair<std::string, bool (*)()>> tests = {
+      {"mpsc", &TestMpsc},
+      {"spsc", &TestSpsc},
+      {"close_with_outstanding_items", &TestCloseWithOutstandingItems},
+      {"push_batch_on_closed_ring", &TestPushBatchOnClosedRing}};
+  bool ok = true;
+  for (const auto& test : tests) {
+    const bool passed = test.second();
+    std::cout << (passed ? "PASSED " : "FAILED ") << test.first << "\n";
+    ok &= passed;
+  }
+  return ok ? 0 : 1;
+}
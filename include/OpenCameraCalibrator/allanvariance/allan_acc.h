@@ -2,9 +2,11 @@
 
 #pragma once
 
+#include "OpenCameraCalibrator/utils/memory_budget.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include <iostream>
 #include <math.h>
+#include <thread>
 #include <vector>
 
 namespace OpenICC {
@@ -19,6 +21,15 @@ class AllanAcc {
   void pushMPerSec2(double data, double time);
   void calc();
 
+  //! Reserves the raw data of numSamples samples at once, it is spilled to
+  //! disk if it does not fit into the memory budget
+  void reserve(const int numSamples) { m_rawData.reserve(numSamples); }
+
+  //! Number of threads the cluster factors are distributed over
+  void setNumThreads(const int numThreads) {
+    m_numThreads = numThreads > 0 ? numThreads : 1;
+  }
+
   std::vector<double> getVariance() const;
   std::vector<double> getDeviation();
   std::vector<double> getTimes();
@@ -28,7 +39,7 @@ class AllanAcc {
  private:
   std::vector<double> calcVariance(double period);
 
-  std::vector<double> calcThetas(const double freq);
+  void calcThetas(const double freq);
   void initStrides();
   std::vector<double> getLogSpace(float a, float b);
   double getAvgFreq() { return 1.0 / getAvgDt(); }
@@ -39,13 +50,15 @@ class AllanAcc {
   std::string m_name;
   double m_freq;
   int numData;
-  std::vector<AccData> m_rawData;
-  std::vector<double> m_thetas;
+  utils::SpillableArray<AccData> m_rawData;
+  utils::SpillableArray<double> m_thetas;
   int numCluster;
   int numFactors;
   std::vector<int> mFactors;
 
   std::vector<double> mVariance;
+  double m_period = 0.0;
+  int m_numThreads = std::max(1u, std::thread::hardware_concurrency());
 };
 
 }  // namespace allanvar
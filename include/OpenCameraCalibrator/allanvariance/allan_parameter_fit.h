@@ -0,0 +1,85 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+
+namespace OpenICC {
+namespace allanvar {
+
+//! Allan variance of one sensor axis. Gyroscope variances are in (deg/h)^2,
+//! accelerometer variances in (m/s^2)^2
+struct AllanAxisData {
+  std::string name;
+  bool gyroscope = true;
+  std::vector<double> variances;
+  //! cluster times in seconds
+  std::vector<double> taus;
+  //! sample rate in Hz
+  double freq = 0.0;
+  //! mean of the samples, deg/h or m/s^2
+  double mean = 0.0;
+};
+
+//! Noise model of one axis,
+//!   sigma^2(tau) = Q^2/tau^2 + N^2/tau + B^2 + K^2 tau + R^2 tau^2
+//! with quantization noise Q, white noise N, bias instability B, rate
+//! random walk K and rate ramp R in the unit of the variances
+struct AllanAxisFit {
+  std::string name;
+  bool gyroscope = true;
+  double Q = 0.0;
+  double N = 0.0;
+  double B = 0.0;
+  double K = 0.0;
+  double R = 0.0;
+  //! white noise density in rad/s/sqrt(Hz) or m/s^2/sqrt(Hz)
+  double white_noise = 0.0;
+  //! minimum of the model deviation in rad/s or m/s^2
+  double bias_instability = 0.0;
+  //! cluster time of the bias instability in seconds
+  double bias_instability_tau = 0.0;
+  //! mean of the samples in deg/s or m/s^2
+  double bias = 0.0;
+  int num_iterations = 0;
+  double final_cost = 0.0;
+  bool converged = false;
+};
+
+//! Start values of Q, N, B, K, R. Least squares fit of the deviation to the
+//! powers -2..2 of sqrt(tau), as in imu_utils
+std::vector<double> AllanInitialValues(const std::vector<double>& variances,
+                                       const std::vector<double>& taus);
+
+//! sqrt(sigma^2(tau)) of the model
+double AllanModelDeviation(const AllanAxisFit& fit, const double tau);
+
+//! Fits the model to the log10 variances with analytic derivatives. Like
+//! imu_utils, accelerometer variances that still rise at cluster times
+//! below one second are skipped
+bool FitAllanAxis(const AllanAxisData& data, AllanAxisFit& fit);
+
+//! Fits all axes concurrently
+bool FitAllanAxes(const std::vector<AllanAxisData>& data,
+                  std::vector<AllanAxisFit>& fits);
+
+nlohmann::json AllanAxisFitToJson(const AllanAxisFit& fit);
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -0,0 +1,81 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace OpenICC {
+namespace allanvar {
+
+//! Overlapping allan variance for the first num_factors cluster factors.
+//! thetas is the integrated signal, so every cluster average is a difference
+//! of two entries and each factor costs one pass over the data. The factors
+//! are distributed round robin over num_threads threads
+std::vector<double> CalcOverlappingAllanVariance(
+    const double* thetas,
+    const int num_thetas,
+    const std::vector<int>& factors,
+    const int num_factors,
+    const double period,
+    const int num_threads);
+
+//! Non-overlapping allan variance at octave spaced cluster factors 1, 2, 4,
+//! ... computed while the samples arrive. Every level keeps the mean of its
+//! last cluster and a pending half cluster, two clusters of one level form
+//! the next one. Memory grows with the number of levels, not with the
+//! number of samples. Values are rates, e.g. deg/h or m/s^2
+class StreamingAllanVariance {
+ public:
+  StreamingAllanVariance() {}
+
+  void AddValue(const double value);
+
+  size_t NumValues() const { return num_values_; }
+
+  double MeanValue() const {
+    return num_values_ > 0 ? sum_ / num_values_ : 0.0;
+  }
+
+  //! Cluster factors that have at least two complete clusters
+  std::vector<int> GetFactors() const;
+
+  //! Variance at GetFactors()
+  std::vector<double> GetVariance() const;
+
+  //! Deviation at GetFactors()
+  std::vector<double> GetDeviation() const;
+
+  //! Cluster times at GetFactors() for a sample period in seconds
+  std::vector<double> GetTimes(const double period) const;
+
+ private:
+  struct Level {
+    double prev_mean = 0.0;
+    bool has_prev = false;
+    double pending_mean = 0.0;
+    bool has_pending = false;
+    double sum_sq_diff = 0.0;
+    size_t num_diffs = 0;
+  };
+
+  std::vector<Level> levels_;
+  size_t num_values_ = 0;
+  double sum_ = 0.0;
+};
+
+}  // namespace allanvar
+}  // namespace OpenICC
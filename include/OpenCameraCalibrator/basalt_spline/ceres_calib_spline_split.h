@@ -4,13 +4,13 @@
 #include "calib_helpers.h"
 #include "ceres_local_param.h"
 #include "common_types.h"
-#include <thread>
 
 #include "ceres_calib_split_residuals.h"
 #include <ceres/ceres.h>
 
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -572,7 +572,7 @@ public:
     ceres::Solver::Options options;
     options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
     options.max_num_iterations = iterations;
-    options.num_threads = std::thread::hardware_concurrency();
+    options.num_threads = OpenICC::utils::Executor::Global().SolverThreads(0);
     // options.logging_type = ceres::LoggingType::PER_MINIMIZER_ITERATION;
     options.minimizer_progress_to_stdout = true;
 
@@ -3,9 +3,14 @@
 #include "ceres_spline_helper.h"
 #include "common_types.h"
 
+#include "OpenCameraCalibrator/utils/camera_model_dispatch.h"
+#include "OpenCameraCalibrator/utils/imu_preintegration.h"
+#include "OpenCameraCalibrator/utils/observation_store.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <Eigen/Core>
+#include <cmath>
+#include <vector>
 #include <theia/sfm/camera/camera.h>
 #include <theia/sfm/camera/camera_intrinsics_model.h>
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
@@ -20,10 +25,94 @@
 
 static constexpr int BIAS_SPLINE_N = 3;
 
+//! Number of bias parameter blocks of an IMU residual. A constant bias is a
+//! single 3-vector block instead of the knots of a bias spline segment.
+inline int NumBiasBlocks(const bool constant_bias) {
+  return constant_bias ? 1 : BIAS_SPLINE_N;
+}
+
+//! Blending weights of the bias blocks of an IMU sample. With a single block
+//! the bias is read directly and its weight is 1.
+struct BiasSplineWeights {
+  BiasSplineWeights(double u, double inv_dt, int num_blocks)
+      : num_blocks(num_blocks) {
+    if (num_blocks == 1) {
+      coeff.setZero();
+      coeff[0] = 1.0;
+    } else {
+      CeresSplineHelper<double, BIAS_SPLINE_N>::computeCoeffs<0, false>(
+          u, inv_dt, coeff);
+    }
+  }
+
+  template <class T>
+  Eigen::Matrix<T, 3, 1> Evaluate(T const* const* blocks) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+    if (num_blocks == 1) {
+      return Eigen::Map<Vector3 const>(blocks[0]);
+    }
+    Vector3 bias;
+    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate_with_coeffs<3>(
+        blocks, coeff, &bias);
+    return bias;
+  }
+
+  int num_blocks;
+  Eigen::Matrix<double, BIAS_SPLINE_N, 1> coeff;
+};
+
+//! Largest number of intrinsic parameters of the supported camera models
+static constexpr int MAX_NUM_INTRINSICS = 10;
+
+//! Doubles per packed observation: x, y, 1 / sigma_x, 1 / sigma_y
+static constexpr int OBSERVATION_STRIDE =
+    OpenICC::utils::ObservationStore::kStride;
+
+//! Copies the observations first, ..., first + num - 1 of the store, which
+//! are laid out like the packed observations of the functors
+inline void PackObservations(const OpenICC::utils::ObservationStore& store,
+                             const size_t first,
+                             const size_t num,
+                             std::vector<double>* observations) {
+  const double* begin = store.Observation(first);
+  observations->assign(begin, begin + OBSERVATION_STRIDE * num);
+}
+
+//! Copies the homogeneous board points of the observations for reprojection
+//! functors that keep them constant instead of taking them as parameter
+//! blocks
+inline void PackBoardPoints(const OpenICC::utils::ObservationStore& store,
+                            const size_t first,
+                            const size_t num,
+                            std::vector<double>* board_points) {
+  board_points->resize(4 * num);
+  for (size_t i = 0; i < num; ++i) {
+    Eigen::Map<Eigen::Vector4d>(board_points->data() + 4 * i) =
+        Eigen::Map<const Eigen::Vector4d>(store.Point(first + i));
+  }
+}
+
+//! Scene point i of a reprojection functor, the parameter block
+//! sKnots[first_point_block + i] or the packed constant board point
+template <class T>
+inline Eigen::Matrix<T, 4, 1> ScenePoint(
+    T const* const* sKnots,
+    const int first_point_block,
+    const std::vector<double>& board_points,
+    const size_t i) {
+  if (!board_points.empty()) {
+    return Eigen::Map<const Eigen::Vector4d>(board_points.data() + 4 * i)
+        .template cast<T>();
+  }
+  return Eigen::Map<const Eigen::Matrix<T, 4, 1>>(
+      sKnots[first_point_block + i]);
+}
+
 template <int _N>
 struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
+  static constexpr int NUM_RESIDUALS = 3;
 
   using MatN = Eigen::Matrix<double, _N, _N>;
   using VecN = Eigen::Matrix<double, _N, 1>;
@@ -39,7 +128,8 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
                                double inv_so3_dt,
                                double inv_std,
                                double u_bias,
-                               double inv_bias_dt)
+                               double inv_bias_dt,
+                               int num_bias_blocks = BIAS_SPLINE_N)
       : measurement(measurement),
         u_r3(u_r3),
         inv_r3_dt(inv_r3_dt),
@@ -47,7 +137,13 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
         inv_so3_dt(inv_so3_dt),
         inv_std(inv_std),
         u_bias(u_bias),
-        inv_bias_dt(inv_bias_dt) {}
+        inv_bias_dt(inv_bias_dt),
+        bias_weights(u_bias, inv_bias_dt, num_bias_blocks) {
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3, inv_so3_dt, so3_coeff);
+    CeresSplineHelper<double, N>::template computeCoeffs<2, false>(
+        u_r3, inv_r3_dt, r3_accel_coeff);
+  }
 
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
@@ -57,20 +153,18 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
     Eigen::Map<Vector3> residuals(sResiduals);
 
     Sophus::SO3<T> R_w_i;
-    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
-        sKnots, T(u_so3), T(inv_so3_dt), &R_w_i);
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
 
     Vector3 accel_w;
-    CeresSplineHelper<T, N>::template evaluate<3, 2>(
-        sKnots + N, T(u_r3), T(inv_r3_dt), &accel_w);
+    CeresSplineHelper<T, N>::template evaluate_with_coeffs<3>(
+        sKnots + N, r3_accel_coeff, &accel_w);
 
-    Vector3 bias_spline;
-    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate<3, 0>(
-        sKnots + 2 * N, T(u_bias), T(inv_bias_dt), &bias_spline);
+    const Vector3 bias_spline = bias_weights.Evaluate(sKnots + 2 * N);
 
-    Eigen::Map<Vector3 const> const gravity(sKnots[2 * N + BIAS_SPLINE_N]);
-    Eigen::Map<Vector6 const> const acl_intrs(
-        sKnots[2 * N + BIAS_SPLINE_N + 1]);
+    const int gravity_block = 2 * N + bias_weights.num_blocks;
+    Eigen::Map<Vector3 const> const gravity(sKnots[gravity_block]);
+    Eigen::Map<Vector6 const> const acl_intrs(sKnots[gravity_block + 1]);
 
     OpenICC::ThreeAxisSensorCalibParams<T> accel_calib_triad(acl_intrs[0],
                                                              acl_intrs[1],
@@ -101,12 +195,17 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
   // bias spline
   double u_bias;
   double inv_bias_dt;
+  // blending coefficients, fixed by the measurement time
+  VecN so3_coeff;
+  VecN r3_accel_coeff;
+  BiasSplineWeights bias_weights;
 };
 
 template <int _N, template <class> class GroupT, bool OLD_TIME_DERIV>
 struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
+  static constexpr int NUM_RESIDUALS = 3;
 
   using MatN = Eigen::Matrix<double, _N, _N>;
   using VecN = Eigen::Matrix<double, _N, 1>;
@@ -122,13 +221,20 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
                        double inv_so3_dt,
                        double inv_std,
                        double u_bias,
-                       double inv_bias_dt)
+                       double inv_bias_dt,
+                       int num_bias_blocks = BIAS_SPLINE_N)
       : measurement(measurement),
         u_so3(u_so3),
         inv_so3_dt(inv_so3_dt),
         inv_std(inv_std),
         u_bias(u_bias),
-        inv_bias_dt(inv_bias_dt) {}
+        inv_bias_dt(inv_bias_dt),
+        bias_weights(u_bias, inv_bias_dt, num_bias_blocks) {
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3, inv_so3_dt, so3_coeff);
+    CeresSplineHelper<double, N>::template computeCoeffs<1, true>(
+        u_so3, inv_so3_dt, so3_vel_coeff);
+  }
 
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
@@ -140,14 +246,13 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
 
     Tangent rot_vel;
 
-    CeresSplineHelper<T, N>::template evaluate_lie<GroupT>(
-        sKnots, T(u_so3), T(inv_so3_dt), nullptr, &rot_vel);
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<GroupT>(
+        sKnots, so3_coeff, &so3_vel_coeff, nullptr, nullptr, nullptr, &rot_vel);
 
-    Vector3 bias_spline;
-    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate<3, 0>(
-        sKnots + N, T(u_bias), T(inv_bias_dt), &bias_spline);
+    const Vector3 bias_spline = bias_weights.Evaluate(sKnots + N);
 
-    Eigen::Map<Vector9 const> const gyr_intrs(sKnots[N + BIAS_SPLINE_N]);
+    Eigen::Map<Vector9 const> const gyr_intrs(
+        sKnots[N + bias_weights.num_blocks]);
     OpenICC::ThreeAxisSensorCalibParams<T> gyro_calib_triad(gyr_intrs[0],
                                                             gyr_intrs[1],
                                                             gyr_intrs[2],
@@ -175,9 +280,295 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
   // bias
   double u_bias, inv_std_bias;
   double inv_bias_dt;
+  // blending coefficients, fixed by the measurement time
+  VecN so3_coeff;
+  VecN so3_vel_coeff;
+  BiasSplineWeights bias_weights;
+};
+
+//! Gyroscope and accelerometer residual of one synchronized IMU sample. The
+//! rotation and rotational velocity are evaluated in one pass over the so3
+//! knots. Residuals are (gyro, accel) with the parameter blocks so3 knots, r3
+//! knots, gyro bias blocks, accl bias blocks, gravity, gyro intrinsics and accl
+//! intrinsics.
+template <int _N>
+struct ImuCostFunctorSplit : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+  static constexpr int NUM_RESIDUALS = 6;
+
+  using VecN = Eigen::Matrix<double, _N, 1>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  ImuCostFunctorSplit(const Eigen::Vector3d& accl_measurement,
+                      const Eigen::Vector3d& gyro_measurement,
+                      double u_so3,
+                      double inv_so3_dt,
+                      double u_r3,
+                      double inv_r3_dt,
+                      double u_gyro_bias,
+                      double inv_gyro_bias_dt,
+                      double u_accl_bias,
+                      double inv_accl_bias_dt,
+                      double inv_std_so3,
+                      double inv_std_r3,
+                      int num_gyro_bias_blocks = BIAS_SPLINE_N,
+                      int num_accl_bias_blocks = BIAS_SPLINE_N)
+      : accl_measurement(accl_measurement),
+        gyro_measurement(gyro_measurement),
+        u_so3(u_so3),
+        inv_so3_dt(inv_so3_dt),
+        u_r3(u_r3),
+        inv_r3_dt(inv_r3_dt),
+        u_gyro_bias(u_gyro_bias),
+        inv_gyro_bias_dt(inv_gyro_bias_dt),
+        u_accl_bias(u_accl_bias),
+        inv_accl_bias_dt(inv_accl_bias_dt),
+        inv_std_so3(inv_std_so3),
+        inv_std_r3(inv_std_r3),
+        gyro_bias_weights(u_gyro_bias, inv_gyro_bias_dt, num_gyro_bias_blocks),
+        accl_bias_weights(
+            u_accl_bias, inv_accl_bias_dt, num_accl_bias_blocks) {
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3, inv_so3_dt, so3_coeff);
+    CeresSplineHelper<double, N>::template computeCoeffs<1, true>(
+        u_so3, inv_so3_dt, so3_vel_coeff);
+    CeresSplineHelper<double, N>::template computeCoeffs<2, false>(
+        u_r3, inv_r3_dt, r3_accel_coeff);
+  }
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+    using Vector6 = Eigen::Matrix<T, 6, 1>;
+    using Vector9 = Eigen::Matrix<T, 9, 1>;
+
+    Eigen::Map<Vector3> gyro_residuals(sResiduals);
+    Eigen::Map<Vector3> accl_residuals(sResiduals + 3);
+
+    Sophus::SO3<T> R_w_i;
+    Vector3 rot_vel;
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, &so3_vel_coeff, nullptr, nullptr, &R_w_i, &rot_vel);
+
+    Vector3 accel_w;
+    CeresSplineHelper<T, N>::template evaluate_with_coeffs<3>(
+        sKnots + N, r3_accel_coeff, &accel_w);
+
+    const int accl_bias_block = 2 * N + gyro_bias_weights.num_blocks;
+    const Vector3 gyro_bias = gyro_bias_weights.Evaluate(sKnots + 2 * N);
+    const Vector3 accl_bias =
+        accl_bias_weights.Evaluate(sKnots + accl_bias_block);
+
+    const int gravity_block = accl_bias_block + accl_bias_weights.num_blocks;
+    Eigen::Map<Vector3 const> const gravity(sKnots[gravity_block]);
+    Eigen::Map<Vector9 const> const gyr_intrs(sKnots[gravity_block + 1]);
+    Eigen::Map<Vector6 const> const acl_intrs(sKnots[gravity_block + 2]);
+
+    OpenICC::ThreeAxisSensorCalibParams<T> gyro_calib_triad(gyr_intrs[0],
+                                                            gyr_intrs[1],
+                                                            gyr_intrs[2],
+                                                            gyr_intrs[3],
+                                                            gyr_intrs[4],
+                                                            gyr_intrs[5],
+                                                            gyr_intrs[6],
+                                                            gyr_intrs[7],
+                                                            gyr_intrs[8],
+                                                            gyro_bias[0],
+                                                            gyro_bias[1],
+                                                            gyro_bias[2]);
+    OpenICC::ThreeAxisSensorCalibParams<T> accel_calib_triad(acl_intrs[0],
+                                                             acl_intrs[1],
+                                                             acl_intrs[2],
+                                                             T(0),
+                                                             T(0),
+                                                             T(0),
+                                                             acl_intrs[3],
+                                                             acl_intrs[4],
+                                                             acl_intrs[5],
+                                                             accl_bias[0],
+                                                             accl_bias[1],
+                                                             accl_bias[2]);
+
+    const Vector3 gyro_raw = gyro_measurement.template cast<T>();
+    const Vector3 accl_raw = accl_measurement.template cast<T>();
+    gyro_residuals = T(inv_std_so3) *
+                     (rot_vel - gyro_calib_triad.UnbiasNormalize(gyro_raw));
+    accl_residuals =
+        T(inv_std_r3) * (R_w_i.inverse() * (accel_w + gravity) -
+                         accel_calib_triad.UnbiasNormalize(accl_raw));
+    return true;
+  }
+
+  Eigen::Vector3d accl_measurement;
+  Eigen::Vector3d gyro_measurement;
+  double u_so3;
+  double inv_so3_dt;
+  double u_r3;
+  double inv_r3_dt;
+  // bias splines
+  double u_gyro_bias;
+  double inv_gyro_bias_dt;
+  double u_accl_bias;
+  double inv_accl_bias_dt;
+  double inv_std_so3;
+  double inv_std_r3;
+  // blending coefficients, fixed by the measurement time
+  VecN so3_coeff;
+  VecN so3_vel_coeff;
+  VecN r3_accel_coeff;
+  BiasSplineWeights gyro_bias_weights;
+  BiasSplineWeights accl_bias_weights;
 };
 
+//! Stacks the residuals of several IMU samples that depend on the same spline
+//! knots into one residual block. SampleFunctor is GyroCostFunctorSplit,
+//! AccelerationCostFunctorSplit or ImuCostFunctorSplit.
+template <class SampleFunctor>
+struct ImuBatchCostFunctorSplit {
+  explicit ImuBatchCostFunctorSplit(std::vector<SampleFunctor> samples)
+      : samples(std::move(samples)) {}
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    for (size_t i = 0; i < samples.size(); ++i) {
+      if (!samples[i](sKnots, sResiduals + SampleFunctor::NUM_RESIDUALS * i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<SampleFunctor> samples;
+};
+
+//! Compound factor of all IMU samples between two times of one spline
+//! segment. Compares the rotation and velocity increments of the spline with
+//! the preintegrated ones, corrected to first order for the bias of the
+//! bias splines in the middle of the interval.
 template <int _N>
+struct ImuPreintegrationCostFunctorSplit
+    : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  ImuPreintegrationCostFunctorSplit(
+      const OpenICC::utils::ImuPreintegration& preintegration,
+      double u_so3_start,
+      double u_so3_end,
+      double inv_so3_dt,
+      double u_r3_start,
+      double u_r3_end,
+      double inv_r3_dt,
+      double u_gyro_bias,
+      double inv_gyro_bias_dt,
+      double u_accl_bias,
+      double inv_accl_bias_dt,
+      double inv_std_rot,
+      double inv_std_vel,
+      int num_gyro_bias_blocks = BIAS_SPLINE_N,
+      int num_accl_bias_blocks = BIAS_SPLINE_N)
+      : preintegration(preintegration),
+        u_so3_start(u_so3_start),
+        u_so3_end(u_so3_end),
+        inv_so3_dt(inv_so3_dt),
+        u_r3_start(u_r3_start),
+        u_r3_end(u_r3_end),
+        inv_r3_dt(inv_r3_dt),
+        u_gyro_bias(u_gyro_bias),
+        inv_gyro_bias_dt(inv_gyro_bias_dt),
+        u_accl_bias(u_accl_bias),
+        inv_accl_bias_dt(inv_accl_bias_dt),
+        inv_std_rot(inv_std_rot),
+        inv_std_vel(inv_std_vel),
+        gyro_bias_weights(u_gyro_bias, inv_gyro_bias_dt, num_gyro_bias_blocks),
+        accl_bias_weights(
+            u_accl_bias, inv_accl_bias_dt, num_accl_bias_blocks) {
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3_start, inv_so3_dt, so3_coeff_start);
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3_end, inv_so3_dt, so3_coeff_end);
+    CeresSplineHelper<double, N>::template computeCoeffs<1, false>(
+        u_r3_start, inv_r3_dt, r3_vel_coeff_start);
+    CeresSplineHelper<double, N>::template computeCoeffs<1, false>(
+        u_r3_end, inv_r3_dt, r3_vel_coeff_end);
+  }
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+
+    Eigen::Map<Vector3> residual_rot(sResiduals);
+    Eigen::Map<Vector3> residual_vel(sResiduals + 3);
+
+    Sophus::SO3<T> R_w_i_start, R_w_i_end;
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff_start, nullptr, nullptr, nullptr, &R_w_i_start);
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff_end, nullptr, nullptr, nullptr, &R_w_i_end);
+
+    Vector3 vel_w_start, vel_w_end;
+    CeresSplineHelper<T, N>::template evaluate_with_coeffs<3>(
+        sKnots + N, r3_vel_coeff_start, &vel_w_start);
+    CeresSplineHelper<T, N>::template evaluate_with_coeffs<3>(
+        sKnots + N, r3_vel_coeff_end, &vel_w_end);
+
+    const int accl_bias_block = 2 * N + gyro_bias_weights.num_blocks;
+    const Vector3 gyro_bias = gyro_bias_weights.Evaluate(sKnots + 2 * N);
+    const Vector3 accl_bias =
+        accl_bias_weights.Evaluate(sKnots + accl_bias_block);
+
+    Eigen::Map<Vector3 const> const gravity(
+        sKnots[accl_bias_block + accl_bias_weights.num_blocks]);
+
+    const Vector3 d_gyro_bias = gyro_bias - preintegration.gyro_bias.cast<T>();
+    const Vector3 d_accl_bias = accl_bias - preintegration.accl_bias.cast<T>();
+
+    const Sophus::SO3<T> delta_rot =
+        preintegration.delta_rot.cast<T>() *
+        Sophus::SO3<T>::exp(
+            preintegration.d_rot_d_gyro_bias.cast<T>() * d_gyro_bias);
+    const Vector3 delta_vel =
+        preintegration.delta_vel.cast<T>() +
+        preintegration.d_vel_d_gyro_bias.cast<T>() * d_gyro_bias +
+        preintegration.d_vel_d_accl_bias.cast<T>() * d_accl_bias;
+
+    const Sophus::SO3<T> R_i_w_start = R_w_i_start.inverse();
+    residual_rot = T(inv_std_rot) *
+                   (delta_rot.inverse() * R_i_w_start * R_w_i_end).log();
+    residual_vel =
+        T(inv_std_vel) *
+        (R_i_w_start * (vel_w_end - vel_w_start +
+                        gravity * T(preintegration.delta_t_s)) -
+         delta_vel);
+
+    return true;
+  }
+
+  OpenICC::utils::ImuPreintegration preintegration;
+  double u_so3_start;
+  double u_so3_end;
+  double inv_so3_dt;
+  double u_r3_start;
+  double u_r3_end;
+  double inv_r3_dt;
+  double u_gyro_bias;
+  double inv_gyro_bias_dt;
+  double u_accl_bias;
+  double inv_accl_bias_dt;
+  double inv_std_rot;
+  double inv_std_vel;
+  // blending coefficients, fixed by the interval
+  Eigen::Matrix<double, N, 1> so3_coeff_start;
+  Eigen::Matrix<double, N, 1> so3_coeff_end;
+  Eigen::Matrix<double, N, 1> r3_vel_coeff_start;
+  Eigen::Matrix<double, N, 1> r3_vel_coeff_end;
+  BiasSplineWeights gyro_bias_weights;
+  BiasSplineWeights accl_bias_weights;
+};
+
+template <int _N, class CameraModel>
 struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
@@ -189,20 +580,34 @@ struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   using Mat3 = Eigen::Matrix<double, 3, 3>;
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  GSReprojectionCostFunctorSplit(const theia::View* view,
-                                 const theia::Reconstruction* image_data,
+  GSReprojectionCostFunctorSplit(const OpenICC::utils::ObservationStore& store,
+                                 const size_t view_index,
+                                 const size_t first,
+                                 const size_t num_observations,
                                  const double u_so3,
                                  const double u_r3,
                                  const double inv_so3_dt,
                                  const double inv_r3_dt,
-                                 std::vector<theia::TrackId> track_ids)
-      : view(view),
-        image_data(image_data),
-        u_so3(u_so3),
+                                 const bool constant_points = false)
+      : u_so3(u_so3),
         u_r3(u_r3),
         inv_so3_dt(inv_so3_dt),
         inv_r3_dt(inv_r3_dt),
-        track_ids(track_ids) {}
+        num_observations(num_observations) {
+    PackObservations(store, first, num_observations, &observations);
+    if (constant_points) {
+      PackBoardPoints(store, first, num_observations, &board_points);
+    }
+    const theia::Camera& cam = *store.GetView(view_index).camera;
+    num_intrinsics = cam.CameraIntrinsics()->NumParameters();
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intrinsics[i] = cam.intrinsics()[i];
+    }
+    CeresSplineHelper<double, N>::template computeCoeffs<0, true>(
+        u_so3, inv_so3_dt, so3_coeff);
+    CeresSplineHelper<double, N>::template computeCoeffs<0, false>(
+        u_r3, inv_r3_dt, r3_coeff);
+  }
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
     using Vector3 = Eigen::Matrix<T, 3, 1>;
@@ -212,85 +617,62 @@ struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
     const int N2 = 2 * N;
     Eigen::Map<Sophus::SE3<T> const> const T_i_c(sKnots[N2]);
 
-    const auto cam = view->Camera();
-    const auto cam_model = cam.GetCameraIntrinsicsModelType();
-
-    T intr[10];
-    for (int i = 0; i < cam.CameraIntrinsics()->NumParameters(); ++i) {
-      intr[i] = T(cam.intrinsics()[i]);
+    T intr[MAX_NUM_INTRINSICS];
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intr[i] = T(intrinsics[i]);
     }
 
-    const T t_so3_row = T(u_so3);
-    const T t_r3_row = T(u_r3);
-
     Sophus::SO3<T> R_w_i;
-    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
-        sKnots, t_so3_row, T(inv_so3_dt), &R_w_i);
+    CeresSplineHelper<T, N>::template evaluate_lie_with_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
 
     Vector3 t_w_i;
-    CeresSplineHelper<T, N>::template evaluate<3, 0>(
-        sKnots + N, t_r3_row, T(inv_r3_dt), &t_w_i);
+    CeresSplineHelper<T, N>::template evaluate_with_coeffs<3>(
+        sKnots + N, r3_coeff, &t_w_i);
 
     Sophus::SE3<T> T_w_c = Sophus::SE3<T>(R_w_i, t_w_i) * T_i_c;
     Matrix4 T_c_w_matrix = T_w_c.inverse().matrix();
 
-    for (size_t i = 0; i < track_ids.size(); ++i) {
-      const auto feature = *view->GetFeature(track_ids[i]);
+    for (size_t i = 0; i < num_observations; ++i) {
+      const double* obs = observations.data() + OBSERVATION_STRIDE * i;
 
-      // get corresponding 3d point
-      Eigen::Map<Vector4 const> const scene_point(sKnots[N2 + i]);
+      // get corresponding 3d point, they follow after T_i_c
+      const Vector4 scene_point = ScenePoint(sKnots, N2 + 1, board_points, i);
 
       Vector3 p3d = (T_c_w_matrix * scene_point).hnormalized();
 
       T reprojection[2];
-      bool success = false;
-      if (theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION ==
-          cam.GetCameraIntrinsicsModelType()) {
-        success =
-            theia::DivisionUndistortionCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::DOUBLE_SPHERE == cam_model) {
-        success = theia::DoubleSphereCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE == cam_model) {
-        success = theia::PinholeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::FISHEYE == cam_model) {
-        success = theia::FisheyeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED ==
-                 cam_model) {
-        success = theia::ExtendedUnifiedCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL ==
-                 cam_model) {
-        success =
-            theia::PinholeRadialTangentialCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      }
+      const bool success = CameraModel::CameraToPixelCoordinates(
+          intr, p3d.data(), reprojection);
 
       if (!success) {
         sResiduals[2 * i + 0] = T(1e10);
         sResiduals[2 * i + 1] = T(1e10);
       } else {
-        const T inv_info_x = T(1. / ceres::sqrt(feature.covariance_(0, 0)));
-        const T inv_info_y = T(1. / ceres::sqrt(feature.covariance_(1, 1)));
-        sResiduals[2 * i + 0] = inv_info_x * (reprojection[0] - T(feature.x()));
-        sResiduals[2 * i + 1] = inv_info_y * (reprojection[1] - T(feature.y()));
+        sResiduals[2 * i + 0] = T(obs[2]) * (reprojection[0] - T(obs[0]));
+        sResiduals[2 * i + 1] = T(obs[3]) * (reprojection[1] - T(obs[1]));
       }
     }
     return true;
   }
-  const theia::View* view;
-  const theia::Reconstruction* image_data;
-  std::vector<theia::TrackId> track_ids;
+  // x, y, 1 / sigma_x, 1 / sigma_y of each observed track
+  std::vector<double> observations;
+  // homogeneous board points if they are not parameter blocks
+  std::vector<double> board_points;
+  size_t num_observations;
   double u_so3;
   double inv_so3_dt;
   double u_r3;
   double inv_r3_dt;
+  // intrinsics are constant during the spline optimization
+  double intrinsics[MAX_NUM_INTRINSICS];
+  int num_intrinsics;
+  // blending coefficients, fixed by the capture time
+  VecN so3_coeff;
+  VecN r3_coeff;
 };
 
-template <int _N>
+template <int _N, class CameraModel>
 struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
@@ -302,20 +684,30 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   using Mat3 = Eigen::Matrix<double, 3, 3>;
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  RSReprojectionCostFunctorSplit(const theia::View* view,
-                                 const theia::Reconstruction* image_data,
+  RSReprojectionCostFunctorSplit(const OpenICC::utils::ObservationStore& store,
+                                 const size_t view_index,
+                                 const size_t first,
+                                 const size_t num_observations,
                                  const double u_so3,
                                  const double u_r3,
                                  const double inv_so3_dt,
                                  const double inv_r3_dt,
-                                 std::vector<theia::TrackId> track_ids)
-      : view(view),
-        image_data(image_data),
-        u_so3(u_so3),
+                                 const bool constant_points = false)
+      : u_so3(u_so3),
         u_r3(u_r3),
         inv_so3_dt(inv_so3_dt),
         inv_r3_dt(inv_r3_dt),
-        track_ids(track_ids) {}
+        num_observations(num_observations) {
+    PackObservations(store, first, num_observations, &observations);
+    if (constant_points) {
+      PackBoardPoints(store, first, num_observations, &board_points);
+    }
+    const theia::Camera& cam = *store.GetView(view_index).camera;
+    num_intrinsics = cam.CameraIntrinsics()->NumParameters();
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intrinsics[i] = cam.intrinsics()[i];
+    }
+  }
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
     using Vector3 = Eigen::Matrix<T, 3, 1>;
@@ -327,21 +719,18 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
     Eigen::Map<Sophus::SE3<T> const> const T_i_c(sKnots[N2]);
     Eigen::Map<Vector1 const> const line_delay(sKnots[N2 + 1]);
 
-    const auto cam = view->Camera();
-    const auto cam_model = cam.GetCameraIntrinsicsModelType();
-
-    T intr[10];
-    for (int i = 0; i < cam.CameraIntrinsics()->NumParameters(); ++i) {
-      intr[i] = T(cam.intrinsics()[i]);
+    T intr[MAX_NUM_INTRINSICS];
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intr[i] = T(intrinsics[i]);
     }
 
     // if we have a rolling shutter cam we will always need to evaluate with
     // line delay
-    for (size_t i = 0; i < track_ids.size(); ++i) {
-      const auto feature = *view->GetFeature(track_ids[i]);
+    for (size_t i = 0; i < num_observations; ++i) {
+      const double* obs = observations.data() + OBSERVATION_STRIDE * i;
 
       // get time for respective RS line
-      const T y_coord = T(feature.y()) * line_delay[0];
+      const T y_coord = T(obs[1]) * line_delay[0];
       const T t_so3_row = T(u_so3) + y_coord;
       const T t_r3_row = T(u_r3) + y_coord;
 
@@ -357,56 +746,163 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
       Matrix4 T_c_w_matrix = T_w_c.inverse().matrix();
 
       // get corresponding 3d point
-      Eigen::Map<Vector4 const> const scene_point(sKnots[N2 + 2 + i]);
+      const Vector4 scene_point = ScenePoint(sKnots, N2 + 2, board_points, i);
 
       Vector3 p3d = (T_c_w_matrix * scene_point).hnormalized();
 
       T reprojection[2];
-      bool success = false;
-      if (theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION ==
-          cam.GetCameraIntrinsicsModelType()) {
-        success =
-            theia::DivisionUndistortionCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::DOUBLE_SPHERE == cam_model) {
-        success = theia::DoubleSphereCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE == cam_model) {
-        success = theia::PinholeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::FISHEYE == cam_model) {
-        success = theia::FisheyeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED ==
-                 cam_model) {
-        success = theia::ExtendedUnifiedCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL ==
-                 cam_model) {
-        success =
-            theia::PinholeRadialTangentialCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
+      const bool success = CameraModel::CameraToPixelCoordinates(
+          intr, p3d.data(), reprojection);
+
+      if (!success) {
+        sResiduals[2 * i + 0] = T(1e10);
+        sResiduals[2 * i + 1] = T(1e10);
+      } else {
+        sResiduals[2 * i + 0] = T(obs[2]) * (reprojection[0] - T(obs[0]));
+        sResiduals[2 * i + 1] = T(obs[3]) * (reprojection[1] - T(obs[1]));
       }
+    }
+    return true;
+  }
+  // x, y, 1 / sigma_x, 1 / sigma_y of each observed track
+  std::vector<double> observations;
+  // homogeneous board points if they are not parameter blocks
+  std::vector<double> board_points;
+  size_t num_observations;
+  double u_so3;
+  double inv_so3_dt;
+  double u_r3;
+  double inv_r3_dt;
+  // intrinsics are constant during the spline optimization
+  double intrinsics[MAX_NUM_INTRINSICS];
+  int num_intrinsics;
+};
+
+//! Rolling shutter reprojection that evaluates the spline pose, angular and
+//! linear velocity once at the center row of the image and moves every
+//! feature to its own row with a constant velocity model. The rows are
+//! shifted in normalized time by y * line_delay like in
+//! RSReprojectionCostFunctorSplit. The error to the exact functor grows
+//! quadratically with the row distance to the center and with the angular
+//! acceleration.
+template <int _N, class CameraModel>
+struct RSLinearizedReprojectionCostFunctorSplit
+    : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  using MatN = Eigen::Matrix<double, _N, _N>;
+  using VecN = Eigen::Matrix<double, _N, 1>;
+
+  using Vec3 = Eigen::Matrix<double, 3, 1>;
+  using Mat3 = Eigen::Matrix<double, 3, 3>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  RSLinearizedReprojectionCostFunctorSplit(
+      const OpenICC::utils::ObservationStore& store,
+      const size_t view_index,
+      const size_t first,
+      const size_t num_observations,
+      const double u_so3,
+      const double u_r3,
+      const double inv_so3_dt,
+      const double inv_r3_dt,
+      const bool constant_points = false)
+      : u_so3(u_so3),
+        u_r3(u_r3),
+        inv_so3_dt(inv_so3_dt),
+        inv_r3_dt(inv_r3_dt),
+        num_observations(num_observations) {
+    PackObservations(store, first, num_observations, &observations);
+    if (constant_points) {
+      PackBoardPoints(store, first, num_observations, &board_points);
+    }
+    const theia::Camera& cam = *store.GetView(view_index).camera;
+    num_intrinsics = cam.CameraIntrinsics()->NumParameters();
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intrinsics[i] = cam.intrinsics()[i];
+    }
+    center_row = 0.5 * cam.ImageHeight();
+  }
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+    using Vector4 = Eigen::Matrix<T, 4, 1>;
+    using Vector1 = Eigen::Matrix<T, 1, 1>;
+    using Matrix3 = Eigen::Matrix<T, 3, 3>;
+
+    const int N2 = 2 * N;
+    Eigen::Map<Sophus::SE3<T> const> const T_i_c(sKnots[N2]);
+    Eigen::Map<Vector1 const> const line_delay(sKnots[N2 + 1]);
+
+    T intr[MAX_NUM_INTRINSICS];
+    for (int i = 0; i < num_intrinsics; ++i) {
+      intr[i] = T(intrinsics[i]);
+    }
+
+    // pose and velocities at the center row
+    const T y_center = T(center_row) * line_delay[0];
+    Sophus::SO3<T> R_w_i;
+    Vector3 omega_i;
+    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
+        sKnots, T(u_so3) + y_center, T(inv_so3_dt), &R_w_i, &omega_i);
+
+    Vector3 t_w_i, v_w_i;
+    CeresSplineHelper<T, N>::template evaluate<3, 0>(
+        sKnots + N, T(u_r3) + y_center, T(inv_r3_dt), &t_w_i);
+    CeresSplineHelper<T, N>::template evaluate<3, 1>(
+        sKnots + N, T(u_r3) + y_center, T(inv_r3_dt), &v_w_i);
+
+    // the velocities are per second, the row shift is in normalized time of
+    // the respective spline
+    const Vector3 omega_row = omega_i / T(inv_so3_dt);
+    const Vector3 v_row = v_w_i / T(inv_r3_dt);
+
+    const Matrix3 R_i_c = T_i_c.so3().matrix();
+    const Vector3 t_i_c = T_i_c.translation();
+
+    for (size_t i = 0; i < num_observations; ++i) {
+      const double* obs = observations.data() + OBSERVATION_STRIDE * i;
+
+      const T dy = (T(obs[1]) - T(center_row)) * line_delay[0];
+      const Matrix3 R_w_i_row =
+          (R_w_i * Sophus::SO3<T>::exp(omega_row * dy)).matrix();
+      const Vector3 t_w_i_row = t_w_i + v_row * dy;
+
+      // T_c_w = (T_w_i * T_i_c)^-1 applied to the scene point
+      const Vector4 scene_point = ScenePoint(sKnots, N2 + 2, board_points, i);
+      const Vector3 p_w = scene_point.hnormalized();
+      const Vector3 p_i = R_w_i_row.transpose() * (p_w - t_w_i_row);
+      Vector3 p3d = R_i_c.transpose() * (p_i - t_i_c);
+
+      T reprojection[2];
+      const bool success = CameraModel::CameraToPixelCoordinates(
+          intr, p3d.data(), reprojection);
 
       if (!success) {
         sResiduals[2 * i + 0] = T(1e10);
         sResiduals[2 * i + 1] = T(1e10);
       } else {
-        const T inv_info_x = T(1. / ceres::sqrt(feature.covariance_(0, 0)));
-        const T inv_info_y = T(1. / ceres::sqrt(feature.covariance_(1, 1)));
-        sResiduals[2 * i + 0] = inv_info_x * (reprojection[0] - T(feature.x()));
-        sResiduals[2 * i + 1] = inv_info_y * (reprojection[1] - T(feature.y()));
+        sResiduals[2 * i + 0] = T(obs[2]) * (reprojection[0] - T(obs[0]));
+        sResiduals[2 * i + 1] = T(obs[3]) * (reprojection[1] - T(obs[1]));
       }
     }
     return true;
   }
-  const theia::View* view;
-  const theia::Reconstruction* image_data;
-  std::vector<theia::TrackId> track_ids;
+  // x, y, 1 / sigma_x, 1 / sigma_y of each observed track
+  std::vector<double> observations;
+  // homogeneous board points if they are not parameter blocks
+  std::vector<double> board_points;
+  size_t num_observations;
   double u_so3;
   double inv_so3_dt;
   double u_r3;
   double inv_r3_dt;
+  // intrinsics are constant during the spline optimization
+  double intrinsics[MAX_NUM_INTRINSICS];
+  int num_intrinsics;
+  // row at which the spline is evaluated
+  double center_row;
 };
 
 // template <int _N>
@@ -0,0 +1,108 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//! Compile time lists of parameter block sizes
+template <int Value, class Sequence>
+struct RepeatBlockSizeImpl;
+
+template <int Value, int... Is>
+struct RepeatBlockSizeImpl<Value, std::integer_sequence<int, Is...>> {
+  using type = std::integer_sequence<int, (Is * 0 + Value)...>;
+};
+
+//! Count times the block size Value
+template <int Value, int Count>
+using RepeatBlockSize =
+    typename RepeatBlockSizeImpl<Value,
+                                 std::make_integer_sequence<int, Count>>::type;
+
+template <class... Sequences>
+struct ConcatBlockSizes;
+
+template <int... As>
+struct ConcatBlockSizes<std::integer_sequence<int, As...>> {
+  using type = std::integer_sequence<int, As...>;
+};
+
+template <int... As, int... Bs, class... Rest>
+struct ConcatBlockSizes<std::integer_sequence<int, As...>,
+                        std::integer_sequence<int, Bs...>,
+                        Rest...> {
+  using type = typename ConcatBlockSizes<
+      std::integer_sequence<int, As..., Bs...>,
+      Rest...>::type;
+};
+
+template <class Functor, int NumResiduals, class BlockSizes>
+struct FixedSizeAutoDiffCostFunctionImpl;
+
+template <class Functor, int NumResiduals, int... BlockSizes>
+struct FixedSizeAutoDiffCostFunctionImpl<
+    Functor,
+    NumResiduals,
+    std::integer_sequence<int, BlockSizes...>> {
+  using type =
+      ceres::AutoDiffCostFunction<Functor, NumResiduals, BlockSizes...>;
+};
+
+//! Lets a functor written for DynamicAutoDiffCostFunction, i.e. taking all
+//! parameter blocks as one array, be used by a fixed-size
+//! AutoDiffCostFunction, which passes every block as its own argument. Does
+//! not own the functor.
+template <class Functor>
+struct FixedSizeFunctorAdapter {
+  explicit FixedSizeFunctorAdapter(Functor* functor) : functor(functor) {}
+
+  template <typename... Args>
+  bool operator()(Args... args) const {
+    // the parameter blocks are followed by the residuals
+    auto* residuals = std::get<sizeof...(Args) - 1>(std::make_tuple(args...));
+    using T = std::remove_pointer_t<decltype(residuals)>;
+    const T* blocks[] = {args...};
+    return (*functor)(blocks, residuals);
+  }
+
+  Functor* functor;
+};
+
+//! Fixed-size autodiff cost function of a reprojection functor for
+//! NumFeatures features of a view. The blocks are the N so3 and N r3 knots,
+//! T_i_c, the line delay for rolling shutter and one block per feature
+//! unless the board points are constants of the functor. With all sizes
+//! known at compile time ceres uses stack allocated Jets.
+template <class Functor,
+          int N,
+          int NumFeatures,
+          bool RollingShutter,
+          bool ConstantPoints>
+using FixedSizeReprojectionCostFunction =
+    typename FixedSizeAutoDiffCostFunctionImpl<
+        FixedSizeFunctorAdapter<Functor>,
+        2 * NumFeatures,
+        typename ConcatBlockSizes<
+            RepeatBlockSize<4, N>,
+            RepeatBlockSize<3, N>,
+            std::integer_sequence<int, 7>,
+            RepeatBlockSize<1, RollingShutter ? 1 : 0>,
+            RepeatBlockSize<4, ConstantPoints ? 0 : NumFeatures>>::type>::
+        type;
@@ -113,3 +113,49 @@ class LieLocalParameterization : public ceres::LocalParameterization {
   ///@brief Local size
   virtual int LocalSize() const { return Groupd::DoF; }
 };
+
+/// @brief Local parametrization of a Sophus SE3 that only updates the
+/// rotation, the translation stays at its initial value.
+class SE3RotationLocalParameterization : public ceres::LocalParameterization {
+ public:
+  virtual ~SE3RotationLocalParameterization() {}
+
+  /// @brief plus operation for Ceres
+  ///
+  ///  [R * exp(x), t]
+  ///
+  virtual bool Plus(double const* T_raw,
+                    double const* delta_raw,
+                    double* T_plus_delta_raw) const {
+    Eigen::Map<Sophus::SE3d const> const T(T_raw);
+    Eigen::Map<Sophus::SO3d::Tangent const> const delta(delta_raw);
+    Eigen::Map<Sophus::SE3d> T_plus_delta(T_plus_delta_raw);
+    T_plus_delta =
+        Sophus::SE3d(T.so3() * Sophus::SO3d::exp(delta), T.translation());
+    return true;
+  }
+
+  ///@brief Jacobian of plus operation for Ceres
+  ///
+  /// Dx [R * exp(x), t]  with  x=0
+  ///
+  virtual bool ComputeJacobian(double const* T_raw,
+                               double* jacobian_raw) const {
+    Eigen::Map<Sophus::SE3d const> T(T_raw);
+    Eigen::Map<Eigen::Matrix<double,
+                             Sophus::SE3d::num_parameters,
+                             Sophus::SO3d::DoF,
+                             Eigen::RowMajor>>
+        jacobian(jacobian_raw);
+    jacobian.setZero();
+    jacobian.topRows<Sophus::SO3d::num_parameters>() =
+        T.so3().Dx_this_mul_exp_x_at_0();
+    return true;
+  }
+
+  ///@brief Global size
+  virtual int GlobalSize() const { return Sophus::SE3d::num_parameters; }
+
+  ///@brief Local size
+  virtual int LocalSize() const { return Sophus::SO3d::DoF; }
+};
@@ -38,8 +38,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include "sophus_utils.h"
 #include "spline_common.h"
 #include <Eigen/Dense>
+#include <type_traits>
 
 #include "ceres/ceres.h"
 
@@ -73,19 +75,40 @@ struct CeresSplineHelper {
     Eigen::MatrixBase<Derived>& res =
         const_cast<Eigen::MatrixBase<Derived>&>(res_const);
 
+    static constexpr SplineMatrixTable<N> base = baseCoefficientsTable<N>();
+
     res.setZero();
 
-    if (Derivative < N) {
-      res[Derivative] = base_coefficients_(Derivative, Derivative);
+    if constexpr (Derivative < N) {
+      res[Derivative] = T(base.m[Derivative][Derivative]);
 
       T _t = t;
       for (int j = Derivative + 1; j < N; j++) {
-        res[j] = base_coefficients_(Derivative, j) * _t;
+        res[j] = base.m[Derivative][j] * _t;
         _t = _t * t;
       }
     }
   }
 
+  /// @brief Blending coefficients of the N knots for a time derivative.
+  ///
+  /// The coefficients only depend on the normalized time and the knot
+  /// spacing. Cost functors with a fixed measurement time compute them once
+  /// and evaluate the spline with the *_with_coeffs functions.
+  /// @param[in] u normalized time
+  /// @param[in] inv_dt inverse of the time spacing in seconds between spline
+  /// knots
+  /// @param[out] coeff blending coefficients, scaled by inv_dt^Derivative
+  template <int Derivative, bool Cumulative>
+  static inline void computeCoeffs(const T u, const T inv_dt, VecN& coeff) {
+    evaluateBlendingWeights<N, Derivative, Cumulative>(u, coeff);
+    if (Derivative > 0) {
+      T scale = inv_dt;
+      for (int d = 1; d < Derivative; ++d) scale = scale * inv_dt;
+      coeff *= scale;
+    }
+  }
+
   /// @brief Evaluate Lie group cummulative B-spline and time derivatives.
   ///
   /// @param[in] sKnots array of pointers of the spline knots. The size of each
@@ -107,33 +130,56 @@ struct CeresSplineHelper {
       typename GroupT<T>::Tangent* vel_out = nullptr,
       typename GroupT<T>::Tangent* accel_out = nullptr,
       typename GroupT<T>::Tangent* jerk_out = nullptr) {
-    using Group = GroupT<T>;
-    using Tangent = typename GroupT<T>::Tangent;
-    using Adjoint = typename GroupT<T>::Adjoint;
-
-    VecN p, coeff, dcoeff, ddcoeff, dddcoeff;
+    VecN coeff, dcoeff, ddcoeff, dddcoeff;
 
-    CeresSplineHelper<T, N>::template baseCoeffsWithTime<0>(p, u);
-    coeff = CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+    computeCoeffs<0, true>(u, inv_dt, coeff);
 
     if (vel_out || accel_out || jerk_out) {
-      CeresSplineHelper<T, N>::template baseCoeffsWithTime<1>(p, u);
-      dcoeff =
-          inv_dt * CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+      computeCoeffs<1, true>(u, inv_dt, dcoeff);
 
       if (accel_out || jerk_out) {
-        CeresSplineHelper<T, N>::template baseCoeffsWithTime<2>(p, u);
-        ddcoeff = inv_dt * inv_dt *
-                  CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+        computeCoeffs<2, true>(u, inv_dt, ddcoeff);
 
         if (jerk_out) {
-          CeresSplineHelper<T, N>::template baseCoeffsWithTime<3>(p, u);
-          dddcoeff = inv_dt * inv_dt * inv_dt *
-                     CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+          computeCoeffs<3, true>(u, inv_dt, dddcoeff);
         }
       }
     }
 
+    evaluate_lie_with_coeffs<GroupT>(sKnots,
+                                     coeff,
+                                     &dcoeff,
+                                     &ddcoeff,
+                                     &dddcoeff,
+                                     transform_out,
+                                     vel_out,
+                                     accel_out,
+                                     jerk_out);
+  }
+
+  /// @brief Evaluate Lie group cummulative B-spline and time derivatives from
+  /// precomputed cumulative coefficients.
+  ///
+  /// @param[in] coeff, dcoeff, ddcoeff, dddcoeff coefficients of
+  /// computeCoeffs<0..3, true>. The derivative coefficients are only read if
+  /// the corresponding output is requested and can be nullptr otherwise. They
+  /// can be of another scalar type than the knots, e.g. double coefficients
+  /// with Jet knots.
+  template <template <class> class GroupT, class Coeffs>
+  static inline void evaluate_lie_with_coeffs(
+      T const* const* sKnots,
+      const Coeffs& coeff,
+      const typename std::decay<Coeffs>::type* dcoeff,
+      const typename std::decay<Coeffs>::type* ddcoeff,
+      const typename std::decay<Coeffs>::type* dddcoeff,
+      GroupT<T>* transform_out = nullptr,
+      typename GroupT<T>::Tangent* vel_out = nullptr,
+      typename GroupT<T>::Tangent* accel_out = nullptr,
+      typename GroupT<T>::Tangent* jerk_out = nullptr) {
+    using Group = GroupT<T>;
+    using Tangent = typename GroupT<T>::Tangent;
+    using Adjoint = typename GroupT<T>::Adjoint;
+
     if (transform_out) {
       Eigen::Map<Group const> const p00(sKnots[0]);
       *transform_out = p00;
@@ -150,9 +196,9 @@ struct CeresSplineHelper {
       Eigen::Map<Group const> const p1(sKnots[i + 1]);
 
       Group r01 = p0.inverse() * p1;
-      Tangent delta = r01.log();
+      Tangent delta = Sophus::LieFastPath<Group>::log(r01);
 
-      Group exp_kdelta = Group::exp(delta * coeff[i + 1]);
+      Group exp_kdelta = Sophus::LieFastPath<Group>::exp(delta * coeff[i + 1]);
 
       if (transform_out) (*transform_out) *= exp_kdelta;
 
@@ -160,22 +206,23 @@ struct CeresSplineHelper {
         Adjoint A = exp_kdelta.inverse().Adj();
 
         rot_vel = A * rot_vel;
-        Tangent rot_vel_current = delta * dcoeff[i + 1];
+        Tangent rot_vel_current = delta * (*dcoeff)[i + 1];
         rot_vel += rot_vel_current;
 
         if (accel_out || jerk_out) {
           rot_accel = A * rot_accel;
           Tangent accel_lie_bracket =
               Group::lieBracket(rot_vel, rot_vel_current);
-          rot_accel += ddcoeff[i + 1] * delta + accel_lie_bracket;
+          rot_accel += (*ddcoeff)[i + 1] * delta + accel_lie_bracket;
 
           if (jerk_out) {
             rot_jerk = A * rot_jerk;
-            rot_jerk += dddcoeff[i + 1] * delta +
-                        Group::lieBracket(ddcoeff[i + 1] * rot_vel +
-                                              T(2) * dcoeff[i + 1] * rot_accel -
-                                              dcoeff[i + 1] * accel_lie_bracket,
-                                          delta);
+            rot_jerk +=
+                (*dddcoeff)[i + 1] * delta +
+                Group::lieBracket((*ddcoeff)[i + 1] * rot_vel +
+                                      T(2) * (*dcoeff)[i + 1] * rot_accel -
+                                      (*dcoeff)[i + 1] * accel_lie_bracket,
+                                  delta);
           }
         }
       }
@@ -202,13 +249,20 @@ struct CeresSplineHelper {
                               Eigen::Matrix<T, DIM, 1>* vec_out) {
     if (!vec_out) return;
 
-    using VecD = Eigen::Matrix<T, DIM, 1>;
+    VecN coeff;
+    computeCoeffs<DERIV, false>(u, inv_dt, coeff);
+    evaluate_with_coeffs<DIM>(sKnots, coeff, vec_out);
+  }
 
-    VecN p, coeff;
+  /// @brief Evaluate Euclidean B-spline or time derivatives from precomputed
+  /// coefficients of computeCoeffs<DERIV, false>.
+  template <int DIM, class Coeffs>
+  static inline void evaluate_with_coeffs(T const* const* sKnots,
+                                          const Coeffs& coeff,
+                                          Eigen::Matrix<T, DIM, 1>* vec_out) {
+    if (!vec_out) return;
 
-    CeresSplineHelper<T, N>::template baseCoeffsWithTime<DERIV>(p, u);
-    coeff = ceres::pow(inv_dt, DERIV) *
-            CeresSplineHelper<T, N>::blending_matrix_ * p;
+    using VecD = Eigen::Matrix<T, DIM, 1>;
 
     vec_out->setZero();
 
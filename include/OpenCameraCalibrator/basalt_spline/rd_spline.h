@@ -255,12 +255,9 @@ class RdSpline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<Derivative>(p, u);
-
-    VecN coeff = pow_inv_dt[Derivative] * (blending_matrix_ * p);
-
-    // std::cerr << "p " << p.transpose() << std::endl;
+    VecN coeff;
+    evaluateBlendingWeights<N, Derivative, false>(u, coeff);
+    coeff *= pow_inv_dt[Derivative];
     // std::cerr << "coeff " << coeff.transpose() << std::endl;
 
     VecD res;
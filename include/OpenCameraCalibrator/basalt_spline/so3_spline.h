@@ -214,10 +214,8 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
     SO3 res = knots[s];
 
@@ -233,7 +231,7 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      Vec3 delta = r01.log();
+      Vec3 delta = Sophus::so3_log_fast(r01);
       Vec3 kdelta = delta * coeff[i + 1];
 
       if (J) {
@@ -247,7 +245,7 @@ class So3Spline {
                    p0.inverse().matrix();
         J->d_val_d_knot[i] -= J_helper;
       }
-      res *= SO3::exp(kdelta);
+      res *= Sophus::so3_exp_fast(kdelta);
     }
 
     if (J) J->d_val_d_knot[DEG] = J_helper;
@@ -315,12 +313,12 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
-    baseCoeffsWithTime<1>(p, u);
-    VecN dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    VecN dcoeff;
+    evaluateBlendingWeights<N, 1, true>(u, dcoeff);
+    dcoeff *= pow_inv_dt[1];
 
     Vec3 rot_vel;
     rot_vel.setZero();
@@ -330,9 +328,9 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      Vec3 delta = r01.log();
+      Vec3 delta = Sophus::so3_log_fast(r01);
 
-      rot_vel = SO3::exp(-delta * coeff[i + 1]) * rot_vel;
+      rot_vel = Sophus::so3_exp_fast(-delta * coeff[i + 1]) * rot_vel;
       rot_vel += delta * dcoeff[i + 1];
     }
 
@@ -362,12 +360,12 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
-    baseCoeffsWithTime<1>(p, u);
-    VecN dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    VecN dcoeff;
+    evaluateBlendingWeights<N, 1, true>(u, dcoeff);
+    dcoeff *= pow_inv_dt[1];
 
     Vec3 delta_vec[DEG];
 
@@ -382,7 +380,7 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      delta_vec[i] = r01.log();
+      delta_vec[i] = Sophus::so3_log_fast(r01);
 
       Sophus::rightJacobianInvSO3(delta_vec[i], Jr_delta_inv[i]);
       Jr_delta_inv[i] *= p1.inverse().matrix();
@@ -391,7 +389,7 @@ class So3Spline {
       Sophus::rightJacobianSO3(-k_delta, Jr_kdelta[i]);
 
       R_tmp[i] = accum.matrix();
-      exp_k_delta[i] = Sophus::SO3d::exp(-k_delta);
+      exp_k_delta[i] = Sophus::so3_exp_fast(-k_delta);
       accum *= exp_k_delta[i];
     }
 
@@ -443,15 +441,16 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
-    baseCoeffsWithTime<1>(p, u);
-    VecN dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    VecN dcoeff;
+    evaluateBlendingWeights<N, 1, true>(u, dcoeff);
+    dcoeff *= pow_inv_dt[1];
 
-    baseCoeffsWithTime<2>(p, u);
-    VecN ddcoeff = pow_inv_dt[2] * blending_matrix_ * p;
+    VecN ddcoeff;
+    evaluateBlendingWeights<N, 2, true>(u, ddcoeff);
+    ddcoeff *= pow_inv_dt[2];
 
     SO3 r_accum;
 
@@ -466,9 +465,9 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      Vec3 delta = r01.log();
+      Vec3 delta = Sophus::so3_log_fast(r01);
 
-      SO3 rot = SO3::exp(-delta * coeff[i + 1]);
+      SO3 rot = Sophus::so3_exp_fast(-delta * coeff[i + 1]);
 
       rot_vel = rot * rot_vel;
       Vec3 vel_current = dcoeff[i + 1] * delta;
@@ -514,15 +513,16 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
-    baseCoeffsWithTime<1>(p, u);
-    VecN dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    VecN dcoeff;
+    evaluateBlendingWeights<N, 1, true>(u, dcoeff);
+    dcoeff *= pow_inv_dt[1];
 
-    baseCoeffsWithTime<2>(p, u);
-    VecN ddcoeff = pow_inv_dt[2] * blending_matrix_ * p;
+    VecN ddcoeff;
+    evaluateBlendingWeights<N, 2, true>(u, ddcoeff);
+    ddcoeff *= pow_inv_dt[2];
 
     Vec3 delta_vec[DEG];
     Mat3 exp_k_delta[DEG];
@@ -542,7 +542,7 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      delta_vec[i] = r01.log();
+      delta_vec[i] = Sophus::so3_log_fast(r01);
 
       Sophus::rightJacobianInvSO3(delta_vec[i], Jr_delta_inv[i]);
       Jr_delta_inv[i] *= p1.inverse().matrix();
@@ -550,7 +550,7 @@ class So3Spline {
       Vec3 k_delta = coeff[i + 1] * delta_vec[i];
       Sophus::rightJacobianSO3(-k_delta, Jr_kdelta[i]);
 
-      exp_k_delta[i] = Sophus::SO3d::exp(-k_delta).matrix();
+      exp_k_delta[i] = Sophus::so3_exp_fast(-k_delta).matrix();
 
       rot_vel = exp_k_delta[i] * rot_vel;
       Vec3 vel_current = dcoeff[i + 1] * delta_vec[i];
@@ -659,18 +659,20 @@ class So3Spline {
         size_t(s + N) <= knots.size(),
         "s " << s << " N " << N << " knots.size() " << knots.size());
 
-    VecN p;
-    baseCoeffsWithTime<0>(p, u);
-    VecN coeff = blending_matrix_ * p;
+    VecN coeff;
+    evaluateBlendingWeights<N, 0, true>(u, coeff);
 
-    baseCoeffsWithTime<1>(p, u);
-    VecN dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    VecN dcoeff;
+    evaluateBlendingWeights<N, 1, true>(u, dcoeff);
+    dcoeff *= pow_inv_dt[1];
 
-    baseCoeffsWithTime<2>(p, u);
-    VecN ddcoeff = pow_inv_dt[2] * blending_matrix_ * p;
+    VecN ddcoeff;
+    evaluateBlendingWeights<N, 2, true>(u, ddcoeff);
+    ddcoeff *= pow_inv_dt[2];
 
-    baseCoeffsWithTime<3>(p, u);
-    VecN dddcoeff = pow_inv_dt[3] * blending_matrix_ * p;
+    VecN dddcoeff;
+    evaluateBlendingWeights<N, 3, true>(u, dddcoeff);
+    dddcoeff *= pow_inv_dt[3];
 
     Vec3 rot_vel;
     rot_vel.setZero();
@@ -686,9 +688,9 @@ class So3Spline {
       const SO3& p1 = knots[s + i + 1];
 
       SO3 r01 = p0.inverse() * p1;
-      Vec3 delta = r01.log();
+      Vec3 delta = Sophus::so3_log_fast(r01);
 
-      SO3 rot = SO3::exp(-delta * coeff[i + 1]);
+      SO3 rot = Sophus::so3_exp_fast(-delta * coeff[i + 1]);
 
       rot_vel = rot * rot_vel;
       Vec3 vel_current = dcoeff[i + 1] * delta;
@@ -86,6 +86,187 @@ inline SE3<typename Derived::Scalar> se3_expd(
                      upsilon_omega.template head<3>());
 }
 
+/// @brief Squared rotation angle below which the SO(3) expmap and the SO(3)
+/// Jacobians use truncated Taylor series instead of trigonometric functions.
+/// The series keep the terms up to \f$ \theta^8 \f$, the truncation error at
+/// the threshold (\f$ \theta \approx 0.22 \f$ rad) is below 1e-16.
+constexpr double kSO3SmallAngleSq = 0.05;
+
+/// @brief Logmap fast path threshold on \f$ |v|^2 / w^2 =
+/// \tan^2(\theta / 2) \f$ of the unit quaternion \f$ (w, v) \f$, about the
+/// same angle as kSO3SmallAngleSq.
+constexpr double kSO3SmallHalfAngleTanSq = 0.0125;
+
+/// @brief Quaternion factors of the SO(3) expmap
+/// \f$ (\cos(\theta / 2), \sin(\theta / 2) / \theta) \f$ from \f$ \theta^2 <
+/// \f$ kSO3SmallAngleSq
+template <typename Scalar>
+inline void so3ExpSmallAngleFactors(const Scalar& theta_sq,
+                                    Scalar& real_factor,
+                                    Scalar& imag_factor) {
+  const Scalar t2 = theta_sq;
+  real_factor =
+      Scalar(1) +
+      t2 * (Scalar(-1.0 / 8.0) +
+            t2 * (Scalar(1.0 / 384.0) +
+                  t2 * (Scalar(-1.0 / 46080.0) +
+                        t2 * Scalar(1.0 / 10321920.0))));
+  imag_factor =
+      Scalar(1.0 / 2.0) +
+      t2 * (Scalar(-1.0 / 48.0) +
+            t2 * (Scalar(1.0 / 3840.0) +
+                  t2 * (Scalar(-1.0 / 645120.0) +
+                        t2 * Scalar(1.0 / 185794560.0))));
+}
+
+/// @brief Expmap for SO(3) without trigonometric functions for small angles
+///
+/// Same result as SO3::exp up to rounding. Knot increments of our splines are
+/// almost always below the small angle threshold. Can be used with ceres Jets.
+/// @param[in] omega tangent vector (3x1 vector)
+/// @return SO(3) member
+template <typename Derived>
+inline SO3<typename Derived::Scalar> so3_exp_fast(
+    const Eigen::MatrixBase<Derived>& omega) {
+  EIGEN_STATIC_ASSERT_FIXED_SIZE(Derived);
+  EIGEN_STATIC_ASSERT_VECTOR_SPECIFIC_SIZE(Derived, 3);
+
+  using Scalar = typename Derived::Scalar;
+
+  const Scalar theta_sq = omega.squaredNorm();
+  if (!(theta_sq < Scalar(kSO3SmallAngleSq))) {
+    return SO3<Scalar>::exp(omega);
+  }
+
+  Scalar real_factor, imag_factor;
+  so3ExpSmallAngleFactors(theta_sq, real_factor, imag_factor);
+
+  // the factors are normalized up to rounding, which is what SO3::exp does
+  SO3<Scalar> R;
+  Scalar* q = R.data();
+  q[0] = imag_factor * omega[0];
+  q[1] = imag_factor * omega[1];
+  q[2] = imag_factor * omega[2];
+  q[3] = real_factor;
+  return R;
+}
+
+/// @brief Batched expmap \f$ \exp(s_j \omega) \f$ for j < n
+///
+/// The spline segments rotate about the same knot increment with different
+/// blending coefficients, so \f$ \theta^2 \f$ is computed once for all
+/// samples.
+/// @param[in] omega tangent vector (3x1 vector)
+/// @param[in] scales n scales of omega
+/// @param[in] n number of rotations
+/// @param[out] exp_out n SO(3) members
+template <typename Scalar>
+inline void so3_exp_fast_batch(const Eigen::Matrix<Scalar, 3, 1>& omega,
+                               const Scalar* scales,
+                               const int n,
+                               SO3<Scalar>* exp_out) {
+  const Scalar omega_sq = omega.squaredNorm();
+  for (int j = 0; j < n; ++j) {
+    const Scalar theta_sq = omega_sq * scales[j] * scales[j];
+    if (!(theta_sq < Scalar(kSO3SmallAngleSq))) {
+      exp_out[j] = SO3<Scalar>::exp(scales[j] * omega);
+      continue;
+    }
+    Scalar real_factor, imag_factor;
+    so3ExpSmallAngleFactors(theta_sq, real_factor, imag_factor);
+    imag_factor *= scales[j];
+    Scalar* q = exp_out[j].data();
+    q[0] = imag_factor * omega[0];
+    q[1] = imag_factor * omega[1];
+    q[2] = imag_factor * omega[2];
+    q[3] = real_factor;
+  }
+}
+
+/// @brief Logmap for SO(3) without atan for small angles
+///
+/// Same result as SO3::log up to rounding. Can be used with ceres Jets.
+/// @param[in] SO(3) member
+/// @return tangent vector (3x1 vector)
+template <typename Derived>
+inline typename SO3Base<Derived>::Tangent so3_log_fast(
+    const SO3Base<Derived>& R) {
+  using Scalar = typename SO3Base<Derived>::Scalar;
+
+  const Scalar w = R.unit_quaternion().w();
+  const Scalar squared_n = R.unit_quaternion().vec().squaredNorm();
+  const Scalar squared_w = w * w;
+  if (!(squared_n < Scalar(kSO3SmallHalfAngleTanSq) * squared_w)) {
+    return R.log();
+  }
+
+  // 2 * atan(n / w) / n = 2 / w * sum_k (-y)^k / (2k + 1), y = n^2 / w^2
+  const Scalar y = squared_n / squared_w;
+  const Scalar series =
+      Scalar(1) +
+      y * (Scalar(-1.0 / 3.0) +
+           y * (Scalar(1.0 / 5.0) +
+                y * (Scalar(-1.0 / 7.0) +
+                     y * (Scalar(1.0 / 9.0) +
+                          y * (Scalar(-1.0 / 11.0) +
+                               y * (Scalar(1.0 / 13.0) +
+                                    y * Scalar(-1.0 / 15.0)))))));
+  return (Scalar(2) * series / w) * R.unit_quaternion().vec();
+}
+
+/// @brief Expmap and logmap of a Lie group, the SO(3) versions use the small
+/// angle fast paths
+template <class Group>
+struct LieFastPath {
+  static inline Group exp(const typename Group::Tangent& x) {
+    return Group::exp(x);
+  }
+  static inline typename Group::Tangent log(const Group& g) { return g.log(); }
+};
+
+template <typename Scalar>
+struct LieFastPath<SO3<Scalar>> {
+  static inline SO3<Scalar> exp(const typename SO3<Scalar>::Tangent& x) {
+    return so3_exp_fast(x);
+  }
+  static inline typename SO3<Scalar>::Tangent log(const SO3<Scalar>& g) {
+    return so3_log_fast(g);
+  }
+};
+
+/// @brief Factors \f$ a = (1 - \cos\theta) / \theta^2 \f$ and \f$ b = (\theta -
+/// \sin\theta) / \theta^3 \f$ of the SO(3) Jacobians from \f$ \theta^2 <
+/// \f$ kSO3SmallAngleSq
+template <typename Scalar>
+inline void so3JacobianSmallAngleFactors(const Scalar& theta_sq,
+                                         Scalar& a,
+                                         Scalar& b) {
+  const Scalar t2 = theta_sq;
+  a = Scalar(1.0 / 2.0) +
+      t2 * (Scalar(-1.0 / 24.0) +
+            t2 * (Scalar(1.0 / 720.0) +
+                  t2 * (Scalar(-1.0 / 40320.0) +
+                        t2 * Scalar(1.0 / 3628800.0))));
+  b = Scalar(1.0 / 6.0) +
+      t2 * (Scalar(-1.0 / 120.0) +
+            t2 * (Scalar(1.0 / 5040.0) +
+                  t2 * (Scalar(-1.0 / 362880.0) +
+                        t2 * Scalar(1.0 / 39916800.0))));
+}
+
+/// @brief Factor \f$ 1 / \theta^2 - (1 + \cos\theta) / (2 \theta
+/// \sin\theta) \f$ of the inverse SO(3) Jacobians from \f$ \theta^2 < \f$
+/// kSO3SmallAngleSq
+template <typename Scalar>
+inline Scalar so3JacobianInvSmallAngleFactor(const Scalar& theta_sq) {
+  const Scalar t2 = theta_sq;
+  return Scalar(1.0 / 12.0) +
+         t2 * (Scalar(1.0 / 720.0) +
+               t2 * (Scalar(1.0 / 30240.0) +
+                     t2 * (Scalar(1.0 / 1209600.0) +
+                           t2 * Scalar(1.0 / 47900160.0))));
+}
+
 /// @brief Right Jacobian for SO(3)
 ///
 /// For \f$ \exp(x) \in SO(3) \f$ provides a Jacobian that approximates the sum
@@ -107,19 +288,31 @@ inline void rightJacobianSO3(const Eigen::MatrixBase<Derived1>& phi,
   Eigen::MatrixBase<Derived2>& J =
       const_cast<Eigen::MatrixBase<Derived2>&>(J_phi);
 
+  using std::cos;
+  using std::sin;
+  using std::sqrt;
+
   Scalar phi_norm2 = phi.squaredNorm();
-  Scalar phi_norm = std::sqrt(phi_norm2);
-  Scalar phi_norm3 = phi_norm2 * phi_norm;
 
   J.setIdentity();
 
-  if (Sophus::Constants<Scalar>::epsilon() < phi_norm) {
+  if (phi_norm2 < Scalar(kSO3SmallAngleSq)) {
+    Scalar a, b;
+    so3JacobianSmallAngleFactors(phi_norm2, a, b);
     Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
-    Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
-
-    J -= phi_hat * (1 - std::cos(phi_norm)) / phi_norm2;
-    J += phi_hat2 * (phi_norm - std::sin(phi_norm)) / phi_norm3;
+    J -= phi_hat * a;
+    J += phi_hat * phi_hat * b;
+    return;
   }
+
+  Scalar phi_norm = sqrt(phi_norm2);
+  Scalar phi_norm3 = phi_norm2 * phi_norm;
+
+  Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
+  Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+
+  J -= phi_hat * (Scalar(1) - cos(phi_norm)) / phi_norm2;
+  J += phi_hat2 * (phi_norm - sin(phi_norm)) / phi_norm3;
 }
 
 /// @brief Right Inverse Jacobian for SO(3)
@@ -143,19 +336,28 @@ inline void rightJacobianInvSO3(const Eigen::MatrixBase<Derived1>& phi,
   Eigen::MatrixBase<Derived2>& J =
       const_cast<Eigen::MatrixBase<Derived2>&>(J_phi);
 
+  using std::cos;
+  using std::sin;
+  using std::sqrt;
+
   Scalar phi_norm2 = phi.squaredNorm();
-  Scalar phi_norm = std::sqrt(phi_norm2);
 
   J.setIdentity();
 
-  if (Sophus::Constants<Scalar>::epsilon() < phi_norm) {
-    Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
-    Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+  Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
+  Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+
+  J += phi_hat / Scalar(2);
 
-    J += phi_hat / 2;
-    J += phi_hat2 * (1 / phi_norm2 - (1 + std::cos(phi_norm)) /
-                                         (2 * phi_norm * std::sin(phi_norm)));
+  if (phi_norm2 < Scalar(kSO3SmallAngleSq)) {
+    J += phi_hat2 * so3JacobianInvSmallAngleFactor(phi_norm2);
+    return;
   }
+
+  Scalar phi_norm = sqrt(phi_norm2);
+  J += phi_hat2 * (Scalar(1) / phi_norm2 -
+                   (Scalar(1) + cos(phi_norm)) /
+                       (Scalar(2) * phi_norm * sin(phi_norm)));
 }
 
 /// @brief Left Jacobian for SO(3)
@@ -179,19 +381,31 @@ inline void leftJacobianSO3(const Eigen::MatrixBase<Derived1>& phi,
   Eigen::MatrixBase<Derived2>& J =
       const_cast<Eigen::MatrixBase<Derived2>&>(J_phi);
 
+  using std::cos;
+  using std::sin;
+  using std::sqrt;
+
   Scalar phi_norm2 = phi.squaredNorm();
-  Scalar phi_norm = std::sqrt(phi_norm2);
-  Scalar phi_norm3 = phi_norm2 * phi_norm;
 
   J.setIdentity();
 
-  if (Sophus::Constants<Scalar>::epsilon() < phi_norm) {
+  if (phi_norm2 < Scalar(kSO3SmallAngleSq)) {
+    Scalar a, b;
+    so3JacobianSmallAngleFactors(phi_norm2, a, b);
     Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
-    Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
-
-    J += phi_hat * (1 - std::cos(phi_norm)) / phi_norm2;
-    J += phi_hat2 * (phi_norm - std::sin(phi_norm)) / phi_norm3;
+    J += phi_hat * a;
+    J += phi_hat * phi_hat * b;
+    return;
   }
+
+  Scalar phi_norm = sqrt(phi_norm2);
+  Scalar phi_norm3 = phi_norm2 * phi_norm;
+
+  Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
+  Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+
+  J += phi_hat * (Scalar(1) - cos(phi_norm)) / phi_norm2;
+  J += phi_hat2 * (phi_norm - sin(phi_norm)) / phi_norm3;
 }
 
 /// @brief Left Inverse Jacobian for SO(3)
@@ -215,19 +429,28 @@ inline void leftJacobianInvSO3(const Eigen::MatrixBase<Derived1>& phi,
   Eigen::MatrixBase<Derived2>& J =
       const_cast<Eigen::MatrixBase<Derived2>&>(J_phi);
 
+  using std::cos;
+  using std::sin;
+  using std::sqrt;
+
   Scalar phi_norm2 = phi.squaredNorm();
-  Scalar phi_norm = std::sqrt(phi_norm2);
 
   J.setIdentity();
 
-  if (Sophus::Constants<Scalar>::epsilon() < phi_norm) {
-    Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
-    Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+  Eigen::Matrix<Scalar, 3, 3> phi_hat = Sophus::SO3<Scalar>::hat(phi);
+  Eigen::Matrix<Scalar, 3, 3> phi_hat2 = phi_hat * phi_hat;
+
+  J -= phi_hat / Scalar(2);
 
-    J -= phi_hat / 2;
-    J += phi_hat2 * (1 / phi_norm2 - (1 + std::cos(phi_norm)) /
-                                         (2 * phi_norm * std::sin(phi_norm)));
+  if (phi_norm2 < Scalar(kSO3SmallAngleSq)) {
+    J += phi_hat2 * so3JacobianInvSmallAngleFactor(phi_norm2);
+    return;
   }
+
+  Scalar phi_norm = sqrt(phi_norm2);
+  J += phi_hat2 * (Scalar(1) / phi_norm2 -
+                   (Scalar(1) + cos(phi_norm)) /
+                       (Scalar(2) * phi_norm * sin(phi_norm)));
 }
 
 /// @brief Right Jacobian for decoupled SE(3)
@@ -40,6 +40,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <Eigen/Dense>
 #include <cstdint>
+#include <deque>
+#include <type_traits>
+#include <utility>
+
+namespace Eigen {
+/// @brief std::deque with Eigen::aligned_allocator, used for the spline knots
+template <typename T>
+using aligned_deque = std::deque<T, Eigen::aligned_allocator<T>>;
+}  // namespace Eigen
 
 /// @brief Compute binomial coefficient.
 ///
@@ -59,42 +68,155 @@ constexpr inline uint64_t C_n_k(uint64_t n, uint64_t k) {
   return r;
 }
 
-/// @brief Compute blending matrix for uniform B-spline evaluation.
-///
-/// @param _N order of the spline
-/// @param _Scalar scalar type to use
-/// @param _Cumulative if the spline should be cumulative
-template <int _N, typename _Scalar = double, bool _Cumulative = false>
-Eigen::Matrix<_Scalar, _N, _N> computeBlendingMatrix() {
-  Eigen::Matrix<double, _N, _N> m;
-  m.setZero();
+/// @brief Row major N x N matrix that can be computed at compile time.
+template <int _N>
+struct SplineMatrixTable {
+  double m[_N][_N] = {};
+};
+
+/// @brief Integer power, std::pow is not constexpr.
+constexpr inline int64_t intPow(int64_t base, int exp) {
+  int64_t r = 1;
+  for (int i = 0; i < exp; ++i) {
+    r *= base;
+  }
+  return r;
+}
 
+/// @brief Compile time blending matrix, see \ref computeBlendingMatrix.
+///
+/// The entries are integers divided by (N-1)!, so they are the same as the
+/// ones computed with floating point sums.
+template <int _N, bool _Cumulative>
+constexpr SplineMatrixTable<_N> blendingMatrixTable() {
+  int64_t m[_N][_N] = {};
   for (int i = 0; i < _N; ++i) {
     for (int j = 0; j < _N; ++j) {
-      double sum = 0;
-
+      int64_t sum = 0;
       for (int s = j; s < _N; ++s) {
-        sum += std::pow(-1.0, s - j) * C_n_k(_N, s - j) *
-               std::pow(_N - s - 1.0, _N - 1.0 - i);
+        const int64_t sign = (s - j) % 2 == 0 ? 1 : -1;
+        sum += sign * int64_t(C_n_k(_N, s - j)) *
+               intPow(_N - s - 1, _N - 1 - i);
       }
-      m(j, i) = C_n_k(_N - 1, _N - 1 - i) * sum;
+      m[j][i] = int64_t(C_n_k(_N - 1, _N - 1 - i)) * sum;
     }
   }
 
   if (_Cumulative) {
     for (int i = 0; i < _N; i++) {
       for (int j = i + 1; j < _N; j++) {
-        m.row(i) += m.row(j);
+        for (int k = 0; k < _N; k++) {
+          m[i][k] += m[j][k];
+        }
       }
     }
   }
 
-  uint64_t factorial = 1;
+  int64_t factorial = 1;
   for (int i = 2; i < _N; ++i) {
     factorial *= i;
   }
 
-  return (m / factorial).template cast<_Scalar>();
+  SplineMatrixTable<_N> table;
+  for (int i = 0; i < _N; ++i) {
+    for (int j = 0; j < _N; ++j) {
+      table.m[i][j] = double(m[i][j]) / double(factorial);
+    }
+  }
+  return table;
+}
+
+/// @brief Compile time base coefficients, see \ref computeBaseCoefficients.
+template <int _N>
+constexpr SplineMatrixTable<_N> baseCoefficientsTable() {
+  SplineMatrixTable<_N> table;
+  for (int i = 0; i < _N; i++) {
+    table.m[0][i] = 1.0;
+  }
+
+  const int DEG = _N - 1;
+  int order = DEG;
+  for (int n = 1; n < _N; n++) {
+    for (int i = DEG - order; i < _N; i++) {
+      table.m[n][i] = (order - DEG + i) * table.m[n - 1][i];
+    }
+    order--;
+  }
+  return table;
+}
+
+/// @brief Blending matrix times the base coefficients of a time derivative.
+///
+/// Entry (j, k) is the coefficient of \f$ u^{k-Derivative} \f$ in the
+/// blending weight of knot j, so the weights are polynomials in u.
+template <int _N, int _Derivative, bool _Cumulative>
+constexpr SplineMatrixTable<_N> blendingPolynomialTable() {
+  constexpr SplineMatrixTable<_N> blending =
+      blendingMatrixTable<_N, _Cumulative>();
+  constexpr SplineMatrixTable<_N> base = baseCoefficientsTable<_N>();
+  SplineMatrixTable<_N> table;
+  if (_Derivative < _N) {
+    for (int j = 0; j < _N; ++j) {
+      for (int k = _Derivative; k < _N; ++k) {
+        table.m[j][k] = blending.m[j][k] * base.m[_Derivative][k];
+      }
+    }
+  }
+  return table;
+}
+
+/// @brief Calls f(std::integral_constant<int, I>()) for I = 0 ... N-1, so
+/// loops over the knots of a fixed order spline are unrolled.
+template <class F, int... I>
+inline void staticFor(F&& f, std::integer_sequence<int, I...>) {
+  (f(std::integral_constant<int, I>()), ...);
+}
+
+template <int _N, class F>
+inline void staticFor(F&& f) {
+  staticFor(std::forward<F>(f), std::make_integer_sequence<int, _N>());
+}
+
+/// @brief Unrolled evaluation of the blending weights of the N knots.
+///
+/// Evaluates the polynomials of \ref blendingPolynomialTable with the Horner
+/// scheme. All coefficients are compile time constants.
+/// @param[in] u normalized time
+/// @param[out] coeff blending weights, not scaled by the knot spacing
+template <int _N, int _Derivative, bool _Cumulative, class T, class Derived>
+inline void evaluateBlendingWeights(const T& u,
+                                    Eigen::MatrixBase<Derived>& coeff) {
+  EIGEN_STATIC_ASSERT_VECTOR_SPECIFIC_SIZE(Derived, _N);
+  static constexpr SplineMatrixTable<_N> table =
+      blendingPolynomialTable<_N, _Derivative, _Cumulative>();
+  staticFor<_N>([&](auto j) {
+    if constexpr (_Derivative >= _N) {
+      coeff[int(j)] = T(0);
+    } else {
+      T c = T(table.m[j][_N - 1]);
+      staticFor<_N - 1>([&](auto i) {
+        constexpr int k = _N - 2 - decltype(i)::value;
+        if constexpr (k >= _Derivative) {
+          c = c * u + T(table.m[j][k]);
+        }
+      });
+      coeff[int(j)] = c;
+    }
+  });
+}
+
+/// @brief Compute blending matrix for uniform B-spline evaluation.
+///
+/// @param _N order of the spline
+/// @param _Scalar scalar type to use
+/// @param _Cumulative if the spline should be cumulative
+template <int _N, typename _Scalar = double, bool _Cumulative = false>
+Eigen::Matrix<_Scalar, _N, _N> computeBlendingMatrix() {
+  constexpr SplineMatrixTable<_N> table =
+      blendingMatrixTable<_N, _Cumulative>();
+  return Eigen::Map<const Eigen::Matrix<double, _N, _N, Eigen::RowMajor>>(
+             &table.m[0][0])
+      .template cast<_Scalar>();
 }
 
 /// @brief Compute base coefficient matrix for polynomials of size N.
@@ -116,18 +238,8 @@ Eigen::Matrix<_Scalar, _N, _N> computeBlendingMatrix() {
 /// @param _Scalar scalar type to use
 template <int _N, typename _Scalar = double>
 Eigen::Matrix<_Scalar, _N, _N> computeBaseCoefficients() {
-  Eigen::Matrix<double, _N, _N> base_coefficients;
-
-  base_coefficients.setZero();
-  base_coefficients.row(0).setOnes();
-
-  const int DEG = _N - 1;
-  int order = DEG;
-  for (int n = 1; n < _N; n++) {
-    for (int i = DEG - order; i < _N; i++) {
-      base_coefficients(n, i) = (order - DEG + i) * base_coefficients(n - 1, i);
-    }
-    order--;
-  }
-  return base_coefficients.template cast<_Scalar>();
+  constexpr SplineMatrixTable<_N> table = baseCoefficientsTable<_N>();
+  return Eigen::Map<const Eigen::Matrix<double, _N, _N, Eigen::RowMajor>>(
+             &table.m[0][0])
+      .template cast<_Scalar>();
 }
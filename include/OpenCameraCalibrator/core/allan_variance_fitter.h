@@ -1,13 +1,14 @@
 #pragma once
 
-#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/json_fwd.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include "OpenCameraCalibrator/allanvariance/allan_acc.h"
 #include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
 
-#include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
-#include "OpenCameraCalibrator/allanvariance/fitallan_acc.h"
+#include "OpenCameraCalibrator/allanvariance/allan_parameter_fit.h"
+#include "OpenCameraCalibrator/allanvariance/allan_variance.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
 
 namespace OpenICC {
 namespace core {
@@ -17,11 +18,19 @@ class AllanVarianceFitter {
   AllanVarianceFitter(const CameraTelemetryData& telemetry_data,
                       const int nr_clusters);
 
+  //! Fits the noise model of the six axes concurrently
   bool RunFit();
 
+  //! gyroscope x, y, z and accelerometer x, y, z after RunFit
+  const std::vector<allanvar::AllanAxisFit>& GetFits() const { return fits_; }
+
+  nlohmann::json ResultToJson() const;
+
  private:
   CameraTelemetryData telemetry_data_;
 
+  std::vector<allanvar::AllanAxisFit> fits_;
+
   allanvar::AllanAcc* data_acc_x_;
   allanvar::AllanAcc* data_acc_y_;
   allanvar::AllanAcc* data_acc_z_;
@@ -31,5 +40,36 @@ class AllanVarianceFitter {
   allanvar::AllanGyr* data_gyr_z_;
 };
 
+//! Allan variance fit on octave spaced cluster factors. The telemetry is
+//! consumed sample by sample, e.g. with io::StreamTelemetry, and is not
+//! stored, so memory does not grow with the length of the recording
+class StreamingAllanVarianceFitter : public io::TelemetryConsumer {
+ public:
+  StreamingAllanVarianceFitter() {}
+
+  void AddTimestamp(const int64_t timestamp_ns) override;
+  void AddAccelerometer(const Eigen::Vector3d& accl) override;
+  void AddGyroscope(const Eigen::Vector3d& gyro) override;
+
+  bool RunFit();
+
+  //! gyroscope x, y, z and accelerometer x, y, z after RunFit
+  const std::vector<allanvar::AllanAxisFit>& GetFits() const { return fits_; }
+
+  nlohmann::json ResultToJson() const;
+
+ private:
+  std::vector<allanvar::AllanAxisFit> fits_;
+
+  //! gyroscope in deg/h, accelerometer in m/s^2
+  allanvar::StreamingAllanVariance gyr_[3];
+  allanvar::StreamingAllanVariance acc_[3];
+
+  //! first and last timestamp for the mean sample period
+  int64_t first_timestamp_ns_ = 0;
+  int64_t last_timestamp_ns_ = 0;
+  size_t num_timestamps_ = 0;
+};
+
 }  // namespace core
 }  // namespace OpenICC
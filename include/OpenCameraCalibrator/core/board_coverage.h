@@ -0,0 +1,96 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+struct BoardCoverageOptions {
+  //! views every bin needs, 0 disables the coverage tracking
+  int target_views_per_bin = 0;
+  //! the image is split into grid_cols x grid_rows cells, a view counts for
+  //! every cell one of its corners lies in
+  int grid_cols = 8;
+  int grid_rows = 6;
+  //! the pose bins are the board tilt around both image axes, below
+  //! -tilt_threshold, in between and above, times the board scale bins. The
+  //! tilt is the relative depth change from the board center to its border.
+  double tilt_threshold = 0.1;
+  //! edges of the scale bins, the square root of the image fraction the
+  //! whole board covers
+  std::vector<double> scale_bin_edges{0.3, 0.55};
+  //! stop if no view filled a bin for this long, some poses might never be
+  //! recorded. 0 waits for all bins.
+  double max_stale_s = 0.0;
+  //! views with fewer corners are ignored
+  int min_corners = 8;
+};
+
+//! Online image and pose coverage of the board views of an extraction. The
+//! pose of a view is binned from the homography of the board plane to the
+//! image, so no camera calibration is needed.
+class BoardCoverage {
+ public:
+  BoardCoverage(const BoardCoverageOptions& options,
+                const std::vector<cv::Point3f>& board_pts);
+
+  //! Adds the corners of one view, in pixels of an image of the given size.
+  //! Returns true if the view added to a bin that was not full yet.
+  bool AddView(const double timestamp_s,
+               const int image_width,
+               const int image_height,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& ids);
+
+  //! If all bins are full or, with max_stale_s, no view added anything since
+  //! max_stale_s before timestamp_s. Remembers why for ToJson.
+  bool Complete(const double timestamp_s);
+
+  //! Counts of the bins and why the extraction stopped
+  void ToJson(nlohmann::json& coverage_json) const;
+
+ private:
+  //! Bin of the board pose of a view, -1 if the homography failed
+  int PoseBin(const int image_width,
+              const int image_height,
+              const aligned_vector<Eigen::Vector2d>& corners,
+              const std::vector<int>& ids) const;
+
+  bool AllBinsFull() const;
+
+  BoardCoverageOptions options_;
+  std::vector<cv::Point3f> board_pts_;
+  //! board bounding box, the board points are normalized with it
+  cv::Point2f board_center_;
+  cv::Point2f board_half_size_;
+
+  std::vector<int> image_cell_views_;
+  std::vector<int> pose_bin_views_;
+  size_t num_views_ = 0;
+  double last_new_view_s_ = 0.0;
+  std::string stop_reason_ = "end of input";
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -20,14 +20,24 @@
 #include <opencv2/opencv.hpp>
 #include <third_party/apriltag/apriltag.h>
 
-#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/core/board_coverage.h"
+#include "OpenCameraCalibrator/utils/json_fwd.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <dirent.h>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace OpenICC {
+namespace io {
+class SceneStreamWriter;
+}  // namespace io
+
 namespace core {
 
 const int NUM_PTS_MARKER = 4;
@@ -45,6 +55,106 @@ inline BoardType StringToBoardType(const std::string& board_type) {
   return BoardType::CHARUCO;
 }
 
+//! Why a frame was dropped before the board detection
+enum FrameRejection {
+  NOT_REJECTED = 0,
+  BLURRY = 1,
+  REDUNDANT = 2,
+  //! not decoded, see SetFrameStride
+  SKIPPED = 3,
+  //! the detection exceeded its time budget, see SetDetectionBudget
+  TIMED_OUT = 4
+};
+
+//! One frame passed through the extraction pipeline
+struct ExtractionFrame {
+  size_t frame_idx = 0;
+  double timestamp_s = 0.0;
+  cv::Mat image;
+  int image_width = 0;
+  int image_height = 0;
+  aligned_vector<Eigen::Vector2d> corners;
+  std::vector<int> ids;
+  //! rejected frames are not passed to the board detection
+  FrameRejection rejection = NOT_REJECTED;
+  //! preprocessing and detection
+  double detection_time_s = 0.0;
+};
+
+//! Number of frames accepted and dropped by the frame filter
+struct FrameFilterStats {
+  size_t num_accepted = 0;
+  size_t num_blurry = 0;
+  size_t num_redundant = 0;
+  size_t num_skipped = 0;
+  size_t num_timed_out = 0;
+};
+
+//! Search region of the board tracking, the expanded corner hull of the
+//! previous frame
+struct BoardTrackingState {
+  bool valid = false;
+  cv::Rect roi;
+  size_t num_corners = 0;
+  //! downsample factor the roi is given in
+  double downsample_factor = 1.0;
+  //! mean corner spacing of the previous frame in full resolution pixels,
+  //! 0 if unknown
+  double corner_spacing_px = 0.0;
+};
+
+//! Detector state and buffers of one extraction worker. The buffers keep
+//! their capacity across frames, such that the detection stops allocating
+//! once they are large enough. Every thread needs its own context, see
+//! BoardExtractor::CreateExtractionContext.
+struct ExtractionContext {
+  cv::Ptr<cv::aruco::DetectorParameters> detector_params;
+  std::unique_ptr<ApriltagDetector> april_detector;
+
+  //! the detection of the current frame skips its remaining expensive steps
+  //! after this time, if has_deadline is set
+  bool has_deadline = false;
+  std::chrono::steady_clock::time_point deadline;
+
+  // charuco
+  std::vector<int> marker_ids;
+  std::vector<std::vector<cv::Point2f>> marker_corners;
+  std::vector<std::vector<cv::Point2f>> rejected_markers;
+  std::vector<int> charuco_ids;
+  std::vector<cv::Point2f> charuco_corners;
+
+  // radon
+  std::vector<cv::Point2d> radon_corners;
+  std::vector<cv::Point2f> radon_refined_corners;
+  cv::Mat radon_meta;
+  cv::Mat radon_image;
+
+  // apriltag
+  std::vector<int> tag_ids, rejected_tag_ids;
+  std::vector<double> tag_radii, rejected_tag_radii;
+  std::vector<cv::Point2f> tag_corners, rejected_tag_corners;
+
+  // tracking and preprocessing
+  cv::Mat roi_image;
+  aligned_vector<Eigen::Vector2d> roi_corners;
+  std::vector<int> roi_ids;
+  cv::Mat resized_image;
+  cv::Mat detection_image;
+  cv::Mat full_res_image;
+};
+
+//! Metadata of a video and the board detections on a few of its frames, see
+//! BoardExtractor::SampleVideo
+struct VideoSample {
+  double fps = 0.0;
+  int num_frames = 0;
+  int image_width = 0;
+  int image_height = 0;
+  //! detected corners of every decoded sample frame
+  std::vector<int> num_corners;
+  double detection_time_s = 0.0;
+};
+
 class BoardExtractor {
  public:
   BoardExtractor();
@@ -54,11 +164,49 @@ class BoardExtractor {
                     aligned_vector<Eigen::Vector2d>& corners,
                     std::vector<int>& object_pt_ids);
 
+  //! Extracts the board with the detector state and buffers of context.
+  //! Several threads can extract at the same time with one context each.
+  bool ExtractBoard(const cv::Mat& image,
+                    ExtractionContext& context,
+                    aligned_vector<Eigen::Vector2d>& corners,
+                    std::vector<int>& object_pt_ids);
+
+  //! Detector state and buffers for one worker of the initialized board
+  std::unique_ptr<ExtractionContext> CreateExtractionContext() const;
+
+  //! Runs the detection of the extraction on one frame, with the configured
+  //! downsampling, tracking and full resolution refinement. Pass the same
+  //! tracking state for consecutive frames, reset it to start a new track.
+  //! Corners are in pixels of the detected image, see
+  //! SetRefineFullResolution and SetAdaptiveDownsample. Returns false if
+  //! nothing was detected.
+  bool DetectImage(const cv::Mat& image,
+                   const double img_downsample_factor,
+                   BoardTrackingState& tracking_state,
+                   aligned_vector<Eigen::Vector2d>& corners,
+                   std::vector<int>& object_pt_ids);
+
   //! Extracts a board from a video file to a json file and saves it to disk
   bool ExtractVideoToJson(const std::string& video_path,
                           const std::string& save_path,
                           const double img_downsample_factor);
 
+  //! Reads the metadata of a video and runs the board detection on
+  //! num_frames frames evenly spread over it without writing anything. The
+  //! frames are seeked to, so this takes seconds even for long videos
+  bool SampleVideo(const std::string& video_path,
+                   const int num_frames,
+                   const double img_downsample_factor,
+                   VideoSample& sample);
+
+  //! Decodes num_frames frames evenly spread over the video like
+  //! SampleVideo, downsampled and converted to gray like the extraction does
+  //! before the board detection. The images can be passed to ExtractBoard.
+  bool SampleVideoFrames(const std::string& video_path,
+                         const int num_frames,
+                         const double img_downsample_factor,
+                         std::vector<cv::Mat>& detection_images);
+
   //! Extract the board from a folder full of images. The image names has to be
   //! time time in nanoseconds! e.g. 1000000000000.png
   bool ExtractImageFolderToJson(const std::string& image_folder,
@@ -73,14 +221,45 @@ class BoardExtractor {
                               int squaresY,
                               int dictionaryId);
 
+  //! Copy of the aruco detector parameters of the charuco board, null for
+  //! the other boards
+  cv::Ptr<cv::aruco::DetectorParameters> GetDetectorParameters() const;
+
+  //! Replaces the aruco detector parameters of the charuco board, the
+  //! extraction contexts created afterwards use them
+  void SetDetectorParameters(const cv::aruco::DetectorParameters& params);
+
   //! Initializes a Radon checkerboard
   bool InitializeRadonBoard(float square_length, int squaresX, int squaresY);
 
-  //! Initialize a Apriltag board
-  bool InitializeAprilBoard(double marker_length,
-                            double tag_spacing,
-                            int squaresX,
-                            int squaresY);
+  //! Detects the Radon board without the exhaustive search first, on the
+  //! image downsampled by downsample_factor, and refines the corners on the
+  //! image. Only if that fails or finds less than min_corner_ratio times the
+  //! board corners the exhaustive search runs.
+  void SetRadonFastPath(const bool fast_path,
+                        const double downsample_factor = 2.0,
+                        const double min_corner_ratio = 1.0) {
+    radon_fast_path_ = fast_path;
+    radon_fast_downsample_factor_ = std::max(1.0, downsample_factor);
+    radon_fast_min_corner_ratio_ = min_corner_ratio;
+  }
+
+  //! Fraction of the Radon fast path detections that needed the
+  //! exhaustive search, since the last extraction started
+  double RadonEscalationRate() const {
+    return num_radon_fast_ > 0
+               ? double(num_radon_escalated_) / double(num_radon_fast_)
+               : 0.0;
+  }
+
+  //! Initialize a Apriltag board. The options set the threads and the quad
+  //! decimation of the tag detector.
+  bool InitializeAprilBoard(
+      double marker_length,
+      double tag_spacing,
+      int squaresX,
+      int squaresY,
+      const ApriltagDetectorOptions& options = ApriltagDetectorOptions());
 
   bool DetectAprilBoard(const cv::Mat& image);
 
@@ -89,11 +268,240 @@ class BoardExtractor {
 
   std::vector<int> GetRadonBoardIDs() { return continuous_board_indices_; }
 
+  //! Writes the scene_pts of the initialized board, keyed by the corner ids
+  void BoardToJson(nlohmann::json& output_json);
+
   //! Set verbose plot
   void SetVerbosePlot() { verbose_plot_ = true; }
 
+  //! Number of detector threads used for the extraction. 1 runs everything
+  //! in a single serial loop.
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
+  //! Searches the board only around its corners in the previous frame and
+  //! falls back to the full image if it is not found there. The tracking
+  //! restarts with a full image search every track_block_size frames, such
+  //! that the result does not depend on the number of threads. 0 disables it.
+  void SetTrackBlockSize(const int track_block_size) {
+    track_block_size_ = std::max(0, track_block_size);
+  }
+
+  //! The board is detected on the downsampled image, but the corners are
+  //! refined in small windows on the full resolution image. Corners and
+  //! image size are written in full resolution pixels.
+  void SetRefineFullResolution(const bool refine_full_resolution) {
+    refine_full_resolution_ = refine_full_resolution;
+  }
+
+  //! Chooses the downsample factor of every frame from the corner spacing
+  //! in the previous frame of its track block, such that the detected
+  //! corners are min_corner_spacing_px apart. The downsample factor passed
+  //! to the extraction becomes the largest factor, the first frame of a
+  //! block is detected at full resolution. Corners and image size are
+  //! written in full resolution pixels. Needs a track block size, 0
+  //! disables it.
+  void SetAdaptiveDownsample(const double min_corner_spacing_px) {
+    adaptive_min_corner_spacing_px_ = std::max(0.0, min_corner_spacing_px);
+  }
+
+  //! Only frames [start_frame, end_frame) are extracted, e.g. to split one
+  //! recording across processes. end_frame < 0 extracts until the end.
+  void SetFrameRange(const int start_frame, const int end_frame) {
+    start_frame_ = std::max(0, start_frame);
+    end_frame_ = end_frame;
+  }
+
+  //! Writes a checkpoint every checkpoint_interval frames (rounded up to the
+  //! track block size) next to the output file. 0 disables checkpoints.
+  void SetCheckpointInterval(const int checkpoint_interval) {
+    checkpoint_interval_ = std::max(0, checkpoint_interval);
+  }
+
+  //! Continues an interrupted extraction from its last checkpoint, if there
+  //! is one. The frame filter starts without a previous frame.
+  void SetResume(const bool resume) { resume_ = resume; }
+
+  //! Decodes videos with a hardware decoder if OpenCV and the platform
+  //! support it (VAAPI, NVDEC, ...). Falls back to software decoding.
+  void SetHardwareDecoding(const bool hardware_decoding) {
+    hardware_decoding_ = hardware_decoding;
+  }
+
+  //! Decodes the images of an image folder directly in gray at a reduced
+  //! resolution if the downsample factor is 2, 4 or 8, instead of decoding
+  //! them in color at full resolution and resizing them. Not used with the
+  //! full resolution refinement or the adaptive downsampling, which need
+  //! the full resolution image.
+  void SetReducedDecode(const bool reduced_decode) {
+    reduced_decode_ = reduced_decode;
+  }
+
+  //! Resizes and converts the frames to gray on the OpenCL device, only the
+  //! images passed to the board detector are downloaded. Falls back to the
+  //! cpu if OpenCV has no OpenCL device.
+  void SetUseOpenCL(const bool use_opencl);
+
+  //! Frames whose detection takes longer than budget_s skip the remaining
+  //! expensive steps, like the full image search after a lost track, the
+  //! exhaustive Radon search or the aruco marker refinement, and are
+  //! written as timed out without corners. A running detector call can not
+  //! be interrupted, so a frame can exceed the budget by its last call. 0
+  //! disables it.
+  void SetDetectionBudget(const double budget_s) {
+    detection_budget_s_ = std::max(0.0, budget_s);
+  }
+
+  //! Only decodes frames whose index is a multiple of frame_stride, the
+  //! others are grabbed without decoding them. Their timestamps are kept.
+  //! For videos a target_fps > 0 overrides the stride with the frame rate of
+  //! the video divided by target_fps.
+  void SetFrameStride(const int frame_stride, const double target_fps = 0.0) {
+    frame_stride_ = std::max(1, frame_stride);
+    target_fps_ = std::max(0.0, target_fps);
+  }
+
+  //! Drops frames before the board detection. Frames whose variance of the
+  //! Laplacian on a thumbnail is below min_blur_score are blurry. Frames
+  //! whose mean absolute gray value difference to the last accepted
+  //! thumbnail is below min_frame_difference are redundant. 0 disables a
+  //! check.
+  void SetFrameFilter(const double min_blur_score,
+                      const double min_frame_difference) {
+    min_blur_score_ = std::max(0.0, min_blur_score);
+    min_frame_difference_ = std::max(0.0, min_frame_difference);
+  }
+
+  //! Stops the extraction once the views cover the image grid and the pose
+  //! bins of the options, or no view added coverage for max_stale_s. Frames
+  //! are counted in reading order, so the extraction stops at the same frame
+  //! for every number of threads. A resumed extraction starts with empty
+  //! bins. A target of 0 extracts all frames.
+  void SetCoverageTermination(const BoardCoverageOptions& options) {
+    coverage_options_ = options;
+  }
+
+  //! Called by the writer with every view written to the scene file, in
+  //! writing order, e.g. to estimate the poses while the extraction runs.
+  //! A blocking callback throttles the extraction.
+  void SetViewCallback(
+      const std::function<void(const std::string&, const nlohmann::json&)>&
+          view_callback) {
+    view_callback_ = view_callback;
+  }
+
  private:
-  void BoardToJson(nlohmann::json& output_json);
+
+  //! Extracts the board inside the tracked search region, falls back to the
+  //! full image and updates the tracking state
+  bool TrackBoard(const cv::Mat& image,
+                  ExtractionContext& context,
+                  aligned_vector<Eigen::Vector2d>& corners,
+                  std::vector<int>& object_pt_ids,
+                  BoardTrackingState& tracking_state);
+
+  //! findChessboardCornersSB with the fast path if it is enabled. The
+  //! corners and the meta data are returned in the radon buffers of context.
+  bool DetectRadonBoard(const cv::Mat& image, ExtractionContext& context);
+
+  //! Maps corners detected on an image downsampled by downsample_factor to
+  //! the full resolution gray image and refines them there
+  void RefineCornersFullResolution(
+      const cv::Mat& image_full_res,
+      const double downsample_factor,
+      aligned_vector<Eigen::Vector2d>& corners) const;
+
+  //! Sets the rejection of a frame and releases the image of rejected
+  //! frames. Has to be called in reading order.
+  void FilterFrame(ExtractionFrame& frame, cv::Mat& last_thumbnail) const;
+
+  //! Downsample factor of a frame in adaptive mode, from the corner spacing
+  //! in the tracking state. Between 1 and max_downsample_factor.
+  double AdaptiveDownsampleFactor(
+      const double max_downsample_factor,
+      const BoardTrackingState& tracking_state) const;
+
+  //! If the detection of the current frame passed its deadline
+  bool OverBudget(const ExtractionContext& context) const;
+
+  //! Writes the frame filter and Radon fast path counts and the detection
+  //! time distribution to the output json
+  void FrameFilterStatsToJson(nlohmann::json& output_json) const;
+
+  //! Resizes the image by fxfy and converts it to gray into the detection
+  //! image of context. With full_res the gray conversion runs first and the
+  //! full resolution gray image of context is set as well.
+  void PrepareDetectionImage(const cv::Mat& image,
+                             const double fxfy,
+                             const int interpolation,
+                             const bool full_res,
+                             ExtractionContext& context) const;
+
+  //! Downsamples, converts to gray and extracts the board of one frame. The
+  //! image of the frame is only kept for plotting.
+  void DetectFrame(const double img_downsample_factor,
+                   ExtractionContext& context,
+                   BoardTrackingState& tracking_state,
+                   ExtractionFrame& frame);
+
+  //! Writes the detections of one frame to the output json
+  void WriteFrame(ExtractionFrame& frame,
+                  const int total_nr_frames,
+                  nlohmann::json& output_json,
+                  io::SceneStreamWriter& scene_writer,
+                  std::vector<double>& timestamps_s);
+
+  //! Opens the scene writer, or resumes it from the checkpoint. Returns the
+  //! index of the first frame to extract.
+  bool StartSceneWriter(const std::string& save_path,
+                        nlohmann::json& output_json,
+                        io::SceneStreamWriter& scene_writer,
+                        std::vector<double>& timestamps_s,
+                        size_t& first_frame_idx);
+
+  //! Closes the scene file and removes the checkpoint
+  bool FinishSceneWriter(const nlohmann::json& output_json,
+                         io::SceneStreamWriter& scene_writer);
+
+  bool ReadCheckpoint(nlohmann::json& checkpoint) const;
+
+  //! Stores everything needed to continue with frame next_frame_idx
+  void WriteCheckpoint(const size_t next_frame_idx,
+                       const double timestamp_s,
+                       const nlohmann::json& output_json,
+                       io::SceneStreamWriter& scene_writer,
+                       const std::vector<double>& timestamps_s);
+
+  //! Single threaded read and detect loop
+  void RunExtractionSerial(
+      const std::function<bool(ExtractionFrame&)>& read_next_frame,
+      const size_t first_frame_idx,
+      const double img_downsample_factor,
+      const int total_nr_frames,
+      nlohmann::json& output_json,
+      io::SceneStreamWriter& scene_writer,
+      std::vector<double>& timestamps_s);
+
+  //! Reader thread -> detector workers -> ordered writer
+  void RunExtractionPipeline(
+      const std::function<bool(ExtractionFrame&)>& read_next_frame,
+      const size_t first_frame_idx,
+      const double img_downsample_factor,
+      const int total_nr_frames,
+      nlohmann::json& output_json,
+      io::SceneStreamWriter& scene_writer,
+      std::vector<double>& timestamps_s);
+
+  //! Converts the corners of one view to json
+  void ViewToJson(const aligned_vector<Eigen::Vector2d>& corners,
+                  const std::vector<int>& ids,
+                  nlohmann::json& view_json);
+
+  //! Draws the extracted corners and shows the image
+  void PlotCorners(cv::Mat& image,
+                   const aligned_vector<Eigen::Vector2d>& corners,
+                   const std::vector<int>& ids);
 
   //! Board type
   BoardType board_type_;
@@ -114,11 +522,22 @@ class BoardExtractor {
   int radon_flags_;
   //! radon board size
   cv::Size radon_pattern_size_;
+  //! try the radon detection without exhaustive search first
+  bool radon_fast_path_ = false;
+  double radon_fast_downsample_factor_ = 2.0;
+  double radon_fast_min_corner_ratio_ = 1.0;
+  //! fast path detections and how many of them fell back to the exhaustive
+  //! search, updated by all detector threads
+  std::atomic<size_t> num_radon_fast_{0};
+  std::atomic<size_t> num_radon_escalated_{0};
   //! board pt continuous index
   std::vector<int> continuous_board_indices_;
 
-  //! Apriltag stuff
-  ApriltagDetector april_detector_;
+  //! options of the apriltag detectors of the extraction contexts
+  ApriltagDetectorOptions april_options_;
+
+  //! context of the single threaded extraction and ExtractBoard
+  std::unique_ptr<ExtractionContext> context_;
 
   //! if a board is already initialized
   bool board_initialized_ = false;
@@ -128,6 +547,81 @@ class BoardExtractor {
 
   //! display extracted corners
   bool verbose_plot_ = false;
+
+  //! number of detector threads
+  int num_threads_ = 1;
+
+  //! frames tracked from one full image search, 0 disables the tracking
+  int track_block_size_ = 0;
+
+  //! the search region is the corner hull expanded by this fraction of its
+  //! larger side
+  double track_margin_ = 0.25;
+
+  //! the tracked detection has to find this fraction of the corners of the
+  //! previous frame, otherwise the full image is searched
+  double track_min_corner_ratio_ = 0.8;
+
+  //! detect downsampled, refine the corners on the full resolution image
+  bool refine_full_resolution_ = false;
+
+  //! target corner spacing of the adaptive downsampling, 0 disables it
+  double adaptive_min_corner_spacing_px_ = 0.0;
+
+  //! half size of the full resolution refinement window in downsampled
+  //! pixels
+  double refine_half_window_ = 2.0;
+
+  //! decode videos with a hardware decoder
+  bool hardware_decoding_ = false;
+
+  //! decode image folders at the detection resolution
+  bool reduced_decode_ = false;
+
+  //! resize and gray conversion on the OpenCL device
+  bool use_opencl_ = false;
+
+  //! time budget of the detection of one frame, 0 disables it
+  double detection_budget_s_ = 0.0;
+
+  //! detection times of the frames written since the extraction started
+  std::vector<double> detection_times_s_;
+
+  //! only every frame_stride_-th frame is decoded
+  int frame_stride_ = 1;
+
+  //! frames per second decoded from videos, 0 uses frame_stride_
+  double target_fps_ = 0.0;
+
+  //! frame filter thresholds, 0 disables a check
+  double min_blur_score_ = 0.0;
+  double min_frame_difference_ = 0.0;
+
+  //! width of the frame filter thumbnail in pixels
+  int filter_thumbnail_width_ = 320;
+
+  //! counted by the writer
+  FrameFilterStats frame_filter_stats_;
+
+  //! early termination by coverage, the bins of the running extraction
+  BoardCoverageOptions coverage_options_;
+  std::unique_ptr<BoardCoverage> coverage_;
+  //! set by the writer, the reader stops reading and the frames after the
+  //! one that completed the coverage are dropped
+  std::atomic<bool> coverage_complete_{false};
+
+  //! receives the written views, see SetViewCallback
+  std::function<void(const std::string&, const nlohmann::json&)>
+      view_callback_;
+
+  //! extracted frame range, end_frame_ < 0 extracts until the end
+  int start_frame_ = 0;
+  int end_frame_ = -1;
+
+  //! frames between two checkpoints, 0 disables them
+  int checkpoint_interval_ = 0;
+  bool resume_ = false;
+  std::string checkpoint_path_;
 };
 
 }  // namespace core
@@ -0,0 +1,110 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ceres/ceres.h>
+#include <theia/sfm/bundle_adjustment/bundle_adjustment.h>
+#include <theia/sfm/camera/camera.h>
+#include <theia/sfm/reconstruction.h>
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Parameters one stage of the calibration bundle adjustment optimizes
+struct CalibrationBundleAdjustmentStage {
+  theia::OptimizeIntrinsicsType intrinsics_to_optimize =
+      theia::OptimizeIntrinsicsType::NONE;
+  bool optimize_poses = true;
+  bool optimize_points = false;
+  int max_num_iterations = 500;
+  double function_tolerance = 1e-6;
+  bool verbose = false;
+};
+
+//! Bundle adjustment of a board calibration on one persistent ceres
+//! problem. All views share one intrinsics block, initialized from the
+//! first view, and the board poses are eliminated by the Schur complement.
+//! The stages only change which blocks are constant. Intrinsics, poses and
+//! board points are copied into the adjuster, every Solve writes them back
+//! to the reconstruction.
+class CalibrationBundleAdjuster {
+ public:
+  explicit CalibrationBundleAdjuster(const int num_threads,
+                                     const double robust_loss_width = 1.345);
+
+  //! Adds one reprojection residual per observation of the views. A view
+  //! listed k times gets k residuals per observation, e.g. for bootstrap
+  //! replicas. False if the camera model is not supported
+  bool Build(const theia::Reconstruction& recon,
+             const std::vector<theia::ViewId>& view_ids);
+
+  //! Removes the residuals and the pose of a view
+  void RemoveView(const theia::ViewId view_id);
+
+  //! Runs one stage and writes the intrinsics to all views of the problem,
+  //! the poses and the board points to recon. False if ceres failed
+  bool Solve(const CalibrationBundleAdjustmentStage& stage,
+             theia::Reconstruction& recon,
+             ceres::Solver::Summary* summary = nullptr);
+
+  //! Runs one stage without writing the result back, see Camera()
+  bool Solve(const CalibrationBundleAdjustmentStage& stage,
+             ceres::Solver::Summary* summary = nullptr);
+
+  //! holds the intrinsics of the last Solve
+  const theia::Camera& Camera() const { return camera_; }
+
+  //! Covariance of the shared intrinsics in the theia parameter order at
+  //! the state of the last Solve, with the poses and board points of that
+  //! stage marginalized. Intrinsics constant in the stage get zero rows
+  bool IntrinsicsCovariance(Eigen::MatrixXd& covariance);
+
+  int NumViews() const { return views_.size(); }
+
+ private:
+  struct ViewBlocks {
+    //! theia camera extrinsics, position and angle axis orientation
+    std::array<double, 6> extrinsics;
+    std::vector<ceres::ResidualBlockId> residuals;
+  };
+
+  //! sets the parameterization and constancy of the intrinsics block
+  void SetIntrinsicsToOptimize(
+      const theia::OptimizeIntrinsicsType intrinsics_to_optimize);
+
+  const int num_threads_;
+
+  //! the shared loss and parameterizations outlive the problem
+  std::unique_ptr<ceres::LossFunction> loss_function_;
+  std::vector<std::unique_ptr<ceres::LocalParameterization>>
+      parameterizations_;
+  std::unique_ptr<ceres::LocalParameterization> point_parameterization_;
+  std::unique_ptr<ceres::Problem> problem_;
+
+  //! camera of the first view, holds the optimized intrinsics
+  theia::Camera camera_;
+  std::unordered_map<theia::ViewId, ViewBlocks> views_;
+  //! homogeneous board points, the homogeneous coordinate stays constant
+  std::unordered_map<theia::TrackId, Eigen::Vector4d> points_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
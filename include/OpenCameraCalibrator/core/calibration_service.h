@@ -0,0 +1,213 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace core {
+
+class ImuCameraCalibrator;
+
+struct CalibrationServiceOptions {
+  //! jobs that run at the same time
+  int num_workers = 1;
+  //! jobs waiting for a worker, further jobs are rejected
+  int max_queued_jobs = 16;
+  //! threads of one job, 0 splits the concurrency cap among the workers
+  int threads_per_job = 0;
+  //! process wide cap of the executor threads shared by all jobs, 0 uses the
+  //! hardware threads
+  int max_concurrency = 0;
+  //! bit-reproducible results of all jobs, see Executor::SetDeterministic
+  bool deterministic = false;
+  //! pins worker i and its share of the executor threads to NUMA node
+  //! i % num_nodes. A job loads its telemetry, spline and observations on its
+  //! worker, so they are allocated on that node.
+  bool numa_placement = false;
+  //! explicit cpu sets of the workers separated by ';', e.g. "0-15;16-31",
+  //! worker i gets set i % num_sets. Overrides numa_placement.
+  std::string worker_cpu_sets;
+  //! resident memory of the process the jobs should stay below, large
+  //! intermediate arrays beyond it are spilled to files in spill_dir. 0
+  //! disables the budget.
+  int64_t memory_budget_mb = 0;
+  std::string spill_dir;
+  //! records job, stage and solver metrics, see MetricsText
+  bool metrics = false;
+};
+
+//! Receives the status messages of a job. Every accepted job reports
+//! "queued", "running", a "progress" message with the name, wall_time_s,
+//! cpu_time_s and num_items of every stage the job finished, and finally
+//! "done" with its result or "failed" with an error. Called from the worker
+//! threads.
+using JobStatusCallback = std::function<void(const nlohmann::json& status)>;
+
+//! Runs calibration jobs in a long running process. Initialized board
+//! extractors are kept per board configuration and reused by later jobs, so
+//! a job only pays for its own computation. A job is a json object with an
+//! "id" and a "stage":
+//!   extract_board: input_path, save_corners_json_path, board {board_type,
+//!     aruco_detector_params, checker_square_length_m, num_squares_x,
+//!     num_squares_y, aruco_dict}, downsample_factor, ...
+//!   preflight: input_path and board of extract_board and/or telemetry,
+//!     num_sample_frames, validates the dataset in seconds and fails with
+//!     its first problem, the result holds the report
+//!   calibrate_camera: input_corners, save_path_calib_dataset, camera_model,
+//!     grid_size, max_calibration_views, optimize_board_points
+//!   estimate_poses: input_corners, camera_calibration_json,
+//!     output_pose_dataset, optimize_board_points
+//!   estimate_imu_to_camera_rotation: input_pose_calibration_dataset,
+//!     telemetry, imu_bias_estimate, imu_rotation_init_output,
+//!     delta_t_imu_to_cam, ransac_hypotheses, ransac_window_s,
+//!     ransac_inlier_threshold
+//!   calibrate_imu_camera: input_corners, camera_calibration_json,
+//!     input_pose_calibration_dataset, imu_rotation_init, telemetry,
+//!     imu_intrinsics, imu_bias_estimate, spline_error_weighting_json
+//!     (estimated from the telemetry with q_so3 and q_r3 if missing),
+//!     result_output_json, ...
+//!   calibrate_imu_camera_sequences: sequences, an array of
+//!     calibrate_imu_camera inputs of recordings of one device that share
+//!     T_i_c (and with shared_imu_intrinsics the IMU intrinsics),
+//!     sequence_rounds, shared_iterations
+//!   merge_scenes: inputs, time_offsets_s, output
+//!   convert_telemetry: input, output, compression, chunk_samples, writes
+//!     binary telemetry
+//!   fit_allan_variance: telemetry
+//!   pipeline: steps, an array of the jobs above run in order by one worker
+//! Missing parameters take the defaults of the corresponding application.
+//! All jobs share the global executor. Its tasks are scheduled by the
+//! "priority" of the job (high, normal or low), by default the extraction
+//! and conversion stages run first and fit_allan_variance last.
+class CalibrationService {
+ public:
+  explicit CalibrationService(const CalibrationServiceOptions& options);
+  //! Finishes the queued jobs
+  ~CalibrationService();
+
+  CalibrationService(const CalibrationService&) = delete;
+  CalibrationService& operator=(const CalibrationService&) = delete;
+
+  //! Queues a job. If the queue is full or the service stopped, the job is
+  //! rejected, callback gets a "rejected" status and false is returned.
+  bool Submit(const nlohmann::json& job, JobStatusCallback callback);
+
+  //! Stops accepting jobs, finishes the queued ones and joins the workers
+  void Stop();
+
+  size_t NumQueuedJobs() { return queue_.Size(); }
+
+  //! Counters of the finished jobs, stages, extracted frames and solver
+  //! iterations and gauges of the queue, running jobs and memory in the
+  //! Prometheus text format. Empty unless options.metrics is set.
+  std::string MetricsText();
+  //! The same series as json
+  nlohmann::json MetricsJson();
+
+ private:
+  struct Job {
+    nlohmann::json request;
+    JobStatusCallback callback;
+  };
+
+  void WorkerLoop(const int worker_idx);
+
+  //! Sets the gauges of the current service state
+  void UpdateGauges();
+
+  //! Runs one stage or pipeline, fills result or error
+  bool RunJob(const nlohmann::json& request,
+              const JobStatusCallback& callback,
+              nlohmann::json& result,
+              std::string& error);
+
+  bool ExtractBoard(const nlohmann::json& request,
+                    nlohmann::json& result,
+                    std::string& error);
+  bool Preflight(const nlohmann::json& request,
+                 nlohmann::json& result,
+                 std::string& error);
+  bool CalibrateCamera(const nlohmann::json& request,
+                       nlohmann::json& result,
+                       std::string& error);
+  bool EstimatePoses(const nlohmann::json& request,
+                     nlohmann::json& result,
+                     std::string& error);
+  bool EstimateImuToCameraRotation(const nlohmann::json& request,
+                                   nlohmann::json& result,
+                                   std::string& error);
+  bool CalibrateImuCamera(const nlohmann::json& request,
+                          nlohmann::json& result,
+                          std::string& error);
+  bool CalibrateImuCameraSequences(const nlohmann::json& request,
+                                   nlohmann::json& result,
+                                   std::string& error);
+
+  //! Reads the inputs of a calibrate_imu_camera request, sets up the
+  //! calibrator and initializes its spline. flags are the groups to optimize
+  bool InitImuCameraCalibrator(const nlohmann::json& request,
+                               ImuCameraCalibrator& imu_cam_calibrator,
+                               int& flags,
+                               double& time_offset_imu_to_cam,
+                               std::string& error);
+  bool MergeScenes(const nlohmann::json& request,
+                   nlohmann::json& result,
+                   std::string& error);
+  bool ConvertTelemetry(const nlohmann::json& request,
+                        nlohmann::json& result,
+                        std::string& error);
+  bool FitAllanVariance(const nlohmann::json& request,
+                        nlohmann::json& result,
+                        std::string& error);
+
+  //! Takes an initialized extractor for the board from the pool, or
+  //! initializes a new one. board_key identifies the board configuration.
+  std::unique_ptr<BoardExtractor> AcquireBoardExtractor(
+      const nlohmann::json& board, const std::string& board_key);
+  void ReleaseBoardExtractor(const std::string& board_key,
+                             std::unique_ptr<BoardExtractor> extractor);
+
+  const CalibrationServiceOptions options_;
+  int threads_per_job_;
+  //! cpus worker i is pinned to, empty if not pinned
+  std::vector<std::vector<int>> worker_cpus_;
+
+  utils::BoundedQueue<Job> queue_;
+  std::vector<std::thread> workers_;
+  std::mutex stop_mutex_;
+  std::atomic<int> num_running_jobs_{0};
+
+  //! idle initialized extractors per board configuration
+  std::mutex extractor_mutex_;
+  std::unordered_map<std::string, std::vector<std::unique_ptr<BoardExtractor>>>
+      idle_extractors_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
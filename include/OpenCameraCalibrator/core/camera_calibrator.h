@@ -15,14 +15,35 @@
 
 #pragma once
 
+#include <theia/sfm/camera/camera.h>
 #include <theia/sfm/reconstruction.h>
 #include <theia/solvers/ransac.h>
 
-#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/corner_subsampling.h"
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <functional>
+#include <string>
+#include <vector>
 
 namespace OpenICC {
+namespace io {
+class MappedScene;
+}  // namespace io
+
 namespace core {
 
+//! Replicas of the bootstrap of CameraCalibrator::SetBootstrap
+struct CameraBootstrapOptions {
+  //! 0 disables the bootstrap
+  int num_replicas = 0;
+  //! every replica starts at the calibration and needs few iterations
+  int max_num_iterations = 10;
+  double function_tolerance = 1e-4;
+  unsigned int seed = 42;
+};
+
 class CameraCalibrator {
  public:
   CameraCalibrator(const std::string& camera_model,
@@ -33,6 +54,10 @@ class CameraCalibrator {
   bool CalibrateCameraFromJson(const nlohmann::json& scene_json,
                                const std::string& output_path);
 
+  //! Same as CalibrateCameraFromJson, but views are parsed one at a time
+  bool CalibrateCameraFromScene(const io::MappedScene& scene,
+                                const std::string& output_path);
+
   bool WriteCalibration(const std::string& output_path);
 
   void RemoveViewsReprojError(const double max_reproj_error = 2.0);
@@ -59,10 +84,138 @@ class CameraCalibrator {
   //! pose in a voxel
   void SetGridSize(const double grid_size = 0.04) { grid_size_ = grid_size; }
 
+  //! At most this many views are bundle adjusted, selected by board coverage
+  //! and pose diversity. The remaining views only get their poses refined
+  //! with the final intrinsics and validate the calibration. 0 uses all.
+  void SetMaxCalibrationViews(const int max_calibration_views = 200) {
+    max_calibration_views_ = max_calibration_views;
+  }
+
+  //! Only a spatially stratified subset of the corners of every view enters
+  //! the bundle adjustment, see utils::SubsampleCorners. The initial poses
+  //! are estimated from all corners.
+  void SetCornerSubsampling(const utils::CornerSubsamplingOptions& options) {
+    corner_subsampling_ = options;
+  }
+
+  //! Warm start from a previous calibration of the same camera. Views are
+  //! initialized by calibrated PnP with the prior intrinsics and only the
+  //! full bundle adjustment is run. Returns false if the camera model of the
+  //! prior does not match.
+  bool SetPriorCamera(const theia::Camera& prior_camera);
+
+  void SetNumThreads(const int num_threads) { num_threads_ = num_threads; }
+
+  //! After the calibration, bundle adjust replicas of the calibrated views
+  //! drawn with replacement in parallel, each starting from the calibrated
+  //! intrinsics, poses and board points. The standard deviations of the
+  //! intrinsics over the replicas are written to the calibration json.
+  void SetBootstrap(const CameraBootstrapOptions& options) {
+    bootstrap_options_ = options;
+  }
+
+  //! standard deviations of the bootstrap in the theia parameter order,
+  //! empty without a bootstrap
+  const Eigen::VectorXd& GetBootstrapIntrinsicsStd() const {
+    return bootstrap_intrinsics_std_;
+  }
+
   //! Print result
   void PrintResult();
 
+  //! Calibrated camera and the fps of the calibration video, valid after a
+  //! successful calibration
+  bool GetCalibratedCamera(theia::Camera& camera, double& fps) const;
+
+  //! mean reprojection error of the calibrated views in pixel
+  double GetReprojectionError() const { return final_reproj_error_; }
+
+  int GetNumCalibratedViews() const {
+    return static_cast<int>(recon_calib_dataset_.NumViews());
+  }
+
  private:
+  //! Corners of one view and its initial pose and intrinsics
+  struct ViewInit {
+    double timestamp_s = 0.0;
+    std::vector<int> board_pt3_ids;
+    aligned_vector<Eigen::Vector2d> corners;
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d position = Eigen::Vector3d::Zero();
+    double focal_length = 0.0;
+    double radial_distortion = 0.0;
+    bool success = false;
+    //! focal length and distortion were estimated from this view
+    bool is_hypothesis = false;
+  };
+
+  //! Reads the timestamp and corners of a view
+  void PrepareView(const std::string& view_key,
+                   const nlohmann::json& view,
+                   ViewInit& view_init) const;
+
+  //! Estimates pose, focal length and distortion of a single view
+  void InitializeViewUncalibrated(const theia::RansacParameters& ransac_params,
+                                  const int image_width,
+                                  const int image_height,
+                                  ViewInit& view_init) const;
+
+  //! Calibrated PnP with known intrinsics. The ransac threshold is in pixel.
+  void InitializePoseFromCamera(const theia::Camera& camera,
+                                const theia::RansacParameters& ransac_params,
+                                ViewInit& view_init) const;
+
+  //! Median focal length and distortion of the hypotheses that agree with
+  //! the median focal length. Returns the number of agreeing hypotheses.
+  int FindIntrinsicConsensus(const std::vector<ViewInit>& view_inits,
+                             double& focal_length,
+                             double& radial_distortion) const;
+
+  //! Initializes the views in parallel batches. Until enough hypotheses
+  //! agree on the intrinsics every view runs the uncalibrated RANSAC, after
+  //! that only a calibrated PnP with the consensus intrinsics. Views are
+  //! added in order, if there is no other view close by.
+  //! parse_view(i, key, storage) returns view i, or nullptr, and may parse it
+  //! into storage.
+  template <typename ParseView>
+  void InitializeViews(const size_t num_views,
+                       const int image_width,
+                       const int image_height,
+                       ParseView&& parse_view);
+
+  //! Disables the warm start if the prior was calibrated on another image size
+  void CheckPriorImageSize(const int image_width, const int image_height);
+
+  //! Greedily selects at most max_calibration_views_ views. Every step takes
+  //! the view that adds the most board coverage in image cells that are
+  //! still sparsely observed, weighted by its rotation difference to the
+  //! views selected so far. Favours corners in the image periphery and
+  //! tilted boards, which constrain distortion and focal length.
+  void SelectCalibrationViews(std::vector<theia::ViewId>& calib_view_ids,
+                              std::vector<theia::ViewId>& held_out_view_ids);
+
+  //! Removes views of view_ids with a larger reprojection error from the
+  //! dataset and from view_ids
+  void RemoveViewsReprojError(const double max_reproj_error,
+                              std::vector<theia::ViewId>& view_ids);
+
+  //! Copies the intrinsics of the first calibration view to the held out
+  //! views and refines their poses. Views with a large reprojection error
+  //! are removed.
+  void ValidateOnHeldOutViews(const std::vector<theia::ViewId>& calib_view_ids,
+                              std::vector<theia::ViewId>& held_out_view_ids,
+                              const bool refine_poses);
+
+  //! intrinsics the full bundle adjustment optimizes for the camera model
+  theia::OptimizeIntrinsicsType FullIntrinsicsToOptimize() const;
+
+  //! Bootstrap of the calibrated views, see SetBootstrap
+  bool RunBootstrap();
+
+  //! Runs the calibration on all initialized views and writes the result
+  bool FinishCalibration(const std::string& output_path,
+                         const double camera_fps);
+
   //! holds all calibration information like views and features
   theia::Reconstruction recon_calib_dataset_;
 
@@ -83,7 +236,92 @@ class CameraCalibrator {
 
   //! min number views for calibration
   int min_num_view_ = 10;
+
+  //! budget of bundle adjusted views, 0 for all
+  int max_calibration_views_ = 200;
+
+  //! corners per view of the bundle adjustment
+  utils::CornerSubsamplingOptions corner_subsampling_;
+
+  //! image cells per side for the board coverage score
+  int coverage_grid_cells_ = 10;
+
+  //! initialize from prior_camera_ and skip the staged optimization
+  bool warm_start_ = false;
+
+  //! intrinsics of a previous calibration
+  theia::Camera prior_camera_;
+
+  //! agreeing focal length hypotheses needed to stop the uncalibrated
+  //! initialization
+  int min_consensus_hypotheses_ = 20;
+
+  //! relative focal length difference to the median of an agreeing hypothesis
+  double consensus_focal_tolerance_ = 0.05;
+
+  //! views initialized in parallel between two consensus checks
+  size_t consensus_batch_size_ = 64;
+
+  //! threads used for the view initialization
+  int num_threads_ = 1;
+
+  //! base seed of the per view RANSAC random number generators
+  unsigned int ransac_seed_ = 42;
+
+  //! fps of the calibration video
+  double camera_fps_ = 0.0;
+
+  //! if RunCalibration succeeded on the current dataset
+  bool calibrated_ = false;
+
+  //! of FinishCalibration
+  double final_reproj_error_ = 0.0;
+
+  //! standard deviations of the calibrated intrinsics in the theia
+  //! parameter order, empty if the covariance could not be computed
+  Eigen::VectorXd intrinsics_std_;
+
+  CameraBootstrapOptions bootstrap_options_;
+
+  //! of RunBootstrap, empty before
+  Eigen::VectorXd bootstrap_intrinsics_std_;
 };
 
+//! One camera of CalibrateCameraBatch
+struct CameraBatchJob {
+  std::string name;
+  std::string input_corners;
+  //! prefix of the outputs like calibrate_camera --save_path_calib_dataset,
+  //! empty writes none
+  std::string output_path;
+};
+
+struct CameraBatchResult {
+  std::string name;
+  bool success = false;
+  theia::Camera camera;
+  double fps = 0.0;
+  double reproj_error = 0.0;
+  int num_views = 0;
+  double wall_time_s = 0.0;
+};
+
+//! Calibrates independent cameras concurrently as executor tasks, every
+//! calibration runs single threaded. The small problems of one camera scale
+//! badly over threads, running one per core maximizes the throughput of a
+//! batch. configure sets up every calibrator like a single calibration,
+//! it is called from the worker threads. Returns true if all succeeded.
+bool CalibrateCameraBatch(
+    const std::vector<CameraBatchJob>& jobs,
+    const std::string& camera_model,
+    const bool optimize_board_pts,
+    const std::function<void(CameraCalibrator&)>& configure,
+    std::vector<CameraBatchResult>& results);
+
+//! Writes one row per result, name, success, number of views, reprojection
+//! error, focal length, principal point and wall time, as csv
+bool WriteCameraBatchResults(const std::vector<CameraBatchResult>& results,
+                             const std::string& output_csv);
+
 }  // namespace core
 }  // namespace OpenICC
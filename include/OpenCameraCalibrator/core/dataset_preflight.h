@@ -0,0 +1,98 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+
+namespace OpenICC {
+namespace core {
+
+class BoardExtractor;
+
+struct PreflightOptions {
+  //! frames evenly spread over the video that run through the board detector
+  int num_sample_frames = 20;
+  double img_downsample_factor = 1.0;
+  //! corners a sampled frame needs to count as a view, the minimum of the
+  //! pose estimation
+  int min_corners = 8;
+  //! fraction of the sampled frames that have to be views
+  double min_view_fraction = 0.2;
+  int min_telemetry_samples = 100;
+  //! larger gaps between two telemetry samples are reported as warnings
+  double max_telemetry_gap_s = 0.05;
+  //! the telemetry has to cover this fraction of the video
+  double min_telemetry_coverage = 0.9;
+};
+
+//! Problems and statistics of a dataset found by the preflight checks
+struct PreflightReport {
+  std::vector<std::string> errors;
+  std::vector<std::string> warnings;
+
+  // telemetry
+  size_t num_timestamps = 0;
+  size_t num_accl_samples = 0;
+  size_t num_gyro_samples = 0;
+  //! timestamps that are smaller than their predecessor
+  size_t num_decreasing_timestamps = 0;
+  size_t num_repeated_timestamps = 0;
+  size_t num_non_finite_values = 0;
+  double telemetry_duration_s = 0.0;
+  double telemetry_rate_hz = 0.0;
+  double max_telemetry_gap_s = 0.0;
+  double mean_accl_norm = 0.0;
+  double max_gyro_norm = 0.0;
+
+  // video
+  double fps = 0.0;
+  int num_frames = 0;
+  int image_width = 0;
+  int image_height = 0;
+  int num_sampled_frames = 0;
+  int num_sampled_views = 0;
+  double mean_sampled_corners = 0.0;
+  double detection_time_s = 0.0;
+
+  bool Passed() const { return errors.empty(); }
+
+  nlohmann::json ToJson() const;
+};
+
+//! Streams the telemetry with constant memory and checks that the
+//! timestamps increase, that every timestamp has an accelerometer and a
+//! gyroscope value, that the values are finite and plausible in m/s^2 and
+//! rad/s and that there are no large gaps. Returns false if it adds an
+//! error to the report
+bool PreflightTelemetry(const std::string& telemetry_path,
+                        const PreflightOptions& options,
+                        PreflightReport& report);
+
+//! Checks the video metadata and that enough of a sparse sample of frames
+//! show the board of the initialized extractor. Compares the video duration
+//! to the telemetry if it was checked before. Returns false if it adds an
+//! error to the report
+bool PreflightVideo(const std::string& video_path,
+                    const PreflightOptions& options,
+                    BoardExtractor& board_extractor,
+                    PreflightReport& report);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,70 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+class BoardExtractor;
+
+struct DetectorTuningOptions {
+  //! the tuned parameters have to find this fraction of the charuco corners
+  //! that the initial parameters find on the sample frames
+  double min_recall = 1.0;
+  //! largest mean distance in pixels of the corners to those of the initial
+  //! parameters
+  double max_corner_shift_px = 0.1;
+  //! a change is only kept if it makes the detection this fraction faster,
+  //! such that timing noise does not change the parameters
+  double min_speedup = 0.03;
+  //! every candidate is timed this often, the fastest run counts
+  int num_repetitions = 3;
+  //! passes over all parameters, the search stops early if a pass changed
+  //! nothing
+  int max_rounds = 2;
+};
+
+struct DetectorTuningResult {
+  cv::Ptr<cv::aruco::DetectorParameters> detector_params;
+  double initial_frame_time_s = 0.0;
+  double tuned_frame_time_s = 0.0;
+  size_t initial_num_corners = 0;
+  //! corners with an id that the initial parameters found as well
+  size_t tuned_num_corners = 0;
+  int num_evaluations = 0;
+};
+
+//! Searches the aruco detector parameters of the charuco board of
+//! board_extractor for the lowest detection time per frame that keeps the
+//! corners its current parameters find on the sample frames. The frames are
+//! detection images, see BoardExtractor::SampleVideoFrames. A coordinate
+//! descent tries a few values for the adaptive threshold windows, the
+//! marker size range, the bit extraction resolution and the marker corner
+//! refinement. The corner refinement window is not changed, it also refines
+//! the charuco corners. The extractor keeps its parameters.
+bool TuneDetectorParameters(const std::vector<cv::Mat>& detection_images,
+                            const DetectorTuningOptions& options,
+                            BoardExtractor& board_extractor,
+                            DetectorTuningResult& result);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,166 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace theia {
+class Reconstruction;
+}
+
+namespace OpenICC {
+namespace core {
+
+struct ExcitationMonitorOptions {
+  //! white noise std of one gyroscope [rad/s] and accelerometer [m/s^2]
+  //! sample and of a board corner [px]
+  double gyro_noise_std = 0.01;
+  double accl_noise_std = 0.05;
+  double corner_noise_std_px = 0.5;
+  //! camera the corners are detected in
+  double focal_length_px = 1000.0;
+  int image_width = 0;
+  int image_height = 0;
+  //! the image is split into grid_cells x grid_cells cells for the coverage
+  int grid_cells = 8;
+
+  //! The information measures only account for white noise and ignore the
+  //! correlations to the spline, their stds are optimistic lower bounds.
+  //! The thresholds are therefore well below the wanted accuracy
+  //! minimum rms angular rate of each gyroscope axis [rad/s]
+  double min_gyro_rms = 0.5;
+  //! minimum std of each accelerometer axis [m/s^2]
+  double min_accl_std = 0.5;
+  //! minimum fraction of grid cells with a board corner
+  double min_board_coverage = 0.5;
+  int min_views = 100;
+  //! maximum std of the worst constrained direction of T_i_c
+  double max_rotation_std_deg = 0.01;
+  double max_translation_std_m = 0.001;
+  //! maximum std of the line delay, only checked for rolling shutter cameras
+  bool check_line_delay = true;
+  double max_line_delay_std_us = 0.1;
+  //! maximum relative std of the focal length and of the IMU axis scales
+  double max_focal_length_std = 1e-4;
+  double max_imu_scale_std = 1e-3;
+};
+
+//! Excitation, coverage and information of the data seen so far
+struct ExcitationReport {
+  double duration_s = 0.0;
+  size_t num_gyro_samples = 0;
+  size_t num_accl_samples = 0;
+  size_t num_views = 0;
+  Eigen::Vector3d gyro_rms = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_std = Eigen::Vector3d::Zero();
+  double board_coverage = 0.0;
+  //! stds of the worst constrained directions, infinite if unobservable
+  double rotation_std_deg = 0.0;
+  double translation_std_m = 0.0;
+  double line_delay_std_us = 0.0;
+  double focal_length_std = 0.0;
+  double gyro_scale_std = 0.0;
+  double accl_scale_std = 0.0;
+  bool sufficient = false;
+
+  nlohmann::json ToJson() const;
+};
+
+//! Consumes IMU samples and board corners incrementally and tells when the
+//! data constrains T_i_c, the line delay, the camera intrinsics and the IMU
+//! scales well enough, so a recording can be stopped or trimmed there.
+//! Every measurement adds the information of a linearized residual with
+//! white noise:
+//!  - gyroscope samples constrain the rotation of T_i_c through the angular
+//!    rate they measure perpendicular to each direction
+//!  - accelerometer samples constrain its translation through the lever arm
+//!    accelerations (d omega/dt)^ + (omega^)^2
+//!  - corners constrain the line delay through the image motion of their
+//!    row offset to the board center, f * |omega| * dy, and the focal
+//!    length through their distance to the image center
+//! Samples have to be added in time order.
+class ExcitationMonitor {
+ public:
+  explicit ExcitationMonitor(const ExcitationMonitorOptions& options);
+
+  void AddGyroSample(const double timestamp_s, const Eigen::Vector3d& gyro);
+
+  void AddAcclSample(const double timestamp_s, const Eigen::Vector3d& accl);
+
+  //! Board corners of one frame in pixels, timestamp in the clock of the IMU
+  //! samples
+  void AddView(const double timestamp_s,
+               const aligned_vector<Eigen::Vector2d>& corners);
+
+  ExcitationReport Report() const;
+
+  //! All thresholds of the options are met
+  bool Sufficient() const { return Report().sufficient; }
+
+  //! Time of the view at which the data became sufficient, -1 before
+  double SufficientTime() const { return sufficient_time_s_; }
+
+ private:
+  void UpdateTimeSpan(const double timestamp_s);
+
+  const ExcitationMonitorOptions options_;
+
+  double first_time_s_ = -1.0;
+  double last_time_s_ = -1.0;
+  double sufficient_time_s_ = -1.0;
+
+  size_t num_gyro_samples_ = 0;
+  Eigen::Vector3d gyro_sq_sum_ = Eigen::Vector3d::Zero();
+  double last_gyro_time_s_ = -1.0;
+  Eigen::Vector3d last_gyro_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_rate_ = Eigen::Vector3d::Zero();
+
+  //! running mean and sum of squared deviations of the accelerometer axes
+  size_t num_accl_samples_ = 0;
+  Eigen::Vector3d accl_mean_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_m2_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_sq_sum_ = Eigen::Vector3d::Zero();
+
+  size_t num_views_ = 0;
+  std::vector<bool> covered_cells_;
+  size_t num_covered_cells_ = 0;
+
+  //! information matrices of the T_i_c rotation and translation and the
+  //! information of the line delay and the relative focal length
+  Eigen::Matrix3d rotation_information_ = Eigen::Matrix3d::Zero();
+  Eigen::Matrix3d translation_information_ = Eigen::Matrix3d::Zero();
+  double line_delay_information_ = 0.0;
+  double focal_length_information_ = 0.0;
+};
+
+//! Feeds the telemetry and the views of a vision dataset to an
+//! ExcitationMonitor in time order. end_time_s is the timestamp of the view
+//! at which the data became sufficient, in the camera clock. Returns false
+//! if the whole recording is not sufficient, report then describes all of
+//! it and end_time_s is the last view
+bool FindSufficientDataEnd(const CameraTelemetryData& telemetry,
+                           const theia::Reconstruction& vision_dataset,
+                           const double time_offset_imu_to_cam,
+                           const ExcitationMonitorOptions& options,
+                           double& end_time_s,
+                           ExcitationReport& report);
+
+}  // namespace core
+}  // namespace OpenICC
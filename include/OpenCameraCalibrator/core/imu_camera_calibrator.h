@@ -15,22 +15,95 @@
 
 #pragma once
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <utility>
 
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
 
 namespace OpenICC {
+namespace io {
+class MappedScene;
+}  // namespace io
+
 namespace core {
 
 const int SPLINE_N = 6;
 
+//! image grid cells per side for the coverage of the view selection
+const int SPLINE_VIEW_GRID_CELLS = 4;
+
+//! so3 knot intervals per block of measurements that are added together,
+//! see ImuCameraCalibrator::AddMeasurementsInTimeOrder
+const int SPLINE_TIME_ORDER_BLOCK_KNOTS = 16;
+
+//! Builds the vision dataset for BatchInitSpline from the poses and board
+//! points of a pose dataset (the points might have been optimized to account
+//! for non planarity of the target) and the corners of the scene. Views of
+//! the scene without an estimated pose or outside [t_begin_s, t_end_s] are
+//! skipped, only the other views are parsed
+bool SplineDatasetFromPoseDataset(
+    const theia::Reconstruction& pose_dataset,
+    const io::MappedScene& scene,
+    const theia::Camera& camera,
+    theia::Reconstruction& calib_dataset,
+    const double t_begin_s = std::numeric_limits<double>::lowest(),
+    const double t_end_s = std::numeric_limits<double>::max());
+
+//! Candidates of the line delay and time offset grid search of
+//! BatchInitSpline, see ImuCameraCalibrator::SetInitGridSearch
+struct InitGridSearchOptions {
+  //! line delays between min_factor and max_factor times the initial one.
+  //! Global shutter cameras keep a zero line delay
+  int num_line_delays = 11;
+  double line_delay_min_factor = 0.25;
+  double line_delay_max_factor = 1.25;
+  //! imu to camera time offsets within +-time_offset_range_s of the initial
+  //! one
+  int num_time_offsets = 21;
+  double time_offset_range_s = 0.02;
+  //! only every view_stride-th view and gyro_stride-th gyroscope sample is
+  //! evaluated
+  int view_stride = 4;
+  int gyro_stride = 4;
+};
+
+//! Replicas of ImuCameraCalibrator::Bootstrap
+struct ImuCameraBootstrapOptions {
+  int num_replicas = 32;
+  //! the recording is resampled in blocks of this length, which keeps the
+  //! correlated IMU noise and the motion inside a block together
+  double block_s = 2.0;
+  //! every replica starts at the main solution and needs few iterations
+  int max_num_iterations = 10;
+  //! stops a replica early, see SplineConvergenceCriteria
+  double min_relative_reprojection_improvement = 1e-3;
+  unsigned int seed = 42;
+};
+
+//! Standard deviations of the calibration over the bootstrap replicas
+struct ImuCameraBootstrapResult {
+  int num_replicas = 0;
+  //! T_i_c tangent [translation, rotation] around the main solution
+  Eigen::Matrix<double, 6, 1> T_i_c_std = Eigen::Matrix<double, 6, 1>::Zero();
+  double line_delay_std_s = 0.0;
+  Eigen::Matrix<double, 6, 1> accl_intrinsics_std =
+      Eigen::Matrix<double, 6, 1>::Zero();
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics_std =
+      Eigen::Matrix<double, 9, 1>::Zero();
+};
+
 class ImuCameraCalibrator {
  public:
   ImuCameraCalibrator() {}
+  //! The vision dataset is shared with the spline estimator, not copied
   void BatchInitSpline(
-      const theia::Reconstruction& vision_dataset,
+      std::shared_ptr<theia::Reconstruction> vision_dataset,
       const Sophus::SE3<double>& T_i_c_init,
       const OpenICC::SplineWeightingData& spline_weight_data,
       const double time_offset_imu_to_cam,
@@ -39,8 +112,42 @@ class ImuCameraCalibrator {
       const ThreeAxisSensorCalibParams<double> accl_intrinsics,
       const ThreeAxisSensorCalibParams<double> gyro_intrinsics);
 
+  //! Adds another camera of the rig. Its views become camera residuals on
+  //! the same spline and IMU residuals as the BatchInitSpline dataset, with
+  //! their own T_i_c and line delay. The view timestamps are shifted by
+  //! time_offset_s onto the time of that dataset. Returns the camera index
+  //! of trajectory_. Needs to be called before BatchInitSpline
+  int AddRigCamera(std::shared_ptr<theia::Reconstruction> vision_dataset,
+                   const Sophus::SE3<double>& T_i_c_init,
+                   const double initial_line_delay,
+                   const double time_offset_s);
+
+  //! AddRigCamera from the corners, pose dataset, camera calibration and imu
+  //! to camera rotation init of the camera. The time offset to camera 0
+  //! follows from the imu to camera time offsets of both cameras
+  bool AddRigCameraFromFiles(const std::string& input_corners,
+                             const std::string& input_pose_dataset,
+                             const std::string& camera_calibration_json,
+                             const std::string& imu_rotation_init,
+                             const double time_offset_imu_to_cam,
+                             const bool global_shutter);
+
   double Optimize(const int iterations, const int optim_flags);
 
+  //! Appends the views of the shared vision dataset and the IMU samples of
+  //! telemetry_data that are newer than the stored ones, e.g. of a recording
+  //! that is still running, and extends the spline to the newest view. New
+  //! views are not thinned by SetMaxViewsPerKnotInterval. Needs to be called
+  //! after BatchInitSpline with a single knot spacing level. The
+  //! measurements enter the problem with OptimizeLatestWindow
+  void AppendMeasurements(const std::vector<theia::ViewId>& view_ids,
+                          const OpenICC::CameraTelemetryData& telemetry_data);
+
+  //! Optimizes the fixed-lag window (see SetFixedLagWindow) that ends at the
+  //! newest view, the problem is rebuilt from the stored measurements.
+  //! Without a window the whole spline is optimized
+  double OptimizeLatestWindow(const int iterations, const int optim_flags);
+
   void ToTheiaReconDataset(theia::Reconstruction& output_recon);
 
   void ClearSpline();
@@ -50,15 +157,16 @@ class ImuCameraCalibrator {
   //! camera timestamps in seconds
   std::vector<double> GetCamTimestamps() { return cam_timestamps_; }
 
-  //! get gyroscope measurements
-  aligned_map<double, Eigen::Vector3d> GetGyroMeasurements() {
-    return gyro_measurements_;
+  //! imu timestamps in seconds, sorted
+  const std::vector<double>& GetImuTimestamps() const {
+    return imu_timestamps_s_;
   }
 
-  //! get accelerometer measurements
-  aligned_map<double, Eigen::Vector3d> GetAcclMeasurements() {
-    return accl_measurements_;
-  }
+  //! get gyroscope measurements at GetImuTimestamps()
+  const vec3_vector& GetGyroMeasurements() const { return gyro_measurements_; }
+
+  //! get accelerometer measurements at GetImuTimestamps()
+  const vec3_vector& GetAcclMeasurements() const { return accl_measurements_; }
 
   //! Use this function if we really know the gravity direction of
   //! the calibration board (e.g. flat on the ground -> [0,0,9.81])
@@ -72,6 +180,245 @@ class ImuCameraCalibrator {
   double GetCalibratedRSLineDelay() { return trajectory_.GetRSLineDelay(); }
   double GetInitialRSLineDelay() { return inital_cam_line_delay_s_; }
 
+  //! Needs to be called before BatchInitSpline
+  void SetUseAnalyticImuJacobians(const bool use_analytic_jacobians) {
+    trajectory_.SetUseAnalyticImuJacobians(use_analytic_jacobians);
+  }
+
+  //! Spline knot Jacobians of the analytic IMU residuals in float. Needs to
+  //! be called before BatchInitSpline
+  void SetUseFloatImuJacobians(const bool use_float_jacobians) {
+    trajectory_.SetUseFloatImuJacobians(use_float_jacobians);
+  }
+
+  //! Share the rotation knot differences of the analytic IMU residuals per
+  //! solver evaluation. Needs to be called before BatchInitSpline
+  void SetShareKnotEvaluations(const bool share_knot_evaluations) {
+    trajectory_.SetShareKnotEvaluations(share_knot_evaluations);
+  }
+
+  //! Keep the board points constant inside the camera residuals. Needs to
+  //! be called before BatchInitSpline
+  void SetRigidBoard(const bool rigid_board) {
+    trajectory_.SetRigidBoard(rigid_board);
+  }
+
+  //! Knot spacing of the accelerometer and gyroscope bias splines in
+  //! seconds. A spacing <= 0 estimates one constant bias for the recording.
+  //! Needs to be called before BatchInitSpline
+  void SetBiasSplineKnotSpacing(const double accl_dt_s,
+                                const double gyro_dt_s) {
+    accl_bias_dt_s_ = accl_dt_s;
+    gyro_bias_dt_s_ = gyro_dt_s;
+  }
+
+  //! Only calibrate the rotation between gyroscope and camera, the time
+  //! offset and the line delay. Adds just the gyroscope residuals and keeps
+  //! the R3 knots, the translation of T_i_c and the board points at their
+  //! initial values. Needs to be called before BatchInitSpline
+  void SetRotationOnly(const bool rotation_only) {
+    rotation_only_ = rotation_only;
+    trajectory_.SetRotationOnly(rotation_only);
+    if (rotation_only) {
+      trajectory_.SetRigidBoard(true);
+    }
+  }
+
+  //! Residual blocks the reprojection errors of a view are split into.
+  //! Needs to be called before BatchInitSpline
+  void SetCameraResidualLayout(const CameraResidualLayout layout) {
+    trajectory_.SetCameraResidualLayout(layout);
+  }
+
+  //! Linearize the rolling shutter around the center row of every view.
+  //! Needs to be called before BatchInitSpline
+  void SetLinearizeRollingShutter(const bool linearize_rolling_shutter) {
+    trajectory_.SetLinearizeRollingShutter(linearize_rolling_shutter);
+  }
+
+  //! Group IMU samples of the same spline segment into one residual block.
+  //! Needs to be called before BatchInitSpline
+  void SetBatchImuResiduals(const bool batch_imu_residuals) {
+    batch_imu_residuals_ = batch_imu_residuals;
+  }
+
+  //! Add the gyroscope and accelerometer sample of a timestamp as one
+  //! residual. Needs to be called before BatchInitSpline
+  void SetFuseImuResiduals(const bool fuse_imu_residuals) {
+    fuse_imu_residuals_ = fuse_imu_residuals;
+  }
+
+  //! Replace the per-sample IMU residuals by preintegrated factors per spline
+  //! segment. Needs to be called before BatchInitSpline
+  void SetUseImuPreintegration(const bool use_imu_preintegration) {
+    use_imu_preintegration_ = use_imu_preintegration;
+  }
+
+  //! Optimize a window of window_s seconds that advances by step_s over the
+  //! recording instead of the whole spline at once. Measurements enter the
+  //! problem with the window and are dropped once it passed them, which
+  //! bounds memory for long recordings. Needs to be called before
+  //! BatchInitSpline
+  void SetFixedLagWindow(const double window_s, const double step_s) {
+    fixed_lag_window_s_ = window_s;
+    fixed_lag_step_s_ = step_s > 0.0 ? step_s : window_s;
+  }
+
+  //! Split the recording into segments of segment_s seconds that are solved
+  //! in parallel, each with the measurements of overlap_s seconds around it
+  //! and only its spline knots variable. Every round is followed by a solve
+  //! of the other optimized parameters over every global_sample_stride-th
+  //! measurement with the spline fixed. Needs to be called before
+  //! BatchInitSpline
+  void SetDomainDecomposition(const double segment_s,
+                              const double overlap_s,
+                              const int rounds,
+                              const int global_sample_stride) {
+    decomposition_segment_s_ = segment_s;
+    decomposition_overlap_s_ = overlap_s;
+    decomposition_rounds_ = std::max(rounds, 1);
+    decomposition_sample_stride_ = std::max(global_sample_stride, 1);
+  }
+
+  //! Solve on levels - 1 coarser knot spacings first, each one twice the
+  //! next finer one, and use every solution to initialize the next level.
+  //! Needs to be called before BatchInitSpline
+  void SetKnotSpacingLevels(const int levels) {
+    knot_spacing_levels_ = levels;
+  }
+
+  //! Least squares fit of the initial knots to the vision poses and the
+  //! gyroscope samples instead of interpolating the poses. Needs to be called
+  //! before BatchInitSpline
+  void SetFitKnotsToPoses(const bool fit_knots,
+                          const KnotFitOptions& options = KnotFitOptions()) {
+    fit_knots_to_poses_ = fit_knots;
+    knot_fit_options_ = options;
+  }
+
+  //! Evaluate a grid of line delays and imu to camera time offsets around
+  //! the initial values on the initialized spline with the knots fixed and
+  //! start from the best candidates. The line delay is scored by the
+  //! reprojection error, the time offset by the gyroscope error against
+  //! the spline angular velocity. Needs to be called before BatchInitSpline
+  void SetInitGridSearch(const bool grid_search,
+                         const InitGridSearchOptions& options =
+                             InitGridSearchOptions()) {
+    init_grid_search_ = grid_search;
+    init_grid_search_options_ = options;
+  }
+
+  //! imu to camera time offset of the imu samples, the one passed to
+  //! BatchInitSpline unless the grid search changed it
+  double GetTimeOffsetImuToCam() const { return time_offset_imu_to_cam_s_; }
+
+  //! Average blocks of IMU samples down to about rate_hz before they become
+  //! residuals, the residual weights grow with the square root of the block
+  //! size. The rate should stay well above the inverse knot spacing. 0 keeps
+  //! every sample. Needs to be called before BatchInitSpline
+  void SetImuDecimationRate(const double rate_hz) {
+    imu_decimation_rate_hz_ = rate_hz;
+  }
+
+  //! Remove the outlier residual blocks before every spline solve that
+  //! follows another one, i.e. between the knot spacing levels and the
+  //! Optimize calls. Not used by the fixed-lag and decomposed modes, they
+  //! rebuild the problem every sweep
+  void SetOutlierGating(const bool gate_outliers,
+                        const OutlierGatingOptions& options =
+                            OutlierGatingOptions()) {
+    gate_outliers_ = gate_outliers;
+    outlier_gating_options_ = options;
+  }
+
+  //! Keep at most this many views per knot interval as camera residuals,
+  //! selected by board coverage, feature count and motion. 0 keeps all
+  //! views. Needs to be called before BatchInitSpline
+  void SetMaxViewsPerKnotInterval(const int max_views) {
+    max_views_per_knot_interval_ = max_views;
+  }
+
+  //! Linear solver setup of the spline optimization
+  void SetSolverProfile(const SplineSolverProfile& profile) {
+    trajectory_.SetSolverProfile(profile);
+  }
+
+  //! Print evaluation count and time per residual kind after every spline
+  //! solve. Needs to be called before BatchInitSpline
+  void SetProfileResiduals(const bool profile_residuals) {
+    trajectory_.SetProfileResiduals(profile_residuals);
+  }
+
+  //! Called after every solver iteration of the spline optimization
+  void SetIterationCallback(SplineIterationCallback callback) {
+    trajectory_.SetIterationCallback(std::move(callback));
+  }
+
+  //! Lets every spline solve stop before its iteration budget is used up
+  //! Graduated robust loss of the camera residuals. The first batch solve
+  //! runs one stage of at most stage_iterations per Huber width in widths_px
+  //! before the full solve with the last width, so the early iterations are
+  //! not pulled around by outliers. The widths should shrink, 0 removes the
+  //! loss. Empty disables the schedule. All other solves use the last
+  //! width. Needs to be called before BatchInitSpline
+  void SetGraduatedCameraLoss(const std::vector<double>& widths_px,
+                              const int stage_iterations) {
+    graduated_loss_widths_px_ = widths_px;
+    graduated_loss_iterations_ = stage_iterations;
+    if (!widths_px.empty()) {
+      trajectory_.SetCameraLossWidth(widths_px.back());
+    }
+  }
+
+  void SetConvergenceCriteria(const SplineConvergenceCriteria& criteria) {
+    trajectory_.SetConvergenceCriteria(criteria);
+  }
+
+  //! Initialize T_i_c, the line delay and the IMU intrinsics from the spline
+  //! state of another recording of the same rig instead of the values passed
+  //! to BatchInitSpline. Needs to be called before BatchInitSpline
+  bool SetWarmStartSplineState(const std::string& path);
+
+  //! Checkpoint of the spline knots and calibration parameters
+  bool SaveSplineState(const std::string& path) const;
+
+  //! Resume from a SaveSplineState of the same recording and spline
+  //! settings. Needs to be called after BatchInitSpline
+  bool LoadSplineState(const std::string& path);
+
+  //! Marginal covariance of T_i_c, the line delay and the IMU intrinsics of
+  //! the parameter groups optimized so far, with the knots, points, biases
+  //! and gravity eliminated. Call after a batch Optimize, the fixed-lag and
+  //! decomposed modes only keep the last window in the problem. The layout
+  //! is the one of SplineTrajectoryEstimator::CalibrationNormalEquations,
+  //! WriteCalibrationResult writes the standard deviations
+  bool ComputeCalibrationCovariance();
+  const Eigen::MatrixXd& GetCalibrationCovariance() const {
+    return calibration_covariance_;
+  }
+
+  //! Solves replicas of the calibration on blocks of the recording drawn
+  //! with replacement, a block drawn k times adds its views and IMU samples
+  //! k times. The replicas share the measurements, start from the current
+  //! solution and optimize the parameter groups optimized so far, in
+  //! parallel on the threads of the spline estimator. Call after a batch
+  //! Optimize, WriteCalibrationResult writes the spreads
+  bool Bootstrap(const ImuCameraBootstrapOptions& options);
+  const ImuCameraBootstrapResult& GetBootstrapResult() const {
+    return bootstrap_result_;
+  }
+
+  //! RMS of the unweighted gyroscope [rad/s] and accelerometer [m/s^2]
+  //! residuals of the imu samples inside the spline, with the calibrated
+  //! intrinsics and biases. Comparable between different spline weightings
+  bool GetImuResidualRms(double& gyro_rms, double& accl_rms);
+
+  //! Writes the calibrated imu to camera transformation, line delay and the
+  //! measured and spline imu values at all imu timestamps to a json file
+  bool WriteCalibrationResult(const std::string& output_json,
+                              const double reproj_error,
+                              const double time_offset_imu_to_cam);
+
   void GetIMUIntrinsics(ThreeAxisSensorCalibParams<double>& acc_intrinsics,
                         ThreeAxisSensorCalibParams<double>& gyr_intrinsics,
                         const int64_t time_ns = 0);
@@ -79,14 +426,71 @@ class ImuCameraCalibrator {
  private:
   void InitializeGravity(const OpenICC::CameraTelemetryData& telemetry_data);
 
+  //! add every stride-th camera view and stored imu sample with
+  //! start_s <= t < end_s to trajectory
+  void AddVisionMeasurements(const double start_s,
+                             const double end_s,
+                             SplineTrajectoryEstimator<SPLINE_N>& trajectory,
+                             const int stride = 1);
+  void AddImuMeasurements(const double start_s,
+                          const double end_s,
+                          SplineTrajectoryEstimator<SPLINE_N>& trajectory,
+                          const int stride = 1);
+
+  //! adds the vision and imu measurements of all views and imu samples in
+  //! blocks of SPLINE_TIME_ORDER_BLOCK_KNOTS knot intervals, one block after
+  //! the other. Ceres evaluates the residual blocks in insertion order, so
+  //! consecutive residuals touch the same knots
+  void AddMeasurementsInTimeOrder(
+      SplineTrajectoryEstimator<SPLINE_N>& trajectory);
+
+  //! optimize the spline at the current knot spacing
+  double OptimizeSpline(const int iterations, const int optim_flags);
+  double OptimizeFixedLag(const int iterations, const int optim_flags);
+  double OptimizeDecomposed(const int iterations, const int optim_flags);
+  //! all but the last stage of the graduated camera loss, restores the last
+  //! width
+  void OptimizeGraduatedLoss(const int optim_flags);
+
+  //! the sweeps of the fixed-lag and decomposed modes add the measurements
+  //! themselves
+  bool AddsMeasurementsPerSweep() const {
+    return fixed_lag_window_s_ > 0.0 || decomposition_segment_s_ > 0.0;
+  }
+
+  //! block averages the stored IMU samples to imu_decimation_rate_hz_ and
+  //! scales the spline weighting to the lower noise
+  void DecimateImuMeasurements();
+
+  //! thins cam_timestamps_ to spline_cam_timestamps_ under the views per
+  //! knot interval budget
+  void SelectSplineViews();
+
+  //! grid search of the initial line delay and time offset on the
+  //! initialized spline, see SetInitGridSearch
+  void SearchInitGrid(
+      const OpenICC::CameraTelemetryData& telemetry_data,
+      const ThreeAxisSensorCalibParams<double>& gyro_intrinsics);
+
+  //! knot spacing in nanoseconds on the current level
+  int64_t KnotSpacingNs(const double dt_s) const;
+
   //! camera timestamps
   std::vector<double> cam_timestamps_;
 
-  //! accl measurements
-  aligned_map<double, Eigen::Vector3d> gyro_measurements_;
+  //! sorted timestamps of the views that become camera residuals
+  std::vector<double> spline_cam_timestamps_;
+
+  //! imu timestamps in seconds, sorted
+  std::vector<double> imu_timestamps_s_;
+  //! the same timestamps rounded to nanoseconds once, the spline times
+  std::vector<int64_t> imu_times_ns_;
 
   //! gyro measurements
-  aligned_map<double, Eigen::Vector3d> accl_measurements_;
+  vec3_vector gyro_measurements_;
+
+  //! accl measurements
+  vec3_vector accl_measurements_;
 
   //! spline know spacing in R3 and SO3 in seconds
   SplineWeightingData spline_weight_data_;
@@ -114,7 +518,87 @@ class ImuCameraCalibrator {
   //! is gravity direction in sensor frame is initialized
   bool reestimate_biases_ = false;
 
-  theia::Reconstruction image_data_;
+  //! add IMU samples as one residual block per spline segment
+  bool batch_imu_residuals_ = false;
+
+  //! one 6-D residual per IMU sample instead of a gyro and an accl residual
+  bool fuse_imu_residuals_ = false;
+
+  //! add preintegrated IMU factors instead of per-sample residuals
+  bool use_imu_preintegration_ = false;
+
+  //! only gyroscope residuals and the rotation of the trajectory
+  bool rotation_only_ = false;
+
+  //! knot spacing of the bias splines in seconds, <= 0 is constant
+  double accl_bias_dt_s_ = 10.0;
+  double gyro_bias_dt_s_ = 10.0;
+
+  //! fixed-lag window length and step in seconds, 0 optimizes in batch
+  double fixed_lag_window_s_ = 0.0;
+  double fixed_lag_step_s_ = 0.0;
+
+  //! segment length and overlap in seconds, 0 optimizes in batch
+  double decomposition_segment_s_ = 0.0;
+  double decomposition_overlap_s_ = 0.0;
+  int decomposition_rounds_ = 1;
+  int decomposition_sample_stride_ = 1;
+
+  //! number of knot spacing levels and the current one, 0 is the finest
+  int knot_spacing_levels_ = 1;
+  int current_knot_level_ = 0;
+
+  //! target IMU rate in Hz, 0 keeps all samples
+  double imu_decimation_rate_hz_ = 0.0;
+
+  //! gate outliers before every solve after the first one
+  bool gate_outliers_ = false;
+  OutlierGatingOptions outlier_gating_options_;
+  bool spline_solved_ = false;
+
+  //! camera loss widths of the first solve, see SetGraduatedCameraLoss
+  std::vector<double> graduated_loss_widths_px_;
+  int graduated_loss_iterations_ = 5;
+
+  //! view budget per knot interval, 0 keeps all views
+  int max_views_per_knot_interval_ = 0;
+
+  //! fit the initial knots instead of interpolating the vision poses
+  bool fit_knots_to_poses_ = false;
+  KnotFitOptions knot_fit_options_;
+
+  //! line delay and time offset grid search in BatchInitSpline
+  bool init_grid_search_ = false;
+  InitGridSearchOptions init_grid_search_options_;
+
+  //! imu to camera time offset of the stored imu samples in seconds
+  double time_offset_imu_to_cam_s_ = 0.0;
+
+  //! parameter groups of all Optimize calls so far
+  int optimized_flags_ = 0;
+
+  //! of ComputeCalibrationCovariance, empty before
+  Eigen::MatrixXd calibration_covariance_;
+  int covariance_groups_ = 0;
+
+  //! of Bootstrap, no replicas before
+  ImuCameraBootstrapResult bootstrap_result_;
+
+  //! calibration of another recording that BatchInitSpline starts from
+  std::unique_ptr<io::SplineState> warm_start_state_;
+
+  std::shared_ptr<theia::Reconstruction> image_data_;
+
+  //! cameras of the rig besides image_data_
+  struct RigCameraData {
+    std::shared_ptr<theia::Reconstruction> image_data;
+    //! sorted view timestamps in seconds, without the time offset
+    std::vector<double> timestamps;
+    double time_offset_s = 0.0;
+    bool rolling_shutter = false;
+    int camera = 0;
+  };
+  std::vector<RigCameraData> rig_cameras_;
 };
 
 }  // namespace core
@@ -15,26 +15,62 @@
 
 #pragma once
 
+#include <theia/sfm/reconstruction.h>
+
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/smoothing_filter.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 namespace OpenICC {
 namespace core {
 
+//! Robust rotation fit for recordings with tracking loss. The angular
+//! velocity pairs are summed per time window once, every hypothesis is fit to
+//! a random subset of windows from these sums and scored by the windows it
+//! explains, the rotation is refit to the inlier windows of the best one.
+struct RotationRansacOptions {
+  //! 0 disables the RANSAC, the rotation is fit to all samples
+  int num_hypotheses = 0;
+  double window_s = 1.0;
+  int windows_per_hypothesis = 3;
+  //! rms residual in rad/s below which a window is an inlier
+  double inlier_threshold = 0.1;
+  unsigned int seed = 42;
+};
+
 class ImuToCameraRotationEstimator {
  public:
   ImuToCameraRotationEstimator() {}
   ImuToCameraRotationEstimator(const quat_map& visual_rotations,
-                               const vec3_map& imu_angular_vel)
-      : visual_rotations_(visual_rotations),
-        imu_angular_vel_(imu_angular_vel) {}
-
-  void SetVisualRotations(const quat_map& visual_rotations) {
-    visual_rotations_ = visual_rotations;
+                               const vec3_map& imu_angular_vel) {
+    SetVisualRotations(visual_rotations);
+    SetAngularVelocities(imu_angular_vel);
   }
 
-  void SetAngularVelocities(const vec3_map& imu_angular_vel) {
-    imu_angular_vel_ = imu_angular_vel;
-  }
+  void SetVisualRotations(const quat_map& visual_rotations);
+
+  void SetAngularVelocities(const vec3_map& imu_angular_vel);
+
+  //! Bulk insert of the visual rotations. The measurements are sorted by
+  //! timestamp if needed, for equal timestamps the last one is kept.
+  void SetVisualRotations(const std::vector<double>& timestamps_s,
+                          const quat_vector& visual_rotations);
+
+  //! Bulk insert of the imu angular velocities, see SetVisualRotations
+  void SetAngularVelocities(const std::vector<double>& timestamps_s,
+                            const vec3_vector& imu_angular_vel);
+
+  //! Sets the bias corrected gyroscope measurements, shifted by
+  //! t_imu_to_cam, and the camera rotations of the pose dataset. The visual
+  //! rotations are interpolated to the median camera rate as some views
+  //! might be missing. imu_dt_s is the mean imu sample interval
+  bool SetMeasurementsFromPoseDataset(
+      const theia::Reconstruction& pose_dataset,
+      const CameraTelemetryData& telemetry_data,
+      const Eigen::Vector3d& gyro_bias,
+      const double t_imu_to_cam,
+      double& imu_dt_s);
 
   bool EstimateCameraImuRotation(const double dt_imu,
                                  Eigen::Matrix3d& R_imu_to_camera,
@@ -45,23 +81,97 @@ class ImuToCameraRotationEstimator {
 
   double SolveClosedForm(const vec3_vector& angVis,
                          const vec3_vector& angImu,
-                         const std::vector<double> timestamps_s,
+                         const std::vector<double>& timestamps_s,
                          const double td,
                          const double dt_imu,
                          Eigen::Matrix3d& Rs,
                          Eigen::Vector3d& bias);
 
+  //! Coarse time offset between the smoothed imu and visual angular
+  //! velocities, both given at timestamps_s. Cross correlates their
+  //! magnitudes resampled at dt_imu. Returns false if the correlation peak is
+  //! too weak to be trusted.
+  bool CoarseTimeOffset(const vec3_vector& ang_imu,
+                        const vec3_vector& ang_vis,
+                        const std::vector<double>& timestamps_s,
+                        const double dt_imu,
+                        double& time_offset);
+
   void EnableGyroBiasEstimation() { estimate_gyro_bias_ = true; }
 
+  //! Largest time offset in seconds that is searched, default 1s
+  void SetMaxTimeOffset(const double max_time_offset_s) {
+    max_time_offset_s_ = max_time_offset_s;
+  }
+
+  //! Half width in seconds of the golden-section search window around the
+  //! cross correlation estimate, default 0.05s
+  void SetFineSearchWindow(const double fine_search_window_s) {
+    fine_search_window_s_ = fine_search_window_s;
+  }
+
+  //! Filter for the imu and visual angular velocities before the time offset
+  //! and rotation are estimated, default a 15 sample moving average
+  void SetSmoothingFilter(const utils::SmoothingFilterOptions& options) {
+    smoothing_filter_ = options;
+  }
+
+  void SetRansac(const RotationRansacOptions& options) {
+    ransac_options_ = options;
+  }
+
+  //! Threads the RANSAC hypotheses are scored on, default 1
+  void SetNumThreads(const int num_threads) { num_threads_ = num_threads; }
+
  private:
-  //! visual rotations
-  quat_map visual_rotations_;
+  //! Sums of the angular velocity pairs of one time window
+  struct WindowSums {
+    int num_samples = 0;
+    Eigen::Vector3d sum_imu = Eigen::Vector3d::Zero();
+    Eigen::Vector3d sum_vis = Eigen::Vector3d::Zero();
+    //! sum of ang_imu * ang_vis^T
+    Eigen::Matrix3d cross = Eigen::Matrix3d::Zero();
+    //! sum of the squared norms of both
+    double sum_sq = 0.0;
+  };
+
+  //! Fits the rotation to the inlier windows of the best hypothesis and
+  //! returns the means of their samples. Falls back to all windows if there
+  //! are too few of them.
+  void SolveWindowedRansac(const vec3_vector& ang_vis,
+                           const vec3_vector& ang_imu,
+                           const std::vector<double>& timestamps_s,
+                           Eigen::Matrix3d& Rs,
+                           Eigen::Vector3d& mean_imu,
+                           Eigen::Vector3d& mean_vis);
+
+  //! visual rotations, sorted by timestamp
+  std::vector<double> vis_timestamps_s_;
+  quat_vector visual_rotations_;
 
-  //! imu angular velocities
-  vec3_map imu_angular_vel_;
+  //! imu angular velocities, sorted by timestamp
+  std::vector<double> imu_timestamps_s_;
+  vec3_vector imu_angular_vel_;
 
   //! estimate bias
   bool estimate_gyro_bias_ = false;
+
+  double max_time_offset_s_ = 1.0;
+
+  double fine_search_window_s_ = 0.05;
+
+  //! below this normalized correlation the full window is searched
+  double min_peak_correlation_ = 0.5;
+
+  utils::SmoothingFilterOptions smoothing_filter_;
+
+  RotationRansacOptions ransac_options_;
+
+  int num_threads_ = 1;
+
+  //! windows and inlier windows of the last windowed RANSAC fit
+  size_t num_windows_ = 0;
+  size_t num_inlier_windows_ = 0;
 };
 
 }  // namespace core
@@ -0,0 +1,75 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Calibrates T_i_c, the line delays and the IMU intrinsics of a device on
+//! several recordings at once. Every sequence keeps its own spline, biases
+//! and gravity, so the gaps between the recordings cost no knots. A round
+//! solves the sequence splines independently and in parallel with the
+//! shared calibration fixed, followed by Levenberg-Marquardt steps on the
+//! shared calibration over the residuals of all sequences with the splines
+//! fixed. The sequences are optimized in batch, the fixed-lag and
+//! decomposed modes leave their problems empty after a solve.
+class MultiSequenceCalibrator {
+ public:
+  MultiSequenceCalibrator() {}
+
+  //! New sequence, set it up and call BatchInitSpline on it as for a single
+  //! recording. All sequences need the same cameras.
+  ImuCameraCalibrator& AddSequence();
+
+  size_t NumSequences() const { return sequences_.size(); }
+
+  ImuCameraCalibrator& Sequence(const size_t i) { return *sequences_[i]; }
+
+  //! threads shared by the sequences of a round
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(num_threads, 1);
+  }
+
+  //! Runs the rounds. sequence_flags are the per-sequence parameters,
+  //! e.g. SPLINE and the biases, shared_flags the calibration groups of
+  //! SplineTrajectoryEstimator::CalibrationNormalEquations. The sequences
+  //! start from the calibration of the first one. Returns the mean
+  //! reprojection error over the sequences.
+  double Optimize(const int rounds,
+                  const int iterations,
+                  const int sequence_flags,
+                  const int shared_flags,
+                  const int shared_iterations = 10);
+
+ private:
+  //! Levenberg-Marquardt on the shared calibration, the normal equations of
+  //! the sequences are summed. Returns the final cost.
+  double OptimizeShared(const int shared_flags, const int iterations);
+
+  std::vector<std::unique_ptr<ImuCameraCalibrator>> sequences_;
+
+  int num_threads_ = utils::Executor::Global().MaxConcurrency();
+};
+
+}  // namespace core
+}  // namespace OpenICC
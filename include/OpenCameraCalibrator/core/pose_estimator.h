@@ -21,12 +21,23 @@
 #include <theia/sfm/reconstruction.h>
 #include <theia/solvers/ransac.h>
 
-#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+#include "OpenCameraCalibrator/utils/reprojection_error.h"
 #include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/undistortion_map.h"
 
+#include <map>
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace OpenICC {
+namespace io {
+class MappedScene;
+}  // namespace io
+
 namespace core {
 
 struct Pose {
@@ -39,6 +50,7 @@ struct Pose {
 class PoseEstimator {
  public:
   PoseEstimator();
+  ~PoseEstimator();
 
   bool EstimatePosePinhole(const theia::ViewId& view_id,
                            const std::vector<theia::FeatureCorrespondence2D3D>&
@@ -48,17 +60,192 @@ class PoseEstimator {
   bool EstimatePosesFromJson(const nlohmann::json& scene_json,
                              const theia::Camera camera);
 
+  //! Same as EstimatePosesFromJson, but views are parsed one at a time
+  bool EstimatePosesFromScene(const io::MappedScene& scene,
+                              const theia::Camera camera);
+
+  //! Sets up the estimator for views that arrive one at a time, e.g. from a
+  //! live camera. The board points are the scene_pts of scene_header
+  void InitializeStream(const nlohmann::json& scene_header,
+                        const theia::Camera& camera) {
+    InitializeFromScene(scene_header, camera);
+  }
+
+  //! PnP and pose check of one view of InitializeStream, view holds its
+  //! image_points. The view is not kept in the pose dataset, so it stays
+  //! small for long streams. Returns the orientation as angle axis and the
+  //! position of the camera.
+  bool EstimateStreamViewPose(const std::string& view_key,
+                              const nlohmann::json& view,
+                              const theia::Camera& camera,
+                              Eigen::Vector3d& orientation,
+                              Eigen::Vector3d& position);
+
+  //! Starts the estimation of views that are added one at a time while the
+  //! corners are still being extracted. The board points are the scene_pts
+  //! of scene_header. The views are prepared and solved by worker threads
+  //! while the caller continues
+  void StartViews(const nlohmann::json& scene_header,
+                  const theia::Camera& camera);
+
+  //! Queues a view of StartViews, blocks while the queue is full. Views with
+  //! the key of the previous view are merged like in the scene writer
+  void AddView(const std::string& view_key, const nlohmann::json& view);
+
+  //! Waits for the queued views and adds them to the pose dataset in
+  //! timestamp order. Gives the same poses as EstimatePosesFromScene on the
+  //! scene file the views were written to
+  bool FinishViews();
+
   void GetPoseDataset(theia::Reconstruction& pose_dataset) {
     pose_dataset = pose_dataset_;
   }
 
   void OptimizeBoardPoints();
 
+  //! Refines all poses with the board points fixed. With the independent
+  //! pose refinement every view is a small 6 DoF problem of its own, solved
+  //! in parallel, otherwise all views are bundle adjusted by theia.
   void OptimizeAllPoses();
 
+  //! Removes views far from the median board distance and views with a
+  //! reprojection error far above the median of all views. Reuses the
+  //! errors of an independent pose refinement right before it.
   void FilterBadPoses();
 
+  //! OptimizeBoardPoints alternates parallel point updates with fixed poses
+  //! and parallel pose updates with fixed points instead of one theia
+  //! bundle adjustment. Only up to max_views well conditioned views are
+  //! used, 0 uses all of them.
+  void SetAlternatingBoardRefinement(const bool alternating,
+                                     const int max_views = 200,
+                                     const int rounds = 3) {
+    alternating_board_refinement_ = alternating;
+    max_board_refinement_views_ = max_views;
+    board_refinement_rounds_ = rounds;
+  }
+
+  //! Refine the poses of OptimizeAllPoses independently, valid as the board
+  //! points are fixed at that point
+  void SetIndependentPoseRefinement(const bool independent) {
+    independent_pose_refinement_ = independent;
+  }
+
+  //! Number of threads used to prepare the correspondences and to solve PnP
+  //! per view. Results do not depend on it, as every view seeds its own
+  //! RANSAC random number generator. Default is the number of hardware
+  //! threads.
+  void SetNumThreads(const int num_threads) { num_threads_ = num_threads; }
+
+  //! Undistort the corners through a lookup table of the camera sampled
+  //! every cell_size_px pixels instead of the iterative undistortion of the
+  //! camera model. 0 disables it.
+  void SetUndistortionMapCellSize(const double cell_size_px) {
+    undistortion_map_cell_px_ = cell_size_px;
+  }
+
+  //! Start the PnP of a view from the pose of the previous view solved by
+  //! the same thread if it is at most max_gap_s older. The pose is refined
+  //! on all corners and corners above the RANSAC threshold are gated.
+  //! RANSAC only runs if less than min_inlier_ratio of the corners remain.
+  //! Which views fall back to RANSAC depends on the number of threads.
+  void SetPoseTracking(const bool tracking,
+                       const double max_gap_s = 0.1,
+                       const double min_inlier_ratio = 0.9) {
+    pose_tracking_ = tracking;
+    max_tracking_gap_s_ = max_gap_s;
+    min_tracking_inlier_ratio_ = min_inlier_ratio;
+  }
+
  private:
+  //! Correspondences of one view and its PnP result
+  struct ViewPnP {
+    std::string view_key;
+    double timestamp_s = 0.0;
+    std::vector<int> board_pts3_ids;
+    std::vector<theia::FeatureCorrespondence2D3D> correspondences_undist;
+    bool pose_found = false;
+    //! the pose was tracked from the previous view without RANSAC
+    bool tracked = false;
+    theia::CalibratedAbsolutePose pose;
+    std::vector<int> inliers;
+  };
+
+  //! Undistorts the corners of a view and pairs them with the board points.
+  //! Does not modify the pose dataset. Returns false if there are too few.
+  bool PrepareView(const std::string& view_key,
+                   const nlohmann::json& view,
+                   const theia::Camera& camera,
+                   ViewPnP& view_pnp) const;
+
+  //! RANSAC PnP on the prepared correspondences, thread safe
+  void SolvePnP(const theia::RansacParameters& ransac_params,
+                ViewPnP& view_pnp) const;
+
+  //! Refines the pose of previous on the correspondences of view_pnp and
+  //! gates them. Returns false if previous is too old or too few
+  //! correspondences are inliers, thread safe
+  bool TrackPnP(const ViewPnP& previous, ViewPnP& view_pnp) const;
+
+  //! TrackPnP from previous if pose tracking is enabled, RANSAC PnP if that
+  //! fails. previous may be nullptr
+  void SolveViewPnP(const theia::RansacParameters& ransac_params,
+                    const ViewPnP* previous,
+                    ViewPnP& view_pnp) const;
+
+  //! Sets the PnP pose and inliers to a view of the pose dataset and
+  //! refines it
+  bool AddPnPResult(const theia::ViewId& view_id, const ViewPnP& view_pnp);
+
+  //! Prepares and solves all views in parallel, then adds them to the pose
+  //! dataset in timestamp order. parse_view(i, key, storage) returns view i,
+  //! or nullptr, and may parse it into storage.
+  template <typename ParseView>
+  void EstimatePoses(const size_t num_views,
+                     const theia::Camera& camera,
+                     ParseView&& parse_view);
+
+  //! Adds a solved view to the pose dataset and checks its reprojection
+  //! error
+  bool AddViewPnP(const ViewPnP& view_pnp);
+
+  //! Adds the solved views with AddViewPnP ordered by their timestamps
+  void AddViewsInTimeOrder(std::vector<const ViewPnP*>& views_pnp);
+
+  //! RANSAC seed of a view, derived from its timestamp so that it does not
+  //! depend on the order in which the views are solved
+  unsigned int ViewSeed(const ViewPnP& view_pnp) const;
+
+  //! Views queued by AddView and the worker threads solving them
+  struct ViewQueue;
+  std::unique_ptr<ViewQueue> view_queue_;
+
+  //! Refines the pose of one view with fixed intrinsics and board points
+  //! on a problem of its own and returns its reprojection error after the
+  //! refinement. Thread safe for different views
+  bool RefineViewPose(const theia::ViewId view_id,
+                      utils::ViewReprojectionError& view_error);
+
+  //! Refines one board point with fixed poses of the given views. Returns
+  //! the information matrix, residual count and squared error of the point
+  //! at the refined position. Thread safe for different points
+  bool RefineBoardPoint(const theia::TrackId track_id,
+                        const std::unordered_set<theia::ViewId>& view_ids,
+                        Eigen::Matrix3d& information,
+                        double& squared_error,
+                        int& num_residuals);
+
+  //! Board point refinement of SetAlternatingBoardRefinement, returns the
+  //! empirical covariances of the points like theia::BundleAdjustTracks
+  void AlternateBoardRefinement(
+      const std::vector<theia::TrackId>& track_ids,
+      std::map<theia::TrackId, Eigen::Matrix3d>& covariances,
+      double& variance_factor);
+
+  //! Sets the ransac threshold and adds the scene points
+  void InitializeFromScene(const nlohmann::json& scene_header,
+                           const theia::Camera& camera);
+
   //! Pose datasets
   theia::Reconstruction pose_dataset_;
 
@@ -68,6 +255,13 @@ class PoseEstimator {
   //! Ransac parameters for initial pose estimation
   theia::RansacParameters ransac_params_;
 
+  //! Views with a larger mean reprojection error are removed
+  double max_reproj_error_ = 0.0;
+
+  //! FilterBadPoses removes views with a mean reprojection error larger than
+  //! this factor times the median of all views
+  double max_reproj_error_factor_ = 5.0;
+
   //! Minimum number of inliers for pose estimation success
   size_t min_num_points_ = 8;
 
@@ -79,6 +273,39 @@ class PoseEstimator {
 
   //! PnP type
   theia::PnPType pnp_type_ = theia::PnPType::DLS;
+
+  //! Threads used for the per view PnP
+  int num_threads_ = 1;
+
+  //! Lookup table of the camera passed to InitializeFromScene
+  utils::UndistortionMap undistortion_map_;
+  double undistortion_map_cell_px_ = 0.0;
+
+  //! Base seed of the per view RANSAC random number generators
+  unsigned int ransac_seed_ = 42;
+
+  //! views passed to EstimateStreamViewPose, seeds their RANSAC
+  unsigned int num_stream_views_ = 0;
+
+  //! previous view of EstimateStreamViewPose for the pose tracking
+  ViewPnP previous_stream_view_;
+
+  //! SetPoseTracking
+  bool pose_tracking_ = false;
+  double max_tracking_gap_s_ = 0.1;
+  double min_tracking_inlier_ratio_ = 0.9;
+
+  //! OptimizeAllPoses solves one problem per view
+  bool independent_pose_refinement_ = false;
+
+  //! OptimizeBoardPoints alternates point and pose updates on a view subset
+  bool alternating_board_refinement_ = false;
+  int max_board_refinement_views_ = 200;
+  int board_refinement_rounds_ = 3;
+
+  //! Reprojection errors of the last independent pose refinement, consumed
+  //! by FilterBadPoses. Empty if the poses or points changed since
+  std::vector<utils::ViewReprojectionError> refined_view_errors_;
 };
 
 }  // namespace core
@@ -0,0 +1,58 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include "sophus/se3.hpp"
+
+#include "theia/sfm/camera/camera.h"
+#include "theia/sfm/reconstruction.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Which frames of the debug video are rendered and where they go
+struct ReprojectionVideoOptions {
+  int num_threads = 1;
+  //! render only every frame_step-th frame of the video
+  int frame_step = 1;
+  //! video time window in seconds, end_s <= 0 renders until the end
+  double start_s = 0.0;
+  double end_s = 0.0;
+  //! stop after this many rendered frames, 0 renders all
+  int max_frames = 0;
+  //! encode the rendered frames to this file. If empty, every frame is shown
+  //! in a window and the next one follows on a key press
+  std::string output_path;
+};
+
+//! Draws the corners of the calibration dataset, reprojected with the camera
+//! poses T_w_c of the same view, into the frames of the video together with
+//! the mean reprojection error of the frame. Frames are matched to the views
+//! by their timestamp, rounded to microseconds. Decoding stays on one
+//! thread, the frames are rendered on num_threads workers and written or
+//! shown in video order.
+bool RenderReprojectionVideo(
+    const std::string& input_video_path,
+    const theia::Reconstruction& calib_dataset,
+    const std::unordered_map<theia::ViewId, Sophus::SE3d>& T_w_c,
+    const theia::Camera& camera,
+    const ReprojectionVideoOptions& options);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,80 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Evaluations of the residual blocks of one kind during a solve
+struct ResidualTiming {
+  std::string name;
+  int64_t num_evaluations = 0;
+  //! evaluations that computed jacobians, included in num_evaluations
+  int64_t num_jacobian_evaluations = 0;
+  double residual_time_s = 0.0;
+  double jacobian_time_s = 0.0;
+};
+
+//! Accumulates the evaluations of all blocks of a kind. Ceres evaluates the
+//! blocks from several threads, so the counters are atomic.
+class ResidualTimer {
+ public:
+  explicit ResidualTimer(const std::string& name) : name_(name) {}
+
+  void Record(const bool jacobians, const int64_t time_ns);
+
+  void Reset();
+
+  ResidualTiming Timing() const;
+
+ private:
+  const std::string name_;
+  std::atomic<int64_t> num_residual_evaluations_{0};
+  std::atomic<int64_t> num_jacobian_evaluations_{0};
+  std::atomic<int64_t> residual_time_ns_{0};
+  std::atomic<int64_t> jacobian_time_ns_{0};
+};
+
+//! Forwards to the wrapped cost function and records every evaluation in
+//! timer. Does not own cost_function, it and the timer have to outlive the
+//! wrapper.
+class TimedCostFunction : public ceres::CostFunction {
+ public:
+  TimedCostFunction(const ceres::CostFunction* cost_function,
+                    ResidualTimer* timer);
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override;
+
+ private:
+  const ceres::CostFunction* const cost_function_;
+  ResidualTimer* const timer_;
+};
+
+//! prints one line per kind with evaluations, time and time per evaluation,
+//! most expensive kind first
+void ReportResidualTimings(std::vector<ResidualTiming> timings);
+
+}  // namespace core
+}  // namespace OpenICC
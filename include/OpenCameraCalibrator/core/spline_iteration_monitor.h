@@ -0,0 +1,85 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <deque>
+#include <functional>
+
+namespace OpenICC {
+namespace core {
+
+//! State of the spline optimization after a solver iteration
+struct SplineIterationSummary {
+  int iteration = 0;
+  double cost = 0.0;
+  double cost_change = 0.0;
+  double step_norm = 0.0;
+  bool step_is_successful = false;
+  //! mean reprojection error in pixels, negative if it was not computed
+  double reprojection_error = -1.0;
+  double cumulative_time_s = 0.0;
+};
+
+//! Return false to stop the optimization after this iteration
+using SplineIterationCallback =
+    std::function<bool(const SplineIterationSummary&)>;
+
+//! Early termination criteria of a spline solve, checked after every
+//! successful iteration. A criterion with a value of 0 is disabled.
+struct SplineConvergenceCriteria {
+  //! stop if the reprojection error improved by less than this fraction over
+  //! the last window successful iterations
+  double min_relative_reprojection_improvement = 0.0;
+  int window = 3;
+  //! stop once the reprojection error is below this many pixels
+  double target_reprojection_error = 0.0;
+
+  bool Enabled() const {
+    return min_relative_reprojection_improvement > 0.0 ||
+           target_reprojection_error > 0.0;
+  }
+};
+
+//! Forwards the solver iterations to a SplineIterationCallback and terminates
+//! the solve once the convergence criteria are met. The reprojection error is
+//! only evaluated if a callback or a criterion needs it. The solver has to
+//! update the parameter blocks every iteration for it to be current.
+class SplineIterationMonitor : public ceres::IterationCallback {
+ public:
+  SplineIterationMonitor(const SplineConvergenceCriteria& criteria,
+                         SplineIterationCallback callback,
+                         std::function<double()> reprojection_error);
+
+  bool Active() const { return criteria_.Enabled() || callback_ != nullptr; }
+
+  ceres::CallbackReturnType operator()(
+      const ceres::IterationSummary& summary) override;
+
+ private:
+  bool Converged(const double reprojection_error);
+
+  const SplineConvergenceCriteria criteria_;
+  const SplineIterationCallback callback_;
+  const std::function<double()> reprojection_error_;
+
+  //! reprojection errors of the last window + 1 successful iterations
+  std::deque<double> errors_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
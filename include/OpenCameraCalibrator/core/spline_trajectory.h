@@ -0,0 +1,135 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
+#include "OpenCameraCalibrator/io/spline_state.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sophus/se3.hpp"
+
+namespace OpenICC {
+namespace core {
+
+//! Read only trajectory of an optimized spline for pose queries at arbitrary
+//! times, e.g. for video stabilization or rolling shutter correction. The
+//! knot increments of the so3 segments and the polynomial coefficients of
+//! the r3 segments are computed once, a query only blends them. All queries
+//! are const and do not lock, so any number of threads can share one
+//! trajectory. Values equal the getters of SplineTrajectoryEstimator.
+template <int _N>
+class SplineTrajectory {
+ public:
+  static constexpr int N_ = _N;
+  static constexpr int DEG_ = _N - 1;
+
+  //! Builds the segment caches of a spline state, e.g. a checkpoint of
+  //! io::ReadSplineState. Returns false for another spline order or fewer
+  //! than N knots.
+  bool Initialize(const io::SplineState& state);
+
+  bool Initialize(const SplineTrajectoryEstimator<_N>& estimator);
+
+  //! Initialize from a file of io::WriteSplineState
+  bool Load(const std::string& spline_state_path);
+
+  //! Queries return false for times outside [GetMinTimeNs, GetMaxTimeNs]
+  int64_t GetMinTimeNs() const { return start_t_ns_; }
+  int64_t GetMaxTimeNs() const;
+
+  //! T_w_i at time_ns
+  bool GetPose(const int64_t time_ns, Sophus::SE3d& pose) const;
+
+  bool GetOrientation(const int64_t time_ns, Sophus::SO3d& orientation) const;
+
+  bool GetPosition(const int64_t time_ns, Eigen::Vector3d& position) const;
+
+  //! angular velocity in the body frame
+  bool GetAngularVelocity(const int64_t time_ns,
+                          Eigen::Vector3d& velocity) const;
+
+  //! velocity in the world frame
+  bool GetVelocity(const int64_t time_ns, Eigen::Vector3d& velocity) const;
+
+  //! specific force in the body frame, like the accelerometer measures it
+  bool GetAcceleration(const int64_t time_ns,
+                       Eigen::Vector3d& acceleration) const;
+
+  //! The TrajectorySampleFlags values at unsorted timestamps, split over
+  //! num_threads. The bias splines are not part of the trajectory,
+  //! SAMPLE_BIASES is ignored.
+  void Evaluate(const std::vector<int64_t>& times_ns,
+                const int flags,
+                TrajectorySamples& samples,
+                const int num_threads = 1) const;
+
+  const Sophus::SE3d& GetT_i_c() const { return T_i_c_; }
+  const Eigen::Vector3d& GetGravity() const { return gravity_; }
+  double GetCameraLineDelay() const { return cam_line_delay_s_; }
+  double GetImuToCameraTimeOffset() const {
+    return imu_to_camera_time_offset_s_;
+  }
+
+ private:
+  //! first knot of a so3 segment and the increments to the next knots
+  struct SO3Segment {
+    Sophus::SO3d start;
+    Eigen::Vector3d delta[DEG_];
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  //! r3 segment as a polynomial in u, row d multiplies u^d
+  using R3Segment = Eigen::Matrix<double, N_, 3>;
+
+  //! segment index and normalized time like the estimator's CalcTimes
+  bool Segment(const int64_t time_ns,
+               const int64_t dt_ns,
+               const size_t num_segments,
+               size_t& s,
+               double& u) const;
+
+  //! orientation and, if velocity is set, angular velocity of a segment
+  void EvaluateSO3(const SO3Segment& segment,
+                   const double u,
+                   Sophus::SO3d& orientation,
+                   Eigen::Vector3d* velocity) const;
+
+  //! derivative of the r3 polynomial, not scaled by the knot spacing
+  template <int Derivative>
+  static Eigen::Vector3d EvaluateR3(const R3Segment& segment, const double u);
+
+  int64_t start_t_ns_ = 0;
+  int64_t dt_so3_ns_ = 1;
+  int64_t dt_r3_ns_ = 1;
+  double inv_so3_dt_ = 1.0;
+  double inv_r3_dt_ = 1.0;
+
+  aligned_vector<SO3Segment> so3_segments_;
+  aligned_vector<R3Segment> r3_segments_;
+
+  Sophus::SE3d T_i_c_;
+  Eigen::Vector3d gravity_ = Eigen::Vector3d::Zero();
+  double cam_line_delay_s_ = 0.0;
+  double imu_to_camera_time_offset_s_ = 0.0;
+};
+
+}  // namespace core
+}  // namespace OpenICC
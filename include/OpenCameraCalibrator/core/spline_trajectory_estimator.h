@@ -3,13 +3,32 @@
 #include "ceres/ceres.h"
 #include "theia/sfm/reconstruction.h"
 
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
 #include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_fixed_size_residuals.h"
 #include "OpenCameraCalibrator/basalt_spline/ceres_local_param.h"
+#include "OpenCameraCalibrator/core/residual_timing.h"
+#include "OpenCameraCalibrator/core/spline_iteration_monitor.h"
+#include "OpenCameraCalibrator/io/chunked_file.h"
+#include "OpenCameraCalibrator/io/spline_state.h"
+#include "OpenCameraCalibrator/utils/banded_least_squares.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/object_arena.h"
+#include "OpenCameraCalibrator/utils/observation_store.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
-#include <thread>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 namespace OpenICC {
 namespace core {
@@ -26,8 +45,175 @@ enum SplineOptimFlags {
   GYR_BIAS = 1 << 8
 };
 
+//! How the reprojection errors of a view are split into residual blocks.
+//! VIEW_RESIDUALS: one dynamic autodiff block over all features of the view.
+//! FEATURE_RESIDUALS: one fixed-size autodiff block per feature.
+//! CHUNK_RESIDUALS: fixed-size blocks of CAMERA_RESIDUAL_CHUNK_SIZE
+//! features, the remaining features get one block each.
+enum CameraResidualLayout {
+  VIEW_RESIDUALS = 0,
+  FEATURE_RESIDUALS = 1,
+  CHUNK_RESIDUALS = 2
+};
+
+const int CAMERA_RESIDUAL_CHUNK_SIZE = 4;
+
+inline CameraResidualLayout StringToCameraResidualLayout(
+    const std::string& layout) {
+  if (layout == "feature") {
+    return CameraResidualLayout::FEATURE_RESIDUALS;
+  } else if (layout == "chunk") {
+    return CameraResidualLayout::CHUNK_RESIDUALS;
+  }
+  return CameraResidualLayout::VIEW_RESIDUALS;
+}
+
 const double GRAVITY_MAGN = 9.81;
 
+//! Linear solver setup of the spline optimization
+struct SplineSolverProfile {
+  std::string name = "sparse_normal_cholesky";
+  ceres::LinearSolverType linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  ceres::PreconditionerType preconditioner_type = ceres::CLUSTER_TRIDIAGONAL;
+  ceres::SparseLinearAlgebraLibraryType sparse_linear_algebra_library_type =
+      ceres::SUITE_SPARSE;
+  //! dense factorizations and the reduced system of dense_schur, CUDA runs
+  //! them on the GPU
+  ceres::DenseLinearAlgebraLibraryType dense_linear_algebra_library_type =
+      ceres::EIGEN;
+  //! order the elimination: points first, then bias knots, then pose knots
+  //! and the remaining parameters
+  bool use_elimination_ordering = false;
+};
+
+//! Profiles: "sparse_normal_cholesky", "ordered_normal_cholesky",
+//! "sparse_schur", "iterative_schur", "dense_normal_cholesky",
+//! "dense_schur". sparse_backend is a ceres sparse linear algebra library
+//! name, e.g. "SUITE_SPARSE" or "EIGEN_SPARSE".
+bool SplineSolverProfileFromString(const std::string& profile_name,
+                                   const std::string& sparse_backend,
+                                   SplineSolverProfile& profile);
+
+//! Sets the ceres dense linear algebra library of the profile, "EIGEN",
+//! "LAPACK" or "CUDA". False if the name is unknown or ceres was built
+//! without the library.
+bool SplineDenseBackendFromString(const std::string& dense_backend,
+                                  SplineSolverProfile& profile);
+
+//! Least squares fit of the spline knots to the vision poses, see
+//! SplineTrajectoryEstimator::FitKnotsToVisPoses
+struct KnotFitOptions {
+  //! Gauss-Newton iterations of the SO3 knots, the R3 fit is linear
+  int so3_iterations = 5;
+  //! standard deviation of the vision rotations in rad and positions in m
+  double vision_std_so3 = 1e-3;
+  double vision_std_r3 = 1e-3;
+  //! fit the angular velocity of every gyro_stride-th gyroscope sample
+  int gyro_stride = 1;
+  //! keeps knots without measurements at their interpolated value
+  double damping = 1.0;
+};
+
+//! Measurement kind of a residual block of the spline problem
+enum SplineResidualKind {
+  CAMERA_RESIDUAL = 0,
+  ACCELEROMETER_RESIDUAL = 1,
+  GYROSCOPE_RESIDUAL = 2,
+  IMU_RESIDUAL = 3,
+  IMU_PREINTEGRATION_RESIDUAL = 4,
+  NUM_SPLINE_RESIDUAL_KINDS = 5
+};
+
+inline std::string SplineResidualKindName(const SplineResidualKind kind) {
+  switch (kind) {
+    case CAMERA_RESIDUAL:
+      return "camera";
+    case ACCELEROMETER_RESIDUAL:
+      return "accelerometer";
+    case GYROSCOPE_RESIDUAL:
+      return "gyroscope";
+    case IMU_RESIDUAL:
+      return "imu";
+    case IMU_PREINTEGRATION_RESIDUAL:
+      return "imu_preintegration";
+    default:
+      return "unknown";
+  }
+}
+
+//! Outlier gating of the residual blocks, see
+//! SplineTrajectoryEstimator::GateOutliers
+struct OutlierGatingOptions {
+  //! a block is an outlier if its RMS residual is more than num_mads scaled
+  //! median absolute deviations above the median of its kind
+  double num_mads = 5.0;
+  //! camera blocks above this RMS reprojection error in pixels are outliers
+  //! as well, 0 disables it
+  double max_camera_rms_px = 0.0;
+  //! gate the IMU residuals as well as the camera residuals
+  bool gate_imu = true;
+};
+
+struct OutlierGatingSummary {
+  int num_evaluated = 0;
+  //! removed blocks per SplineResidualKind
+  std::array<int, NUM_SPLINE_RESIDUAL_KINDS> num_removed{};
+};
+
+//! Reprojection errors of all views, computed in one pass
+struct ReprojectionErrorStatistics {
+  //! mean error over all observations
+  double mean_error = 0.0;
+  int num_points = 0;
+  //! mean error of every evaluated view
+  std::unordered_map<theia::ViewId, double> view_errors;
+  //! number of views per error bin, the last bin holds all larger errors
+  std::vector<int> histogram;
+  double histogram_bin_width = 0.0;
+};
+
+//! Values requested from SplineTrajectoryEstimator::EvaluateTrajectory
+enum TrajectorySampleFlags {
+  SAMPLE_POSE = 1 << 0,
+  SAMPLE_ANGULAR_VELOCITY = 1 << 1,
+  SAMPLE_ACCELERATION = 1 << 2,
+  //! gyroscope and accelerometer bias splines
+  SAMPLE_BIASES = 1 << 3
+};
+
+//! Spline values at a list of timestamps. Row i belongs to timestamp i and
+//! the matrices are column major, so each component is contiguous. Only the
+//! requested values are filled, invalid samples keep identity and zero rows.
+struct TrajectorySamples {
+  //! 1 if the timestamp lies inside the spline
+  std::vector<char> valid;
+  //! R_w_i as quaternion x, y, z, w
+  Eigen::Matrix<double, Eigen::Dynamic, 4> rotation;
+  //! p_w_i
+  Eigen::Matrix<double, Eigen::Dynamic, 3> position;
+  //! angular velocity in the body frame
+  Eigen::Matrix<double, Eigen::Dynamic, 3> angular_velocity;
+  //! specific force in the body frame, like GetAcceleration
+  Eigen::Matrix<double, Eigen::Dynamic, 3> acceleration;
+  Eigen::Matrix<double, Eigen::Dynamic, 3> gyro_bias;
+  Eigen::Matrix<double, Eigen::Dynamic, 3> accl_bias;
+
+  Sophus::SE3d Pose(const size_t i) const {
+    return Sophus::SE3d(Eigen::Quaterniond(rotation.row(i).transpose()),
+                        position.row(i).transpose());
+  }
+};
+
+//! Magic of the chunked files of SplineTrajectoryEstimator::ExportTrajectory
+extern const char kTrajectoryMagic[8];
+
+//! Appends the columns of the samples selected by flags to raw, see
+//! SplineTrajectoryEstimator::ExportTrajectory
+void PackTrajectoryChunk(const std::vector<int64_t>& times_ns,
+                         const TrajectorySamples& samples,
+                         const int flags,
+                         std::vector<char>& raw);
+
 template <int _N>
 class SplineTrajectoryEstimator {
  public:
@@ -47,6 +233,9 @@ class SplineTrajectoryEstimator {
 
   void InitSpline(const int flags, const double end_time_s = 0.0);
 
+  //! A knot spacing <= 0 makes the bias of that sensor constant over the
+  //! recording. It is then a single 3-vector knot, which the IMU residuals
+  //! read directly instead of blending BIAS_SPLINE_N knots.
   void InitBiasSplines(const Eigen::Vector3d& accl_init_bias,
                        const Eigen::Vector3d& gyr_init_bias,
                        int64_t dt_accl_bias_ns = 500000000,
@@ -56,18 +245,117 @@ class SplineTrajectoryEstimator {
 
   void BatchInitSO3R3VisPoses();
 
+  //! Least squares fit of the knots to the IMU poses of the image data,
+  //! starting from BatchInitSO3R3VisPoses. The R3 knots are solved linearly,
+  //! the SO3 knots by Gauss-Newton. If gyroscope samples are passed, the
+  //! rotation between the frames follows their angular velocity, corrected
+  //! with the current IMU intrinsics and gyroscope bias spline. Both normal
+  //! equations are banded and solved in linear time. Returns false if no
+  //! vision pose lies inside the spline.
+  bool FitKnotsToVisPoses(const KnotFitOptions& options,
+                          const std::vector<int64_t>& gyro_times_ns = {},
+                          const vec3_vector& gyro_measurements = {},
+                          const double gyro_std = 1.0);
+
   void InitScenePoints();
 
+  //! Optimizes the SplineOptimFlags groups in flags and keeps all other
+  //! groups constant
   void SetFixedParams(const int flags);
 
+  //! Sets all parameter blocks of the SplineOptimFlags groups constant or
+  //! variable. IMU_BIASES selects both bias splines.
+  void SetParameterGroupsConstant(const int groups, const bool constant);
+
+  //! Gauss-Newton system J^T J, J^T r and the cost of all residual blocks
+  //! in the calibration parameters of the groups T_I_C, CAM_LINE_DELAY and
+  //! IMU_INTRINSICS, everything else held at its current value. The tangent
+  //! space layout is T_i_c and line delay of every camera, then the
+  //! accelerometer and gyroscope intrinsics, the same for all estimators
+  //! with the same cameras. Blocks outside of the problem have zero rows.
+  bool CalibrationNormalEquations(const int groups,
+                                  Eigen::MatrixXd& JtJ,
+                                  Eigen::VectorXd& Jtr,
+                                  double& cost);
+
+  //! Marginal covariance of the calibration parameters of the groups in the
+  //! layout of CalibrationNormalEquations. The variable blocks of
+  //! eliminated_groups are eliminated by a sparse Schur complement, all
+  //! other blocks are held at their current value. Blocks outside of the
+  //! problem have zero rows. False if the parameters are not observable.
+  bool CalibrationCovariance(const int groups,
+                             const int eliminated_groups,
+                             Eigen::MatrixXd& covariance);
+
+  //! Moves the calibration parameters of the groups by dx, in the layout of
+  //! CalibrationNormalEquations
+  void ApplyCalibrationStep(const int groups, const Eigen::VectorXd& dx);
+
+  //! cost of all residual blocks at the current parameters
+  double EvaluateCost();
+
+  //! Copies T_i_c and the line delay of every camera and the IMU
+  //! intrinsics. A zero line delay marks a global shutter, on either side
+  //! it is kept.
+  void CopyCalibrationFrom(const SplineTrajectoryEstimator& other);
+
   ceres::Solver::Summary Optimize(const int max_iters, const int flags);
 
-  // keep the rest constant and only optimize a window
+  // keep the rest constant and only optimize a window. Knots before the
+  // window are removed from the problem together with their residuals, so
+  // the problem stays bounded if measurements are added as the window
+  // advances (fixed-lag smoothing).
   ceres::Solver::Summary Optimize(const int max_iters,
                                   const int flags,
                                   const int64_t start_time,
                                   const int64_t end_time);
 
+  //! Evaluates all residual blocks of the problem on all threads and removes
+  //! the outliers of every SplineResidualKind. Removal is cheap since the
+  //! problem is built with fast removal. Knots and points stay in the
+  //! problem, measurements added later are not gated.
+  OutlierGatingSummary GateOutliers(const OutlierGatingOptions& options);
+
+  //! Remove all spline knots and measurements from the problem. The knot
+  //! values are kept.
+  void ClearMeasurements();
+
+  //! Change the knot spacing and initialize the new knots from the current
+  //! spline. All measurements are removed and have to be added again.
+  void ResampleKnots(const int64_t dt_so3_ns, const int64_t dt_r3_ns);
+
+  //! Appends knots until the trajectory and bias splines reach end_time_ns,
+  //! e.g. while the measurements of a live recording arrive. The new
+  //! trajectory knots start at pose, the new bias knots at the last bias
+  //! knot. The knot arrays move, so all measurements are removed and have
+  //! to be added again.
+  void ExtendKnots(const int64_t end_time_ns, const Sophus::SE3d& pose);
+
+  //! Copies the splines, calibration parameters and residual options of
+  //! other. The problem stays empty, so parts of the spline can be solved
+  //! on their own.
+  void CopyStateFrom(const SplineTrajectoryEstimator& other);
+
+  //! Knots of the trajectory and bias splines and the calibration
+  //! parameters, to checkpoint the optimization with io::WriteSplineState
+  void GetState(io::SplineState& state) const;
+
+  //! Restores GetState. The state needs the knot layout of this estimator,
+  //! i.e. the same SetTimes and InitBiasSplines. Knots that are part of the
+  //! problem keep their parameter blocks.
+  bool SetState(const io::SplineState& state);
+
+  //! Only takes T_i_c, the line delay and the IMU intrinsics of state, e.g.
+  //! to start the calibration of another recording of the same rig
+  void SetCalibrationFromState(const io::SplineState& state);
+
+  //! Copies the so3 and r3 knots of other with a knot time
+  //! start + i * dt in [start_time_ns, end_time_ns). Both estimators need
+  //! the same start time and knot spacing.
+  void CopyKnotsFrom(const SplineTrajectoryEstimator& other,
+                     const int64_t start_time_ns,
+                     const int64_t end_time_ns);
+
   bool AddGPSMeasurement(const Eigen::Vector3d& meas,
                          const int64_t time_ns,
                          const double weight_gps);
@@ -80,17 +368,77 @@ class SplineTrajectoryEstimator {
                                const int64_t time_ns,
                                const double weight_se3);
 
+  //! Add many samples with sorted timestamps at once. Consecutive samples
+  //! that depend on the same spline knots share one residual block.
+  bool AddAccelerometerMeasurements(const vec3_vector& meas,
+                                    const std::vector<int64_t>& times_ns,
+                                    const double weight_se3);
+
+  bool AddGyroscopeMeasurements(const vec3_vector& meas,
+                                const std::vector<int64_t>& times_ns,
+                                const double weight_so3);
+
+  //! Gyroscope and accelerometer sample of the same time as one 6-D
+  //! residual, the so3 spline is evaluated once for both
+  bool AddImuMeasurement(const Eigen::Vector3d& accl_meas,
+                         const Eigen::Vector3d& gyro_meas,
+                         const int64_t time_ns,
+                         const double weight_so3,
+                         const double weight_se3);
+
+  //! Batched AddImuMeasurement, consecutive samples that depend on the same
+  //! spline knots share one residual block
+  bool AddImuMeasurements(const vec3_vector& accl_meas,
+                          const vec3_vector& gyro_meas,
+                          const std::vector<int64_t>& times_ns,
+                          const double weight_so3,
+                          const double weight_se3);
+
+  //! Preintegrate the samples between consecutive spline knot changes and add
+  //! one rotation and velocity factor per interval instead of one residual
+  //! per sample. The IMU intrinsics are kept fixed at their current values.
+  bool AddImuPreintegrationMeasurements(const vec3_vector& accl_meas,
+                                        const vec3_vector& gyro_meas,
+                                        const std::vector<int64_t>& times_ns,
+                                        const double weight_so3,
+                                        const double weight_se3);
+
   bool AddGSCameraMeasurement(const theia::View* view,
                               const double robust_loss_width);
   bool AddRSCameraMeasurement(const theia::View* view,
                               const double robust_loss_width = 0.0);
+  //! Add the views as global or rolling shutter measurements. Cost
+  //! functions are built on all threads and then added to the problem.
+  //! The views belong to the reconstruction of camera, see AddRigCamera.
+  bool AddCameraMeasurements(const std::vector<const theia::View*>& views,
+                             const bool rolling_shutter,
+                             const double robust_loss_width = 0.0,
+                             const int camera = 0);
+
+  //! Adds a camera of a rig. It shares the spline, the IMU residuals and the
+  //! gravity with the other cameras but has its own reconstruction, T_i_c
+  //! and line delay. Its view timestamps are shifted by time_offset_s onto
+  //! the time of camera 0, the camera of SetImageData. Returns the index of
+  //! the camera.
+  int AddRigCamera(std::shared_ptr<theia::Reconstruction> image_data,
+                   const Sophus::SE3d& T_i_c,
+                   const double line_delay_s,
+                   const double time_offset_s);
+
+  //! camera 0 and the rig cameras
+  int GetNumCameras() const { return 1 + rig_cameras_.size(); }
+
   bool AddGSInvCameraMeasurement(const theia::View* view,
                                  const double robust_loss_width);
   bool AddRSInvCameraMeasurement(const theia::View* view,
                                  const double robust_loss_width);
 
   // setter
+  //! Copies the reconstruction
   void SetImageData(const theia::Reconstruction& c);
+  //! Shares the reconstruction with the caller. Optimized points are written
+  //! back into it.
+  void SetImageData(std::shared_ptr<theia::Reconstruction> image_data);
 
   void SetGravity(const Eigen::Vector3d& g);
 
@@ -106,6 +454,70 @@ class SplineTrajectoryEstimator {
       const ThreeAxisSensorCalibParams<double>& accl_intrinsics,
       const ThreeAxisSensorCalibParams<double>& gyro_intrinsics);
 
+  //! Use closed-form Jacobians for gyroscope and accelerometer residuals
+  //! instead of autodiff. Only affects measurements added afterwards.
+  void SetUseAnalyticImuJacobians(const bool use_analytic_jacobians);
+
+  //! Computes the spline knot Jacobians of the analytic imu residuals in
+  //! float. Residuals stay double and ceres accumulates in double.
+  void SetUseFloatImuJacobians(const bool use_float_jacobians);
+
+  //! Computes the rotation knot differences once per solver evaluation for
+  //! all analytic imu residuals instead of once per residual. Registers an
+  //! evaluation callback, which excludes inner iterations. Has to be called
+  //! before the first measurement is added.
+  void SetShareKnotEvaluations(const bool share_knot_evaluations);
+
+  //! Camera residuals added afterwards share one Huber loss instead of the
+  //! robust_loss_width of their measurement. Its width can be changed
+  //! between solves without rebuilding the problem, 0 removes the loss.
+  void SetCameraLossWidth(const double width);
+
+  //! Bake the board points into the camera residuals as constants instead
+  //! of adding them as parameter blocks. Every view residual then only
+  //! depends on its spline knots, T_i_c and the line delay, the POINTS flag
+  //! has no effect. Only affects views added afterwards.
+  void SetRigidBoard(const bool rigid_board);
+
+  //! Only estimate the rotation of the trajectory and of T_i_c. The R3 knots
+  //! and the translation of T_i_c keep their initial values, e.g. from the
+  //! vision poses, which leaves the SO3 knots, the line delay and the
+  //! rotation of T_i_c to the camera and gyroscope residuals. Only affects
+  //! cameras added afterwards.
+  void SetRotationOnly(const bool rotation_only);
+
+  //! Residual blocks the reprojection errors of a view are split into. The
+  //! fixed-size layouts let ceres use stack allocated Jets and keep the
+  //! Jacobians of different features apart. Only affects views added
+  //! afterwards.
+  void SetCameraResidualLayout(const CameraResidualLayout layout);
+
+  //! Evaluate the spline once per rolling shutter view at the center row
+  //! and shift the features to their rows with constant velocities instead
+  //! of evaluating it per feature. The reprojection error statistics always
+  //! use the exact model. Only affects views added afterwards.
+  void SetLinearizeRollingShutter(const bool linearize_rolling_shutter);
+
+  //! Number of threads used to build residuals and to solve
+  void SetNumThreads(const int num_threads);
+
+  //! Linear solver and ordering used by Optimize
+  void SetSolverProfile(const SplineSolverProfile& profile);
+
+  //! Called after every solver iteration of Optimize
+  void SetIterationCallback(SplineIterationCallback callback);
+
+  //! Criteria for Optimize to stop before the iteration budget is used up
+  void SetConvergenceCriteria(const SplineConvergenceCriteria& criteria);
+
+  //! Record evaluation count and time of the residual blocks added
+  //! afterwards per kind, camera residuals split by shutter model. Every
+  //! Optimize prints the breakdown. Costs two clock reads per evaluation.
+  void SetProfileResiduals(const bool profile_residuals);
+
+  //! residual evaluations of the last Optimize, empty without profiling
+  std::vector<ResidualTiming> GetResidualTimings() const;
+
   // getter
   Sophus::SE3d GetKnot(int i) const;
 
@@ -119,26 +531,79 @@ class SplineTrajectoryEstimator {
 
   bool GetAcceleration(const int64_t& time_ns, Eigen::Vector3d& acceleration);
 
+  //! Evaluates the TrajectorySampleFlags values at sorted timestamps. Walks
+  //! the knot segments and shares the segment setup between all timestamps
+  //! in it, long ranges are split over the estimator's threads.
+  bool EvaluateTrajectory(const std::vector<int64_t>& times_ns,
+                          const int flags,
+                          TrajectorySamples& samples) const;
+
+  //! Writes the TrajectorySampleFlags values at sorted timestamps to a
+  //! chunked file (see io::ChunkedFileWriter) with the magic kTrajectoryMagic
+  //! and the uint32 flags as meta data. Each chunk holds samples_per_chunk
+  //! samples as columns, the unrequested ones are left out:
+  //! int64 t_ns[n] | uint8 valid[n] | float64 rotation[4][n] (qx, qy, qz,
+  //! qw) | float64 position[3][n] | float64 angular_velocity[3][n] |
+  //! float64 acceleration[3][n] | float64 gyro_bias[3][n] |
+  //! float64 accl_bias[3][n]
+  //! The samples of a chunk are evaluated in parallel, so memory stays at
+  //! one chunk for any length of the trajectory.
+  bool ExportTrajectory(const std::string& path,
+                        const std::vector<int64_t>& times_ns,
+                        const int flags,
+                        const io::ChunkCodec codec = io::ChunkCodec::kNone,
+                        const size_t samples_per_chunk = 1 << 16) const;
+
   size_t GetNumSO3Knots() const;
 
   size_t GetNumR3Knots() const;
 
+  int GetNumResidualBlocks() const;
+
+  int GetNumThreads() const { return num_threads_; }
+
   int64_t GetMaxTimeNs() const;
 
   int64_t GetMinTimeNs() const;
 
-  Eigen::Vector3d GetGyroBias(const int64_t& time_ns);
+  Eigen::Vector3d GetGyroBias(const int64_t& time_ns) const;
 
-  Eigen::Vector3d GetAcclBias(const int64_t& time_ns);
+  Eigen::Vector3d GetAcclBias(const int64_t& time_ns) const;
 
   double GetMeanReprojectionError();
 
+  ReprojectionErrorStatistics GetReprojectionErrorStatistics(
+      const double histogram_bin_width = 0.5,
+      const int num_histogram_bins = 20,
+      const int camera = 0);
+
+  //! Mean reprojection error of every view_stride-th view of camera for
+  //! each of the rolling shutter line delays, with the spline, T_i_c and the
+  //! points as they are. All candidates are evaluated on the estimator
+  //! threads. Candidates without a valid view get the largest double
+  std::vector<double> EvaluateLineDelays(
+      const std::vector<double>& line_delays_s,
+      const int view_stride = 1,
+      const int camera = 0);
+
+  //! Mean distance between the spline angular velocity and the unbiased
+  //! gyroscope samples for each time offset added to the sample timestamps
+  std::vector<double> EvaluateGyroTimeOffsets(
+      const std::vector<double>& time_offsets_s,
+      const std::vector<double>& timestamps_s,
+      const vec3_vector& gyro_measurements,
+      const ThreeAxisSensorCalibParams<double>& gyro_intrinsics);
+
   Eigen::Vector3d GetGravity() const;
 
   Sophus::SE3d GetT_i_c() const;
 
   double GetRSLineDelay() const;
 
+  //! T_i_c and line delay of a camera of the rig
+  Sophus::SE3d GetCameraT_i_c(const int camera) const;
+  double GetCameraLineDelay(const int camera) const;
+
   ThreeAxisSensorCalibParams<double> GetAcclIntrinsics(const int64_t& time_ns);
 
   ThreeAxisSensorCalibParams<double> GetGyroIntrinsics(const int64_t& time_ns);
@@ -148,14 +613,256 @@ class SplineTrajectoryEstimator {
   void ConvertInvDepthPointsToHom();
 
  private:
-  bool CalcSO3Times(const int64_t sensor_time, double& u_so3, int64_t& s_so3);
-  bool CalcR3Times(const int64_t sensor_time, double& u_r3, int64_t& s_r3);
+  //! normalized spline times and first knot indices of a measurement
+  struct SampleTimes {
+    double u_so3 = 0.0;
+    double u_r3 = 0.0;
+    double u_bias = 0.0;
+    int64_t s_so3 = 0;
+    int64_t s_r3 = 0;
+    int64_t s_bias = 0;
+  };
+
+  ceres::Problem::Options ProblemOptions() const;
+  ceres::Solver::Options SolverOptions(const int max_iters);
+
+  //! points, bias knots, rest. Covers all parameter blocks of the problem.
+  std::shared_ptr<ceres::ParameterBlockOrdering> EliminationOrdering();
+
+  //! prints the timing of a solve with the current solver profile
+  void ReportSolverTiming(const ceres::Solver::Summary& summary) const;
+
+  //! Monitor of the iteration callback and convergence criteria, registered
+  //! in options if either is set
+  std::unique_ptr<SplineIterationMonitor> AddIterationMonitor(
+      ceres::Solver::Options& options);
+
+  //! removes knots before s_start and fixes the knots shared with removed
+  //! residuals and the ones after s_end
+  template <class KnotVector>
+  void WindowKnots(KnotVector& knots,
+                   std::vector<bool>& in_problem,
+                   const int64_t s_start,
+                   const int64_t s_end);
+
+  //! knot times of a view captured at timestamp_s by camera
+  bool CalcCameraTimes(const double timestamp_s,
+                       SampleTimes& times,
+                       const int camera = 0);
+  bool CalcAccelerometerTimes(const int64_t time_ns, SampleTimes& times);
+  bool CalcGyroscopeTimes(const int64_t time_ns, SampleTimes& times);
+
+  //! parameter blocks of the knots and points. A block gets its local
+  //! parameterization and bounds once, when it enters the problem.
+  double* SO3KnotBlock(const int64_t i);
+  double* R3KnotBlock(const int64_t i);
+  double* AcclBiasBlock(const int64_t i);
+  double* GyroBiasBlock(const int64_t i);
+  double* PointBlock(const theia::TrackId track_id, const int camera = 0);
+
+  //! parameter blocks of an imu residual, marks the knots as used
+  std::vector<double*> AccelerometerParameters(const SampleTimes& times);
+  std::vector<double*> GyroscopeParameters(const SampleTimes& times);
+  std::vector<double*> ImuPreintegrationParameters(
+      const SampleTimes& accl_times, const SampleTimes& gyro_times);
+  std::vector<double*> ImuParameters(const SampleTimes& accl_times,
+                                     const SampleTimes& gyro_times);
+
+  //! adds the residual block to the problem and to residual_kinds_. With
+  //! profiling the evaluations are recorded under timer_name, which
+  //! defaults to the name of the kind.
+  ceres::ResidualBlockId AddResidualBlock(
+      const SplineResidualKind kind,
+      ceres::CostFunction* cost_function,
+      ceres::LossFunction* loss_function,
+      const std::vector<double*>& parameter_blocks,
+      const std::string& timer_name = "");
+
+  //! clears the timers before a solve
+  void ResetResidualTimers();
+
+  //! splits the valid samples into ranges [first, last) of consecutive
+  //! samples for which same_group(first, i) holds
+  template <class SameGroup>
+  static std::vector<std::pair<size_t, size_t>> GroupSamples(
+      const std::vector<char>& valid, SameGroup&& same_group);
+  //! a calibration parameter block, Euclidean without parameterization
+  struct CalibrationBlock {
+    double* block;
+    int tangent_size;
+    ceres::LocalParameterization* parameterization;
+  };
+  std::vector<CalibrationBlock> CalibrationBlocks(const int groups);
+
+  //! parameter blocks of the SplineOptimFlags groups that are part of the
+  //! problem
+  std::vector<double*> ParameterGroupBlocks(const int groups);
+
+  //! a camera of the rig besides camera 0. Owned through a pointer, its
+  //! T_i_c and line delay are parameter blocks.
+  struct RigCamera {
+    std::shared_ptr<theia::Reconstruction> image_data;
+    Sophus::SE3d T_i_c;
+    double line_delay_s = 0.0;
+    double time_offset_s = 0.0;
+    std::set<theia::TrackId> tracks_in_problem;
+    utils::ObservationStore observations;
+  };
+
+  //! data and parameter blocks of a camera, camera 0 uses the members
+  struct CameraBlocks {
+    theia::Reconstruction* image_data;
+    double* T_i_c;
+    double* line_delay_s;
+    double time_offset_s;
+    std::set<theia::TrackId>* tracks_in_problem;
+    const utils::ObservationStore* observations;
+  };
+  CameraBlocks Camera(const int camera);
+
+  //! adds the reprojection errors and the number of valid points of view v
+  //! of camera to the sums. A null line_delay_s evaluates the view as global
+  //! shutter. False if the view is outside of the spline or has an
+  //! unsupported camera model
+  bool ViewReprojectionError(const int camera,
+                             const size_t v,
+                             const double* line_delay_s,
+                             double& sum_error,
+                             int& num_points);
+
+  //! reprojection cost function of some features of a view
+  struct CameraResidual {
+    ceres::CostFunction* cost_function = nullptr;
+    std::vector<theia::TrackId> track_ids;
+  };
+
+  //! parameter blocks of a reprojection residual, marks knots and tracks as
+  //! used
+  std::vector<double*> CameraParameters(
+      const SampleTimes& times,
+      const bool rolling_shutter,
+      const std::vector<theia::TrackId>& track_ids,
+      const int camera = 0);
+
+  //! reprojection residuals of view view_index of the store in the current
+  //! layout, empty if the camera model is not supported. Only reads the
+  //! estimator, so it can be called concurrently.
+  std::vector<CameraResidual> CreateCameraResiduals(
+      const utils::ObservationStore& store,
+      const size_t view_index,
+      const SampleTimes& times,
+      const bool rolling_shutter);
+
+  //! dynamic reprojection cost function of the observations first, ...,
+  //! first + num - 1 of the store, they belong to view view_index
+  ceres::CostFunction* CreateCameraCostFunction(
+      const utils::ObservationStore& store,
+      const size_t view_index,
+      const size_t first,
+      const size_t num,
+      const SampleTimes& times,
+      const bool rolling_shutter);
+
+  //! fixed-size reprojection cost function of NUM_FEATURES observations
+  template <int NUM_FEATURES>
+  ceres::CostFunction* CreateFixedSizeCameraCostFunction(
+      const utils::ObservationStore& store,
+      const size_t view_index,
+      const size_t first,
+      const SampleTimes& times,
+      const bool rolling_shutter);
+
+  //! Huber loss of the width, shared by all residuals using it. A width of
+  //! 0 gives no loss, it would remove the residual from the cost.
+  ceres::LossFunction* HuberLoss(const double width);
+
+  //! adds the residuals of a view to the problem
+  void AddCameraResiduals(const std::vector<CameraResidual>& residuals,
+                          const SampleTimes& times,
+                          const bool rolling_shutter,
+                          const double robust_loss_width,
+                          const int camera = 0);
+
+  //! analytic cost function of the samples [first, last), a batch if there
+  //! is more than one
+  template <typename JacScalar>
+  ceres::CostFunction* CreateAnalyticAccelerometerCostFunction(
+      const vec3_vector& meas,
+      const std::vector<SampleTimes>& times,
+      const size_t first,
+      const size_t last,
+      const double weight_se3) const;
+  template <typename JacScalar>
+  ceres::CostFunction* CreateAnalyticGyroscopeCostFunction(
+      const vec3_vector& meas,
+      const std::vector<SampleTimes>& times,
+      const size_t first,
+      const size_t last,
+      const double weight_so3) const;
+
+  template <typename JacScalar>
+  ceres::CostFunction* CreateAnalyticImuCostFunction(
+      const vec3_vector& accl_meas,
+      const vec3_vector& gyro_meas,
+      const std::vector<SampleTimes>& accl_times,
+      const std::vector<SampleTimes>& gyro_times,
+      const size_t first,
+      const size_t last,
+      const double weight_so3,
+      const double weight_se3) const;
+
+  //! fused imu cost function of the samples [first, last) with the analytic
+  //! or autodiff Jacobians
+  ceres::CostFunction* CreateImuCostFunction(
+      const vec3_vector& accl_meas,
+      const vec3_vector& gyro_meas,
+      const std::vector<SampleTimes>& accl_times,
+      const std::vector<SampleTimes>& gyro_times,
+      const size_t first,
+      const size_t last,
+      const double weight_so3,
+      const double weight_se3);
+
+  template <class FunctorT>
+  ceres::CostFunction* CreateAccelerometerAutoDiffCostFunction(
+      FunctorT* functor, const int num_samples);
+  template <class FunctorT>
+  ceres::CostFunction* CreateGyroscopeAutoDiffCostFunction(
+      FunctorT* functor, const int num_samples);
+  template <class FunctorT>
+  ceres::CostFunction* CreateImuAutoDiffCostFunction(FunctorT* functor,
+                                                     const int num_samples);
+
+  //! samples [first, last) of EvaluateTrajectory, they all lie in the so3
+  //! segment s_so3 and the r3 segment s_r3
+  void EvaluateTrajectorySegment(const std::vector<int64_t>& times_ns,
+                                 const size_t first,
+                                 const size_t last,
+                                 const int64_t s_so3,
+                                 const int64_t s_r3,
+                                 const int flags,
+                                 TrajectorySamples& samples) const;
+
+  bool CalcSO3Times(const int64_t sensor_time,
+                    double& u_so3,
+                    int64_t& s_so3) const;
+  bool CalcR3Times(const int64_t sensor_time,
+                   double& u_r3,
+                   int64_t& s_r3) const;
   bool CalcTimes(const int64_t sensor_time,
                  double& u,
                  int64_t& s,
                  int64_t dt_ns,
                  size_t nr_knots,
-                 const int N = N_);
+                 const int N = N_) const;
+  //! CalcTimes of a bias spline, u = 0 and s = 0 for the single knot of a
+  //! constant bias
+  bool CalcBiasTimes(const int64_t sensor_time,
+                     double& u,
+                     int64_t& s,
+                     int64_t dt_ns,
+                     size_t nr_knots,
+                     const bool constant_bias) const;
 
   int64_t start_t_ns_;
   int64_t end_t_ns_;
@@ -189,14 +896,45 @@ class SplineTrajectoryEstimator {
   vec3_vector gyro_bias_spline_;
   vec3_vector accl_bias_spline_;
 
+  std::vector<bool> gyro_bias_in_problem_;
+  std::vector<bool> accl_bias_in_problem_;
+
   double max_accl_bias_range_ = 1.0;
   double max_gyro_bias_range_ = 1e-2;
 
+  //! one estimated bias for the whole recording, see InitBiasSplines
+  bool constant_accl_bias_ = false;
+  bool constant_gyro_bias_ = false;
+
   //! parameters
   int optim_flags_;
 
   bool fix_imu_intrinsics_ = false;
 
+  bool use_analytic_imu_jacobians_ = false;
+
+  bool float_imu_jacobians_ = false;
+
+  bool linearize_rolling_shutter_ = false;
+
+  bool rigid_board_ = false;
+
+  bool rotation_only_ = false;
+
+  CameraResidualLayout camera_residual_layout_ =
+      CameraResidualLayout::VIEW_RESIDUALS;
+
+  int num_threads_ = utils::Executor::Global().MaxConcurrency();
+
+  SplineSolverProfile solver_profile_;
+
+  SplineIterationCallback iteration_callback_;
+  SplineConvergenceCriteria convergence_criteria_;
+
+  bool profile_residuals_ = false;
+  //! shared by the timed cost functions of a kind, outlive the problem
+  std::map<std::string, std::unique_ptr<ResidualTimer>> residual_timers_;
+
   double cam_line_delay_s_ = 0.0;
 
   double imu_to_camera_time_offset_s_ = 0.0;
@@ -208,35 +946,86 @@ class SplineTrajectoryEstimator {
   Eigen::Matrix<double, 6, 1> accl_intrinsics_;
   Eigen::Matrix<double, 9, 1> gyro_intrinsics_;
 
-  theia::Reconstruction image_data_;
+  std::shared_ptr<theia::Reconstruction> image_data_ =
+      std::make_shared<theia::Reconstruction>();
+  //! observations of image_data_ in contiguous arrays
+  utils::ObservationStore observations_;
 
   Sophus::SE3<double> T_i_c_;
 
+  //! cameras 1, 2, ... of the rig
+  std::vector<std::unique_ptr<RigCamera>> rig_cameras_;
+
+  //! shared by all blocks of a kind, the problem does not own them
+  std::unique_ptr<ceres::LocalParameterization> so3_parameterization_{
+      new LieLocalParameterization<Sophus::SO3d>()};
+  std::unique_ptr<ceres::LocalParameterization> se3_parameterization_{
+      new LieLocalParameterization<Sophus::SE3d>()};
+  std::unique_ptr<ceres::LocalParameterization> se3_rotation_parameterization_{
+      new SE3RotationLocalParameterization()};
+  std::unique_ptr<ceres::LocalParameterization> point_parameterization_{
+      new ceres::HomogeneousVectorParameterization(4)};
+
+  //! functors and cost functions of all residual blocks, the problem does
+  //! not own them. Freed in bulk by ClearMeasurements.
+  mutable utils::ObjectArena cost_function_arena_;
+  //! robust losses by width, the problem does not own them
+  std::map<double, std::unique_ptr<ceres::LossFunction>> huber_losses_;
+  //! shared Huber loss of the camera residuals, see SetCameraLossWidth
+  std::unique_ptr<ceres::LossFunctionWrapper> camera_loss_;
+  double camera_loss_width_ = 0.0;
+
+  //! evaluation callback of problem_ if the knot evaluations are shared
+  std::unique_ptr<So3KnotDeltaCache> so3_knot_cache_;
+
   ceres::Problem problem_;
 
+  //! kind of the residual blocks, blocks that left the problem with their
+  //! knots are dropped by GateOutliers
+  std::unordered_map<ceres::ResidualBlockId, SplineResidualKind>
+      residual_kinds_;
+
   bool spline_initialized_with_gps_ = false;
 };
 
-inline bool KnotInBlock(const std::vector<double*> vec, double* knot_ptr) {
-  for (const auto& v : vec) {
-    if (knot_ptr == v) {
-      return true;
+//! Parameter blocks of a residual with a hash index from block pointer to
+//! its offset, so assembling blocks with shared knots stays linear.
+class ParameterBlockIndex {
+ public:
+  //! Appends the block if it is not part of the index yet. Returns its offset.
+  int Add(double* block) {
+    const auto it = offsets_.emplace(block, static_cast<int>(blocks_.size()));
+    if (it.second) {
+      blocks_.push_back(block);
     }
+    return it.first->second;
   }
-  return false;
-}
 
-inline int GetPtrOffset(const double* knot_ptr,
-                        const std::vector<double*>& container) {
-  for (size_t i = 0; i < container.size(); ++i) {
-    if (knot_ptr == container[i]) {
-      return i;
-    }
+  bool Contains(const double* block) const {
+    return offsets_.find(block) != offsets_.end();
   }
-  // this should not happen!
-  return 0;
-}
+
+  //! Returns -1 if the block is not part of the index
+  int Offset(const double* block) const {
+    const auto it = offsets_.find(block);
+    return it == offsets_.end() ? -1 : it->second;
+  }
+
+  const std::vector<double*>& Blocks() const { return blocks_; }
+
+  size_t Size() const { return blocks_.size(); }
+
+ private:
+  std::vector<double*> blocks_;
+  std::unordered_map<const double*, int> offsets_;
+};
+
+//! Compiled once into the library for the spline orders in use, see
+//! spline_trajectory_estimator.cc. Other orders have to include
+//! spline_trajectory_estimator.impl.h.
+extern template class SplineTrajectoryEstimator<4>;
+extern template class SplineTrajectoryEstimator<5>;
+extern template class SplineTrajectoryEstimator<6>;
+
 }  // namespace core
 }  // namespace OpenICC
-
-#include "OpenCameraCalibrator/core/spline_trajectory_estimator.impl.h"
@@ -1,7 +1,15 @@
+#pragma once
+
 #include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
 
+#include <Eigen/Sparse>
 #include <theia/theia.h>
 
+#include <cstring>
+#include <unordered_set>
+
+#include "OpenCameraCalibrator/utils/metrics.h"
+
 namespace OpenICC {
 namespace core {
 
@@ -10,7 +18,8 @@ SplineTrajectoryEstimator<_T>::SplineTrajectoryEstimator()
     : dt_so3_ns_(0.1 * S_TO_NS),
       dt_r3_ns_(0.1 * S_TO_NS),
       start_t_ns_(0.0),
-      gravity_(Eigen::Vector3d(0, 0, GRAVITY_MAGN)) {
+      gravity_(Eigen::Vector3d(0, 0, GRAVITY_MAGN)),
+      problem_(ProblemOptions()) {
   inv_so3_dt_ = S_TO_NS / dt_so3_ns_;
   inv_r3_dt_ = S_TO_NS / dt_r3_ns_;
 
@@ -26,7 +35,8 @@ SplineTrajectoryEstimator<_T>::SplineTrajectoryEstimator(
     : dt_so3_ns_(time_interval_so3_ns),
       dt_r3_ns_(time_interval_r3_ns),
       start_t_ns_(start_time_ns),
-      gravity_(Eigen::Vector3d(0, 0, GRAVITY_MAGN)) {
+      gravity_(Eigen::Vector3d(0, 0, GRAVITY_MAGN)),
+      problem_(ProblemOptions()) {
   inv_so3_dt_ = S_TO_NS / dt_so3_ns_;
   inv_r3_dt_ = S_TO_NS / dt_r3_ns_;
 
@@ -61,15 +71,22 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
   max_accl_bias_range_ = max_accl_range;
   max_gyro_bias_range_ = max_gyro_range;
 
-  dt_accl_bias_ns_ = dt_accl_bias_ns;
-  dt_gyro_bias_ns_ = dt_gyro_bias_ns;
+  // a constant bias is a single knot without spacing
+  constant_accl_bias_ = dt_accl_bias_ns <= 0;
+  constant_gyro_bias_ = dt_gyro_bias_ns <= 0;
+  dt_accl_bias_ns_ = constant_accl_bias_ ? 0 : dt_accl_bias_ns;
+  dt_gyro_bias_ns_ = constant_gyro_bias_ ? 0 : dt_gyro_bias_ns;
 
-  inv_accl_bias_dt_ = 1. / dt_accl_bias_ns_;
-  inv_gyro_bias_dt_ = 1. / dt_gyro_bias_ns_;
+  inv_accl_bias_dt_ = constant_accl_bias_ ? 0.0 : 1. / dt_accl_bias_ns_;
+  inv_gyro_bias_dt_ = constant_gyro_bias_ ? 0.0 : 1. / dt_gyro_bias_ns_;
 
   const auto duration = end_t_ns_ - start_t_ns_;
-  nr_knots_accl_bias_ = duration / dt_accl_bias_ns_ + BIAS_SPLINE_N;
-  nr_knots_gyro_bias_ = duration / dt_gyro_bias_ns_ + BIAS_SPLINE_N;
+  nr_knots_accl_bias_ = constant_accl_bias_
+                            ? 1
+                            : duration / dt_accl_bias_ns_ + BIAS_SPLINE_N;
+  nr_knots_gyro_bias_ = constant_gyro_bias_
+                            ? 1
+                            : duration / dt_gyro_bias_ns_ + BIAS_SPLINE_N;
 
   std::cout << "Initializing " << nr_knots_accl_bias_
             << " acceleration bias knots with: " << accl_init_bias.transpose()
@@ -80,6 +97,8 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
 
   accl_bias_spline_.resize(nr_knots_accl_bias_);
   gyro_bias_spline_.resize(nr_knots_gyro_bias_);
+  accl_bias_in_problem_ = std::vector<bool>(nr_knots_accl_bias_, false);
+  gyro_bias_in_problem_ = std::vector<bool>(nr_knots_gyro_bias_, false);
 
   for (int i = 0; i < nr_knots_accl_bias_; ++i) {
     accl_bias_spline_[i] = accl_init_bias;
@@ -91,190 +110,962 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
 
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetFixedParams(const int flags) {
-  // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(T_i_c_.data())) {
-    if (!(flags & SplineOptimFlags::T_I_C)) {
-      problem_.SetParameterBlockConstant(T_i_c_.data());
-      LOG(INFO) << "Keeping T_I_C constant.";
+  static const std::vector<std::pair<int, std::string>> groups = {
+      {SplineOptimFlags::T_I_C, "T_I_C"},
+      {SplineOptimFlags::CAM_LINE_DELAY, "camera line delay"},
+      {SplineOptimFlags::GRAVITY_DIR, "gravity direction"},
+      {SplineOptimFlags::POINTS, "object points"},
+      {SplineOptimFlags::IMU_INTRINSICS, "IMU intrinsics"},
+      {SplineOptimFlags::SPLINE, "spline knots"},
+      {SplineOptimFlags::ACC_BIAS, "accelerometer bias spline"},
+      {SplineOptimFlags::GYR_BIAS, "gyroscope bias spline"}};
+
+  int variable = flags;
+  if ((flags & SplineOptimFlags::POINTS) && rigid_board_) {
+    LOG(WARNING) << "The object points are constants of the camera "
+                 << "residuals on a rigid board and can not be optimized.";
+  }
+  if (flags & SplineOptimFlags::IMU_BIASES) {
+    variable |= SplineOptimFlags::ACC_BIAS | SplineOptimFlags::GYR_BIAS;
+  }
+  int constant = 0;
+  for (const auto& group : groups) {
+    if (variable & group.first) {
+      LOG(INFO) << "Optimizing " << group.second << ".";
     } else {
-      ceres::LocalParameterization* local_parameterization =
-          new LieLocalParameterization<Sophus::SE3d>();
-      problem_.SetParameterization(T_i_c_.data(), local_parameterization);
-      problem_.SetParameterBlockVariable(T_i_c_.data());
-      LOG(INFO) << "Optimizing T_I_C.";
+      constant |= group.first;
+      LOG(INFO) << "Keeping " << group.second << " constant.";
     }
   }
-
-  // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(&cam_line_delay_s_) &&
-      cam_line_delay_s_ != 0.0) {
-    if (!(flags & SplineOptimFlags::CAM_LINE_DELAY)) {
-      problem_.SetParameterBlockConstant(&cam_line_delay_s_);
-      LOG(INFO) << "Keeping camera line delay constant at: "
-                << cam_line_delay_s_;
-    } else {
-      problem_.SetParameterBlockVariable(&cam_line_delay_s_);
-      LOG(INFO) << "Optimizing camera line delay.";
+  SetParameterGroupsConstant(constant, true);
+  SetParameterGroupsConstant(variable & ~SplineOptimFlags::IMU_BIASES, false);
+  if (rotation_only_ && (variable & SplineOptimFlags::SPLINE)) {
+    // the positions stay at their initialization
+    for (size_t i = 0; i < r3_knots_.size(); ++i) {
+      if (r3_knot_in_problem_[i]) {
+        problem_.SetParameterBlockConstant(r3_knots_[i].data());
+      }
     }
+    LOG(INFO) << "Keeping R3 spline knots constant.";
   }
+}
 
-  // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(gravity_.data())) {
-    if (!(flags & SplineOptimFlags::GRAVITY_DIR)) {
-      LOG(INFO) << "Keeping gravity direction constant at: "
-                << gravity_.transpose();
-
-      problem_.SetParameterBlockConstant(gravity_.data());
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetParameterGroupsConstant(
+    const int groups, const bool constant) {
+  for (double* block : ParameterGroupBlocks(groups)) {
+    if (constant) {
+      problem_.SetParameterBlockConstant(block);
     } else {
-      if (problem_.HasParameterBlock(gravity_.data()))
-        problem_.SetParameterBlockVariable(gravity_.data());
-      LOG(INFO) << "Optimizing gravity direction.";
+      problem_.SetParameterBlockVariable(block);
     }
   }
+}
+
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::ParameterGroupBlocks(
+    const int groups) {
+  std::vector<double*> blocks;
+  // only knots that are part of the problem
+  auto add_knots = [&](auto& knots, const std::vector<bool>& in_problem) {
+    for (size_t i = 0; i < knots.size(); ++i) {
+      if (in_problem[i]) {
+        blocks.push_back(knots[i].data());
+      }
+    }
+  };
 
-  // if world points should be optimized
-  if (!(flags & SplineOptimFlags::POINTS)) {
-    LOG(INFO) << "Keeping object points constant.";
-    for (const auto& tid : tracks_in_problem_) {
-      const auto track = image_data_.MutableTrack(tid)->MutablePoint()->data();
-      if (problem_.HasParameterBlock(track))
-        problem_.SetParameterBlockConstant(track);
+  for (int c = 0; c < GetNumCameras(); ++c) {
+    const CameraBlocks camera = Camera(c);
+    if ((groups & SplineOptimFlags::T_I_C) &&
+        problem_.HasParameterBlock(camera.T_i_c)) {
+      blocks.push_back(camera.T_i_c);
     }
-  } else {
-    for (const auto& tid : tracks_in_problem_) {
-      const auto track = image_data_.MutableTrack(tid)->MutablePoint()->data();
-      if (problem_.HasParameterBlock(track)) {
-        problem_.SetParameterBlockVariable(track);
-        ceres::LocalParameterization* local_parameterization =
-            new ceres::HomogeneousVectorParameterization(4);
-        problem_.SetParameterization(track, local_parameterization);
+    if ((groups & SplineOptimFlags::CAM_LINE_DELAY) &&
+        problem_.HasParameterBlock(camera.line_delay_s) &&
+        *camera.line_delay_s != 0.0) {
+      blocks.push_back(camera.line_delay_s);
+    }
+    if (groups & SplineOptimFlags::POINTS) {
+      for (const auto& tid : *camera.tracks_in_problem) {
+        blocks.push_back(
+            camera.image_data->MutableTrack(tid)->MutablePoint()->data());
       }
     }
-    LOG(INFO) << "Optimizing object points.";
   }
-
-  // if imu intrinics should be optimized
-  if (problem_.HasParameterBlock(accl_intrinsics_.data()) &&
+  if ((groups & SplineOptimFlags::GRAVITY_DIR) &&
+      problem_.HasParameterBlock(gravity_.data())) {
+    blocks.push_back(gravity_.data());
+  }
+  if ((groups & SplineOptimFlags::IMU_INTRINSICS) &&
+      problem_.HasParameterBlock(accl_intrinsics_.data()) &&
       problem_.HasParameterBlock(gyro_intrinsics_.data())) {
-    if (!(flags & SplineOptimFlags::IMU_INTRINSICS)) {
-      LOG(INFO) << "Keeping IMU intrinsics constant.";
-      problem_.SetParameterBlockConstant(accl_intrinsics_.data());
-      problem_.SetParameterBlockConstant(gyro_intrinsics_.data());
-    } else {
-      problem_.SetParameterBlockVariable(accl_intrinsics_.data());
-      problem_.SetParameterBlockVariable(gyro_intrinsics_.data());
-      LOG(INFO) << "Optimizing IMU intrinsics.";
-    }
+    blocks.push_back(accl_intrinsics_.data());
+    blocks.push_back(gyro_intrinsics_.data());
   }
+  if (groups & SplineOptimFlags::SPLINE) {
+    add_knots(so3_knots_, so3_knot_in_problem_);
+    add_knots(r3_knots_, r3_knot_in_problem_);
+  }
+  if (groups & (SplineOptimFlags::ACC_BIAS | SplineOptimFlags::IMU_BIASES)) {
+    add_knots(accl_bias_spline_, accl_bias_in_problem_);
+  }
+  if (groups & (SplineOptimFlags::GYR_BIAS | SplineOptimFlags::IMU_BIASES)) {
+    add_knots(gyro_bias_spline_, gyro_bias_in_problem_);
+  }
+  return blocks;
+}
 
-  // add local parametrization for SO(3)
-  for (size_t i = 0; i < so3_knots_.size(); ++i) {
-    if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-      ceres::LocalParameterization* local_parameterization =
-          new LieLocalParameterization<Sophus::SO3d>();
-
-      problem_.SetParameterization(so3_knots_[i].data(),
-                                   local_parameterization);
+template <int _T>
+std::vector<typename SplineTrajectoryEstimator<_T>::CalibrationBlock>
+SplineTrajectoryEstimator<_T>::CalibrationBlocks(const int groups) {
+  std::vector<CalibrationBlock> blocks;
+  for (int c = 0; c < GetNumCameras(); ++c) {
+    const CameraBlocks camera = Camera(c);
+    if (groups & SplineOptimFlags::T_I_C) {
+      blocks.push_back(
+          {camera.T_i_c, Sophus::SE3d::DoF, se3_parameterization_.get()});
+    }
+    if (groups & SplineOptimFlags::CAM_LINE_DELAY) {
+      blocks.push_back({camera.line_delay_s, 1, nullptr});
     }
   }
-  if (!(flags & SplineOptimFlags::SPLINE)) {
-    // set knots constant if asked
-    for (size_t i = 0; i < r3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(r3_knots_[i].data())) {
-        problem_.SetParameterBlockConstant(r3_knots_[i].data());
+  if (groups & SplineOptimFlags::IMU_INTRINSICS) {
+    blocks.push_back(
+        {accl_intrinsics_.data(), int(accl_intrinsics_.size()), nullptr});
+    blocks.push_back(
+        {gyro_intrinsics_.data(), int(gyro_intrinsics_.size()), nullptr});
+  }
+  return blocks;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CalibrationNormalEquations(
+    const int groups,
+    Eigen::MatrixXd& JtJ,
+    Eigen::VectorXd& Jtr,
+    double& cost) {
+  ceres::Problem::EvaluateOptions options;
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
+  // columns of the evaluated jacobian in the common layout
+  std::vector<int> column_map;
+  int num_columns = 0;
+  for (const CalibrationBlock& block : CalibrationBlocks(groups)) {
+    if (problem_.HasParameterBlock(block.block)) {
+      options.parameter_blocks.push_back(block.block);
+      for (int d = 0; d < block.tangent_size; ++d) {
+        column_map.push_back(num_columns + d);
       }
     }
-    for (size_t i = 0; i < so3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-        problem_.SetParameterBlockConstant(so3_knots_[i].data());
+    num_columns += block.tangent_size;
+  }
+  JtJ.setZero(num_columns, num_columns);
+  Jtr.setZero(num_columns);
+  if (options.parameter_blocks.empty()) {
+    cost = EvaluateCost();
+    return true;
+  }
+
+  // the blocks not listed in the options are held constant
+  SetParameterGroupsConstant(groups, false);
+  std::vector<double> residuals;
+  ceres::CRSMatrix jacobian;
+  if (!problem_.Evaluate(options, &cost, &residuals, nullptr, &jacobian)) {
+    LOG(ERROR) << "Could not evaluate the calibration jacobian.";
+    return false;
+  }
+  for (int r = 0; r < jacobian.num_rows; ++r) {
+    for (int i = jacobian.rows[r]; i < jacobian.rows[r + 1]; ++i) {
+      const int col_i = column_map[jacobian.cols[i]];
+      Jtr[col_i] += jacobian.values[i] * residuals[r];
+      for (int j = jacobian.rows[r]; j < jacobian.rows[r + 1]; ++j) {
+        JtJ(col_i, column_map[jacobian.cols[j]]) +=
+            jacobian.values[i] * jacobian.values[j];
       }
     }
-  } else {
-    // set knots constant if asked
-    for (size_t i = 0; i < r3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(r3_knots_[i].data())) {
-        problem_.SetParameterBlockVariable(r3_knots_[i].data());
+  }
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CalibrationCovariance(
+    const int groups,
+    const int eliminated_groups,
+    Eigen::MatrixXd& covariance) {
+  ceres::Problem::EvaluateOptions options;
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
+  // the eliminated blocks come first, the calibration blocks are mapped to
+  // the common layout after them
+  int num_eliminated = 0;
+  for (double* block : ParameterGroupBlocks(eliminated_groups & ~groups)) {
+    options.parameter_blocks.push_back(block);
+    num_eliminated += problem_.ParameterBlockLocalSize(block);
+  }
+  std::vector<int> column_map;
+  int num_columns = 0;
+  for (const CalibrationBlock& block : CalibrationBlocks(groups)) {
+    if (problem_.HasParameterBlock(block.block)) {
+      options.parameter_blocks.push_back(block.block);
+      for (int d = 0; d < block.tangent_size; ++d) {
+        column_map.push_back(num_columns + d);
       }
     }
-    for (size_t i = 0; i < so3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-        problem_.SetParameterBlockVariable(so3_knots_[i].data());
-      }
+    num_columns += block.tangent_size;
+  }
+  covariance.setZero(num_columns, num_columns);
+  const int num_calibration = column_map.size();
+  if (num_calibration == 0) {
+    return true;
+  }
+
+  SetParameterGroupsConstant(groups | eliminated_groups, false);
+  ceres::CRSMatrix jacobian;
+  if (!problem_.Evaluate(options, nullptr, nullptr, nullptr, &jacobian)) {
+    LOG(ERROR) << "Could not evaluate the calibration jacobian.";
+    return false;
+  }
+  std::vector<Eigen::Triplet<double>> triplets;
+  triplets.reserve(jacobian.values.size());
+  for (int r = 0; r < jacobian.num_rows; ++r) {
+    for (int i = jacobian.rows[r]; i < jacobian.rows[r + 1]; ++i) {
+      triplets.emplace_back(r, jacobian.cols[i], jacobian.values[i]);
+    }
+  }
+  Eigen::SparseMatrix<double> J(jacobian.num_rows, jacobian.num_cols);
+  J.setFromTriplets(triplets.begin(), triplets.end());
+  const Eigen::SparseMatrix<double> JtJ = J.transpose() * J;
+
+  // marginal information of the calibration parameters, the Schur
+  // complement of the knots, points, biases and gravity. The eliminated
+  // block is banded and sparse, its factorization dominates
+  Eigen::MatrixXd information =
+      JtJ.bottomRightCorner(num_calibration, num_calibration).toDense();
+  if (num_eliminated > 0) {
+    const Eigen::SparseMatrix<double> JtJ_ee =
+        JtJ.topLeftCorner(num_eliminated, num_eliminated);
+    const Eigen::MatrixXd JtJ_ec =
+        JtJ.topRightCorner(num_eliminated, num_calibration).toDense();
+    const Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(JtJ_ee);
+    if (ldlt.info() != Eigen::Success) {
+      LOG(ERROR) << "Could not factorize the eliminated parameters.";
+      return false;
     }
+    information -= JtJ_ec.transpose() * ldlt.solve(JtJ_ec);
+  }
+  const Eigen::LDLT<Eigen::MatrixXd> information_ldlt(information);
+  if (information_ldlt.info() != Eigen::Success ||
+      !information_ldlt.isPositive()) {
+    LOG(ERROR) << "The calibration parameters are not observable.";
+    return false;
+  }
+  const Eigen::MatrixXd marginal_covariance = information_ldlt.solve(
+      Eigen::MatrixXd::Identity(num_calibration, num_calibration));
+  if (!marginal_covariance.allFinite()) {
+    LOG(ERROR) << "The calibration parameters are not observable.";
+    return false;
   }
+  for (int i = 0; i < num_calibration; ++i) {
+    for (int j = 0; j < num_calibration; ++j) {
+      covariance(column_map[i], column_map[j]) = marginal_covariance(i, j);
+    }
+  }
+  return true;
+}
 
-  // set bias limits
-  // if imu intrinics should be optimized
-  if ((flags & SplineOptimFlags::ACC_BIAS ||
-       flags & SplineOptimFlags::IMU_BIASES)) {
-    LOG(INFO) << "Optimizing accelerometer bias spline.";
-    for (int i = 0; i < accl_bias_spline_.size(); ++i) {
-      if (problem_.HasParameterBlock(accl_bias_spline_[i].data())) {
-        for (int d = 0; d < 3; ++d) {
-          problem_.SetParameterLowerBound(
-              accl_bias_spline_[i].data(), d, -max_accl_bias_range_);
-          problem_.SetParameterUpperBound(
-              accl_bias_spline_[i].data(), d, max_accl_bias_range_);
-        }
-        problem_.SetParameterBlockVariable(accl_bias_spline_[i].data());
-      }
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ApplyCalibrationStep(
+    const int groups, const Eigen::VectorXd& dx) {
+  int offset = 0;
+  for (const CalibrationBlock& block : CalibrationBlocks(groups)) {
+    if (block.parameterization) {
+      const int size = block.parameterization->GlobalSize();
+      std::vector<double> moved(size);
+      block.parameterization->Plus(
+          block.block, dx.data() + offset, moved.data());
+      std::copy(moved.begin(), moved.end(), block.block);
+    } else {
+      Eigen::Map<Eigen::VectorXd>(block.block, block.tangent_size) +=
+          dx.segment(offset, block.tangent_size);
     }
-  } else {
-    LOG(INFO) << "Fixing accelerometer bias spline.";
-    for (int i = 0; i < accl_bias_spline_.size(); ++i) {
-      if (problem_.HasParameterBlock(accl_bias_spline_[i].data())) {
-        problem_.SetParameterBlockConstant(accl_bias_spline_[i].data());
-      }
+    offset += block.tangent_size;
+  }
+}
+
+template <int _T>
+double SplineTrajectoryEstimator<_T>::EvaluateCost() {
+  ceres::Problem::EvaluateOptions options;
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
+  double cost = 0.0;
+  problem_.Evaluate(options, &cost, nullptr, nullptr, nullptr);
+  return cost;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::CopyCalibrationFrom(
+    const SplineTrajectoryEstimator& other) {
+  const auto copy_line_delay = [](const double from, double& to) {
+    if (from != 0.0 && to != 0.0) {
+      to = from;
     }
+  };
+  T_i_c_ = other.T_i_c_;
+  copy_line_delay(other.cam_line_delay_s_, cam_line_delay_s_);
+  const size_t num_rig_cameras =
+      std::min(rig_cameras_.size(), other.rig_cameras_.size());
+  for (size_t c = 0; c < num_rig_cameras; ++c) {
+    rig_cameras_[c]->T_i_c = other.rig_cameras_[c]->T_i_c;
+    copy_line_delay(other.rig_cameras_[c]->line_delay_s,
+                    rig_cameras_[c]->line_delay_s);
   }
-  if ((flags & SplineOptimFlags::GYR_BIAS ||
-       flags & SplineOptimFlags::IMU_BIASES)) {
-    LOG(INFO) << "Optimizing gyroscope bias spline.";
-    for (int i = 0; i < gyro_bias_spline_.size(); ++i) {
-      if (problem_.HasParameterBlock(gyro_bias_spline_[i].data())) {
-        for (int d = 0; d < 3; ++d) {
-          problem_.SetParameterLowerBound(
-              gyro_bias_spline_[i].data(), d, -max_gyro_bias_range_);
-          problem_.SetParameterUpperBound(
-              gyro_bias_spline_[i].data(), d, max_gyro_bias_range_);
-        }
-        problem_.SetParameterBlockVariable(gyro_bias_spline_[i].data());
-      }
+  accl_intrinsics_ = other.accl_intrinsics_;
+  gyro_intrinsics_ = other.gyro_intrinsics_;
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::SO3KnotBlock(const int64_t i) {
+  double* block = so3_knots_[i].data();
+  if (!so3_knot_in_problem_[i]) {
+    problem_.AddParameterBlock(
+        block, Sophus::SO3d::num_parameters, so3_parameterization_.get());
+    so3_knot_in_problem_[i] = true;
+  }
+  return block;
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::R3KnotBlock(const int64_t i) {
+  r3_knot_in_problem_[i] = true;
+  return r3_knots_[i].data();
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::AcclBiasBlock(const int64_t i) {
+  double* block = accl_bias_spline_[i].data();
+  if (!accl_bias_in_problem_[i]) {
+    problem_.AddParameterBlock(block, 3);
+    for (int d = 0; d < 3; ++d) {
+      problem_.SetParameterLowerBound(block, d, -max_accl_bias_range_);
+      problem_.SetParameterUpperBound(block, d, max_accl_bias_range_);
     }
-  } else {
-    LOG(INFO) << "Fixing gyroscope bias spline.";
-    for (int i = 0; i < gyro_bias_spline_.size(); ++i) {
-      if (problem_.HasParameterBlock(gyro_bias_spline_[i].data())) {
-        problem_.SetParameterBlockConstant(gyro_bias_spline_[i].data());
-      }
+    accl_bias_in_problem_[i] = true;
+  }
+  return block;
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::GyroBiasBlock(const int64_t i) {
+  double* block = gyro_bias_spline_[i].data();
+  if (!gyro_bias_in_problem_[i]) {
+    problem_.AddParameterBlock(block, 3);
+    for (int d = 0; d < 3; ++d) {
+      problem_.SetParameterLowerBound(block, d, -max_gyro_bias_range_);
+      problem_.SetParameterUpperBound(block, d, max_gyro_bias_range_);
     }
+    gyro_bias_in_problem_[i] = true;
   }
+  return block;
 }
 
 template <int _T>
-ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Optimize(
-    const int max_iters, const int flags) {
+double* SplineTrajectoryEstimator<_T>::PointBlock(
+    const theia::TrackId track_id, const int camera) {
+  const CameraBlocks blocks = Camera(camera);
+  double* block =
+      blocks.image_data->MutableTrack(track_id)->MutablePoint()->data();
+  if (blocks.tracks_in_problem->insert(track_id).second) {
+    problem_.AddParameterBlock(block, 4, point_parameterization_.get());
+  }
+  return block;
+}
+
+template <int _T>
+ceres::Problem::Options SplineTrajectoryEstimator<_T>::ProblemOptions()
+    const {
+  ceres::Problem::Options options;
+  // knots and their residuals are removed while a fixed-lag window advances
+  options.enable_fast_removal = true;
+  // the estimator shares one parameterization between all blocks of a kind
+  options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  // cost functions live in the arena of the estimator, losses are shared
+  options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  options.evaluation_callback = so3_knot_cache_.get();
+  return options;
+}
+
+template <int _T>
+ceres::Solver::Options SplineTrajectoryEstimator<_T>::SolverOptions(
+    const int max_iters) {
   ceres::Solver::Options options;
-  options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  options.linear_solver_type = solver_profile_.linear_solver_type;
+  options.preconditioner_type = solver_profile_.preconditioner_type;
+  options.sparse_linear_algebra_library_type =
+      solver_profile_.sparse_linear_algebra_library_type;
+  options.dense_linear_algebra_library_type =
+      solver_profile_.dense_linear_algebra_library_type;
+  // the reprojection residuals hold all points of a view, so the points are
+  // no independent set. Schur solvers pick their elimination group.
+  if (solver_profile_.use_elimination_ordering &&
+      !ceres::IsSchurType(options.linear_solver_type)) {
+    options.linear_solver_ordering = EliminationOrdering();
+  }
   options.max_num_iterations = max_iters;
-  options.num_threads = std::thread::hardware_concurrency();
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
   options.minimizer_progress_to_stdout = true;
   options.trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT;
   options.function_tolerance = 1e-4;
   options.parameter_tolerance = 1e-7;
-  options.preconditioner_type = ceres::CLUSTER_TRIDIAGONAL;
-  options.use_inner_iterations = true;
+  // ceres does not combine inner iterations with an evaluation callback
+  options.use_inner_iterations = so3_knot_cache_ == nullptr;
+  return options;
+}
+
+template <int _T>
+std::shared_ptr<ceres::ParameterBlockOrdering>
+SplineTrajectoryEstimator<_T>::EliminationOrdering() {
+  std::unordered_set<const double*> points;
+  for (int c = 0; c < GetNumCameras(); ++c) {
+    const CameraBlocks camera = Camera(c);
+    for (const auto& tid : *camera.tracks_in_problem) {
+      points.insert(camera.image_data->Track(tid)->Point().data());
+    }
+  }
+  std::unordered_set<const double*> bias_knots;
+  for (const auto& knot : accl_bias_spline_) {
+    bias_knots.insert(knot.data());
+  }
+  for (const auto& knot : gyro_bias_spline_) {
+    bias_knots.insert(knot.data());
+  }
+
+  std::vector<double*> parameter_blocks;
+  problem_.GetParameterBlocks(&parameter_blocks);
+  std::shared_ptr<ceres::ParameterBlockOrdering> ordering =
+      std::make_shared<ceres::ParameterBlockOrdering>();
+  for (double* block : parameter_blocks) {
+    if (points.count(block)) {
+      ordering->AddElementToGroup(block, 0);
+    } else if (bias_knots.count(block)) {
+      ordering->AddElementToGroup(block, 1);
+    } else {
+      ordering->AddElementToGroup(block, 2);
+    }
+  }
+  return ordering;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ReportSolverTiming(
+    const ceres::Solver::Summary& summary) const {
+  std::cout << "Solver profile " << solver_profile_.name << ": "
+            << summary.total_time_in_seconds << "s total, "
+            << summary.linear_solver_time_in_seconds << "s linear solver, "
+            << summary.residual_evaluation_time_in_seconds
+            << "s residuals, " << summary.jacobian_evaluation_time_in_seconds
+            << "s jacobians, " << summary.iterations.size()
+            << " iterations.\n";
+  const std::string solver_label = utils::Label("solver", "spline");
+  utils::Metrics::Instance().AddCounter(
+      "openicc_solver_iterations_total",
+      solver_label,
+      summary.iterations.size());
+  utils::Metrics::Instance().AddCounter("openicc_solver_seconds_total",
+                                        solver_label,
+                                        summary.total_time_in_seconds);
+  if (profile_residuals_) {
+    ReportResidualTimings(GetResidualTimings());
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ResetResidualTimers() {
+  for (auto& timer : residual_timers_) {
+    timer.second->Reset();
+  }
+}
+
+template <int _T>
+std::vector<ResidualTiming> SplineTrajectoryEstimator<_T>::GetResidualTimings()
+    const {
+  std::vector<ResidualTiming> timings;
+  for (const auto& timer : residual_timers_) {
+    timings.push_back(timer.second->Timing());
+  }
+  return timings;
+}
+
+template <int _T>
+std::unique_ptr<SplineIterationMonitor>
+SplineTrajectoryEstimator<_T>::AddIterationMonitor(
+    ceres::Solver::Options& options) {
+  std::unique_ptr<SplineIterationMonitor> monitor(
+      new SplineIterationMonitor(convergence_criteria_,
+                                 iteration_callback_,
+                                 [this] {
+                                   return GetReprojectionErrorStatistics()
+                                       .mean_error;
+                                 }));
+  if (!monitor->Active()) {
+    return nullptr;
+  }
+  // the reprojection error is computed from the current parameter blocks
+  options.update_state_every_iteration = true;
+  options.callbacks.push_back(monitor.get());
+  return monitor;
+}
+
+template <int _T>
+ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Optimize(
+    const int max_iters, const int flags) {
+  ceres::Solver::Options options = SolverOptions(max_iters);
+  const std::unique_ptr<SplineIterationMonitor> monitor =
+      AddIterationMonitor(options);
 
   SetFixedParams(flags);
 
   // Solve
+  ResetResidualTimers();
   ceres::Solver::Summary summary;
   ceres::Solve(options, &problem_, &summary);
   std::cout << summary.FullReport() << std::endl;
+  ReportSolverTiming(summary);
+
+  return summary;
+}
+
+template <int _T>
+ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Optimize(
+    const int max_iters,
+    const int flags,
+    const int64_t start_time,
+    const int64_t end_time) {
+  ceres::Solver::Options options = SolverOptions(max_iters);
+  const std::unique_ptr<SplineIterationMonitor> monitor =
+      AddIterationMonitor(options);
+
+  SetFixedParams(flags);
+
+  // first knots that influence the window
+  const int64_t s_so3_start =
+      std::max<int64_t>(0, (start_time - start_t_ns_) / dt_so3_ns_);
+  const int64_t s_r3_start =
+      std::max<int64_t>(0, (start_time - start_t_ns_) / dt_r3_ns_);
+  // last knots that influence the window
+  const int64_t s_so3_end =
+      std::max<int64_t>(0, (end_time - start_t_ns_) / dt_so3_ns_) + N_ - 1;
+  const int64_t s_r3_end =
+      std::max<int64_t>(0, (end_time - start_t_ns_) / dt_r3_ns_) + N_ - 1;
+
+  WindowKnots(so3_knots_, so3_knot_in_problem_, s_so3_start, s_so3_end);
+  WindowKnots(r3_knots_, r3_knot_in_problem_, s_r3_start, s_r3_end);
+
+  std::cout << "Optimizing window " << start_time * NS_TO_S << "s - "
+            << end_time * NS_TO_S << "s with "
+            << problem_.NumResidualBlocks() << " residual blocks.\n";
+
+  ResetResidualTimers();
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem_, &summary);
+  std::cout << summary.BriefReport() << std::endl;
+  ReportSolverTiming(summary);
 
   return summary;
 }
 
+template <int _T>
+template <class KnotVector>
+void SplineTrajectoryEstimator<_T>::WindowKnots(KnotVector& knots,
+                                                std::vector<bool>& in_problem,
+                                                const int64_t s_start,
+                                                const int64_t s_end) {
+  for (int64_t i = 0; i < static_cast<int64_t>(knots.size()); ++i) {
+    double* knot = knots[i].data();
+    if (!problem_.HasParameterBlock(knot)) {
+      continue;
+    }
+    if (i < s_start) {
+      // the knot left the window, this also drops all its residual blocks
+      problem_.RemoveParameterBlock(knot);
+      in_problem[i] = false;
+    } else if ((s_start > 0 && i < s_start + N_ - 1) || i > s_end) {
+      // shared with dropped residuals or outside of the window
+      problem_.SetParameterBlockConstant(knot);
+    }
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ResampleKnots(const int64_t dt_so3_ns,
+                                                  const int64_t dt_r3_ns) {
+  ClearMeasurements();
+
+  const int64_t duration = end_t_ns_ - start_t_ns_;
+  const size_t nr_knots_so3 = duration / dt_so3_ns + N_;
+  const size_t nr_knots_r3 = duration / dt_r3_ns + N_;
+
+  // a knot mostly influences the spline around the middle of its support,
+  // so sample the current splines there
+  auto knot_time = [&](const size_t i, const int64_t dt_ns) {
+    const int64_t t_ns =
+        start_t_ns_ + static_cast<int64_t>((i - 0.5 * DEG_) * dt_ns);
+    return std::min(std::max(t_ns, start_t_ns_), end_t_ns_);
+  };
+
+  so3_vector so3_knots(nr_knots_so3);
+  for (size_t i = 0; i < nr_knots_so3; ++i) {
+    double u_so3;
+    int64_t s_so3;
+    if (!CalcSO3Times(knot_time(i, dt_so3_ns), u_so3, s_so3)) {
+      continue;
+    }
+    std::vector<const double*> vec;
+    for (int j = 0; j < N_; ++j) {
+      vec.emplace_back(so3_knots_[s_so3 + j].data());
+    }
+    CeresSplineHelper<double, N_>::template evaluate_lie<Sophus::SO3>(
+        &vec[0], u_so3, inv_so3_dt_, &so3_knots[i]);
+  }
+
+  vec3_vector r3_knots(nr_knots_r3, Eigen::Vector3d::Zero());
+  for (size_t i = 0; i < nr_knots_r3; ++i) {
+    GetPosition(knot_time(i, dt_r3_ns), r3_knots[i]);
+  }
+
+  dt_so3_ns_ = dt_so3_ns;
+  dt_r3_ns_ = dt_r3_ns;
+  nr_knots_so3_ = nr_knots_so3;
+  nr_knots_r3_ = nr_knots_r3;
+  inv_so3_dt_ = S_TO_NS / dt_so3_ns_;
+  inv_r3_dt_ = S_TO_NS / dt_r3_ns_;
+
+  so3_knots_ = so3_knots;
+  r3_knots_ = r3_knots;
+  so3_knot_in_problem_ = std::vector<bool>(nr_knots_so3_, false);
+  r3_knot_in_problem_ = std::vector<bool>(nr_knots_r3_, false);
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ExtendKnots(const int64_t end_time_ns,
+                                                const Sophus::SE3d& pose) {
+  if (end_time_ns <= end_t_ns_) {
+    return;
+  }
+  ClearMeasurements();
+  // the bias knots have no residuals left, but would dangle in the problem
+  const auto remove_blocks = [this](vec3_vector& knots,
+                                    std::vector<bool>& in_problem) {
+    for (size_t i = 0; i < knots.size(); ++i) {
+      if (problem_.HasParameterBlock(knots[i].data())) {
+        problem_.RemoveParameterBlock(knots[i].data());
+      }
+      in_problem[i] = false;
+    }
+  };
+  remove_blocks(accl_bias_spline_, accl_bias_in_problem_);
+  remove_blocks(gyro_bias_spline_, gyro_bias_in_problem_);
+
+  end_t_ns_ = end_time_ns;
+  const int64_t duration = end_t_ns_ - start_t_ns_;
+  nr_knots_so3_ = duration / dt_so3_ns_ + _T;
+  nr_knots_r3_ = duration / dt_r3_ns_ + _T;
+  so3_knots_.resize(nr_knots_so3_, pose.so3());
+  r3_knots_.resize(nr_knots_r3_, pose.translation());
+  so3_knot_in_problem_.resize(nr_knots_so3_, false);
+  r3_knot_in_problem_.resize(nr_knots_r3_, false);
+
+  // bias splines exist after InitBiasSplines, a constant bias keeps its knot
+  if (!accl_bias_spline_.empty() && !constant_accl_bias_) {
+    nr_knots_accl_bias_ = duration / dt_accl_bias_ns_ + BIAS_SPLINE_N;
+    const Eigen::Vector3d last_bias = accl_bias_spline_.back();
+    accl_bias_spline_.resize(nr_knots_accl_bias_, last_bias);
+    accl_bias_in_problem_.resize(nr_knots_accl_bias_, false);
+  }
+  if (!gyro_bias_spline_.empty() && !constant_gyro_bias_) {
+    nr_knots_gyro_bias_ = duration / dt_gyro_bias_ns_ + BIAS_SPLINE_N;
+    const Eigen::Vector3d last_bias = gyro_bias_spline_.back();
+    gyro_bias_spline_.resize(nr_knots_gyro_bias_, last_bias);
+    gyro_bias_in_problem_.resize(nr_knots_gyro_bias_, false);
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::CopyStateFrom(
+    const SplineTrajectoryEstimator& other) {
+  ClearMeasurements();
+
+  start_t_ns_ = other.start_t_ns_;
+  end_t_ns_ = other.end_t_ns_;
+  dt_so3_ns_ = other.dt_so3_ns_;
+  dt_r3_ns_ = other.dt_r3_ns_;
+  inv_so3_dt_ = other.inv_so3_dt_;
+  inv_r3_dt_ = other.inv_r3_dt_;
+  nr_knots_so3_ = other.nr_knots_so3_;
+  nr_knots_r3_ = other.nr_knots_r3_;
+  so3_knots_ = other.so3_knots_;
+  r3_knots_ = other.r3_knots_;
+  so3_knot_in_problem_ = std::vector<bool>(so3_knots_.size(), false);
+  r3_knot_in_problem_ = std::vector<bool>(r3_knots_.size(), false);
+
+  nr_knots_accl_bias_ = other.nr_knots_accl_bias_;
+  nr_knots_gyro_bias_ = other.nr_knots_gyro_bias_;
+  dt_accl_bias_ns_ = other.dt_accl_bias_ns_;
+  dt_gyro_bias_ns_ = other.dt_gyro_bias_ns_;
+  inv_accl_bias_dt_ = other.inv_accl_bias_dt_;
+  inv_gyro_bias_dt_ = other.inv_gyro_bias_dt_;
+  accl_bias_spline_ = other.accl_bias_spline_;
+  gyro_bias_spline_ = other.gyro_bias_spline_;
+  accl_bias_in_problem_ = std::vector<bool>(accl_bias_spline_.size(), false);
+  gyro_bias_in_problem_ = std::vector<bool>(gyro_bias_spline_.size(), false);
+  max_accl_bias_range_ = other.max_accl_bias_range_;
+  max_gyro_bias_range_ = other.max_gyro_bias_range_;
+  constant_accl_bias_ = other.constant_accl_bias_;
+  constant_gyro_bias_ = other.constant_gyro_bias_;
+
+  fix_imu_intrinsics_ = other.fix_imu_intrinsics_;
+  use_analytic_imu_jacobians_ = other.use_analytic_imu_jacobians_;
+  float_imu_jacobians_ = other.float_imu_jacobians_;
+  SetShareKnotEvaluations(other.so3_knot_cache_ != nullptr);
+  linearize_rolling_shutter_ = other.linearize_rolling_shutter_;
+  rigid_board_ = other.rigid_board_;
+  rotation_only_ = other.rotation_only_;
+  if (other.camera_loss_) {
+    SetCameraLossWidth(other.camera_loss_width_);
+  }
+  camera_residual_layout_ = other.camera_residual_layout_;
+  solver_profile_ = other.solver_profile_;
+  profile_residuals_ = other.profile_residuals_;
+
+  cam_line_delay_s_ = other.cam_line_delay_s_;
+  imu_to_camera_time_offset_s_ = other.imu_to_camera_time_offset_s_;
+  gravity_ = other.gravity_;
+  accl_intrinsics_ = other.accl_intrinsics_;
+  gyro_intrinsics_ = other.gyro_intrinsics_;
+  // the store points into the shared reconstruction, a copy stays valid
+  image_data_ = other.image_data_;
+  observations_ = other.observations_;
+  T_i_c_ = other.T_i_c_;
+  rig_cameras_.clear();
+  for (const auto& rig_camera : other.rig_cameras_) {
+    AddRigCamera(rig_camera->image_data,
+                 rig_camera->T_i_c,
+                 rig_camera->line_delay_s,
+                 rig_camera->time_offset_s);
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::GetState(io::SplineState& state) const {
+  state.spline_order = _T;
+  state.start_t_ns = start_t_ns_;
+  state.end_t_ns = end_t_ns_;
+  state.dt_so3_ns = dt_so3_ns_;
+  state.dt_r3_ns = dt_r3_ns_;
+  state.dt_accl_bias_ns = dt_accl_bias_ns_;
+  state.dt_gyro_bias_ns = dt_gyro_bias_ns_;
+  state.so3_knots = so3_knots_;
+  state.r3_knots = r3_knots_;
+  state.accl_bias_knots = accl_bias_spline_;
+  state.gyro_bias_knots = gyro_bias_spline_;
+  state.max_accl_bias_range = max_accl_bias_range_;
+  state.max_gyro_bias_range = max_gyro_bias_range_;
+
+  state.T_i_c = T_i_c_;
+  state.gravity = gravity_;
+  state.accl_intrinsics = accl_intrinsics_;
+  state.gyro_intrinsics = gyro_intrinsics_;
+  state.cam_line_delay_s = cam_line_delay_s_;
+  state.imu_to_camera_time_offset_s = imu_to_camera_time_offset_s_;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::SetState(const io::SplineState& state) {
+  io::SplineState current;
+  GetState(current);
+  if (!current.SameKnotLayout(state)) {
+    LOG(ERROR) << "The spline state was saved with another spline order, "
+                  "time range or knot spacing.";
+    return false;
+  }
+  // copy element wise, the problem holds pointers to the knots
+  std::copy(
+      state.so3_knots.begin(), state.so3_knots.end(), so3_knots_.begin());
+  std::copy(state.r3_knots.begin(), state.r3_knots.end(), r3_knots_.begin());
+  std::copy(state.accl_bias_knots.begin(),
+            state.accl_bias_knots.end(),
+            accl_bias_spline_.begin());
+  std::copy(state.gyro_bias_knots.begin(),
+            state.gyro_bias_knots.end(),
+            gyro_bias_spline_.begin());
+  max_accl_bias_range_ = state.max_accl_bias_range;
+  max_gyro_bias_range_ = state.max_gyro_bias_range;
+
+  gravity_ = state.gravity;
+  imu_to_camera_time_offset_s_ = state.imu_to_camera_time_offset_s;
+  SetCalibrationFromState(state);
+  return true;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetCalibrationFromState(
+    const io::SplineState& state) {
+  T_i_c_ = state.T_i_c;
+  accl_intrinsics_ = state.accl_intrinsics;
+  gyro_intrinsics_ = state.gyro_intrinsics;
+  cam_line_delay_s_ = state.cam_line_delay_s;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::CopyKnotsFrom(
+    const SplineTrajectoryEstimator& other,
+    const int64_t start_time_ns,
+    const int64_t end_time_ns) {
+  const auto in_range = [&](const size_t i, const int64_t dt_ns) {
+    const int64_t knot_time_ns = start_t_ns_ + static_cast<int64_t>(i) * dt_ns;
+    return knot_time_ns >= start_time_ns && knot_time_ns < end_time_ns;
+  };
+  for (size_t i = 0; i < so3_knots_.size(); ++i) {
+    if (in_range(i, dt_so3_ns_)) {
+      so3_knots_[i] = other.so3_knots_[i];
+    }
+  }
+  for (size_t i = 0; i < r3_knots_.size(); ++i) {
+    if (in_range(i, dt_r3_ns_)) {
+      r3_knots_[i] = other.r3_knots_[i];
+    }
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ClearMeasurements() {
+  for (size_t i = 0; i < so3_knots_.size(); ++i) {
+    if (problem_.HasParameterBlock(so3_knots_[i].data())) {
+      problem_.RemoveParameterBlock(so3_knots_[i].data());
+    }
+    so3_knot_in_problem_[i] = false;
+  }
+  for (size_t i = 0; i < r3_knots_.size(); ++i) {
+    if (problem_.HasParameterBlock(r3_knots_[i].data())) {
+      problem_.RemoveParameterBlock(r3_knots_[i].data());
+    }
+    r3_knot_in_problem_[i] = false;
+  }
+  residual_kinds_.clear();
+  // all residuals depend on knots, so none are left to use the arena
+  if (problem_.NumResidualBlocks() == 0) {
+    cost_function_arena_.Clear();
+  }
+}
+
+template <int _T>
+ceres::ResidualBlockId SplineTrajectoryEstimator<_T>::AddResidualBlock(
+    const SplineResidualKind kind,
+    ceres::CostFunction* cost_function,
+    ceres::LossFunction* loss_function,
+    const std::vector<double*>& parameter_blocks,
+    const std::string& timer_name) {
+  if (profile_residuals_) {
+    const std::string name =
+        timer_name.empty() ? SplineResidualKindName(kind) : timer_name;
+    std::unique_ptr<ResidualTimer>& timer = residual_timers_[name];
+    if (!timer) {
+      timer.reset(new ResidualTimer(name));
+    }
+    cost_function = cost_function_arena_.Create<TimedCostFunction>(
+        cost_function, timer.get());
+  }
+  const ceres::ResidualBlockId id =
+      problem_.AddResidualBlock(cost_function, loss_function, parameter_blocks);
+  residual_kinds_[id] = kind;
+  return id;
+}
+
+template <int _T>
+OutlierGatingSummary SplineTrajectoryEstimator<_T>::GateOutliers(
+    const OutlierGatingOptions& options) {
+  OutlierGatingSummary summary;
+  // drop the bookkeeping of blocks that left the problem with their knots
+  std::vector<ceres::ResidualBlockId> problem_ids;
+  problem_.GetResidualBlocks(&problem_ids);
+  std::unordered_map<ceres::ResidualBlockId, SplineResidualKind> kinds;
+  std::vector<ceres::ResidualBlockId> ids;
+  for (const ceres::ResidualBlockId id : problem_ids) {
+    const auto it = residual_kinds_.find(id);
+    if (it != residual_kinds_.end()) {
+      kinds.emplace(id, it->second);
+      ids.push_back(id);
+    }
+  }
+  residual_kinds_.swap(kinds);
+  summary.num_evaluated = ids.size();
+
+  // RMS residual of every block without the robust loss. The blocks are
+  // evaluated in parallel, so the knot cache is updated once up front.
+  if (so3_knot_cache_) {
+    so3_knot_cache_->PrepareForEvaluation(false, true);
+  }
+  std::vector<double> rms(ids.size(), 0.0);
+  utils::ParallelFor(
+      ids.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          double cost = 0.0;
+          if (!problem_.EvaluateResidualBlockAssumingParametersUnchanged(
+                  ids[i], false, &cost, nullptr, nullptr)) {
+            continue;
+          }
+          const int num_residuals =
+              problem_.GetCostFunctionForResidualBlock(ids[i])
+                  ->num_residuals();
+          rms[i] = std::sqrt(2.0 * cost / std::max(num_residuals, 1));
+        }
+      });
+
+  // median and scaled median absolute deviation per kind
+  std::array<double, NUM_SPLINE_RESIDUAL_KINDS> thresholds;
+  for (int kind = 0; kind < NUM_SPLINE_RESIDUAL_KINDS; ++kind) {
+    thresholds[kind] = std::numeric_limits<double>::max();
+    if (kind != CAMERA_RESIDUAL && !options.gate_imu) {
+      continue;
+    }
+    std::vector<double> values;
+    for (size_t i = 0; i < ids.size(); ++i) {
+      if (residual_kinds_[ids[i]] == kind) values.push_back(rms[i]);
+    }
+    if (values.empty()) {
+      continue;
+    }
+    const double median = utils::MedianOfDoubleVec(values);
+    for (double& v : values) v = std::abs(v - median);
+    const double mad = 1.4826 * utils::MedianOfDoubleVec(values);
+    // identical residuals, nothing sticks out
+    if (mad <= 0.0) {
+      continue;
+    }
+    thresholds[kind] = median + options.num_mads * mad;
+    if (kind == CAMERA_RESIDUAL && options.max_camera_rms_px > 0.0) {
+      thresholds[kind] = std::min(thresholds[kind], options.max_camera_rms_px);
+    }
+  }
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const SplineResidualKind kind = residual_kinds_[ids[i]];
+    if (rms[i] <= thresholds[kind]) {
+      continue;
+    }
+    problem_.RemoveResidualBlock(ids[i]);
+    residual_kinds_.erase(ids[i]);
+    ++summary.num_removed[kind];
+  }
+  int num_removed_imu = 0;
+  for (int kind = ACCELEROMETER_RESIDUAL; kind < NUM_SPLINE_RESIDUAL_KINDS;
+       ++kind) {
+    num_removed_imu += summary.num_removed[kind];
+  }
+  LOG(INFO) << "Outlier gating removed " << summary.num_removed[CAMERA_RESIDUAL]
+            << " camera and " << num_removed_imu << " IMU residual blocks of "
+            << summary.num_evaluated;
+  return summary;
+}
+
 template <int _T>
 void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses() {
   so3_knots_ = OpenICC::so3_vector(nr_knots_so3_);
@@ -287,9 +1078,9 @@ void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses() {
   OpenICC::vec3_map translations_map;
 
   // get sorted poses
-  const auto view_ids = image_data_.ViewIds();
+  const auto view_ids = image_data_->ViewIds();
   for (const auto& vid : view_ids) {
-    const auto* v = image_data_.View(vid);
+    const auto* v = image_data_->View(vid);
     const double t_s = v->GetTimestamp();
     const auto q_w_c = Eigen::Quaterniond(
         v->Camera().GetOrientationAsRotationMatrix().transpose());
@@ -339,82 +1130,320 @@ void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses() {
 }
 
 template <int _T>
-bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurement(
-    const Eigen::Vector3d& meas,
-    const int64_t time_ns,
-    const double weight_se3) {
-  double u_r3, u_so3, u_bias;
-  int64_t s_r3, s_so3, s_bias;
-  if (!CalcR3Times(time_ns, u_r3, s_r3)) {
+bool SplineTrajectoryEstimator<_T>::FitKnotsToVisPoses(
+    const KnotFitOptions& options,
+    const std::vector<int64_t>& gyro_times_ns,
+    const vec3_vector& gyro_measurements,
+    const double gyro_std) {
+  using JacobianHelper = So3SplineJacobianHelper<_T>;
+  using VecN = Eigen::Matrix<double, _T, 1>;
+
+  std::vector<SampleTimes> vis_times;
+  std::vector<Sophus::SE3d> vis_T_w_i;
+  for (const auto& vid : image_data_->ViewIds()) {
+    const auto* v = image_data_->View(vid);
+    SampleTimes times;
+    const int64_t t_ns = SecondsToNs(v->GetTimestamp());
+    if (!CalcSO3Times(t_ns, times.u_so3, times.s_so3) ||
+        !CalcR3Times(t_ns, times.u_r3, times.s_r3)) {
+      continue;
+    }
+    const auto q_w_c = Eigen::Quaterniond(
+        v->Camera().GetOrientationAsRotationMatrix().transpose());
+    const Sophus::SE3d T_w_c(q_w_c, v->Camera().GetPosition());
+    vis_times.push_back(times);
+    vis_T_w_i.push_back(T_w_c * T_i_c_.inverse());
+  }
+  if (vis_times.empty()) {
+    LOG(ERROR) << "No vision pose inside the spline to fit the knots to";
+    return false;
+  }
+
+  // R3: the spline is linear in the knots, one solve for the update
+  utils::BandedLeastSquares r3_ls(3 * r3_knots_.size(), 3 * _T - 1);
+  Eigen::MatrixXd J(3, 3 * _T);
+  for (size_t j = 0; j < vis_times.size(); ++j) {
+    VecN coeff;
+    CeresSplineHelper<double, _T>::template computeCoeffs<0, false>(
+        vis_times[j].u_r3, inv_r3_dt_, coeff);
+    Eigen::Vector3d r = -vis_T_w_i[j].translation();
+    for (int i = 0; i < _T; ++i) {
+      r += coeff[i] * r3_knots_[vis_times[j].s_r3 + i];
+      J.middleCols<3>(3 * i) = coeff[i] * Eigen::Matrix3d::Identity();
+    }
+    r3_ls.AddResidualBlock(
+        3 * vis_times[j].s_r3, J, r, 1. / options.vision_std_r3);
+  }
+  r3_ls.AddDamping(options.damping);
+  Eigen::VectorXd dx;
+  if (!r3_ls.Solve(dx)) {
+    LOG(ERROR) << "R3 knot fit failed";
+    return false;
+  }
+  for (size_t i = 0; i < r3_knots_.size(); ++i) {
+    r3_knots_[i] += dx.segment<3>(3 * i);
+  }
+
+  // SO3: Gauss-Newton on the right perturbations of the knots
+  std::vector<SampleTimes> gyro_times;
+  vec3_vector gyro_calibrated;
+  const int stride = std::max(options.gyro_stride, 1);
+  for (size_t j = 0; j < gyro_times_ns.size(); j += stride) {
+    SampleTimes times;
+    if (!CalcSO3Times(gyro_times_ns[j], times.u_so3, times.s_so3)) {
+      continue;
+    }
+    gyro_times.push_back(times);
+    gyro_calibrated.push_back(GetGyroIntrinsics(gyro_times_ns[j])
+                                  .UnbiasNormalize(gyro_measurements[j]));
+  }
+
+  utils::BandedLeastSquares so3_ls(3 * so3_knots_.size(), 3 * _T - 1);
+  const auto linearize = [&]() {
+    so3_ls.SetZero();
+    typename JacobianHelper::Mat3J d_val_d_knot[_T];
+    const double* knots[_T];
+    VecN coeff, dcoeff;
+    for (size_t j = 0; j < vis_times.size(); ++j) {
+      const int64_t s = vis_times[j].s_so3;
+      for (int i = 0; i < _T; ++i) knots[i] = so3_knots_[s + i].data();
+      CeresSplineHelper<double, _T>::template computeCoeffs<0, true>(
+          vis_times[j].u_so3, inv_so3_dt_, coeff);
+      Sophus::SO3d rot;
+      JacobianHelper::EvaluateRotation(knots, coeff, &rot, d_val_d_knot);
+      const Eigen::Vector3d r =
+          Sophus::so3_log_fast(vis_T_w_i[j].so3().inverse() * rot);
+      Eigen::Matrix3d Jr_inv;
+      Sophus::rightJacobianInvSO3(r, Jr_inv);
+      for (int i = 0; i < _T; ++i) {
+        J.middleCols<3>(3 * i) = Jr_inv * d_val_d_knot[i];
+      }
+      so3_ls.AddResidualBlock(3 * s, J, r, 1. / options.vision_std_so3);
+    }
+    for (size_t j = 0; j < gyro_times.size(); ++j) {
+      const int64_t s = gyro_times[j].s_so3;
+      for (int i = 0; i < _T; ++i) knots[i] = so3_knots_[s + i].data();
+      CeresSplineHelper<double, _T>::template computeCoeffs<0, true>(
+          gyro_times[j].u_so3, inv_so3_dt_, coeff);
+      CeresSplineHelper<double, _T>::template computeCoeffs<1, true>(
+          gyro_times[j].u_so3, inv_so3_dt_, dcoeff);
+      Eigen::Vector3d rot_vel;
+      JacobianHelper::EvaluateVelocity(
+          knots, coeff, dcoeff, &rot_vel, d_val_d_knot);
+      for (int i = 0; i < _T; ++i) {
+        J.middleCols<3>(3 * i) = d_val_d_knot[i];
+      }
+      so3_ls.AddResidualBlock(
+          3 * s, J, rot_vel - gyro_calibrated[j], 1. / gyro_std);
+    }
+    return so3_ls.Cost();
+  };
+
+  const double initial_cost = linearize();
+  double cost = initial_cost;
+  for (int it = 0; it < options.so3_iterations; ++it) {
+    so3_ls.AddDamping(options.damping);
+    if (!so3_ls.Solve(dx)) {
+      LOG(ERROR) << "SO3 knot fit failed";
+      return false;
+    }
+    const OpenICC::so3_vector so3_knots_before = so3_knots_;
+    for (size_t i = 0; i < so3_knots_.size(); ++i) {
+      so3_knots_[i] *= Sophus::so3_exp_fast(dx.segment<3>(3 * i));
+    }
+    const double new_cost = linearize();
+    if (new_cost > cost) {
+      so3_knots_ = so3_knots_before;
+      break;
+    }
+    cost = new_cost;
+  }
+  LOG(INFO) << "Fitted knots to " << vis_times.size() << " vision poses and "
+            << gyro_times.size() << " gyroscope samples. Initial R3 cost: "
+            << r3_ls.Cost() << " SO3 cost: " << initial_cost << " -> "
+            << cost;
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CalcAccelerometerTimes(
+    const int64_t time_ns, SampleTimes& times) {
+  if (!CalcR3Times(time_ns, times.u_r3, times.s_r3)) {
     LOG(INFO) << "Wrong time adding r3 accelerometer measurements. time_ns: "
-              << time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+              << time_ns << " u_r3: " << times.u_r3 << " s_r3:" << times.s_r3;
     return false;
   }
-  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
+  if (!CalcSO3Times(time_ns, times.u_so3, times.s_so3)) {
     LOG(INFO) << "Wrong time adding so3 accelerometer measurements. time_ns: "
-              << time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+              << time_ns << " u_r3: " << times.u_r3 << " s_r3:" << times.s_r3;
     return false;
   }
-  if (!CalcTimes(time_ns,
-                 u_bias,
-                 s_bias,
-                 dt_accl_bias_ns_,
-                 nr_knots_accl_bias_,
-                 BIAS_SPLINE_N)) {
+  if (!CalcBiasTimes(time_ns,
+                     times.u_bias,
+                     times.s_bias,
+                     dt_accl_bias_ns_,
+                     nr_knots_accl_bias_,
+                     constant_accl_bias_)) {
     LOG(INFO) << "Wrong time adding accelerometer bias measurements. time_ns: "
-              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+              << time_ns << " u_r3: " << times.u_bias
+              << " s_r3:" << times.s_bias;
     return false;
   }
+  return true;
+}
 
-  using FunctorT = AccelerationCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(meas,
-                                   u_r3,
-                                   inv_r3_dt_,
-                                   u_so3,
-                                   inv_so3_dt_,
-                                   weight_se3,
-                                   u_bias,
-                                   inv_accl_bias_dt_);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CalcGyroscopeTimes(const int64_t time_ns,
+                                                       SampleTimes& times) {
+  if (!CalcSO3Times(time_ns, times.u_so3, times.s_so3)) {
+    LOG(INFO) << "Wrong time adding so3 gyroscope measurements. time_ns: "
+              << time_ns << " u_r3: " << times.u_so3
+              << " s_r3:" << times.s_so3;
+    return false;
+  }
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  if (!CalcBiasTimes(time_ns,
+                     times.u_bias,
+                     times.s_bias,
+                     dt_gyro_bias_ns_,
+                     nr_knots_gyro_bias_,
+                     constant_gyro_bias_)) {
+    LOG(INFO) << "Wrong time adding so3 gyroscope bias measurements. time_ns: "
+              << time_ns << " u_r3: " << times.u_bias
+              << " s_r3:" << times.s_bias;
+    return false;
+  }
+  return true;
+}
 
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::AccelerometerParameters(
+    const SampleTimes& times) {
   std::vector<double*> vec;
   // so3 spline
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    vec.emplace_back(SO3KnotBlock(times.s_so3 + i));
   }
 
   // R3 spline
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
+    vec.emplace_back(R3KnotBlock(times.s_r3 + i));
   }
 
   // bias spline
-  for (int i = 0; i < BIAS_SPLINE_N; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_bias + i;
-    vec.emplace_back(accl_bias_spline_[t].data());
+  for (int i = 0; i < NumBiasBlocks(constant_accl_bias_); i++) {
+    vec.emplace_back(AcclBiasBlock(times.s_bias + i));
   }
 
   // gravity
-  cost_function->AddParameterBlock(3);
   vec.emplace_back(gravity_.data());
 
   // imu intrinsics and bias
-  cost_function->AddParameterBlock(6);
   vec.emplace_back(accl_intrinsics_.data());
+  return vec;
+}
+
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::GyroscopeParameters(
+    const SampleTimes& times) {
+  // SO3 spline
+  std::vector<double*> vec;
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(SO3KnotBlock(times.s_so3 + i));
+  }
+  // bias spline
+  for (int i = 0; i < NumBiasBlocks(constant_gyro_bias_); ++i) {
+    vec.emplace_back(GyroBiasBlock(times.s_bias + i));
+  }
+  // intrinsics
+  vec.emplace_back(gyro_intrinsics_.data());
+  return vec;
+}
 
+template <int _T>
+template <class FunctorT>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateAccelerometerAutoDiffCostFunction(
+    FunctorT* functor, const int num_samples) {
+  using CostFunctionT = ceres::DynamicAutoDiffCostFunction<FunctorT>;
+  CostFunctionT* cost_function = cost_function_arena_.Create<CostFunctionT>(
+      functor, ceres::DO_NOT_TAKE_OWNERSHIP);
+  // so3 spline
+  for (int i = 0; i < N_; i++) {
+    cost_function->AddParameterBlock(4);
+  }
+  // r3 spline, bias spline and gravity
+  for (int i = 0; i < N_ + NumBiasBlocks(constant_accl_bias_) + 1; i++) {
+    cost_function->AddParameterBlock(3);
+  }
+  // imu intrinsics
+  cost_function->AddParameterBlock(6);
   // number of residuals
-  cost_function->SetNumResiduals(3);
+  cost_function->SetNumResiduals(3 * num_samples);
+  return cost_function;
+}
+
+template <int _T>
+template <class FunctorT>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateGyroscopeAutoDiffCostFunction(
+    FunctorT* functor, const int num_samples) {
+  using CostFunctionT = ceres::DynamicAutoDiffCostFunction<FunctorT>;
+  CostFunctionT* cost_function = cost_function_arena_.Create<CostFunctionT>(
+      functor, ceres::DO_NOT_TAKE_OWNERSHIP);
+  // so3 spline
+  for (int i = 0; i < N_; i++) {
+    cost_function->AddParameterBlock(4);
+  }
+  // bias spline
+  for (int i = 0; i < NumBiasBlocks(constant_gyro_bias_); ++i) {
+    cost_function->AddParameterBlock(3);
+  }
+  // intrinsics
+  cost_function->AddParameterBlock(9);
+  cost_function->SetNumResiduals(3 * num_samples);
+  return cost_function;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurement(
+    const Eigen::Vector3d& meas,
+    const int64_t time_ns,
+    const double weight_se3) {
+  SampleTimes times;
+  if (!CalcAccelerometerTimes(time_ns, times)) {
+    return false;
+  }
+
+  ceres::CostFunction* cost_function = nullptr;
+  if (use_analytic_imu_jacobians_) {
+    const vec3_vector sample_meas(1, meas);
+    const std::vector<SampleTimes> sample_times(1, times);
+    cost_function =
+        float_imu_jacobians_
+            ? CreateAnalyticAccelerometerCostFunction<float>(
+                  sample_meas, sample_times, 0, 1, weight_se3)
+            : CreateAnalyticAccelerometerCostFunction<double>(
+                  sample_meas, sample_times, 0, 1, weight_se3);
+  } else {
+    using FunctorT = AccelerationCostFunctorSplit<N_>;
+    FunctorT* functor = cost_function_arena_.Create<FunctorT>(
+        meas,
+        times.u_r3,
+        inv_r3_dt_,
+        times.u_so3,
+        inv_so3_dt_,
+        weight_se3,
+        times.u_bias,
+        inv_accl_bias_dt_,
+        NumBiasBlocks(constant_accl_bias_));
+    cost_function = CreateAccelerometerAutoDiffCostFunction(functor, 1);
+  }
 
-  problem_.AddResidualBlock(cost_function, NULL, vec);
+  AddResidualBlock(ACCELEROMETER_RESIDUAL,
+                   cost_function,
+                   NULL,
+                   AccelerometerParameters(times));
 
   return true;
 }
@@ -424,182 +1453,1021 @@ bool SplineTrajectoryEstimator<_T>::AddGyroscopeMeasurement(
     const Eigen::Vector3d& meas,
     const int64_t time_ns,
     const double weight_so3) {
-  double u_so3, u_bias;
-  int64_t s_so3, s_bias;
-  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
-    LOG(INFO) << "Wrong time adding so3 gyroscope measurements. time_ns: "
-              << time_ns << " u_r3: " << u_so3 << " s_r3:" << s_so3;
+  SampleTimes times;
+  if (!CalcGyroscopeTimes(time_ns, times)) {
     return false;
   }
 
-  if (!CalcTimes(time_ns,
-                 u_bias,
-                 s_bias,
-                 dt_gyro_bias_ns_,
-                 nr_knots_gyro_bias_,
-                 BIAS_SPLINE_N)) {
-    LOG(INFO) << "Wrong time adding so3 gyroscope bias measurements. time_ns: "
-              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+  ceres::CostFunction* cost_function = nullptr;
+  if (use_analytic_imu_jacobians_) {
+    const vec3_vector sample_meas(1, meas);
+    const std::vector<SampleTimes> sample_times(1, times);
+    cost_function =
+        float_imu_jacobians_
+            ? CreateAnalyticGyroscopeCostFunction<float>(
+                  sample_meas, sample_times, 0, 1, weight_so3)
+            : CreateAnalyticGyroscopeCostFunction<double>(
+                  sample_meas, sample_times, 0, 1, weight_so3);
+  } else {
+    using FunctorT = GyroCostFunctorSplit<N_, Sophus::SO3, false>;
+    FunctorT* functor = cost_function_arena_.Create<FunctorT>(
+        meas,
+        times.u_so3,
+        inv_so3_dt_,
+        weight_so3,
+        times.u_bias,
+        inv_gyro_bias_dt_,
+        NumBiasBlocks(constant_gyro_bias_));
+    cost_function = CreateGyroscopeAutoDiffCostFunction(functor, 1);
+  }
+
+  AddResidualBlock(
+      GYROSCOPE_RESIDUAL, cost_function, NULL, GyroscopeParameters(times));
+
+  return true;
+}
+
+template <int _T>
+template <typename JacScalar>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateAnalyticAccelerometerCostFunction(
+    const vec3_vector& meas,
+    const std::vector<SampleTimes>& times,
+    const size_t first,
+    const size_t last,
+    const double weight_se3) const {
+  using SampleCostFunctionT =
+      AccelerationCostFunctionSplitAnalytic<N_, JacScalar>;
+  const int num_bias_blocks = NumBiasBlocks(constant_accl_bias_);
+  std::vector<SampleCostFunctionT*> samples;
+  for (size_t i = first; i < last; ++i) {
+    samples.push_back(
+        cost_function_arena_.Create<SampleCostFunctionT>(meas[i],
+                                                         times[i].u_r3,
+                                                         inv_r3_dt_,
+                                                         times[i].u_so3,
+                                                         inv_so3_dt_,
+                                                         weight_se3,
+                                                         times[i].u_bias,
+                                                         inv_accl_bias_dt_,
+                                                         num_bias_blocks));
+    samples.back()->knot_cache = so3_knot_cache_.get();
+    samples.back()->s_so3 = times[i].s_so3;
+  }
+  if (samples.size() == 1) {
+    return samples[0];
+  }
+  return cost_function_arena_
+      .Create<ImuBatchCostFunctionSplitAnalytic<SampleCostFunctionT>>(
+          std::move(samples));
+}
+
+template <int _T>
+template <typename JacScalar>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateAnalyticGyroscopeCostFunction(
+    const vec3_vector& meas,
+    const std::vector<SampleTimes>& times,
+    const size_t first,
+    const size_t last,
+    const double weight_so3) const {
+  using SampleCostFunctionT = GyroCostFunctionSplitAnalytic<N_, JacScalar>;
+  const int num_bias_blocks = NumBiasBlocks(constant_gyro_bias_);
+  std::vector<SampleCostFunctionT*> samples;
+  for (size_t i = first; i < last; ++i) {
+    samples.push_back(
+        cost_function_arena_.Create<SampleCostFunctionT>(meas[i],
+                                                         times[i].u_so3,
+                                                         inv_so3_dt_,
+                                                         weight_so3,
+                                                         times[i].u_bias,
+                                                         inv_gyro_bias_dt_,
+                                                         num_bias_blocks));
+    samples.back()->knot_cache = so3_knot_cache_.get();
+    samples.back()->s_so3 = times[i].s_so3;
+  }
+  if (samples.size() == 1) {
+    return samples[0];
+  }
+  return cost_function_arena_
+      .Create<ImuBatchCostFunctionSplitAnalytic<SampleCostFunctionT>>(
+          std::move(samples));
+}
+
+template <int _T>
+template <class SameGroup>
+std::vector<std::pair<size_t, size_t>>
+SplineTrajectoryEstimator<_T>::GroupSamples(const std::vector<char>& valid,
+                                            SameGroup&& same_group) {
+  std::vector<std::pair<size_t, size_t>> groups;
+  size_t start = 0;
+  while (start < valid.size()) {
+    if (!valid[start]) {
+      ++start;
+      continue;
+    }
+    size_t end = start + 1;
+    while (end < valid.size() && valid[end] && same_group(start, end)) {
+      ++end;
+    }
+    groups.emplace_back(start, end);
+    start = end;
+  }
+  return groups;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurements(
+    const vec3_vector& meas,
+    const std::vector<int64_t>& times_ns,
+    const double weight_se3) {
+  if (meas.size() != times_ns.size()) {
+    LOG(ERROR) << "Number of accelerometer measurements and timestamps differ.";
     return false;
   }
 
-  using FunctorT = GyroCostFunctorSplit<N_, Sophus::SO3, false>;
-  FunctorT* functor = new FunctorT(
-      meas, u_so3, inv_so3_dt_, weight_so3, u_bias, inv_gyro_bias_dt_);
+  // char instead of bool, the flags are written from several threads
+  std::vector<SampleTimes> times(meas.size());
+  std::vector<char> valid(meas.size());
+  utils::ParallelFor(
+      meas.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          valid[i] = CalcAccelerometerTimes(times_ns[i], times[i]);
+        }
+      });
+  const bool all_valid =
+      std::find(valid.begin(), valid.end(), 0) == valid.end();
+
+  // consecutive samples share a residual block as long as they depend on
+  // the same so3, r3 and bias knots
+  const auto groups = GroupSamples(valid, [&](size_t first, size_t i) {
+    return times[i].s_so3 == times[first].s_so3 &&
+           times[i].s_r3 == times[first].s_r3 &&
+           times[i].s_bias == times[first].s_bias;
+  });
+
+  using SampleFunctorT = AccelerationCostFunctorSplit<N_>;
+
+  // build the cost functions in parallel, only adding them is serial
+  std::vector<ceres::CostFunction*> cost_functions(groups.size());
+  utils::ParallelFor(
+      groups.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t g = begin; g < end; ++g) {
+          const size_t first = groups[g].first;
+          const size_t last = groups[g].second;
+          if (use_analytic_imu_jacobians_) {
+            cost_functions[g] =
+                float_imu_jacobians_
+                    ? CreateAnalyticAccelerometerCostFunction<float>(
+                          meas, times, first, last, weight_se3)
+                    : CreateAnalyticAccelerometerCostFunction<double>(
+                          meas, times, first, last, weight_se3);
+          } else {
+            std::vector<SampleFunctorT> samples;
+            for (size_t i = first; i < last; ++i) {
+              samples.emplace_back(meas[i],
+                                   times[i].u_r3,
+                                   inv_r3_dt_,
+                                   times[i].u_so3,
+                                   inv_so3_dt_,
+                                   weight_se3,
+                                   times[i].u_bias,
+                                   inv_accl_bias_dt_,
+                                   NumBiasBlocks(constant_accl_bias_));
+            }
+            cost_functions[g] = CreateAccelerometerAutoDiffCostFunction(
+                cost_function_arena_
+                    .Create<ImuBatchCostFunctorSplit<SampleFunctorT>>(
+                        std::move(samples)),
+                last - first);
+          }
+        }
+      });
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  for (size_t g = 0; g < groups.size(); ++g) {
+    AddResidualBlock(ACCELEROMETER_RESIDUAL,
+                     cost_functions[g],
+                     NULL,
+                     AccelerometerParameters(times[groups[g].first]));
+  }
 
-  // SO3 spline
+  return all_valid;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddGyroscopeMeasurements(
+    const vec3_vector& meas,
+    const std::vector<int64_t>& times_ns,
+    const double weight_so3) {
+  if (meas.size() != times_ns.size()) {
+    LOG(ERROR) << "Number of gyroscope measurements and timestamps differ.";
+    return false;
+  }
+
+  // char instead of bool, the flags are written from several threads
+  std::vector<SampleTimes> times(meas.size());
+  std::vector<char> valid(meas.size());
+  utils::ParallelFor(
+      meas.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          valid[i] = CalcGyroscopeTimes(times_ns[i], times[i]);
+        }
+      });
+  const bool all_valid =
+      std::find(valid.begin(), valid.end(), 0) == valid.end();
+
+  // consecutive samples share a residual block as long as they depend on
+  // the same so3 and bias knots
+  const auto groups = GroupSamples(valid, [&](size_t first, size_t i) {
+    return times[i].s_so3 == times[first].s_so3 &&
+           times[i].s_bias == times[first].s_bias;
+  });
+
+  using SampleFunctorT = GyroCostFunctorSplit<N_, Sophus::SO3, false>;
+
+  // build the cost functions in parallel, only adding them is serial
+  std::vector<ceres::CostFunction*> cost_functions(groups.size());
+  utils::ParallelFor(
+      groups.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t g = begin; g < end; ++g) {
+          const size_t first = groups[g].first;
+          const size_t last = groups[g].second;
+          if (use_analytic_imu_jacobians_) {
+            cost_functions[g] =
+                float_imu_jacobians_
+                    ? CreateAnalyticGyroscopeCostFunction<float>(
+                          meas, times, first, last, weight_so3)
+                    : CreateAnalyticGyroscopeCostFunction<double>(
+                          meas, times, first, last, weight_so3);
+          } else {
+            std::vector<SampleFunctorT> samples;
+            for (size_t i = first; i < last; ++i) {
+              samples.emplace_back(meas[i],
+                                   times[i].u_so3,
+                                   inv_so3_dt_,
+                                   weight_so3,
+                                   times[i].u_bias,
+                                   inv_gyro_bias_dt_,
+                                   NumBiasBlocks(constant_gyro_bias_));
+            }
+            cost_functions[g] = CreateGyroscopeAutoDiffCostFunction(
+                cost_function_arena_
+                    .Create<ImuBatchCostFunctorSplit<SampleFunctorT>>(
+                        std::move(samples)),
+                last - first);
+          }
+        }
+      });
+
+  for (size_t g = 0; g < groups.size(); ++g) {
+    AddResidualBlock(GYROSCOPE_RESIDUAL,
+                     cost_functions[g],
+                     NULL,
+                     GyroscopeParameters(times[groups[g].first]));
+  }
+
+  return all_valid;
+}
+
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::ImuPreintegrationParameters(
+    const SampleTimes& accl_times, const SampleTimes& gyro_times) {
   std::vector<double*> vec;
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(SO3KnotBlock(accl_times.s_so3 + i));
+  }
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(R3KnotBlock(accl_times.s_r3 + i));
+  }
+  for (int i = 0; i < NumBiasBlocks(constant_gyro_bias_); ++i) {
+    vec.emplace_back(GyroBiasBlock(gyro_times.s_bias + i));
+  }
+  for (int i = 0; i < NumBiasBlocks(constant_accl_bias_); ++i) {
+    vec.emplace_back(AcclBiasBlock(accl_times.s_bias + i));
+  }
+  vec.emplace_back(gravity_.data());
+  return vec;
+}
+
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::ImuParameters(
+    const SampleTimes& accl_times, const SampleTimes& gyro_times) {
+  // so3, r3, gyro bias, accl bias and gravity
+  std::vector<double*> vec =
+      ImuPreintegrationParameters(accl_times, gyro_times);
+  vec.emplace_back(gyro_intrinsics_.data());
+  vec.emplace_back(accl_intrinsics_.data());
+  return vec;
+}
+
+template <int _T>
+template <class FunctorT>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateImuAutoDiffCostFunction(
+    FunctorT* functor, const int num_samples) {
+  using CostFunctionT = ceres::DynamicAutoDiffCostFunction<FunctorT>;
+  CostFunctionT* cost_function = cost_function_arena_.Create<CostFunctionT>(
+      functor, ceres::DO_NOT_TAKE_OWNERSHIP);
+  // so3 spline
   for (int i = 0; i < N_; i++) {
     cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
   }
-  // bias spline
-  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+  // r3 spline, gyro and accl bias spline and gravity
+  const int num_bias_blocks =
+      NumBiasBlocks(constant_gyro_bias_) + NumBiasBlocks(constant_accl_bias_);
+  for (int i = 0; i < N_ + num_bias_blocks + 1; i++) {
     cost_function->AddParameterBlock(3);
-    const int t = s_bias + i;
-    vec.emplace_back(gyro_bias_spline_[t].data());
   }
-  // intrinsics
+  // gyro and accl intrinsics
   cost_function->AddParameterBlock(9);
-  vec.emplace_back(gyro_intrinsics_.data());
+  cost_function->AddParameterBlock(6);
+  cost_function->SetNumResiduals(6 * num_samples);
+  return cost_function;
+}
+
+template <int _T>
+template <typename JacScalar>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateAnalyticImuCostFunction(
+    const vec3_vector& accl_meas,
+    const vec3_vector& gyro_meas,
+    const std::vector<SampleTimes>& accl_times,
+    const std::vector<SampleTimes>& gyro_times,
+    const size_t first,
+    const size_t last,
+    const double weight_so3,
+    const double weight_se3) const {
+  using SampleCostFunctionT = ImuCostFunctionSplitAnalytic<N_, JacScalar>;
+  const int num_gyro_bias_blocks = NumBiasBlocks(constant_gyro_bias_);
+  const int num_accl_bias_blocks = NumBiasBlocks(constant_accl_bias_);
+  std::vector<SampleCostFunctionT*> samples;
+  for (size_t i = first; i < last; ++i) {
+    samples.push_back(
+        cost_function_arena_.Create<SampleCostFunctionT>(accl_meas[i],
+                                                         gyro_meas[i],
+                                                         accl_times[i].u_so3,
+                                                         inv_so3_dt_,
+                                                         accl_times[i].u_r3,
+                                                         inv_r3_dt_,
+                                                         gyro_times[i].u_bias,
+                                                         inv_gyro_bias_dt_,
+                                                         accl_times[i].u_bias,
+                                                         inv_accl_bias_dt_,
+                                                         weight_so3,
+                                                         weight_se3,
+                                                         num_gyro_bias_blocks,
+                                                         num_accl_bias_blocks));
+    samples.back()->knot_cache = so3_knot_cache_.get();
+    samples.back()->s_so3 = accl_times[i].s_so3;
+  }
+  if (samples.size() == 1) {
+    return samples[0];
+  }
+  return cost_function_arena_
+      .Create<ImuBatchCostFunctionSplitAnalytic<SampleCostFunctionT>>(
+          std::move(samples));
+}
+
+template <int _T>
+ceres::CostFunction* SplineTrajectoryEstimator<_T>::CreateImuCostFunction(
+    const vec3_vector& accl_meas,
+    const vec3_vector& gyro_meas,
+    const std::vector<SampleTimes>& accl_times,
+    const std::vector<SampleTimes>& gyro_times,
+    const size_t first,
+    const size_t last,
+    const double weight_so3,
+    const double weight_se3) {
+  if (use_analytic_imu_jacobians_) {
+    return float_imu_jacobians_
+               ? CreateAnalyticImuCostFunction<float>(accl_meas,
+                                                      gyro_meas,
+                                                      accl_times,
+                                                      gyro_times,
+                                                      first,
+                                                      last,
+                                                      weight_so3,
+                                                      weight_se3)
+               : CreateAnalyticImuCostFunction<double>(accl_meas,
+                                                       gyro_meas,
+                                                       accl_times,
+                                                       gyro_times,
+                                                       first,
+                                                       last,
+                                                       weight_so3,
+                                                       weight_se3);
+  }
+
+  using SampleFunctorT = ImuCostFunctorSplit<N_>;
+  std::vector<SampleFunctorT> samples;
+  for (size_t i = first; i < last; ++i) {
+    samples.emplace_back(accl_meas[i],
+                         gyro_meas[i],
+                         accl_times[i].u_so3,
+                         inv_so3_dt_,
+                         accl_times[i].u_r3,
+                         inv_r3_dt_,
+                         gyro_times[i].u_bias,
+                         inv_gyro_bias_dt_,
+                         accl_times[i].u_bias,
+                         inv_accl_bias_dt_,
+                         weight_so3,
+                         weight_se3,
+                         NumBiasBlocks(constant_gyro_bias_),
+                         NumBiasBlocks(constant_accl_bias_));
+  }
+  if (samples.size() == 1) {
+    return CreateImuAutoDiffCostFunction(
+        cost_function_arena_.Create<SampleFunctorT>(samples[0]), 1);
+  }
+  return CreateImuAutoDiffCostFunction(
+      cost_function_arena_.Create<ImuBatchCostFunctorSplit<SampleFunctorT>>(
+          std::move(samples)),
+      last - first);
+}
 
-  cost_function->SetNumResiduals(3);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddImuMeasurement(
+    const Eigen::Vector3d& accl_meas,
+    const Eigen::Vector3d& gyro_meas,
+    const int64_t time_ns,
+    const double weight_so3,
+    const double weight_se3) {
+  std::vector<SampleTimes> accl_times(1), gyro_times(1);
+  if (!CalcAccelerometerTimes(time_ns, accl_times[0]) ||
+      !CalcGyroscopeTimes(time_ns, gyro_times[0])) {
+    return false;
+  }
 
-  problem_.AddResidualBlock(cost_function, NULL, vec);
+  AddResidualBlock(IMU_RESIDUAL,
+                   CreateImuCostFunction(vec3_vector(1, accl_meas),
+                                         vec3_vector(1, gyro_meas),
+                                         accl_times,
+                                         gyro_times,
+                                         0,
+                                         1,
+                                         weight_so3,
+                                         weight_se3),
+                   NULL,
+                   ImuParameters(accl_times[0], gyro_times[0]));
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddImuMeasurements(
+    const vec3_vector& accl_meas,
+    const vec3_vector& gyro_meas,
+    const std::vector<int64_t>& times_ns,
+    const double weight_so3,
+    const double weight_se3) {
+  if (accl_meas.size() != times_ns.size() ||
+      gyro_meas.size() != times_ns.size()) {
+    LOG(ERROR) << "Number of IMU measurements and timestamps differ.";
+    return false;
+  }
+
+  // char instead of bool, the flags are written from several threads
+  std::vector<SampleTimes> accl_times(times_ns.size());
+  std::vector<SampleTimes> gyro_times(times_ns.size());
+  std::vector<char> valid(times_ns.size());
+  utils::ParallelFor(
+      times_ns.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          valid[i] = CalcAccelerometerTimes(times_ns[i], accl_times[i]) &&
+                     CalcGyroscopeTimes(times_ns[i], gyro_times[i]);
+        }
+      });
+  const bool all_valid =
+      std::find(valid.begin(), valid.end(), 0) == valid.end();
+
+  // consecutive samples share a residual block as long as they depend on
+  // the same so3, r3 and bias knots
+  const auto groups = GroupSamples(valid, [&](size_t first, size_t i) {
+    return accl_times[i].s_so3 == accl_times[first].s_so3 &&
+           accl_times[i].s_r3 == accl_times[first].s_r3 &&
+           accl_times[i].s_bias == accl_times[first].s_bias &&
+           gyro_times[i].s_bias == gyro_times[first].s_bias;
+  });
+
+  // build the cost functions in parallel, only adding them is serial
+  std::vector<ceres::CostFunction*> cost_functions(groups.size());
+  utils::ParallelFor(
+      groups.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t g = begin; g < end; ++g) {
+          cost_functions[g] = CreateImuCostFunction(accl_meas,
+                                                    gyro_meas,
+                                                    accl_times,
+                                                    gyro_times,
+                                                    groups[g].first,
+                                                    groups[g].second,
+                                                    weight_so3,
+                                                    weight_se3);
+        }
+      });
+
+  for (size_t g = 0; g < groups.size(); ++g) {
+    const size_t first = groups[g].first;
+    AddResidualBlock(IMU_RESIDUAL,
+                     cost_functions[g],
+                     NULL,
+                     ImuParameters(accl_times[first], gyro_times[first]));
+  }
+
+  return all_valid;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddImuPreintegrationMeasurements(
+    const vec3_vector& accl_meas,
+    const vec3_vector& gyro_meas,
+    const std::vector<int64_t>& times_ns,
+    const double weight_so3,
+    const double weight_se3) {
+  if (accl_meas.size() != times_ns.size() ||
+      gyro_meas.size() != times_ns.size()) {
+    LOG(ERROR) << "Number of IMU measurements and timestamps differ.";
+    return false;
+  }
+
+  // char instead of bool, the flags are written from several threads
+  std::vector<SampleTimes> accl_times(times_ns.size());
+  std::vector<SampleTimes> gyro_times(times_ns.size());
+  std::vector<char> valid(times_ns.size());
+  utils::ParallelFor(
+      times_ns.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          valid[i] = CalcAccelerometerTimes(times_ns[i], accl_times[i]) &&
+                     CalcGyroscopeTimes(times_ns[i], gyro_times[i]);
+        }
+      });
+  bool all_added = std::find(valid.begin(), valid.end(), 0) == valid.end();
+
+  // an interval ends as soon as a sample depends on other so3, r3 or bias
+  // knots. The step from the last sample of one interval to the first
+  // sample of the next one is not integrated.
+  const auto groups = GroupSamples(valid, [&](size_t first, size_t i) {
+    return accl_times[i].s_so3 == accl_times[first].s_so3 &&
+           accl_times[i].s_r3 == accl_times[first].s_r3 &&
+           accl_times[i].s_bias == accl_times[first].s_bias &&
+           gyro_times[i].s_bias == gyro_times[first].s_bias;
+  });
+
+  using FunctorT = ImuPreintegrationCostFunctorSplit<N_>;
+  const int num_gyro_bias_blocks = NumBiasBlocks(constant_gyro_bias_);
+  const int num_accl_bias_blocks = NumBiasBlocks(constant_accl_bias_);
+
+  // integrating the intervals is independent, only adding them is serial
+  std::vector<ceres::CostFunction*> cost_functions(groups.size(), nullptr);
+  std::vector<char> integrated(groups.size(), 1);
+  utils::ParallelFor(
+      groups.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t g = begin; g < end; ++g) {
+          const size_t first = groups[g].first;
+          const size_t last = groups[g].second;
+          if (last - first < 2) {
+            continue;
+          }
+
+          // integrate with the current intrinsics and the biases in the
+          // middle of the interval
+          const int64_t mid_time_ns =
+              (times_ns[first] + times_ns[last - 1]) / 2;
+          SampleTimes accl_mid, gyro_mid;
+          CalcAccelerometerTimes(mid_time_ns, accl_mid);
+          CalcGyroscopeTimes(mid_time_ns, gyro_mid);
+
+          const vec3_vector gyro_interval(gyro_meas.begin() + first,
+                                          gyro_meas.begin() + last);
+          const vec3_vector accl_interval(accl_meas.begin() + first,
+                                          accl_meas.begin() + last);
+          std::vector<double> times_s;
+          for (size_t i = first; i < last; ++i) {
+            times_s.push_back((times_ns[i] - times_ns[first]) * NS_TO_S);
+          }
+
+          OpenICC::utils::ImuPreintegration preintegration;
+          if (!OpenICC::utils::PreintegrateImu(gyro_interval,
+                                               accl_interval,
+                                               times_s,
+                                               GetGyroIntrinsics(mid_time_ns),
+                                               GetAcclIntrinsics(mid_time_ns),
+                                               preintegration)) {
+            integrated[g] = 0;
+            continue;
+          }
+
+          // the noise of the increments grows with the square root of the
+          // number of integration steps
+          const double sqrt_steps =
+              std::sqrt(static_cast<double>(last - first - 1));
+          const double inv_std_rot =
+              weight_so3 * sqrt_steps / preintegration.delta_t_s;
+          const double inv_std_vel =
+              weight_se3 * sqrt_steps / preintegration.delta_t_s;
+
+          FunctorT* functor =
+              cost_function_arena_.Create<FunctorT>(preintegration,
+                                                    accl_times[first].u_so3,
+                                                    accl_times[last - 1].u_so3,
+                                                    inv_so3_dt_,
+                                                    accl_times[first].u_r3,
+                                                    accl_times[last - 1].u_r3,
+                                                    inv_r3_dt_,
+                                                    gyro_mid.u_bias,
+                                                    inv_gyro_bias_dt_,
+                                                    accl_mid.u_bias,
+                                                    inv_accl_bias_dt_,
+                                                    inv_std_rot,
+                                                    inv_std_vel,
+                                                    num_gyro_bias_blocks,
+                                                    num_accl_bias_blocks);
+
+          using CostFunctionT = ceres::DynamicAutoDiffCostFunction<FunctorT>;
+          CostFunctionT* cost_function =
+              cost_function_arena_.Create<CostFunctionT>(
+                  functor, ceres::DO_NOT_TAKE_OWNERSHIP);
+          // so3 spline
+          for (int i = 0; i < N_; i++) {
+            cost_function->AddParameterBlock(4);
+          }
+          // r3 spline, gyro and accl bias spline and gravity
+          for (int i = 0;
+               i < N_ + num_gyro_bias_blocks + num_accl_bias_blocks + 1;
+               i++) {
+            cost_function->AddParameterBlock(3);
+          }
+          cost_function->SetNumResiduals(6);
+          cost_functions[g] = cost_function;
+        }
+      });
+
+  for (size_t g = 0; g < groups.size(); ++g) {
+    if (!integrated[g]) {
+      all_added = false;
+    }
+    if (!cost_functions[g]) {
+      continue;
+    }
+    const size_t first = groups[g].first;
+    AddResidualBlock(
+        IMU_PREINTEGRATION_RESIDUAL,
+        cost_functions[g],
+        NULL,
+        ImuPreintegrationParameters(accl_times[first], gyro_times[first]));
+  }
 
-  return true;
+  return all_added;
 }
 
 template <int _T>
-bool SplineTrajectoryEstimator<_T>::AddGSCameraMeasurement(
-    const theia::View* view, const double robust_loss_width) {
-  const int64_t image_obs_time_ns = view->GetTimestamp() * S_TO_NS;
-  const auto track_ids = view->TrackIds();
-
-  double u_r3 = 0.0, u_so3 = 0.0;
-  int64_t s_r3 = 0, s_so3 = 0;
-  if (!CalcR3Times(image_obs_time_ns, u_r3, s_r3)) {
+bool SplineTrajectoryEstimator<_T>::CalcCameraTimes(const double timestamp_s,
+                                                    SampleTimes& times,
+                                                    const int camera) {
+  const int64_t image_obs_time_ns =
+      SecondsToNs(timestamp_s + Camera(camera).time_offset_s);
+  if (!CalcR3Times(image_obs_time_ns, times.u_r3, times.s_r3)) {
     LOG(INFO) << "Wrong time observation r3 vision measurements. time_ns: "
-              << image_obs_time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+              << image_obs_time_ns << " u_r3: " << times.u_r3
+              << " s_r3:" << times.s_r3;
     return false;
   }
-  if (!CalcSO3Times(image_obs_time_ns, u_so3, s_so3)) {
+  if (!CalcSO3Times(image_obs_time_ns, times.u_so3, times.s_so3)) {
     LOG(INFO) << "Wrong time reference so3 vision measurements. time_ns: "
-              << image_obs_time_ns << " u_r3: " << u_so3 << " s_r3:" << s_so3;
+              << image_obs_time_ns << " u_r3: " << times.u_so3
+              << " s_r3:" << times.s_so3;
     return false;
   }
+  return true;
+}
+
+template <int _T>
+std::vector<typename SplineTrajectoryEstimator<_T>::CameraResidual>
+SplineTrajectoryEstimator<_T>::CreateCameraResiduals(
+    const utils::ObservationStore& store,
+    const size_t view_index,
+    const SampleTimes& times,
+    const bool rolling_shutter) {
+  const utils::ObservationStore::View& view = store.GetView(view_index);
+  const auto track_ids = [&](const size_t first, const size_t num) {
+    std::vector<theia::TrackId> ids(num);
+    for (size_t i = 0; i < num; ++i) {
+      ids[i] = store.GetTrackId(first + i);
+    }
+    return ids;
+  };
+  std::vector<CameraResidual> residuals;
+  if (view.num == 0) {
+    return residuals;
+  }
+  if (camera_residual_layout_ == CameraResidualLayout::VIEW_RESIDUALS) {
+    CameraResidual residual;
+    residual.cost_function = CreateCameraCostFunction(
+        store, view_index, view.first, view.num, times, rolling_shutter);
+    residual.track_ids = track_ids(view.first, view.num);
+    if (residual.cost_function) {
+      residuals.push_back(std::move(residual));
+    }
+    return residuals;
+  }
+
+  const size_t chunk_size =
+      camera_residual_layout_ == CameraResidualLayout::CHUNK_RESIDUALS
+          ? CAMERA_RESIDUAL_CHUNK_SIZE
+          : 1;
+  const size_t end = view.first + view.num;
+  for (size_t first = view.first; first < end;) {
+    CameraResidual residual;
+    if (end - first >= chunk_size && chunk_size > 1) {
+      residual.track_ids = track_ids(first, chunk_size);
+      residual.cost_function =
+          CreateFixedSizeCameraCostFunction<CAMERA_RESIDUAL_CHUNK_SIZE>(
+              store, view_index, first, times, rolling_shutter);
+    } else {
+      residual.track_ids = track_ids(first, 1);
+      residual.cost_function = CreateFixedSizeCameraCostFunction<1>(
+          store, view_index, first, times, rolling_shutter);
+    }
+    if (!residual.cost_function) {
+      // the cost functions created so far stay in the arena until it is
+      // cleared
+      return {};
+    }
+    first += residual.track_ids.size();
+    residuals.push_back(std::move(residual));
+  }
+  return residuals;
+}
 
-  using FunctorT = GSReprojectionCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(
-      view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, track_ids);
+template <int _T>
+ceres::CostFunction* SplineTrajectoryEstimator<_T>::CreateCameraCostFunction(
+    const utils::ObservationStore& store,
+    const size_t view_index,
+    const size_t first,
+    const size_t num,
+    const SampleTimes& times,
+    const bool rolling_shutter) {
+  // resolve the camera model once, the functor is templated on it
+  ceres::CostFunction* cost_function = nullptr;
+  const auto create_cost_function = [&](auto model_tag) {
+    using CameraModel = typename decltype(model_tag)::CameraModel;
+    const auto create = [&](auto&& functor_value) {
+      using FunctorT = std::decay_t<decltype(functor_value)>;
+      FunctorT* functor =
+          cost_function_arena_.Create<FunctorT>(std::move(functor_value));
+      using CostFunctionT = ceres::DynamicAutoDiffCostFunction<FunctorT>;
+      CostFunctionT* autodiff_cost_function =
+          cost_function_arena_.Create<CostFunctionT>(
+              functor, ceres::DO_NOT_TAKE_OWNERSHIP);
+      for (int i = 0; i < N_; i++) {
+        autodiff_cost_function->AddParameterBlock(4);
+      }
+      for (int i = 0; i < N_; i++) {
+        autodiff_cost_function->AddParameterBlock(3);
+      }
+      autodiff_cost_function->AddParameterBlock(7);
+      if (rolling_shutter) {
+        autodiff_cost_function->AddParameterBlock(1);
+      }
+      if (!rigid_board_) {
+        for (size_t i = 0; i < num; ++i) {
+          autodiff_cost_function->AddParameterBlock(4);
+        }
+      }
+      autodiff_cost_function->SetNumResiduals(num * 2);
+      cost_function = autodiff_cost_function;
+    };
+    if (rolling_shutter && linearize_rolling_shutter_) {
+      create(RSLinearizedReprojectionCostFunctorSplit<N_, CameraModel>(
+          store,
+          view_index,
+          first,
+          num,
+          times.u_so3,
+          times.u_r3,
+          inv_so3_dt_,
+          inv_r3_dt_,
+          rigid_board_));
+    } else if (rolling_shutter) {
+      create(RSReprojectionCostFunctorSplit<N_, CameraModel>(
+          store,
+          view_index,
+          first,
+          num,
+          times.u_so3,
+          times.u_r3,
+          inv_so3_dt_,
+          inv_r3_dt_,
+          rigid_board_));
+    } else {
+      create(GSReprojectionCostFunctorSplit<N_, CameraModel>(
+          store,
+          view_index,
+          first,
+          num,
+          times.u_so3,
+          times.u_r3,
+          inv_so3_dt_,
+          inv_r3_dt_,
+          rigid_board_));
+    }
+    return true;
+  };
+  if (!utils::DispatchCameraModel(
+          store.GetView(view_index).camera->GetCameraIntrinsicsModelType(),
+          create_cost_function)) {
+    LOG(ERROR) << "Unsupported camera model for vision measurements.";
+    return nullptr;
+  }
+  return cost_function;
+}
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+template <int _T>
+template <int NUM_FEATURES>
+ceres::CostFunction*
+SplineTrajectoryEstimator<_T>::CreateFixedSizeCameraCostFunction(
+    const utils::ObservationStore& store,
+    const size_t view_index,
+    const size_t first,
+    const SampleTimes& times,
+    const bool rolling_shutter) {
+  ceres::CostFunction* cost_function = nullptr;
+  const auto create_cost_function = [&](auto model_tag) {
+    using CameraModel = typename decltype(model_tag)::CameraModel;
+    // the block sizes depend on the shutter and on the board points being
+    // blocks, both select the cost function type
+    const auto create = [&](auto&& functor_value, auto rolling_shutter_tag) {
+      using FunctorT = std::decay_t<decltype(functor_value)>;
+      constexpr bool kRollingShutter = decltype(rolling_shutter_tag)::value;
+      using AdapterT = FixedSizeFunctorAdapter<FunctorT>;
+      AdapterT* adapter = cost_function_arena_.Create<AdapterT>(
+          cost_function_arena_.Create<FunctorT>(std::move(functor_value)));
+      if (rigid_board_) {
+        using CostFunctionT = FixedSizeReprojectionCostFunction<FunctorT,
+                                                                N_,
+                                                                NUM_FEATURES,
+                                                                kRollingShutter,
+                                                                true>;
+        cost_function = cost_function_arena_.Create<CostFunctionT>(
+            adapter, ceres::DO_NOT_TAKE_OWNERSHIP);
+      } else {
+        using CostFunctionT = FixedSizeReprojectionCostFunction<FunctorT,
+                                                                N_,
+                                                                NUM_FEATURES,
+                                                                kRollingShutter,
+                                                                false>;
+        cost_function = cost_function_arena_.Create<CostFunctionT>(
+            adapter, ceres::DO_NOT_TAKE_OWNERSHIP);
+      }
+    };
+    if (rolling_shutter && linearize_rolling_shutter_) {
+      create(RSLinearizedReprojectionCostFunctorSplit<N_, CameraModel>(
+                 store,
+                 view_index,
+                 first,
+                 NUM_FEATURES,
+                 times.u_so3,
+                 times.u_r3,
+                 inv_so3_dt_,
+                 inv_r3_dt_,
+                 rigid_board_),
+             std::true_type());
+    } else if (rolling_shutter) {
+      create(RSReprojectionCostFunctorSplit<N_, CameraModel>(
+                 store,
+                 view_index,
+                 first,
+                 NUM_FEATURES,
+                 times.u_so3,
+                 times.u_r3,
+                 inv_so3_dt_,
+                 inv_r3_dt_,
+                 rigid_board_),
+             std::true_type());
+    } else {
+      create(GSReprojectionCostFunctorSplit<N_, CameraModel>(
+                 store,
+                 view_index,
+                 first,
+                 NUM_FEATURES,
+                 times.u_so3,
+                 times.u_r3,
+                 inv_so3_dt_,
+                 inv_r3_dt_,
+                 rigid_board_),
+             std::false_type());
+    }
+    return true;
+  };
+  if (!utils::DispatchCameraModel(
+          store.GetView(view_index).camera->GetCameraIntrinsicsModelType(),
+          create_cost_function)) {
+    LOG(ERROR) << "Unsupported camera model for vision measurements.";
+    return nullptr;
+  }
+  return cost_function;
+}
 
+template <int _T>
+std::vector<double*> SplineTrajectoryEstimator<_T>::CameraParameters(
+    const SampleTimes& times,
+    const bool rolling_shutter,
+    const std::vector<theia::TrackId>& track_ids,
+    const int camera) {
+  const CameraBlocks blocks = Camera(camera);
   std::vector<double*> vec;
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    vec.emplace_back(SO3KnotBlock(times.s_so3 + i));
   }
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
+    vec.emplace_back(R3KnotBlock(times.s_r3 + i));
   }
 
   // camera to imu transformation
-  cost_function->AddParameterBlock(7);
-  vec.emplace_back(T_i_c_.data());
+  if (!problem_.HasParameterBlock(blocks.T_i_c)) {
+    problem_.AddParameterBlock(blocks.T_i_c,
+                               Sophus::SE3d::num_parameters,
+                               rotation_only_
+                                   ? se3_rotation_parameterization_.get()
+                                   : se3_parameterization_.get());
+  }
+  vec.emplace_back(blocks.T_i_c);
 
-  // object point
-  for (size_t i = 0; i < track_ids.size(); ++i) {
-    cost_function->AddParameterBlock(4);
-    vec.emplace_back(
-        image_data_.MutableTrack(track_ids[i])->MutablePoint()->data());
-    tracks_in_problem_.insert(track_ids[i]);
+  // line delay for rolling shutter cameras
+  if (rolling_shutter) {
+    vec.emplace_back(blocks.line_delay_s);
   }
 
-  cost_function->SetNumResiduals(track_ids.size() * 2);
+  // object points, constants of the functor on a rigid board
+  if (!rigid_board_) {
+    for (const auto& track_id : track_ids) {
+      vec.emplace_back(PointBlock(track_id, camera));
+    }
+  }
+  return vec;
+}
 
-  ceres::LossFunction* loss_function = new ceres::HuberLoss(robust_loss_width);
-  problem_.AddResidualBlock(cost_function, loss_function, vec);
+template <int _T>
+ceres::LossFunction* SplineTrajectoryEstimator<_T>::HuberLoss(
+    const double width) {
+  // a Huber loss of width 0 would remove the residual from the cost
+  if (width == 0.0) {
+    return nullptr;
+  }
+  std::unique_ptr<ceres::LossFunction>& loss = huber_losses_[width];
+  if (!loss) {
+    loss.reset(new ceres::HuberLoss(width));
+  }
+  return loss.get();
+}
 
-  return true;
+template <int _T>
+void SplineTrajectoryEstimator<_T>::AddCameraResiduals(
+    const std::vector<CameraResidual>& residuals,
+    const SampleTimes& times,
+    const bool rolling_shutter,
+    const double robust_loss_width,
+    const int camera) {
+  for (const CameraResidual& residual : residuals) {
+    AddResidualBlock(
+        CAMERA_RESIDUAL,
+        residual.cost_function,
+        camera_loss_ ? camera_loss_.get() : HuberLoss(robust_loss_width),
+        CameraParameters(times, rolling_shutter, residual.track_ids, camera),
+        rolling_shutter ? "rs_reprojection" : "gs_reprojection");
+  }
 }
 
 template <int _T>
-bool SplineTrajectoryEstimator<_T>::AddRSCameraMeasurement(
+bool SplineTrajectoryEstimator<_T>::AddGSCameraMeasurement(
     const theia::View* view, const double robust_loss_width) {
-  const int64_t image_obs_time_ns = view->GetTimestamp() * S_TO_NS;
-  const auto track_ids = view->TrackIds();
-
-  double u_r3 = 0.0, u_so3 = 0.0;
-  int64_t s_r3 = 0, s_so3 = 0;
-  if (!CalcR3Times(image_obs_time_ns, u_r3, s_r3)) {
-    LOG(INFO) << "Wrong time observation r3 vision measurements. time_ns: "
-              << image_obs_time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+  const int view_index = observations_.ViewIndex(view);
+  SampleTimes times;
+  if (view_index < 0 || !CalcCameraTimes(view->GetTimestamp(), times)) {
     return false;
   }
-  if (!CalcSO3Times(image_obs_time_ns, u_so3, s_so3)) {
-    LOG(INFO) << "Wrong time reference so3 vision measurements. time_ns: "
-              << image_obs_time_ns << " u_r3: " << u_so3 << " s_r3:" << s_so3;
+  const std::vector<CameraResidual> residuals =
+      CreateCameraResiduals(observations_, view_index, times, false);
+  if (residuals.empty()) {
     return false;
   }
+  AddCameraResiduals(residuals, times, false, robust_loss_width);
+  return true;
+}
 
-  using FunctorT = RSReprojectionCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(
-      view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, track_ids);
-
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
-
-  std::vector<double*> vec;
-  for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
-  }
-  for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
-  }
-
-  // camera to imu transformation
-  cost_function->AddParameterBlock(7);
-  vec.emplace_back(T_i_c_.data());
-
-  // line delay for rolling shutter cameras
-  cost_function->AddParameterBlock(1);
-  vec.emplace_back(&cam_line_delay_s_);
-
-  // object point
-  for (size_t i = 0; i < track_ids.size(); ++i) {
-    cost_function->AddParameterBlock(4);
-    vec.emplace_back(
-        image_data_.MutableTrack(track_ids[i])->MutablePoint()->data());
-    tracks_in_problem_.insert(track_ids[i]);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddRSCameraMeasurement(
+    const theia::View* view, const double robust_loss_width) {
+  const int view_index = observations_.ViewIndex(view);
+  SampleTimes times;
+  if (view_index < 0 || !CalcCameraTimes(view->GetTimestamp(), times)) {
+    return false;
   }
-
-  cost_function->SetNumResiduals(track_ids.size() * 2);
-
-  if (robust_loss_width == 0.0) {
-    problem_.AddResidualBlock(cost_function, NULL, vec);
-  } else {
-    ceres::LossFunction* loss_function =
-        new ceres::HuberLoss(robust_loss_width);
-    problem_.AddResidualBlock(cost_function, loss_function, vec);
+  const std::vector<CameraResidual> residuals =
+      CreateCameraResiduals(observations_, view_index, times, true);
+  if (residuals.empty()) {
+    return false;
   }
+  AddCameraResiduals(residuals, times, true, robust_loss_width);
 
   // bound translation
   //  problem_.SetParameterLowerBound(T_i_c_.data(), 4, -1e-2);
@@ -612,6 +2480,45 @@ bool SplineTrajectoryEstimator<_T>::AddRSCameraMeasurement(
   return true;
 }
 
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddCameraMeasurements(
+    const std::vector<const theia::View*>& views,
+    const bool rolling_shutter,
+    const double robust_loss_width,
+    const int camera) {
+  if (camera < 0 || camera >= GetNumCameras()) {
+    LOG(ERROR) << "No camera " << camera << " in the rig.";
+    return false;
+  }
+  const utils::ObservationStore& store = *Camera(camera).observations;
+  // knot times and cost functions only read the spline, so they are built in
+  // parallel. Adding them to the problem stays on this thread.
+  std::vector<SampleTimes> times(views.size());
+  std::vector<std::vector<CameraResidual>> residuals(views.size());
+  utils::ParallelFor(
+      views.size(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          const int view_index = store.ViewIndex(views[i]);
+          if (view_index >= 0 &&
+              CalcCameraTimes(views[i]->GetTimestamp(), times[i], camera)) {
+            residuals[i] = CreateCameraResiduals(
+                store, view_index, times[i], rolling_shutter);
+          }
+        }
+      });
+
+  bool all_added = true;
+  for (size_t i = 0; i < views.size(); ++i) {
+    if (residuals[i].empty()) {
+      all_added = false;
+      continue;
+    }
+    AddCameraResiduals(
+        residuals[i], times[i], rolling_shutter, robust_loss_width, camera);
+  }
+  return all_added;
+}
+
 // template <int _T>
 // bool SplineTrajectoryEstimator<_T>::AddRSInvCameraMeasurement(
 //    const theia::View *view, const double robust_loss_width) {
@@ -766,7 +2673,7 @@ bool SplineTrajectoryEstimator<_T>::CalcTimes(const int64_t sensor_time,
                                               int64_t& s,
                                               int64_t dt_ns,
                                               size_t nr_knots,
-                                              const int N) {
+                                              const int N) const {
   const int64_t st_ns = (sensor_time - start_t_ns_);
 
   if (st_ns < 0.0) {
@@ -787,17 +2694,34 @@ bool SplineTrajectoryEstimator<_T>::CalcTimes(const int64_t sensor_time,
   return true;
 }
 
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CalcBiasTimes(
+    const int64_t sensor_time,
+    double& u,
+    int64_t& s,
+    int64_t dt_ns,
+    size_t nr_knots,
+    const bool constant_bias) const {
+  if (!constant_bias) {
+    return CalcTimes(sensor_time, u, s, dt_ns, nr_knots, BIAS_SPLINE_N);
+  }
+  // every sample reads the single knot of a constant bias
+  u = 0.0;
+  s = 0;
+  return sensor_time >= start_t_ns_;
+}
+
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::CalcSO3Times(const int64_t sensor_time,
                                                  double& u_so3,
-                                                 int64_t& s_so3) {
+                                                 int64_t& s_so3) const {
   return CalcTimes(sensor_time, u_so3, s_so3, dt_so3_ns_, so3_knots_.size());
 }
 
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::CalcR3Times(const int64_t sensor_time,
                                                 double& u_r3,
-                                                int64_t& s_r3) {
+                                                int64_t& s_r3) const {
   return CalcTimes(sensor_time, u_r3, s_r3, dt_r3_ns_, r3_knots_.size());
 }
 
@@ -806,6 +2730,11 @@ Sophus::SE3d SplineTrajectoryEstimator<_T>::GetKnot(int i) const {
   return Sophus::SE3d(so3_knots_[i], r3_knots_[i]);
 }
 
+template <int _T>
+int SplineTrajectoryEstimator<_T>::GetNumResidualBlocks() const {
+  return problem_.NumResidualBlocks();
+}
+
 template <int _T>
 size_t SplineTrajectoryEstimator<_T>::GetNumSO3Knots() const {
   return so3_knots_.size();
@@ -829,7 +2758,14 @@ int64_t SplineTrajectoryEstimator<_T>::GetMinTimeNs() const {
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetImageData(
     const theia::Reconstruction& c) {
-  image_data_ = c;
+  SetImageData(std::make_shared<theia::Reconstruction>(c));
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetImageData(
+    std::shared_ptr<theia::Reconstruction> image_data) {
+  image_data_ = std::move(image_data);
+  observations_.Build(image_data_.get());
   // calculate all reference bearings
   //  const auto track_ids = image_data_.TrackIds();
   //  for (auto t = 0; t < track_ids.size(); ++t) {
@@ -875,6 +2811,42 @@ void SplineTrajectoryEstimator<_T>::SetCameraLineDelay(
   cam_line_delay_s_ = cam_line_delay_s;
 }
 
+template <int _T>
+int SplineTrajectoryEstimator<_T>::AddRigCamera(
+    std::shared_ptr<theia::Reconstruction> image_data,
+    const Sophus::SE3d& T_i_c,
+    const double line_delay_s,
+    const double time_offset_s) {
+  auto rig_camera = std::make_unique<RigCamera>();
+  rig_camera->image_data = std::move(image_data);
+  rig_camera->observations.Build(rig_camera->image_data.get());
+  rig_camera->T_i_c = T_i_c;
+  rig_camera->line_delay_s = line_delay_s;
+  rig_camera->time_offset_s = time_offset_s;
+  rig_cameras_.push_back(std::move(rig_camera));
+  return rig_cameras_.size();
+}
+
+template <int _T>
+typename SplineTrajectoryEstimator<_T>::CameraBlocks
+SplineTrajectoryEstimator<_T>::Camera(const int camera) {
+  if (camera == 0) {
+    return {image_data_.get(),
+            T_i_c_.data(),
+            &cam_line_delay_s_,
+            0.0,
+            &tracks_in_problem_,
+            &observations_};
+  }
+  RigCamera& rig_camera = *rig_cameras_[camera - 1];
+  return {rig_camera.image_data.get(),
+          rig_camera.T_i_c.data(),
+          &rig_camera.line_delay_s,
+          rig_camera.time_offset_s,
+          &rig_camera.tracks_in_problem,
+          &rig_camera.observations};
+}
+
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::GetPosition(const int64_t& time_ns,
                                                 Eigen::Vector3d& position) {
@@ -993,96 +2965,495 @@ bool SplineTrajectoryEstimator<_T>::GetAcceleration(
 }
 
 template <int _T>
-double SplineTrajectoryEstimator<_T>::GetMeanReprojectionError() {
-  // ConvertInvDepthPointsToHom();
-  double sum_error = 0.0;
-  int num_points = 0;
-  for (const auto vid : image_data_.ViewIds()) {
-    const auto* view = image_data_.View(vid);
-    std::vector<theia::TrackId> tracks = view->TrackIds();
-    const size_t nr_obs = tracks.size();
-    if (nr_obs <= 0) {
-      return false;
-    }
+bool SplineTrajectoryEstimator<_T>::EvaluateTrajectory(
+    const std::vector<int64_t>& times_ns,
+    const int flags,
+    TrajectorySamples& samples) const {
+  if (!std::is_sorted(times_ns.begin(), times_ns.end())) {
+    LOG(ERROR) << "Trajectory timestamps have to be sorted.";
+    return false;
+  }
+
+  const size_t num_samples = times_ns.size();
+  samples.valid.assign(num_samples, 0);
+  if (flags & SAMPLE_POSE) {
+    samples.rotation.setZero(num_samples, 4);
+    samples.rotation.col(3).setOnes();
+    samples.position.setZero(num_samples, 3);
+  }
+  if (flags & SAMPLE_ANGULAR_VELOCITY) {
+    samples.angular_velocity.setZero(num_samples, 3);
+  }
+  if (flags & SAMPLE_ACCELERATION) {
+    samples.acceleration.setZero(num_samples, 3);
+  }
+  if (flags & SAMPLE_BIASES) {
+    samples.gyro_bias.setZero(num_samples, 3);
+    samples.accl_bias.setZero(num_samples, 3);
+  }
+
+  utils::ParallelFor(
+      num_samples, num_threads_, [&](size_t begin, size_t end, int) {
+        size_t first = begin;
+        while (first < end) {
+          double u_so3, u_r3;
+          int64_t s_so3, s_r3;
+          if (!CalcSO3Times(times_ns[first], u_so3, s_so3) ||
+              !CalcR3Times(times_ns[first], u_r3, s_r3)) {
+            ++first;
+            continue;
+          }
+          // the following samples share both segments until one of them ends
+          const int64_t segment_end_ns =
+              start_t_ns_ +
+              std::min((s_so3 + 1) * dt_so3_ns_, (s_r3 + 1) * dt_r3_ns_);
+          size_t last = first + 1;
+          while (last < end && times_ns[last] < segment_end_ns) {
+            ++last;
+          }
+          EvaluateTrajectorySegment(
+              times_ns, first, last, s_so3, s_r3, flags, samples);
+          first = last;
+        }
+      });
+  return true;
+}
 
-    const int64_t image_time_ns = view->GetTimestamp() * S_TO_NS;
+template <int _T>
+void SplineTrajectoryEstimator<_T>::EvaluateTrajectorySegment(
+    const std::vector<int64_t>& times_ns,
+    const size_t first,
+    const size_t last,
+    const int64_t s_so3,
+    const int64_t s_r3,
+    const int flags,
+    TrajectorySamples& samples) const {
+  using VecN = Eigen::Matrix<double, N_, 1>;
+  using CoeffMat = Eigen::Matrix<double, Eigen::Dynamic, N_>;
+
+  const int num = last - first;
+  std::fill(samples.valid.begin() + first, samples.valid.begin() + last, 1);
+
+  // the relative rotations between the knots are the same for all samples
+  Eigen::Vector3d delta[DEG_];
+  for (int k = 0; k < DEG_; ++k) {
+    delta[k] = Sophus::so3_log_fast(so3_knots_[s_so3 + k].inverse() *
+                                    so3_knots_[s_so3 + k + 1]);
+  }
+  Eigen::Matrix<double, N_, 3> r3_knots;
+  for (int k = 0; k < N_; ++k) {
+    r3_knots.row(k) = r3_knots_[s_r3 + k].transpose();
+  }
 
-    double u_r3, u_so3;
-    int64_t s_r3, s_so3;
-    if (!CalcR3Times(image_time_ns, u_r3, s_r3)) {
-      return 0.0;
+  const bool need_rotation = flags & (SAMPLE_POSE | SAMPLE_ACCELERATION);
+  const bool need_velocity = flags & SAMPLE_ANGULAR_VELOCITY;
+  const int64_t so3_start_ns = start_t_ns_ + s_so3 * dt_so3_ns_;
+  const int64_t r3_start_ns = start_t_ns_ + s_r3 * dt_r3_ns_;
+
+  CoeffMat pos_coeffs(num, N_), accel_coeffs(num, N_);
+  CoeffMat so3_coeffs(num, N_), so3_dcoeffs(num, N_);
+  for (int j = 0; j < num; ++j) {
+    const int64_t t_ns = times_ns[first + j];
+    const double u_so3 = double(t_ns - so3_start_ns) / double(dt_so3_ns_);
+    const double u_r3 = double(t_ns - r3_start_ns) / double(dt_r3_ns_);
+
+    VecN coeff;
+    if (flags & SAMPLE_POSE) {
+      CeresSplineHelper<double, N_>::template computeCoeffs<0, false>(
+          u_r3, inv_r3_dt_, coeff);
+      pos_coeffs.row(j) = coeff.transpose();
+    }
+    if (flags & SAMPLE_ACCELERATION) {
+      CeresSplineHelper<double, N_>::template computeCoeffs<2, false>(
+          u_r3, inv_r3_dt_, coeff);
+      accel_coeffs.row(j) = coeff.transpose();
     }
-    if (!CalcSO3Times(image_time_ns, u_so3, s_so3)) {
-      return 0.0;
+    if (need_rotation || need_velocity) {
+      CeresSplineHelper<double, N_>::template computeCoeffs<0, true>(
+          u_so3, inv_so3_dt_, coeff);
+      so3_coeffs.row(j) = coeff.transpose();
     }
+    if (need_velocity) {
+      CeresSplineHelper<double, N_>::template computeCoeffs<1, true>(
+          u_so3, inv_so3_dt_, coeff);
+      so3_dcoeffs.row(j) = coeff.transpose();
+    }
+  }
 
-    using FunctorT = RSReprojectionCostFunctorSplit<N_>;
-    FunctorT* functor = new FunctorT(
-        view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, tracks);
+  // all samples rotate about the same knot increments, only the blending
+  // coefficients differ. The coefficient columns are contiguous, so the
+  // increments of one knot are exponentiated in one batch
+  so3_vector rotations, exp_kdelta;
+  vec3_vector rot_vels;
+  if (need_rotation || need_velocity) {
+    rotations.assign(num, so3_knots_[s_so3]);
+    exp_kdelta.resize(num);
+    rot_vels.assign(num, Eigen::Vector3d::Zero());
+    for (int k = 0; k < DEG_; ++k) {
+      Sophus::so3_exp_fast_batch(
+          delta[k], so3_coeffs.col(k + 1).data(), num, exp_kdelta.data());
+      for (int j = 0; j < num; ++j) {
+        rotations[j] *= exp_kdelta[j];
+        if (need_velocity) {
+          rot_vels[j] = exp_kdelta[j].inverse() * rot_vels[j] +
+                        delta[k] * so3_dcoeffs(j, k + 1);
+        }
+      }
+    }
+  }
+  for (int j = 0; j < num; ++j) {
+    if (flags & SAMPLE_POSE) {
+      samples.rotation.row(first + j) =
+          rotations[j].unit_quaternion().coeffs().transpose();
+    }
+    if (need_velocity) {
+      samples.angular_velocity.row(first + j) = rot_vels[j].transpose();
+    }
+  }
 
-    ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-        new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  // the r3 values of all samples of the segment are one matrix product
+  if (flags & SAMPLE_POSE) {
+    samples.position.middleRows(first, num) = pos_coeffs * r3_knots;
+  }
+  if (flags & SAMPLE_ACCELERATION) {
+    const Eigen::Matrix<double, Eigen::Dynamic, 3> accel_w =
+        accel_coeffs * r3_knots;
+    for (int j = 0; j < num; ++j) {
+      samples.acceleration.row(first + j) =
+          (rotations[j].inverse() * (accel_w.row(j).transpose() + gravity_))
+              .transpose();
+    }
+  }
+  if (flags & SAMPLE_BIASES) {
+    for (int j = 0; j < num; ++j) {
+      samples.gyro_bias.row(first + j) =
+          GetGyroBias(times_ns[first + j]).transpose();
+      samples.accl_bias.row(first + j) =
+          GetAcclBias(times_ns[first + j]).transpose();
+    }
+  }
+}
 
-    std::vector<double*> vec;
-    for (int i = 0; i < N_; i++) {
-      cost_function->AddParameterBlock(4);
-      const int t = s_so3 + i;
-      vec.emplace_back(so3_knots_[t].data());
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::ExportTrajectory(
+    const std::string& path,
+    const std::vector<int64_t>& times_ns,
+    const int flags,
+    const io::ChunkCodec codec,
+    const size_t samples_per_chunk) const {
+  if (!std::is_sorted(times_ns.begin(), times_ns.end())) {
+    LOG(ERROR) << "Trajectory timestamps have to be sorted.";
+    return false;
+  }
+  const uint32_t meta_flags = flags;
+  std::vector<char> meta(sizeof(meta_flags));
+  std::memcpy(meta.data(), &meta_flags, sizeof(meta_flags));
+  io::ChunkedFileWriter writer;
+  if (!writer.Open(path, kTrajectoryMagic, codec, meta)) {
+    LOG(ERROR) << "Could not open " << path << " for writing.";
+    return false;
+  }
+  const size_t chunk_size = std::max<size_t>(samples_per_chunk, 1);
+  std::vector<int64_t> chunk_times_ns;
+  TrajectorySamples samples;
+  std::vector<char> raw;
+  for (size_t i = 0; i < times_ns.size(); i += chunk_size) {
+    const size_t n = std::min(chunk_size, times_ns.size() - i);
+    chunk_times_ns.assign(times_ns.begin() + i, times_ns.begin() + i + n);
+    if (!EvaluateTrajectory(chunk_times_ns, flags, samples)) {
+      return false;
     }
-    for (int i = 0; i < N_; i++) {
-      cost_function->AddParameterBlock(3);
-      const int t = s_r3 + i;
-      vec.emplace_back(r3_knots_[t].data());
+    raw.clear();
+    PackTrajectoryChunk(chunk_times_ns, samples, flags, raw);
+    if (!writer.AddChunk(
+            raw, n, chunk_times_ns.front(), chunk_times_ns.back())) {
+      LOG(ERROR) << "Could not write the trajectory to " << path;
+      return false;
     }
+  }
+  return writer.Close();
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::ViewReprojectionError(
+    const int camera,
+    const size_t v,
+    const double* line_delay_s,
+    double& sum_error,
+    int& num_points) {
+  const CameraBlocks blocks = Camera(camera);
+  const utils::ObservationStore& store = *blocks.observations;
+  const utils::ObservationStore::View& view = store.GetView(v);
+  const size_t nr_obs = view.num;
+  SampleTimes times;
+  if (nr_obs == 0 || !CalcCameraTimes(view.timestamp_s, times, camera)) {
+    return false;
+  }
+
+  std::vector<const double*> vec;
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(so3_knots_[times.s_so3 + i].data());
+  }
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(r3_knots_[times.s_r3 + i].data());
+  }
 
-    // camera to imu transformation
-    cost_function->AddParameterBlock(7);
-    vec.emplace_back(T_i_c_.data());
+  // camera to imu transformation
+  vec.emplace_back(blocks.T_i_c);
 
-    // line delay for rolling shutter cameras
-    cost_function->AddParameterBlock(1);
-    vec.emplace_back(&cam_line_delay_s_);
+  // line delay for rolling shutter cameras
+  if (line_delay_s) {
+    vec.emplace_back(line_delay_s);
+  }
 
-    // all object points
-    for (size_t i = 0; i < nr_obs; ++i) {
-      cost_function->AddParameterBlock(4);
-      vec.emplace_back(
-          image_data_.MutableTrack(tracks[i])->MutablePoint()->data());
-    }
+  // all object points
+  for (size_t i = 0; i < nr_obs; ++i) {
+    vec.emplace_back(store.Point(view.first + i));
+  }
 
-    cost_function->SetNumResiduals(2 * nr_obs);
-    {
-      Eigen::VectorXd residual;
-      residual.setZero(nr_obs * 2);
+  Eigen::VectorXd residual;
+  residual.setZero(nr_obs * 2);
+
+  // no derivatives needed, evaluate the functor directly
+  const auto evaluate_residuals = [&](auto model_tag) {
+    using CameraModel = typename decltype(model_tag)::CameraModel;
+    const auto evaluate = [&](const auto& functor) {
+      return functor(vec.data(), residual.data());
+    };
+    if (line_delay_s) {
+      return evaluate(RSReprojectionCostFunctorSplit<N_, CameraModel>(
+          store,
+          v,
+          view.first,
+          nr_obs,
+          times.u_so3,
+          times.u_r3,
+          inv_so3_dt_,
+          inv_r3_dt_));
+    }
+    return evaluate(GSReprojectionCostFunctorSplit<N_, CameraModel>(
+        store,
+        v,
+        view.first,
+        nr_obs,
+        times.u_so3,
+        times.u_r3,
+        inv_so3_dt_,
+        inv_r3_dt_));
+  };
+  if (!utils::DispatchCameraModel(view.camera->GetCameraIntrinsicsModelType(),
+                                  evaluate_residuals)) {
+    return false;
+  }
 
-      cost_function->Evaluate(&vec[0], residual.data(), NULL);
+  for (size_t i = 0; i < nr_obs; i++) {
+    const Eigen::Vector2d res_point = residual.segment<2>(2 * i);
+    if (res_point[0] != 0.0 && res_point[1] != 0.0) {
+      sum_error += res_point.norm();
+      num_points += 1;
+    }
+  }
+  return true;
+}
 
-      for (size_t i = 0; i < nr_obs; i++) {
-        Eigen::Vector2d res_point = residual.segment<2>(2 * i);
-        if (res_point[0] != 0.0 && res_point[1] != 0.0) {
-          sum_error += res_point.norm();
-          num_points += 1;
+template <int _T>
+ReprojectionErrorStatistics
+SplineTrajectoryEstimator<_T>::GetReprojectionErrorStatistics(
+    const double histogram_bin_width,
+    const int num_histogram_bins,
+    const int camera) {
+  const CameraBlocks blocks = Camera(camera);
+  const utils::ObservationStore& store = *blocks.observations;
+  // without line delay all points of a view share one spline pose, so the
+  // global shutter functor evaluates the spline only once per view. Rolling
+  // shutter views use the exact functor even if the optimization linearized
+  // them
+  const double* line_delay_s =
+      *blocks.line_delay_s != 0.0 ? blocks.line_delay_s : nullptr;
+
+  std::vector<double> view_sum_errors(store.NumViews(), 0.0);
+  std::vector<int> view_num_points(store.NumViews(), 0);
+  utils::ParallelFor(
+      store.NumViews(), num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t v = begin; v < end; ++v) {
+          ViewReprojectionError(
+              camera, v, line_delay_s, view_sum_errors[v], view_num_points[v]);
         }
-      }
+      });
+
+  ReprojectionErrorStatistics statistics;
+  statistics.histogram_bin_width = histogram_bin_width;
+  statistics.histogram.assign(std::max(num_histogram_bins, 1), 0);
+  double sum_error = 0.0;
+  for (size_t v = 0; v < store.NumViews(); ++v) {
+    if (view_num_points[v] == 0) {
+      continue;
     }
+    sum_error += view_sum_errors[v];
+    statistics.num_points += view_num_points[v];
+
+    const double view_error = view_sum_errors[v] / view_num_points[v];
+    statistics.view_errors[store.GetView(v).view_id] = view_error;
+    // the last bin collects all larger errors
+    const int bin = std::min<int>(view_error / histogram_bin_width,
+                                  statistics.histogram.size() - 1);
+    statistics.histogram[bin] += 1;
+  }
+  if (statistics.num_points > 0) {
+    statistics.mean_error = sum_error / statistics.num_points;
+  }
+  return statistics;
+}
+
+template <int _T>
+double SplineTrajectoryEstimator<_T>::GetMeanReprojectionError() {
+  // over the observations of all cameras of the rig
+  double sum_error = 0.0;
+  int num_points = 0;
+  for (int c = 0; c < GetNumCameras(); ++c) {
+    const ReprojectionErrorStatistics statistics =
+        GetReprojectionErrorStatistics(0.5, 20, c);
+    sum_error += statistics.mean_error * statistics.num_points;
+    num_points += statistics.num_points;
   }
+  const double mean_error = num_points > 0 ? sum_error / num_points : 0.0;
 
-  std::cout << "Mean reprojection error " << sum_error / num_points
+  std::cout << "Mean reprojection error " << mean_error
             << " number residuals: " << num_points << std::endl;
 
-  return sum_error / num_points;
+  return mean_error;
+}
+
+template <int _T>
+std::vector<double> SplineTrajectoryEstimator<_T>::EvaluateLineDelays(
+    const std::vector<double>& line_delays_s,
+    const int view_stride,
+    const int camera) {
+  const utils::ObservationStore& store = *Camera(camera).observations;
+  const size_t stride = std::max(view_stride, 1);
+  const size_t num_views = (store.NumViews() + stride - 1) / stride;
+  const size_t num_candidates = line_delays_s.size();
+  // the items are pairs of candidate and block of views. The errors are
+  // summed per block and the blocks in a fixed tree, so the result does not
+  // depend on the threads.
+  using ErrorSum = std::pair<double, int>;
+  const auto add_sums = [](const ErrorSum& a, const ErrorSum& b) {
+    return ErrorSum(a.first + b.first, a.second + b.second);
+  };
+  const size_t num_blocks =
+      (num_views + utils::kReductionBlockSize - 1) / utils::kReductionBlockSize;
+  std::vector<ErrorSum> block_sums(num_candidates * num_blocks,
+                                   ErrorSum(0.0, 0));
+  utils::ParallelFor(
+      num_candidates * num_blocks,
+      num_threads_,
+      [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          const size_t c = i / num_blocks;
+          const size_t first = (i % num_blocks) * utils::kReductionBlockSize;
+          const size_t last =
+              std::min(num_views, first + utils::kReductionBlockSize);
+          for (size_t v = first; v < last; ++v) {
+            ViewReprojectionError(camera,
+                                  v * stride,
+                                  &line_delays_s[c],
+                                  block_sums[i].first,
+                                  block_sums[i].second);
+          }
+        }
+      });
+
+  std::vector<double> mean_errors(num_candidates,
+                                  std::numeric_limits<double>::max());
+  for (size_t c = 0; c < num_candidates; ++c) {
+    const ErrorSum sum = utils::TreeReduce(
+        std::vector<ErrorSum>(block_sums.begin() + c * num_blocks,
+                              block_sums.begin() + (c + 1) * num_blocks),
+        ErrorSum(0.0, 0),
+        add_sums);
+    if (sum.second > 0) {
+      mean_errors[c] = sum.first / sum.second;
+    }
+  }
+  return mean_errors;
+}
+
+template <int _T>
+std::vector<double> SplineTrajectoryEstimator<_T>::EvaluateGyroTimeOffsets(
+    const std::vector<double>& time_offsets_s,
+    const std::vector<double>& timestamps_s,
+    const vec3_vector& gyro_measurements,
+    const ThreeAxisSensorCalibParams<double>& gyro_intrinsics) {
+  vec3_vector gyro_calibrated(gyro_measurements.size());
+  for (size_t j = 0; j < gyro_measurements.size(); ++j) {
+    gyro_calibrated[j] = gyro_intrinsics.UnbiasNormalize(gyro_measurements[j]);
+  }
+  const size_t num_samples = timestamps_s.size();
+  const size_t num_candidates = time_offsets_s.size();
+  // summed per block of samples and the blocks in a fixed tree, so the
+  // result does not depend on the threads
+  using ErrorSum = std::pair<double, int>;
+  const auto add_sums = [](const ErrorSum& a, const ErrorSum& b) {
+    return ErrorSum(a.first + b.first, a.second + b.second);
+  };
+  const size_t num_blocks = (num_samples + utils::kReductionBlockSize - 1) /
+                            utils::kReductionBlockSize;
+  std::vector<ErrorSum> block_sums(num_candidates * num_blocks,
+                                   ErrorSum(0.0, 0));
+  utils::ParallelFor(
+      num_candidates * num_blocks,
+      num_threads_,
+      [&](size_t begin, size_t end, int) {
+        std::vector<const double*> vec(N_);
+        for (size_t i = begin; i < end; ++i) {
+          const size_t c = i / num_blocks;
+          const size_t first = (i % num_blocks) * utils::kReductionBlockSize;
+          const size_t last =
+              std::min(num_samples, first + utils::kReductionBlockSize);
+          for (size_t j = first; j < last; ++j) {
+            const int64_t time_ns =
+                SecondsToNs(timestamps_s[j] + time_offsets_s[c]);
+            SampleTimes times;
+            if (!CalcSO3Times(time_ns, times.u_so3, times.s_so3)) {
+              continue;
+            }
+            for (int n = 0; n < N_; ++n) {
+              vec[n] = so3_knots_[times.s_so3 + n].data();
+            }
+            Eigen::Vector3d velocity;
+            CeresSplineHelper<double, N_>::template evaluate_lie<Sophus::SO3>(
+                &vec[0], times.u_so3, inv_so3_dt_, nullptr, &velocity);
+            block_sums[i].first += (velocity - gyro_calibrated[j]).norm();
+            block_sums[i].second += 1;
+          }
+        }
+      });
+
+  std::vector<double> mean_errors(num_candidates,
+                                  std::numeric_limits<double>::max());
+  for (size_t c = 0; c < num_candidates; ++c) {
+    const ErrorSum sum = utils::TreeReduce(
+        std::vector<ErrorSum>(block_sums.begin() + c * num_blocks,
+                              block_sums.begin() + (c + 1) * num_blocks),
+        ErrorSum(0.0, 0),
+        add_sums);
+    if (sum.second > 0) {
+      mean_errors[c] = sum.first / sum.second;
+    }
+  }
+  return mean_errors;
 }
 
 template <int _T>
 void SplineTrajectoryEstimator<_T>::ConvertInvDepthPointsToHom() {
-  const auto track_ids = image_data_.TrackIds();
+  const auto track_ids = image_data_->TrackIds();
   for (size_t p = 0; p < track_ids.size(); ++p) {
-    theia::Track* mutable_track = image_data_.MutableTrack(track_ids[p]);
-    const theia::View* v = image_data_.View(mutable_track->ReferenceViewId());
+    theia::Track* mutable_track = image_data_->MutableTrack(track_ids[p]);
+    const theia::View* v = image_data_->View(mutable_track->ReferenceViewId());
     Eigen::Vector3d bearing =
         v->Camera().PixelToUnitDepthRay((*v->GetFeature(track_ids[p])).point_);
 
-    const int64_t ts = v->GetTimestamp() * S_TO_NS;
+    const int64_t ts = SecondsToNs(v->GetTimestamp());
     Sophus::SE3d T_w_i;
     GetPose(ts, T_w_i);
     Eigen::Vector3d X_ref =
@@ -1100,10 +3471,10 @@ template <int _T>
 void SplineTrajectoryEstimator<_T>::ConvertToTheiaRecon(
     theia::Reconstruction* recon_out) {
   // read camera calibration
-  std::vector<theia::ViewId> view_ids = image_data_.ViewIds();
+  std::vector<theia::ViewId> view_ids = image_data_->ViewIds();
   for (size_t i = 0; i < view_ids.size(); ++i) {
     const int64_t t_ns =
-        image_data_.View(view_ids[i])->GetTimestamp() * S_TO_NS;
+        SecondsToNs(image_data_->View(view_ids[i])->GetTimestamp());
     Sophus::SE3d T_w_i;
     GetPose(t_ns, T_w_i);
     Sophus::SE3d T_w_c = T_w_i * T_i_c_;
@@ -1117,11 +3488,11 @@ void SplineTrajectoryEstimator<_T>::ConvertToTheiaRecon(
     camera_ptr->SetPosition(T_w_c.translation());
   }
   // ConvertInvDepthPointsToHom();
-  const auto track_ids = image_data_.TrackIds();
+  const auto track_ids = image_data_->TrackIds();
   for (size_t p = 0; p < track_ids.size(); ++p) {
     TrackId tid = recon_out->AddTrack();
     *recon_out->MutableTrack(tid)->MutablePoint() =
-        image_data_.Track(track_ids[p])->Point();
+        image_data_->Track(track_ids[p])->Point();
     recon_out->MutableTrack(tid)->SetEstimated(true);
   }
 }
@@ -1141,6 +3512,19 @@ double SplineTrajectoryEstimator<_T>::GetRSLineDelay() const {
   return cam_line_delay_s_;
 }
 
+template <int _T>
+Sophus::SE3d SplineTrajectoryEstimator<_T>::GetCameraT_i_c(
+    const int camera) const {
+  return camera == 0 ? T_i_c_ : rig_cameras_[camera - 1]->T_i_c;
+}
+
+template <int _T>
+double SplineTrajectoryEstimator<_T>::GetCameraLineDelay(
+    const int camera) const {
+  return camera == 0 ? cam_line_delay_s_
+                     : rig_cameras_[camera - 1]->line_delay_s;
+}
+
 template <int _T>
 ThreeAxisSensorCalibParams<double>
 SplineTrajectoryEstimator<_T>::GetAcclIntrinsics(const int64_t& time_ns) {
@@ -1163,7 +3547,7 @@ SplineTrajectoryEstimator<_T>::GetAcclIntrinsics(const int64_t& time_ns) {
 template <int _T>
 ThreeAxisSensorCalibParams<double>
 SplineTrajectoryEstimator<_T>::GetGyroIntrinsics(const int64_t& time_ns) {
-  const auto gyro_bias_at_time = GetAcclBias(time_ns);
+  const auto gyro_bias_at_time = GetGyroBias(time_ns);
   ThreeAxisSensorCalibParams<double> gyro_calib_triad(gyro_intrinsics_[0],
                                                       gyro_intrinsics_[1],
                                                       gyro_intrinsics_[2],
@@ -1181,20 +3565,23 @@ SplineTrajectoryEstimator<_T>::GetGyroIntrinsics(const int64_t& time_ns) {
 
 template <int _T>
 Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetGyroBias(
-    const int64_t& time_ns) {
+    const int64_t& time_ns) const {
   double u;
   int64_t s;
   Eigen::Vector3d gyro_bias;
   gyro_bias.setZero();
 
-  if (!CalcTimes(time_ns,
-                 u,
-                 s,
-                 dt_gyro_bias_ns_,
-                 nr_knots_gyro_bias_,
-                 BIAS_SPLINE_N)) {
+  if (!CalcBiasTimes(time_ns,
+                     u,
+                     s,
+                     dt_gyro_bias_ns_,
+                     nr_knots_gyro_bias_,
+                     constant_gyro_bias_)) {
     return gyro_bias;
   }
+  if (constant_gyro_bias_) {
+    return gyro_bias_spline_[0];
+  }
 
   std::vector<const double*> vec;
   for (int i = 0; i < BIAS_SPLINE_N; ++i) {
@@ -1209,20 +3596,23 @@ Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetGyroBias(
 
 template <int _T>
 Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetAcclBias(
-    const int64_t& time_ns) {
+    const int64_t& time_ns) const {
   double u;
   int64_t s;
   Eigen::Vector3d accl_bias;
   accl_bias.setZero();
 
-  if (!CalcTimes(time_ns,
-                 u,
-                 s,
-                 dt_accl_bias_ns_,
-                 nr_knots_accl_bias_,
-                 BIAS_SPLINE_N)) {
+  if (!CalcBiasTimes(time_ns,
+                     u,
+                     s,
+                     dt_accl_bias_ns_,
+                     nr_knots_accl_bias_,
+                     constant_accl_bias_)) {
     return accl_bias;
   }
+  if (constant_accl_bias_) {
+    return accl_bias_spline_[0];
+  }
 
   std::vector<const double*> vec;
   for (int i = 0; i < BIAS_SPLINE_N; ++i) {
@@ -1248,5 +3638,110 @@ void SplineTrajectoryEstimator<_T>::SetIMUIntrinsics(
       gyro_intrinsics.misYX(), gyro_intrinsics.scaleX(),
       gyro_intrinsics.scaleY(), gyro_intrinsics.scaleZ();
 }
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetUseFloatImuJacobians(
+    const bool use_float_jacobians) {
+  float_imu_jacobians_ = use_float_jacobians;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetShareKnotEvaluations(
+    const bool share_knot_evaluations) {
+  if (share_knot_evaluations == (so3_knot_cache_ != nullptr)) {
+    return;
+  }
+  // the callback is part of the problem options, so the problem is rebuilt
+  if (problem_.NumParameterBlocks() > 0) {
+    LOG(WARNING) << "Knot evaluations can only be shared before the first "
+                    "measurement is added.";
+    return;
+  }
+  // the cache is swapped before the problem is rebuilt, the new problem must
+  // not keep the callback of a destroyed cache
+  if (share_knot_evaluations) {
+    so3_knot_cache_.reset(
+        new So3KnotDeltaCache(so3_knots_, so3_knot_in_problem_));
+    so3_knot_cache_->SetNumThreads(num_threads_);
+  } else {
+    so3_knot_cache_.reset();
+  }
+  problem_ = ceres::Problem(ProblemOptions());
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetUseAnalyticImuJacobians(
+    const bool use_analytic_jacobians) {
+  use_analytic_imu_jacobians_ = use_analytic_jacobians;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetCameraResidualLayout(
+    const CameraResidualLayout layout) {
+  camera_residual_layout_ = layout;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetCameraLossWidth(const double width) {
+  // a Huber loss of width 0 would remove the residual from the cost, the
+  // wrapper without a loss is the plain squared norm
+  ceres::LossFunction* loss =
+      width == 0.0 ? nullptr : new ceres::HuberLoss(width);
+  if (!camera_loss_) {
+    camera_loss_.reset(
+        new ceres::LossFunctionWrapper(loss, ceres::TAKE_OWNERSHIP));
+  } else {
+    camera_loss_->Reset(loss, ceres::TAKE_OWNERSHIP);
+  }
+  camera_loss_width_ = width;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetRigidBoard(const bool rigid_board) {
+  rigid_board_ = rigid_board;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetRotationOnly(const bool rotation_only) {
+  rotation_only_ = rotation_only;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetLinearizeRollingShutter(
+    const bool linearize_rolling_shutter) {
+  linearize_rolling_shutter_ = linearize_rolling_shutter;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetNumThreads(const int num_threads) {
+  num_threads_ = std::max(1, num_threads);
+  if (so3_knot_cache_) {
+    so3_knot_cache_->SetNumThreads(num_threads_);
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetIterationCallback(
+    SplineIterationCallback callback) {
+  iteration_callback_ = std::move(callback);
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetConvergenceCriteria(
+    const SplineConvergenceCriteria& criteria) {
+  convergence_criteria_ = criteria;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetSolverProfile(
+    const SplineSolverProfile& profile) {
+  solver_profile_ = profile;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetProfileResiduals(
+    const bool profile_residuals) {
+  profile_residuals_ = profile_residuals;
+}
 }  // namespace core
 }  // namespace OpenICC
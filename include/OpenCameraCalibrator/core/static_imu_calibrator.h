@@ -1,6 +1,6 @@
 #pragma once
 
-#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/json_fwd.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include "OpenCameraCalibrator/utils/gyro_integration.h"
@@ -8,6 +8,9 @@
 
 #include <ceres/ceres.h>
 
+#include <utility>
+#include <vector>
+
 using namespace OpenICC::utils;
 
 namespace OpenICC {
@@ -15,63 +18,112 @@ namespace core {
 
 using Vector3d = Eigen::Vector3d;
 
-struct MultiPosAccResidual {
+//! Jacobian of the calibrated reading T*K*(X - B) of a raw reading X w.r.t.
+//! the misalignments (mis_yz, mis_zy, mis_zx, mis_xz, mis_xy, mis_yx), the
+//! scales and the biases of ThreeAxisSensorCalibParams
+inline Eigen::Matrix<double, 3, 12> CalibratedReadingJacobian(
+    const ThreeAxisSensorCalibParams<double>& calib_triad,
+    const Eigen::Vector3d& raw_data) {
+  const Eigen::Vector3d unbiased = calib_triad.Unbias(raw_data);
+  const Eigen::Vector3d scaled = calib_triad.GetScaleMatrix() * unbiased;
+  const Eigen::Matrix3d& mis_mat = calib_triad.GetMisalignmentMatrix();
+  Eigen::Matrix<double, 3, 12> jacobian = Eigen::Matrix<double, 3, 12>::Zero();
+  jacobian(0, 0) = -scaled(1);
+  jacobian(0, 1) = scaled(2);
+  jacobian(1, 2) = -scaled(2);
+  jacobian(1, 3) = scaled(0);
+  jacobian(2, 4) = -scaled(0);
+  jacobian(2, 5) = scaled(1);
+  for (int c = 0; c < 3; ++c) {
+    jacobian.col(6 + c) = mis_mat.col(c) * unbiased(c);
+  }
+  jacobian.rightCols<3>() = -mis_mat * calib_triad.GetScaleMatrix();
+  return jacobian;
+}
+
+//! Difference of the gravity magnitude and the norm of a calibrated static
+//! accelerometer sample, with analytic jacobian
+class MultiPosAccResidual : public ceres::SizedCostFunction<1, 9> {
+ public:
   MultiPosAccResidual(const double& g_mag, const Eigen::Vector3d& sample)
       : g_mag_(g_mag), sample_(sample) {}
 
-  template <typename T>
-  bool operator()(const T* const params, T* residuals) const {
-    Eigen::Matrix<T, 3, 1> raw_samp(
-        T(sample_(0)), T(sample_(1)), T(sample_(2)));
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const double* params = parameters[0];
     /* Assume body frame same as accelerometer frame,
      * so bottom left params in the misalignment matris are set to zero */
-    ThreeAxisSensorCalibParams<T> calib_triad(params[0],
-                                              params[1],
-                                              params[2],
-                                              T(0),
-                                              T(0),
-                                              T(0),
-                                              params[3],
-                                              params[4],
-                                              params[5],
-                                              params[6],
-                                              params[7],
-                                              params[8]);
-
-    Eigen::Matrix<T, 3, 1> calib_samp = calib_triad.UnbiasNormalize(raw_samp);
-    residuals[0] = T(g_mag_) - calib_samp.norm();
+    const ThreeAxisSensorCalibParams<double> calib_triad(params[0],
+                                                         params[1],
+                                                         params[2],
+                                                         0.0,
+                                                         0.0,
+                                                         0.0,
+                                                         params[3],
+                                                         params[4],
+                                                         params[5],
+                                                         params[6],
+                                                         params[7],
+                                                         params[8]);
+
+    const Eigen::Vector3d calib_samp = calib_triad.UnbiasNormalize(sample_);
+    const double calib_norm = calib_samp.norm();
+    residuals[0] = g_mag_ - calib_norm;
+    if (jacobians && jacobians[0]) {
+      if (calib_norm == 0.0) {
+        return false;
+      }
+      const Eigen::Matrix<double, 1, 12> d_residual =
+          -calib_samp.transpose() / calib_norm *
+          CalibratedReadingJacobian(calib_triad, sample_);
+      // the three misalignments of the body frame, scales and biases
+      Eigen::Map<Eigen::Matrix<double, 1, 9>> jacobian(jacobians[0]);
+      jacobian << d_residual.head<3>(), d_residual.tail<6>();
+    }
     return true;
   }
 
   static ceres::CostFunction* Create(const double& g_mag,
                                      const Vector3d& sample) {
-    return (new ceres::AutoDiffCostFunction<MultiPosAccResidual, 1, 9>(
-        new MultiPosAccResidual(g_mag, sample)));
+    return new MultiPosAccResidual(g_mag, sample);
   }
 
+ private:
   const double g_mag_;
   const Vector3d sample_;
 };
 
-struct MultiPosGyroResidual {
+//! Difference of the gravity direction of a static interval and the one of
+//! the previous interval rotated by the integrated calibrated gyroscope
+//! samples in between. The interval is integrated once per evaluation in
+//! plain doubles, the jacobian is propagated through the RK4 steps. The
+//! initial bias is removed from the raw samples before the calibration.
+class MultiPosGyroResidual : public ceres::CostFunction {
+ public:
   MultiPosGyroResidual(const Vector3d& g_versor_pos0,
                        const Vector3d& g_versor_pos1,
-                       const ImuReadings& gyro_samples,
+                       const ImuSamplesViewd& gyro_samples,
                        const DataInterval& gyro_interval_pos01,
                        double dt,
-                       bool optimize_bias)
-      :
-
-        g_versor_pos0_(g_versor_pos0),
+                       bool optimize_bias,
+                       const Vector3d& initial_bias = Vector3d::Zero())
+      : g_versor_pos0_(g_versor_pos0),
         g_versor_pos1_(g_versor_pos1),
         gyro_samples_(gyro_samples),
         interval_pos01_(gyro_interval_pos01),
         dt_(dt),
-        optimize_bias_(optimize_bias) {}
+        optimize_bias_(optimize_bias),
+        initial_bias_(initial_bias) {
+    set_num_residuals(3);
+    mutable_parameter_block_sizes()->push_back(optimize_bias ? 12 : 9);
+  }
 
-  template <typename T>
-  bool operator()(const T* const params, T* residuals) const {
-    ThreeAxisSensorCalibParams<T> calib_triad(
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const double* params = parameters[0];
+    const ThreeAxisSensorCalibParams<double> calib_triad(
         params[0],
         params[1],
         params[2],
@@ -81,65 +133,88 @@ struct MultiPosGyroResidual {
         params[6],
         params[7],
         params[8],
-        optimize_bias_ ? params[9] : T(0),
-        optimize_bias_ ? params[10] : T(0),
-        optimize_bias_ ? params[11] : T(0));
-
-    std::vector<ImuReading<T>> calib_gyro_samples;
-    calib_gyro_samples.reserve(interval_pos01_.end_idx -
-                               interval_pos01_.start_idx + 1);
-
-    for (int i = interval_pos01_.start_idx; i <= interval_pos01_.end_idx; i++) {
-      Eigen::Matrix<T, 3, 1> gyro(T(gyro_samples_[i].x()),
-                                  T(gyro_samples_[i].y()),
-                                  T(gyro_samples_[i].z()));
-      calib_gyro_samples.push_back(
-          ImuReading<T>(T(gyro_samples_[i].timestamp_s()),
-                        calib_triad.UnbiasNormalize(gyro)));
+        optimize_bias_ ? params[9] : 0.0,
+        optimize_bias_ ? params[10] : 0.0,
+        optimize_bias_ ? params[11] : 0.0);
+    const bool compute_jacobian = jacobians && jacobians[0];
+
+    Eigen::Vector4d quat(1.0, 0.0, 0.0, 0.0);
+    Eigen::Matrix<double, 4, 12> d_quat = Eigen::Matrix<double, 4, 12>::Zero();
+    const Eigen::Vector3d raw_omega0 =
+        gyro_samples_.data(interval_pos01_.start_idx) - initial_bias_;
+    Eigen::Vector3d omega0 = calib_triad.UnbiasNormalize(raw_omega0);
+    Eigen::Matrix<double, 3, 12> d_omega0, d_omega1;
+    d_omega0.setZero();
+    if (compute_jacobian) {
+      d_omega0 = CalibratedReadingJacobian(calib_triad, raw_omega0);
+    }
+    d_omega1 = d_omega0;
+    for (int i = interval_pos01_.start_idx; i < interval_pos01_.end_idx; i++) {
+      const double dt = dt_ > 0.0 ? dt_
+                                  : gyro_samples_.timestamp_s(i + 1) -
+                                        gyro_samples_.timestamp_s(i);
+      const Eigen::Vector3d raw_omega1 =
+          gyro_samples_.data(i + 1) - initial_bias_;
+      const Eigen::Vector3d omega1 = calib_triad.UnbiasNormalize(raw_omega1);
+      if (compute_jacobian) {
+        d_omega1 = CalibratedReadingJacobian(calib_triad, raw_omega1);
+      }
+      QuatIntegrationStepRK4(
+          quat, omega0, omega1, dt, d_omega0, d_omega1, quat, d_quat);
+      omega0 = omega1;
+      d_omega0 = d_omega1;
     }
-    Eigen::Matrix<T, 3, 3> rot_mat;
-    IntegrateGyroInterval(calib_gyro_samples, rot_mat, T(dt_));
-
-    Eigen::Matrix<T, 3, 1> diff =
-        rot_mat.transpose() * g_versor_pos0_.template cast<T>() -
-        g_versor_pos1_.template cast<T>();
-
-    residuals[0] = diff(0);
-    residuals[1] = diff(1);
-    residuals[2] = diff(2);
 
+    // R^T * g0 of the unit quaternion (w, v)
+    const double w = quat(0);
+    const Eigen::Vector3d v = quat.tail<3>();
+    const Eigen::Vector3d& g0 = g_versor_pos0_;
+    const Eigen::Vector3d rotated_g0 =
+        (w * w - v.squaredNorm()) * g0 + 2.0 * v * v.dot(g0) -
+        2.0 * w * v.cross(g0);
+    Eigen::Map<Eigen::Vector3d> residual(residuals);
+    residual = rotated_g0 - g_versor_pos1_;
+
+    if (compute_jacobian) {
+      Eigen::Matrix<double, 3, 4> d_rotated_quat;
+      d_rotated_quat.col(0) = 2.0 * w * g0 - 2.0 * v.cross(g0);
+      Eigen::Matrix3d g0_skew;
+      g0_skew << 0.0, -g0(2), g0(1), g0(2), 0.0, -g0(0), -g0(1), g0(0), 0.0;
+      d_rotated_quat.rightCols<3>() =
+          2.0 * (v.dot(g0) * Eigen::Matrix3d::Identity() +
+                 v * g0.transpose() - g0 * v.transpose() + w * g0_skew);
+      const Eigen::Matrix<double, 3, 12> d_residual = d_rotated_quat * d_quat;
+      const int num_params = parameter_block_sizes()[0];
+      Eigen::Map<Eigen::Matrix<double, 3, Eigen::Dynamic, Eigen::RowMajor>>(
+          jacobians[0], 3, num_params) = d_residual.leftCols(num_params);
+    }
     return true;
   }
 
   static ceres::CostFunction* Create(const Vector3d& g_versor_pos0,
                                      const Vector3d& g_versor_pos1,
-                                     const ImuReadings& gyro_samples,
+                                     const ImuSamplesViewd& gyro_samples,
                                      const DataInterval& gyro_interval_pos01,
                                      double dt,
-                                     bool optimize_bias) {
-    if (optimize_bias)
-      return (new ceres::AutoDiffCostFunction<MultiPosGyroResidual, 3, 12>(
-          new MultiPosGyroResidual(g_versor_pos0,
-                                   g_versor_pos1,
-                                   gyro_samples,
-                                   gyro_interval_pos01,
-                                   dt,
-                                   optimize_bias)));
-    else
-      return (new ceres::AutoDiffCostFunction<MultiPosGyroResidual, 3, 9>(
-          new MultiPosGyroResidual(g_versor_pos0,
-                                   g_versor_pos1,
-                                   gyro_samples,
-                                   gyro_interval_pos01,
-                                   dt,
-                                   optimize_bias)));
+                                     bool optimize_bias,
+                                     const Vector3d& initial_bias =
+                                         Vector3d::Zero()) {
+    return new MultiPosGyroResidual(g_versor_pos0,
+                                    g_versor_pos1,
+                                    gyro_samples,
+                                    gyro_interval_pos01,
+                                    dt,
+                                    optimize_bias,
+                                    initial_bias);
   }
 
+ private:
   const Vector3d g_versor_pos0_, g_versor_pos1_;
-  const ImuReadings gyro_samples_;
+  const ImuSamplesViewd gyro_samples_;
   const DataInterval interval_pos01_;
   const double dt_;
   const bool optimize_bias_;
+  const Vector3d initial_bias_;
 };
 
 /** @brief This object enables to calibrate an accelerometers triad and
@@ -249,6 +324,26 @@ class StaticImuCalibrator {
     optimize_gyro_bias_ = enabled;
   }
 
+  /** @brief Set the number of threads used to fit the accelerometers
+   * calibration candidates of the different static detection thresholds.
+   * Default is the number of hardware threads. */
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
+  /** @brief Use these static intervals, given as start and end timestamps
+   * in seconds, instead of detecting them. Meant for IMUs co-mounted with
+   * the one the intervals were detected on, with the same time base. Empty
+   * detects them, which is the default. */
+  void SetStaticIntervals(
+      const std::vector<std::pair<double, double>>& intervals_s) {
+    shared_static_intervals_s_ = intervals_s;
+  }
+
+  /** @brief Provides the start and end timestamps of the static intervals
+   * used by the last accelerometers calibration */
+  const std::vector<std::pair<double, double>>& GetStaticIntervals() const {
+    return static_intervals_s_;
+  }
+
   /** @brief If the parameter enabled is true, verbose output is activeted  */
   void EnableVerboseOutput(bool enabled) { verbose_output_ = enabled; }
 
@@ -284,16 +379,6 @@ class StaticImuCalibrator {
     return gyro_calib_;
   }
 
-  /** @brief Provide the calibrated acceleremoters data vector (it should be
-   * called after calibrateAcc() or calibrateAccGyro() ) */
-  const CameraAccData& getCalibAccSamples() const { return calib_acc_samples_; }
-
-  /** @brief Provide the calibrated gyroscopes data vector (it should be called
-   * after calibrateAccGyro() ) */
-  const CameraGyroData& getCalibGyroSamples() const {
-    return calib_gyro_samples_;
-  }
-
  private:
   double g_mag_;
   const int min_num_intervals_;
@@ -302,11 +387,15 @@ class StaticImuCalibrator {
   bool acc_use_means_;
   double gyro_dt_;
   bool optimize_gyro_bias_;
+  int num_threads_;
   std::vector<utils::DataInterval> min_cost_static_intervals_;
+  std::vector<std::pair<double, double>> shared_static_intervals_s_;
+  std::vector<std::pair<double, double>> static_intervals_s_;
   ThreeAxisSensorCalibParams<double> init_acc_calib_, init_gyro_calib_;
   ThreeAxisSensorCalibParams<double> acc_calib_, gyro_calib_;
-  CameraAccData calib_acc_samples_;
-  CameraGyroData calib_gyro_samples_;
+  //! accelerometer samples of the last CalibrateAcc as arrays, the static
+  //! intervals index into them
+  ImuSampleArraysd acc_arrays_;
 
   bool verbose_output_;
 };
@@ -0,0 +1,220 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "OpenCameraCalibrator/core/excitation_monitor.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/utils/ring_queue.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+class BoardExtractor;
+class PoseEstimator;
+
+struct StreamingCalibratorOptions {
+  //! frames waiting for the board detection, TryPushFrame drops frames
+  //! beyond it. Rounded up to a power of two
+  int frame_queue_size = 8;
+  //! IMU samples waiting for the solver. Has to hold the samples that arrive
+  //! during one window solve, PushImuSample blocks beyond it
+  int imu_queue_size = 16384;
+  //! frames are downsampled by this factor before the detection, the camera
+  //! calibration has to be the one of the downsampled images
+  double downsample_factor = 1.0;
+  //! recording time in seconds the spline is initialized with
+  double init_duration_s = 5.0;
+  //! length of the optimized window and recording time between two window
+  //! solves in seconds
+  double window_s = 10.0;
+  double step_s = 1.0;
+  //! solver iterations per window
+  int iterations = 5;
+  //! SplineOptimFlags groups of the window solves
+  int optim_flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  //! thresholds of DataSufficient. An unset image size is taken from the
+  //! camera of Start together with its focal length
+  ExcitationMonitorOptions excitation;
+};
+
+//! Calibration of a StreamingCalibrator after a window solve
+struct StreamingEstimate {
+  //! newest view of the spline in seconds
+  double time_s = 0.0;
+  int num_solves = 0;
+  size_t num_views = 0;
+  double reprojection_error = 0.0;
+  Sophus::SE3d T_i_c;
+  double line_delay_s = 0.0;
+  Eigen::Vector3d gravity = Eigen::Vector3d::Zero();
+  //! excitation and information of all measurements so far
+  ExcitationReport excitation;
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+using StreamingEstimateCallback =
+    std::function<void(const StreamingEstimate& estimate)>;
+
+//! Calibrates while the camera and IMU are still recording. Frames pass a
+//! lock-free ring to a detector thread that extracts the board and estimates
+//! the view pose, IMU samples pass a ring to the solver thread.
+//! Once init_duration_s of views arrived, the spline is initialized like the
+//! batch calibration, afterwards it is extended every step_s of new views
+//! and the last window_s of the recording is optimized. The estimate
+//! converges during the recording instead of after uploading it.
+class StreamingCalibrator {
+ public:
+  explicit StreamingCalibrator(const StreamingCalibratorOptions& options);
+  //! Finishes the stream
+  ~StreamingCalibrator();
+
+  StreamingCalibrator(const StreamingCalibrator&) = delete;
+  StreamingCalibrator& operator=(const StreamingCalibrator&) = delete;
+
+  //! Residual and solver settings of the spline, to be set before Start.
+  //! After Finish it holds the calibration, e.g. for WriteCalibrationResult
+  ImuCameraCalibrator& Calibrator() { return calibrator_; }
+
+  //! Called by the solver thread after every window solve, to be set before
+  //! Start
+  void SetEstimateCallback(StreamingEstimateCallback callback) {
+    estimate_callback_ = std::move(callback);
+  }
+
+  //! Starts the detector and solver threads. The extractor has to be
+  //! initialized with the board and stay alive until Finish
+  bool Start(BoardExtractor* board_extractor,
+             const theia::Camera& camera,
+             const Sophus::SE3d& T_i_c_init,
+             const SplineWeightingData& spline_weight_data,
+             const double time_offset_imu_to_cam,
+             const double initial_line_delay,
+             const ThreeAxisSensorCalibParams<double>& accl_intrinsics,
+             const ThreeAxisSensorCalibParams<double>& gyro_intrinsics);
+
+  //! Blocks while the frame queue is full, e.g. for recorded frames.
+  //! Timestamps have to increase. The frames are pushed from one thread
+  bool PushFrame(const double timestamp_s, const cv::Mat& image);
+
+  //! Drops the frame if the detection fell behind, e.g. for a live camera
+  bool TryPushFrame(const double timestamp_s, const cv::Mat& image);
+
+  //! Timestamp in the IMU clock, see the time offset of Start. The samples
+  //! are pushed from one thread
+  bool PushImuSample(const double timestamp_s,
+                     const Eigen::Vector3d& accl,
+                     const Eigen::Vector3d& gyro);
+
+  //! The measurements so far meet the thresholds of options.excitation, the
+  //! recording can be stopped
+  bool DataSufficient() const { return data_sufficient_; }
+
+  //! Estimate of the last window solve, false before the first one
+  bool GetEstimate(StreamingEstimate& estimate);
+
+  //! Stops accepting measurements, processes the queued ones, solves the
+  //! last window and joins the threads. False if the recording was too
+  //! short to initialize the spline
+  bool Finish();
+
+ private:
+  struct Frame {
+    double timestamp_s = 0.0;
+    cv::Mat image;
+  };
+
+  struct ImuSample {
+    double timestamp_s = 0.0;
+    Eigen::Vector3d accl;
+    Eigen::Vector3d gyro;
+  };
+
+  //! board corners and camera pose of a frame
+  struct Detection {
+    double timestamp_s = 0.0;
+    Eigen::Vector3d orientation;
+    Eigen::Vector3d position;
+    aligned_vector<Eigen::Vector2d> corners;
+    std::vector<int> ids;
+  };
+
+  void DetectorLoop();
+  void SolverLoop();
+
+  //! Moves the queued IMU samples to telemetry_
+  void DrainImuQueue();
+
+  //! Adds a detection as a view of the vision dataset
+  theia::ViewId AddView(const Detection& detection);
+
+  //! Optimizes the latest window and publishes the estimate
+  void Solve();
+
+  const StreamingCalibratorOptions options_;
+  ImuCameraCalibrator calibrator_;
+  StreamingEstimateCallback estimate_callback_;
+
+  BoardExtractor* board_extractor_ = nullptr;
+  std::unique_ptr<PoseEstimator> pose_estimator_;
+  theia::Camera camera_;
+
+  //! inputs of BatchInitSpline
+  Sophus::SE3d T_i_c_init_;
+  SplineWeightingData spline_weight_data_;
+  double time_offset_imu_to_cam_ = 0.0;
+  double initial_line_delay_ = 0.0;
+  ThreeAxisSensorCalibParams<double> accl_intrinsics_;
+  ThreeAxisSensorCalibParams<double> gyro_intrinsics_;
+
+  utils::SpscQueue<Frame> frames_;
+  utils::SpscQueue<ImuSample> imu_samples_;
+  utils::SpscQueue<Detection> detections_;
+
+  //! owned by the solver thread
+  std::shared_ptr<theia::Reconstruction> vision_dataset_;
+  //! samples not yet passed to the calibrator
+  CameraTelemetryData telemetry_;
+  std::vector<theia::ViewId> new_view_ids_;
+  bool initialized_ = false;
+  double first_view_s_ = -1.0;
+  double last_solve_s_ = 0.0;
+  double newest_view_s_ = 0.0;
+  int num_solves_ = 0;
+  std::unique_ptr<ExcitationMonitor> excitation_monitor_;
+  std::atomic<bool> data_sufficient_{false};
+
+  std::mutex estimate_mutex_;
+  StreamingEstimate estimate_;
+  bool has_estimate_ = false;
+
+  std::thread detector_thread_;
+  std::thread solver_thread_;
+  std::mutex finish_mutex_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,174 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace io {
+
+//! Compression of the chunks. zstd and lz4 are only available if the library
+//! was built with them (OPENICC_WITH_ZSTD, OPENICC_WITH_LZ4).
+enum class ChunkCodec : uint32_t { kNone = 0, kZstd = 1, kLz4 = 2 };
+
+//! "none", "zstd" or "lz4"
+bool ParseChunkCodec(const std::string& name, ChunkCodec& codec);
+
+bool ChunkCodecAvailable(const ChunkCodec codec);
+
+//! Read only memory mapping of the byte range [offset, offset + bytes) of a
+//! file, bytes 0 maps up to the end. The offset does not have to be page
+//! aligned, files embedded in a session container are mapped in place.
+class MappedRegion {
+ public:
+  MappedRegion() {}
+  ~MappedRegion() { Close(); }
+
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion& operator=(const MappedRegion&) = delete;
+
+  bool Open(const std::string& path,
+            const uint64_t offset = 0,
+            const uint64_t bytes = 0);
+
+  void Close();
+
+  //! madvise of the mapping, e.g. MADV_RANDOM
+  void Advise(const int advice);
+
+  const char* Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+//! Index entry of one chunk. Keys are the timestamps of the first and last
+//! record in the chunk, chunks are written in time order.
+struct ChunkInfo {
+  uint64_t offset = 0;
+  uint64_t compressed_bytes = 0;
+  uint64_t raw_bytes = 0;
+  uint64_t num_records = 0;
+  int64_t first_key = 0;
+  int64_t last_key = 0;
+};
+
+//! Layout (little endian):
+//! magic[8] | uint32 version | uint32 codec | uint64 meta bytes | meta |
+//! compressed chunks | ChunkInfo index[num_chunks] | uint64 num_chunks |
+//! uint64 index offset
+//! The index is written last, so chunks can be added with constant memory.
+class ChunkedFileWriter {
+ public:
+  ChunkedFileWriter() {}
+  ~ChunkedFileWriter();
+
+  bool Open(const std::string& path,
+            const char magic[8],
+            const ChunkCodec codec,
+            const std::vector<char>& meta);
+
+  //! Compresses and appends one chunk
+  bool AddChunk(const std::vector<char>& raw,
+                const uint64_t num_records,
+                const int64_t first_key,
+                const int64_t last_key);
+
+  //! Writes the index
+  bool Close();
+
+  uint64_t NumRecords() const { return num_records_; }
+
+ private:
+  std::string path_;
+  std::ofstream output_;
+  ChunkCodec codec_ = ChunkCodec::kNone;
+  std::vector<ChunkInfo> index_;
+  std::vector<char> compressed_;
+  uint64_t num_records_ = 0;
+};
+
+//! Memory mapped chunked file. Only the index is read on Open, chunks are
+//! decompressed on request, so a time range touches only its chunks.
+class ChunkedFileReader {
+ public:
+  ChunkedFileReader() {}
+  ~ChunkedFileReader();
+
+  ChunkedFileReader(const ChunkedFileReader&) = delete;
+  ChunkedFileReader& operator=(const ChunkedFileReader&) = delete;
+
+  bool Open(const std::string& path, const char magic[8]);
+
+  //! Chunked file embedded at [offset, offset + bytes) of path, see
+  //! MappedRegion
+  bool Open(const std::string& path,
+            const char magic[8],
+            const uint64_t offset,
+            const uint64_t bytes);
+
+  ChunkCodec Codec() const { return codec_; }
+
+  const std::vector<char>& Meta() const { return meta_; }
+
+  size_t NumChunks() const { return index_.size(); }
+
+  const ChunkInfo& Chunk(const size_t chunk_idx) const {
+    return index_[chunk_idx];
+  }
+
+  uint64_t NumRecords() const;
+
+  //! Chunks [begin, end) that overlap the key range [first_key, last_key]
+  void FindChunks(const int64_t first_key,
+                  const int64_t last_key,
+                  size_t& begin,
+                  size_t& end) const;
+
+  bool ReadChunk(const size_t chunk_idx, std::vector<char>& raw) const;
+
+  //! Decompresses chunks [begin, end) in parallel, raw[i] is chunk begin + i
+  bool ReadChunks(const size_t begin,
+                  const size_t end,
+                  std::vector<std::vector<char>>& raw,
+                  const int num_threads) const;
+
+ private:
+  void Close();
+
+  MappedRegion region_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  ChunkCodec codec_ = ChunkCodec::kNone;
+  std::vector<char> meta_;
+  std::vector<ChunkInfo> index_;
+};
+
+//! True if the file has the magic at offset
+bool HasMagic(const std::string& path,
+              const char magic[8],
+              const uint64_t offset = 0);
+
+}  // namespace io
+}  // namespace OpenICC
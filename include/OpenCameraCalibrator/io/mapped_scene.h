@@ -0,0 +1,91 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/chunked_file.h"
+#include <OpenCameraCalibrator/utils/json.h>
+
+namespace OpenICC {
+namespace io {
+
+//! Memory mapped corner/scene file as written by the board extractor.
+//! On Open only the byte ranges of the views are indexed, the views
+//! themselves are parsed when they are accessed.
+class MappedScene {
+ public:
+  MappedScene() {}
+  ~MappedScene();
+
+  MappedScene(const MappedScene&) = delete;
+  MappedScene& operator=(const MappedScene&) = delete;
+
+  //! Opens the corners section if input_bson is a session file
+  bool Open(const std::string& input_bson);
+
+  //! Scene embedded at [offset, offset + bytes) of input_bson
+  bool Open(const std::string& input_bson,
+            const uint64_t offset,
+            const uint64_t bytes);
+
+  //! Parses the complete file into one json document
+  bool ParseAll(nlohmann::json& scene_json) const;
+
+  //! All top level entries except the views (scene_pts, image size, fps,...)
+  const nlohmann::json& Header() const { return header_; }
+
+  //! Views are sorted by their key, like when iterating the json document
+  size_t NumViews() const { return views_.size(); }
+
+  //! View key, the timestamp in microseconds
+  const std::string& ViewKey(const size_t view_idx) const {
+    return views_[view_idx].key;
+  }
+
+  //! Parses a single view, e.g. {"image_points": {...}}
+  bool ParseView(const size_t view_idx, nlohmann::json& view) const;
+
+ private:
+  struct ViewRange {
+    std::string key;
+    size_t begin;
+    size_t end;
+    //! element type if the views are stored in a typed container
+    std::uint8_t type;
+  };
+
+  bool IndexViews();
+
+  nlohmann::json ParseRange(const std::uint8_t type,
+                            const size_t begin,
+                            const size_t end) const;
+
+  void Close();
+
+  MappedRegion region_;
+  const std::uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+
+  nlohmann::json header_;
+  std::vector<ViewRange> views_;
+};
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,91 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/chunked_file.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Columnar storage of board observations. The corners of view i are
+//! corner_ids[view_offsets[i] .. view_offsets[i+1]] and the matching
+//! corner_xy pairs.
+struct ObservationDataset {
+  //! board type, scene points, image size, fps, ... (everything but views)
+  nlohmann::json header;
+
+  std::vector<int64_t> timestamps_ns;
+  //! size NumViews() + 1
+  std::vector<uint64_t> view_offsets = {0};
+  std::vector<uint16_t> corner_ids;
+  //! x0, y0, x1, y1, ...
+  std::vector<double> corner_xy;
+
+  size_t NumViews() const { return timestamps_ns.size(); }
+
+  size_t NumObservations() const { return corner_ids.size(); }
+
+  //! Appends a view, ids and xy have to be of the same length
+  void AddView(const int64_t timestamp_ns,
+               const std::vector<uint16_t>& ids,
+               const std::vector<double>& xy);
+
+  void Clear();
+};
+
+//! Binary layout (little endian):
+//! "OICCOBS1" | uint32 version | uint64 header bytes | ubjson header |
+//! uint64 num_views | uint64 num_obs | int64 timestamps_ns[num_views] |
+//! uint64 view_offsets[num_views + 1] | uint16 corner_ids[num_obs] |
+//! float64 corner_xy[2 * num_obs]
+//! Compressed datasets are chunked files (see ChunkedFileWriter) with the
+//! magic "OICCOBSC" and the ubjson header as meta data. A chunk holds
+//! int64 timestamps_ns[v] | uint64 view_offsets[v + 1] | uint16 corner_ids[n]
+//! | float64 corner_xy[2n] of v consecutive views, offsets start at 0.
+bool WriteObservationDataset(const std::string& output_path,
+                             const ObservationDataset& dataset);
+
+//! kNone writes the uncompressed layout
+bool WriteObservationDataset(const std::string& output_path,
+                             const ObservationDataset& dataset,
+                             const ChunkCodec codec,
+                             const size_t views_per_chunk);
+
+//! Default chunk size of compressed datasets
+const size_t kObservationViewsPerChunk = 1024;
+
+bool ReadObservationDataset(const std::string& input_path,
+                            ObservationDataset& dataset);
+
+//! Reads only the views with a timestamp in [first_ns, last_ns]. Compressed
+//! datasets only decompress the chunks of the time range.
+bool ReadObservationDatasetRange(const std::string& input_path,
+                                 const int64_t first_ns,
+                                 const int64_t last_ns,
+                                 ObservationDataset& dataset);
+
+//! Converts the ubjson corner file written by the board extractor
+bool SceneToObservationDataset(const MappedScene& scene,
+                               ObservationDataset& dataset);
+
+}  // namespace io
+}  // namespace OpenICC
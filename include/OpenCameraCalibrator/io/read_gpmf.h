@@ -0,0 +1,55 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+
+namespace OpenICC {
+namespace io {
+
+//! True if the file starts with an MP4 / QuickTime ftyp box
+bool IsMP4File(const std::string& path_to_file);
+
+//! Streams ACCL and GYRO of the GPMF metadata track (codec gpmd) of a GoPro
+//! MP4 without intermediate json. Only the moov box and the telemetry
+//! payloads are read from the file. Values are scaled by SCAL and reordered
+//! like the telemetry converter does (x, y, z = GPMF axes 1, 2, 0). The
+//! samples of a payload are spread evenly over its duration in the mp4
+//! sample table, like gopro-telemetry does for the cts values.
+bool StreamGoProMP4Telemetry(const std::string& path_to_mp4,
+                             TelemetryConsumer& consumer);
+
+//! Length in seconds of the GPMF track of a GoPro MP4
+bool ReadGoProMP4TelemetryDuration(const std::string& path_to_mp4,
+                                   double& duration_s);
+
+//! Start times of the chapters of a split GoPro recording, given in
+//! recording order. Every chapter starts where the GPMF track of the one
+//! before it ended.
+bool GoProChapterOffsets(const std::vector<std::string>& chapter_mp4s,
+                         std::vector<double>& offsets_s);
+
+//! Parses the telemetry of all chapters concurrently and merges them,
+//! shifted by their offsets, into one time sorted stream
+bool ReadGoProChapterTelemetry(const std::vector<std::string>& chapter_mp4s,
+                               const std::vector<double>& offsets_s,
+                               CameraTelemetryData& telemetry);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -26,6 +26,13 @@ namespace io {
 
 bool read_scene_bson(const std::string& input_bson, nlohmann::json& scene_json);
 
+//! Only parses the views with a timestamp in [t_begin_s, t_end_s], the
+//! others are skipped in the mapped file without decoding them
+bool read_scene_bson(const std::string& input_bson,
+                     const double t_begin_s,
+                     const double t_end_s,
+                     nlohmann::json& scene_json);
+
 void scene_points_to_calib_dataset(const nlohmann::json& json,
                                    theia::Reconstruction& reconstruction);
 
@@ -15,14 +15,157 @@
 #pragma once
 
 #include <Eigen/Geometry>
+#include <cstdint>
+#include <fstream>
 #include <string>
+#include <vector>
 
+#include "OpenCameraCalibrator/io/chunked_file.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 namespace OpenICC {
 namespace io {
 
+//! Receives telemetry sample by sample, see StreamTelemetry
+class TelemetryConsumer {
+ public:
+  virtual ~TelemetryConsumer() {}
+  virtual void AddTimestamp(const int64_t timestamp_ns) = 0;
+  virtual void AddAccelerometer(const Eigen::Vector3d& accl) = 0;
+  virtual void AddGyroscope(const Eigen::Vector3d& gyro) = 0;
+};
+
+//! Streams the telemetry json (timestamps_ns, accelerometer, gyroscope)
+bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
+                       CameraTelemetryData& telemetry);
+
+//! Keeps only the samples in [t_begin_s, t_end_s]. The json has to be
+//! parsed completely, but only the samples of the range are converted.
 bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
+                       const double t_begin_s,
+                       const double t_end_s,
                        CameraTelemetryData& telemetry);
+
+//! Binary layout (little endian):
+//! "OICCTEL1" | uint32 version | uint64 n | int64 timestamps_ns[n] |
+//! float64 accelerometer[3n] | float64 gyroscope[3n]
+//! Compressed files are chunked files (see ChunkedFileWriter) with the magic
+//! "OICCTELC", every chunk holds the same three arrays for its samples.
+bool ReadTelemetryBinary(const std::string& path_to_telemetry_file,
+                         CameraTelemetryData& telemetry);
+
+//! Reads only the samples in [t_begin_s, t_end_s] of a binary telemetry
+//! file. Compressed files only decompress the chunks of the time range.
+bool ReadTelemetryBinaryRange(const std::string& path_to_telemetry_file,
+                              const double t_begin_s,
+                              const double t_end_s,
+                              CameraTelemetryData& telemetry);
+
+bool WriteTelemetryBinary(const std::string& path_to_telemetry_file,
+                          const CameraTelemetryData& telemetry);
+
+//! Writes compressed chunks of samples_per_chunk samples, kNone writes the
+//! uncompressed layout
+bool WriteTelemetryBinary(const std::string& path_to_telemetry_file,
+                          const CameraTelemetryData& telemetry,
+                          const ChunkCodec codec,
+                          const size_t samples_per_chunk);
+
+//! Default chunk size of compressed telemetry, about 3.5MB of raw samples
+const size_t kTelemetrySamplesPerChunk = 1 << 16;
+
+//! Writes the binary telemetry format sample by sample with constant memory.
+//! Timestamps go to the output file directly, the accelerometer and
+//! gyroscope values to temporary files that are appended on Close. With
+//! compression all three arrays go to temporary files and are chunked on
+//! Close.
+class TelemetryBinaryWriter : public TelemetryConsumer {
+ public:
+  TelemetryBinaryWriter() {}
+  ~TelemetryBinaryWriter();
+
+  //! Writes compressed chunks instead, has to be called before Open
+  void SetCompression(const ChunkCodec codec,
+                      const size_t samples_per_chunk =
+                          kTelemetrySamplesPerChunk) {
+    codec_ = codec;
+    samples_per_chunk_ = samples_per_chunk;
+  }
+
+  bool Open(const std::string& path_to_telemetry_file);
+
+  void AddTimestamp(const int64_t timestamp_ns) override;
+  void AddAccelerometer(const Eigen::Vector3d& accl) override;
+  void AddGyroscope(const Eigen::Vector3d& gyro) override;
+
+  //! Fails if not every timestamp got an accelerometer and gyroscope value
+  bool Close();
+
+  uint64_t NumDatapoints() const { return nr_timestamps_; }
+
+ private:
+  void RemoveParts();
+  bool WriteChunks();
+
+  std::string output_path_;
+  //! the timestamps part if compressed
+  std::ofstream output_;
+  std::ofstream accl_part_;
+  std::ofstream gyro_part_;
+  uint64_t nr_timestamps_ = 0;
+  uint64_t nr_accl_ = 0;
+  uint64_t nr_gyro_ = 0;
+  ChunkCodec codec_ = ChunkCodec::kNone;
+  size_t samples_per_chunk_ = kTelemetrySamplesPerChunk;
+};
+
+//! Reads the GPMF telemetry of a GoPro MP4, see StreamGoProMP4Telemetry
+bool ReadTelemetryMP4(const std::string& path_to_mp4,
+                      CameraTelemetryData& telemetry);
+
+//! k-way merge of time sorted telemetry streams into one time sorted stream.
+//! The samples of streams[i] are shifted by offsets_s[i], samples with the
+//! same time keep the order of the streams.
+bool MergeTelemetry(const std::vector<CameraTelemetryData>& streams,
+                    const std::vector<double>& offsets_s,
+                    CameraTelemetryData& merged);
+
+//! Reads a recording of javascript/data_recorder.js (little endian):
+//! "OICCREC1" | uint32 version | uint32 capacity | chunks. Every chunk is
+//! uint32 sensor | uint32 n | float64 timestamps_ms[capacity] |
+//! float64 x[capacity] | float64 y[capacity] | float64 z[capacity], of which
+//! the first n samples are valid. Sensor 0 is the accelerometer, 1 the
+//! gyroscope, their timestamps are independent. The file is memory mapped
+//! and the chunks of each sensor are concatenated without parsing.
+bool ReadRecorderTelemetry(const std::string& path_to_recording,
+                           CameraTelemetryData& telemetry);
+
+//! Reads binary, browser recorder, GoPro MP4 or json telemetry or the
+//! telemetry section of a session file, depending on the file content
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   CameraTelemetryData& telemetry);
+
+//! Reads only the samples in [t_begin_s, t_end_s]. Binary files and session
+//! files only read the range, see ReadTelemetryBinaryRange, the other
+//! formats are cropped after reading.
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   const double t_begin_s,
+                   const double t_end_s,
+                   CameraTelemetryData& telemetry);
+
+//! Passes the telemetry to the consumer without storing it. The arrays are
+//! passed in the order they appear in the file, so the timestamp,
+//! accelerometer and gyroscope value of one sample are not passed together.
+bool StreamTelemetryJSON(const std::string& path_to_telemetry_file,
+                         TelemetryConsumer& consumer);
+
+bool StreamTelemetryBinary(const std::string& path_to_telemetry_file,
+                           TelemetryConsumer& consumer);
+
+//! Streams binary, GoPro MP4 or json telemetry, depending on the file
+//! content
+bool StreamTelemetry(const std::string& path_to_telemetry_file,
+                     TelemetryConsumer& consumer);
+
 }  // namespace io
 }  // namespace OpenICC
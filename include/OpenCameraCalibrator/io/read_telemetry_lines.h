@@ -0,0 +1,39 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Streams a csv with the rows t_ns, gx, gy, gz, ax, ay, az, the layout of
+//! TelemetryImporter.read_csv. Lines that do not start with a number, e.g. a
+//! header, are skipped.
+bool StreamTelemetryCSV(const std::string& path_to_csv,
+                        TelemetryConsumer& consumer);
+
+//! Streams the jsonl log of the ZED recorder. The n-th accelerometer sample
+//! is paired with the n-th gyroscope sample and both get the gyroscope time.
+//! Only samples between the first and the last camera frame are passed and
+//! the timestamps start at 0, like TelemetryImporter.read_zed_jsonl.
+bool StreamZedTelemetryJSONL(const std::string& path_to_jsonl,
+                             TelemetryConsumer& consumer);
+
+}  // namespace io
+}  // namespace OpenICC
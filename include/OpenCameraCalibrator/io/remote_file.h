@@ -0,0 +1,108 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace OpenICC {
+namespace io {
+
+//! http:// and https:// URLs, e.g. objects of S3 compatible storage behind a
+//! public endpoint or presigned URLs
+bool IsRemoteUrl(const std::string& path);
+
+//! Only available if the library was built with libcurl (OPENICC_WITH_CURL)
+bool RemoteFetchAvailable();
+
+struct RemoteFetchOptions {
+  //! bytes per ranged request
+  size_t chunk_bytes = 8 << 20;
+  //! requests in flight at once
+  int num_connections = 4;
+  //! chunks fetched ahead of the read position
+  int read_ahead_chunks = 8;
+};
+
+//! Read only view of a remote file. The chunks in front of the read position
+//! are fetched with parallel ranged requests, chunks behind it are dropped
+//! again, so reading a file sequentially holds about read_ahead_chunks chunks
+//! in memory and nothing on disk. Seeking back refetches the chunks.
+class RemoteFile {
+ public:
+  RemoteFile() {}
+  ~RemoteFile() { Close(); }
+
+  RemoteFile(const RemoteFile&) = delete;
+  RemoteFile& operator=(const RemoteFile&) = delete;
+
+  //! Requests the size of the object and starts the fetch threads
+  bool Open(const std::string& url,
+            const RemoteFetchOptions& options = RemoteFetchOptions());
+
+  void Close();
+
+  uint64_t Size() const { return size_; }
+
+  //! Blocks until the bytes at offset are fetched. Returns the number of
+  //! bytes read, 0 at the end of the file and -1 if a request failed.
+  int64_t Read(const uint64_t offset, char* buffer, const size_t size);
+
+ private:
+  enum class ChunkState { kMissing, kFetching, kDone };
+
+  struct Chunk {
+    ChunkState state = ChunkState::kMissing;
+    std::vector<char> data;
+  };
+
+  //! Next missing chunk of the read ahead window, needs the lock
+  bool NextChunk(size_t& chunk_idx);
+
+  //! Drops the fetched chunks outside of the read ahead window, needs the
+  //! lock
+  void EvictChunks();
+
+  void WorkerLoop();
+
+  std::string url_;
+  RemoteFetchOptions options_;
+  uint64_t size_ = 0;
+  std::vector<Chunk> chunks_;
+  size_t read_chunk_ = 0;
+  bool failed_ = false;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable chunk_done_;
+  std::condition_variable window_moved_;
+  std::vector<std::thread> workers_;
+};
+
+//! Downloads a remote file to local_path with parallel ranged requests
+bool FetchRemoteFile(const std::string& url,
+                     const std::string& local_path,
+                     const RemoteFetchOptions& options = RemoteFetchOptions());
+
+//! Local file for a remote URL in the temporary directory of the system
+std::string RemoteTempPath(const std::string& url);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,141 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Sections of a calibration session. Each holds the file of the same name
+//! as it is written by the applications, byte for byte. ReadTelemetry,
+//! ReadObservationDataset, MappedScene, read_camera_calibration, the readers
+//! of read_misc.h and ReadSplineState accept a session file in place of the
+//! file of their section and map or parse only that section.
+//! scene ubjson of the board extractor
+const char kSessionCorners[] = "corners";
+//! observation dataset, see WriteObservationDataset
+const char kSessionObservations[] = "observations";
+//! binary telemetry, see WriteTelemetryBinary
+const char kSessionTelemetry[] = "telemetry";
+const char kSessionCameraCalibration[] = "camera_calibration";
+//! theia reconstruction of estimate_camera_poses_from_checkerboard
+const char kSessionPoseDataset[] = "pose_dataset";
+const char kSessionImuIntrinsics[] = "imu_intrinsics";
+const char kSessionImuBias[] = "imu_bias";
+const char kSessionGyroToCam[] = "gyro_to_cam";
+const char kSessionSplineWeighting[] = "spline_weighting";
+const char kSessionCalibrationResult[] = "calibration_result";
+const char kSessionSplineState[] = "spline_state";
+//! cameras and common view timeline of a multi camera extraction
+const char kSessionCameraRig[] = "camera_rig";
+
+//! Corners section of camera camera_idx of a rig. Camera 0 uses the corners
+//! section read by the single camera stages.
+std::string CameraCornersSection(const int camera_idx);
+
+//! Table of contents entry. Time indexed sections store the timestamps of
+//! their first and last sample in nanoseconds, the others 0.
+struct SessionSection {
+  char name[48] = {};
+  uint64_t offset = 0;
+  uint64_t bytes = 0;
+  int64_t first_key = 0;
+  int64_t last_key = 0;
+};
+
+//! Layout (little endian):
+//! "OICCSES1" | uint32 version | uint32 alignment | sections |
+//! SessionSection toc[num_sections] | uint64 num_sections | uint64 toc offset
+//! Sections start at multiples of the alignment, so the readers of the
+//! embedded files map them in place. The table of contents is written last,
+//! sections are copied with constant memory.
+class SessionWriter {
+ public:
+  SessionWriter() {}
+  ~SessionWriter();
+
+  bool Open(const std::string& path);
+
+  bool AddSection(const std::string& name,
+                  const char* data,
+                  const size_t bytes,
+                  const int64_t first_key = 0,
+                  const int64_t last_key = 0);
+
+  //! Copies a file as section
+  bool AddFile(const std::string& name,
+               const std::string& file_path,
+               const int64_t first_key = 0,
+               const int64_t last_key = 0);
+
+  //! Writes the table of contents
+  bool Close();
+
+ private:
+  bool BeginSection(const std::string& name);
+  bool EndSection(const int64_t first_key, const int64_t last_key);
+
+  std::string path_;
+  std::ofstream output_;
+  std::vector<SessionSection> toc_;
+};
+
+//! Reads only the table of contents on Open. Sections are mapped or parsed
+//! on request, so a stage touches only the sections it needs.
+class SessionReader {
+ public:
+  bool Open(const std::string& path);
+
+  const std::string& Path() const { return path_; }
+
+  const std::vector<SessionSection>& Sections() const { return toc_; }
+
+  //! False if the session has no such section
+  bool FindSection(const std::string& name, SessionSection& section) const;
+
+  //! Parses a json or ubjson section
+  bool ReadJson(const std::string& name, nlohmann::json& section_json) const;
+
+  //! Copies a section to a file, for readers that only take paths
+  bool ExtractSection(const std::string& name,
+                      const std::string& output_path) const;
+
+ private:
+  std::string path_;
+  std::vector<SessionSection> toc_;
+};
+
+bool IsSessionFile(const std::string& path);
+
+//! The section of a session file or the file itself, used by the readers
+//! that accept either. Returns the byte range of path to read.
+bool ResolveSessionSection(const std::string& path,
+                           const std::string& section_name,
+                           uint64_t& offset,
+                           uint64_t& bytes);
+
+//! Parses a json file, or the json section of a session file
+bool ReadJsonFileOrSection(const std::string& path,
+                           const std::string& section_name,
+                           nlohmann::json& file_json);
+
+}  // namespace io
+}  // namespace OpenICC
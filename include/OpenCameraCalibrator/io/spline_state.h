@@ -0,0 +1,88 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <Eigen/Core>
+
+#include "OpenCameraCalibrator/utils/types.h"
+#include "sophus/se3.hpp"
+
+namespace OpenICC {
+namespace io {
+
+//! Optimized state of a SplineTrajectoryEstimator: the spline knots of the
+//! trajectory and the bias splines and the calibration of the rig. See
+//! SplineTrajectoryEstimator::GetState
+struct SplineState {
+  uint32_t spline_order = 0;
+
+  int64_t start_t_ns = 0;
+  int64_t end_t_ns = 0;
+  int64_t dt_so3_ns = 0;
+  int64_t dt_r3_ns = 0;
+  int64_t dt_accl_bias_ns = 0;
+  int64_t dt_gyro_bias_ns = 0;
+
+  so3_vector so3_knots;
+  vec3_vector r3_knots;
+  vec3_vector accl_bias_knots;
+  vec3_vector gyro_bias_knots;
+  double max_accl_bias_range = 0.0;
+  double max_gyro_bias_range = 0.0;
+
+  Sophus::SE3d T_i_c;
+  Eigen::Vector3d gravity = Eigen::Vector3d::Zero();
+  Eigen::Matrix<double, 6, 1> accl_intrinsics =
+      Eigen::Matrix<double, 6, 1>::Zero();
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics =
+      Eigen::Matrix<double, 9, 1>::Zero();
+  double cam_line_delay_s = 0.0;
+  double imu_to_camera_time_offset_s = 0.0;
+
+  //! same spline order, times and number of knots
+  bool SameKnotLayout(const SplineState& other) const {
+    return spline_order == other.spline_order &&
+           start_t_ns == other.start_t_ns && end_t_ns == other.end_t_ns &&
+           dt_so3_ns == other.dt_so3_ns && dt_r3_ns == other.dt_r3_ns &&
+           dt_accl_bias_ns == other.dt_accl_bias_ns &&
+           dt_gyro_bias_ns == other.dt_gyro_bias_ns &&
+           so3_knots.size() == other.so3_knots.size() &&
+           r3_knots.size() == other.r3_knots.size() &&
+           accl_bias_knots.size() == other.accl_bias_knots.size() &&
+           gyro_bias_knots.size() == other.gyro_bias_knots.size();
+  }
+};
+
+//! Binary layout (little endian):
+//! "OICCSPL1" | uint32 version | uint32 spline_order |
+//! int64 start_t_ns, end_t_ns, dt_so3_ns, dt_r3_ns, dt_accl_bias_ns,
+//! dt_gyro_bias_ns | uint64 n_so3, n_r3, n_accl_bias, n_gyro_bias |
+//! float64 so3_knots[4 n_so3] (qx, qy, qz, qw) | float64 r3_knots[3 n_r3] |
+//! float64 accl_bias_knots[3 n_accl_bias] |
+//! float64 gyro_bias_knots[3 n_gyro_bias] |
+//! float64 T_i_c[7] (qx, qy, qz, qw, tx, ty, tz) | float64 gravity[3] |
+//! float64 accl_intrinsics[6] | float64 gyro_intrinsics[9] |
+//! float64 cam_line_delay_s, imu_to_camera_time_offset_s,
+//! max_accl_bias_range, max_gyro_bias_range
+bool WriteSplineState(const std::string& path, const SplineState& state);
+
+bool ReadSplineState(const std::string& path, SplineState& state);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -24,10 +24,15 @@
 namespace OpenICC {
 namespace io {
 
-bool write_camera_calibration(const std::string& output_file,
-                              const theia::Camera& camera,
-                              const double fps,
-                              const int nr_calib_images,
-                              const double total_reproj_error);
+//! intrinsics_std are written as "intrinsics_std" and bootstrap_intrinsics_std
+//! as "intrinsics_bootstrap_std" in the theia parameter order if not empty
+bool write_camera_calibration(
+    const std::string& output_file,
+    const theia::Camera& camera,
+    const double fps,
+    const int nr_calib_images,
+    const double total_reproj_error,
+    const Eigen::VectorXd& intrinsics_std = Eigen::VectorXd(),
+    const Eigen::VectorXd& bootstrap_intrinsics_std = Eigen::VectorXd());
 }  // namespace io
 }  // namespace OpenICC
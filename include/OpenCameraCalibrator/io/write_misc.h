@@ -0,0 +1,32 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Geometry>
+#include <string>
+
+namespace OpenICC {
+namespace io {
+
+//! Writes the initial imu to camera calibration, can be read with
+//! ReadIMU2CamInit
+bool WriteIMU2CamInit(const std::string& path_to_file,
+                      const Eigen::Vector3d& gyro_bias,
+                      const Eigen::Quaterniond& imu_to_cam_rotation,
+                      const double time_offset_imu_to_cam);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,84 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <OpenCameraCalibrator/utils/json.h>
+
+namespace OpenICC {
+namespace io {
+
+//! Writes the extracted corners as UBJSON directly to disk, one view at a
+//! time, instead of building the whole json tree in memory first. The result
+//! can be read with read_scene_bson.
+class SceneStreamWriter {
+ public:
+  SceneStreamWriter() {}
+  ~SceneStreamWriter();
+
+  //! Opens the output file and starts the top level object
+  bool Open(const std::string& output_bson);
+
+  //! Reopens the temporary file of an interrupted extraction and continues
+  //! after the state returned by Checkpoint
+  bool Resume(const std::string& output_bson, const nlohmann::json& state);
+
+  //! Flushes the written views to disk and returns the state needed to
+  //! resume the file from this point
+  nlohmann::json Checkpoint();
+
+  //! Adds the image points of one view, e.g. {"image_points": {...}}
+  void AddView(const std::string& view_us, const nlohmann::json& view);
+
+  //! Writes the remaining top level entries (board, fps, image size, ...) and
+  //! closes the file
+  bool Close(const nlohmann::json& header);
+
+ private:
+  void WriteKey(const std::string& key);
+  void WriteValue(const nlohmann::json& value);
+  void FlushView();
+
+  std::string output_path_;
+  std::ofstream output_;
+
+  //! views are kept until the next view arrives, as views with the same
+  //! timestamp have to be merged
+  std::string pending_view_us_;
+  nlohmann::json pending_view_;
+
+  bool views_started_ = false;
+};
+
+//! Merges scene files that were extracted from frame ranges of the same
+//! recording. Views with the same timestamp are merged, header entries are
+//! taken from the first file that has them and the frame filter counts are
+//! summed.
+bool MergeSceneFiles(const std::vector<std::string>& input_bsons,
+                     const std::string& output_bson);
+
+//! Merges the scene files of consecutive chapters of a split recording. The
+//! view timestamps of input_bsons[i] are shifted by time_offsets_s[i].
+bool MergeSceneFiles(const std::vector<std::string>& input_bsons,
+                     const std::vector<double>& time_offsets_s,
+                     const std::string& output_bson);
+
+}  // namespace io
+}  // namespace OpenICC
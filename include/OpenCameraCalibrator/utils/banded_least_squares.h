@@ -0,0 +1,63 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+
+namespace OpenICC {
+namespace utils {
+
+//! Normal equations H dx = -g of a linear least squares problem whose
+//! residual blocks only couple unknowns that are at most bandwidth indices
+//! apart, e.g. the knots of a uniform B-spline. H is stored as its upper
+//! band, so accumulating and solving with the banded Cholesky factorization
+//! is linear in the number of unknowns.
+class BandedLeastSquares {
+ public:
+  BandedLeastSquares(const int num_unknowns, const int bandwidth);
+
+  //! Adds the residual block weight * (J * x[first:first + J.cols()] + r).
+  //! Blocks that leave the band or the unknowns are ignored, returns false
+  //! for them
+  bool AddResidualBlock(const int first,
+                        const Eigen::MatrixXd& J,
+                        const Eigen::VectorXd& r,
+                        const double weight = 1.0);
+
+  //! Adds lambda * |x|^2, keeps unknowns without residuals solvable
+  void AddDamping(const double lambda);
+
+  //! Returns false if H is not positive definite
+  bool Solve(Eigen::VectorXd& dx) const;
+
+  void SetZero();
+
+  int NumUnknowns() const { return num_unknowns_; }
+
+  //! sum of the squared weighted residuals that were added
+  double Cost() const { return cost_; }
+
+ private:
+  int num_unknowns_;
+  int bandwidth_;
+  //! band_(d, i) = H(i, i + d)
+  Eigen::MatrixXd band_;
+  Eigen::VectorXd g_;
+  double cost_ = 0.0;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
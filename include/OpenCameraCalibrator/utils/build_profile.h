@@ -0,0 +1,38 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace OpenICC {
+namespace utils {
+
+//! Defaults of the applications that depend on the build profile. The
+//! embedded ARM profile (-DBUILD_EMBEDDED_ARM=ON) keeps the pipeline inside
+//! the memory of small devices: decimated IMU residuals, a memory budget
+//! that spills the large arrays and streaming telemetry statistics.
+#ifdef OPENICC_EMBEDDED
+constexpr double kDefaultImuDecimationRateHz = 200.0;
+constexpr int64_t kDefaultMemoryBudgetMb = 1536;
+constexpr bool kDefaultStreaming = true;
+#else
+constexpr double kDefaultImuDecimationRateHz = 0.0;
+constexpr int64_t kDefaultMemoryBudgetMb = 0;
+constexpr bool kDefaultStreaming = false;
+#endif
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,60 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/camera/camera_intrinsics_model.h>
+#include <theia/sfm/camera/division_undistortion_camera_model.h>
+#include <theia/sfm/camera/double_sphere_camera_model.h>
+#include <theia/sfm/camera/extended_unified_camera_model.h>
+#include <theia/sfm/camera/fisheye_camera_model.h>
+#include <theia/sfm/camera/pinhole_camera_model.h>
+#include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
+
+namespace OpenICC {
+namespace utils {
+
+template <class CameraModelT>
+struct CameraModelTag {
+  using CameraModel = CameraModelT;
+};
+
+//! Resolves the theia camera model type once and calls
+//! visitor(CameraModelTag<CameraModel>()). Returns false for unsupported
+//! models, otherwise the result of the visitor.
+template <class Visitor>
+bool DispatchCameraModel(const theia::CameraIntrinsicsModelType model_type,
+                         Visitor&& visitor) {
+  switch (model_type) {
+    case theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION:
+      return visitor(CameraModelTag<theia::DivisionUndistortionCameraModel>());
+    case theia::CameraIntrinsicsModelType::DOUBLE_SPHERE:
+      return visitor(CameraModelTag<theia::DoubleSphereCameraModel>());
+    case theia::CameraIntrinsicsModelType::PINHOLE:
+      return visitor(CameraModelTag<theia::PinholeCameraModel>());
+    case theia::CameraIntrinsicsModelType::FISHEYE:
+      return visitor(CameraModelTag<theia::FisheyeCameraModel>());
+    case theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED:
+      return visitor(CameraModelTag<theia::ExtendedUnifiedCameraModel>());
+    case theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL:
+      return visitor(
+          CameraModelTag<theia::PinholeRadialTangentialCameraModel>());
+    default:
+      return false;
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,60 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/reconstruction.h>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Spatially stratified selection of the corners of a view, bounds the
+//! residuals a dense board adds per view
+struct CornerSubsamplingOptions {
+  //! corners kept per view, 0 keeps all corners
+  int max_corners_per_view = 0;
+  //! the interior corners are drawn in turns from the cells of this grid
+  //! over the image
+  int grid_cols = 8;
+  int grid_rows = 6;
+  //! corners closer to the image border than this fraction of the smaller
+  //! image side are all kept, they constrain the distortion. 0 keeps none
+  //! of them beyond the cap.
+  double border_fraction = 0.0;
+};
+
+//! Indices of the corners to keep, ascending. Keeps the border corners,
+//! then takes the corner closest to the center of every grid cell in turns
+//! until max_corners_per_view corners are selected. Deterministic for the
+//! same corners.
+void SubsampleCorners(const vec2_vector& corners,
+                      const int image_width,
+                      const int image_height,
+                      const CornerSubsamplingOptions& options,
+                      std::vector<size_t>& selected);
+
+//! Removes the observations of every view of reconstruction that
+//! SubsampleCorners does not select, the image size is that of the view
+//! camera. Returns the number of removed observations.
+size_t SubsampleViewCorners(const CornerSubsamplingOptions& options,
+                            theia::Reconstruction& reconstruction);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,55 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Parses a cpu list like "0-3,8,10-11" as used by /sys and taskset
+bool ParseCpuList(const std::string& list, std::vector<int>& cpus);
+
+//! NUMA nodes of the machine, 1 if the topology can not be read
+int NumNumaNodes();
+
+//! CPUs of a NUMA node, empty if the node does not exist
+std::vector<int> NumaNodeCpus(const int node);
+
+//! NUMA node of a cpu, 0 if unknown
+int NumaNodeOfCpu(const int cpu);
+
+//! cpus the process may run on as set by taskset or a parent process, the
+//! hardware threads if the affinity can not be read
+int NumProcessCpus();
+
+//! cpu the calling thread runs on, -1 if unknown
+int CurrentCpu();
+
+//! NUMA node the calling thread runs on
+int CurrentNumaNode();
+
+//! Restricts the calling thread to the given cpus. Memory the thread touches
+//! first is then allocated on their node by the default linux policy.
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+//! Resolves a placement, either "node:<n>" for all cpus of a NUMA node or a
+//! cpu list. Empty gives no cpus.
+bool ResolveCpuPlacement(const std::string& placement, std::vector<int>& cpus);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,38 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Finds the lag in samples that maximizes the normalized cross correlation
+//! of two signals sampled at the same constant rate, i.e. b[t + lag] ~ a[t].
+//! Only lags in [-max_lag, max_lag] are considered. The correlation is
+//! computed with an FFT in O(n log n) and the integer peak is refined with a
+//! parabola through its neighbours.
+//!
+//! peak_correlation is the normalized correlation at the integer peak, in
+//! [-1, 1]. Returns false if one of the signals is constant or too short.
+bool CrossCorrelationLag(const std::vector<double>& a,
+                         const std::vector<double>& b,
+                         const int max_lag,
+                         double& lag,
+                         double& peak_correlation);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,171 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Scheduling order of pending tasks. Within a priority the owner of a queue
+//! takes its newest task, thieves take the oldest one.
+enum class TaskPriority { kHigh = 0, kNormal = 1, kLow = 2 };
+
+//! Process wide work-stealing thread pool that all subsystems submit their
+//! parallel work to, so nested parallel stages share one set of threads
+//! instead of multiplying them. Every worker owns one queue per priority,
+//! tasks submitted from a worker go to its own queue, all others to a shared
+//! injection queue. Idle workers steal from the others.
+class Executor {
+ public:
+  //! The executor used by ParallelFor, TaskGroup and the solvers. Starts
+  //! with one thread per hardware thread.
+  static Executor& Global();
+
+  explicit Executor(const int max_concurrency = 0);
+  ~Executor();
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  //! Caps the threads that run tasks at the same time. The thread that waits
+  //! for a TaskGroup helps executing tasks and counts towards the cap, so the
+  //! executor starts max_concurrency - 1 workers. 0 uses the hardware
+  //! threads. Must not be called while tasks are running.
+  void SetMaxConcurrency(int max_concurrency);
+
+  int MaxConcurrency() const { return max_concurrency_; }
+
+  //! Pins worker i to cpu_sets[i % cpu_sets.size()], empty unpins them. On
+  //! machines with several NUMA nodes, tasks are queued per node of the
+  //! submitting thread and workers take the tasks of their own node first.
+  //! Must not be called while tasks are running.
+  void SetWorkerCpuSets(const std::vector<std::vector<int>>& cpu_sets);
+
+  //! Threads a library with its own thread pool (ceres, theia) should use
+  //! from the calling thread: the requested number clamped to the part of
+  //! the concurrency cap that is not running tasks right now. 1 in
+  //! deterministic mode.
+  int SolverThreads(const int requested) const;
+
+  //! Bit-reproducible results independent of thread count and load. The
+  //! parallel stages of the library reduce in a fixed order in both modes,
+  //! but ceres sums the cost and gradient in the order its threads pick up
+  //! the residual blocks, so deterministic mode runs the solvers single
+  //! threaded. Must not be called while tasks are running.
+  void SetDeterministic(const bool deterministic) {
+    deterministic_ = deterministic;
+  }
+
+  bool Deterministic() const { return deterministic_; }
+
+  void Submit(std::function<void()> task, const TaskPriority priority);
+
+  //! Runs the most urgent pending task on the calling thread. Returns false
+  //! if no task was pending.
+  bool RunPendingTask();
+
+  //! Tasks that ran on another NUMA node than the one they were submitted
+  //! from, 0 on single node machines
+  int64_t NumCrossNodeTasks() const { return num_cross_node_tasks_; }
+
+ private:
+  struct Task {
+    std::function<void()> func;
+    //! node of the submitting thread
+    int numa_node = 0;
+  };
+
+  struct TaskQueue {
+    std::mutex mutex;
+    // one deque per TaskPriority
+    std::deque<Task> tasks[3];
+    //! node of the cpus the owner is pinned to, -1 if not pinned
+    int numa_node = -1;
+  };
+
+  void StartWorkers();
+  void StopWorkers();
+  void WorkerLoop(const size_t worker_idx);
+  //! node the calling thread runs on
+  int ThreadNumaNode() const;
+  bool PopTask(const int worker_idx, Task& task, TaskPriority& priority);
+  void RunTask(Task& task, const TaskPriority priority);
+
+  int max_concurrency_;
+  bool deterministic_ = false;
+  const bool numa_aware_;
+  std::vector<std::vector<int>> worker_cpu_sets_;
+  std::vector<std::unique_ptr<TaskQueue>> worker_queues_;
+  //! tasks of threads that are no workers, one queue per NUMA node
+  std::vector<std::unique_ptr<TaskQueue>> injection_queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<int> num_pending_{0};
+  std::atomic<int> num_running_{0};
+  std::atomic<int64_t> num_cross_node_tasks_{0};
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+};
+
+//! Priority of the tasks the calling thread submits while the scope lives.
+//! Tasks inherit the priority of the thread that submitted them.
+class ScopedTaskPriority {
+ public:
+  explicit ScopedTaskPriority(const TaskPriority priority);
+  ~ScopedTaskPriority();
+
+  //! Priority of the tasks submitted from the calling thread
+  static TaskPriority Current();
+
+ private:
+  const TaskPriority previous_;
+};
+
+//! Tasks whose completion is awaited together. Wait() executes pending tasks
+//! of the executor until all tasks of the group finished, so waiting inside
+//! a task does not block a worker.
+class TaskGroup {
+ public:
+  explicit TaskGroup(Executor& executor = Executor::Global())
+      : executor_(executor), priority_(ScopedTaskPriority::Current()) {}
+  ~TaskGroup() { Wait(); }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void Run(std::function<void()> task);
+
+  void Wait();
+
+ private:
+  Executor& executor_;
+  const TaskPriority priority_;
+  std::atomic<int> num_unfinished_{0};
+  std::mutex mutex_;
+  std::condition_variable finished_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
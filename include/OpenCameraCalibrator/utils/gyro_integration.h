@@ -37,6 +37,7 @@
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <iostream>
+#include <vector>
 
 namespace OpenICC {
 namespace utils {
@@ -70,6 +71,63 @@ inline void NormalizeQuaternion(_T quat[4]) {
   NormalizeQuaternion(tmp_q);
 }
 
+/** @brief Product of a quaternion q = (w, x, y, z) with the pure quaternion
+ * (0, omega), i.e. ComputeOmegaSkew(omega) * q without building the skew
+ * matrix. The components can be scalars or Eigen arrays, in the latter case
+ * every coefficient holds a different quaternion.
+ */
+template <typename _Q>
+inline void QuatOmegaProduct(const _Q q[4], const _Q omega[3], _Q res[4]) {
+  res[0] = -(q[1] * omega[0] + q[2] * omega[1] + q[3] * omega[2]);
+  res[1] = q[0] * omega[0] + q[2] * omega[2] - q[3] * omega[1];
+  res[2] = q[0] * omega[1] - q[1] * omega[2] + q[3] * omega[0];
+  res[3] = q[0] * omega[2] + q[1] * omega[1] - q[2] * omega[0];
+}
+
+/** @brief RK4 Runge-Kutta integration step on quaternion components, see
+ * QuatIntegrationStepRK4. The components can be scalars or Eigen arrays, which
+ * integrates one rotation per array coefficient. quat and quat_res must not
+ * alias.
+ */
+template <typename _Q>
+inline void QuatComponentsStepRK4(const _Q quat[4],
+                                  const _Q omega0[3],
+                                  const _Q omega1[3],
+                                  const _Q& dt,
+                                  _Q quat_res[4]) {
+  using std::sqrt;
+  const _Q omega01[3] = {0.5 * (omega0[0] + omega1[0]),
+                         0.5 * (omega0[1] + omega1[1]),
+                         0.5 * (omega0[2] + omega1[2])};
+  // The products below miss the 0.5 factor of the quaternion derivative, it
+  // is folded into half_dt
+  const _Q half_dt = 0.5 * dt;
+  _Q k1[4], k2[4], k3[4], k4[4], tmp_q[4];
+
+  // First Runge-Kutta coefficient
+  QuatOmegaProduct(quat, omega0, k1);
+  // Second Runge-Kutta coefficient
+  for (int j = 0; j < 4; ++j) tmp_q[j] = quat[j] + 0.5 * half_dt * k1[j];
+  QuatOmegaProduct(tmp_q, omega01, k2);
+  // Third Runge-Kutta coefficient (same omega as second coeff.)
+  for (int j = 0; j < 4; ++j) tmp_q[j] = quat[j] + 0.5 * half_dt * k2[j];
+  QuatOmegaProduct(tmp_q, omega01, k3);
+  // Forth Runge-Kutta coefficient
+  for (int j = 0; j < 4; ++j) tmp_q[j] = quat[j] + half_dt * k3[j];
+  QuatOmegaProduct(tmp_q, omega1, k4);
+
+  for (int j = 0; j < 4; ++j) {
+    quat_res[j] = quat[j] + half_dt * ((1.0 / 6.0) * k1[j] +
+                                       (1.0 / 3.0) * k2[j] +
+                                       (1.0 / 3.0) * k3[j] +
+                                       (1.0 / 6.0) * k4[j]);
+  }
+  const _Q quat_norm =
+      sqrt(quat_res[0] * quat_res[0] + quat_res[1] * quat_res[1] +
+           quat_res[2] * quat_res[2] + quat_res[3] * quat_res[3]);
+  for (int j = 0; j < 4; ++j) quat_res[j] = quat_res[j] / quat_norm;
+}
+
 /** @brief Perform a RK4 Runge-Kutta integration step
  *
  * @param quat The input Eigen 4D vector representing the initial rotation
@@ -84,27 +142,83 @@ inline void QuatIntegrationStepRK4(const Eigen::Matrix<_T, 4, 1>& quat,
                                    const Eigen::Matrix<_T, 3, 1>& omega1,
                                    const _T& dt,
                                    Eigen::Matrix<_T, 4, 1>& quat_res) {
-  Eigen::Matrix<_T, 3, 1> omega01 = _T(0.5) * (omega0 + omega1);
-  Eigen::Matrix<_T, 4, 1> k1, k2, k3, k4, tmp_q;
-  Eigen::Matrix<_T, 4, 4> omega_skew;
+  const _T q[4] = {quat(0), quat(1), quat(2), quat(3)};
+  const _T w0[3] = {omega0(0), omega0(1), omega0(2)};
+  const _T w1[3] = {omega1(0), omega1(1), omega1(2)};
+  _T q_res[4];
+  QuatComponentsStepRK4(q, w0, w1, dt, q_res);
+  quat_res << q_res[0], q_res[1], q_res[2], q_res[3];
+}
 
-  // First Runge-Kutta coefficient
-  ComputeOmegaSkew(omega0, omega_skew);
-  k1 = _T(0.5) * omega_skew * quat;
-  // Second Runge-Kutta coefficient
-  tmp_q = quat + _T(0.5) * dt * k1;
-  ComputeOmegaSkew(omega01, omega_skew);
-  k2 = _T(0.5) * omega_skew * tmp_q;
-  // Third Runge-Kutta coefficient (same omega skew as second coeff.)
-  tmp_q = quat + _T(0.5) * dt * k2;
-  k3 = _T(0.5) * omega_skew * tmp_q;
-  // Forth Runge-Kutta coefficient
-  tmp_q = quat + dt * k3;
-  ComputeOmegaSkew(omega1, omega_skew);
-  k4 = _T(0.5) * omega_skew * tmp_q;
-  _T mult1 = _T(1.0) / _T(6.0), mult2 = _T(1.0) / _T(3.0);
-  quat_res = quat + dt * (mult1 * k1 + mult2 * k2 + mult2 * k3 + mult1 * k4);
-  NormalizeQuaternion(quat_res);
+/** @brief Jacobian of QuatOmegaProduct w.r.t. omega, i.e.
+ * QuatOmegaProduct(q, omega) = QuatOmegaProductJacobian(q) * omega
+ */
+inline Eigen::Matrix<double, 4, 3> QuatOmegaProductJacobian(
+    const Eigen::Vector4d& q) {
+  Eigen::Matrix<double, 4, 3> jacobian;
+  jacobian << -q(1), -q(2), -q(3), q(0), -q(3), q(2), q(3), q(0), -q(1), -q(2),
+      q(1), q(0);
+  return jacobian;
+}
+
+/** @brief Same RK4 Runge-Kutta integration step as QuatIntegrationStepRK4 in
+ * plain doubles, which also propagates the jacobian of the rotation w.r.t. P
+ * parameters the rotational velocities depend on.
+ *
+ * @param d_omega0 Jacobian of omega0 w.r.t. the parameters
+ * @param d_omega1 Jacobian of omega1 w.r.t. the parameters
+ * @param[in,out] d_quat Jacobian of quat, replaced by the one of quat_res.
+ * It stays tangent to the unit quaternions.
+ */
+template <int P>
+inline void QuatIntegrationStepRK4(const Eigen::Vector4d& quat,
+                                   const Eigen::Vector3d& omega0,
+                                   const Eigen::Vector3d& omega1,
+                                   const double dt,
+                                   const Eigen::Matrix<double, 3, P>& d_omega0,
+                                   const Eigen::Matrix<double, 3, P>& d_omega1,
+                                   Eigen::Vector4d& quat_res,
+                                   Eigen::Matrix<double, 4, P>& d_quat) {
+  const Eigen::Vector3d omega01 = 0.5 * (omega0 + omega1);
+  const Eigen::Matrix<double, 3, P> d_omega01 = 0.5 * (d_omega0 + d_omega1);
+  const double half_dt = 0.5 * dt;
+  Eigen::Matrix4d skew0, skew01, skew1;
+  ComputeOmegaSkew(omega0, skew0);
+  ComputeOmegaSkew(omega01, skew01);
+  ComputeOmegaSkew(omega1, skew1);
+
+  // the stages of QuatComponentsStepRK4 and their variations
+  const Eigen::Vector4d k1 = skew0 * quat;
+  const Eigen::Vector4d q2 = quat + 0.5 * half_dt * k1;
+  const Eigen::Vector4d k2 = skew01 * q2;
+  const Eigen::Vector4d q3 = quat + 0.5 * half_dt * k2;
+  const Eigen::Vector4d k3 = skew01 * q3;
+  const Eigen::Vector4d q4 = quat + half_dt * k3;
+  const Eigen::Vector4d k4 = skew1 * q4;
+  const Eigen::Vector4d q_step =
+      quat + half_dt * ((1.0 / 6.0) * k1 + (1.0 / 3.0) * k2 +
+                        (1.0 / 3.0) * k3 + (1.0 / 6.0) * k4);
+
+  const Eigen::Matrix<double, 4, P> d_k1 =
+      skew0 * d_quat + QuatOmegaProductJacobian(quat) * d_omega0;
+  const Eigen::Matrix<double, 4, P> d_k2 =
+      skew01 * (d_quat + 0.5 * half_dt * d_k1) +
+      QuatOmegaProductJacobian(q2) * d_omega01;
+  const Eigen::Matrix<double, 4, P> d_k3 =
+      skew01 * (d_quat + 0.5 * half_dt * d_k2) +
+      QuatOmegaProductJacobian(q3) * d_omega01;
+  const Eigen::Matrix<double, 4, P> d_k4 =
+      skew1 * (d_quat + half_dt * d_k3) +
+      QuatOmegaProductJacobian(q4) * d_omega1;
+  const Eigen::Matrix<double, 4, P> d_q_step =
+      d_quat + half_dt * ((1.0 / 6.0) * d_k1 + (1.0 / 3.0) * d_k2 +
+                          (1.0 / 3.0) * d_k3 + (1.0 / 6.0) * d_k4);
+
+  // normalization
+  const double norm = q_step.norm();
+  quat_res = q_step / norm;
+  d_quat = (Eigen::Matrix4d::Identity() - quat_res * quat_res.transpose()) *
+           d_q_step / norm;
 }
 
 /** @brief Perform a RK4 Runge-Kutta integration step
@@ -144,7 +258,7 @@ inline void QuatIntegrationStepRK4(const _T quat[4],
  * assumed to be the identity quaternion.
  *
  * @param gyro_samples Input gyroscope signal (rotational velocity samples
- * vector)
+ * vector), a std::vector<ImuReading<_T>> or an ImuSamplesView<_T>
  * @param[out] quat_res Resulting final rotation quaternion
  * @param dt Fixed time step (t1 - t0) between samples. If is -1, the sample
  * timestamps are used instead.
@@ -152,8 +266,8 @@ inline void QuatIntegrationStepRK4(const _T quat[4],
  * interval is not valid, i.e., one of the two indices is -1, the integration is
  * computed for the whole data sequence.
  */
-template <typename _T>
-void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
+template <typename _T, typename Samples>
+void IntegrateGyroInterval(const Samples& gyro_samples,
                            Eigen::Matrix<_T, 4, 1>& quat_res,
                            _T data_dt = _T(-1),
                            const DataInterval& interval = DataInterval()) {
@@ -182,7 +296,7 @@ void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
  * assumed to be the identity rotation matrix.
  *
  * @param gyro_samples Input gyroscope signal (rotational velocity samples
- * vector)
+ * vector), a std::vector<ImuReading<_T>> or an ImuSamplesView<_T>
  * @param[out] quat_res Resulting final rotation matrix
  * @param dt Fixed time step (t1 - t0) between samples. If is -1, the sample
  * timestamps are used instead.
@@ -190,8 +304,8 @@ void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
  * interval is not valid, i.e., one of the two indices is -1, the integration is
  * computed for the whole data sequence.
  */
-template <typename _T>
-void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
+template <typename _T, typename Samples>
+void IntegrateGyroInterval(const Samples& gyro_samples,
                            Eigen::Matrix<_T, 3, 3>& rot_res,
                            _T data_dt = _T(-1),
                            const DataInterval& interval = DataInterval()) {
@@ -202,5 +316,38 @@ void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
   ceres::QuaternionToRotation(quat_res.data(), rot_mat);
 }
 
+/** @brief Integrate several intervals of a sequence of rotational velocities
+ *         using the RK4 Runge-Kutta discrete integration method, see
+ * IntegrateGyroInterval.
+ *
+ * @param gyro_samples Input gyroscope signal
+ * @param intervals Data intervals where to compute the integrations
+ * @param[out] quats_res Resulting final rotation quaternions, one column per
+ * interval
+ * @param dt Fixed time step (t1 - t0) between samples. If is -1, the sample
+ * timestamps are used instead.
+ */
+template <typename _T, typename Samples>
+void IntegrateGyroIntervals(const Samples& gyro_samples,
+                            const std::vector<DataInterval>& intervals,
+                            Eigen::Matrix<_T, 4, Eigen::Dynamic>& quats_res,
+                            _T data_dt = _T(-1)) {
+  quats_res.resize(4, intervals.size());
+  Eigen::Matrix<_T, 4, 1> quat_res;
+  for (size_t k = 0; k < intervals.size(); ++k) {
+    IntegrateGyroInterval(gyro_samples, quat_res, data_dt, intervals[k]);
+    quats_res.col(k) = quat_res;
+  }
+}
+
+/** @brief Same as IntegrateGyroIntervals, but all intervals are integrated in
+ * lockstep with one quaternion per SIMD lane. Shorter intervals keep their
+ * result once they ran out of samples.
+ */
+void IntegrateGyroIntervals(const ImuSamplesViewd& gyro_samples,
+                            const std::vector<DataInterval>& intervals,
+                            Eigen::Matrix<double, 4, Eigen::Dynamic>& quats_res,
+                            double data_dt = -1.0);
+
 }  // namespace utils
 }  // namespace OpenICC
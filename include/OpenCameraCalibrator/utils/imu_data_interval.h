@@ -58,7 +58,8 @@ struct DataInterval {
    * @param start_ts Initial timestamp
    * @param end_ts Final timestamp
    */
-  static DataInterval FromTimestamps(const ImuReadings& samples,
+  template <typename Samples>
+  static DataInterval FromTimestamps(const Samples& samples,
                                      double start_ts,
                                      double end_ts) {
     if (start_ts < 0 || end_ts <= start_ts)
@@ -86,7 +87,8 @@ struct DataInterval {
    * @param samples Input signal (data samples vector)
    * @param duration Interval duration
    */
-  static DataInterval InitialInterval(const ImuReadings& samples,
+  template <typename Samples>
+  static DataInterval InitialInterval(const Samples& samples,
                                       double duration_s) {
     if (duration_s <= 0)
       throw std::invalid_argument("Invalid interval duration");
@@ -109,7 +111,8 @@ struct DataInterval {
    * @param samples Input signal (data samples vector)
    * @param duration Interval duration
    */
-  static DataInterval FinalInterval(const ImuReadings& samples,
+  template <typename Samples>
+  static DataInterval FinalInterval(const Samples& samples,
                                     double duration) {
     if (duration <= 0) throw std::invalid_argument("Invalid interval duration");
     if (samples.size() < 3)
@@ -128,7 +131,8 @@ struct DataInterval {
   int start_idx, end_idx;
 
  private:
-  static int TimeToIndex(const ImuReadings& samples, double ts) {
+  template <typename Samples>
+  static int TimeToIndex(const Samples& samples, double ts) {
     int idx0 = 0, idx1 = samples.size() - 1, idxm;
     while (idx1 - idx0 > 1) {
       idxm = (idx1 + idx0) / 2;
@@ -154,8 +158,8 @@ struct DataInterval {
  *
  * @returns The "corrected" interval
  */
-template <typename T>
-DataInterval CheckInterval(const std::vector<ImuReading<T>>& samples,
+template <typename Samples>
+DataInterval CheckInterval(const Samples& samples,
                            const DataInterval& interval) {
   int start_idx = interval.start_idx, end_idx = interval.end_idx;
   if (start_idx < 0) start_idx = 0;
@@ -179,6 +183,10 @@ DataInterval CheckInterval(const std::vector<ImuReading<T>>& samples,
 Eigen::Vector3d DataMean(const ImuReadings& samples,
                          const DataInterval& interval = DataInterval());
 
+//! Same as DataMean, the axes are summed as contiguous arrays
+Eigen::Vector3d DataMean(const ImuSamplesViewd& samples,
+                         const DataInterval& interval = DataInterval());
+
 /** @brief Compute the variance of a sequence of TriadData_ objects. If a valid
  * data interval is provided, the variance is computed only inside this interval
  *
@@ -192,6 +200,10 @@ Eigen::Vector3d DataMean(const ImuReadings& samples,
 Eigen::Vector3d DataVariance(const ImuReadings& samples,
                              const DataInterval& interval = DataInterval());
 
+//! Same as DataVariance, the axes are summed as contiguous arrays
+Eigen::Vector3d DataVariance(const ImuSamplesViewd& samples,
+                             const DataInterval& interval = DataInterval());
+
 /** @brief If the flag only_means is set to false, for each interval
  *        (input vector intervals) extract from the input signal
  *        (samples) the first interval_n_samps samples, and store them
@@ -222,6 +234,17 @@ void ExtractIntervalsSamples(const ImuReadings& samples,
                              int interval_n_samps = 100,
                              bool only_means = false);
 
+//! Same selection as ExtractIntervalsSamples without copying the samples:
+//! sample_ranges[i] are the samples that extracted_intervals[i] contributes,
+//! its first interval_n_samps samples or, if only_means, the whole interval.
+//! The samples or their means are then read from the original signal, e.g.
+//! with DataMean on an ImuSamplesViewd.
+void SelectIntervals(const std::vector<DataInterval>& intervals,
+                     std::vector<DataInterval>& extracted_intervals,
+                     std::vector<DataInterval>& sample_ranges,
+                     int interval_n_samps = 100,
+                     bool only_means = false);
+
 /** @brief Decompose a rotation matrix into the roll, pitch, and yaw angular
  * components
  *
@@ -265,5 +288,20 @@ void StaticIntervalsDetector(const ImuReadings& samples,
                              std::vector<DataInterval>& intervals,
                              int win_size = 101);
 
+//! Same as StaticIntervalsDetector on structure of arrays samples
+void StaticIntervalsDetector(const ImuSamplesViewd& samples,
+                             double threshold,
+                             std::vector<DataInterval>& intervals,
+                             int win_size = 101);
+
+//! Runs StaticIntervalsDetector for several thresholds at once. The sliding
+//! variance is computed only once, intervals[t] holds the static intervals
+//! detected with thresholds[t].
+void StaticIntervalsDetector(
+    const ImuSamplesViewd& samples,
+    const std::vector<double>& thresholds,
+    std::vector<std::vector<DataInterval>>& intervals,
+    int win_size = 101);
+
 }  // namespace utils
 }  // namespace OpenICC
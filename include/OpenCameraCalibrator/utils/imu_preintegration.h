@@ -0,0 +1,116 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <sophus/so3.hpp>
+
+#include "OpenCameraCalibrator/basalt_spline/sophus_utils.h"
+#include "OpenCameraCalibrator/utils/gyro_integration.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Rotation and velocity increment of an IMU interval, integrated in the
+//! body frame of the first sample. The bias Jacobians allow a first order
+//! correction if the biases change during optimization.
+struct ImuPreintegration {
+  Sophus::SO3d delta_rot;
+  Eigen::Vector3d delta_vel = Eigen::Vector3d::Zero();
+  //! integration time in seconds
+  double delta_t_s = 0.0;
+  //! number of integrated samples
+  int num_samples = 0;
+  //! biases the interval was integrated with
+  Eigen::Vector3d gyro_bias = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias = Eigen::Vector3d::Zero();
+  //! right perturbation of delta_rot w.r.t. the gyroscope bias
+  Eigen::Matrix3d d_rot_d_gyro_bias = Eigen::Matrix3d::Zero();
+  Eigen::Matrix3d d_vel_d_gyro_bias = Eigen::Matrix3d::Zero();
+  Eigen::Matrix3d d_vel_d_accl_bias = Eigen::Matrix3d::Zero();
+};
+
+//! Preintegrate raw gyroscope and accelerometer samples. The rotation uses
+//! QuatIntegrationStepRK4, the velocity the trapezoidal rule. Samples are
+//! calibrated with the given triads, including their biases.
+inline bool PreintegrateImu(
+    const vec3_vector& gyro_raw,
+    const vec3_vector& accl_raw,
+    const std::vector<double>& times_s,
+    const ThreeAxisSensorCalibParams<double>& gyro_calib,
+    const ThreeAxisSensorCalibParams<double>& accl_calib,
+    ImuPreintegration& preint) {
+  const size_t nr_samples = times_s.size();
+  if (nr_samples < 2 || gyro_raw.size() != nr_samples ||
+      accl_raw.size() != nr_samples) {
+    return false;
+  }
+
+  const Eigen::Matrix3d gyro_ms =
+      gyro_calib.GetMisalignmentMatrix() * gyro_calib.GetScaleMatrix();
+  const Eigen::Matrix3d accl_ms =
+      accl_calib.GetMisalignmentMatrix() * accl_calib.GetScaleMatrix();
+
+  preint = ImuPreintegration();
+  preint.num_samples = nr_samples;
+  preint.gyro_bias = gyro_calib.GetBiasVector();
+  preint.accl_bias = accl_calib.GetBiasVector();
+
+  // quaternion as (w, x, y, z) for the RK4 step
+  Eigen::Vector4d quat(1.0, 0.0, 0.0, 0.0);
+  Eigen::Vector3d omega0 = gyro_calib.UnbiasNormalize(gyro_raw[0]);
+  Eigen::Vector3d accl0 = accl_calib.UnbiasNormalize(accl_raw[0]);
+  for (size_t i = 1; i < nr_samples; ++i) {
+    const double dt = times_s[i] - times_s[i - 1];
+    const Eigen::Vector3d omega1 = gyro_calib.UnbiasNormalize(gyro_raw[i]);
+    const Eigen::Vector3d accl1 = accl_calib.UnbiasNormalize(accl_raw[i]);
+
+    Eigen::Vector4d quat1;
+    QuatIntegrationStepRK4(quat, omega0, omega1, dt, quat1);
+    const Sophus::SO3d rot0 = preint.delta_rot;
+    const Sophus::SO3d rot1(
+        Eigen::Quaterniond(quat1[0], quat1[1], quat1[2], quat1[3]));
+
+    // bias Jacobians, the rotation one uses the mean rotational velocity
+    const Eigen::Vector3d omega_dt = 0.5 * (omega0 + omega1) * dt;
+    Eigen::Matrix3d Jr;
+    Sophus::rightJacobianSO3(omega_dt, Jr);
+    const Eigen::Matrix3d d_rot0_d_gyro_bias = preint.d_rot_d_gyro_bias;
+    preint.d_rot_d_gyro_bias =
+        Sophus::SO3d::exp(omega_dt).inverse().matrix() * d_rot0_d_gyro_bias -
+        Jr * gyro_ms * dt;
+    preint.d_vel_d_gyro_bias -=
+        0.5 * dt *
+        (rot0.matrix() * Sophus::SO3d::hat(accl0) * d_rot0_d_gyro_bias +
+         rot1.matrix() * Sophus::SO3d::hat(accl1) * preint.d_rot_d_gyro_bias);
+    preint.d_vel_d_accl_bias -=
+        0.5 * dt * (rot0.matrix() + rot1.matrix()) * accl_ms;
+
+    preint.delta_vel += 0.5 * (rot0 * accl0 + rot1 * accl1) * dt;
+    preint.delta_rot = rot1;
+    preint.delta_t_s += dt;
+
+    quat = quat1;
+    omega0 = omega1;
+    accl0 = accl1;
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
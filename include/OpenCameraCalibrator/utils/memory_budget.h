@@ -0,0 +1,178 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace OpenICC {
+namespace utils {
+
+//! Process wide memory budget. Stages check it before they materialize
+//! large arrays and spill those to memory mapped files instead. The budget is
+//! compared with the resident set size, so it also covers the memory of
+//! ceres and theia. Without a budget nothing is spilled.
+class MemoryBudget {
+ public:
+  static MemoryBudget& Instance();
+
+  //! 0 disables the budget, which is the default
+  void SetBudgetMb(const int64_t budget_mb) { budget_mb_ = budget_mb; }
+  int64_t BudgetMb() const { return budget_mb_; }
+
+  //! directory of the spill files, defaults to TMPDIR or /tmp
+  void SetSpillDirectory(const std::string& spill_dir);
+  std::string SpillDirectory() const;
+
+  //! true if num_bytes more resident memory would exceed the budget
+  bool WouldExceed(const size_t num_bytes) const;
+
+  //! bytes currently held in spill files
+  int64_t SpilledBytes() const { return spilled_bytes_; }
+
+ private:
+  friend class SpillBuffer;
+
+  MemoryBudget() {}
+
+  std::atomic<int64_t> budget_mb_{0};
+  std::atomic<int64_t> spilled_bytes_{0};
+  mutable std::mutex mutex_;
+  std::string spill_dir_;
+};
+
+//! Raw memory on the heap or, if the memory budget would be exceeded, in an
+//! unlinked memory mapped file whose pages the kernel writes back to disk
+//! under memory pressure instead of failing the allocation.
+class SpillBuffer {
+ public:
+  SpillBuffer() {}
+  ~SpillBuffer() { Release(); }
+
+  SpillBuffer(const SpillBuffer&) = delete;
+  SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+  //! Replaces the buffer with num_bytes uninitialized bytes, returns false
+  //! if neither the heap nor a spill file could provide them
+  bool Allocate(const size_t num_bytes);
+
+  void Release();
+
+  void Swap(SpillBuffer& other);
+
+  void* Data() const { return data_; }
+  size_t NumBytes() const { return num_bytes_; }
+  bool Spilled() const { return spilled_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t num_bytes_ = 0;
+  bool spilled_ = false;
+};
+
+//! Growable array of trivially copyable elements in a SpillBuffer, so large
+//! intermediate arrays move to disk when the memory budget is exhausted.
+//! Follows the std::vector interface as far as it is needed.
+template <typename T>
+class SpillableArray {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SpillableArray elements are copied with memcpy");
+
+ public:
+  SpillableArray() {}
+
+  SpillableArray(const SpillableArray& other) { *this = other; }
+  SpillableArray& operator=(const SpillableArray& other) {
+    if (this != &other) {
+      clear();
+      reserve(other.size_);
+      if (other.size_ > 0) {
+        std::memcpy(data(), other.data(), other.size_ * sizeof(T));
+      }
+      size_ = other.size_;
+    }
+    return *this;
+  }
+
+  SpillableArray(SpillableArray&& other) noexcept { *this = std::move(other); }
+  SpillableArray& operator=(SpillableArray&& other) noexcept {
+    buffer_.Swap(other.buffer_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+    return *this;
+  }
+
+  //! Grows the capacity to at least capacity elements. Reserve the final
+  //! size, every growth needs the old and the new buffer at the same time.
+  void reserve(const size_t capacity) {
+    if (capacity <= capacity_) {
+      return;
+    }
+    SpillBuffer buffer;
+    if (!buffer.Allocate(capacity * sizeof(T))) {
+      throw std::bad_alloc();
+    }
+    if (size_ > 0) {
+      std::memcpy(buffer.Data(), buffer_.Data(), size_ * sizeof(T));
+    }
+    buffer_.Swap(buffer);
+    capacity_ = capacity;
+  }
+
+  void push_back(const T& value) {
+    if (size_ == capacity_) {
+      reserve(capacity_ > 0 ? 2 * capacity_ : 64);
+    }
+    data()[size_++] = value;
+  }
+
+  //! releases the memory
+  void clear() {
+    buffer_.Release();
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+  T* data() { return static_cast<T*>(buffer_.Data()); }
+  const T* data() const { return static_cast<const T*>(buffer_.Data()); }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  bool spilled() const { return buffer_.Spilled(); }
+
+  T& operator[](const size_t i) { return data()[i]; }
+  const T& operator[](const size_t i) const { return data()[i]; }
+
+  T* begin() { return data(); }
+  T* end() { return data() + size_; }
+  const T* begin() const { return data(); }
+  const T* end() const { return data() + size_; }
+
+ private:
+  SpillBuffer buffer_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
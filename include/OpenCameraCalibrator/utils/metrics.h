@@ -0,0 +1,88 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json_fwd.h"
+
+namespace OpenICC {
+namespace utils {
+
+struct StageRecord;
+
+//! Process wide counters, gauges and duration histograms for a metrics
+//! endpoint, exported in the Prometheus text format. The timed stages feed
+//! it automatically. Nothing is recorded before Enable() was called.
+class Metrics {
+ public:
+  static Metrics& Instance();
+
+  void Enable() { enabled_ = true; }
+  bool Enabled() const { return enabled_; }
+
+  //! Adds value to the counter name{labels}. labels is empty or made with
+  //! Label, several labels are joined by ','.
+  void AddCounter(const std::string& name,
+                  const std::string& labels,
+                  const double value);
+
+  void SetGauge(const std::string& name,
+                const std::string& labels,
+                const double value);
+
+  //! Adds a duration to the histogram name{labels}
+  void ObserveDuration(const std::string& name,
+                       const std::string& labels,
+                       const double seconds);
+
+  //! Counts a finished stage, its wall time, cpu time and items
+  void ObserveStage(const StageRecord& stage);
+
+  //! All series in the Prometheus text exposition format
+  std::string PrometheusText();
+
+  //! All series as "name{labels}": value, histograms with count and sum
+  nlohmann::json ToJson();
+
+ private:
+  struct Histogram {
+    //! counts per upper bound of kDurationBuckets, not cumulative
+    std::vector<int64_t> counts;
+    int64_t count = 0;
+    double sum = 0.0;
+  };
+
+  Metrics() = default;
+
+  std::atomic<bool> enabled_{false};
+  std::mutex mutex_;
+  // series by name and labels
+  std::map<std::string, std::map<std::string, double>> counters_;
+  std::map<std::string, std::map<std::string, double>> gauges_;
+  std::map<std::string, std::map<std::string, Histogram>> histograms_;
+};
+
+//! key="value" with the value escaped for the Prometheus text format
+std::string Label(const std::string& key, const std::string& value);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,98 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Bump allocator for many small objects that die together, e.g. the cost
+//! functions of a ceres problem. Objects are constructed in large blocks
+//! and destroyed in bulk by Clear() or the destructor, in reverse order of
+//! creation per thread. Create can be called from several threads, every
+//! thread allocates from its own shard. Clear must not run concurrently
+//! with Create and invalidates all created objects.
+class ObjectArena {
+ public:
+  ObjectArena();
+  ~ObjectArena();
+
+  ObjectArena(const ObjectArena&) = delete;
+  ObjectArena& operator=(const ObjectArena&) = delete;
+
+  template <typename T, typename... Args>
+  T* Create(Args&&... args) {
+    Shard* shard = ThreadShard();
+    T* object = ::new (shard->Allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      shard->destructors.emplace_back(
+          object, [](void* p) { static_cast<T*>(p)->~T(); });
+    }
+    return object;
+  }
+
+  //! destroys all objects and frees all but one block per shard
+  void Clear();
+
+  //! objects with a destructor created since the last Clear
+  size_t NumObjects() const;
+
+  //! bytes of the blocks currently held by the arena
+  size_t NumBytes() const;
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+
+  struct Shard {
+    std::vector<Block> blocks;
+    //! offset into the last block
+    size_t used = 0;
+    std::vector<std::pair<void*, void (*)(void*)>> destructors;
+
+    void* Allocate(const size_t size, const size_t alignment);
+    void Clear();
+  };
+
+  //! shards are kept until the arena is destroyed, threads that stopped
+  //! using the arena hand theirs back for reuse
+  struct State {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<Shard*> free_shards;
+  };
+
+  friend struct ShardLease;
+
+  Shard* ThreadShard();
+
+  const uint64_t id_;
+  const std::shared_ptr<State> state_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,96 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/reconstruction.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Compact copy of the board observations of a reconstruction for the spline
+//! calibration. The features of all views are stored in contiguous arrays,
+//! view after view in timestamp order, so that building and evaluating
+//! reprojection residuals needs no view or feature lookups. The board points
+//! stay in the tracks of the reconstruction, they are the parameter blocks
+//! of the optimization, the store only points to them.
+class ObservationStore {
+ public:
+  //! doubles per observation: x, y, 1 / sigma_x, 1 / sigma_y
+  static constexpr int kStride = 4;
+
+  struct View {
+    theia::ViewId view_id = theia::kInvalidViewId;
+    const theia::Camera* camera = nullptr;
+    double timestamp_s = 0.0;
+    //! observations first, ..., first + num - 1 belong to the view
+    size_t first = 0;
+    size_t num = 0;
+  };
+
+  //! Replaces the content with the views and tracks of reconstruction. Keeps
+  //! pointers into reconstruction, which has to outlive the store and must
+  //! not get new views or tracks until the next Build.
+  void Build(theia::Reconstruction* reconstruction);
+
+  void Clear();
+
+  size_t NumViews() const { return views_.size(); }
+  size_t NumObservations() const { return track_ids_.size(); }
+  size_t NumPoints() const { return points_.size(); }
+
+  const View& GetView(const size_t v) const { return views_[v]; }
+
+  //! index of a view of the reconstruction, also of a copy of it as the
+  //! views are matched by name as well. -1 if the view is not in the store.
+  int ViewIndex(const theia::View* view) const;
+
+  theia::TrackId GetTrackId(const size_t obs) const { return track_ids_[obs]; }
+
+  //! kStride doubles of observation obs, the following observations of its
+  //! view come right after
+  const double* Observation(const size_t obs) const {
+    return observations_.data() + kStride * obs;
+  }
+
+  //! homogeneous board point of observation obs in its track
+  double* Point(const size_t obs) const {
+    return points_[point_indices_[obs]];
+  }
+
+  //! memory held by the arrays
+  size_t NumBytes() const;
+
+ private:
+  const theia::Reconstruction* reconstruction_ = nullptr;
+  std::vector<View> views_;
+  std::unordered_map<const theia::View*, size_t> view_indices_;
+  std::unordered_map<theia::ViewId, size_t> view_id_indices_;
+  // one entry per observation, spilled to disk beyond the memory budget
+  SpillableArray<theia::TrackId> track_ids_;
+  SpillableArray<double> observations_;
+  SpillableArray<uint32_t> point_indices_;
+  std::vector<double*> points_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
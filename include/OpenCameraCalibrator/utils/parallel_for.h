@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/executor.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Splits [0, num_items) into one contiguous chunk per thread and calls
+//! func(begin, end, thread_idx) for each chunk. The chunks run as tasks of
+//! the global executor, the calling thread takes the first one. With a single
+//! thread or item the function runs on the calling thread.
+template <class Func>
+void ParallelFor(const size_t num_items, const int num_threads, Func&& func) {
+  const size_t nr_threads =
+      std::min(num_items, static_cast<size_t>(std::max(num_threads, 1)));
+  if (nr_threads <= 1) {
+    func(size_t(0), num_items, 0);
+    return;
+  }
+
+  const size_t chunk_size = (num_items + nr_threads - 1) / nr_threads;
+  TaskGroup chunks;
+  for (size_t t = 1; t < nr_threads; ++t) {
+    const size_t begin = t * chunk_size;
+    const size_t end = std::min(num_items, begin + chunk_size);
+    if (begin >= end) {
+      break;
+    }
+    chunks.Run([&func, begin, end, t]() {
+      func(begin, end, static_cast<int>(t));
+    });
+  }
+  func(size_t(0), std::min(num_items, chunk_size), 0);
+  chunks.Wait();
+}
+
+//! Items per partial result of a parallel reduction. Reductions accumulate
+//! blocks of this size instead of one partial result per thread, such that
+//! the rounding does not depend on the number of threads.
+constexpr size_t kReductionBlockSize = 256;
+
+//! Combines the values pairwise along a balanced tree whose shape only
+//! depends on their number. Returns identity for no values.
+template <class T, class Combine>
+T TreeReduce(std::vector<T> values, const T& identity, Combine&& combine) {
+  if (values.empty()) {
+    return identity;
+  }
+  for (size_t stride = 1; stride < values.size(); stride *= 2) {
+    for (size_t i = 0; i + stride < values.size(); i += 2 * stride) {
+      values[i] = combine(values[i], values[i + stride]);
+    }
+  }
+  return values[0];
+}
+
+}  // namespace utils
+}  // namespace OpenICC
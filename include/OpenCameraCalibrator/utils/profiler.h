@@ -0,0 +1,154 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Wall time, cpu time, peak memory and item count of one pipeline stage
+struct StageRecord {
+  std::string name;
+  //! start in microseconds since the profiler was created
+  int64_t start_us = 0;
+  int64_t wall_time_us = 0;
+  //! process cpu time, summed over all threads
+  int64_t cpu_time_us = 0;
+  //! peak resident set size of the process at the end of the stage
+  int64_t peak_rss_kb = 0;
+  //! resident set size of the process at the end of the stage
+  int64_t rss_kb = 0;
+  //! memory held in spill files at the end of the stage, see MemoryBudget
+  int64_t spilled_kb = 0;
+  int64_t num_items = 0;
+  //! nesting depth of the stage, 0 for top level stages
+  int depth = 0;
+  //! NUMA node the stage started on
+  int numa_node = 0;
+  //! executor tasks of the process that ran on another NUMA node than they
+  //! were submitted from during the stage
+  int64_t cross_node_tasks = 0;
+};
+
+//! Process wide record of the timed stages. Stages are only recorded after
+//! Enable() was called, so instrumented code costs nothing otherwise.
+class Profiler {
+ public:
+  static Profiler& Instance();
+
+  void Enable() { enabled_ = true; }
+  bool Enabled() const { return enabled_; }
+
+  void AddStage(const StageRecord& stage);
+
+  std::vector<StageRecord> Stages();
+
+  //! Writes the stages in the chrome trace event format. Open the file with
+  //! chrome://tracing or perfetto, every stage also carries its cpu time,
+  //! peak memory and item count.
+  bool WriteChromeTrace(const std::string& output_path);
+
+  //! microseconds since the profiler was created
+  int64_t NowUs() const;
+
+ private:
+  Profiler() : start_(std::chrono::steady_clock::now()) {}
+
+  const std::chrono::steady_clock::time_point start_;
+  bool enabled_ = false;
+  std::mutex mutex_;
+  std::vector<StageRecord> stages_;
+};
+
+//! current process cpu time in microseconds
+int64_t ProcessCpuTimeUs();
+
+//! peak resident set size of the process in kilobytes
+int64_t PeakResidentSetSizeKb();
+
+//! current resident set size of the process in kilobytes, 0 if it can not
+//! be read
+int64_t ResidentSetSizeKb();
+
+//! Passes the stages that finish on the calling thread while the scope lives
+//! to a callback, e.g. to report the progress of a job. Scopes nest, the
+//! innermost one receives the stages.
+class ScopedStageListener {
+ public:
+  explicit ScopedStageListener(
+      std::function<void(const StageRecord&)> listener);
+  ~ScopedStageListener();
+
+  ScopedStageListener(const ScopedStageListener&) = delete;
+  ScopedStageListener& operator=(const ScopedStageListener&) = delete;
+
+  //! true if a listener is active on the calling thread
+  static bool Active();
+
+  //! Passes the stage to the listener of the calling thread, if any
+  static void Notify(const StageRecord& stage);
+
+ private:
+  const std::function<void(const StageRecord&)> listener_;
+  ScopedStageListener* const previous_;
+};
+
+//! Records the enclosing scope as one stage, e.g.
+//!   ScopedStageTimer timer("PoseEstimator::EstimatePoses");
+//!   timer.AddItems(num_views);
+//! The stage goes to the profiler, the metrics and the stage listener of the
+//! thread, whichever of them is enabled.
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(const std::string& name);
+  ~ScopedStageTimer();
+
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+  void AddItems(const int64_t num_items) { stage_.num_items += num_items; }
+
+ private:
+  const bool enabled_;
+  StageRecord stage_;
+};
+
+//! Enables the profiler if output_path is not empty. Records the lifetime of
+//! the object as stage run_name and writes the trace on destruction, so it
+//! is meant to be created at the start of main.
+class ScopedProfileWriter {
+ public:
+  ScopedProfileWriter(const std::string& output_path,
+                      const std::string& run_name);
+  ~ScopedProfileWriter();
+
+  ScopedProfileWriter(const ScopedProfileWriter&) = delete;
+  ScopedProfileWriter& operator=(const ScopedProfileWriter&) = delete;
+
+ private:
+  const std::string output_path_;
+  std::unique_ptr<ScopedStageTimer> run_timer_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
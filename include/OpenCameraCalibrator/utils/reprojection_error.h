@@ -0,0 +1,55 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/reconstruction.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Reprojection error statistics of a single view in pixel
+struct ViewReprojectionError {
+  theia::ViewId view_id = theia::kInvalidViewId;
+  //! observations that could be projected with the camera model
+  size_t num_observations = 0;
+  //! observations the camera model could not project, not in the statistics
+  size_t num_invalid = 0;
+  double mean = 0.0;
+  double rmse = 0.0;
+  double median = 0.0;
+  double max = 0.0;
+};
+
+//! Reprojects all observations of a view. The board points and observations
+//! are gathered into contiguous arrays, transformed to the camera frame with
+//! one matrix product and projected with the static projection function of
+//! the camera model.
+ViewReprojectionError ComputeViewReprojectionError(
+    const theia::Reconstruction& recon_dataset, const theia::ViewId v_id);
+
+//! Same as ComputeViewReprojectionError for many views, which are evaluated
+//! in parallel. errors[i] belongs to view_ids[i].
+void ComputeViewReprojectionErrors(
+    const theia::Reconstruction& recon_dataset,
+    const std::vector<theia::ViewId>& view_ids,
+    std::vector<ViewReprojectionError>& errors,
+    const int num_threads = 1);
+
+}  // namespace utils
+}  // namespace OpenICC
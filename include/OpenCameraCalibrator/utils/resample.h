@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! The timestamps start_s + i * dt_s for i < num_samples
+struct UniformGrid {
+  double start_s = 0.0;
+  double dt_s = 0.0;
+  size_t num_samples = 0;
+
+  double Time(const size_t i) const { return start_s + i * dt_s; }
+};
+
+//! Grid from first_s with spacing dt_s up to the last time not after last_s
+UniformGrid MakeUniformGrid(const double first_s,
+                            const double last_s,
+                            const double dt_s);
+
+//! Grid over the sorted timestamps with their mean spacing and as many
+//! samples, for streams that are nominally uniform
+UniformGrid MakeUniformGrid(const std::vector<double>& timestamps_s);
+
+UniformGrid MakeUniformGrid(const ImuReadings& readings);
+
+//! The ResampleUniform functions interpolate a stream given at sorted
+//! timestamps onto the grid, grid times outside of the stream are clamped to
+//! its first or last value. Each thread takes a contiguous chunk of the grid,
+//! finds the first bracket of its chunk with a binary search and merges the
+//! rest in one linear pass. The output is resized to the grid.
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const std::vector<double>& values,
+                     const UniformGrid& grid,
+                     std::vector<double>& resampled,
+                     const int num_threads = 1);
+
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const vec3_vector& values,
+                     const UniformGrid& grid,
+                     vec3_vector& resampled,
+                     const int num_threads = 1);
+
+//! Slerps between the quaternions
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const quat_vector& values,
+                     const UniformGrid& grid,
+                     quat_vector& resampled,
+                     const int num_threads = 1);
+
+//! The resampled readings carry the grid times as timestamps
+void ResampleUniform(const ImuReadings& readings,
+                     const UniformGrid& grid,
+                     ImuReadings& resampled,
+                     const int num_threads = 1);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,242 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/metrics.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Bounded lock-free FIFO ring that hands frames, detections or IMU samples
+//! from one pipeline stage to the next. Every slot carries a sequence number,
+//! with kMultiProducer the producers claim their slot with a CAS. There is a
+//! single consumer. The capacity is rounded up to a power of two. Push and
+//! Pop spin, yield and then sleep while the ring is full or empty, so a full
+//! ring throttles the producers. Close() is called once the producers
+//! finished, Pop returns false after the ring ran empty. Items are moved in
+//! and out, move-only payloads work.
+template <typename T, bool kMultiProducer>
+class RingQueue {
+ public:
+  explicit RingQueue(const size_t capacity) {
+    size_t num_slots = 1;
+    while (num_slots < capacity) {
+      num_slots <<= 1;
+    }
+    mask_ = num_slots - 1;
+    slots_.reset(new Slot[num_slots]);
+    for (size_t i = 0; i < num_slots; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+
+  //! Reports the ring as gauges openicc_queue_occupancy{queue=name} and
+  //! openicc_queue_capacity{queue=name} and counts the pushes that had to
+  //! wait for a full ring. To be called before the ring is used
+  void SetMetricsName(const std::string& name) {
+    metrics_labels_ = Label("queue", name);
+    report_metrics_ = true;
+  }
+
+  //! Returns false if the queue was closed before the item could be added
+  bool Push(T item) { return BlockingPush(item); }
+
+  //! Does not block, returns false if the queue is full or closed
+  bool TryPush(T item) { return TryEnqueue(item); }
+
+  //! Pushes all items in order and clears them. Returns false if the queue
+  //! was closed, the items that were not added are left in items
+  bool PushBatch(std::vector<T>& items) {
+    size_t num_pushed = 0;
+    for (; num_pushed < items.size(); ++num_pushed) {
+      if (!BlockingPush(items[num_pushed])) {
+        break;
+      }
+    }
+    items.erase(items.begin(), items.begin() + num_pushed);
+    return items.empty();
+  }
+
+  //! Returns false if the queue is closed and no items are left
+  bool Pop(T& item) {
+    Backoff backoff;
+    while (!TryPop(item)) {
+      // the producers finished before Close, so one more try sees all items
+      if (closed_.load(std::memory_order_acquire)) {
+        return TryPop(item);
+      }
+      backoff.Wait();
+    }
+    return true;
+  }
+
+  //! Does not block, returns false if the queue is empty
+  bool TryPop(T& item) {
+    const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[pos & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+    item = std::move(slot.item);
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    if (report_metrics_ && (pos % kReportInterval) == 0) {
+      Metrics& metrics = Metrics::Instance();
+      metrics.SetGauge("openicc_queue_occupancy", metrics_labels_, Size());
+      metrics.SetGauge("openicc_queue_capacity", metrics_labels_, Capacity());
+    }
+    return true;
+  }
+
+  //! Blocks for the first item and takes the ones queued behind it, at most
+  //! max_items in total. Returns false if the queue is closed and empty
+  bool PopBatch(std::vector<T>& items, const size_t max_items) {
+    items.clear();
+    items.emplace_back();
+    if (!Pop(items.back())) {
+      items.clear();
+      return false;
+    }
+    while (items.size() < max_items) {
+      items.emplace_back();
+      if (!TryPop(items.back())) {
+        items.pop_back();
+        break;
+      }
+    }
+    return true;
+  }
+
+  void Close() { closed_.store(true, std::memory_order_release); }
+
+  //! Approximate while producers or the consumer are active
+  size_t Size() const {
+    const size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+    const size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  size_t Capacity() const { return mask_ + 1; }
+
+ private:
+  static constexpr size_t kReportInterval = 64;
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  //! spins first, the stages usually catch up within microseconds
+  class Backoff {
+   public:
+    void Wait() {
+      ++iterations_;
+      if (iterations_ <= 64) {
+        return;
+      }
+      if (iterations_ <= 128) {
+        std::this_thread::yield();
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(sleep_us_));
+      sleep_us_ = std::min(2 * sleep_us_, 1000);
+    }
+
+   private:
+    int iterations_ = 0;
+    int sleep_us_ = 10;
+  };
+
+  //! Push that moves the item only if it was added, so it stays with the
+  //! caller when the queue was closed
+  bool BlockingPush(T& item) {
+    Backoff backoff;
+    bool waited = false;
+    while (!TryEnqueue(item)) {
+      if (closed_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      waited = true;
+      backoff.Wait();
+    }
+    if (waited && report_metrics_) {
+      Metrics::Instance().AddCounter(
+          "openicc_queue_full_waits_total", metrics_labels_, 1.0);
+    }
+    return true;
+  }
+
+  //! moves the item only if it was added
+  bool TryEnqueue(T& item) {
+    if (closed_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[pos & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence < pos) {
+        // the consumer did not free the slot yet
+        return false;
+      }
+      if (sequence > pos) {
+        // another producer claimed the slot
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (!kMultiProducer) {
+        enqueue_pos_.store(pos + 1, std::memory_order_relaxed);
+      } else if (!enqueue_pos_.compare_exchange_weak(
+                     pos, pos + 1, std::memory_order_relaxed)) {
+        continue;
+      }
+      slot.item = std::move(item);
+      slot.sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+  }
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_ = 0;
+  // separate cache lines, the producers and the consumer write one each
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  std::atomic<bool> closed_{false};
+  std::string metrics_labels_;
+  bool report_metrics_ = false;
+};
+
+//! single producer, e.g. the reader thread of a video
+template <typename T>
+using SpscQueue = RingQueue<T, false>;
+
+//! several producers, e.g. the detection tasks of the executor
+template <typename T>
+using MpscQueue = RingQueue<T, true>;
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,226 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+enum SmoothingFilterType {
+  MOVING_AVERAGE = 0,
+  SAVITZKY_GOLAY = 1,
+  BUTTERWORTH = 2
+};
+
+inline SmoothingFilterType StringToSmoothingFilterType(
+    const std::string& filter_type) {
+  if (filter_type == "savitzky_golay") {
+    return SmoothingFilterType::SAVITZKY_GOLAY;
+  } else if (filter_type == "butterworth") {
+    return SmoothingFilterType::BUTTERWORTH;
+  }
+  return SmoothingFilterType::MOVING_AVERAGE;
+}
+
+struct SmoothingFilterOptions {
+  SmoothingFilterType type = SmoothingFilterType::MOVING_AVERAGE;
+  //! window length in samples of the moving average and the Savitzky-Golay
+  //! filter, the latter rounds it up to an odd number
+  int window = 15;
+  //! order of the polynomial fitted by the Savitzky-Golay filter
+  int polynomial_order = 2;
+  //! cutoff frequency of the Butterworth low-pass as a fraction of the
+  //! sample rate, in (0, 0.5)
+  double cutoff = 0.05;
+};
+
+//! Row j holds the weights that evaluate the least squares polynomial of the
+//! given order through window samples at sample j of the window
+Eigen::MatrixXd SavitzkyGolayCoefficients(const int window,
+                                          const int polynomial_order);
+
+//! Numerator b and denominator a (a[0] = 1) of the second order Butterworth
+//! low-pass with the cutoff as a fraction of the sample rate
+void ButterworthLowPassCoefficients(const double cutoff,
+                                    Eigen::Vector3d& b,
+                                    Eigen::Vector3d& a);
+
+//! Decimates samples at the sorted timestamps by a factor: every output is
+//! the mean of factor consecutive samples at the mean time of the block. The
+//! block average is a zero phase low-pass against aliasing and lowers the
+//! white noise std by sqrt(factor). The last block may be shorter, factors
+//! below 2 copy the input.
+void DecimateByBlockAverage(const std::vector<double>& timestamps,
+                            const vec3_vector& samples,
+                            const int factor,
+                            std::vector<double>& decimated_timestamps,
+                            vec3_vector& decimated_samples);
+
+//! Smooths all channels of a sampled signal at once. The samples are mapped
+//! as one Channels x n matrix, so the moving average and the Savitzky-Golay
+//! filter are sums of shifted blocks that Eigen vectorizes over the whole
+//! signal. The Butterworth recursion runs over time with all channels in one
+//! vector.
+//!
+//! MOVING_AVERAGE: causal mean of the last window samples, the first window - 1
+//! outputs average all samples so far.
+//! SAVITZKY_GOLAY: centered polynomial fit, the first and last window / 2
+//! outputs evaluate the fit of the first and last full window.
+//! BUTTERWORTH: second order low-pass applied forward and backward, so
+//! without phase delay. The state starts at steady state with the first
+//! sample to avoid a transient.
+//!
+//! Signals shorter than the Savitzky-Golay window are copied unfiltered.
+//! The output must not alias the input.
+template <typename T, int Channels>
+class MultiChannelFilter {
+ public:
+  using Sample = Eigen::Matrix<T, Channels, 1>;
+  using Signal = aligned_vector<Sample>;
+
+  explicit MultiChannelFilter(const SmoothingFilterOptions& options)
+      : options_(options) {
+    options_.window = std::max(options_.window, 1);
+    if (options_.type == SmoothingFilterType::SAVITZKY_GOLAY) {
+      options_.window += 1 - options_.window % 2;
+      options_.polynomial_order =
+          std::min(std::max(options_.polynomial_order, 0), options_.window - 1);
+      savgol_ = SavitzkyGolayCoefficients(options_.window,
+                                          options_.polynomial_order)
+                    .template cast<T>();
+    } else if (options_.type == SmoothingFilterType::BUTTERWORTH) {
+      Eigen::Vector3d b, a;
+      ButterworthLowPassCoefficients(options_.cutoff, b, a);
+      b_ = b.template cast<T>();
+      a_ = a.template cast<T>();
+    }
+  }
+
+  void Apply(const Signal& input, Signal& output) const {
+    Apply(input.data(), input.size(), output);
+  }
+
+  //! Filters nr_samples samples starting at input
+  void Apply(const Sample* input,
+             const size_t nr_samples,
+             Signal& output) const {
+    output.resize(nr_samples);
+    if (nr_samples == 0) {
+      return;
+    }
+    const Eigen::Index n = static_cast<Eigen::Index>(nr_samples);
+    const ConstSignalMap in(input->data(), Channels, n);
+    SignalMap out(output.data()->data(), Channels, n);
+    const Eigen::Index min_samples =
+        (options_.type == SmoothingFilterType::SAVITZKY_GOLAY)
+            ? options_.window
+            : 2;
+    if (n < min_samples) {
+      out = in;
+      return;
+    }
+    switch (options_.type) {
+      case SmoothingFilterType::SAVITZKY_GOLAY:
+        SavitzkyGolay(in, out);
+        break;
+      case SmoothingFilterType::BUTTERWORTH:
+        Butterworth(in, out);
+        break;
+      default:
+        MovingAverage(in, out);
+    }
+  }
+
+  const SmoothingFilterOptions& GetOptions() const { return options_; }
+
+ private:
+  using SignalMatrix = Eigen::Matrix<T, Channels, Eigen::Dynamic>;
+  using ConstSignalMap = Eigen::Map<const SignalMatrix>;
+  using SignalMap = Eigen::Map<SignalMatrix>;
+
+  void MovingAverage(const ConstSignalMap& in, SignalMap& out) const {
+    const int w = options_.window;
+    const Eigen::Index n_full = in.cols() - w + 1;
+    const Eigen::Index n_head = std::min<Eigen::Index>(w - 1, in.cols());
+    Sample sum = Sample::Zero();
+    for (Eigen::Index i = 0; i < n_head; ++i) {
+      sum += in.col(i);
+      out.col(i) = sum / T(i + 1);
+    }
+    if (n_full <= 0) {
+      return;
+    }
+    auto full = out.rightCols(n_full);
+    full = in.leftCols(n_full);
+    for (int k = 1; k < w; ++k) {
+      full += in.middleCols(k, n_full);
+    }
+    full /= T(w);
+  }
+
+  void SavitzkyGolay(const ConstSignalMap& in, SignalMap& out) const {
+    const int w = options_.window;
+    const int half = w / 2;
+    const Eigen::Index n = in.cols();
+    const Eigen::Index n_full = n - w + 1;
+    // edges from the fits of the first and last full window
+    out.leftCols(half) = in.leftCols(w) * savgol_.topRows(half).transpose();
+    out.rightCols(half) =
+        in.rightCols(w) * savgol_.bottomRows(half).transpose();
+    auto center = out.middleCols(half, n_full);
+    center = savgol_(half, 0) * in.leftCols(n_full);
+    for (int k = 1; k < w; ++k) {
+      center += savgol_(half, k) * in.middleCols(k, n_full);
+    }
+  }
+
+  void Butterworth(const ConstSignalMap& in, SignalMap& out) const {
+    const Eigen::Index n = in.cols();
+    // direct form II transposed, forward pass
+    Sample z1 = (T(1) - b_[0]) * in.col(0);
+    Sample z2 = (b_[2] - a_[2]) * in.col(0);
+    for (Eigen::Index i = 0; i < n; ++i) {
+      const Sample x = in.col(i);
+      const Sample y = b_[0] * x + z1;
+      z1 = b_[1] * x - a_[1] * y + z2;
+      z2 = b_[2] * x - a_[2] * y;
+      out.col(i) = y;
+    }
+    // backward pass on the forward output
+    z1 = (T(1) - b_[0]) * out.col(n - 1);
+    z2 = (b_[2] - a_[2]) * out.col(n - 1);
+    for (Eigen::Index i = n - 1; i >= 0; --i) {
+      const Sample x = out.col(i);
+      const Sample y = b_[0] * x + z1;
+      z1 = b_[1] * x - a_[1] * y + z2;
+      z2 = b_[2] * x - a_[2] * y;
+      out.col(i) = y;
+    }
+  }
+
+  SmoothingFilterOptions options_;
+  Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> savgol_;
+  Eigen::Matrix<T, 3, 1> b_, a_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
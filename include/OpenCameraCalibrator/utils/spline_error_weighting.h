@@ -0,0 +1,49 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Spline error weighting (Ovren and Forssen, CVPR 2018), the C++
+//! counterpart of python/sew.py. Finds the largest uniform knot spacing in
+//! [min_dt, max_dt] for which a cubic B-spline keeps the fraction quality of
+//! the signal energy and the variance of the resulting approximation error.
+//! The signal is expected to be sampled at an approximately constant rate.
+//! The axes are transformed on up to num_threads threads. Returns false if
+//! the signal is too short or constant.
+bool KnotSpacingAndVariance(const ImuReadings& signal,
+                            const double quality,
+                            const double min_dt,
+                            const double max_dt,
+                            double& dt,
+                            double& variance,
+                            const int num_threads = 1);
+
+//! Knot spacings and residual standard deviations of the SO3 spline from the
+//! gyroscope and of the R3 spline from the accelerometer, with the spacing
+//! bounds of python/get_sew_for_dataset.py, both signals in parallel.
+//! cam_fps is not touched.
+bool SplineWeightingFromTelemetry(const CameraTelemetryData& telemetry,
+                                  const double quality_so3,
+                                  const double quality_r3,
+                                  SplineWeightingData& weighting,
+                                  const int num_threads = 1);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,84 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Cache of the output files of a pipeline stage, keyed by a hash of
+//! everything the stage depends on. A stage adds the content of its input
+//! files and the values of its parameters, then fetches the outputs of an
+//! earlier run with the same key or runs and stores them, e.g.
+//!   StageCache cache(FLAGS_cache_dir, "calibrate_camera");
+//!   cache.AddFile(FLAGS_input_corners);
+//!   cache.AddValue("grid_size", FLAGS_grid_size);
+//!   if (!cache.Fetch({output})) { ...run...; cache.Store({output}); }
+//! Entries live in cache_dir/stage_name/key. An empty cache_dir disables
+//! the cache, Fetch then always misses and Store does nothing.
+class StageCache {
+ public:
+  StageCache(const std::string& cache_dir, const std::string& stage_name);
+
+  bool Enabled() const { return !cache_dir_.empty(); }
+
+  //! Hashes the content of a file, or the names and contents of all files
+  //! below a directory. A missing path is hashed as such
+  void AddFile(const std::string& path);
+
+  //! Hashes a named parameter value. Floating point values are written
+  //! with full precision so that any change gives a new key
+  template <typename T>
+  void AddValue(const std::string& name, const T& value) {
+    std::ostringstream ss;
+    ss << std::setprecision(std::numeric_limits<double>::max_digits10)
+       << value;
+    AddString(name);
+    AddString(ss.str());
+  }
+
+  //! hex digest of everything added so far
+  std::string Key() const;
+
+  //! Copies the cached outputs of the current key to output_paths. Returns
+  //! false if there is no complete entry
+  bool Fetch(const std::vector<std::string>& output_paths) const;
+
+  //! Copies output_paths into the entry of the current key. The entry
+  //! appears at once, so an interrupted run never leaves a partial entry
+  bool Store(const std::vector<std::string>& output_paths) const;
+
+ private:
+  void AddString(const std::string& str);
+  void AddBytes(const char* data, const size_t num_bytes);
+
+  std::string EntryDir() const;
+
+  const std::string cache_dir_;
+  const std::string stage_name_;
+
+  //! 64 bit FNV-1a state
+  uint64_t hash_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -17,6 +17,8 @@
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <cmath>
+#include <cstdint>
 #include <deque>
 #include <map>
 #include <unordered_map>
@@ -35,6 +37,16 @@ const double S_TO_US = 1e6;   ///< Second to museconds conversion
 const double MS_TO_S = 1e-3;  ///< Milliseconds to second conversion
 const double S_TO_MS = 1e3;   ///< Second to milliseconds conversion
 
+//! Splines, residuals and sample times use int64 nanoseconds, seconds only
+//! at the io edges. Rounds to the nearest nanosecond, a truncating cast of
+//! t_s * S_TO_NS drops one for most timestamps and moves samples over knot
+//! boundaries.
+inline int64_t SecondsToNs(const double t_s) {
+  return static_cast<int64_t>(std::llround(t_s * S_TO_NS));
+}
+
+inline double NsToSeconds(const int64_t t_ns) { return t_ns * NS_TO_S; }
+
 enum class CalibBoardGravDir { UNKOWN = -1, X = 0, Y = 1, Z = 2 };
 
 // alignment stuff
@@ -106,11 +118,114 @@ class ImuReading {
   T timestamp_s_;
 };
 
+//! Structure of arrays storage of imu samples. Timestamps and the three axes
+//! are separate aligned arrays, so loops over the samples stream linearly
+//! through memory and vectorize.
+template <typename T>
+class ImuSampleArrays {
+ public:
+  ImuSampleArrays() {}
+
+  explicit ImuSampleArrays(const std::vector<ImuReading<T>>& readings) {
+    reserve(readings.size());
+    for (const auto& reading : readings) {
+      push_back(reading.timestamp_s(), reading.data());
+    }
+  }
+
+  void reserve(const size_t n) {
+    timestamps_s_.reserve(n);
+    x_.reserve(n);
+    y_.reserve(n);
+    z_.reserve(n);
+  }
+
+  void clear() {
+    timestamps_s_.clear();
+    x_.clear();
+    y_.clear();
+    z_.clear();
+  }
+
+  void push_back(const T& timestamp_s, const Eigen::Matrix<T, 3, 1>& xyz) {
+    timestamps_s_.push_back(timestamp_s);
+    x_.push_back(xyz[0]);
+    y_.push_back(xyz[1]);
+    z_.push_back(xyz[2]);
+  }
+
+  inline size_t size() const { return timestamps_s_.size(); }
+  inline bool empty() const { return timestamps_s_.empty(); }
+
+  inline const T* timestamps_s() const { return timestamps_s_.data(); }
+  inline const T* axis(int index) const {
+    return index == 0 ? x_.data() : (index == 1 ? y_.data() : z_.data());
+  }
+
+ private:
+  std::vector<T, Eigen::aligned_allocator<T>> timestamps_s_;
+  std::vector<T, Eigen::aligned_allocator<T>> x_;
+  std::vector<T, Eigen::aligned_allocator<T>> y_;
+  std::vector<T, Eigen::aligned_allocator<T>> z_;
+};
+
+//! Non owning view of a contiguous range of ImuSampleArrays. Element access
+//! mirrors std::vector<ImuReading<T>>, so interval utilities can take both.
+template <typename T>
+class ImuSamplesView {
+ public:
+  ImuSamplesView() {}
+
+  ImuSamplesView(const ImuSampleArrays<T>& arrays)
+      : timestamps_s_(arrays.timestamps_s()),
+        x_(arrays.axis(0)),
+        y_(arrays.axis(1)),
+        z_(arrays.axis(2)),
+        size_(arrays.size()) {}
+
+  //! samples [begin, begin + n) of this view
+  ImuSamplesView Subview(const size_t begin, const size_t n) const {
+    ImuSamplesView view;
+    view.timestamps_s_ = timestamps_s_ + begin;
+    view.x_ = x_ + begin;
+    view.y_ = y_ + begin;
+    view.z_ = z_ + begin;
+    view.size_ = n;
+    return view;
+  }
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+  inline const T& timestamp_s(const size_t i) const { return timestamps_s_[i]; }
+  inline Eigen::Matrix<T, 3, 1> data(const size_t i) const {
+    return Eigen::Matrix<T, 3, 1>(x_[i], y_[i], z_[i]);
+  }
+  inline ImuReading<T> operator[](const size_t i) const {
+    return ImuReading<T>(timestamps_s_[i], x_[i], y_[i], z_[i]);
+  }
+
+  inline const T* timestamps_s() const { return timestamps_s_; }
+  inline const T* axis(int index) const {
+    return index == 0 ? x_ : (index == 1 ? y_ : z_);
+  }
+
+ private:
+  const T* timestamps_s_ = nullptr;
+  const T* x_ = nullptr;
+  const T* y_ = nullptr;
+  const T* z_ = nullptr;
+  size_t size_ = 0;
+};
+
+using ImuSampleArraysd = ImuSampleArrays<double>;
+using ImuSamplesViewd = ImuSamplesView<double>;
+
 using CameraGyroData = std::vector<ImuReading<double>>;
 using CameraAccData = std::vector<ImuReading<double>>;
 
 struct SplineWeightingData {
-  // create this with get_sew_for_dataset.py
+  // estimated by utils::SplineWeightingFromTelemetry or read from a json
   double dt_r3;
   double dt_so3;
   double std_r3;
@@ -0,0 +1,70 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+#include <theia/sfm/camera/camera.h>
+
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Normalized image coordinates of a camera sampled on a regular pixel grid.
+//! A lookup interpolates the grid bilinearly and refines the result with
+//! Newton steps on the closed-form projection, which replaces the iterative
+//! undistortion of the distorted camera models by a constant-time lookup.
+class UndistortionMap {
+ public:
+  //! Samples the camera every cell_size_px pixels, the grid covers the full
+  //! image. The camera is copied.
+  void Build(const theia::Camera& camera,
+             const double cell_size_px = 16.0,
+             const int newton_steps = 1,
+             const int num_threads = 1);
+
+  void Clear();
+
+  bool Empty() const { return nodes_.empty(); }
+
+  //! True if the map was built for a camera with these intrinsics and image
+  //! size
+  bool Matches(const theia::Camera& camera) const;
+
+  //! (x/z, y/z) of the pixel like theia::Camera::PixelToNormalizedCoordinates.
+  //! Pixels outside the grid or next to a node that does not undistort go
+  //! through the camera. Thread safe.
+  Eigen::Vector2d PixelToNormalized(const Eigen::Vector2d& pixel) const;
+
+ private:
+  using ProjectFunction = bool (*)(const double* intrinsics,
+                                   const double* point,
+                                   double* pixel);
+
+  theia::Camera camera_;
+  //! closed-form projection of the camera model, nullptr skips the Newton
+  //! steps
+  ProjectFunction project_ = nullptr;
+  double cell_size_px_ = 16.0;
+  int newton_steps_ = 1;
+  int cols_ = 0;
+  int rows_ = 0;
+  //! row major grid nodes, NaN if the node does not undistort
+  std::vector<Eigen::Vector2d> nodes_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
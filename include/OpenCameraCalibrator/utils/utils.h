@@ -36,6 +36,12 @@ bool DoesFileExist(const std::string& path);
 bool ReadDetectorParameters(std::string filename,
                             cv::Ptr<cv::aruco::DetectorParameters>& params);
 
+//! Writes the parameters that ReadDetectorParameters reads, the comment is
+//! written to the top of the file if it is not empty
+bool WriteDetectorParameters(const std::string& filename,
+                             const cv::aruco::DetectorParameters& params,
+                             const std::string& comment = "");
+
 double MedianOfDoubleVec(std::vector<double>& double_vec);
 
 void PrintResult(const std::string cam_type,
@@ -50,21 +56,50 @@ double GetReprojErrorOfView(const theia::Reconstruction& recon_dataset,
 
 std::vector<std::string> load_images(const std::string& img_dir_path);
 
+//! Index of the timestamp closest to t_imu, vis_timestamps has to be sorted
 size_t FindClosestTimestamp(const double t_imu,
-                         const std::vector<double>& vis_timestamps,
-                         double& distance_to_nearest_timestamp);
+                            const std::vector<double>& vis_timestamps,
+                            double& distance_to_nearest_timestamp);
+
+//! A timestamp t located in a sorted timestamp vector: t lies at fraction
+//! between timestamps[idx] and timestamps[idx + 1]. Timestamps outside the
+//! vector are clamped to its first or last entry with a zero fraction.
+struct TimestampBracket {
+  size_t idx = 0;
+  double fraction = 0.0;
+};
+
+//! Binary search for t in the sorted timestamps
+TimestampBracket FindTimestampBracket(const double t,
+                                      const std::vector<double>& timestamps);
+
+//! Brackets of all t_new in t_old. Both have to be sorted, a single merge
+//! pass over the two vectors.
+void AssociateSortedTimestamps(const std::vector<double>& t_old,
+                               const std::vector<double>& t_new,
+                               std::vector<TimestampBracket>& brackets);
+
+//! Brackets of all t_new in the sorted t_old. Merges if t_new is sorted as
+//! well and falls back to a binary search per timestamp otherwise.
+void AssociateTimestamps(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
+                         std::vector<TimestampBracket>& brackets);
 
 Eigen::Vector3d lerp3d(const Eigen::Vector3d& v0,
                        const Eigen::Vector3d& v1,
                        double fraction);
 
-void InterpolateQuaternions(std::vector<double> t_old,
-                            std::vector<double> t_new,
+//! Slerps input_q given at the sorted t_old to t_new. interpolated_q is
+//! resized to t_new.
+void InterpolateQuaternions(const std::vector<double>& t_old,
+                            const std::vector<double>& t_new,
                             const quat_vector& input_q,
                             quat_vector& interpolated_q);
 
-void InterpolateVector3d(std::vector<double> t_old,
-                         std::vector<double> t_new,
+//! Linearly interpolates input_vec given at the sorted t_old to t_new.
+//! interpolated_vec is resized to t_new.
+void InterpolateVector3d(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
                          const vec3_vector& input_vec,
                          vec3_vector& interpolated_vec);
 
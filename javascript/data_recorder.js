@@ -1,7 +1,69 @@
 
-imu_data = {}
-imu_data["accelerometer"] = {}
-imu_data["gyroscope"] = {}
+// Samples are written to fixed size binary chunks of typed arrays instead of
+// one growing object, finished chunks are handed to a Blob that the browser
+// may keep outside of the js heap. Layout (little endian):
+// "OICCREC1" | uint32 version | uint32 samples per chunk, then per chunk
+// uint32 sensor (0 accelerometer, 1 gyroscope) | uint32 samples |
+// float64 timestamps_ms[capacity] | float64 x[capacity] | y | z
+// Read it with OpenICC::io::ReadRecorderTelemetry or ReadTelemetry.
+const SAMPLES_PER_CHUNK = 4096;
+const SENSOR_ACCELEROMETER = 0;
+const SENSOR_GYROSCOPE = 1;
+
+class ChunkedRecorder {
+    constructor(capacity=SAMPLES_PER_CHUNK) {
+        this.capacity = capacity;
+        const header = new ArrayBuffer(16);
+        const view = new DataView(header);
+        "OICCREC1".split("").forEach((c, i) => view.setUint8(i, c.charCodeAt(0)));
+        view.setUint32(8, 1, true);
+        view.setUint32(12, capacity, true);
+        this.data = new Blob([header]);
+        this.open_chunks = [null, null];
+    }
+
+    newChunk(sensor) {
+        const buffer = new ArrayBuffer(8 + 32 * this.capacity);
+        const chunk = {
+            buffer: buffer,
+            header: new DataView(buffer, 0, 8),
+            values: new Float64Array(buffer, 8, 4 * this.capacity),
+            size: 0
+        };
+        chunk.header.setUint32(0, sensor, true);
+        return chunk;
+    }
+
+    add(sensor, timestamp_ms, x, y, z) {
+        if (this.open_chunks[sensor] === null) {
+            this.open_chunks[sensor] = this.newChunk(sensor);
+        }
+        const chunk = this.open_chunks[sensor];
+        const n = chunk.size++;
+        chunk.values[n] = timestamp_ms;
+        chunk.values[this.capacity + n] = x;
+        chunk.values[2 * this.capacity + n] = y;
+        chunk.values[3 * this.capacity + n] = z;
+        chunk.header.setUint32(4, chunk.size, true);
+        if (chunk.size === this.capacity) {
+            this.data = new Blob([this.data, chunk.buffer]);
+            this.open_chunks[sensor] = null;
+        }
+    }
+
+    // finished chunks and a copy of the open ones, recording can go on
+    blob() {
+        const parts = [this.data];
+        for (const chunk of this.open_chunks) {
+            if (chunk !== null) {
+                parts.push(chunk.buffer.slice(0));
+            }
+        }
+        return new Blob(parts, {type: "application/octet-stream"});
+    }
+}
+
+const recorder = new ChunkedRecorder();
 let acl = new Accelerometer({frequency: 60});
 
 acl.addEventListener('reading', () => {
@@ -9,7 +71,7 @@ acl.addEventListener('reading', () => {
     document.getElementById("ay").innerHTML = "ay: "+acl.y.toFixed(7);
     document.getElementById("az").innerHTML = "az: "+acl.z.toFixed(7);
     document.getElementById("ta").innerHTML = "ta: "+acl.timestamp;
-    imu_data["accelerometer"][acl.timestamp] = [acl.x,acl.y,acl.z]
+    recorder.add(SENSOR_ACCELEROMETER, acl.timestamp, acl.x, acl.y, acl.z);
 });
 acl.start();
 let gyr = new Gyroscope({frequency: 60});
@@ -18,15 +80,14 @@ gyr.addEventListener('reading', () => {
     document.getElementById("gy").innerHTML = "gy: "+gyr.y.toFixed(7);
     document.getElementById("gz").innerHTML = "gz: "+gyr.z.toFixed(7);
     document.getElementById("tg").innerHTML = "tg: "+gyr.timestamp;
-    imu_data["gyroscope"][gyr.timestamp] = [gyr.x,gyr.y,gyr.z]
+    recorder.add(SENSOR_GYROSCOPE, gyr.timestamp, gyr.x, gyr.y, gyr.z);
 });
 gyr.start();
 
 
 // Function to download data to a file
-function download(data=imu_data, filename="test.json", type="text/plain") {
-    var dbParam = JSON.stringify(data);
-    var file = new Blob([dbParam], {type: type});
+function download(filename="imu_recording.bin") {
+    var file = recorder.blob();
     if (window.navigator.msSaveOrOpenBlob) // IE10+
         window.navigator.msSaveOrOpenBlob(file, filename);
     else { // Others
@@ -0,0 +1,833 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Python bindings of the calibration classes and readers. Telemetry and
+// evaluated trajectories are returned as read only NumPy views on the C++
+// memory, they keep their owner alive and are not copied.
+
+#include <pybind11/eigen.h>
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/allan_variance_fitter.h"
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/multi_sequence_calibrator.h"
+#include "OpenCameraCalibrator/core/spline_trajectory.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/spline_error_weighting.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include "theia/io/reconstruction_reader.h"
+#include "theia/sfm/reconstruction.h"
+
+namespace py = pybind11;
+
+namespace OpenICC {
+namespace {
+
+using Estimator = core::SplineTrajectoryEstimator<core::SPLINE_N>;
+using Trajectory = core::SplineTrajectory<core::SPLINE_N>;
+
+py::array ReadOnly(py::array array) {
+  array.attr("setflags")(py::arg("write") = false);
+  return array;
+}
+
+//! (n, 3) view on the values of ImuReadings, rows are strided by the size of
+//! one reading
+py::array ImuValuesView(const ImuReadings& readings, py::handle owner) {
+  if (readings.empty()) {
+    return py::array_t<double>(std::vector<py::ssize_t>{0, 3});
+  }
+  const py::ssize_t n = readings.size();
+  return ReadOnly(py::array_t<double>(
+      {n, py::ssize_t(3)},
+      {py::ssize_t(sizeof(ImuReading<double>)), py::ssize_t(sizeof(double))},
+      readings[0].data_ptr(),
+      owner));
+}
+
+//! (n,) view on the timestamps of ImuReadings
+py::array ImuTimestampsView(const ImuReadings& readings, py::handle owner) {
+  if (readings.empty()) {
+    return py::array_t<double>(0);
+  }
+  const py::ssize_t n = readings.size();
+  return ReadOnly(
+      py::array_t<double>({n},
+                          {py::ssize_t(sizeof(ImuReading<double>))},
+                          &readings[0].timestamp_s(),
+                          owner));
+}
+
+//! (rows, cols) view on a column major Eigen matrix
+template <int _Cols>
+py::array MatrixView(const Eigen::Matrix<double, Eigen::Dynamic, _Cols>& mat,
+                     py::handle owner) {
+  const py::ssize_t rows = mat.rows();
+  return ReadOnly(py::array_t<double>(
+      {rows, py::ssize_t(_Cols)},
+      {py::ssize_t(sizeof(double)), py::ssize_t(rows * sizeof(double))},
+      mat.data(),
+      owner));
+}
+
+Sophus::SE3d SE3FromMatrix(const Eigen::Matrix4d& T) {
+  const Eigen::Matrix3d R = T.block<3, 3>(0, 0);
+  return Sophus::SE3d(Eigen::Quaterniond(R).normalized(),
+                      T.block<3, 1>(0, 3));
+}
+
+}  // namespace
+}  // namespace OpenICC
+
+using namespace OpenICC;
+
+PYBIND11_MODULE(openicc, m) {
+  m.doc() = "OpenImuCameraCalibrator bindings";
+
+  // data containers
+  py::class_<SplineWeightingData>(m, "SplineWeightingData")
+      .def(py::init<>())
+      .def_readwrite("dt_r3", &SplineWeightingData::dt_r3)
+      .def_readwrite("dt_so3", &SplineWeightingData::dt_so3)
+      .def_readwrite("std_r3", &SplineWeightingData::std_r3)
+      .def_readwrite("std_so3", &SplineWeightingData::std_so3)
+      .def_readwrite("cam_fps", &SplineWeightingData::cam_fps);
+
+  py::class_<ThreeAxisSensorCalibParamsd>(m, "ThreeAxisSensorCalibParams")
+      .def(py::init<>())
+      .def_property(
+          "misalignment",
+          &ThreeAxisSensorCalibParamsd::GetMisalignmentMatrix,
+          &ThreeAxisSensorCalibParamsd::SetMisalignmentMatrix)
+      .def_property(
+          "scale",
+          [](const ThreeAxisSensorCalibParamsd& p) {
+            return Eigen::Vector3d(p.scaleX(), p.scaleY(), p.scaleZ());
+          },
+          &ThreeAxisSensorCalibParamsd::SetScale)
+      .def_property("bias",
+                    &ThreeAxisSensorCalibParamsd::GetBiasVector,
+                    &ThreeAxisSensorCalibParamsd::SetBias);
+
+  py::class_<CameraTelemetryData>(m, "CameraTelemetryData")
+      .def(py::init<>())
+      .def("__len__",
+           [](const CameraTelemetryData& t) { return t.accelerometer.size(); })
+      .def_property_readonly(
+          "accelerometer",
+          [](py::object self) {
+            return ImuValuesView(
+                self.cast<CameraTelemetryData&>().accelerometer, self);
+          })
+      .def_property_readonly(
+          "accelerometer_timestamps_s",
+          [](py::object self) {
+            return ImuTimestampsView(
+                self.cast<CameraTelemetryData&>().accelerometer, self);
+          })
+      .def_property_readonly(
+          "gyroscope",
+          [](py::object self) {
+            return ImuValuesView(self.cast<CameraTelemetryData&>().gyroscope,
+                                 self);
+          })
+      .def_property_readonly(
+          "gyroscope_timestamps_s", [](py::object self) {
+            return ImuTimestampsView(
+                self.cast<CameraTelemetryData&>().gyroscope, self);
+          });
+
+  py::class_<core::TrajectorySamples>(m, "TrajectorySamples")
+      .def_property_readonly(
+          "valid",
+          [](py::object self) {
+            const auto& valid = self.cast<core::TrajectorySamples&>().valid;
+            return ReadOnly(py::array_t<uint8_t>(
+                {py::ssize_t(valid.size())},
+                {py::ssize_t(sizeof(char))},
+                reinterpret_cast<const uint8_t*>(valid.data()),
+                self));
+          })
+      .def_property_readonly(
+          "rotation",
+          [](py::object self) {
+            return MatrixView(self.cast<core::TrajectorySamples&>().rotation,
+                              self);
+          })
+      .def_property_readonly(
+          "position",
+          [](py::object self) {
+            return MatrixView(self.cast<core::TrajectorySamples&>().position,
+                              self);
+          })
+      .def_property_readonly(
+          "angular_velocity",
+          [](py::object self) {
+            return MatrixView(
+                self.cast<core::TrajectorySamples&>().angular_velocity, self);
+          })
+      .def_property_readonly(
+          "acceleration",
+          [](py::object self) {
+            return MatrixView(
+                self.cast<core::TrajectorySamples&>().acceleration, self);
+          })
+      .def_property_readonly(
+          "gyro_bias",
+          [](py::object self) {
+            return MatrixView(self.cast<core::TrajectorySamples&>().gyro_bias,
+                              self);
+          })
+      .def_property_readonly("accl_bias", [](py::object self) {
+        return MatrixView(self.cast<core::TrajectorySamples&>().accl_bias,
+                          self);
+      });
+
+  py::enum_<core::SplineOptimFlags>(m, "SplineOptimFlags", py::arithmetic())
+      .value("POINTS", core::POINTS)
+      .value("T_I_C", core::T_I_C)
+      .value("IMU_BIASES", core::IMU_BIASES)
+      .value("IMU_INTRINSICS", core::IMU_INTRINSICS)
+      .value("GRAVITY_DIR", core::GRAVITY_DIR)
+      .value("CAM_LINE_DELAY", core::CAM_LINE_DELAY)
+      .value("SPLINE", core::SPLINE)
+      .value("ACC_BIAS", core::ACC_BIAS)
+      .value("GYR_BIAS", core::GYR_BIAS);
+  py::enum_<core::CameraResidualLayout>(m, "CameraResidualLayout")
+      .value("VIEW_RESIDUALS", core::VIEW_RESIDUALS)
+      .value("FEATURE_RESIDUALS", core::FEATURE_RESIDUALS)
+      .value("CHUNK_RESIDUALS", core::CHUNK_RESIDUALS);
+  m.attr("SAMPLE_POSE") = int(core::SAMPLE_POSE);
+  m.attr("SAMPLE_ANGULAR_VELOCITY") = int(core::SAMPLE_ANGULAR_VELOCITY);
+  m.attr("SAMPLE_ACCELERATION") = int(core::SAMPLE_ACCELERATION);
+  m.attr("SAMPLE_BIASES") = int(core::SAMPLE_BIASES);
+
+  py::class_<core::SplineIterationSummary>(m, "SplineIterationSummary")
+      .def_readonly("iteration", &core::SplineIterationSummary::iteration)
+      .def_readonly("cost", &core::SplineIterationSummary::cost)
+      .def_readonly("cost_change", &core::SplineIterationSummary::cost_change)
+      .def_readonly("step_norm", &core::SplineIterationSummary::step_norm)
+      .def_readonly("step_is_successful",
+                    &core::SplineIterationSummary::step_is_successful)
+      .def_readonly("reprojection_error",
+                    &core::SplineIterationSummary::reprojection_error)
+      .def_readonly("cumulative_time_s",
+                    &core::SplineIterationSummary::cumulative_time_s);
+
+  py::class_<core::SplineConvergenceCriteria>(m, "SplineConvergenceCriteria")
+      .def(py::init<>())
+      .def_readwrite("min_relative_reprojection_improvement",
+                     &core::SplineConvergenceCriteria::
+                         min_relative_reprojection_improvement)
+      .def_readwrite("window", &core::SplineConvergenceCriteria::window)
+      .def_readwrite(
+          "target_reprojection_error",
+          &core::SplineConvergenceCriteria::target_reprojection_error);
+
+  py::class_<core::OutlierGatingOptions>(m, "OutlierGatingOptions")
+      .def(py::init<>())
+      .def_readwrite("num_mads", &core::OutlierGatingOptions::num_mads)
+      .def_readwrite("max_camera_rms_px",
+                     &core::OutlierGatingOptions::max_camera_rms_px)
+      .def_readwrite("gate_imu", &core::OutlierGatingOptions::gate_imu);
+
+  py::class_<core::ResidualTiming>(m, "ResidualTiming")
+      .def_readonly("name", &core::ResidualTiming::name)
+      .def_readonly("num_evaluations", &core::ResidualTiming::num_evaluations)
+      .def_readonly("num_jacobian_evaluations",
+                    &core::ResidualTiming::num_jacobian_evaluations)
+      .def_readonly("residual_time_s", &core::ResidualTiming::residual_time_s)
+      .def_readonly("jacobian_time_s", &core::ResidualTiming::jacobian_time_s);
+
+  py::class_<core::KnotFitOptions>(m, "KnotFitOptions")
+      .def(py::init<>())
+      .def_readwrite("so3_iterations", &core::KnotFitOptions::so3_iterations)
+      .def_readwrite("vision_std_so3", &core::KnotFitOptions::vision_std_so3)
+      .def_readwrite("vision_std_r3", &core::KnotFitOptions::vision_std_r3)
+      .def_readwrite("gyro_stride", &core::KnotFitOptions::gyro_stride)
+      .def_readwrite("damping", &core::KnotFitOptions::damping);
+
+  py::class_<core::InitGridSearchOptions>(m, "InitGridSearchOptions")
+      .def(py::init<>())
+      .def_readwrite("num_line_delays",
+                     &core::InitGridSearchOptions::num_line_delays)
+      .def_readwrite("line_delay_min_factor",
+                     &core::InitGridSearchOptions::line_delay_min_factor)
+      .def_readwrite("line_delay_max_factor",
+                     &core::InitGridSearchOptions::line_delay_max_factor)
+      .def_readwrite("num_time_offsets",
+                     &core::InitGridSearchOptions::num_time_offsets)
+      .def_readwrite("time_offset_range_s",
+                     &core::InitGridSearchOptions::time_offset_range_s)
+      .def_readwrite("view_stride", &core::InitGridSearchOptions::view_stride)
+      .def_readwrite("gyro_stride", &core::InitGridSearchOptions::gyro_stride);
+
+  // theia types are opaque, they are only passed between the functions here
+  py::class_<theia::Camera>(m, "Camera")
+      .def_property_readonly("image_width", &theia::Camera::ImageWidth)
+      .def_property_readonly("image_height", &theia::Camera::ImageHeight);
+
+  py::class_<theia::Reconstruction, std::shared_ptr<theia::Reconstruction>>(
+      m, "Reconstruction")
+      .def(py::init<>())
+      .def_property_readonly("num_views", &theia::Reconstruction::NumViews)
+      .def_property_readonly("num_tracks", &theia::Reconstruction::NumTracks);
+
+  m.def(
+      "set_max_concurrency",
+      [](const int max_concurrency) {
+        utils::Executor::Global().SetMaxConcurrency(max_concurrency);
+      },
+      py::arg("max_concurrency"),
+      "Caps the threads of all parallel work in the process, 0 uses the "
+      "hardware threads");
+  m.def("max_concurrency",
+        []() { return utils::Executor::Global().MaxConcurrency(); });
+  m.def(
+      "set_deterministic",
+      [](const bool deterministic) {
+        utils::Executor::Global().SetDeterministic(deterministic);
+      },
+      py::arg("deterministic"),
+      "Bit-reproducible results independent of the threads, the solvers run "
+      "single threaded");
+  m.def("deterministic",
+        []() { return utils::Executor::Global().Deterministic(); });
+
+  // readers
+  m.def(
+      "read_telemetry",
+      [](const std::string& path) {
+        auto telemetry = std::make_unique<CameraTelemetryData>();
+        if (!io::ReadTelemetry(path, *telemetry)) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return telemetry;
+      },
+      py::arg("path"),
+      py::call_guard<py::gil_scoped_release>(),
+      "Reads binary, GoPro MP4 or json telemetry");
+
+  m.def(
+      "read_camera_calibration",
+      [](const std::string& path) {
+        theia::Camera camera;
+        double fps = 0.0;
+        if (!io::read_camera_calibration(path, camera, fps)) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return std::make_pair(camera, fps);
+      },
+      py::arg("path"),
+      "Returns the camera and the fps of a camera calibration json");
+
+  m.def(
+      "read_imu_intrinsics",
+      [](const std::string& path, const std::string& bias_path) {
+        ThreeAxisSensorCalibParamsd acc, gyr;
+        if (!io::ReadIMUIntrinsics(path, bias_path, acc, gyr)) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return std::make_pair(acc, gyr);
+      },
+      py::arg("path"),
+      py::arg("bias_path") = "",
+      "Returns the accelerometer and gyroscope intrinsics");
+
+  m.def(
+      "read_imu_to_cam_init",
+      [](const std::string& path) {
+        Eigen::Quaterniond imu_to_cam;
+        double time_offset_imu_to_cam = 0.0;
+        if (!io::ReadIMU2CamInit(path, imu_to_cam, time_offset_imu_to_cam)) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return std::make_pair(Eigen::Vector4d(imu_to_cam.coeffs()),
+                              time_offset_imu_to_cam);
+      },
+      py::arg("path"),
+      "Returns the imu to camera rotation as quaternion x, y, z, w and the "
+      "time offset");
+
+  m.def(
+      "read_spline_error_weighting",
+      [](const std::string& path) {
+        SplineWeightingData weighting;
+        if (!io::ReadSplineErrorWeighting(path, weighting)) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return weighting;
+      },
+      py::arg("path"));
+
+  m.def(
+      "spline_weighting_from_telemetry",
+      [](const CameraTelemetryData& telemetry,
+         const double q_so3,
+         const double q_r3,
+         const int num_threads) {
+        SplineWeightingData weighting;
+        if (!utils::SplineWeightingFromTelemetry(
+                telemetry, q_so3, q_r3, weighting, num_threads)) {
+          throw std::runtime_error("Could not estimate the spline weighting");
+        }
+        return weighting;
+      },
+      py::arg("telemetry"),
+      py::arg("q_so3") = 0.98,
+      py::arg("q_r3") = 0.96,
+      py::arg("num_threads") = 1);
+
+  m.def(
+      "read_reconstruction",
+      [](const std::string& path) {
+        auto reconstruction = std::make_shared<theia::Reconstruction>();
+        if (!theia::ReadReconstruction(path, reconstruction.get())) {
+          throw std::runtime_error("Could not read " + path);
+        }
+        return reconstruction;
+      },
+      py::arg("path"),
+      py::call_guard<py::gil_scoped_release>());
+
+  py::class_<io::MappedScene>(m, "MappedScene")
+      .def(py::init([](const std::string& path) {
+             auto scene = std::make_unique<io::MappedScene>();
+             if (!scene->Open(path)) {
+               throw std::runtime_error("Could not open " + path);
+             }
+             return scene;
+           }),
+           py::arg("path"))
+      .def("__len__", &io::MappedScene::NumViews)
+      .def("view_key", &io::MappedScene::ViewKey, py::arg("view_idx"))
+      .def(
+          "view_corners",
+          [](const io::MappedScene& scene, const size_t view_idx) {
+            // views are parsed on access, so the corners are copies
+            nlohmann::json view;
+            if (view_idx >= scene.NumViews() ||
+                !scene.ParseView(view_idx, view)) {
+              throw std::out_of_range("Invalid view index");
+            }
+            const auto& image_points = view["image_points"];
+            py::array_t<int> ids(image_points.size());
+            py::array_t<double> corners(
+                std::vector<py::ssize_t>{py::ssize_t(image_points.size()), 2});
+            auto ids_ptr = ids.mutable_unchecked<1>();
+            auto corners_ptr = corners.mutable_unchecked<2>();
+            py::ssize_t i = 0;
+            for (const auto& img_pts : image_points.items()) {
+              ids_ptr(i) = std::stoi(img_pts.key());
+              corners_ptr(i, 0) = img_pts.value()[0].get<double>();
+              corners_ptr(i, 1) = img_pts.value()[1].get<double>();
+              ++i;
+            }
+            return std::make_pair(ids, corners);
+          },
+          py::arg("view_idx"),
+          "Returns the board point ids and the (n, 2) corners of a view");
+
+  m.def(
+      "spline_dataset_from_pose_dataset",
+      [](const theia::Reconstruction& pose_dataset,
+         const io::MappedScene& scene,
+         const theia::Camera& camera) {
+        auto dataset = std::make_shared<theia::Reconstruction>();
+        if (!core::SplineDatasetFromPoseDataset(
+                pose_dataset, scene, camera, *dataset)) {
+          throw std::runtime_error("Could not build the spline dataset");
+        }
+        return dataset;
+      },
+      py::arg("pose_dataset"),
+      py::arg("scene"),
+      py::arg("camera"),
+      py::call_guard<py::gil_scoped_release>());
+
+  // calibration classes
+  py::class_<Estimator>(m, "SplineTrajectoryEstimator")
+      .def(
+          "evaluate_trajectory",
+          [](const Estimator& estimator,
+             const py::array_t<int64_t, py::array::c_style |
+                                            py::array::forcecast>& times_ns,
+             const int flags) {
+            const std::vector<int64_t> times(times_ns.data(),
+                                             times_ns.data() + times_ns.size());
+            core::TrajectorySamples samples;
+            {
+              py::gil_scoped_release release;
+              if (!estimator.EvaluateTrajectory(times, flags, samples)) {
+                throw std::runtime_error("Could not evaluate the trajectory");
+              }
+            }
+            return samples;
+          },
+          py::arg("times_ns"),
+          py::arg("flags") = int(core::SAMPLE_POSE))
+      .def("mean_reprojection_error",
+           &Estimator::GetMeanReprojectionError,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("T_i_c",
+                             [](const Estimator& estimator) {
+                               return estimator.GetT_i_c().matrix();
+                             })
+      .def_property_readonly("gravity", &Estimator::GetGravity)
+      .def_property_readonly("rs_line_delay", &Estimator::GetRSLineDelay)
+      .def_property_readonly("num_cameras", &Estimator::GetNumCameras)
+      .def(
+          "camera_T_i_c",
+          [](const Estimator& estimator, const int camera) {
+            return estimator.GetCameraT_i_c(camera).matrix();
+          },
+          py::arg("camera"))
+      .def("camera_line_delay",
+           &Estimator::GetCameraLineDelay,
+           py::arg("camera"))
+      .def_property_readonly("residual_timings",
+                             &Estimator::GetResidualTimings)
+      .def("accl_bias", &Estimator::GetAcclBias, py::arg("time_ns"))
+      .def("gyro_bias", &Estimator::GetGyroBias, py::arg("time_ns"));
+
+  py::class_<Trajectory>(m, "SplineTrajectory")
+      .def(py::init([](const Estimator& estimator) {
+             auto trajectory = std::make_unique<Trajectory>();
+             if (!trajectory->Initialize(estimator)) {
+               throw std::runtime_error("Could not build the trajectory");
+             }
+             return trajectory;
+           }),
+           py::arg("estimator"))
+      .def(py::init([](const std::string& spline_state_path) {
+             auto trajectory = std::make_unique<Trajectory>();
+             if (!trajectory->Load(spline_state_path)) {
+               throw std::runtime_error("Could not read " + spline_state_path);
+             }
+             return trajectory;
+           }),
+           py::arg("spline_state_path"))
+      .def(
+          "pose",
+          [](const Trajectory& trajectory, const int64_t time_ns) {
+            Sophus::SE3d pose;
+            if (!trajectory.GetPose(time_ns, pose)) {
+              throw std::out_of_range("Time outside of the trajectory");
+            }
+            return pose.matrix();
+          },
+          py::arg("time_ns"))
+      .def(
+          "evaluate",
+          [](const Trajectory& trajectory,
+             const py::array_t<int64_t, py::array::c_style |
+                                            py::array::forcecast>& times_ns,
+             const int flags,
+             const int num_threads) {
+            const std::vector<int64_t> times(times_ns.data(),
+                                             times_ns.data() + times_ns.size());
+            core::TrajectorySamples samples;
+            {
+              py::gil_scoped_release release;
+              trajectory.Evaluate(times, flags, samples, num_threads);
+            }
+            return samples;
+          },
+          py::arg("times_ns"),
+          py::arg("flags") = int(core::SAMPLE_POSE),
+          py::arg("num_threads") = 1)
+      .def_property_readonly("min_time_ns", &Trajectory::GetMinTimeNs)
+      .def_property_readonly("max_time_ns", &Trajectory::GetMaxTimeNs)
+      .def_property_readonly("T_i_c",
+                             [](const Trajectory& trajectory) {
+                               return trajectory.GetT_i_c().matrix();
+                             })
+      .def_property_readonly("gravity", &Trajectory::GetGravity);
+
+  py::class_<core::ImuCameraCalibrator>(m, "ImuCameraCalibrator")
+      .def(py::init<>())
+      .def_property_readonly(
+          "trajectory",
+          [](core::ImuCameraCalibrator& calibrator) -> Estimator& {
+            return calibrator.trajectory_;
+          },
+          py::return_value_policy::reference_internal)
+      .def(
+          "batch_init_spline",
+          [](core::ImuCameraCalibrator& calibrator,
+             std::shared_ptr<theia::Reconstruction> vision_dataset,
+             const Eigen::Matrix4d& T_i_c_init,
+             const SplineWeightingData& spline_weight_data,
+             const double time_offset_imu_to_cam,
+             const CameraTelemetryData& telemetry,
+             const double initial_line_delay,
+             const ThreeAxisSensorCalibParamsd& accl_intrinsics,
+             const ThreeAxisSensorCalibParamsd& gyro_intrinsics) {
+            py::gil_scoped_release release;
+            calibrator.BatchInitSpline(std::move(vision_dataset),
+                                       SE3FromMatrix(T_i_c_init),
+                                       spline_weight_data,
+                                       time_offset_imu_to_cam,
+                                       telemetry,
+                                       initial_line_delay,
+                                       accl_intrinsics,
+                                       gyro_intrinsics);
+          },
+          py::arg("vision_dataset"),
+          py::arg("T_i_c_init"),
+          py::arg("spline_weight_data"),
+          py::arg("time_offset_imu_to_cam"),
+          py::arg("telemetry"),
+          py::arg("initial_line_delay"),
+          py::arg("accl_intrinsics"),
+          py::arg("gyro_intrinsics"))
+      .def(
+          "add_rig_camera",
+          [](core::ImuCameraCalibrator& calibrator,
+             std::shared_ptr<theia::Reconstruction> vision_dataset,
+             const Eigen::Matrix4d& T_i_c_init,
+             const double initial_line_delay,
+             const double time_offset_s) {
+            return calibrator.AddRigCamera(std::move(vision_dataset),
+                                           SE3FromMatrix(T_i_c_init),
+                                           initial_line_delay,
+                                           time_offset_s);
+          },
+          py::arg("vision_dataset"),
+          py::arg("T_i_c_init"),
+          py::arg("initial_line_delay"),
+          py::arg("time_offset_s"),
+          "Returns the camera index, call before batch_init_spline")
+      .def("add_rig_camera_from_files",
+           &core::ImuCameraCalibrator::AddRigCameraFromFiles,
+           py::arg("input_corners"),
+           py::arg("input_pose_dataset"),
+           py::arg("camera_calibration_json"),
+           py::arg("imu_rotation_init"),
+           py::arg("time_offset_imu_to_cam"),
+           py::arg("global_shutter") = false)
+      .def("optimize",
+           &core::ImuCameraCalibrator::Optimize,
+           py::arg("iterations"),
+           py::arg("optim_flags"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Returns the mean reprojection error")
+      .def("set_known_gravity_dir",
+           &core::ImuCameraCalibrator::SetKnownGravityDir,
+           py::arg("gravity"))
+      .def("set_calibrate_rs_line_delay",
+           &core::ImuCameraCalibrator::SetCalibrateRSLineDelay)
+      .def("set_use_analytic_imu_jacobians",
+           &core::ImuCameraCalibrator::SetUseAnalyticImuJacobians)
+      .def("set_graduated_camera_loss",
+           &core::ImuCameraCalibrator::SetGraduatedCameraLoss,
+           py::arg("widths_px"),
+           py::arg("stage_iterations") = 5)
+      .def("set_share_knot_evaluations",
+           &core::ImuCameraCalibrator::SetShareKnotEvaluations)
+      .def("set_batch_imu_residuals",
+           &core::ImuCameraCalibrator::SetBatchImuResiduals)
+      .def("set_domain_decomposition",
+           &core::ImuCameraCalibrator::SetDomainDecomposition,
+           py::arg("segment_s"),
+           py::arg("overlap_s"),
+           py::arg("rounds"),
+           py::arg("global_sample_stride"))
+      .def("set_fuse_imu_residuals",
+           &core::ImuCameraCalibrator::SetFuseImuResiduals)
+      .def("set_use_imu_preintegration",
+           &core::ImuCameraCalibrator::SetUseImuPreintegration)
+      .def("set_rigid_board", &core::ImuCameraCalibrator::SetRigidBoard)
+      .def("set_rotation_only", &core::ImuCameraCalibrator::SetRotationOnly)
+      .def("set_bias_spline_knot_spacing",
+           &core::ImuCameraCalibrator::SetBiasSplineKnotSpacing,
+           py::arg("accl_dt_s"),
+           py::arg("gyro_dt_s"))
+      .def("set_camera_residual_layout",
+           &core::ImuCameraCalibrator::SetCameraResidualLayout)
+      .def("set_knot_spacing_levels",
+           &core::ImuCameraCalibrator::SetKnotSpacingLevels)
+      .def("set_outlier_gating",
+           &core::ImuCameraCalibrator::SetOutlierGating,
+           py::arg("gate_outliers"),
+           py::arg("options") = core::OutlierGatingOptions())
+      .def("set_imu_decimation_rate",
+           &core::ImuCameraCalibrator::SetImuDecimationRate,
+           py::arg("rate_hz"))
+      .def("set_profile_residuals",
+           &core::ImuCameraCalibrator::SetProfileResiduals,
+           py::arg("profile_residuals"))
+      .def("set_max_views_per_knot_interval",
+           &core::ImuCameraCalibrator::SetMaxViewsPerKnotInterval,
+           py::arg("max_views"))
+      .def("set_fit_knots_to_poses",
+           &core::ImuCameraCalibrator::SetFitKnotsToPoses,
+           py::arg("fit_knots"),
+           py::arg("options") = core::KnotFitOptions())
+      .def("set_init_grid_search",
+           &core::ImuCameraCalibrator::SetInitGridSearch,
+           py::arg("grid_search"),
+           py::arg("options") = core::InitGridSearchOptions())
+      .def("get_time_offset_imu_to_cam",
+           &core::ImuCameraCalibrator::GetTimeOffsetImuToCam)
+      .def("compute_calibration_covariance",
+           &core::ImuCameraCalibrator::ComputeCalibrationCovariance)
+      .def("get_calibration_covariance",
+           &core::ImuCameraCalibrator::GetCalibrationCovariance)
+      .def("set_convergence_criteria",
+           &core::ImuCameraCalibrator::SetConvergenceCriteria)
+      .def(
+          "set_iteration_callback",
+          [](core::ImuCameraCalibrator& calibrator, py::function callback) {
+            // the solver runs without the GIL
+            calibrator.SetIterationCallback(
+                [callback](const core::SplineIterationSummary& summary) {
+                  py::gil_scoped_acquire acquire;
+                  return callback(summary).cast<bool>();
+                });
+          },
+          py::arg("callback"),
+          "callback(SplineIterationSummary) -> bool, False stops the solve")
+      .def("set_warm_start_spline_state",
+           &core::ImuCameraCalibrator::SetWarmStartSplineState,
+           py::arg("path"))
+      .def("save_spline_state",
+           &core::ImuCameraCalibrator::SaveSplineState,
+           py::arg("path"))
+      .def("load_spline_state",
+           &core::ImuCameraCalibrator::LoadSplineState,
+           py::arg("path"))
+      .def("write_calibration_result",
+           &core::ImuCameraCalibrator::WriteCalibrationResult,
+           py::arg("output_json"),
+           py::arg("reproj_error"),
+           py::arg("time_offset_imu_to_cam"));
+
+  py::class_<core::MultiSequenceCalibrator>(m, "MultiSequenceCalibrator")
+      .def(py::init<>())
+      .def("add_sequence",
+           &core::MultiSequenceCalibrator::AddSequence,
+           py::return_value_policy::reference_internal)
+      .def("sequence",
+           &core::MultiSequenceCalibrator::Sequence,
+           py::arg("i"),
+           py::return_value_policy::reference_internal)
+      .def_property_readonly("num_sequences",
+                             &core::MultiSequenceCalibrator::NumSequences)
+      .def("set_num_threads",
+           &core::MultiSequenceCalibrator::SetNumThreads,
+           py::arg("num_threads"))
+      .def("optimize",
+           &core::MultiSequenceCalibrator::Optimize,
+           py::arg("rounds"),
+           py::arg("iterations"),
+           py::arg("sequence_flags"),
+           py::arg("shared_flags"),
+           py::arg("shared_iterations") = 10,
+           py::call_guard<py::gil_scoped_release>(),
+           "Returns the mean reprojection error over the sequences");
+
+  py::class_<core::CameraCalibrator>(m, "CameraCalibrator")
+      .def(py::init<const std::string&, const bool>(),
+           py::arg("camera_model"),
+           py::arg("optimize_board_pts") = false)
+      .def("calibrate_from_scene",
+           &core::CameraCalibrator::CalibrateCameraFromScene,
+           py::arg("scene"),
+           py::arg("output_path"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("set_verbose", &core::CameraCalibrator::SetVerbose)
+      .def("set_num_threads",
+           &core::CameraCalibrator::SetNumThreads,
+           py::arg("num_threads"))
+      .def("set_grid_size",
+           &core::CameraCalibrator::SetGridSize,
+           py::arg("grid_size"))
+      .def("set_max_calibration_views",
+           &core::CameraCalibrator::SetMaxCalibrationViews,
+           py::arg("max_calibration_views"))
+      .def("set_ransac_error_thresh",
+           &core::CameraCalibrator::SetRansacErrorThresh,
+           py::arg("error_thresh"))
+      .def("calibrated_camera",
+           [](const core::CameraCalibrator& calibrator) -> py::object {
+             theia::Camera camera;
+             double fps = 0.0;
+             if (!calibrator.GetCalibratedCamera(camera, fps)) {
+               return py::none();
+             }
+             return py::cast(std::make_pair(camera, fps));
+           });
+
+  py::class_<allanvar::AllanAxisFit>(m, "AllanAxisFit")
+      .def_readonly("name", &allanvar::AllanAxisFit::name)
+      .def_readonly("gyroscope", &allanvar::AllanAxisFit::gyroscope)
+      .def_readonly("Q", &allanvar::AllanAxisFit::Q)
+      .def_readonly("N", &allanvar::AllanAxisFit::N)
+      .def_readonly("B", &allanvar::AllanAxisFit::B)
+      .def_readonly("K", &allanvar::AllanAxisFit::K)
+      .def_readonly("R", &allanvar::AllanAxisFit::R)
+      .def_readonly("white_noise", &allanvar::AllanAxisFit::white_noise)
+      .def_readonly("bias_instability",
+                    &allanvar::AllanAxisFit::bias_instability)
+      .def_readonly("bias_instability_tau",
+                    &allanvar::AllanAxisFit::bias_instability_tau)
+      .def_readonly("bias", &allanvar::AllanAxisFit::bias)
+      .def_readonly("converged", &allanvar::AllanAxisFit::converged);
+
+  py::class_<core::AllanVarianceFitter>(m, "AllanVarianceFitter")
+      .def(py::init<const CameraTelemetryData&, const int>(),
+           py::arg("telemetry"),
+           py::arg("nr_clusters"))
+      .def("run_fit",
+           &core::AllanVarianceFitter::RunFit,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("fits", &core::AllanVarianceFitter::GetFits);
+
+  py::class_<core::StreamingAllanVarianceFitter>(m,
+                                                "StreamingAllanVarianceFitter")
+      .def(py::init<>())
+      .def(
+          "add_telemetry",
+          [](core::StreamingAllanVarianceFitter& fitter,
+             const std::string& path) {
+            if (!io::StreamTelemetry(path, fitter)) {
+              throw std::runtime_error("Could not read " + path);
+            }
+          },
+          py::arg("path"),
+          py::call_guard<py::gil_scoped_release>(),
+          "Streams a telemetry file into the fitter without storing it")
+      .def("run_fit",
+           &core::StreamingAllanVarianceFitter::RunFit,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("fits",
+                             &core::StreamingAllanVarianceFitter::GetFits);
+}
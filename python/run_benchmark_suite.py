@@ -0,0 +1,290 @@
+import os
+import sys
+import json
+import glob
+import hashlib
+import statistics
+import time
+from argparse import ArgumentParser
+from subprocess import Popen
+from os.path import join as pjoin
+
+# Runs the calibration pipelines on pinned reference datasets and compares
+# the wall time and peak memory of their stages and the final calibration
+# results to a stored baseline. Every dataset is run with the
+# run_*_calibration.py script given in the manifest, the stage timings come
+# from its --stage_report_json and, with "profile", from the chrome traces
+# the binaries write to --profile_dir.
+#
+# The manifest is a json file:
+# {
+#   "tolerances": {"wall_time_rel": 0.15, "wall_time_abs_s": 2.0,
+#                  "peak_rss_rel": 0.15,
+#                  "metrics": {"imu_cam_reproj_error": 0.01}},
+#   "datasets": [{"name": "gopro9_1080_50",
+#                 "runner": "run_gopro_calibration.py",
+#                 "path_calib_dataset": ".../GoPro9/1080_50/dataset2",
+#                 "files": {"cam/GH010037.MP4": "<sha256>", ...},
+#                 "args": {"camera_model": "DOUBLE_SPHERE",
+#                          "checker_size_m": 0.021},
+#                 "profile": true,
+#                 "metrics": {"camera_reproj_error":
+#                             ["cam/cam_calib_*.json", "final_reproj_error"]}}]
+# }
+# files pins the recordings by their sha256, a dataset whose files changed is
+# not run. metrics maps a name to a result json (glob relative to the
+# dataset) and a dotted key inside it, DEFAULT_METRICS is used without it.
+# Metrics without a tolerance may change by --metric_tolerance relative to
+# the baseline. Dataset entries can override the tolerances.
+
+DEFAULT_METRICS = {
+    "camera_reproj_error": ["cam/cam_calib_*.json", "final_reproj_error"],
+    "imu_cam_reproj_error": ["cam_imu/cam_imu_calib_result_*.json",
+                             "final_reproj_error"],
+    "time_offset_imu_to_cam_s": ["cam_imu/cam_imu_calib_result_*.json",
+                                 "time_offset_imu_to_cam_s"],
+    "calib_line_delay_us": ["cam_imu/cam_imu_calib_result_*.json",
+                            "calib_line_delay_us"],
+    "t_i_c_x": ["cam_imu/cam_imu_calib_result_*.json", "t_i_c.x"],
+    "t_i_c_y": ["cam_imu/cam_imu_calib_result_*.json", "t_i_c.y"],
+    "t_i_c_z": ["cam_imu/cam_imu_calib_result_*.json", "t_i_c.z"],
+}
+
+DEFAULT_TOLERANCES = {"wall_time_rel": 0.15,
+                      "wall_time_abs_s": 2.0,
+                      "peak_rss_rel": 0.15,
+                      "metrics": {}}
+
+
+def sha256_of(path, chunk_bytes=1 << 24):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(chunk_bytes), b""):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+
+def check_pinned_files(dataset):
+    ''' Returns the files of the dataset that are missing or changed. '''
+    errors = []
+    for rel_path, expected in dataset.get("files", {}).items():
+        path = pjoin(dataset["path_calib_dataset"], rel_path)
+        if not os.path.isfile(path):
+            errors.append(rel_path + " is missing")
+        elif sha256_of(path) != expected:
+            errors.append(rel_path + " does not match its sha256")
+    return errors
+
+
+def read_metric(dataset_path, spec):
+    ''' Value of the dotted key in the newest file matching the glob, None if
+    there is none. '''
+    files = glob.glob(pjoin(dataset_path, spec[0]))
+    if not files:
+        return None
+    with open(max(files, key=os.path.getmtime), "r") as f:
+        value = json.load(f)
+    for key in spec[1].split("."):
+        if not isinstance(value, dict) or key not in value:
+            return None
+        value = value[key]
+    return value if isinstance(value, (int, float)) else None
+
+
+def read_profiled_stages(profile_dir):
+    ''' Wall time and peak memory of the top level stages in the chrome
+    traces of the binaries, keyed by binary/stage. '''
+    stages = {}
+    for trace_file in glob.glob(pjoin(profile_dir, "*.json")):
+        binary = os.path.basename(trace_file)[:-5]
+        with open(trace_file, "r") as f:
+            trace = json.load(f)
+        for event in trace.get("traceEvents", []):
+            event_args = event.get("args", {})
+            if event_args.get("depth", 0) != 0:
+                continue
+            stage = stages.setdefault(binary + "/" + event["name"],
+                                      {"wall_time_s": 0.0, "peak_rss_kb": 0})
+            stage["wall_time_s"] += event.get("dur", 0) * 1e-6
+            stage["peak_rss_kb"] = max(stage["peak_rss_kb"],
+                                       event_args.get("peak_rss_kb", 0))
+    return stages
+
+
+def run_once(dataset, args, run_dir):
+    report_json = pjoin(run_dir, "stage_report.json")
+    profile_dir = pjoin(run_dir, "profile")
+    command = [sys.executable,
+               pjoin(os.path.dirname(os.path.abspath(__file__)), dataset["runner"]),
+               "--path_calib_dataset=" + dataset["path_calib_dataset"],
+               "--path_to_build=" + args.path_to_build,
+               "--stage_report_json=" + report_json]
+    for key, value in dataset.get("args", {}).items():
+        command.append("--" + key + "=" + str(value))
+    if dataset.get("profile", False):
+        command.append("--profile_dir=" + profile_dir)
+    start_s = time.time()
+    returncode = Popen(command).wait()
+    wall_time_s = time.time() - start_s
+    if returncode != 0 or not os.path.isfile(report_json):
+        return None
+    with open(report_json, "r") as f:
+        report = json.load(f)
+    stages = {s["name"]: {"wall_time_s": s["wall_time_s"],
+                          "peak_rss_kb": s["peak_rss_kb"]}
+              for s in report["stages"]}
+    if os.path.isdir(profile_dir):
+        stages.update(read_profiled_stages(profile_dir))
+    return {"wall_time_s": wall_time_s, "stages": stages}
+
+
+def run_dataset(dataset, args):
+    ''' Runs the dataset args.repeats times. Stage timings are the median of
+    the runs, peak memory the maximum, metrics from the last run. '''
+    result = {"success": False, "errors": check_pinned_files(dataset)}
+    if result["errors"]:
+        return result
+    runs = []
+    for repeat in range(args.repeats):
+        run_dir = pjoin(args.output_dir, dataset["name"], "run_" + str(repeat))
+        os.makedirs(run_dir, exist_ok=True)
+        print("Benchmarking {}, run {}/{}.".format(
+            dataset["name"], repeat + 1, args.repeats))
+        run = run_once(dataset, args, run_dir)
+        if run is None:
+            result["errors"].append("run " + str(repeat) + " failed")
+            return result
+        runs.append(run)
+
+    stages = {}
+    for name in runs[-1]["stages"]:
+        samples = [r["stages"][name] for r in runs if name in r["stages"]]
+        stages[name] = {
+            "wall_time_s": statistics.median(s["wall_time_s"] for s in samples),
+            "peak_rss_kb": max(s["peak_rss_kb"] for s in samples)}
+    metric_specs = dataset.get("metrics", DEFAULT_METRICS)
+    metrics = {}
+    for name, spec in metric_specs.items():
+        value = read_metric(dataset["path_calib_dataset"], spec)
+        if value is not None:
+            metrics[name] = value
+    result.update({
+        "success": True,
+        "wall_time_s": statistics.median(r["wall_time_s"] for r in runs),
+        "peak_rss_kb": max(s["peak_rss_kb"] for s in stages.values()),
+        "stages": stages,
+        "metrics": metrics})
+    return result
+
+
+def compare(name, result, baseline, tolerances, args):
+    ''' Returns the regressions of one dataset against its baseline. '''
+    if not result["success"]:
+        return [name + ": " + e for e in result["errors"]]
+    regressions = []
+
+    def check_time(label, value, reference):
+        limit = max(reference * (1.0 + tolerances["wall_time_rel"]),
+                    reference + tolerances["wall_time_abs_s"])
+        if value > limit:
+            regressions.append("{}: {} took {:.2f}s, baseline {:.2f}s".format(
+                name, label, value, reference))
+
+    def check_memory(label, value, reference):
+        if reference > 0 and value > reference * (1.0 + tolerances["peak_rss_rel"]):
+            regressions.append("{}: {} peaked at {}kB, baseline {}kB".format(
+                name, label, value, reference))
+
+    check_time("pipeline", result["wall_time_s"], baseline["wall_time_s"])
+    check_memory("pipeline", result["peak_rss_kb"], baseline["peak_rss_kb"])
+    for stage, reference in baseline["stages"].items():
+        if stage not in result["stages"]:
+            continue
+        check_time(stage, result["stages"][stage]["wall_time_s"],
+                   reference["wall_time_s"])
+        check_memory(stage, result["stages"][stage]["peak_rss_kb"],
+                     reference["peak_rss_kb"])
+    for metric, reference in baseline["metrics"].items():
+        if metric not in result["metrics"]:
+            regressions.append("{}: {} is missing".format(name, metric))
+            continue
+        value = result["metrics"][metric]
+        tolerance = tolerances["metrics"].get(
+            metric, abs(reference) * args.metric_tolerance)
+        if abs(value - reference) > tolerance:
+            regressions.append("{}: {} is {:.6g}, baseline {:.6g} +- {:.3g}".format(
+                name, metric, value, reference, tolerance))
+    return regressions
+
+
+def main():
+    parser = ArgumentParser("OpenICC - Benchmark suite")
+    parser.add_argument("--manifest",
+                        help="Json file with the reference datasets and tolerances.", required=True)
+    parser.add_argument('--path_to_build',
+                        help="Path to OpenCameraCalibrator build folder.",
+                        default='/media/Data/builds/openicc_release/applications')
+    parser.add_argument("--output_dir",
+                        help="Folder for the stage reports and profiles of the runs.", default="benchmark_runs", type=str)
+    parser.add_argument("--output_json",
+                        help="Writes the timings, memory and metrics of all datasets to this file.", default="benchmark_report.json", type=str)
+    parser.add_argument("--baseline_json",
+                        help="Report of an earlier run to compare against. Empty only records.", default="", type=str)
+    parser.add_argument("--update_baseline",
+                        help="If the report should also be written to baseline_json.", default=0, type=int)
+    parser.add_argument("--datasets",
+                        help="Comma separated names of the datasets to run, empty runs all.", default="", type=str)
+    parser.add_argument("--repeats",
+                        help="Runs per dataset, the stage timings are their median.", default=1, type=int)
+    parser.add_argument("--metric_tolerance",
+                        help="Relative change allowed for metrics without a tolerance in the manifest.", default=0.02, type=float)
+    args = parser.parse_args()
+    args.repeats = max(1, args.repeats)
+
+    with open(args.manifest, "r") as f:
+        manifest = json.load(f)
+    selected = [d for d in args.datasets.split(",") if d]
+    baseline = {}
+    if args.baseline_json and os.path.isfile(args.baseline_json):
+        with open(args.baseline_json, "r") as f:
+            baseline = json.load(f)["datasets"]
+
+    report = {"datasets": {}}
+    regressions = []
+    for dataset in manifest["datasets"]:
+        name = dataset["name"]
+        if selected and name not in selected:
+            continue
+        tolerances = dict(DEFAULT_TOLERANCES)
+        tolerances.update(manifest.get("tolerances", {}))
+        tolerances.update(dataset.get("tolerances", {}))
+        result = run_dataset(dataset, args)
+        report["datasets"][name] = result
+        if name in baseline and baseline[name]["success"]:
+            regressions += compare(name, result, baseline[name], tolerances, args)
+        elif not result["success"]:
+            regressions += [name + ": " + e for e in result["errors"]]
+        else:
+            print("No baseline for {}, only recording it.".format(name))
+
+    with open(args.output_json, "w") as f:
+        json.dump(report, f, indent=2)
+    if args.update_baseline and args.baseline_json:
+        with open(args.baseline_json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    print("==================================================================")
+    for name, result in report["datasets"].items():
+        if result["success"]:
+            print("{:<45} {:>9.2f}s {:>10}kB".format(
+                name, result["wall_time_s"], result["peak_rss_kb"]))
+        else:
+            print("{:<45} {:>9}".format(name, "failed"))
+    for regression in regressions:
+        print("REGRESSION " + regression)
+    print("==================================================================")
+    if regressions:
+        exit(-1)
+
+if __name__ == "__main__":
+    main()
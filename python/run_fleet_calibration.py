@@ -0,0 +1,339 @@
+import os
+import json
+import socket
+import struct
+import threading
+import time
+import queue
+from argparse import ArgumentParser
+from concurrent.futures import ThreadPoolExecutor
+from os.path import join as pjoin
+
+# Calibrates many devices on a set of calibration_server nodes. Every node
+# runs the calibration_server application, recordings and results live on
+# storage that all nodes mount under the same paths. Videos are split into
+# frame ranges that are extracted on different nodes, the telemetry is
+# converted to the binary format once, so only compact scene (UBJSON) and
+# telemetry (binary) intermediates are passed between the stages.
+#
+# The manifest is a json file:
+# {
+#   "defaults": {"board": {"board_type": "charuco", ...},
+#                "telemetry_compression": "zstd",
+#                "downsample_factor": 2.0, "camera_model": "DOUBLE_SPHERE"},
+#   "devices": [{"name": "unit_0001",
+#                "cam_video": ".../cam/GX010001.MP4",
+#                "cam_imu_video": ".../cam_imu/GX010002.MP4",
+#                "spline_error_weighting_json": ".../spline_info.json",
+#                "imu_intrinsics": "", "imu_bias_estimate": "",
+#                "allan_telemetry": "", "output_dir": ".../unit_0001"}]
+# }
+# Device entries override the defaults.
+
+TELEMETRY_HEADER_BYTES = 8 + 4 + 8
+# compressed telemetry ends with the chunk index, see chunked_file.h
+CHUNKED_TELEMETRY_MAGIC = b"OICCTELC"
+CHUNK_INFO_BYTES = 6 * 8
+
+
+class NodePool:
+    ''' NodePool
+
+    Hands out free job slots of the calibration server nodes.
+    '''
+    def __init__(self, nodes, jobs_per_node):
+        self.free = queue.Queue()
+        for _ in range(jobs_per_node):
+            for node in nodes:
+                self.free.put(node)
+
+    def run(self, job, retry_delay_s=2.0):
+        ''' Sends the job to a free node and blocks until it finished.
+        Returns the final status message of the job. '''
+        while True:
+            node = self.free.get()
+            try:
+                status = send_job(node, job)
+            except OSError as e:
+                status = {"status": "rejected", "error": str(e)}
+            finally:
+                self.free.put(node)
+            if status["status"] != "rejected":
+                return status
+            # queue of the node is full or it is unreachable, try another
+            time.sleep(retry_delay_s)
+
+
+def send_job(node, job):
+    host, port = node.rsplit(":", 1)
+    with socket.create_connection((host, int(port))) as conn:
+        conn.sendall((json.dumps(job) + "\n").encode())
+        stream = conn.makefile("r")
+        for line in stream:
+            status = json.loads(line)
+            if status.get("id") != job["id"] or "pipeline_id" in status:
+                continue
+            if status["status"] in ("done", "failed", "rejected"):
+                return status
+    return {"status": "failed", "error": "connection to " + node + " closed"}
+
+
+def count_frames(video_path):
+    try:
+        import cv2
+    except ImportError:
+        return -1
+    cap = cv2.VideoCapture(video_path)
+    nr_frames = int(cap.get(cv2.CAP_PROP_FRAME_COUNT))
+    cap.release()
+    return nr_frames
+
+
+def first_telemetry_timestamp_s(telemetry_bin):
+    with open(telemetry_bin, "rb") as f:
+        header = f.read(TELEMETRY_HEADER_BYTES + 8)
+        if header[:8] != CHUNKED_TELEMETRY_MAGIC:
+            return struct.unpack_from(
+                "<q", header, TELEMETRY_HEADER_BYTES)[0] * 1e-9
+        # first_key of the first chunk in the index
+        f.seek(-16, os.SEEK_END)
+        _, index_offset = struct.unpack("<QQ", f.read(16))
+        f.seek(index_offset)
+        chunk = struct.unpack("<QQQQqq", f.read(CHUNK_INFO_BYTES))
+    return chunk[4] * 1e-9
+
+
+class DeviceCalibration:
+    ''' DeviceCalibration
+
+    Runs the stages of one device on the node pool.
+    '''
+    def __init__(self, device, pool, executor, segments_per_video):
+        self.device = device
+        self.name = device["name"]
+        self.pool = pool
+        self.executor = executor
+        self.segments_per_video = segments_per_video
+        self.out = device["output_dir"]
+        self.job_counter = 0
+        self.lock = threading.Lock()
+
+    def job(self, stage, **params):
+        with self.lock:
+            self.job_counter += 1
+            job_id = "{}/{}/{}".format(self.name, stage, self.job_counter)
+        job = {"id": job_id, "stage": stage}
+        job.update(params)
+        return job
+
+    def run_parallel(self, jobs):
+        futures = [self.executor.submit(self.pool.run, j) for j in jobs]
+        statuses = [f.result() for f in futures]
+        for s in statuses:
+            if s["status"] != "done":
+                raise RuntimeError(s["id"] + ": " + s.get("error", ""))
+        return statuses
+
+    def extraction_jobs(self, video_path, corners_path):
+        nr_frames = count_frames(video_path)
+        nr_segments = self.segments_per_video if nr_frames > 0 else 1
+        segment_len = (nr_frames + nr_segments - 1) // nr_segments
+        segments = []
+        params = {k: self.device[k] for k in
+                  ("board", "downsample_factor", "refine_full_resolution",
+                   "track_block_size", "adaptive_min_corner_spacing_px",
+                   "min_blur_score", "min_frame_difference", "frame_stride",
+                   "target_fps", "use_opencl", "radon_fast_path",
+                   "radon_fast_downsample_factor", "detection_budget_s")
+                  if k in self.device}
+        for i in range(nr_segments):
+            start = i * segment_len if nr_frames > 0 else 0
+            # the frame count of a container is a guess, the last segment
+            # extracts until the end
+            end = start + segment_len if i + 1 < nr_segments else -1
+            segment = corners_path + ".segment{}".format(i)
+            segments.append(self.job("extract_board",
+                                     input_path=video_path,
+                                     save_corners_json_path=segment,
+                                     start_frame=start,
+                                     end_frame=end, **params))
+        return segments
+
+    def run(self):
+        d = self.device
+        os.makedirs(self.out, exist_ok=True)
+        cam_corners = pjoin(self.out, "cam_corners.bson")
+        cam_imu_corners = pjoin(self.out, "cam_imu_corners.bson")
+        telemetry = pjoin(self.out, "cam_imu_telemetry.bin")
+
+        # 1. extraction segments of both videos and the telemetry
+        cam_segments = self.extraction_jobs(d["cam_video"], cam_corners)
+        cam_imu_segments = self.extraction_jobs(d["cam_imu_video"],
+                                                cam_imu_corners)
+        jobs = cam_segments + cam_imu_segments
+        jobs.append(self.job("convert_telemetry",
+                             input=d.get("telemetry", d["cam_imu_video"]),
+                             output=telemetry,
+                             compression=d.get("telemetry_compression",
+                                               "none")))
+        if d.get("allan_telemetry", "") != "":
+            jobs.append(self.job("fit_allan_variance",
+                                 telemetry=d["allan_telemetry"]))
+        self.run_parallel(jobs)
+
+        # 2. merge the segments
+        merges = []
+        for segments, corners in ((cam_segments, cam_corners),
+                                  (cam_imu_segments, cam_imu_corners)):
+            merges.append(self.job(
+                "merge_scenes",
+                inputs=[s["save_corners_json_path"] for s in segments],
+                output=corners))
+        self.run_parallel(merges)
+        for s in cam_segments + cam_imu_segments:
+            os.remove(s["save_corners_json_path"])
+
+        # 3. calibration chain on one node
+        cam_calib = pjoin(self.out, "cam_calib")
+        pose_dataset = pjoin(self.out, "cam_imu_poses.recon")
+        rotation_init = pjoin(self.out, "imu_to_cam_init.json")
+        result_json = pjoin(self.out, "imu_cam_calibration.json")
+        delta_t = d.get("delta_t_imu_to_cam",
+                        -first_telemetry_timestamp_s(telemetry))
+        optimize_board_points = d.get("optimize_board_points", False)
+        spline_params = {k: d[k] for k in
+                         ("global_shutter", "calibrate_cam_line_delay",
+                          "reestimate_biases", "gravity_const",
+                          "known_grav_dir_axis", "solver_profile",
+                          "sparse_backend", "dense_backend",
+                          "linearize_rolling_shutter",
+                          "rigid_board", "camera_residual_layout",
+                          "fuse_imu_residuals", "decomposition_segment_s",
+                          "decomposition_overlap_s", "decomposition_rounds",
+                          "decomposition_sample_stride", "spline_iterations",
+                          "fit_knots_to_poses", "knot_fit_iterations",
+                          "max_views_per_knot_interval",
+                          "imu_decimation_rate", "gate_outliers_mads",
+                          "gate_max_reprojection_error", "rig_cameras",
+                          "load_spline_state", "warm_start_spline_state",
+                          "profile_residuals", "init_grid_search",
+                          "init_grid_line_delays", "init_grid_time_offsets",
+                          "init_grid_time_offset_range_s",
+                          "compute_covariance")
+                         if k in d}
+        # checkpoint to rerun late stages or to warm start other devices
+        spline_params["save_spline_state"] = pjoin(self.out,
+                                                   "imu_cam_spline.state")
+        steps = [
+            self.job("calibrate_camera",
+                     input_corners=cam_corners,
+                     save_path_calib_dataset=cam_calib,
+                     camera_model=d.get("camera_model", "DOUBLE_SPHERE"),
+                     grid_size=d.get("grid_size", 0.04),
+                     optimize_board_points=optimize_board_points),
+            self.job("estimate_poses",
+                     input_corners=cam_imu_corners,
+                     camera_calibration_json=cam_calib + ".json",
+                     output_pose_dataset=pose_dataset,
+                     optimize_board_points=optimize_board_points,
+                     independent_pose_refinement=d.get(
+                         "independent_pose_refinement", False),
+                     alternating_board_refinement=d.get(
+                         "alternating_board_refinement", False),
+                     max_board_refinement_views=d.get(
+                         "max_board_refinement_views", 200)),
+            self.job("estimate_imu_to_camera_rotation",
+                     input_pose_calibration_dataset=pose_dataset,
+                     telemetry=telemetry,
+                     imu_bias_estimate=d.get("imu_bias_estimate", ""),
+                     imu_rotation_init_output=rotation_init,
+                     delta_t_imu_to_cam=delta_t,
+                     ransac_hypotheses=d.get("rotation_ransac_hypotheses", 0)),
+            self.job("calibrate_imu_camera",
+                     input_corners=cam_imu_corners,
+                     camera_calibration_json=cam_calib + ".json",
+                     input_pose_calibration_dataset=pose_dataset,
+                     imu_rotation_init=rotation_init,
+                     telemetry=telemetry,
+                     imu_intrinsics=d.get("imu_intrinsics", ""),
+                     imu_bias_estimate=d.get("imu_bias_estimate", ""),
+                     spline_error_weighting_json=d[
+                         "spline_error_weighting_json"],
+                     result_output_json=result_json, **spline_params)]
+        status = self.run_parallel([self.job("pipeline", steps=steps)])[0]
+        with open(result_json, "r") as f:
+            calibration = json.load(f)
+        return {"status": "done",
+                "output_dir": self.out,
+                "steps": status["result"]["steps"],
+                "calibration": calibration}
+
+
+def main():
+
+    parser = ArgumentParser("OpenCameraCalibrator - Fleet Calibrator")
+    parser.add_argument("--manifest",
+                        help="Json file with the devices to calibrate.",
+                        required=True, type=str)
+    parser.add_argument("--nodes",
+                        help="Comma separated host:port list of the calibration_server nodes.",
+                        default="127.0.0.1:5757", type=str)
+    parser.add_argument("--jobs_per_node",
+                        help="Jobs sent to one node at the same time, should match its num_workers.",
+                        default=1, type=int)
+    parser.add_argument("--segments_per_video",
+                        help="Frame ranges a video is split into for the board extraction.",
+                        default=4, type=int)
+    parser.add_argument("--max_parallel_devices",
+                        help="Devices whose stages are scheduled at the same time.",
+                        default=8, type=int)
+    parser.add_argument("--result_json",
+                        help="Where to write the per device results.",
+                        default="fleet_results.json", type=str)
+    args = parser.parse_args()
+
+    with open(args.manifest, "r") as f:
+        manifest = json.load(f)
+    defaults = manifest.get("defaults", {})
+    devices = []
+    for device in manifest["devices"]:
+        d = dict(defaults)
+        d.update(device)
+        devices.append(d)
+
+    nodes = args.nodes.split(",")
+    pool = NodePool(nodes, args.jobs_per_node)
+    # one thread per job slot waits for its job, the devices only schedule
+    job_executor = ThreadPoolExecutor(
+        max_workers=len(nodes) * args.jobs_per_node + 4 * args.max_parallel_devices)
+
+    def calibrate(device):
+        start = time.time()
+        try:
+            result = DeviceCalibration(
+                device, pool, job_executor, args.segments_per_video).run()
+        except (RuntimeError, OSError, KeyError) as e:
+            result = {"status": "failed", "error": str(e)}
+        result["wall_time_s"] = time.time() - start
+        print("{}: {} after {:.1f}s".format(
+            device["name"], result["status"], result["wall_time_s"]))
+        return device["name"], result
+
+    start = time.time()
+    with ThreadPoolExecutor(max_workers=args.max_parallel_devices) as devices_executor:
+        results = dict(devices_executor.map(calibrate, devices))
+    job_executor.shutdown()
+
+    nr_done = sum(1 for r in results.values() if r["status"] == "done")
+    summary = {"nr_devices": len(devices),
+               "nr_done": nr_done,
+               "wall_time_s": time.time() - start,
+               "devices": results}
+    with open(args.result_json, "w") as f:
+        json.dump(summary, f, indent=2)
+    print("Calibrated {} of {} devices in {:.1f}s.".format(
+        nr_done, len(devices), summary["wall_time_s"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,7 @@ import glob
 import time
 from utils import get_abbr_from_cam_model
 from telemetry_converter import TelemetryConverter, TelemetryImporter
+from stage_scheduler import StageScheduler
 
 def main():
 
@@ -58,6 +59,9 @@ def main():
     parser.add_argument("--reestimate_bias_spline_opt", 
                         help="If biases should be also estimated during spline optimization", 
                         default=0, type=int)
+    parser.add_argument("--bias_spline_dt_s", 
+                        help="Knot spacing of the bias splines in seconds during spline optimization. 0 estimates a constant bias.", 
+                        default=10.0, type=float)
     parser.add_argument("--optimize_board_points", 
                         help="if board points should be optimized during camera calibration and after pose estimation.", 
                         default=1, type=int)
@@ -66,8 +70,32 @@ def main():
                         choices=["X","Y","Z","UNKOWN"], default="UNKOWN", type=str)
     parser.add_argument("--global_shutter", 
                         help="If the camera is a global shutter cam.", default=0, type=int)
+    parser.add_argument("--rotation_only", 
+                        help="Only calibrate the gyroscope to camera rotation, time offset and line delay. Much faster, but does not estimate the translation.", default=0, type=int)
     parser.add_argument("--verbose", 
                         help="If calibration steps should output more information.", default=0, type=int)
+    parser.add_argument("--profile_dir", 
+                        help="If set, every calibration binary writes a chrome trace profile of its stages to this folder.", default="", type=str)
+    parser.add_argument("--cache_dir", 
+                        help="If set, corner extraction, camera calibration, pose estimation and the rotation initialization cache their results in this folder and reuse them while their inputs and parameters do not change.", default="", type=str)
+    parser.add_argument("--tune_detector_params", 
+                        help="If the charuco detector parameters should be tuned for speed on the camera calibration video first. The tuned parameters are stored next to the video and reused by later runs.", default=0, type=int)
+    parser.add_argument("--coverage_target_views", 
+                        help="If > 0, the corner extraction of the camera calibration video stops once every image region and board pose has this many views, or no new views arrived for 10s.", default=0, type=int)
+    parser.add_argument("--rotation_ransac_hypotheses", 
+                        help="If > 0, the IMU to camera rotation initialization runs a RANSAC with this many hypotheses over time windows, robust to segments with tracking loss.", default=0, type=int)
+    parser.add_argument("--overlap_pose_estimation", 
+                        help="If the camera poses for the IMU to camera calibration should be estimated while its corners are extracted, in one stage that starts after the camera calibration.", default=0, type=int)
+    parser.add_argument("--graduated_loss_widths", 
+                        help="Comma separated, shrinking Huber widths in pixels of the camera residuals of the spline optimization, e.g. 16,4,1. The first solve runs a short stage per width. Empty disables it.", default="", type=str)
+    parser.add_argument("--undistortion_map_cell_px", 
+                        help="If > 0, the corners of the IMU to camera pose estimation are undistorted through a lookup table of the camera sampled every this many pixels.", default=0.0, type=float)
+    parser.add_argument("--pose_tracking", 
+                        help="If the IMU to camera pose estimation should start every view from the pose of the previous frame and only fall back to RANSAC if that fails.", default=0, type=int)
+    parser.add_argument("--core_budget", 
+                        help="Cores the stages share. Independent stages run at the same time as long as they fit, 0 uses all cores.", default=0, type=int)
+    parser.add_argument("--stage_report_json", 
+                        help="If set, the wall time, peak memory and state of every stage are written to this json file.", default="", type=str)
 
     args = parser.parse_args()
 
@@ -78,6 +106,18 @@ def main():
     # # 0. Check inputs 
     # #
     bin_path = pjoin(args.path_to_build)
+
+    def profile_flag(run_name):
+        if args.profile_dir == "":
+            return []
+        os.makedirs(args.profile_dir, exist_ok=True)
+        return ["--profile_json=" + pjoin(args.profile_dir, run_name + ".json")]
+
+    def cache_flag():
+        if args.cache_dir == "":
+            return []
+        return ["--cache_dir=" + args.cache_dir]
+
     cam_calib_path = pjoin(args.path_calib_dataset,'cam')
     cam_calib_video = glob.glob(pjoin(cam_calib_path,"*.MP4"))
     if len(cam_calib_video) == 0:
@@ -115,7 +155,6 @@ def main():
     imu_cam_calibration_json = pjoin(cam_imu_path, "imu_to_cam_calibration_"+cam_imu_video_fn+".json")
 
     imu_bias_json =  pjoin(imu_bias_path, "imu_bias_"+bias_video_fn+".json")
-    spline_weighting_json = pjoin(cam_imu_path, "spline_info_"+cam_imu_video_fn+".json")
     cam_imu_result_json = pjoin(cam_imu_path, "cam_imu_calib_result_"+cam_imu_video_fn+".json")
     cam_imu_corners_json = pjoin(cam_imu_path, "cam_imu_corners_"+cam_imu_video_fn+".uson")
     cam_corners_json = pjoin(cam_calib_path, "cam_corners_"+cam_video_fn+".uson")
@@ -125,217 +164,202 @@ def main():
     gopro_telemetry_gen = gopro_telemetry[:-5] + "_gen.json"
     imu_bias_telemetry_json_in_gen = imu_bias_telemetry_json_in[:-5] + "_gen.json"
 
+    scheduler = StageScheduler(args.core_budget, report_json=args.stage_report_json)
+    # the corner extractions and the camera calibration share the budget, the
+    # spline optimization gets all of it
+    half_budget = max(1, len(scheduler.cpus) // 2)
+
     #
     # 0. Extract corners for camera calibration and camera imu calibration
     #
-    print("==================================================================")
-    print("Running corner extraction.")
-    print("==================================================================")   
-    start = time.time()
-    print("Extracing corners for camera calibration.")
-    cam_calib = Popen([pjoin(bin_path,'extract_board_to_json'),
-                    "--input_path=" + cam_calib_video[0],
-                    "--aruco_detector_params=" + aruco_detector_params,
-                    "--board_type=" + args.board_type,
-                    "--save_corners_json_path=" + cam_corners_json,
-                    "--downsample_factor=" + str(args.image_downsample_factor),
-                    "--checker_square_length_m=" + checker_size_m,
-                    "--verbose=" + str(args.verbose),
-                    "--recompute_corners=" + str(args.recompute_corners),
-                    "--num_squares_x="+str(args.num_squares_x),
-                    "--num_squares_y="+str(args.num_squares_y),
-                    "--logtostderr=1"])
-    error_cam_calib = cam_calib.wait()
-    print("Extracing corners for imu camera calibration.")
-    cam_imu_calib_corners = Popen([pjoin(bin_path,'extract_board_to_json'),
-                    "--input_path=" + cam_imu_video[0],
-                    "--aruco_detector_params=" + aruco_detector_params,
-                    "--board_type=" + args.board_type,
-                    "--save_corners_json_path=" + cam_imu_corners_json,
-                    "--downsample_factor=" + str(args.image_downsample_factor),
-                    "--checker_square_length_m=" + checker_size_m,
-                    "--verbose=" + str(args.verbose),
-                    "--recompute_corners=" + str(args.recompute_corners),
-                    "--num_squares_x="+str(args.num_squares_x),
-                    "--num_squares_y="+str(args.num_squares_y),
-                    "--logtostderr=1"])
-    error_cam_calib = cam_imu_calib_corners.wait()
-    print("Finished corner extraction.")
-    print("==================================================================")
-    print("Corner extraction took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+    def extract_corners(video, corners_json, run_name):
+        return [pjoin(bin_path,'extract_board_to_json'),
+                "--input_path=" + video,
+                "--aruco_detector_params=" + aruco_detector_params,
+                "--board_type=" + args.board_type,
+                "--save_corners_json_path=" + corners_json,
+                "--downsample_factor=" + str(args.image_downsample_factor),
+                "--checker_square_length_m=" + checker_size_m,
+                "--verbose=" + str(args.verbose),
+                "--recompute_corners=" + str(args.recompute_corners),
+                "--num_squares_x="+str(args.num_squares_x),
+                "--num_squares_y="+str(args.num_squares_y),
+                "--num_threads=" + str(half_budget),
+                "--logtostderr=1"] + profile_flag(run_name) + cache_flag()
+    # the tuned detector parameters are kept for this camera and board, the
+    # extractions wait for the tuning if they do not exist yet
+    extract_deps = []
+    if args.tune_detector_params and args.board_type == "charuco":
+        tuned_detector_params = pjoin(cam_calib_path, "charuco_detector_params_tuned.yml")
+        if not os.path.exists(tuned_detector_params):
+            scheduler.add("tune_detector_params",
+                          extract_corners(cam_calib_video[0], cam_corners_json, "tune_detector_params") +
+                          ["--tune_detector_params_output=" + tuned_detector_params])
+            extract_deps = ["tune_detector_params"]
+        aruco_detector_params = tuned_detector_params
+    # the intrinsics only need a good spread of views, not every frame
+    coverage_flags = []
+    if args.coverage_target_views > 0:
+        coverage_flags = ["--coverage_target_views=" + str(args.coverage_target_views),
+                          "--coverage_max_stale_s=10"]
+    scheduler.add("extract_corners_cam",
+                  extract_corners(cam_calib_video[0], cam_corners_json, "extract_board_cam") + coverage_flags,
+                  deps=extract_deps, cores=half_budget)
 
     #
     # 1. Calibrate camera
     #
-    print("==================================================================")
-    print("Running camera calibration.")
-    print("==================================================================")
-    start = time.time()
-    print("Calibrating camera.")
-    cam_calib = Popen([pjoin(bin_path,'calibrate_camera'),
-                    "--input_corners=" + cam_corners_json,
-                    "--save_path_calib_dataset=" + cam_calib_file_path,
-                    "--camera_model_to_calibrate=" + args.camera_model,
-                    "--grid_size=" + str(args.voxel_grid_size),
-                    "--optimize_board_points="+str(args.optimize_board_points),
-                    "--verbose=" + str(args.verbose),
-                    "--logtostderr=0"])
-    error_cam_calib = cam_calib.wait()
-    print("Finished camera calibration.")
-    print("==================================================================")
-    print("Camera calibration took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+    scheduler.add("calibrate_camera",
+                  [pjoin(bin_path,'calibrate_camera'),
+                   "--input_corners=" + cam_corners_json,
+                   "--save_path_calib_dataset=" + cam_calib_file_path,
+                   "--camera_model_to_calibrate=" + args.camera_model,
+                   "--grid_size=" + str(args.voxel_grid_size),
+                   "--optimize_board_points="+str(args.optimize_board_points),
+                   "--verbose=" + str(args.verbose),
+                   "--logtostderr=0"] + profile_flag("calibrate_camera") + cache_flag(),
+                  deps=["extract_corners_cam"], cores=half_budget)
 
     #
     # 2. Extracting GoPro telemetry
     #   
     js_extract_file = pjoin(path_to_src,"javascript","extract_metadata.js")
-    print("==================================================================")
-    print("Extracting GoPro telemetry for imu bias and camera imu calibration.")
-    print("==================================================================")
-    start = time.time()
-    telemetry_extract = Popen(["node",js_extract_file,
-                       imu_bias_path,
-                       bias_video_fn+".MP4",
-                       imu_bias_path])
-    # error_telemetry_extract = telemetry_extract.wait()
-    telemetry_extract = Popen(["node",js_extract_file,
-                       cam_imu_path,
-                       cam_imu_video_fn+".MP4",
-                       cam_imu_path])
-    error_telemetry_extract = telemetry_extract.wait()
-    print("==================================================================")
-    print("Telemetry extraction took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
-    
+    scheduler.add("extract_telemetry_imu_bias",
+                  ["node",js_extract_file,
+                   imu_bias_path,
+                   bias_video_fn+".MP4",
+                   imu_bias_path])
+    scheduler.add("extract_telemetry_cam_imu",
+                  ["node",js_extract_file,
+                   cam_imu_path,
+                   cam_imu_video_fn+".MP4",
+                   cam_imu_path])
 
     #
     # 3. Convert gopro json telemetry to common format
     #
     telemetry_conv = TelemetryConverter()
-    telemetry_conv.convert_gopro_telemetry_file(gopro_telemetry, gopro_telemetry_gen)
-    telemetry_conv.convert_gopro_telemetry_file(imu_bias_telemetry_json_in, imu_bias_telemetry_json_in_gen)
+    scheduler.add("convert_telemetry_imu_bias",
+                  func=lambda: telemetry_conv.convert_gopro_telemetry_file(
+                      imu_bias_telemetry_json_in, imu_bias_telemetry_json_in_gen),
+                  deps=["extract_telemetry_imu_bias"])
+    scheduler.add("convert_telemetry_cam_imu",
+                  func=lambda: telemetry_conv.convert_gopro_telemetry_file(
+                      gopro_telemetry, gopro_telemetry_gen),
+                  deps=["extract_telemetry_cam_imu"])
+
+    # the corner extraction only starts once a quick check of the telemetry
+    # and a few frames of the video passed
+    scheduler.add("preflight_cam_imu",
+                  extract_corners(cam_imu_video[0], cam_imu_corners_json, "preflight_cam_imu") +
+                  ["--preflight=1",
+                   "--preflight_telemetry=" + gopro_telemetry_gen],
+                  deps=["convert_telemetry_cam_imu"] + extract_deps)
+    if not args.overlap_pose_estimation:
+        scheduler.add("extract_corners_cam_imu",
+                      extract_corners(cam_imu_video[0], cam_imu_corners_json, "extract_board_cam_imu"),
+                      deps=["preflight_cam_imu"], cores=half_budget)
 
     #
     # 4. Estimating IMU biases
     #  
     py_imu_file = pjoin(path_to_src,"python","get_imu_biases.py")
-    print("==================================================================")
-    print("Estimating IMU biases.")
-    print("==================================================================")
-    start = time.time()
-    bias_estimation = Popen(["python", py_imu_file,
-                       "--input_json_path=" + imu_bias_telemetry_json_in_gen,
-                       "--output_path=" + imu_bias_json,
-                       "--gravity_const=" + str(args.gravity_const),
-                       "--remove_sec=" + str(args.bias_calib_remove_s)])
-    error_bias_estimation = bias_estimation.wait()
-    print("==================================================================")
-    print("IMU bias estimation took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+    scheduler.add("estimate_imu_biases",
+                  ["python", py_imu_file,
+                   "--input_json_path=" + imu_bias_telemetry_json_in_gen,
+                   "--output_path=" + imu_bias_json,
+                   "--gravity_const=" + str(args.gravity_const),
+                   "--remove_sec=" + str(args.bias_calib_remove_s)],
+                  deps=["convert_telemetry_imu_bias"])
 
     #
     # 5. Creating pose dataset for IMU - CAM calibration
     #   
-    print("==================================================================")
-    print("Estimating camera poses for IMU - CAM calibration.")
-    print("==================================================================")
-    start = time.time()
-    pose_estimation = Popen([pjoin(bin_path,"estimate_camera_poses_from_checkerboard"),
+    if args.overlap_pose_estimation:
+        # the poses are solved as the views are extracted, the extraction
+        # waits for the camera calibration instead
+        scheduler.add("estimate_camera_poses",
+                      extract_corners(cam_imu_video[0], cam_imu_corners_json, "extract_board_cam_imu") +
+                      ["--camera_calibration_json=" + calib_dataset_json,
+                       "--output_pose_dataset=" + pose_calib_dataset,
+                       "--optimize_board_points="+str(args.optimize_board_points),
+                       "--undistortion_map_cell_px="+str(args.undistortion_map_cell_px),
+                       "--pose_tracking="+str(args.pose_tracking)],
+                      deps=["preflight_cam_imu", "calibrate_camera"], cores=half_budget)
+    else:
+        scheduler.add("estimate_camera_poses",
+                      [pjoin(bin_path,"estimate_camera_poses_from_checkerboard"),
                        "--input_corners=" + cam_imu_corners_json,
                        "--camera_calibration_json=" + calib_dataset_json,
                        "--output_pose_dataset=" + pose_calib_dataset,
                        "--optimize_board_points="+str(args.optimize_board_points),
-                       "--logtostderr=1"])
-    error_pose_estimation = pose_estimation.wait()  
-    print("==================================================================")
-    print("Pose estimation estimation took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
-
-    # 
-    # 6. Estimate spline error weighting parameters
-    #  
-    py_spline_file = pjoin(path_to_src,"python","get_sew_for_dataset.py")
-    print("==================================================================")
-    print("Estimating Spline error weighting and knot spacing.")
-    print("==================================================================")
-    start = time.time()
-    spline_init = Popen(["python", py_spline_file,
-                       "--input_json_path=" + gopro_telemetry_gen,
-                       "--output_path=" + spline_weighting_json,
-                       "--q_so3=" + str(0.99),
-                       "--q_r3=" + str(0.99)])
-    error_spline_init = spline_init.wait()  
-    print("==================================================================")
-    print("Spline weighting and knot spacing estimation took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+                       "--undistortion_map_cell_px="+str(args.undistortion_map_cell_px),
+                       "--pose_tracking="+str(args.pose_tracking),
+                       "--logtostderr=1"] + profile_flag("estimate_camera_poses_from_checkerboard") + cache_flag(),
+                      deps=["extract_corners_cam_imu", "calibrate_camera"], cores=half_budget)
 
     #
-    # 7. Estimate IMU to cam rotation
+    # 6. Estimate IMU to cam rotation
     #   
-    print("==================================================================")
-    print("Initializing IMU to camera rotation.")
-    print("==================================================================")
-    start = time.time()
-    # in the case of GoPro's we can actually take the first IMU timestamp as an initial guess
-    # for the time offset IMU->CAM
-    importer = TelemetryImporter()
-    importer.read_generic_json(gopro_telemetry_gen)
-    t_imu_2_cam = -importer.telemetry["timestamps_ns"][0]*1e-9
-    spline_init = Popen([pjoin(bin_path,"estimate_imu_to_camera_rotation"),
-                       "--telemetry_json=" + gopro_telemetry_gen,
-                       "--input_pose_calibration_dataset=" + pose_calib_dataset,
-                       "--imu_bias_estimate=" + imu_bias_json,
-                       "--imu_rotation_init_output=" + imu_cam_calibration_json,
-                       "--delta_t_imu_to_cam=" + str(t_imu_2_cam),
-                       "--logtostderr=1"])
-    error_spline_init = spline_init.wait()  
-    print("==================================================================")
-    print("Spline weighting and knot spacing estimation took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+    def rotation_init_command():
+        # in the case of GoPro's we can actually take the first IMU timestamp as an initial guess
+        # for the time offset IMU->CAM
+        importer = TelemetryImporter()
+        importer.read_generic_json(gopro_telemetry_gen)
+        t_imu_2_cam = -importer.telemetry["timestamps_ns"][0]*1e-9
+        return [pjoin(bin_path,"estimate_imu_to_camera_rotation"),
+                "--telemetry_json=" + gopro_telemetry_gen,
+                "--input_pose_calibration_dataset=" + pose_calib_dataset,
+                "--imu_bias_estimate=" + imu_bias_json,
+                "--imu_rotation_init_output=" + imu_cam_calibration_json,
+                "--delta_t_imu_to_cam=" + str(t_imu_2_cam),
+                "--ransac_hypotheses=" + str(args.rotation_ransac_hypotheses),
+                "--logtostderr=1"] + profile_flag("estimate_imu_to_camera_rotation") + cache_flag()
+    scheduler.add("estimate_imu_to_camera_rotation", rotation_init_command,
+                  deps=["estimate_camera_poses", "estimate_imu_biases", "convert_telemetry_cam_imu"],
+                  cores=half_budget)
 
     #
-    # 8. Run IMU to Camera calibration using Spline Fusion
+    # 7. Run IMU to Camera calibration using Spline Fusion
     #  
-    print("==================================================================")
-    print("Optimizing IMU to Camera calibration using Spline Fusion.")
-    print("==================================================================")
-    start = time.time()
-    spline_init = Popen([pjoin(bin_path,"continuous_time_imu_to_camera_calibration"),
-                       "--gyro_to_cam_initial_calibration=" + imu_cam_calibration_json,
-                       "--telemetry_json=" + gopro_telemetry_gen,
-                       "--imu_intrinsics="+args.path_to_imu_intrinsics,
-                       "--input_pose_dataset=" + pose_calib_dataset,
-                       "--input_corners=" + cam_imu_corners_json,
-                       "--camera_calibration_json=" + calib_dataset_json,
-                       "--imu_bias_file=" + imu_bias_json,
-                       "--output_path=" + cam_imu_path,
-                       "--spline_error_weighting_json=" + spline_weighting_json,
-                       "--result_output_json=" + cam_imu_result_json,
-                       "--reestimate_biases="+str(args.reestimate_bias_spline_opt),
-                       "--logtostderr=1",
-                       "--global_shutter="+str(args.global_shutter),
-                       "--gravity_const="+str(args.gravity_const),
-                       "--known_grav_dir_axis="+args.known_gravity_axis,
-                       "--calibrate_cam_line_delay="+str(args.calib_cam_line_delay),
-                       "--debug_video_path="+cam_imu_video[0]])
-    error_spline_init = spline_init.wait()  
-    print("==================================================================")
-    print("Spline weighting and knot spacing estimation took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+    scheduler.add("continuous_time_imu_to_camera_calibration",
+                  [pjoin(bin_path,"continuous_time_imu_to_camera_calibration"),
+                   "--gyro_to_cam_initial_calibration=" + imu_cam_calibration_json,
+                   "--telemetry_json=" + gopro_telemetry_gen,
+                   "--imu_intrinsics="+args.path_to_imu_intrinsics,
+                   "--input_pose_dataset=" + pose_calib_dataset,
+                   "--input_corners=" + cam_imu_corners_json,
+                   "--camera_calibration_json=" + calib_dataset_json,
+                   "--imu_bias_file=" + imu_bias_json,
+                   "--output_path=" + cam_imu_path,
+                   "--q_so3=" + str(0.99),
+                   "--q_r3=" + str(0.99),
+                   "--result_output_json=" + cam_imu_result_json,
+                   "--reestimate_biases="+str(args.reestimate_bias_spline_opt),
+                   "--bias_spline_dt_s="+str(args.bias_spline_dt_s),
+                   "--logtostderr=1",
+                   "--global_shutter="+str(args.global_shutter),
+                   "--rotation_only="+str(args.rotation_only),
+                   "--gravity_const="+str(args.gravity_const),
+                   "--known_grav_dir_axis="+args.known_gravity_axis,
+                   "--calibrate_cam_line_delay="+str(args.calib_cam_line_delay),
+                   "--graduated_loss_widths="+args.graduated_loss_widths,
+                   "--debug_video_path="+cam_imu_video[0]]
+                   + profile_flag("continuous_time_imu_to_camera_calibration"),
+                  deps=["estimate_imu_to_camera_rotation"],
+                  cores=0)
 
     #
-    # 9. Print results
+    # 8. Print results
     #   
-    py_spline_file = pjoin(path_to_src,"python","print_result_stats.py")
-    print("==================================================================")
-    print("Print results.")
-    print("==================================================================")
-    start = time.time()
-    print_res = Popen(["python", py_spline_file,
-                       "--path_results=" + cam_imu_result_json])
-    error_print_res = print_res.wait()  
+    py_print_file = pjoin(path_to_src,"python","print_result_stats.py")
+    scheduler.add("print_results",
+                  ["python", py_print_file,
+                   "--path_results=" + cam_imu_result_json],
+                  deps=["continuous_time_imu_to_camera_calibration"])
+
+    if not scheduler.run():
+        exit(-1)
 
 if __name__ == "__main__":
     main()
\ No newline at end of file
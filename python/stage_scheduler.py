@@ -0,0 +1,185 @@
+import json
+import os
+import shutil
+import threading
+import time
+from subprocess import Popen
+
+# Runs the stages of a calibration pipeline as a dependency graph. A stage is
+# either a command or a python function and starts as soon as all stages it
+# depends on finished successfully and enough cores of the budget are free.
+# Commands are pinned to their share of the cpus with taskset if it is
+# installed, the native binaries size their thread pool by the cpus they may
+# run on. Stages whose
+# dependencies failed are skipped, independent stages still run.
+
+
+class Stage:
+    ''' Stage
+
+    One node of the graph. Exactly one of command and func is set, command
+    is an argument list or a function returning it when the stage starts.
+    '''
+    def __init__(self, name, command=None, func=None, deps=(), cores=1):
+        self.name = name
+        self.command = command
+        self.func = func
+        self.deps = list(deps)
+        self.cores = max(1, cores)
+        self.cpus = []
+        self.state = "pending"
+        self.start_s = 0.0
+        self.end_s = 0.0
+        self.peak_rss_kb = 0
+
+
+class StageScheduler:
+    ''' StageScheduler
+
+    Starts the ready stages in the order they were added while they fit into
+    the core budget. A stage larger than the budget runs alone. If
+    report_json is set, run writes the state, duration and peak memory of
+    every stage to it.
+    '''
+    def __init__(self, core_budget=0, verbose=True, report_json=""):
+        if hasattr(os, "sched_getaffinity"):
+            self.cpus = sorted(os.sched_getaffinity(0))
+        else:
+            self.cpus = list(range(os.cpu_count() or 1))
+        if core_budget > 0:
+            self.cpus = self.cpus[:core_budget]
+        self.taskset = shutil.which("taskset")
+        self.verbose = verbose
+        self.report_json = report_json
+        self.stages = {}
+        self.order = []
+        self.cond = threading.Condition()
+
+    def add(self, name, command=None, func=None, deps=(), cores=1):
+        ''' Adds a stage, the stages in deps must have been added before.
+        cores=0 gives the stage the full budget. Returns the name. '''
+        if (command is None) == (func is None):
+            raise ValueError("Stage " + name + " needs a command or a function")
+        if name in self.stages:
+            raise ValueError("Stage " + name + " was already added")
+        for dep in deps:
+            if dep not in self.stages:
+                raise ValueError("Stage " + name + " depends on unknown stage " + dep)
+        cores = len(self.cpus) if cores == 0 else cores
+        self.stages[name] = Stage(name, command, func, deps, cores)
+        self.order.append(name)
+        return name
+
+    def _ready(self, stage):
+        return all(self.stages[d].state == "done" for d in stage.deps)
+
+    def _blocked(self, stage):
+        return any(self.stages[d].state in ("failed", "skipped") for d in stage.deps)
+
+    def _execute(self, stage):
+        success = False
+        try:
+            if stage.func is not None:
+                result = stage.func()
+                success = result is None or bool(result)
+            else:
+                command = stage.command() if callable(stage.command) else stage.command
+                if self.taskset and stage.cpus:
+                    cpu_list = ",".join(str(c) for c in stage.cpus)
+                    command = [self.taskset, "-c", cpu_list] + command
+                process = Popen(command)
+                if hasattr(os, "wait4"):
+                    # reaps the command itself to get its resource usage
+                    _, status, usage = os.wait4(process.pid, 0)
+                    process.returncode = (os.WEXITSTATUS(status)
+                                          if os.WIFEXITED(status) else -1)
+                    stage.peak_rss_kb = usage.ru_maxrss
+                success = process.wait() == 0
+        except Exception as e:
+            print("Stage {} raised: {}".format(stage.name, e))
+        with self.cond:
+            stage.end_s = time.time()
+            stage.state = "done" if success else "failed"
+            self.free_cpus.extend(stage.cpus)
+            self.cond.notify_all()
+
+    def run(self):
+        ''' Runs all stages and blocks until they finished. Returns True if
+        all stages succeeded. '''
+        self.free_cpus = list(self.cpus)
+        start_s = time.time()
+        threads = []
+        with self.cond:
+            while True:
+                pending = [self.stages[n] for n in self.order
+                           if self.stages[n].state == "pending"]
+                running = [self.stages[n] for n in self.order
+                           if self.stages[n].state == "running"]
+                for stage in pending:
+                    if self._blocked(stage):
+                        stage.state = "skipped"
+                        print("Skipping stage {}, a dependency failed.".format(stage.name))
+                pending = [s for s in pending if s.state == "pending"]
+                if not pending and not running:
+                    break
+                started = False
+                for stage in pending:
+                    if not self._ready(stage):
+                        continue
+                    cores = min(stage.cores, len(self.cpus))
+                    if cores > len(self.free_cpus):
+                        continue
+                    stage.cpus = self.free_cpus[:cores]
+                    del self.free_cpus[:cores]
+                    stage.state = "running"
+                    stage.start_s = time.time()
+                    if self.verbose:
+                        print("Starting stage {} on {} cores.".format(stage.name, cores))
+                    thread = threading.Thread(target=self._execute, args=(stage,))
+                    thread.start()
+                    threads.append(thread)
+                    started = True
+                if not started:
+                    self.cond.wait()
+        for thread in threads:
+            thread.join()
+        wall_time_s = time.time() - start_s
+        if self.verbose:
+            self.print_summary(wall_time_s)
+        if self.report_json:
+            self.write_report(self.report_json, wall_time_s)
+        return all(self.stages[n].state == "done" for n in self.order)
+
+    def critical_path_s(self):
+        ''' Longest chain of stage durations through the graph. '''
+        finish = {}
+        for name in self.order:
+            stage = self.stages[name]
+            duration = max(0.0, stage.end_s - stage.start_s)
+            finish[name] = duration + max([finish[d] for d in stage.deps], default=0.0)
+        return max(finish.values(), default=0.0)
+
+    def print_summary(self, wall_time_s):
+        print("==================================================================")
+        for name in self.order:
+            stage = self.stages[name]
+            duration = max(0.0, stage.end_s - stage.start_s)
+            print("{:<45} {:>8} {:>9.2f}s".format(name, stage.state, duration))
+        print("Pipeline took {:.2f}s, its critical path {:.2f}s.".format(
+            wall_time_s, self.critical_path_s()))
+        print("==================================================================")
+
+    def write_report(self, path, wall_time_s):
+        stages = []
+        for name in self.order:
+            stage = self.stages[name]
+            stages.append({"name": name,
+                           "state": stage.state,
+                           "cores": stage.cores,
+                           "wall_time_s": max(0.0, stage.end_s - stage.start_s),
+                           "peak_rss_kb": stage.peak_rss_kb})
+        report = {"wall_time_s": wall_time_s,
+                  "critical_path_s": self.critical_path_s(),
+                  "stages": stages}
+        with open(path, "w") as f:
+            json.dump(report, f, indent=2)
@@ -16,7 +16,7 @@ def main():
     # Cast the input to string, int or float type 
     parser.add_argument('--path_static_calib_dataset', 
                         default='/media/Data/work_projects/ImageStabelization/GoPro10Calibration/ImuIntrinsics/dataset1', 
-                        help="Path to calibration dataset")
+                        help="Path to calibration dataset. A comma separated list of datasets of co-mounted IMUs is calibrated in one batch.")
     parser.add_argument('--path_to_build', 
                         help="Path to OpenCameraCalibrator build folder.",
                         default='/media/Data/builds/openicc_release/applications') 
@@ -27,6 +27,9 @@ def main():
                         default=15, type=float)
     parser.add_argument("--verbose", help="If calibration steps should output more information.", 
                         default=0, type=int)
+    parser.add_argument("--share_static_intervals",
+                        help="Batch mode: reuse the static intervals of the first dataset for all others.",
+                        default=1, type=int)
     args = parser.parse_args()
 
     path_to_file = os.path.dirname(os.path.abspath(__file__))
@@ -35,40 +38,43 @@ def main():
     # # 0. Check inputs 
     # #
     bin_path = pjoin(args.path_to_build)
-    cam_calib_path = args.path_static_calib_dataset
-    cam_calib_video = glob.glob(pjoin(cam_calib_path,"*.MP4"))
-    if len(cam_calib_video) == 0:
-        print("Error! Could not find cam calibration video file with MP4 ending in path "+cam_calib_path)
-        exit(-1)
-    print(cam_calib_video)
+    dataset_paths = args.path_static_calib_dataset.split(",")
+    telemetry_gen_files = []
+    for cam_calib_path in dataset_paths:
+        cam_calib_video = glob.glob(pjoin(cam_calib_path,"*.MP4"))
+        if len(cam_calib_video) == 0:
+            print("Error! Could not find cam calibration video file with MP4 ending in path "+cam_calib_path)
+            exit(-1)
+        print(cam_calib_video)
 
-    # globals
-    cam_video_fn = os.path.basename(cam_calib_video[0])[:-4]
-    gopro_telemetry = glob.glob(pjoin(cam_calib_path,"G*.MP4"))[0][:-4]+".json"
-    gopro_telemetry_gen = glob.glob(pjoin(cam_calib_path,"G*.MP4"))[0][:-4]+"_gen.json"
+        # globals
+        cam_video_fn = os.path.basename(cam_calib_video[0])[:-4]
+        gopro_telemetry = glob.glob(pjoin(cam_calib_path,"G*.MP4"))[0][:-4]+".json"
+        gopro_telemetry_gen = glob.glob(pjoin(cam_calib_path,"G*.MP4"))[0][:-4]+"_gen.json"
 
-    #
-    # 1. Extracting GoPro telemetry
-    #   
-    js_extract_file = pjoin(path_to_src,"javascript","extract_metadata.js")
-    print("==================================================================")
-    print("Extracting GoPro telemetry.")
-    print("==================================================================")
-    start = time.time()
-    telemetry_extract = Popen(["node",js_extract_file,
-                       cam_calib_path,
-                       cam_video_fn+".MP4",
-                       cam_calib_path])
-    error = telemetry_extract.wait()
-    print("==================================================================")
-    print("Telemetry extraction took {:.2f}s.".format(time.time()-start))
-    print("==================================================================")
+        #
+        # 1. Extracting GoPro telemetry
+        #   
+        js_extract_file = pjoin(path_to_src,"javascript","extract_metadata.js")
+        print("==================================================================")
+        print("Extracting GoPro telemetry.")
+        print("==================================================================")
+        start = time.time()
+        telemetry_extract = Popen(["node",js_extract_file,
+                           cam_calib_path,
+                           cam_video_fn+".MP4",
+                           cam_calib_path])
+        error = telemetry_extract.wait()
+        print("==================================================================")
+        print("Telemetry extraction took {:.2f}s.".format(time.time()-start))
+        print("==================================================================")
     
-    #
-    # 2. Convert gopro json telemetry to common format
-    #
-    telemetry_conv = TelemetryConverter()
-    telemetry_conv.convert_gopro_telemetry_file(gopro_telemetry, gopro_telemetry_gen)
+        #
+        # 2. Convert gopro json telemetry to common format
+        #
+        telemetry_conv = TelemetryConverter()
+        telemetry_conv.convert_gopro_telemetry_file(gopro_telemetry, gopro_telemetry_gen)
+        telemetry_gen_files.append(gopro_telemetry_gen)
 
     #
     # 3. Perform static multi pose calibration
@@ -77,12 +83,19 @@ def main():
     print("Performing static multi pose IMU calibration.")
     print("==================================================================")
     start = time.time()
-    spline_init = Popen([pjoin(bin_path,"static_imu_calibration"),
-                       "--telemetry_json="+gopro_telemetry_gen,
+    if len(telemetry_gen_files) == 1:
+        telemetry_args = ["--telemetry_json="+telemetry_gen_files[0]]
+    else:
+        # one combined result for all devices, keyed by the dataset name
+        telemetry_args = ["--telemetry_jsons="+",".join(telemetry_gen_files),
+                          "--device_names="+",".join(
+                              os.path.basename(os.path.normpath(p)) for p in dataset_paths),
+                          "--share_static_intervals="+str(args.share_static_intervals)]
+    spline_init = Popen([pjoin(bin_path,"static_imu_calibration")] + telemetry_args + [
                        "--gravity_magnitude="+str(args.gravity_const),
                        "--initial_static_interval_s="+str(args.initial_static_duration_s),
                        "--verbose="+str(args.verbose), 
-                       "--output_calibration_path="+pjoin(args.path_static_calib_dataset,"static_calib_result.json"),
+                       "--output_calibration_path="+pjoin(dataset_paths[0],"static_calib_result.json"),
                        "--logtostderr=1"])
     error_spline_init = spline_init.wait()  
     print("==================================================================")
@@ -1,6 +1,9 @@
 #include "OpenCameraCalibrator/allanvariance/allan_acc.h"
 
 #include <iostream>
+#include <sstream>
+
+#include "OpenCameraCalibrator/allanvariance/allan_variance.h"
 
 namespace OpenICC {
 namespace allanvar {
@@ -33,59 +36,61 @@ void AllanAcc::pushMPerSec2(double data, double time) {
 }
 
 void AllanAcc::calc() {
-  std::cout << m_name << " "
-            << " numData " << numData << std::endl;
+  // collect the output, several axes might be computed concurrently
+  std::ostringstream out;
+  out << m_name << " "
+      << " numData " << numData << std::endl;
   if (numData < 10000)
-    std::cout << m_name << " "
-              << " Too few number" << std::endl;
+    out << m_name << " "
+        << " Too few number" << std::endl;
 
   double start_t = m_rawData.begin()->t;
   double end_t = m_rawData[numData - 1].t;
-  std::cout << m_name << " "
-            << " start_t " << start_t << std::endl;
-  std::cout << m_name << " "
-            << " end_t " << end_t << std::endl;
-  std::cout << m_name << " "
-            << "dt " << std::endl  //
-            << "-------------" << (end_t - start_t) << " s" << std::endl
-            << "-------------" << (end_t - start_t) / 60 << " min" << std::endl
-            << "-------------" << (end_t - start_t) / 3600 << " h" << std::endl;
+  out << m_name << " "
+      << " start_t " << start_t << std::endl;
+  out << m_name << " "
+      << " end_t " << end_t << std::endl;
+  out << m_name << " "
+      << "dt " << std::endl  //
+      << "-------------" << (end_t - start_t) << " s" << std::endl
+      << "-------------" << (end_t - start_t) / 60 << " min" << std::endl
+      << "-------------" << (end_t - start_t) / 3600 << " h" << std::endl;
 
   if ((end_t - start_t) / 60 < 10)
-    std::cout << m_name << " "
-              << " Too short time!!!!" << std::endl;
+    out << m_name << " "
+        << " Too short time!!!!" << std::endl;
 
   m_freq = getAvgFreq();
-  std::cout << m_name << " "
-            << " freq " << m_freq << std::endl;
+  out << m_name << " "
+      << " freq " << m_freq << std::endl;
 
-  double period = getAvgPeriod();
-  std::cout << m_name << " "
-            << " period " << period << std::endl;
+  m_period = getAvgPeriod();
+  out << m_name << " "
+      << " period " << m_period << std::endl;
 
-  m_thetas = calcThetas(m_freq);
+  calcThetas(m_freq);
+  // the variance only needs the integrated signal
+  m_rawData.clear();
 
   initStrides();
 
-  mVariance = calcVariance(period);
+  mVariance = calcVariance(m_period);
+  m_thetas.clear();
+  std::cout << out.str();
 }
 
 std::vector<double> AllanAcc::getVariance() const { return mVariance; }
 
 std::vector<double> AllanAcc::getDeviation() {
-  double period = getAvgPeriod();
-
-  std::vector<double> sigma2 = calcVariance(period);
   std::vector<double> sigma;
-
-  for (auto& sig : sigma2) {
+  for (auto& sig : mVariance) {
     sigma.push_back(sqrt(sig));
   }
   return sigma;
 }
 
 std::vector<double> AllanAcc::getTimes() {
-  double period = getAvgPeriod();
+  const double period = m_period;
   std::vector<double> time(numFactors, 0.0);
   for (int i = 0; i < numFactors; i++) {
     int factor = mFactors[i];
@@ -100,40 +105,22 @@ std::vector<int> AllanAcc::getFactors() const { return mFactors; }
 double AllanAcc::getFreq() const { return m_freq; }
 
 std::vector<double> AllanAcc::calcVariance(double period) {
-  std::vector<double> sigma2(numFactors, 0.0);
-
-  for (int i = 0; i < numFactors; i++) {
-    int factor = mFactors[i];
-    double clusterPeriod2 = (period * factor) * (period * factor);
-    double divided = 2 * clusterPeriod2 * (numData - 2 * factor);
-    int max = numData - 2 * factor;
-
-    for (int k = 0; k < max; k++) {
-      double temp =
-          (m_thetas[k + 2 * factor] - 2 * m_thetas[k + factor] + m_thetas[k]);
-      sigma2[i] += (temp * temp);
-    }
-
-    //            std::cout << "sigma2 " << sigma2[i] << std::endl;
-    sigma2[i] = sigma2[i] / divided;
-  }
-
-  //        for ( int index = 0; index < mVariance.size( ); ++index )
-  //        {
-  //            std::cout << sigma2[index] << std::endl;
-  //        }
-  return sigma2;
+  return CalcOverlappingAllanVariance(m_thetas.data(),
+                                      m_thetas.size(),
+                                      mFactors,
+                                      numFactors,
+                                      period,
+                                      m_numThreads);
 }
 
-std::vector<double> AllanAcc::calcThetas(const double freq) {
-  std::vector<double> thetas;
-
+void AllanAcc::calcThetas(const double freq) {
+  m_thetas.clear();
+  m_thetas.reserve(m_rawData.size());
   double sum = 0;
   for (auto& acc : m_rawData) {
     sum += acc.a;
-    thetas.push_back(sum / freq);
+    m_thetas.push_back(sum / freq);
   }
-  return thetas;
 }
 
 void AllanAcc::initStrides() {
@@ -1,6 +1,9 @@
 #include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
 
 #include <iostream>
+#include <sstream>
+
+#include "OpenCameraCalibrator/allanvariance/allan_variance.h"
 
 namespace OpenICC {
 namespace allanvar {
@@ -33,59 +36,66 @@ void AllanGyr::pushDegreePerHou(double data, double time) {
 }
 
 void AllanGyr::calc() {
-  std::cout << m_name << " "
-            << " numData " << numData << std::endl;
+  // collect the output, several axes might be computed concurrently
+  std::ostringstream out;
+  out << m_name << " "
+      << " numData " << numData << std::endl;
   if (numData < 10000)
-    std::cout << m_name << " "
-              << " Too few number" << std::endl;
+    out << m_name << " "
+        << " Too few number" << std::endl;
 
   double start_t = m_rawData.begin()->t;
   double end_t = m_rawData[numData - 1].t;
-  std::cout << m_name << " "
-            << " start_t " << start_t << std::endl;
-  std::cout << m_name << " "
-            << " end_t " << end_t << std::endl;
-  std::cout << m_name << " "
-            << "dt " << std::endl  //
-            << "-------------" << (end_t - start_t) << " s" << std::endl
-            << "-------------" << (end_t - start_t) / 60 << " min" << std::endl
-            << "-------------" << (end_t - start_t) / 3600 << " h" << std::endl;
+  out << m_name << " "
+      << " start_t " << start_t << std::endl;
+  out << m_name << " "
+      << " end_t " << end_t << std::endl;
+  out << m_name << " "
+      << "dt " << std::endl  //
+      << "-------------" << (end_t - start_t) << " s" << std::endl
+      << "-------------" << (end_t - start_t) / 60 << " min" << std::endl
+      << "-------------" << (end_t - start_t) / 3600 << " h" << std::endl;
 
   if ((end_t - start_t) / 60 < 10)
-    std::cout << m_name << " "
-              << " Too short time!!!!" << std::endl;
+    out << m_name << " "
+        << " Too short time!!!!" << std::endl;
 
   m_freq = getAvgFreq();
-  std::cout << m_name << " "
-            << " freq " << m_freq << std::endl;
+  out << m_name << " "
+      << " freq " << m_freq << std::endl;
 
-  double period = getAvgPeriod();
-  std::cout << m_name << " "
-            << " period " << period << std::endl;
+  m_period = getAvgPeriod();
+  out << m_name << " "
+      << " period " << m_period << std::endl;
 
-  m_thetas = calcThetas(m_freq);
+  calcThetas(m_freq);
+  m_avgValue = 0.0;
+  for (auto& gyro : m_rawData) {
+    m_avgValue += gyro.w;
+  }
+  m_avgValue /= numData;
+  // the variance only needs the integrated signal
+  m_rawData.clear();
 
   initStrides();
 
-  mVariance = calcVariance(period);
+  mVariance = calcVariance(m_period);
+  m_thetas.clear();
+  std::cout << out.str();
 }
 
 std::vector<double> AllanGyr::getVariance() const { return mVariance; }
 
 std::vector<double> AllanGyr::getDeviation() {
-  double period = getAvgPeriod();
-
-  std::vector<double> sigma2 = calcVariance(period);
   std::vector<double> sigma;
-
-  for (auto& sig : sigma2) {
+  for (auto& sig : mVariance) {
     sigma.push_back(sqrt(sig));
   }
   return sigma;
 }
 
 std::vector<double> AllanGyr::getTimes() {
-  double period = getAvgPeriod();
+  const double period = m_period;
   std::vector<double> time(numFactors, 0.0);
   for (int i = 0; i < numFactors; i++) {
     int factor = mFactors[i];
@@ -98,40 +108,22 @@ std::vector<double> AllanGyr::getTimes() {
 std::vector<int> AllanGyr::getFactors() const { return mFactors; }
 
 std::vector<double> AllanGyr::calcVariance(double period) {
-  std::vector<double> sigma2(numFactors, 0.0);
-
-  for (int i = 0; i < numFactors; i++) {
-    int factor = mFactors[i];
-    double clusterPeriod2 = (period * factor) * (period * factor);
-    double divided = 2 * clusterPeriod2 * (numData - 2 * factor);
-    int max = numData - 2 * factor;
-
-    for (int k = 0; k < max; k++) {
-      double temp =
-          (m_thetas[k + 2 * factor] - 2 * m_thetas[k + factor] + m_thetas[k]);
-      sigma2[i] += (temp * temp);
-    }
-
-    //            std::cout << "sigma2 " << sigma2[i] << std::endl;
-    sigma2[i] = sigma2[i] / divided;
-  }
-
-  //        for ( int index = 0; index < mVariance.size( ); ++index )
-  //        {
-  //            std::cout << sigma2[index] << std::endl;
-  //        }
-  return sigma2;
+  return CalcOverlappingAllanVariance(m_thetas.data(),
+                                      m_thetas.size(),
+                                      mFactors,
+                                      numFactors,
+                                      period,
+                                      m_numThreads);
 }
 
-std::vector<double> AllanGyr::calcThetas(const double freq) {
-  std::vector<double> thetas;
-
+void AllanGyr::calcThetas(const double freq) {
+  m_thetas.clear();
+  m_thetas.reserve(m_rawData.size());
   double sum = 0;
   for (auto& gyro : m_rawData) {
     sum += gyro.w;
-    thetas.push_back(sum / freq);
+    m_thetas.push_back(sum / freq);
   }
-  return thetas;
 }
 
 void AllanGyr::initStrides() {
@@ -208,15 +200,7 @@ double AllanGyr::getAvgDt() {
   return sum_dt / (numData - 1);
 }
 
-double AllanGyr::getAvgValue() {
-  double sum = 0.0;
-  int num = 0;
-  for (auto& gyro : m_rawData) {
-    sum += gyro.w;
-    ++num;
-  }
-  return sum / num;
-}
+double AllanGyr::getAvgValue() { return m_avgValue; }
 
 double AllanGyr::getFreq() const { return m_freq; }
 
@@ -0,0 +1,206 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/allanvariance/allan_parameter_fit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace allanvar {
+
+namespace {
+
+const int kNumParams = 5;
+const double kDegPerHourToRadPerSec = 1.0 / (57.3 * 3600);
+
+//! log10 of the model variance minus log10 of the measured variance at all
+//! cluster times of one axis
+class AllanLogVarianceCost : public ceres::CostFunction {
+ public:
+  AllanLogVarianceCost(const std::vector<double>& variances,
+                       const std::vector<double>& taus)
+      : tau_powers_(taus.size(), kNumParams),
+        log_variances_(variances.size()) {
+    for (size_t i = 0; i < taus.size(); ++i) {
+      for (int k = 0; k < kNumParams; ++k) {
+        tau_powers_(i, k) = std::pow(taus[i], k - 2);
+      }
+      log_variances_[i] = std::log10(variances[i]);
+    }
+    set_num_residuals(static_cast<int>(taus.size()));
+    mutable_parameter_block_sizes()->push_back(kNumParams);
+  }
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const Eigen::Map<const Eigen::Matrix<double, kNumParams, 1>> p(
+        parameters[0]);
+    const Eigen::Matrix<double, kNumParams, 1> p_sq = p.cwiseAbs2();
+    const Eigen::VectorXd sigma2 = tau_powers_ * p_sq;
+    if ((sigma2.array() <= 0.0).any()) {
+      return false;
+    }
+    Eigen::Map<Eigen::VectorXd>(residuals, sigma2.size()) =
+        sigma2.array().log10() - log_variances_.array();
+    if (jacobians && jacobians[0]) {
+      // d log10(sigma2) / dp_k = 2 p_k tau^(k-2) / (sigma2 ln 10)
+      Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, kNumParams,
+                               Eigen::RowMajor>>
+          J(jacobians[0], sigma2.size(), kNumParams);
+      const Eigen::ArrayXd scale = 2.0 / (sigma2.array() * std::log(10.0));
+      J = (tau_powers_.array().rowwise() * p.transpose().array()).colwise() *
+          scale;
+    }
+    return true;
+  }
+
+ private:
+  Eigen::Matrix<double, Eigen::Dynamic, kNumParams> tau_powers_;
+  Eigen::VectorXd log_variances_;
+};
+
+}  // namespace
+
+std::vector<double> AllanInitialValues(const std::vector<double>& variances,
+                                       const std::vector<double>& taus) {
+  const Eigen::Map<const Eigen::ArrayXd> var(variances.data(),
+                                             variances.size());
+  const Eigen::Map<const Eigen::ArrayXd> tau(taus.data(), taus.size());
+  const Eigen::ArrayXd sqrt_tau = tau.sqrt();
+  Eigen::MatrixXd F(taus.size(), kNumParams);
+  for (int k = 0; k < kNumParams; ++k) {
+    F.col(k) = sqrt_tau.pow(k - 2).matrix();
+  }
+  const Eigen::VectorXd C =
+      (F.transpose() * F).ldlt().solve(F.transpose() * var.sqrt().matrix());
+  std::vector<double> init(kNumParams);
+  for (int k = 0; k < kNumParams; ++k) {
+    init[k] = std::abs(C[k]);
+  }
+  return init;
+}
+
+double AllanModelDeviation(const AllanAxisFit& fit, const double tau) {
+  return std::sqrt(fit.Q * fit.Q / (tau * tau) + fit.N * fit.N / tau +
+                   fit.B * fit.B + fit.K * fit.K * tau +
+                   fit.R * fit.R * tau * tau);
+}
+
+bool FitAllanAxis(const AllanAxisData& data, AllanAxisFit& fit) {
+  fit = AllanAxisFit();
+  fit.name = data.name;
+  fit.gyroscope = data.gyroscope;
+  if (data.variances.size() != data.taus.size()) {
+    return false;
+  }
+
+  std::vector<double> variances, taus;
+  double rising_max = 0.0;
+  for (size_t i = 0; i < data.taus.size(); ++i) {
+    if (!data.gyroscope && data.taus[i] < 1.0 &&
+        rising_max < data.variances[i]) {
+      rising_max = data.variances[i];
+      continue;
+    }
+    if (data.variances[i] > 0.0) {
+      variances.push_back(data.variances[i]);
+      taus.push_back(data.taus[i]);
+    }
+  }
+  if (taus.size() < static_cast<size_t>(kNumParams)) {
+    return false;
+  }
+
+  std::vector<double> params = AllanInitialValues(variances, taus);
+  ceres::Problem problem;
+  problem.AddResidualBlock(
+      new AllanLogVarianceCost(variances, taus), nullptr, params.data());
+  ceres::Solver::Options options;
+  options.logging_type = ceres::SILENT;
+  options.minimizer_progress_to_stdout = false;
+  options.trust_region_strategy_type = ceres::DOGLEG;
+  options.num_threads = 1;
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+
+  fit.Q = params[0];
+  fit.N = params[1];
+  fit.B = params[2];
+  fit.K = params[3];
+  fit.R = params[4];
+  fit.num_iterations = static_cast<int>(summary.iterations.size());
+  fit.final_cost = summary.final_cost;
+  fit.converged = summary.termination_type == ceres::CONVERGENCE;
+
+  const double unit = data.gyroscope ? kDegPerHourToRadPerSec : 1.0;
+  fit.bias_instability = std::numeric_limits<double>::max();
+  for (const double tau : taus) {
+    const double deviation = AllanModelDeviation(fit, tau);
+    if (deviation < fit.bias_instability) {
+      fit.bias_instability = deviation;
+      fit.bias_instability_tau = tau;
+    }
+  }
+  fit.bias_instability *= unit;
+  fit.white_noise = std::sqrt(data.freq) * AllanModelDeviation(fit, 1.0) * unit;
+  fit.bias = data.gyroscope ? data.mean / 3600.0 : data.mean;
+  return summary.IsSolutionUsable();
+}
+
+bool FitAllanAxes(const std::vector<AllanAxisData>& data,
+                  std::vector<AllanAxisFit>& fits) {
+  fits.resize(data.size());
+  std::vector<char> success(data.size(), 0);
+  utils::ParallelFor(data.size(),
+                     static_cast<int>(data.size()),
+                     [&](size_t begin, size_t end, int) {
+                       for (size_t i = begin; i < end; ++i) {
+                         success[i] = FitAllanAxis(data[i], fits[i]);
+                       }
+                     });
+  return std::all_of(
+      success.begin(), success.end(), [](char s) { return s != 0; });
+}
+
+nlohmann::json AllanAxisFitToJson(const AllanAxisFit& fit) {
+  nlohmann::json fit_json;
+  fit_json["name"] = fit.name;
+  fit_json["sensor"] = fit.gyroscope ? "gyroscope" : "accelerometer";
+  fit_json["Q"] = fit.Q;
+  fit_json["N"] = fit.N;
+  fit_json["B"] = fit.B;
+  fit_json["K"] = fit.K;
+  fit_json["R"] = fit.R;
+  fit_json["white_noise"] = fit.white_noise;
+  fit_json["bias_instability"] = fit.bias_instability;
+  fit_json["bias_instability_tau_s"] = fit.bias_instability_tau;
+  fit_json["bias"] = fit.bias;
+  fit_json["num_iterations"] = fit.num_iterations;
+  fit_json["final_cost"] = fit.final_cost;
+  fit_json["converged"] = fit.converged;
+  return fit_json;
+}
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -0,0 +1,130 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/allanvariance/allan_variance.h"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace allanvar {
+
+std::vector<double> CalcOverlappingAllanVariance(
+    const double* thetas,
+    const int num_thetas,
+    const std::vector<int>& factors,
+    const int num_factors,
+    const double period,
+    const int num_threads) {
+  std::vector<double> sigma2(num_factors, 0.0);
+  const int num_data = num_thetas;
+  const Eigen::Map<const Eigen::ArrayXd> theta(thetas, num_data);
+
+  // small factors cost the most, interleave them so all threads have about
+  // the same amount of work
+  const int nr_threads = std::max(1, std::min(num_threads, num_factors));
+  utils::ParallelFor(
+      nr_threads, nr_threads, [&](size_t, size_t, int thread_idx) {
+        for (int i = thread_idx; i < num_factors; i += nr_threads) {
+          const int factor = factors[i];
+          const int max = num_data - 2 * factor;
+          if (max <= 0) {
+            continue;
+          }
+          const double cluster_period2 =
+              (period * factor) * (period * factor);
+          const double divided = 2 * cluster_period2 * max;
+          const double sum = (theta.segment(2 * factor, max) -
+                              2 * theta.segment(factor, max) +
+                              theta.head(max))
+                                 .square()
+                                 .sum();
+          sigma2[i] = sum / divided;
+        }
+      });
+  return sigma2;
+}
+
+void StreamingAllanVariance::AddValue(const double value) {
+  sum_ += value;
+  ++num_values_;
+
+  // a completed cluster of one level is passed on as half of a cluster of
+  // the next level
+  double mean = value;
+  for (size_t l = 0;; ++l) {
+    if (l == levels_.size()) {
+      levels_.emplace_back();
+    }
+    Level& level = levels_[l];
+    if (level.has_prev) {
+      const double diff = mean - level.prev_mean;
+      level.sum_sq_diff += diff * diff;
+      ++level.num_diffs;
+    }
+    level.prev_mean = mean;
+    level.has_prev = true;
+    if (!level.has_pending) {
+      level.pending_mean = mean;
+      level.has_pending = true;
+      return;
+    }
+    mean = 0.5 * (level.pending_mean + mean);
+    level.has_pending = false;
+  }
+}
+
+std::vector<int> StreamingAllanVariance::GetFactors() const {
+  std::vector<int> factors;
+  for (size_t l = 0; l < levels_.size(); ++l) {
+    if (levels_[l].num_diffs > 0) {
+      factors.push_back(1 << l);
+    }
+  }
+  return factors;
+}
+
+std::vector<double> StreamingAllanVariance::GetVariance() const {
+  std::vector<double> sigma2;
+  for (const Level& level : levels_) {
+    if (level.num_diffs > 0) {
+      sigma2.push_back(level.sum_sq_diff / (2.0 * level.num_diffs));
+    }
+  }
+  return sigma2;
+}
+
+std::vector<double> StreamingAllanVariance::GetDeviation() const {
+  std::vector<double> sigma = GetVariance();
+  for (double& sig : sigma) {
+    sig = std::sqrt(sig);
+  }
+  return sigma;
+}
+
+std::vector<double> StreamingAllanVariance::GetTimes(
+    const double period) const {
+  std::vector<double> times;
+  for (const int factor : GetFactors()) {
+    times.push_back(period * factor);
+  }
+  return times;
+}
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -1,14 +1,50 @@
 #include "OpenCameraCalibrator/core/allan_variance_fitter.h"
 
+#include <algorithm>
+#include <functional>
+#include <glog/logging.h>
+#include <vector>
+
 #include "OpenCameraCalibrator/allanvariance/allan_acc.h"
 #include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
 
-#include "OpenCameraCalibrator/allanvariance/fitallan_acc.h"
-#include "OpenCameraCalibrator/allanvariance/fitallan_gyr.h"
+#include "OpenCameraCalibrator/allanvariance/allan_parameter_fit.h"
+
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/resample.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
 
 namespace OpenICC {
 namespace core {
 
+namespace {
+
+const char* kAxisNames[3] = {"x", "y", "z"};
+
+void LogFits(const std::vector<allanvar::AllanAxisFit>& fits) {
+  for (const allanvar::AllanAxisFit& fit : fits) {
+    const char* unit = fit.gyroscope ? "rad/s" : "m/s^2";
+    LOG(INFO) << fit.name << ": white noise " << fit.white_noise << " "
+              << unit << ", bias instability " << fit.bias_instability << " "
+              << unit << " at " << fit.bias_instability_tau << "s, bias "
+              << fit.bias << (fit.gyroscope ? " deg/s" : " m/s^2")
+              << (fit.converged ? "" : " (not converged)");
+  }
+}
+
+nlohmann::json FitsToJson(const std::vector<allanvar::AllanAxisFit>& fits) {
+  nlohmann::json result;
+  result["axes"] = nlohmann::json::array();
+  for (const allanvar::AllanAxisFit& fit : fits) {
+    result["axes"].push_back(allanvar::AllanAxisFitToJson(fit));
+  }
+  return result;
+}
+
+}  // namespace
+
 AllanVarianceFitter::AllanVarianceFitter(
     const CameraTelemetryData& telemetry_data, const int nr_clusters)
     : telemetry_data_(telemetry_data) {
@@ -22,91 +58,162 @@ AllanVarianceFitter::AllanVarianceFitter(
   data_gyr_y_ = new allanvar::AllanGyr("gyr_y", nr_clusters);
   data_gyr_z_ = new allanvar::AllanGyr("gyr_z", nr_clusters);
 
-  for (size_t i = 0; i < telemetry_data_.accelerometer.size(); ++i) {
-    const double t_s = telemetry_data_.accelerometer[i].timestamp_s();
-    data_acc_x_->pushMPerSec2(telemetry_data_.accelerometer[i].x(), t_s);
-    data_acc_y_->pushMPerSec2(telemetry_data_.accelerometer[i].y(), t_s);
-    data_acc_z_->pushMPerSec2(telemetry_data_.accelerometer[i].z(), t_s);
+  // the cluster averages assume a uniform sampling, both sensors are
+  // resampled onto the mean sample spacing of the accelerometer
+  const utils::UniformGrid grid =
+      utils::MakeUniformGrid(telemetry_data_.accelerometer);
+  const int nr_threads = utils::Executor::Global().MaxConcurrency();
+  ImuReadings accl, gyro;
+  utils::ResampleUniform(telemetry_data_.accelerometer, grid, accl, nr_threads);
+  utils::ResampleUniform(telemetry_data_.gyroscope, grid, gyro, nr_threads);
+
+  const int num_samples = accl.size();
+  for (allanvar::AllanAcc* acc : {data_acc_x_, data_acc_y_, data_acc_z_}) {
+    acc->reserve(num_samples);
+  }
+  for (allanvar::AllanGyr* gyr : {data_gyr_x_, data_gyr_y_, data_gyr_z_}) {
+    gyr->reserve(num_samples);
+  }
+
+  for (size_t i = 0; i < accl.size(); ++i) {
+    const double t_s = accl[i].timestamp_s();
+    data_acc_x_->pushMPerSec2(accl[i].x(), t_s);
+    data_acc_y_->pushMPerSec2(accl[i].y(), t_s);
+    data_acc_z_->pushMPerSec2(accl[i].z(), t_s);
 
-    data_gyr_x_->pushRadPerSec(telemetry_data_.gyroscope[i].x(), t_s);
-    data_gyr_y_->pushRadPerSec(telemetry_data_.gyroscope[i].y(), t_s);
-    data_gyr_z_->pushRadPerSec(telemetry_data_.gyroscope[i].z(), t_s);
+    data_gyr_x_->pushRadPerSec(gyro[i].x(), t_s);
+    data_gyr_y_->pushRadPerSec(gyro[i].y(), t_s);
+    data_gyr_z_->pushRadPerSec(gyro[i].z(), t_s);
   }
 }
 
 bool AllanVarianceFitter::RunFit() {
-  data_gyr_x_->calc();
-  std::vector<double> gyro_v_x = data_gyr_x_->getVariance();
-  std::vector<double> gyro_d_x = data_gyr_x_->getDeviation();
-  std::vector<double> gyro_ts_x = data_gyr_x_->getTimes();
-
-  data_gyr_y_->calc();
-  std::vector<double> gyro_v_y = data_gyr_y_->getVariance();
-  std::vector<double> gyro_d_y = data_gyr_y_->getDeviation();
-  std::vector<double> gyro_ts_y = data_gyr_y_->getTimes();
-
-  data_gyr_z_->calc();
-  std::vector<double> gyro_v_z = data_gyr_z_->getVariance();
-  std::vector<double> gyro_d_z = data_gyr_z_->getDeviation();
-  std::vector<double> gyro_ts_z = data_gyr_z_->getTimes();
-
-  std::cout << "Gyro X " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_x(gyro_v_x, gyro_ts_x, data_gyr_x_->getFreq());
-  std::cout << "  bias " << data_gyr_x_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "Gyro y " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_y(gyro_v_y, gyro_ts_y, data_gyr_y_->getFreq());
-  std::cout << "  bias " << data_gyr_y_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "Gyro z " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_z(gyro_v_z, gyro_ts_z, data_gyr_z_->getFreq());
-  std::cout << "  bias " << data_gyr_z_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::vector<double> gyro_sim_d_x = fit_gyr_x.calcSimDeviation(gyro_ts_x);
-  std::vector<double> gyro_sim_d_y = fit_gyr_y.calcSimDeviation(gyro_ts_y);
-  std::vector<double> gyro_sim_d_z = fit_gyr_z.calcSimDeviation(gyro_ts_z);
-
-  std::cout << "==============================================" << std::endl;
-  std::cout << "==============================================" << std::endl;
-
-  data_acc_x_->calc();
-  std::vector<double> acc_v_x = data_acc_x_->getVariance();
-  std::vector<double> acc_d_x = data_acc_x_->getDeviation();
-  std::vector<double> acc_ts_x = data_acc_x_->getTimes();
-
-  data_acc_y_->calc();
-  std::vector<double> acc_v_y = data_acc_y_->getVariance();
-  std::vector<double> acc_d_y = data_acc_y_->getDeviation();
-  std::vector<double> acc_ts_y = data_acc_y_->getTimes();
-
-  data_acc_z_->calc();
-  std::vector<double> acc_v_z = data_acc_z_->getVariance();
-  std::vector<double> acc_d_z = data_acc_z_->getDeviation();
-  std::vector<double> acc_ts_z = data_acc_z_->getTimes();
-
-  std::cout << "acc X " << std::endl;
-  allanvar::FitAllanAcc fit_acc_x(acc_v_x, acc_ts_x, data_acc_x_->getFreq());
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "acc y " << std::endl;
-  allanvar::FitAllanAcc fit_acc_y(acc_v_y, acc_ts_y, data_acc_y_->getFreq());
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "acc z " << std::endl;
-  allanvar::FitAllanAcc fit_acc_z(acc_v_z, acc_ts_z, data_acc_z_->getFreq());
-  std::cout << "-------------------" << std::endl;
-
-  std::vector<double> acc_sim_d_x = fit_acc_x.calcSimDeviation(acc_ts_x);
-  std::vector<double> acc_sim_d_y = fit_acc_y.calcSimDeviation(acc_ts_x);
-  std::vector<double> acc_sim_d_z = fit_acc_z.calcSimDeviation(acc_ts_x);
-
-  return true;
+  utils::ScopedStageTimer stage_timer("AllanVarianceFitter::RunFit");
+  stage_timer.AddItems(telemetry_data_.accelerometer.size());
+
+  // the six axes are independent, compute them concurrently and split the
+  // threads evenly over their cluster factors
+  const std::vector<std::function<void()>> axes = {
+      [this] { data_gyr_x_->calc(); },
+      [this] { data_gyr_y_->calc(); },
+      [this] { data_gyr_z_->calc(); },
+      [this] { data_acc_x_->calc(); },
+      [this] { data_acc_y_->calc(); },
+      [this] { data_acc_z_->calc(); }};
+  const int nr_threads = utils::Executor::Global().MaxConcurrency();
+  const int threads_per_axis =
+      std::max(1, nr_threads / static_cast<int>(axes.size()));
+  data_gyr_x_->setNumThreads(threads_per_axis);
+  data_gyr_y_->setNumThreads(threads_per_axis);
+  data_gyr_z_->setNumThreads(threads_per_axis);
+  data_acc_x_->setNumThreads(threads_per_axis);
+  data_acc_y_->setNumThreads(threads_per_axis);
+  data_acc_z_->setNumThreads(threads_per_axis);
+  utils::ParallelFor(axes.size(),
+                     static_cast<int>(axes.size()),
+                     [&axes](size_t begin, size_t end, int) {
+                       for (size_t i = begin; i < end; ++i) {
+                         axes[i]();
+                       }
+                     });
+
+  allanvar::AllanGyr* gyr[3] = {data_gyr_x_, data_gyr_y_, data_gyr_z_};
+  allanvar::AllanAcc* acc[3] = {data_acc_x_, data_acc_y_, data_acc_z_};
+  Eigen::Vector3d acc_mean = Eigen::Vector3d::Zero();
+  for (const auto& accl : telemetry_data_.accelerometer) {
+    acc_mean += accl.data();
+  }
+  acc_mean /= std::max<size_t>(1, telemetry_data_.accelerometer.size());
+
+  std::vector<allanvar::AllanAxisData> axes_data(6);
+  for (int d = 0; d < 3; ++d) {
+    allanvar::AllanAxisData& gyr_data = axes_data[d];
+    gyr_data.name = std::string("gyr_") + kAxisNames[d];
+    gyr_data.gyroscope = true;
+    gyr_data.variances = gyr[d]->getVariance();
+    gyr_data.taus = gyr[d]->getTimes();
+    gyr_data.freq = gyr[d]->getFreq();
+    gyr_data.mean = gyr[d]->getAvgValue();
+
+    allanvar::AllanAxisData& acc_data = axes_data[3 + d];
+    acc_data.name = std::string("acc_") + kAxisNames[d];
+    acc_data.gyroscope = false;
+    acc_data.variances = acc[d]->getVariance();
+    acc_data.taus = acc[d]->getTimes();
+    acc_data.freq = acc[d]->getFreq();
+    acc_data.mean = acc_mean[d];
+  }
+  const bool success = allanvar::FitAllanAxes(axes_data, fits_);
+  LogFits(fits_);
+  return success;
+}
+
+nlohmann::json AllanVarianceFitter::ResultToJson() const {
+  return FitsToJson(fits_);
+}
+
+void StreamingAllanVarianceFitter::AddTimestamp(const int64_t timestamp_ns) {
+  if (num_timestamps_ == 0) {
+    first_timestamp_ns_ = timestamp_ns;
+  }
+  last_timestamp_ns_ = timestamp_ns;
+  ++num_timestamps_;
+}
+
+void StreamingAllanVarianceFitter::AddAccelerometer(
+    const Eigen::Vector3d& accl) {
+  for (int d = 0; d < 3; ++d) {
+    acc_[d].AddValue(accl[d]);
+  }
+}
+
+void StreamingAllanVarianceFitter::AddGyroscope(const Eigen::Vector3d& gyro) {
+  // rad/s to deg/h, like AllanGyr::pushRadPerSec
+  for (int d = 0; d < 3; ++d) {
+    gyr_[d].AddValue(gyro[d] * 57.3 * 3600);
+  }
+}
+
+bool StreamingAllanVarianceFitter::RunFit() {
+  utils::ScopedStageTimer stage_timer("StreamingAllanVarianceFitter::RunFit");
+  stage_timer.AddItems(num_timestamps_);
+  if (num_timestamps_ < 2 || gyr_[0].NumValues() != num_timestamps_ ||
+      acc_[0].NumValues() != num_timestamps_) {
+    LOG(ERROR) << "Telemetry needs at least two samples and the same amount "
+                  "of timestamps, accelerometer and gyroscope values.";
+    return false;
+  }
+  const double period = (last_timestamp_ns_ - first_timestamp_ns_) * NS_TO_S /
+                        static_cast<double>(num_timestamps_ - 1);
+  const double freq = 1.0 / period;
+  std::cout << "numData " << num_timestamps_ << " freq " << freq
+            << " period " << period << std::endl;
+
+  std::vector<allanvar::AllanAxisData> axes_data(6);
+  for (int d = 0; d < 3; ++d) {
+    allanvar::AllanAxisData& gyr_data = axes_data[d];
+    gyr_data.name = std::string("gyr_") + kAxisNames[d];
+    gyr_data.gyroscope = true;
+    gyr_data.variances = gyr_[d].GetVariance();
+    gyr_data.taus = gyr_[d].GetTimes(period);
+    gyr_data.freq = freq;
+    gyr_data.mean = gyr_[d].MeanValue();
+
+    allanvar::AllanAxisData& acc_data = axes_data[3 + d];
+    acc_data.name = std::string("acc_") + kAxisNames[d];
+    acc_data.gyroscope = false;
+    acc_data.variances = acc_[d].GetVariance();
+    acc_data.taus = acc_[d].GetTimes(period);
+    acc_data.freq = freq;
+    acc_data.mean = acc_[d].MeanValue();
+  }
+  const bool success = allanvar::FitAllanAxes(axes_data, fits_);
+  LogFits(fits_);
+  return success;
+}
+
+nlohmann::json StreamingAllanVarianceFitter::ResultToJson() const {
+  return FitsToJson(fits_);
 }
 
 }  // namespace core
@@ -0,0 +1,198 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/board_coverage.h"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! below, in between and above the tilt threshold
+const int kNumTiltBins = 3;
+
+int TiltBin(const double tilt, const double threshold) {
+  if (tilt < -threshold) {
+    return 0;
+  }
+  return tilt > threshold ? 2 : 1;
+}
+
+int NumFull(const std::vector<int>& bin_views, const int target) {
+  return std::count_if(bin_views.begin(), bin_views.end(), [&](int views) {
+    return views >= target;
+  });
+}
+
+}  // namespace
+
+BoardCoverage::BoardCoverage(const BoardCoverageOptions& options,
+                             const std::vector<cv::Point3f>& board_pts)
+    : options_(options), board_pts_(board_pts) {
+  options_.grid_cols = std::max(1, options_.grid_cols);
+  options_.grid_rows = std::max(1, options_.grid_rows);
+  std::sort(options_.scale_bin_edges.begin(), options_.scale_bin_edges.end());
+  cv::Point2f min_pt(std::numeric_limits<float>::max(),
+                     std::numeric_limits<float>::max());
+  cv::Point2f max_pt(std::numeric_limits<float>::lowest(),
+                     std::numeric_limits<float>::lowest());
+  for (const cv::Point3f& pt : board_pts_) {
+    min_pt.x = std::min(min_pt.x, pt.x);
+    min_pt.y = std::min(min_pt.y, pt.y);
+    max_pt.x = std::max(max_pt.x, pt.x);
+    max_pt.y = std::max(max_pt.y, pt.y);
+  }
+  board_center_ = 0.5f * (min_pt + max_pt);
+  board_half_size_.x = std::max(0.5f * (max_pt.x - min_pt.x), 1e-6f);
+  board_half_size_.y = std::max(0.5f * (max_pt.y - min_pt.y), 1e-6f);
+  image_cell_views_.assign(options_.grid_cols * options_.grid_rows, 0);
+  pose_bin_views_.assign(
+      kNumTiltBins * kNumTiltBins * (options_.scale_bin_edges.size() + 1), 0);
+}
+
+bool BoardCoverage::AddView(const double timestamp_s,
+                            const int image_width,
+                            const int image_height,
+                            const aligned_vector<Eigen::Vector2d>& corners,
+                            const std::vector<int>& ids) {
+  if (static_cast<int>(ids.size()) < options_.min_corners ||
+      image_width <= 0 || image_height <= 0) {
+    return false;
+  }
+  const int target = options_.target_views_per_bin;
+  bool new_coverage = false;
+  std::vector<char> cells(image_cell_views_.size(), 0);
+  for (const Eigen::Vector2d& corner : corners) {
+    const int col = std::min(
+        std::max(static_cast<int>(corner[0] / image_width * options_.grid_cols),
+                 0),
+        options_.grid_cols - 1);
+    const int row = std::min(
+        std::max(
+            static_cast<int>(corner[1] / image_height * options_.grid_rows),
+            0),
+        options_.grid_rows - 1);
+    cells[row * options_.grid_cols + col] = 1;
+  }
+  for (size_t c = 0; c < cells.size(); ++c) {
+    if (cells[c]) {
+      new_coverage |= image_cell_views_[c] < target;
+      ++image_cell_views_[c];
+    }
+  }
+  const int pose_bin = PoseBin(image_width, image_height, corners, ids);
+  if (pose_bin >= 0) {
+    new_coverage |= pose_bin_views_[pose_bin] < target;
+    ++pose_bin_views_[pose_bin];
+  }
+  ++num_views_;
+  if (new_coverage) {
+    last_new_view_s_ = timestamp_s;
+  }
+  return new_coverage;
+}
+
+int BoardCoverage::PoseBin(const int image_width,
+                           const int image_height,
+                           const aligned_vector<Eigen::Vector2d>& corners,
+                           const std::vector<int>& ids) const {
+  // board in [-1, 1]^2, image centered and scaled by half its larger side
+  const double scale = 0.5 * std::max(image_width, image_height);
+  std::vector<cv::Point2f> board, image;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (ids[i] < 0 || ids[i] >= static_cast<int>(board_pts_.size())) {
+      continue;
+    }
+    const cv::Point3f& pt = board_pts_[ids[i]];
+    board.emplace_back((pt.x - board_center_.x) / board_half_size_.x,
+                       (pt.y - board_center_.y) / board_half_size_.y);
+    image.emplace_back((corners[i][0] - 0.5 * image_width) / scale,
+                       (corners[i][1] - 0.5 * image_height) / scale);
+  }
+  if (board.size() < 4) {
+    return -1;
+  }
+  const cv::Mat H = cv::findHomography(board, image);
+  if (H.empty() || std::abs(H.at<double>(2, 2)) < 1e-12) {
+    return -1;
+  }
+  // the depth of a board point relative to the center is 1 + h31 x + h32 y
+  const double h33 = H.at<double>(2, 2);
+  const int tilt_x =
+      TiltBin(H.at<double>(2, 0) / h33, options_.tilt_threshold);
+  const int tilt_y =
+      TiltBin(H.at<double>(2, 1) / h33, options_.tilt_threshold);
+
+  // image fraction of the projected board outline
+  const std::vector<cv::Point2f> outline{{-1.f, -1.f}, {1.f, -1.f},
+                                         {1.f, 1.f}, {-1.f, 1.f}};
+  std::vector<cv::Point2f> projected;
+  cv::perspectiveTransform(outline, projected, H);
+  const double image_area = (image_width / scale) * (image_height / scale);
+  const double board_scale =
+      std::sqrt(cv::contourArea(projected) / image_area);
+  const int scale_bin = std::upper_bound(options_.scale_bin_edges.begin(),
+                                         options_.scale_bin_edges.end(),
+                                         board_scale) -
+                        options_.scale_bin_edges.begin();
+  return (scale_bin * kNumTiltBins + tilt_y) * kNumTiltBins + tilt_x;
+}
+
+bool BoardCoverage::AllBinsFull() const {
+  const int target = options_.target_views_per_bin;
+  return NumFull(image_cell_views_, target) ==
+             static_cast<int>(image_cell_views_.size()) &&
+         NumFull(pose_bin_views_, target) ==
+             static_cast<int>(pose_bin_views_.size());
+}
+
+bool BoardCoverage::Complete(const double timestamp_s) {
+  if (num_views_ == 0) {
+    return false;
+  }
+  if (AllBinsFull()) {
+    stop_reason_ = "all bins full";
+    return true;
+  }
+  if (options_.max_stale_s > 0.0 &&
+      timestamp_s - last_new_view_s_ >= options_.max_stale_s) {
+    stop_reason_ = "no new coverage";
+    return true;
+  }
+  return false;
+}
+
+void BoardCoverage::ToJson(nlohmann::json& coverage_json) const {
+  const int target = options_.target_views_per_bin;
+  coverage_json["num_views"] = num_views_;
+  coverage_json["target_views_per_bin"] = target;
+  coverage_json["image_cell_views"] = image_cell_views_;
+  coverage_json["pose_bin_views"] = pose_bin_views_;
+  coverage_json["num_full_image_cells"] = NumFull(image_cell_views_, target);
+  coverage_json["num_full_pose_bins"] = NumFull(pose_bin_views_, target);
+  coverage_json["stop_reason"] = stop_reason_;
+}
+
+}  // namespace core
+}  // namespace OpenICC
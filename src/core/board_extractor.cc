@@ -17,6 +17,7 @@
 
 #include <opencv2/aruco.hpp>
 #include <opencv2/calib3d.hpp>
+#include <opencv2/core/ocl.hpp>
 #include <opencv2/opencv.hpp>
 
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
@@ -26,10 +27,24 @@
 #include <third_party/apriltag/ethz_apriltag2/include/apriltags/TagDetection.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <ios>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <thread>
 #include <vector>
 
+#include "OpenCameraCalibrator/io/remote_file.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/metrics.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/ring_queue.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 using namespace cv;
@@ -37,6 +52,224 @@ using namespace cv;
 namespace OpenICC {
 namespace core {
 
+namespace {
+// image names are the timestamp in nanoseconds, e.g. 1000000000000.png
+int64_t ImagePathToTimestampNs(const std::string& image_path) {
+  std::size_t slash = image_path.find_last_of("/\\");
+  std::size_t ending = image_path.find_last_of(".");
+  return std::stoul(image_path.substr(slash + 1, ending));
+}
+
+// bounding box of the corners, expanded by margin times its larger side
+void UpdateTrackingState(const cv::Size& image_size,
+                         const aligned_vector<Eigen::Vector2d>& corners,
+                         const double margin,
+                         BoardTrackingState& tracking_state) {
+  if (corners.empty()) {
+    tracking_state.valid = false;
+    return;
+  }
+  Eigen::Vector2d min_pt = corners[0], max_pt = corners[0];
+  for (const auto& c : corners) {
+    min_pt = min_pt.cwiseMin(c);
+    max_pt = max_pt.cwiseMax(c);
+  }
+  const double border = margin * (max_pt - min_pt).maxCoeff();
+  const cv::Rect roi(cv::Point(cvFloor(min_pt[0] - border),
+                               cvFloor(min_pt[1] - border)),
+                     cv::Point(cvCeil(max_pt[0] + border),
+                               cvCeil(max_pt[1] + border)));
+  tracking_state.roi = roi & cv::Rect(cv::Point(0, 0), image_size);
+  tracking_state.num_corners = corners.size();
+  tracking_state.valid = !tracking_state.roi.empty();
+}
+
+// mean distance of the corners, from the area of their convex hull
+double CornerSpacing(const aligned_vector<Eigen::Vector2d>& corners) {
+  if (corners.size() < 4) {
+    return 0.0;
+  }
+  std::vector<cv::Point2f> points, hull;
+  for (const auto& c : corners) {
+    points.push_back(cv::Point2f(c[0], c[1]));
+  }
+  cv::convexHull(points, hull);
+  return std::sqrt(cv::contourArea(hull) / corners.size());
+}
+
+// moves the search region to the image resolution of downsample_factor
+void ScaleTrackingRoi(const cv::Size& image_size,
+                      const double downsample_factor,
+                      BoardTrackingState& tracking_state) {
+  if (!tracking_state.valid ||
+      tracking_state.downsample_factor == downsample_factor) {
+    tracking_state.downsample_factor = downsample_factor;
+    return;
+  }
+  const double scale = tracking_state.downsample_factor / downsample_factor;
+  const cv::Rect& roi = tracking_state.roi;
+  const cv::Rect scaled_roi(cv::Point(cvFloor(roi.x * scale),
+                                      cvFloor(roi.y * scale)),
+                            cv::Point(cvCeil(roi.br().x * scale),
+                                      cvCeil(roi.br().y * scale)));
+  tracking_state.roi = scaled_roi & cv::Rect(cv::Point(0, 0), image_size);
+  tracking_state.valid = !tracking_state.roi.empty();
+  tracking_state.downsample_factor = downsample_factor;
+}
+
+// imread flag that decodes an image in gray at 1 / downsample_factor of its
+// resolution, cv::IMREAD_COLOR if there is none for the factor
+int ReducedGrayscaleReadFlag(const double downsample_factor) {
+  if (downsample_factor == 2.0) {
+    return cv::IMREAD_REDUCED_GRAYSCALE_2;
+  } else if (downsample_factor == 4.0) {
+    return cv::IMREAD_REDUCED_GRAYSCALE_4;
+  } else if (downsample_factor == 8.0) {
+    return cv::IMREAD_REDUCED_GRAYSCALE_8;
+  }
+  return cv::IMREAD_COLOR;
+}
+
+// decoders can deliver gray images directly
+template <typename MatT>
+void ToGray(const MatT& image, MatT& gray) {
+  if (image.channels() == 1) {
+    gray = image;
+  } else {
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+  }
+}
+
+// the same for cv::Mat and cv::UMat. The outputs are reused if they have
+// the right size.
+template <typename MatT>
+void ResizeToGray(const MatT& image,
+                  const double fxfy,
+                  const int interpolation,
+                  MatT& resized,
+                  MatT& detection_image,
+                  MatT* image_full_res) {
+  if (image_full_res) {
+    ToGray(image, *image_full_res);
+    cv::resize(*image_full_res,
+               detection_image,
+               cv::Size(),
+               fxfy,
+               fxfy,
+               interpolation);
+  } else {
+    cv::resize(image, resized, cv::Size(), fxfy, fxfy, interpolation);
+    ToGray(resized, detection_image);
+  }
+}
+
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 11)
+#define OPENICC_WITH_STREAM_READER
+// FFmpeg reads the container through this, the bytes come from the read
+// ahead window of the remote file and never touch the disk
+class RemoteStreamReader : public cv::IStreamReader {
+ public:
+  bool Open(const std::string& url) { return file_.Open(url); }
+
+  long long read(char* buffer, long long size) override {
+    const int64_t n = file_.Read(position_, buffer, size);
+    if (n > 0) {
+      position_ += n;
+    }
+    return n;
+  }
+
+  long long seek(long long offset, int origin) override {
+    long long position = offset;
+    if (origin == SEEK_CUR) {
+      position += position_;
+    } else if (origin == SEEK_END) {
+      position += file_.Size();
+    }
+    if (position < 0) {
+      return -1;
+    }
+    position_ = position;
+    return position_;
+  }
+
+ private:
+  io::RemoteFile file_;
+  uint64_t position_ = 0;
+};
+#endif
+
+#if CV_VERSION_MAJOR > 4 ||                             \
+    (CV_VERSION_MAJOR == 4 &&                           \
+     (CV_VERSION_MINOR > 5 ||                           \
+      (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+// http(s) URLs are streamed with ranged requests if the library was built
+// with libcurl and OpenCV >= 4.11, otherwise FFmpeg opens the URL itself
+bool OpenRemoteVideo(const std::string& url,
+                     const std::vector<int>& params,
+                     cv::VideoCapture& video) {
+#ifdef OPENICC_WITH_STREAM_READER
+  if (io::RemoteFetchAvailable()) {
+    cv::Ptr<RemoteStreamReader> stream = cv::makePtr<RemoteStreamReader>();
+    if (!stream->Open(url)) {
+      return false;
+    }
+    return video.open(stream, cv::CAP_FFMPEG, params);
+  }
+#endif
+  return video.open(url, cv::CAP_FFMPEG, params);
+}
+#endif
+
+// hardware decoding through the FFmpeg backend, needs OpenCV >= 4.5.2
+bool OpenVideo(const std::string& video_path,
+               const bool hardware_decoding,
+               cv::VideoCapture& video) {
+  const bool remote = io::IsRemoteUrl(video_path);
+#if CV_VERSION_MAJOR > 4 ||                             \
+    (CV_VERSION_MAJOR == 4 &&                           \
+     (CV_VERSION_MINOR > 5 ||                           \
+      (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+  if (hardware_decoding) {
+    const std::vector<int> params = {cv::CAP_PROP_HW_ACCELERATION,
+                                     cv::VIDEO_ACCELERATION_ANY};
+    const bool opened = remote ? OpenRemoteVideo(video_path, params, video)
+                               : video.open(video_path, cv::CAP_FFMPEG, params);
+    if (opened) {
+      const int acceleration =
+          static_cast<int>(video.get(cv::CAP_PROP_HW_ACCELERATION));
+      if (acceleration == cv::VIDEO_ACCELERATION_NONE) {
+        LOG(WARNING) << "No hardware decoder available for " << video_path
+                     << ". Decoding in software.";
+      } else {
+        LOG(INFO) << "Decoding " << video_path
+                  << " with hardware acceleration " << acceleration << ".";
+      }
+      return true;
+    }
+    LOG(WARNING) << "Could not open " << video_path
+                 << " with the FFmpeg backend. Using the default backend.";
+  }
+  if (remote) {
+    return OpenRemoteVideo(video_path, {}, video);
+  }
+#else
+  LOG_IF(WARNING, hardware_decoding)
+      << "Hardware decoding needs OpenCV >= 4.5.2. Decoding in software.";
+  if (remote) {
+    return video.open(video_path, cv::CAP_FFMPEG);
+  }
+#endif
+  return video.open(video_path);
+}
+
+// center of the i-th of num_samples equal parts of a video
+int SampleFrameIndex(const int i, const int num_samples, const int num_frames) {
+  return (2 * i + 1) * static_cast<int64_t>(num_frames) / (2 * num_samples);
+}
+
+}  // namespace
+
 BoardExtractor::BoardExtractor() {}
 
 bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
@@ -67,9 +300,26 @@ bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
   square_length_m_ = square_length;
 
   board_initialized_ = true;
+  context_ = CreateExtractionContext();
   return true;
 }
 
+cv::Ptr<cv::aruco::DetectorParameters> BoardExtractor::GetDetectorParameters()
+    const {
+  if (!detector_params_) {
+    return nullptr;
+  }
+  return cv::makePtr<cv::aruco::DetectorParameters>(*detector_params_);
+}
+
+void BoardExtractor::SetDetectorParameters(
+    const cv::aruco::DetectorParameters& params) {
+  detector_params_ = cv::makePtr<cv::aruco::DetectorParameters>(params);
+  if (board_initialized_) {
+    context_ = CreateExtractionContext();
+  }
+}
+
 bool BoardExtractor::InitializeRadonBoard(float square_length,
                                           int squaresX,
                                           int squaresY) {
@@ -90,13 +340,16 @@ bool BoardExtractor::InitializeRadonBoard(float square_length,
   square_length_m_ = square_length;
   board_type_ = BoardType::RADON;
   board_initialized_ = true;
+  context_ = CreateExtractionContext();
   return true;
 }
 
-bool BoardExtractor::InitializeAprilBoard(double marker_length,
-                                          double tag_spacing,
-                                          int squaresX,
-                                          int squaresY) {
+bool BoardExtractor::InitializeAprilBoard(
+    double marker_length,
+    double tag_spacing,
+    int squaresX,
+    int squaresY,
+    const ApriltagDetectorOptions& options) {
   double x_corner_offsets[4] = {0, marker_length, marker_length, 0};
   double y_corner_offsets[4] = {0, 0, marker_length, marker_length};
 
@@ -119,25 +372,61 @@ bool BoardExtractor::InitializeAprilBoard(double marker_length,
   }
   board_pts3d_.push_back(board_pts);
   square_length_m_ = marker_length;
+  april_options_ = options;
   board_type_ = BoardType::APRILTAG;
   board_initialized_ = true;
+  context_ = CreateExtractionContext();
   return true;
 }
 
+std::unique_ptr<ExtractionContext> BoardExtractor::CreateExtractionContext()
+    const {
+  std::unique_ptr<ExtractionContext> context(new ExtractionContext());
+  if (detector_params_) {
+    context->detector_params =
+        cv::makePtr<cv::aruco::DetectorParameters>(*detector_params_);
+  }
+  context->april_detector.reset(new ApriltagDetector(april_options_));
+  return context;
+}
+
+bool BoardExtractor::ExtractBoard(const Mat& image,
+                                  aligned_vector<Eigen::Vector2d>& corners,
+                                  std::vector<int>& object_pt_ids) {
+  if (!context_) {
+    LOG(ERROR) << "No board initialized.\n";
+    return false;
+  }
+  return ExtractBoard(image, *context_, corners, object_pt_ids);
+}
+
 bool BoardExtractor::ExtractBoard(const Mat& image,
+                                  ExtractionContext& context,
                                   aligned_vector<Eigen::Vector2d>& corners,
                                   std::vector<int>& object_pt_ids) {
+  corners.clear();
+  object_pt_ids.clear();
   if (board_type_ == BoardType::CHARUCO) {
-    std::vector<int> marker_ids, charuco_ids;
-    std::vector<std::vector<Point2f>> marker_corners, rejected_markers;
-    std::vector<Point2f> charuco_corners;
+    std::vector<int>& marker_ids = context.marker_ids;
+    std::vector<int>& charuco_ids = context.charuco_ids;
+    std::vector<std::vector<Point2f>>& marker_corners = context.marker_corners;
+    std::vector<std::vector<Point2f>>& rejected_markers =
+        context.rejected_markers;
+    std::vector<Point2f>& charuco_corners = context.charuco_corners;
+    const cv::Ptr<cv::aruco::DetectorParameters>& detector_params =
+        context.detector_params;
+    charuco_ids.clear();
+    charuco_corners.clear();
 
     aruco::detectMarkers(image,
                          dictionary_,
                          marker_corners,
                          marker_ids,
-                         detector_params_,
+                         detector_params,
                          rejected_markers);
+    if (OverBudget(context)) {
+      return false;
+    }
 
     // refind strategy to detect more markers
     aruco::refineDetectedMarkers(image,
@@ -166,8 +455,8 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
         cv::cornerSubPix(
             image,
             charuco_corners,
-            cv::Size(detector_params_->cornerRefinementWinSize,
-                     detector_params_->cornerRefinementWinSize),
+            cv::Size(detector_params->cornerRefinementWinSize,
+                     detector_params->cornerRefinementWinSize),
             cv::Size(-1, -1),
             cv::TermCriteria(
                 cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 20, 0.01));
@@ -200,10 +489,9 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
     }
 
   } else if (board_type_ == BoardType::RADON) {
-    std::vector<Point2d> radon_corners;
-    cv::Mat meta;
-    bool success = cv::findChessboardCornersSB(
-        image, radon_pattern_size_, radon_corners, radon_flags_, meta);
+    const std::vector<Point2d>& radon_corners = context.radon_corners;
+    const cv::Mat& meta = context.radon_meta;
+    bool success = DetectRadonBoard(image, context);
     if (!success) {
       return false;
     }
@@ -220,18 +508,15 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
       corners.push_back(Eigen::Vector2d(c.x, c.y));
     }
   } else if (board_type_ == BoardType::APRILTAG) {
-    std::vector<int> marker_ids, rejected_ids;
-    std::vector<double> radii, rejected_radii;
-    std::vector<Point2f> marker_corners, rejected_markers;
-    april_detector_.detectTags(image,
-                               marker_corners,
-                               marker_ids,
-                               radii,
-                               rejected_markers,
-                               rejected_ids,
-                               rejected_radii);
-    object_pt_ids = marker_ids;
-    for (const auto& c : marker_corners) {
+    context.april_detector->detectTags(image,
+                                       context.tag_corners,
+                                       context.tag_ids,
+                                       context.tag_radii,
+                                       context.rejected_tag_corners,
+                                       context.rejected_tag_ids,
+                                       context.rejected_tag_radii);
+    object_pt_ids = context.tag_ids;
+    for (const auto& c : context.tag_corners) {
       corners.push_back(Eigen::Vector2d(c.x, c.y));
     }
   } else {
@@ -242,6 +527,44 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
   return true;
 }
 
+bool BoardExtractor::TrackBoard(const cv::Mat& image,
+                                ExtractionContext& context,
+                                aligned_vector<Eigen::Vector2d>& corners,
+                                std::vector<int>& object_pt_ids,
+                                BoardTrackingState& tracking_state) {
+  if (tracking_state.valid) {
+    image(tracking_state.roi).copyTo(context.roi_image);
+    aligned_vector<Eigen::Vector2d>& roi_corners = context.roi_corners;
+    std::vector<int>& roi_ids = context.roi_ids;
+    if (ExtractBoard(context.roi_image, context, roi_corners, roi_ids) &&
+        !roi_ids.empty() &&
+        roi_ids.size() >=
+            track_min_corner_ratio_ * tracking_state.num_corners) {
+      const Eigen::Vector2d offset(tracking_state.roi.x, tracking_state.roi.y);
+      corners.clear();
+      for (const auto& c : roi_corners) {
+        corners.push_back(c + offset);
+      }
+      object_pt_ids = roi_ids;
+      UpdateTrackingState(image.size(), corners, track_margin_, tracking_state);
+      return true;
+    }
+  }
+
+  // lost the board, search the full image
+  if (OverBudget(context)) {
+    tracking_state.valid = false;
+    return false;
+  }
+  const bool found = ExtractBoard(image, context, corners, object_pt_ids);
+  if (found && !object_pt_ids.empty()) {
+    UpdateTrackingState(image.size(), corners, track_margin_, tracking_state);
+  } else {
+    tracking_state.valid = false;
+  }
+  return found;
+}
+
 void BoardExtractor::BoardToJson(nlohmann::json& output_json) {
   std::vector<cv::Point3f> board_pts = GetBoardPts()[0];
   if (board_type_ == BoardType::CHARUCO) {
@@ -265,10 +588,696 @@ void BoardExtractor::BoardToJson(nlohmann::json& output_json) {
   }
 }
 
+void BoardExtractor::ViewToJson(const aligned_vector<Eigen::Vector2d>& corners,
+                                const std::vector<int>& ids,
+                                nlohmann::json& view_json) {
+  for (size_t c = 0; c < ids.size(); ++c) {
+    view_json["image_points"][std::to_string(ids[c])] = {corners[c][0],
+                                                         corners[c][1]};
+  }
+}
+
+void BoardExtractor::PlotCorners(cv::Mat& image,
+                                 const aligned_vector<Eigen::Vector2d>& corners,
+                                 const std::vector<int>& ids) {
+  for (size_t i = 0; i < corners.size(); ++i) {
+    cv::drawMarker(image,
+                   cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
+                   cv::Scalar(0, 0, 255),
+                   cv::MARKER_CROSS,
+                   10,
+                   3);
+
+    cv::putText(image,
+                std::to_string(ids[i]),
+                cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
+                cv::FONT_HERSHEY_PLAIN,
+                1,
+                cv::Scalar(0, 0, 255));
+  }
+  cv::putText(image,
+              "Number corners: " + std::to_string(corners.size()),
+              cv::Point(10, 20),
+              cv::FONT_HERSHEY_COMPLEX_SMALL,
+              2,
+              cv::Scalar(0, 0, 255));
+  cv::imshow("corners", image);
+  cv::waitKey(1);
+}
+
+bool BoardExtractor::DetectRadonBoard(const cv::Mat& image,
+                                      ExtractionContext& context) {
+  std::vector<cv::Point2d>& corners = context.radon_corners;
+  cv::Mat& meta = context.radon_meta;
+  if (radon_fast_path_) {
+    ++num_radon_fast_;
+    const double factor = radon_fast_downsample_factor_;
+    cv::Mat image_small = image;
+    if (factor > 1.0) {
+      cv::resize(image,
+                 context.radon_image,
+                 cv::Size(),
+                 1. / factor,
+                 1. / factor,
+                 INTER_AREA);
+      image_small = context.radon_image;
+    }
+    const int fast_flags = radon_flags_ & ~cv::CALIB_CB_EXHAUSTIVE;
+    if (cv::findChessboardCornersSB(
+            image_small, radon_pattern_size_, corners, fast_flags, meta) &&
+        corners.size() >=
+            radon_fast_min_corner_ratio_ * radon_pattern_size_.area()) {
+      if (factor > 1.0) {
+        // pixel centers as in cv::resize
+        std::vector<cv::Point2f>& corners_refined =
+            context.radon_refined_corners;
+        corners_refined.clear();
+        for (const auto& c : corners) {
+          corners_refined.push_back(cv::Point2f((c.x + 0.5) * factor - 0.5,
+                                                (c.y + 0.5) * factor - 0.5));
+        }
+        const int half_win =
+            std::max(3, cvRound(refine_half_window_ * factor));
+        cv::cornerSubPix(
+            image,
+            corners_refined,
+            cv::Size(half_win, half_win),
+            cv::Size(-1, -1),
+            cv::TermCriteria(
+                cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 30, 0.01));
+        for (size_t i = 0; i < corners.size(); ++i) {
+          corners[i] = cv::Point2d(corners_refined[i].x, corners_refined[i].y);
+        }
+      }
+      return true;
+    }
+    ++num_radon_escalated_;
+    corners.clear();
+    meta.release();
+    if (OverBudget(context)) {
+      return false;
+    }
+  }
+  return cv::findChessboardCornersSB(
+      image, radon_pattern_size_, corners, radon_flags_, meta);
+}
+
+void BoardExtractor::RefineCornersFullResolution(
+    const cv::Mat& image_full_res,
+    const double downsample_factor,
+    aligned_vector<Eigen::Vector2d>& corners) const {
+  if (corners.empty()) {
+    return;
+  }
+  // pixel centers as in cv::resize
+  std::vector<cv::Point2f> corners_full_res;
+  corners_full_res.reserve(corners.size());
+  for (const auto& c : corners) {
+    corners_full_res.push_back(
+        cv::Point2f((c[0] + 0.5) * downsample_factor - 0.5,
+                    (c[1] + 0.5) * downsample_factor - 0.5));
+  }
+  // the window has to cover the uncertainty of the low resolution corner
+  const int half_win =
+      std::max(3, cvRound(refine_half_window_ * downsample_factor));
+  cv::cornerSubPix(
+      image_full_res,
+      corners_full_res,
+      cv::Size(half_win, half_win),
+      cv::Size(-1, -1),
+      cv::TermCriteria(
+          cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 30, 0.01));
+  for (size_t i = 0; i < corners.size(); ++i) {
+    corners[i] = Eigen::Vector2d(corners_full_res[i].x, corners_full_res[i].y);
+  }
+}
+
+void BoardExtractor::FilterFrame(ExtractionFrame& frame,
+                                 cv::Mat& last_thumbnail) const {
+  if ((min_blur_score_ <= 0.0 && min_frame_difference_ <= 0.0) ||
+      frame.image.empty()) {
+    return;
+  }
+  const double scale = std::min(
+      1.0, static_cast<double>(filter_thumbnail_width_) / frame.image.cols);
+  cv::Mat thumbnail;
+  cv::resize(
+      frame.image, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
+  ToGray(thumbnail, thumbnail);
+
+  if (min_blur_score_ > 0.0) {
+    cv::Mat laplacian;
+    cv::Laplacian(thumbnail, laplacian, CV_64F);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(laplacian, mean, stddev);
+    if (stddev[0] * stddev[0] < min_blur_score_) {
+      frame.rejection = BLURRY;
+      frame.image.release();
+      return;
+    }
+  }
+
+  if (min_frame_difference_ > 0.0) {
+    if (!last_thumbnail.empty() && last_thumbnail.size() == thumbnail.size()) {
+      cv::Mat diff;
+      cv::absdiff(thumbnail, last_thumbnail, diff);
+      if (cv::mean(diff)[0] < min_frame_difference_) {
+        frame.rejection = REDUNDANT;
+        frame.image.release();
+        return;
+      }
+    }
+    last_thumbnail = thumbnail;
+  }
+}
+
+void BoardExtractor::FrameFilterStatsToJson(nlohmann::json& output_json) const {
+  if (!detection_times_s_.empty()) {
+    std::vector<double> times_s = detection_times_s_;
+    std::sort(times_s.begin(), times_s.end());
+    auto percentile = [&times_s](const double p) {
+      return times_s[std::min(times_s.size() - 1,
+                              static_cast<size_t>(p * times_s.size()))];
+    };
+    nlohmann::json& time_json = output_json["detection_time"];
+    time_json["num_frames"] = times_s.size();
+    time_json["p50_s"] = percentile(0.5);
+    time_json["p90_s"] = percentile(0.9);
+    time_json["p99_s"] = percentile(0.99);
+    time_json["max_s"] = times_s.back();
+    time_json["num_timed_out"] = frame_filter_stats_.num_timed_out;
+    LOG(INFO) << "Board detection took " << percentile(0.5) << "s (median), "
+              << percentile(0.99) << "s (p99), " << times_s.back()
+              << "s (max). " << frame_filter_stats_.num_timed_out
+              << " frames exceeded the time budget.";
+  }
+  if (coverage_) {
+    coverage_->ToJson(output_json["coverage"]);
+  }
+  if (num_radon_fast_ > 0) {
+    output_json["radon_fast_path"]["num_detections"] =
+        num_radon_fast_.load();
+    output_json["radon_fast_path"]["num_escalated"] =
+        num_radon_escalated_.load();
+    LOG(INFO) << "The Radon fast path needed the exhaustive search for "
+              << 100.0 * RadonEscalationRate() << "% of the detections.";
+  }
+  if (min_blur_score_ <= 0.0 && min_frame_difference_ <= 0.0 &&
+      frame_filter_stats_.num_skipped == 0) {
+    return;
+  }
+  output_json["frame_filter"]["num_accepted"] =
+      frame_filter_stats_.num_accepted;
+  output_json["frame_filter"]["num_blurry"] = frame_filter_stats_.num_blurry;
+  output_json["frame_filter"]["num_redundant"] =
+      frame_filter_stats_.num_redundant;
+  output_json["frame_filter"]["num_skipped"] = frame_filter_stats_.num_skipped;
+  output_json["frame_filter"]["num_timed_out"] =
+      frame_filter_stats_.num_timed_out;
+  LOG(INFO) << "Frame filter accepted " << frame_filter_stats_.num_accepted
+            << " frames, rejected " << frame_filter_stats_.num_blurry
+            << " blurry and " << frame_filter_stats_.num_redundant
+            << " redundant frames, skipped "
+            << frame_filter_stats_.num_skipped << " frames.";
+}
+
+void BoardExtractor::SetUseOpenCL(const bool use_opencl) {
+  use_opencl_ = use_opencl && cv::ocl::haveOpenCL();
+  if (use_opencl && !use_opencl_) {
+    LOG(WARNING) << "OpenCV has no OpenCL device, preprocessing on the cpu.";
+  }
+  if (use_opencl_) {
+    cv::ocl::setUseOpenCL(true);
+    LOG(INFO) << "Preprocessing frames on "
+              << cv::ocl::Device::getDefault().name() << ".";
+  }
+}
+
+void BoardExtractor::PrepareDetectionImage(const cv::Mat& image,
+                                           const double fxfy,
+                                           const int interpolation,
+                                           const bool full_res,
+                                           ExtractionContext& context) const {
+  if (!use_opencl_) {
+    ResizeToGray(image,
+                 fxfy,
+                 interpolation,
+                 context.resized_image,
+                 context.detection_image,
+                 full_res ? &context.full_res_image : nullptr);
+    return;
+  }
+  // the board detectors work on cv::Mat, so only their input is downloaded
+  cv::UMat image_device, resized_device, detection_image_device,
+      image_full_res_device;
+  image.copyTo(image_device);
+  ResizeToGray(image_device,
+               fxfy,
+               interpolation,
+               resized_device,
+               detection_image_device,
+               full_res ? &image_full_res_device : nullptr);
+  detection_image_device.copyTo(context.detection_image);
+  if (full_res) {
+    image_full_res_device.copyTo(context.full_res_image);
+  }
+}
+
+double BoardExtractor::AdaptiveDownsampleFactor(
+    const double max_downsample_factor,
+    const BoardTrackingState& tracking_state) const {
+  if (tracking_state.corner_spacing_px <= 0.0) {
+    return 1.0;
+  }
+  return std::max(1.0,
+                  std::min(max_downsample_factor,
+                           tracking_state.corner_spacing_px /
+                               adaptive_min_corner_spacing_px_));
+}
+
+bool BoardExtractor::OverBudget(const ExtractionContext& context) const {
+  return context.has_deadline &&
+         std::chrono::steady_clock::now() > context.deadline;
+}
+
+void BoardExtractor::DetectFrame(const double img_downsample_factor,
+                                 ExtractionContext& context,
+                                 BoardTrackingState& tracking_state,
+                                 ExtractionFrame& frame) {
+  if (frame.rejection != NOT_REJECTED) {
+    return;
+  }
+  const auto start_time = std::chrono::steady_clock::now();
+  context.has_deadline = detection_budget_s_ > 0.0;
+  context.deadline =
+      start_time +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(detection_budget_s_));
+  // the scale of the board is only known within a track block
+  const bool adaptive =
+      adaptive_min_corner_spacing_px_ > 0.0 && track_block_size_ > 0;
+  const double downsample_factor =
+      adaptive ? AdaptiveDownsampleFactor(img_downsample_factor, tracking_state)
+               : img_downsample_factor;
+  const double fxfy = 1. / downsample_factor;
+  const bool refine_full_res =
+      refine_full_resolution_ && downsample_factor != 1.0;
+  PrepareDetectionImage(frame.image,
+                        fxfy,
+                        refine_full_res || adaptive ? cv::INTER_AREA
+                                                    : cv::INTER_LINEAR,
+                        refine_full_res,
+                        context);
+  const cv::Mat& detection_image = context.detection_image;
+  if (track_block_size_ > 0) {
+    ScaleTrackingRoi(
+        detection_image.size(), downsample_factor, tracking_state);
+    TrackBoard(detection_image,
+               context,
+               frame.corners,
+               frame.ids,
+               tracking_state);
+  } else {
+    ExtractBoard(detection_image, context, frame.corners, frame.ids);
+  }
+  if (refine_full_res) {
+    RefineCornersFullResolution(
+        context.full_res_image, downsample_factor, frame.corners);
+  } else if (adaptive) {
+    // pixel centers as in cv::resize
+    for (auto& c : frame.corners) {
+      c = (c + Eigen::Vector2d(0.5, 0.5)) * downsample_factor -
+          Eigen::Vector2d(0.5, 0.5);
+    }
+  }
+  frame.detection_time_s = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start_time)
+                               .count();
+  if (context.has_deadline && frame.detection_time_s > detection_budget_s_) {
+    frame.rejection = TIMED_OUT;
+    frame.corners.clear();
+    frame.ids.clear();
+    tracking_state.valid = false;
+  }
+  context.has_deadline = false;
+  if (adaptive) {
+    tracking_state.corner_spacing_px = CornerSpacing(frame.corners);
+  }
+  // corners in full resolution pixels belong to the full image
+  const bool full_res_corners = refine_full_res || adaptive;
+  const cv::Size image_size =
+      full_res_corners ? frame.image.size() : detection_image.size();
+  frame.image_width = image_size.width;
+  frame.image_height = image_size.height;
+
+  // the buffers of the context are reused by the next frame, the plotted
+  // image has to be copied
+  if (!verbose_plot_) {
+    frame.image.release();
+  } else if (refine_full_res) {
+    frame.image = context.full_res_image.clone();
+  } else if (adaptive) {
+    cv::Mat gray;
+    ToGray(frame.image, gray);
+    frame.image = gray.clone();
+  } else {
+    frame.image = detection_image.clone();
+  }
+}
+
+bool BoardExtractor::DetectImage(const cv::Mat& image,
+                                 const double img_downsample_factor,
+                                 BoardTrackingState& tracking_state,
+                                 aligned_vector<Eigen::Vector2d>& corners,
+                                 std::vector<int>& object_pt_ids) {
+  if (!board_initialized_) {
+    LOG(ERROR) << "No board initialized.\n";
+    return false;
+  }
+  ExtractionFrame frame;
+  frame.image = image;
+  DetectFrame(img_downsample_factor, *context_, tracking_state, frame);
+  corners = std::move(frame.corners);
+  object_pt_ids = std::move(frame.ids);
+  return !object_pt_ids.empty();
+}
+
+void BoardExtractor::WriteFrame(ExtractionFrame& frame,
+                                const int total_nr_frames,
+                                nlohmann::json& output_json,
+                                io::SceneStreamWriter& scene_writer,
+                                std::vector<double>& timestamps_s) {
+  if (coverage_complete_) {
+    return;
+  }
+  timestamps_s.push_back(frame.timestamp_s);
+  utils::Metrics::Instance().AddCounter(
+      "openicc_extracted_frames_total", "", 1.0);
+  if (frame.rejection == BLURRY) {
+    ++frame_filter_stats_.num_blurry;
+  } else if (frame.rejection == REDUNDANT) {
+    ++frame_filter_stats_.num_redundant;
+  } else if (frame.rejection == SKIPPED) {
+    ++frame_filter_stats_.num_skipped;
+  } else if (frame.rejection == TIMED_OUT) {
+    ++frame_filter_stats_.num_timed_out;
+  } else {
+    ++frame_filter_stats_.num_accepted;
+  }
+  if (frame.rejection == NOT_REJECTED || frame.rejection == TIMED_OUT) {
+    detection_times_s_.push_back(frame.detection_time_s);
+    utils::Metrics::Instance().ObserveDuration(
+        "openicc_board_detection_seconds",
+        utils::Label("board", std::to_string(board_type_)),
+        frame.detection_time_s);
+  }
+  if (!frame.ids.empty()) {
+    nlohmann::json view_json;
+    ViewToJson(frame.corners, frame.ids, view_json);
+    const std::string view_key = std::to_string(frame.timestamp_s * S_TO_US);
+    scene_writer.AddView(view_key, view_json);
+    if (view_callback_) {
+      view_callback_(view_key, view_json);
+    }
+  }
+  if (coverage_) {
+    coverage_->AddView(frame.timestamp_s,
+                       frame.image_width,
+                       frame.image_height,
+                       frame.corners,
+                       frame.ids);
+    if (coverage_->Complete(frame.timestamp_s)) {
+      coverage_complete_ = true;
+      LOG(INFO) << "Board coverage complete after frame " << frame.frame_idx
+                << " (" << frame.timestamp_s << "s), stopping the extraction.";
+    }
+  }
+  if (frame.rejection == NOT_REJECTED &&
+      !output_json.contains("image_width")) {
+    output_json["image_width"] = frame.image_width;
+    output_json["image_height"] = frame.image_height;
+  }
+
+  LOG_IF(INFO, timestamps_s.size() % 60 == 0)
+      << "Extracting corners from frame " << timestamps_s.size() << " / "
+      << total_nr_frames << "\n";
+
+  if (verbose_plot_ && frame.rejection == NOT_REJECTED) {
+    cv::cvtColor(frame.image, frame.image, cv::COLOR_GRAY2BGR);
+    PlotCorners(frame.image, frame.corners, frame.ids);
+  }
+
+  // checkpoints are only written at block boundaries, such that the tracking
+  // of a resumed extraction starts like in the full run
+  if (checkpoint_interval_ > 0) {
+    const size_t block_size = std::max(1, track_block_size_);
+    const size_t interval =
+        (checkpoint_interval_ + block_size - 1) / block_size * block_size;
+    if ((frame.frame_idx + 1) % interval == 0) {
+      WriteCheckpoint(frame.frame_idx + 1,
+                      frame.timestamp_s,
+                      output_json,
+                      scene_writer,
+                      timestamps_s);
+    }
+  }
+}
+
+bool BoardExtractor::StartSceneWriter(const std::string& save_path,
+                                      nlohmann::json& output_json,
+                                      io::SceneStreamWriter& scene_writer,
+                                      std::vector<double>& timestamps_s,
+                                      size_t& first_frame_idx) {
+  checkpoint_path_ = save_path + ".checkpoint";
+  frame_filter_stats_ = FrameFilterStats();
+  num_radon_fast_ = 0;
+  num_radon_escalated_ = 0;
+  detection_times_s_.clear();
+  timestamps_s.clear();
+  first_frame_idx = start_frame_;
+  coverage_.reset();
+  coverage_complete_ = false;
+  if (coverage_options_.target_views_per_bin > 0) {
+    coverage_.reset(new BoardCoverage(coverage_options_, board_pts3d_[0]));
+  }
+
+  nlohmann::json checkpoint;
+  if (resume_ && ReadCheckpoint(checkpoint)) {
+    if (checkpoint["start_frame"] != start_frame_ ||
+        checkpoint["end_frame"] != end_frame_) {
+      LOG(ERROR) << "The checkpoint " << checkpoint_path_
+                 << " was written for another frame range.";
+      return false;
+    }
+    if (!scene_writer.Resume(save_path, checkpoint["writer"])) {
+      return false;
+    }
+    first_frame_idx = checkpoint["next_frame_idx"];
+    timestamps_s = checkpoint["frame_timestamps_s"].get<std::vector<double>>();
+    if (checkpoint.contains("image_width")) {
+      output_json["image_width"] = checkpoint["image_width"];
+      output_json["image_height"] = checkpoint["image_height"];
+    }
+    frame_filter_stats_.num_accepted = checkpoint["frame_filter"][0];
+    frame_filter_stats_.num_blurry = checkpoint["frame_filter"][1];
+    frame_filter_stats_.num_redundant = checkpoint["frame_filter"][2];
+    if (checkpoint["frame_filter"].size() > 3) {
+      frame_filter_stats_.num_skipped = checkpoint["frame_filter"][3];
+    }
+    if (checkpoint["frame_filter"].size() > 4) {
+      frame_filter_stats_.num_timed_out = checkpoint["frame_filter"][4];
+    }
+    LOG(INFO) << "Resuming the extraction at frame " << first_frame_idx
+              << " (" << checkpoint["timestamp_s"].get<double>() << "s).";
+    return true;
+  }
+  return scene_writer.Open(save_path);
+}
+
+bool BoardExtractor::FinishSceneWriter(const nlohmann::json& output_json,
+                                       io::SceneStreamWriter& scene_writer) {
+  if (!scene_writer.Close(output_json)) {
+    return false;
+  }
+  std::remove(checkpoint_path_.c_str());
+  return true;
+}
+
+bool BoardExtractor::ReadCheckpoint(nlohmann::json& checkpoint) const {
+  std::ifstream input(checkpoint_path_, std::ios::binary);
+  if (!input.is_open()) {
+    return false;
+  }
+  const std::vector<std::uint8_t> bson(
+      (std::istreambuf_iterator<char>(input)),
+      std::istreambuf_iterator<char>());
+  checkpoint = nlohmann::json::from_ubjson(bson, true, false);
+  if (checkpoint.is_discarded()) {
+    LOG(WARNING) << "Could not parse the checkpoint " << checkpoint_path_
+                 << ". Starting from the first frame.";
+    return false;
+  }
+  return true;
+}
+
+void BoardExtractor::WriteCheckpoint(const size_t next_frame_idx,
+                                     const double timestamp_s,
+                                     const nlohmann::json& output_json,
+                                     io::SceneStreamWriter& scene_writer,
+                                     const std::vector<double>& timestamps_s) {
+  nlohmann::json checkpoint;
+  checkpoint["next_frame_idx"] = next_frame_idx;
+  checkpoint["timestamp_s"] = timestamp_s;
+  checkpoint["start_frame"] = start_frame_;
+  checkpoint["end_frame"] = end_frame_;
+  checkpoint["writer"] = scene_writer.Checkpoint();
+  if (output_json.contains("image_width")) {
+    checkpoint["image_width"] = output_json["image_width"];
+    checkpoint["image_height"] = output_json["image_height"];
+  }
+  checkpoint["frame_timestamps_s"] = timestamps_s;
+  checkpoint["frame_filter"] = {frame_filter_stats_.num_accepted,
+                                frame_filter_stats_.num_blurry,
+                                frame_filter_stats_.num_redundant,
+                                frame_filter_stats_.num_skipped,
+                                frame_filter_stats_.num_timed_out};
+
+  // replace the last checkpoint only once the new one is complete
+  const std::string tmp_path = checkpoint_path_ + ".part";
+  const std::vector<std::uint8_t> bson = nlohmann::json::to_ubjson(checkpoint);
+  std::ofstream output(tmp_path, std::ios::out | std::ios::binary);
+  output.write(reinterpret_cast<const char*>(bson.data()), bson.size());
+  output.close();
+  if (output.fail() ||
+      std::rename(tmp_path.c_str(), checkpoint_path_.c_str()) != 0) {
+    LOG(WARNING) << "Could not write the checkpoint " << checkpoint_path_;
+  }
+}
+
+void BoardExtractor::RunExtractionSerial(
+    const std::function<bool(ExtractionFrame&)>& read_next_frame,
+    const size_t first_frame_idx,
+    const double img_downsample_factor,
+    const int total_nr_frames,
+    nlohmann::json& output_json,
+    io::SceneStreamWriter& scene_writer,
+    std::vector<double>& timestamps_s) {
+  ExtractionFrame frame;
+  BoardTrackingState tracking_state;
+  cv::Mat last_thumbnail;
+  size_t frame_idx = first_frame_idx;
+  while (!coverage_complete_ && read_next_frame(frame)) {
+    FilterFrame(frame, last_thumbnail);
+    // same blocks as in the pipeline
+    if (track_block_size_ > 0 && frame_idx % track_block_size_ == 0) {
+      tracking_state = BoardTrackingState();
+    }
+    frame.frame_idx = frame_idx++;
+    DetectFrame(img_downsample_factor, *context_, tracking_state, frame);
+    WriteFrame(
+        frame, total_nr_frames, output_json, scene_writer, timestamps_s);
+    frame = ExtractionFrame();
+  }
+}
+
+void BoardExtractor::RunExtractionPipeline(
+    const std::function<bool(ExtractionFrame&)>& read_next_frame,
+    const size_t first_frame_idx,
+    const double img_downsample_factor,
+    const int total_nr_frames,
+    nlohmann::json& output_json,
+    io::SceneStreamWriter& scene_writer,
+    std::vector<double>& timestamps_s) {
+  // the reader stays on one thread. For videos the timestamp is queried from
+  // the capture right after each read. With tracking, blocks of consecutive
+  // frames are detected together. Blocks start at multiples of the block
+  // size, such that a frame range or a resumed extraction gives the same
+  // blocks as a full run. The blocks are detected as tasks of the global
+  // executor, so extractions running at the same time share its threads.
+  // At most num_threads_ blocks are in flight, each owns one context.
+  std::vector<std::unique_ptr<ExtractionContext>> contexts;
+  utils::MpscQueue<ExtractionContext*> free_contexts(num_threads_);
+  for (int t = 0; t < num_threads_; ++t) {
+    contexts.push_back(CreateExtractionContext());
+    free_contexts.Push(contexts.back().get());
+  }
+  const size_t block_size = std::max(1, track_block_size_);
+  utils::MpscQueue<ExtractionFrame> detected_frames(2 * num_threads_);
+  detected_frames.SetMetricsName("extraction_detected_frames");
+  utils::TaskGroup detection_tasks;
+
+  auto detect_block = [&](std::vector<ExtractionFrame> block) {
+    // helps the executor while all contexts are busy, it might have no idle
+    // worker
+    ExtractionContext* context = nullptr;
+    while (!free_contexts.TryPop(context)) {
+      if (!utils::Executor::Global().RunPendingTask()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    auto frames =
+        std::make_shared<std::vector<ExtractionFrame>>(std::move(block));
+    detection_tasks.Run([&, context, frames]() {
+      // the tracking starts with a full image search in every block
+      BoardTrackingState tracking_state;
+      for (ExtractionFrame& frame : *frames) {
+        DetectFrame(img_downsample_factor, *context, tracking_state, frame);
+        detected_frames.Push(std::move(frame));
+      }
+      free_contexts.Push(context);
+    });
+  };
+
+  std::thread reader([&]() {
+    size_t frame_idx = first_frame_idx;
+    std::vector<ExtractionFrame> block;
+    ExtractionFrame frame;
+    // the frame filter depends on the previous frames, so it runs here
+    cv::Mat last_thumbnail;
+    while (!coverage_complete_ && read_next_frame(frame)) {
+      FilterFrame(frame, last_thumbnail);
+      frame.frame_idx = frame_idx++;
+      block.push_back(std::move(frame));
+      frame = ExtractionFrame();
+      if (frame_idx % block_size == 0) {
+        detect_block(std::move(block));
+        block = std::vector<ExtractionFrame>();
+      }
+    }
+    if (!block.empty()) {
+      detect_block(std::move(block));
+    }
+    detection_tasks.Wait();
+    detected_frames.Close();
+  });
+
+  // ordered writer. Frames are written in reading order, such that the
+  // result is identical to the serial extraction.
+  std::map<size_t, ExtractionFrame> pending_frames;
+  size_t next_frame_idx = first_frame_idx;
+  ExtractionFrame frame;
+  while (detected_frames.Pop(frame)) {
+    pending_frames[frame.frame_idx] = std::move(frame);
+    auto it = pending_frames.find(next_frame_idx);
+    while (it != pending_frames.end()) {
+      WriteFrame(it->second,
+                 total_nr_frames,
+                 output_json,
+                 scene_writer,
+                 timestamps_s);
+      pending_frames.erase(it);
+      it = pending_frames.find(++next_frame_idx);
+    }
+  }
+
+  reader.join();
+}
+
 bool BoardExtractor::ExtractImageFolderToJson(
     const std::string& image_folder,
     const std::string& save_path,
     const double img_downsample_factor) {
+  utils::ScopedStageTimer stage_timer("BoardExtractor::ExtractImageFolder");
   if (!board_initialized_) {
     LOG(ERROR) << "No board initialized.\n";
     return false;
@@ -295,75 +1304,76 @@ bool BoardExtractor::ExtractImageFolderToJson(
   output_json["square_size_meter"] = square_length_m_;
   BoardToJson(output_json);
 
+  // views are streamed to disk as soon as they are extracted
+  io::SceneStreamWriter scene_writer;
+  std::vector<double> frame_timestamps_s;
+  size_t first_frame_idx = 0;
+  if (!StartSceneWriter(save_path,
+                        output_json,
+                        scene_writer,
+                        frame_timestamps_s,
+                        first_frame_idx)) {
+    return false;
+  }
+
   const size_t total_nr_frames = filenames.size();
   std::cout << "Total number of frames: " << total_nr_frames << "\n";
-  int frame_cnt = 0;
-  bool set_img_size = false;
-  std::set<double> timestamps_s;
-  for (size_t i = 0; i < total_nr_frames; ++i) {
-    const std::string image_path = filenames[i];
-
-    // get timestamp in nanoseconds
-    std::size_t slash = image_path.find_last_of("/\\");
-    std::size_t ending = image_path.find_last_of(".");
-
-    int64_t timestamp_ns = std::stoul(image_path.substr(slash + 1, ending));
-    Mat image = cv::imread(image_path);
-    const double timestamp_s = timestamp_ns * NS_TO_S;
-    timestamps_s.insert(timestamp_s);
-    const std::string view_us = std::to_string(timestamp_s * S_TO_US);
-    ++frame_cnt;
-
-    const double fxfy = 1. / img_downsample_factor;
-    cv::resize(image, image, cv::Size(), fxfy, fxfy);
+  stage_timer.AddItems(total_nr_frames);
 
-    aligned_vector<Eigen::Vector2d> corners;
-    std::vector<int> ids;
-    cv::cvtColor(image, image, cv::COLOR_BGR2GRAY);
-    ExtractBoard(image, corners, ids);
+  const size_t end_file_idx =
+      end_frame_ < 0 ? total_nr_frames
+                     : std::min(total_nr_frames, size_t(end_frame_));
 
-    for (size_t c = 0; c < ids.size(); ++c) {
-      output_json["views"][view_us]["image_points"][std::to_string(ids[c])] = {
-          corners[c][0], corners[c][1]};
+  // the decoder downsamples, the detection then runs on the decoded image
+  const bool full_res_needed =
+      (refine_full_resolution_ && img_downsample_factor != 1.0) ||
+      adaptive_min_corner_spacing_px_ > 0.0;
+  const int read_flag = reduced_decode_ && !full_res_needed
+                            ? ReducedGrayscaleReadFlag(img_downsample_factor)
+                            : cv::IMREAD_COLOR;
+  const double detection_downsample_factor =
+      read_flag == cv::IMREAD_COLOR ? img_downsample_factor : 1.0;
+  if (read_flag != cv::IMREAD_COLOR) {
+    LOG(INFO) << "Decoding the images in gray at 1/" << img_downsample_factor
+              << " resolution.";
+  }
+
+  size_t file_idx = first_frame_idx;
+  auto read_next_frame = [&](ExtractionFrame& frame) {
+    if (file_idx >= end_file_idx) {
+      return false;
     }
-    if (!set_img_size) {
-      output_json["image_width"] = image.cols;
-      output_json["image_height"] = image.rows;
-      set_img_size = true;
+    const bool skip = file_idx % frame_stride_ != 0;
+    const std::string& image_path = filenames[file_idx++];
+    frame.timestamp_s = ImagePathToTimestampNs(image_path) * NS_TO_S;
+    if (skip) {
+      frame.rejection = SKIPPED;
+    } else {
+      frame.image = cv::imread(image_path, read_flag);
     }
+    return true;
+  };
 
-    LOG_IF(INFO, frame_cnt % 60 == 0)
-        << "Extracting corners from frame " << frame_cnt << " / "
-        << total_nr_frames << "\n";
-
-    if (verbose_plot_) {
-      cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
-      for (size_t i = 0; i < corners.size(); ++i) {
-        cv::drawMarker(
-            image,
-            cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-            cv::Scalar(0, 0, 255),
-            cv::MARKER_CROSS,
-            10,
-            3);
-
-        cv::putText(image,
-                    std::to_string(ids[i]),
-                    cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-                    cv::FONT_HERSHEY_PLAIN,
-                    1,
-                    cv::Scalar(0, 0, 255));
-      }
-      cv::putText(image,
-                  "Number corners: " + std::to_string(corners.size()),
-                  cv::Point(10, 20),
-                  cv::FONT_HERSHEY_COMPLEX_SMALL,
-                  2,
-                  cv::Scalar(0, 0, 255));
-      cv::imshow("corners", image);
-      cv::waitKey(1);
-    }
+  if (num_threads_ > 1) {
+    RunExtractionPipeline(read_next_frame,
+                          first_frame_idx,
+                          detection_downsample_factor,
+                          total_nr_frames,
+                          output_json,
+                          scene_writer,
+                          frame_timestamps_s);
+  } else {
+    RunExtractionSerial(read_next_frame,
+                        first_frame_idx,
+                        detection_downsample_factor,
+                        total_nr_frames,
+                        output_json,
+                        scene_writer,
+                        frame_timestamps_s);
   }
+
+  std::set<double> timestamps_s(frame_timestamps_s.begin(),
+                                frame_timestamps_s.end());
   std::vector<double> times, delta_ts;
   for (const auto& t : timestamps_s) {
     times.push_back(t);
@@ -373,18 +1383,15 @@ bool BoardExtractor::ExtractImageFolderToJson(
   }
 
   output_json["camera_fps"] = 1. / utils::MedianOfDoubleVec(delta_ts);
+  FrameFilterStatsToJson(output_json);
 
-  std::vector<std::uint8_t> v_bson = nlohmann::json::to_ubjson(output_json);
-  std::ofstream calib_txt_output(save_path, std::ios::out | std::ios::binary);
-  calib_txt_output.write(reinterpret_cast<const char*>(&v_bson[0]),
-                         v_bson.size() * sizeof(std::uint8_t));
-
-  return true;
+  return FinishSceneWriter(output_json, scene_writer);
 }
 
 bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
                                         const std::string& save_path,
                                         const double img_downsample_factor) {
+  utils::ScopedStageTimer stage_timer("BoardExtractor::ExtractVideo");
   if (!board_initialized_) {
     LOG(ERROR) << "No board initialized.\n";
     return false;
@@ -396,9 +1403,18 @@ bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
 
   nlohmann::json output_json;
   VideoCapture input_video;
-  input_video.open(video_path);
-  int cnt_wrong = 0;
+  if (!OpenVideo(video_path, hardware_decoding_, input_video)) {
+    LOG(ERROR) << "Could not open video " << video_path << "\n";
+    return false;
+  }
   const double fps = input_video.get(cv::CAP_PROP_FPS);
+  const size_t frame_stride =
+      target_fps_ > 0.0 && fps > 0.0
+          ? std::max(1L, std::lround(fps / target_fps_))
+          : frame_stride_;
+  if (frame_stride > 1) {
+    LOG(INFO) << "Decoding every " << frame_stride << ". frame.";
+  }
 
   output_json["camera_fps"] = fps;
   output_json["calibration_board_type"] = board_type_;
@@ -406,80 +1422,149 @@ bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
 
   BoardToJson(output_json);
 
+  // views are streamed to disk as soon as they are extracted
+  io::SceneStreamWriter scene_writer;
+  std::vector<double> timestamps_s;
+  size_t first_frame_idx = 0;
+  if (!StartSceneWriter(save_path,
+                        output_json,
+                        scene_writer,
+                        timestamps_s,
+                        first_frame_idx)) {
+    return false;
+  }
+
   const int total_nr_frames = input_video.get(cv::CAP_PROP_FRAME_COUNT);
   std::cout << "Total number of frames: " << total_nr_frames << "\n";
-  int frame_cnt = 0;
-  bool set_img_size = false;
-  while (true) {
-    Mat image;
-    if (!input_video.read(image)) {
-      cnt_wrong++;
-      if (cnt_wrong > 500) break;
-      continue;
-    }
-
-    const double timstamp_s = input_video.get(cv::CAP_PROP_POS_MSEC) * 1e-3;
-    const std::string view_us = std::to_string(timstamp_s * S_TO_US);
-    ++frame_cnt;
+  stage_timer.AddItems(total_nr_frames);
 
-    const double fxfy = 1. / img_downsample_factor;
-    cv::resize(image, image, cv::Size(), fxfy, fxfy);
-
-    aligned_vector<Eigen::Vector2d> corners;
-    std::vector<int> ids;
-    cv::cvtColor(image, image, cv::COLOR_BGR2GRAY);
-    ExtractBoard(image, corners, ids);
+  // seeking is not frame accurate for all codecs, so the frames before the
+  // range are grabbed without decoding them
+  size_t frame_idx = 0;
+  while (frame_idx < first_frame_idx && input_video.grab()) {
+    ++frame_idx;
+  }
 
-    for (size_t c = 0; c < ids.size(); ++c) {
-      output_json["views"][view_us]["image_points"][std::to_string(ids[c])] = {
-          corners[c][0], corners[c][1]};
+  int cnt_wrong = 0;
+  auto read_next_frame = [&](ExtractionFrame& frame) {
+    if (end_frame_ >= 0 && frame_idx >= size_t(end_frame_)) {
+      return false;
     }
-    if (!set_img_size) {
-      output_json["image_width"] = image.cols;
-      output_json["image_height"] = image.rows;
-      set_img_size = true;
+    // skipped frames are only grabbed, the position is updated by grab
+    const bool skip = frame_idx % frame_stride != 0;
+    while (!(skip ? input_video.grab() : input_video.read(frame.image))) {
+      cnt_wrong++;
+      if (cnt_wrong > 500) return false;
     }
-
-    LOG_IF(INFO, frame_cnt % 60 == 0)
-        << "Extracting corners from frame " << frame_cnt << " / "
-        << total_nr_frames << "\n";
-
-    if (verbose_plot_) {
-      for (size_t i = 0; i < corners.size(); ++i) {
-        cv::drawMarker(
-            image,
-            cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-            cv::Scalar(0, 0, 255),
-            cv::MARKER_CROSS,
-            10,
-            3);
-
-        cv::putText(image,
-                    std::to_string(ids[i]),
-                    cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-                    cv::FONT_HERSHEY_PLAIN,
-                    1,
-                    cv::Scalar(0, 0, 255));
-      }
-      cv::putText(image,
-                  "Number corners: " + std::to_string(corners.size()),
-                  cv::Point(10, 20),
-                  cv::FONT_HERSHEY_COMPLEX_SMALL,
-                  2,
-                  cv::Scalar(0, 0, 255));
-      cv::imshow("corners", image);
-      cv::waitKey(1);
+    ++frame_idx;
+    frame.timestamp_s = input_video.get(cv::CAP_PROP_POS_MSEC) * 1e-3;
+    if (skip) {
+      frame.rejection = SKIPPED;
     }
+    return true;
+  };
+
+  if (num_threads_ > 1) {
+    RunExtractionPipeline(read_next_frame,
+                          first_frame_idx,
+                          img_downsample_factor,
+                          total_nr_frames,
+                          output_json,
+                          scene_writer,
+                          timestamps_s);
+  } else {
+    RunExtractionSerial(read_next_frame,
+                        first_frame_idx,
+                        img_downsample_factor,
+                        total_nr_frames,
+                        output_json,
+                        scene_writer,
+                        timestamps_s);
   }
+  FrameFilterStatsToJson(output_json);
 
-  std::vector<std::uint8_t> v_bson = nlohmann::json::to_ubjson(output_json);
+  return FinishSceneWriter(output_json, scene_writer);
+}
 
-  std::ofstream calib_txt_output(save_path, std::ios::out | std::ios::binary);
-  calib_txt_output.write(reinterpret_cast<const char*>(&v_bson[0]),
-                         v_bson.size() * sizeof(std::uint8_t));
+bool BoardExtractor::SampleVideo(const std::string& video_path,
+                                 const int num_frames,
+                                 const double img_downsample_factor,
+                                 VideoSample& sample) {
+  if (!board_initialized_) {
+    LOG(ERROR) << "No board initialized.\n";
+    return false;
+  }
+  VideoCapture input_video;
+  if (!OpenVideo(video_path, hardware_decoding_, input_video)) {
+    LOG(ERROR) << "Could not open video " << video_path << "\n";
+    return false;
+  }
+  sample = VideoSample();
+  sample.fps = input_video.get(cv::CAP_PROP_FPS);
+  sample.num_frames = input_video.get(cv::CAP_PROP_FRAME_COUNT);
+  sample.image_width = input_video.get(cv::CAP_PROP_FRAME_WIDTH);
+  sample.image_height = input_video.get(cv::CAP_PROP_FRAME_HEIGHT);
 
+  const int num_samples =
+      sample.num_frames > 0 ? std::min(num_frames, sample.num_frames) : 0;
+  cv::Mat image;
+  for (int i = 0; i < num_samples; ++i) {
+    const int frame_idx = SampleFrameIndex(i, num_samples, sample.num_frames);
+    if (!input_video.set(cv::CAP_PROP_POS_FRAMES, frame_idx) ||
+        !input_video.read(image) || image.empty()) {
+      LOG(WARNING) << "Could not decode frame " << frame_idx << " of "
+                   << video_path;
+      continue;
+    }
+    const auto start_time = std::chrono::steady_clock::now();
+    BoardTrackingState tracking_state;
+    aligned_vector<Eigen::Vector2d> corners;
+    std::vector<int> ids;
+    DetectImage(image, img_downsample_factor, tracking_state, corners, ids);
+    sample.detection_time_s +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start_time)
+            .count();
+    sample.num_corners.push_back(ids.size());
+  }
   return true;
 }
 
+bool BoardExtractor::SampleVideoFrames(const std::string& video_path,
+                                       const int num_frames,
+                                       const double img_downsample_factor,
+                                       std::vector<cv::Mat>& detection_images) {
+  if (!board_initialized_) {
+    LOG(ERROR) << "No board initialized.\n";
+    return false;
+  }
+  VideoCapture input_video;
+  if (!OpenVideo(video_path, hardware_decoding_, input_video)) {
+    LOG(ERROR) << "Could not open video " << video_path << "\n";
+    return false;
+  }
+  const int total_nr_frames = input_video.get(cv::CAP_PROP_FRAME_COUNT);
+  const int num_samples =
+      total_nr_frames > 0 ? std::min(num_frames, total_nr_frames) : 0;
+  detection_images.clear();
+  cv::Mat image;
+  for (int i = 0; i < num_samples; ++i) {
+    const int frame_idx = SampleFrameIndex(i, num_samples, total_nr_frames);
+    if (!input_video.set(cv::CAP_PROP_POS_FRAMES, frame_idx) ||
+        !input_video.read(image) || image.empty()) {
+      LOG(WARNING) << "Could not decode frame " << frame_idx << " of "
+                   << video_path;
+      continue;
+    }
+    PrepareDetectionImage(image,
+                          1. / img_downsample_factor,
+                          cv::INTER_LINEAR,
+                          false,
+                          *context_);
+    detection_images.push_back(context_->detection_image.clone());
+  }
+  return !detection_images.empty();
+}
+
 }  // namespace core
 }  // namespace OpenICC
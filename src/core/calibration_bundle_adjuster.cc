@@ -0,0 +1,285 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/calibration_bundle_adjuster.h"
+
+#include <ceres/rotation.h>
+
+#include "OpenCameraCalibrator/utils/camera_model_dispatch.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/metrics.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! Pixel residual of a homogeneous board point in a view, theia camera
+//! conventions: the extrinsics are the camera position and the angle axis
+//! rotation from world to camera
+template <class CameraModel>
+struct CalibrationReprojectionError {
+  explicit CalibrationReprojectionError(const Eigen::Vector2d& feature)
+      : feature(feature) {}
+
+  template <typename T>
+  bool operator()(const T* extrinsics,
+                  const T* intrinsics,
+                  const T* point,
+                  T* residuals) const {
+    const T* position = extrinsics + theia::Camera::POSITION;
+    const T adjusted_point[3] = {point[0] - position[0] * point[3],
+                                 point[1] - position[1] * point[3],
+                                 point[2] - position[2] * point[3]};
+    T rotated_point[3];
+    ceres::AngleAxisRotatePoint(
+        extrinsics + theia::Camera::ORIENTATION, adjusted_point, rotated_point);
+
+    T pixel[2];
+    if (!CameraModel::CameraToPixelCoordinates(
+            intrinsics, rotated_point, pixel)) {
+      return false;
+    }
+    residuals[0] = pixel[0] - T(feature[0]);
+    residuals[1] = pixel[1] - T(feature[1]);
+    return true;
+  }
+
+  const Eigen::Vector2d feature;
+};
+
+}  // namespace
+
+CalibrationBundleAdjuster::CalibrationBundleAdjuster(
+    const int num_threads, const double robust_loss_width)
+    : num_threads_(std::max(num_threads, 1)),
+      loss_function_(new ceres::HuberLoss(robust_loss_width)),
+      point_parameterization_(
+          new ceres::SubsetParameterization(4, std::vector<int>{3})) {
+  ceres::Problem::Options options;
+  options.enable_fast_removal = true;
+  options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  problem_ = std::make_unique<ceres::Problem>(options);
+}
+
+bool CalibrationBundleAdjuster::Build(
+    const theia::Reconstruction& recon,
+    const std::vector<theia::ViewId>& view_ids) {
+  if (view_ids.empty()) {
+    return false;
+  }
+  camera_ = recon.View(view_ids[0])->Camera();
+  double* intrinsics = camera_.mutable_intrinsics();
+
+  return utils::DispatchCameraModel(
+      camera_.GetCameraIntrinsicsModelType(), [&](auto model_tag) {
+        using CameraModel = typename decltype(model_tag)::CameraModel;
+        using CostFunctionT = ceres::AutoDiffCostFunction<
+            CalibrationReprojectionError<CameraModel>,
+            2,
+            theia::Camera::kExtrinsicsSize,
+            CameraModel::kIntrinsicsSize,
+            4>;
+        for (const theia::ViewId view_id : view_ids) {
+          const theia::View* view = recon.View(view_id);
+          ViewBlocks& blocks = views_[view_id];
+          std::copy(view->Camera().extrinsics(),
+                    view->Camera().extrinsics() + blocks.extrinsics.size(),
+                    blocks.extrinsics.data());
+          for (const theia::TrackId track_id : view->TrackIds()) {
+            auto point = points_.find(track_id);
+            const bool new_point = point == points_.end();
+            if (new_point) {
+              point =
+                  points_.emplace(track_id, recon.Track(track_id)->Point())
+                      .first;
+            }
+            blocks.residuals.push_back(problem_->AddResidualBlock(
+                new CostFunctionT(new CalibrationReprojectionError<CameraModel>(
+                    view->GetFeature(track_id)->point_)),
+                loss_function_.get(),
+                blocks.extrinsics.data(),
+                intrinsics,
+                point->second.data()));
+            if (new_point) {
+              problem_->SetParameterization(point->second.data(),
+                                            point_parameterization_.get());
+            }
+          }
+        }
+        return true;
+      });
+}
+
+void CalibrationBundleAdjuster::RemoveView(const theia::ViewId view_id) {
+  const auto view = views_.find(view_id);
+  if (view == views_.end()) {
+    return;
+  }
+  // removing the pose block also removes its residuals
+  problem_->RemoveParameterBlock(view->second.extrinsics.data());
+  views_.erase(view);
+}
+
+void CalibrationBundleAdjuster::SetIntrinsicsToOptimize(
+    const theia::OptimizeIntrinsicsType intrinsics_to_optimize) {
+  double* intrinsics = camera_.mutable_intrinsics();
+  const int num_parameters = camera_.CameraIntrinsics()->NumParameters();
+  const std::vector<int> constant_parameters =
+      camera_.CameraIntrinsics()->GetSubsetFromOptimizeIntrinsicsType(
+          intrinsics_to_optimize);
+  if (static_cast<int>(constant_parameters.size()) == num_parameters) {
+    problem_->SetParameterBlockConstant(intrinsics);
+    return;
+  }
+  problem_->SetParameterBlockVariable(intrinsics);
+  if (constant_parameters.empty()) {
+    problem_->SetParameterization(intrinsics, nullptr);
+    return;
+  }
+  parameterizations_.emplace_back(
+      new ceres::SubsetParameterization(num_parameters, constant_parameters));
+  problem_->SetParameterization(intrinsics, parameterizations_.back().get());
+}
+
+bool CalibrationBundleAdjuster::Solve(
+    const CalibrationBundleAdjustmentStage& stage,
+    theia::Reconstruction& recon,
+    ceres::Solver::Summary* summary) {
+  if (!Solve(stage, summary)) {
+    return false;
+  }
+  const int num_parameters = camera_.CameraIntrinsics()->NumParameters();
+  for (const auto& view : views_) {
+    theia::Camera* camera = recon.MutableView(view.first)->MutableCamera();
+    std::copy(view.second.extrinsics.begin(),
+              view.second.extrinsics.end(),
+              camera->mutable_extrinsics());
+    std::copy(camera_.intrinsics(),
+              camera_.intrinsics() + num_parameters,
+              camera->mutable_intrinsics());
+  }
+  if (stage.optimize_points) {
+    for (const auto& point : points_) {
+      *recon.MutableTrack(point.first)->MutablePoint() = point.second;
+    }
+  }
+  return true;
+}
+
+bool CalibrationBundleAdjuster::Solve(
+    const CalibrationBundleAdjustmentStage& stage,
+    ceres::Solver::Summary* summary) {
+  if (views_.empty()) {
+    return false;
+  }
+  SetIntrinsicsToOptimize(stage.intrinsics_to_optimize);
+  for (auto& view : views_) {
+    if (stage.optimize_poses) {
+      problem_->SetParameterBlockVariable(view.second.extrinsics.data());
+    } else {
+      problem_->SetParameterBlockConstant(view.second.extrinsics.data());
+    }
+  }
+  for (auto& point : points_) {
+    if (stage.optimize_points) {
+      problem_->SetParameterBlockVariable(point.second.data());
+    } else {
+      problem_->SetParameterBlockConstant(point.second.data());
+    }
+  }
+
+  ceres::Solver::Options options;
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
+  options.max_num_iterations = stage.max_num_iterations;
+  options.function_tolerance = stage.function_tolerance;
+  options.gradient_tolerance = 1e-10;
+  options.parameter_tolerance = 1e-8;
+  options.minimizer_progress_to_stdout = stage.verbose;
+  if (stage.optimize_poses) {
+    // a residual connects one pose with the intrinsics and a board point,
+    // the poses are independent and the reduced system stays small
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.linear_solver_ordering =
+        std::make_shared<ceres::ParameterBlockOrdering>();
+    for (auto& view : views_) {
+      options.linear_solver_ordering->AddElementToGroup(
+          view.second.extrinsics.data(), 0);
+    }
+    options.linear_solver_ordering->AddElementToGroup(
+        camera_.mutable_intrinsics(), 1);
+    for (auto& point : points_) {
+      options.linear_solver_ordering->AddElementToGroup(point.second.data(),
+                                                        1);
+    }
+  } else {
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  }
+
+  ceres::Solver::Summary stage_summary;
+  ceres::Solve(options, problem_.get(), &stage_summary);
+  const std::string solver_label = utils::Label("solver", "camera");
+  utils::Metrics::Instance().AddCounter("openicc_solver_iterations_total",
+                                        solver_label,
+                                        stage_summary.iterations.size());
+  utils::Metrics::Instance().AddCounter("openicc_solver_seconds_total",
+                                        solver_label,
+                                        stage_summary.total_time_in_seconds);
+  if (stage.verbose) {
+    LOG(INFO) << stage_summary.BriefReport();
+  }
+  if (summary) {
+    *summary = stage_summary;
+  }
+  if (!stage_summary.IsSolutionUsable()) {
+    LOG(ERROR) << "Calibration bundle adjustment failed: "
+               << stage_summary.message;
+    return false;
+  }
+  return true;
+}
+
+bool CalibrationBundleAdjuster::IntrinsicsCovariance(
+    Eigen::MatrixXd& covariance) {
+  const double* intrinsics = camera_.intrinsics();
+  if (views_.empty() || problem_->IsParameterBlockConstant(intrinsics)) {
+    return false;
+  }
+  ceres::Covariance::Options options;
+  options.num_threads = utils::Executor::Global().SolverThreads(num_threads_);
+  ceres::Covariance intrinsics_covariance(options);
+  const std::vector<std::pair<const double*, const double*>> blocks = {
+      {intrinsics, intrinsics}};
+  if (!intrinsics_covariance.Compute(blocks, problem_.get())) {
+    LOG(ERROR) << "Could not compute the intrinsics covariance.";
+    return false;
+  }
+  const int num_parameters = camera_.CameraIntrinsics()->NumParameters();
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      block(num_parameters, num_parameters);
+  if (!intrinsics_covariance.GetCovarianceBlock(
+          intrinsics, intrinsics, block.data())) {
+    return false;
+  }
+  covariance = block;
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,1002 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/calibration_service.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <sstream>
+#include <string>
+
+#include <glog/logging.h>
+#include <theia/io/reconstruction_reader.h>
+#include <theia/io/reconstruction_writer.h>
+#include <theia/io/write_ply_file.h>
+
+#include "OpenCameraCalibrator/core/allan_variance_fitter.h"
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/dataset_preflight.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
+#include "OpenCameraCalibrator/core/multi_sequence_calibrator.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/remote_file.h"
+#include "OpenCameraCalibrator/io/write_misc.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/cpu_affinity.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+#include "OpenCameraCalibrator/utils/metrics.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/spline_error_weighting.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+using nlohmann::json;
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+json Status(const json& request, const std::string& status) {
+  json message;
+  message["id"] = request.value("id", json());
+  message["stage"] = request.value("stage", "");
+  message["status"] = status;
+  return message;
+}
+
+bool RequireString(const json& request,
+                   const std::string& name,
+                   std::string& value,
+                   std::string& error) {
+  value = request.value(name, "");
+  if (value.empty()) {
+    error = "missing parameter " + name;
+    return false;
+  }
+  return true;
+}
+
+// Stages that produce the inputs of later stages run first, so the devices
+// of a fleet advance together. A job can override it with "priority".
+utils::TaskPriority StagePriority(const json& request) {
+  const std::string priority = request.value("priority", "");
+  if (priority == "high") {
+    return utils::TaskPriority::kHigh;
+  } else if (priority == "normal") {
+    return utils::TaskPriority::kNormal;
+  } else if (priority == "low") {
+    return utils::TaskPriority::kLow;
+  }
+  const std::string stage = request.value("stage", "");
+  if (stage == "preflight" || stage == "extract_board" ||
+      stage == "convert_telemetry" || stage == "merge_scenes") {
+    return utils::TaskPriority::kHigh;
+  } else if (stage == "fit_allan_variance") {
+    return utils::TaskPriority::kLow;
+  }
+  return utils::TaskPriority::kNormal;
+}
+
+}  // namespace
+
+CalibrationService::CalibrationService(
+    const CalibrationServiceOptions& options)
+    : options_(options), queue_(std::max(1, options.max_queued_jobs)) {
+  const int num_workers = std::max(1, options_.num_workers);
+  if (options_.max_concurrency > 0) {
+    utils::Executor::Global().SetMaxConcurrency(options_.max_concurrency);
+  }
+  utils::Executor::Global().SetDeterministic(options_.deterministic);
+  threads_per_job_ = options_.threads_per_job;
+  if (threads_per_job_ <= 0) {
+    const int num_threads = utils::Executor::Global().MaxConcurrency();
+    threads_per_job_ = std::max(1, num_threads / num_workers);
+  }
+  if (!options_.worker_cpu_sets.empty()) {
+    std::stringstream ss(options_.worker_cpu_sets);
+    std::string cpu_list;
+    while (std::getline(ss, cpu_list, ';')) {
+      std::vector<int> cpus;
+      if (utils::ParseCpuList(cpu_list, cpus)) {
+        worker_cpus_.push_back(cpus);
+      } else {
+        LOG(WARNING) << "Ignoring invalid worker cpu set: " << cpu_list;
+      }
+    }
+  } else if (options_.numa_placement) {
+    for (int node = 0; node < utils::NumNumaNodes(); ++node) {
+      worker_cpus_.push_back(utils::NumaNodeCpus(node));
+    }
+  }
+  if (!worker_cpus_.empty()) {
+    utils::Executor::Global().SetWorkerCpuSets(worker_cpus_);
+  }
+  utils::MemoryBudget::Instance().SetBudgetMb(options_.memory_budget_mb);
+  utils::MemoryBudget::Instance().SetSpillDirectory(options_.spill_dir);
+  if (options_.metrics) {
+    utils::Metrics::Instance().Enable();
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&CalibrationService::WorkerLoop, this, i);
+  }
+}
+
+CalibrationService::~CalibrationService() { Stop(); }
+
+void CalibrationService::Stop() {
+  std::lock_guard<std::mutex> lock(stop_mutex_);
+  queue_.Close();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+bool CalibrationService::Submit(const json& job, JobStatusCallback callback) {
+  if (!queue_.TryPush(Job{job, callback})) {
+    json status = Status(job, "rejected");
+    status["error"] = "job queue is full";
+    callback(status);
+    return false;
+  }
+  callback(Status(job, "queued"));
+  return true;
+}
+
+void CalibrationService::WorkerLoop(const int worker_idx) {
+  if (!worker_cpus_.empty()) {
+    utils::PinCurrentThread(worker_cpus_[worker_idx % worker_cpus_.size()]);
+  }
+  Job job;
+  while (queue_.Pop(job)) {
+    job.callback(Status(job.request, "running"));
+    ++num_running_jobs_;
+    const auto start = std::chrono::steady_clock::now();
+    const int64_t cross_node_tasks =
+        utils::Executor::Global().NumCrossNodeTasks();
+    json result;
+    std::string error;
+    bool success = false;
+    {
+      // stages timed on this worker thread are reported as they finish
+      utils::ScopedStageListener listener(
+          [&job](const utils::StageRecord& stage) {
+            json progress = Status(job.request, "progress");
+            progress["name"] = stage.name;
+            progress["depth"] = stage.depth;
+            progress["wall_time_s"] = stage.wall_time_us * 1e-6;
+            progress["cpu_time_s"] = stage.cpu_time_us * 1e-6;
+            progress["num_items"] = stage.num_items;
+            if (stage.num_items > 0 && stage.wall_time_us > 0) {
+              progress["items_per_second"] =
+                  stage.num_items / (stage.wall_time_us * 1e-6);
+            }
+            job.callback(progress);
+          });
+      try {
+        success = RunJob(job.request, job.callback, result, error);
+      } catch (const json::exception& e) {
+        error = std::string("invalid job parameter: ") + e.what();
+      } catch (const std::exception& e) {
+        // e.g. cv::Exception or bad_alloc of a SpillableArray, one job must
+        // not terminate the service with the other queued jobs
+        error = std::string("job aborted: ") + e.what();
+      } catch (...) {
+        error = "job aborted: unknown exception";
+      }
+    }
+    --num_running_jobs_;
+    const double wall_time_s = std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+    const std::string stage_label =
+        utils::Label("stage", job.request.value("stage", ""));
+    utils::Metrics::Instance().AddCounter(
+        "openicc_jobs_total",
+        stage_label + "," +
+            utils::Label("status", success ? "done" : "failed"),
+        1.0);
+    utils::Metrics::Instance().ObserveDuration(
+        "openicc_job_duration_seconds", stage_label, wall_time_s);
+    json status = Status(job.request, success ? "done" : "failed");
+    status["wall_time_s"] = wall_time_s;
+    status["numa_node"] = utils::CurrentNumaNode();
+    // process wide while the job ran, shared with concurrent jobs
+    status["cross_node_tasks"] =
+        utils::Executor::Global().NumCrossNodeTasks() - cross_node_tasks;
+    status["rss_kb"] = utils::ResidentSetSizeKb();
+    status["spilled_kb"] =
+        utils::MemoryBudget::Instance().SpilledBytes() / 1024;
+    if (success) {
+      status["result"] = result;
+    } else {
+      status["error"] = error;
+      LOG(ERROR) << "Job " << status["id"] << " failed: " << error;
+    }
+    job.callback(status);
+  }
+}
+
+void CalibrationService::UpdateGauges() {
+  utils::Metrics& metrics = utils::Metrics::Instance();
+  metrics.SetGauge("openicc_queued_jobs", "", queue_.Size());
+  metrics.SetGauge("openicc_running_jobs", "", num_running_jobs_);
+  metrics.SetGauge("openicc_executor_concurrency",
+                   "",
+                   utils::Executor::Global().MaxConcurrency());
+  metrics.SetGauge(
+      "openicc_resident_memory_bytes", "", utils::ResidentSetSizeKb() * 1024.0);
+  metrics.SetGauge("openicc_spilled_bytes",
+                   "",
+                   utils::MemoryBudget::Instance().SpilledBytes());
+}
+
+std::string CalibrationService::MetricsText() {
+  if (!options_.metrics) {
+    return "";
+  }
+  UpdateGauges();
+  return utils::Metrics::Instance().PrometheusText();
+}
+
+json CalibrationService::MetricsJson() {
+  if (!options_.metrics) {
+    return json::object();
+  }
+  UpdateGauges();
+  return utils::Metrics::Instance().ToJson();
+}
+
+bool CalibrationService::RunJob(const json& request,
+                                const JobStatusCallback& callback,
+                                json& result,
+                                std::string& error) {
+  const std::string stage = request.value("stage", "");
+  if (stage == "pipeline") {
+    if (!request.contains("steps") || !request["steps"].is_array()) {
+      error = "pipeline without steps";
+      return false;
+    }
+    result["steps"] = json::array();
+    for (const json& step : request["steps"]) {
+      json step_result;
+      if (!RunJob(step, callback, step_result, error)) {
+        error = step.value("stage", "") + ": " + error;
+        return false;
+      }
+      json status = Status(step, "done");
+      status["result"] = step_result;
+      status["pipeline_id"] = request.value("id", json());
+      callback(status);
+      result["steps"].push_back(step_result);
+    }
+    return true;
+  }
+  // parallel work of the stage is scheduled with its priority
+  utils::ScopedTaskPriority priority(StagePriority(request));
+  if (stage == "preflight") {
+    return Preflight(request, result, error);
+  } else if (stage == "extract_board") {
+    return ExtractBoard(request, result, error);
+  } else if (stage == "calibrate_camera") {
+    return CalibrateCamera(request, result, error);
+  } else if (stage == "estimate_poses") {
+    return EstimatePoses(request, result, error);
+  } else if (stage == "estimate_imu_to_camera_rotation") {
+    return EstimateImuToCameraRotation(request, result, error);
+  } else if (stage == "calibrate_imu_camera") {
+    return CalibrateImuCamera(request, result, error);
+  } else if (stage == "calibrate_imu_camera_sequences") {
+    return CalibrateImuCameraSequences(request, result, error);
+  } else if (stage == "merge_scenes") {
+    return MergeScenes(request, result, error);
+  } else if (stage == "convert_telemetry") {
+    return ConvertTelemetry(request, result, error);
+  } else if (stage == "fit_allan_variance") {
+    return FitAllanVariance(request, result, error);
+  }
+  error = "unknown stage " + stage;
+  return false;
+}
+
+std::unique_ptr<BoardExtractor> CalibrationService::AcquireBoardExtractor(
+    const json& board, const std::string& board_key) {
+  {
+    std::lock_guard<std::mutex> lock(extractor_mutex_);
+    auto& idle = idle_extractors_[board_key];
+    if (!idle.empty()) {
+      std::unique_ptr<BoardExtractor> extractor = std::move(idle.back());
+      idle.pop_back();
+      return extractor;
+    }
+  }
+
+  auto extractor = std::make_unique<BoardExtractor>();
+  const BoardType board_type =
+      StringToBoardType(board.value("board_type", "charuco"));
+  const double square_length_m = board.value("checker_square_length_m", 0.022);
+  const int num_squares_x = board.value("num_squares_x", 9);
+  const int num_squares_y = board.value("num_squares_y", 7);
+  bool initialized = false;
+  if (board_type == BoardType::CHARUCO) {
+    initialized = extractor->InitializeCharucoBoard(
+        board.value("aruco_detector_params", ""),
+        square_length_m / 2.0,
+        square_length_m,
+        num_squares_x,
+        num_squares_y,
+        board.value("aruco_dict",
+                    static_cast<int>(cv::aruco::DICT_ARUCO_ORIGINAL)));
+  } else if (board_type == BoardType::RADON) {
+    initialized = extractor->InitializeRadonBoard(
+        square_length_m, num_squares_x, num_squares_y);
+  } else if (board_type == BoardType::APRILTAG) {
+    ApriltagDetectorOptions april_options;
+    april_options.num_threads = board.value("apriltag_num_threads", 1);
+    april_options.quad_decimate = board.value("apriltag_quad_decimate", 1);
+    initialized = extractor->InitializeAprilBoard(
+        square_length_m, 0.3, num_squares_x, num_squares_y, april_options);
+  }
+  if (!initialized) {
+    return nullptr;
+  }
+  LOG(INFO) << "Initialized board extractor for " << board_key;
+  return extractor;
+}
+
+void CalibrationService::ReleaseBoardExtractor(
+    const std::string& board_key, std::unique_ptr<BoardExtractor> extractor) {
+  std::lock_guard<std::mutex> lock(extractor_mutex_);
+  idle_extractors_[board_key].push_back(std::move(extractor));
+}
+
+bool CalibrationService::ExtractBoard(const json& request,
+                                      json& result,
+                                      std::string& error) {
+  std::string input_path, save_path;
+  if (!RequireString(request, "input_path", input_path, error) ||
+      !RequireString(request, "save_corners_json_path", save_path, error)) {
+    return false;
+  }
+  const json board = request.value("board", json::object());
+  const std::string board_key = board.dump();
+  std::unique_ptr<BoardExtractor> extractor =
+      AcquireBoardExtractor(board, board_key);
+  if (!extractor) {
+    error = "could not initialize board " + board_key;
+    return false;
+  }
+
+  // pooled extractors keep the settings of their last job, so all are set
+  extractor->SetNumThreads(request.value("num_threads", threads_per_job_));
+  extractor->SetTrackBlockSize(request.value("track_block_size", 0));
+  extractor->SetRefineFullResolution(
+      request.value("refine_full_resolution", false));
+  extractor->SetAdaptiveDownsample(
+      request.value("adaptive_min_corner_spacing_px", 0.0));
+  extractor->SetHardwareDecoding(request.value("hardware_decoding", false));
+  extractor->SetReducedDecode(request.value("reduced_decode", false));
+  extractor->SetUseOpenCL(request.value("use_opencl", false));
+  extractor->SetFrameRange(request.value("start_frame", 0),
+                           request.value("end_frame", -1));
+  extractor->SetCheckpointInterval(0);
+  extractor->SetResume(false);
+  extractor->SetFrameFilter(request.value("min_blur_score", 0.0),
+                            request.value("min_frame_difference", 0.0));
+  extractor->SetFrameStride(request.value("frame_stride", 1),
+                            request.value("target_fps", 0.0));
+  extractor->SetRadonFastPath(
+      request.value("radon_fast_path", false),
+      request.value("radon_fast_downsample_factor", 2.0));
+  extractor->SetDetectionBudget(request.value("detection_budget_s", 0.0));
+
+  const double downsample_factor = request.value("downsample_factor", 1.0);
+  bool extracted = false;
+  if (utils::IsPathAFile(input_path) || io::IsRemoteUrl(input_path)) {
+    extracted = extractor->ExtractVideoToJson(
+        input_path, save_path, downsample_factor);
+  } else {
+    extracted = extractor->ExtractImageFolderToJson(
+        input_path, save_path, downsample_factor);
+  }
+  ReleaseBoardExtractor(board_key, std::move(extractor));
+  if (!extracted) {
+    error = "board extraction failed for " + input_path;
+    return false;
+  }
+  result["corners"] = save_path;
+  return true;
+}
+
+bool CalibrationService::Preflight(const json& request,
+                                   json& result,
+                                   std::string& error) {
+  const std::string input_path = request.value("input_path", "");
+  const std::string telemetry_path = request.value("telemetry", "");
+  if (input_path.empty() && telemetry_path.empty()) {
+    error = "preflight needs an input_path or a telemetry";
+    return false;
+  }
+  PreflightOptions options;
+  options.num_sample_frames =
+      request.value("num_sample_frames", options.num_sample_frames);
+  options.img_downsample_factor = request.value("downsample_factor", 1.0);
+  PreflightReport report;
+  if (!telemetry_path.empty()) {
+    PreflightTelemetry(telemetry_path, options, report);
+  }
+  if (!input_path.empty()) {
+    const json board = request.value("board", json::object());
+    const std::string board_key = board.dump();
+    std::unique_ptr<BoardExtractor> extractor =
+        AcquireBoardExtractor(board, board_key);
+    if (!extractor) {
+      error = "could not initialize board " + board_key;
+      return false;
+    }
+    extractor->SetHardwareDecoding(request.value("hardware_decoding", false));
+    PreflightVideo(input_path, options, *extractor, report);
+    ReleaseBoardExtractor(board_key, std::move(extractor));
+  }
+  result["report"] = report.ToJson();
+  if (!report.Passed()) {
+    error = report.errors.front();
+    return false;
+  }
+  return true;
+}
+
+bool CalibrationService::CalibrateCamera(const json& request,
+                                         json& result,
+                                         std::string& error) {
+  std::string input_corners, output_path;
+  if (!RequireString(request, "input_corners", input_corners, error) ||
+      !RequireString(
+          request, "save_path_calib_dataset", output_path, error)) {
+    return false;
+  }
+  io::MappedScene scene;
+  if (!scene.Open(input_corners)) {
+    error = "could not load " + input_corners;
+    return false;
+  }
+  CameraCalibrator camera_calibrator(
+      request.value("camera_model", "DOUBLE_SPHERE"),
+      request.value("optimize_board_points", false));
+  camera_calibrator.SetNumThreads(threads_per_job_);
+  camera_calibrator.SetGridSize(request.value("grid_size", 0.04));
+  camera_calibrator.SetMaxCalibrationViews(
+      request.value("max_calibration_views", 200));
+  CameraBootstrapOptions bootstrap_options;
+  bootstrap_options.num_replicas = request.value("bootstrap_replicas", 0);
+  camera_calibrator.SetBootstrap(bootstrap_options);
+  if (!camera_calibrator.CalibrateCameraFromScene(scene, output_path)) {
+    error = "camera calibration failed";
+    return false;
+  }
+  theia::Camera camera;
+  double fps;
+  camera_calibrator.GetCalibratedCamera(camera, fps);
+  result["camera_calibration_json"] = output_path + ".json";
+  result["focal_length"] = camera.FocalLength();
+  result["principal_point"] = {camera.PrincipalPointX(),
+                               camera.PrincipalPointY()};
+  return true;
+}
+
+bool CalibrationService::EstimatePoses(const json& request,
+                                       json& result,
+                                       std::string& error) {
+  std::string input_corners, calibration_json, output_path;
+  if (!RequireString(request, "input_corners", input_corners, error) ||
+      !RequireString(
+          request, "camera_calibration_json", calibration_json, error) ||
+      !RequireString(request, "output_pose_dataset", output_path, error)) {
+    return false;
+  }
+  io::MappedScene scene;
+  if (!scene.Open(input_corners)) {
+    error = "could not load " + input_corners;
+    return false;
+  }
+  theia::Camera camera;
+  double fps;
+  if (!io::read_camera_calibration(calibration_json, camera, fps)) {
+    error = "could not read camera calibration " + calibration_json;
+    return false;
+  }
+
+  PoseEstimator pose_estimator;
+  pose_estimator.SetNumThreads(threads_per_job_);
+  pose_estimator.SetIndependentPoseRefinement(
+      request.value("independent_pose_refinement", false));
+  pose_estimator.SetAlternatingBoardRefinement(
+      request.value("alternating_board_refinement", false),
+      request.value("max_board_refinement_views", 200));
+  pose_estimator.SetPoseTracking(request.value("pose_tracking", false));
+  pose_estimator.EstimatePosesFromScene(scene, camera);
+  if (request.value("optimize_board_points", false)) {
+    pose_estimator.OptimizeBoardPoints();
+    pose_estimator.OptimizeAllPoses();
+  }
+  pose_estimator.FilterBadPoses();
+
+  theia::Reconstruction pose_dataset;
+  pose_estimator.GetPoseDataset(pose_dataset);
+  if (!theia::WriteReconstruction(pose_dataset, output_path)) {
+    error = "could not write " + output_path;
+    return false;
+  }
+  theia::WritePlyFile(
+      output_path + ".ply", pose_dataset, Eigen::Vector3i(255, 0, 0), 2);
+  result["pose_dataset"] = output_path;
+  result["num_views"] = pose_dataset.NumViews();
+  return true;
+}
+
+bool CalibrationService::EstimateImuToCameraRotation(const json& request,
+                                                     json& result,
+                                                     std::string& error) {
+  std::string pose_dataset_path, telemetry_path;
+  if (!RequireString(request,
+                     "input_pose_calibration_dataset",
+                     pose_dataset_path,
+                     error) ||
+      !RequireString(request, "telemetry", telemetry_path, error)) {
+    return false;
+  }
+  const std::string output_path = request.value(
+      "imu_rotation_init_output", "gyro_to_cam_calibration.json");
+
+  theia::Reconstruction pose_dataset;
+  if (!theia::ReadReconstruction(pose_dataset_path, &pose_dataset)) {
+    error = "could not read " + pose_dataset_path;
+    return false;
+  }
+  CameraTelemetryData telemetry_data;
+  if (!io::ReadTelemetry(telemetry_path, telemetry_data)) {
+    error = "could not read " + telemetry_path;
+    return false;
+  }
+
+  ImuToCameraRotationEstimator rotation_estimator;
+  RotationRansacOptions ransac_options;
+  ransac_options.num_hypotheses = request.value("ransac_hypotheses", 0);
+  ransac_options.window_s = request.value("ransac_window_s", 1.0);
+  ransac_options.inlier_threshold =
+      request.value("ransac_inlier_threshold", 0.1);
+  rotation_estimator.SetRansac(ransac_options);
+  rotation_estimator.SetNumThreads(threads_per_job_);
+  Eigen::Vector3d accl_bias = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias = Eigen::Vector3d::Zero();
+  const std::string bias_path = request.value("imu_bias_estimate", "");
+  if (bias_path.empty()) {
+    rotation_estimator.EnableGyroBiasEstimation();
+  } else if (!io::ReadIMUBias(bias_path, gyro_bias, accl_bias)) {
+    error = "could not read " + bias_path;
+    return false;
+  }
+
+  double imu_dt_s = 0.0;
+  if (!rotation_estimator.SetMeasurementsFromPoseDataset(
+          pose_dataset,
+          telemetry_data,
+          gyro_bias,
+          request.value("delta_t_imu_to_cam", 0.0),
+          imu_dt_s)) {
+    error = "could not set measurements from " + pose_dataset_path;
+    return false;
+  }
+  Eigen::Matrix3d R_gyro_to_camera;
+  double time_offset_gyro_to_camera;
+  vec3_vector ang_vel, imu_vel;
+  rotation_estimator.EstimateCameraImuRotation(imu_dt_s,
+                                               R_gyro_to_camera,
+                                               time_offset_gyro_to_camera,
+                                               gyro_bias,
+                                               imu_vel,
+                                               ang_vel);
+  const Eigen::Quaterniond q_gyro_to_cam(R_gyro_to_camera);
+  if (!io::WriteIMU2CamInit(
+          output_path, gyro_bias, q_gyro_to_cam, time_offset_gyro_to_camera)) {
+    error = "could not write " + output_path;
+    return false;
+  }
+  result["imu_rotation_init"] = output_path;
+  result["time_offset_imu_to_cam"] = time_offset_gyro_to_camera;
+  return true;
+}
+
+bool CalibrationService::InitImuCameraCalibrator(
+    const json& request,
+    ImuCameraCalibrator& imu_cam_calibrator,
+    int& flags,
+    double& time_offset_imu_to_cam,
+    std::string& error) {
+  std::string input_corners, calibration_json, pose_dataset_path;
+  std::string rotation_init_path, telemetry_path;
+  if (!RequireString(request, "input_corners", input_corners, error) ||
+      !RequireString(
+          request, "camera_calibration_json", calibration_json, error) ||
+      !RequireString(request,
+                     "input_pose_calibration_dataset",
+                     pose_dataset_path,
+                     error) ||
+      !RequireString(
+          request, "imu_rotation_init", rotation_init_path, error) ||
+      !RequireString(request, "telemetry", telemetry_path, error)) {
+    return false;
+  }
+
+  // without a weighting file it is estimated from the telemetry
+  const std::string weighting_path =
+      request.value("spline_error_weighting_json", "");
+  SplineWeightingData weight_data;
+  if (!weighting_path.empty() &&
+      !io::ReadSplineErrorWeighting(weighting_path, weight_data)) {
+    error = "could not read " + weighting_path;
+    return false;
+  }
+  SplineSolverProfile solver_profile;
+  if (!SplineSolverProfileFromString(
+          request.value("solver_profile", "sparse_normal_cholesky"),
+          request.value("sparse_backend", "SUITE_SPARSE"),
+          solver_profile)) {
+    error = "invalid solver profile";
+    return false;
+  }
+  if (!SplineDenseBackendFromString(request.value("dense_backend", "EIGEN"),
+                                    solver_profile)) {
+    error = "invalid dense backend";
+    return false;
+  }
+  io::MappedScene scene;
+  if (!scene.Open(input_corners)) {
+    error = "could not load " + input_corners;
+    return false;
+  }
+  theia::Camera camera;
+  double fps;
+  if (!io::read_camera_calibration(calibration_json, camera, fps)) {
+    error = "could not read camera calibration " + calibration_json;
+    return false;
+  }
+  theia::Reconstruction pose_dataset;
+  if (!theia::ReadReconstruction(pose_dataset_path, &pose_dataset)) {
+    error = "could not read " + pose_dataset_path;
+    return false;
+  }
+  Eigen::Quaterniond imu2cam;
+  if (!io::ReadIMU2CamInit(
+          rotation_init_path, imu2cam, time_offset_imu_to_cam)) {
+    error = "could not read " + rotation_init_path;
+    return false;
+  }
+  CameraTelemetryData telemetry_data;
+  if (!io::ReadTelemetry(telemetry_path, telemetry_data)) {
+    error = "could not read " + telemetry_path;
+    return false;
+  }
+  if (weighting_path.empty()) {
+    if (!utils::SplineWeightingFromTelemetry(telemetry_data,
+                                             request.value("q_so3", 0.99),
+                                             request.value("q_r3", 0.99),
+                                             weight_data,
+                                             threads_per_job_)) {
+      error = "could not estimate the spline error weighting";
+      return false;
+    }
+    weight_data.cam_fps = fps;
+  }
+  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
+  if (!io::ReadIMUIntrinsics(request.value("imu_intrinsics", ""),
+                             request.value("imu_bias_estimate", ""),
+                             acc_intr,
+                             gyr_intr)) {
+    error = "could not read the imu intrinsics";
+    return false;
+  }
+
+  auto recon_calib_dataset = std::make_shared<theia::Reconstruction>();
+  if (!SplineDatasetFromPoseDataset(
+          pose_dataset, scene, camera, *recon_calib_dataset)) {
+    error = "could not build the spline dataset";
+    return false;
+  }
+  const bool global_shutter = request.value("global_shutter", false);
+  const double init_line_delay_s =
+      global_shutter ? 0.0 : 1. / fps / camera.ImageHeight();
+
+  imu_cam_calibrator.SetSolverProfile(solver_profile);
+  imu_cam_calibrator.SetProfileResiduals(
+      request.value("profile_residuals", false));
+  imu_cam_calibrator.trajectory_.SetNumThreads(threads_per_job_);
+  imu_cam_calibrator.SetLinearizeRollingShutter(
+      request.value("linearize_rolling_shutter", false));
+  imu_cam_calibrator.SetRigidBoard(request.value("rigid_board", true));
+  imu_cam_calibrator.SetFuseImuResiduals(
+      request.value("fuse_imu_residuals", true));
+  imu_cam_calibrator.SetCameraResidualLayout(StringToCameraResidualLayout(
+      request.value("camera_residual_layout", "view")));
+  imu_cam_calibrator.SetDomainDecomposition(
+      request.value("decomposition_segment_s", 0.0),
+      request.value("decomposition_overlap_s", 1.0),
+      request.value("decomposition_rounds", 2),
+      request.value("decomposition_sample_stride", 10));
+  imu_cam_calibrator.SetMaxViewsPerKnotInterval(
+      request.value("max_views_per_knot_interval", 0));
+  imu_cam_calibrator.SetImuDecimationRate(
+      request.value("imu_decimation_rate", 0.0));
+  OutlierGatingOptions gating_options;
+  gating_options.num_mads = request.value("gate_outliers_mads", 0.0);
+  gating_options.max_camera_rms_px =
+      request.value("gate_max_reprojection_error", 0.0);
+  imu_cam_calibrator.SetOutlierGating(gating_options.num_mads > 0.0,
+                                      gating_options);
+  KnotFitOptions knot_fit_options;
+  knot_fit_options.so3_iterations = request.value("knot_fit_iterations", 5);
+  imu_cam_calibrator.SetFitKnotsToPoses(
+      request.value("fit_knots_to_poses", false), knot_fit_options);
+  InitGridSearchOptions grid_search_options;
+  grid_search_options.num_line_delays =
+      request.value("init_grid_line_delays", 11);
+  grid_search_options.num_time_offsets =
+      request.value("init_grid_time_offsets", 21);
+  grid_search_options.time_offset_range_s =
+      request.value("init_grid_time_offset_range_s", 0.02);
+  imu_cam_calibrator.SetInitGridSearch(request.value("init_grid_search", false),
+                                       grid_search_options);
+  for (const json& rig_camera : request.value("rig_cameras", json::array())) {
+    if (!imu_cam_calibrator.AddRigCameraFromFiles(
+            rig_camera.value("input_corners", ""),
+            rig_camera.value("input_pose_calibration_dataset", ""),
+            rig_camera.value("camera_calibration_json", ""),
+            rig_camera.value("imu_rotation_init", ""),
+            time_offset_imu_to_cam,
+            global_shutter)) {
+      error = "could not add the rig camera " + rig_camera.dump();
+      return false;
+    }
+  }
+  const std::string warm_start_path =
+      request.value("warm_start_spline_state", "");
+  if (!warm_start_path.empty() &&
+      !imu_cam_calibrator.SetWarmStartSplineState(warm_start_path)) {
+    error = "could not read " + warm_start_path;
+    return false;
+  }
+  imu_cam_calibrator.BatchInitSpline(
+      recon_calib_dataset,
+      Sophus::SE3<double>(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0)),
+      weight_data,
+      time_offset_imu_to_cam,
+      telemetry_data,
+      init_line_delay_s,
+      acc_intr,
+      gyr_intr);
+  time_offset_imu_to_cam = imu_cam_calibrator.GetTimeOffsetImuToCam();
+  const int grav_dir_axis =
+      utils::GravDirStringToInt(request.value("known_grav_dir_axis", "Z"));
+  flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  if (request.value("reestimate_biases", false)) {
+    flags |= SplineOptimFlags::IMU_BIASES;
+  }
+  if (grav_dir_axis != -1) {
+    Eigen::Vector3d grav_dir(0, 0, 0);
+    grav_dir[grav_dir_axis] = request.value("gravity_const", 9.81);
+    imu_cam_calibrator.SetKnownGravityDir(grav_dir);
+  } else {
+    flags |= SplineOptimFlags::GRAVITY_DIR;
+  }
+  const std::string load_state_path = request.value("load_spline_state", "");
+  if (!load_state_path.empty() &&
+      !imu_cam_calibrator.LoadSplineState(load_state_path)) {
+    error = "could not resume from " + load_state_path;
+    return false;
+  }
+  return true;
+}
+
+bool CalibrationService::CalibrateImuCamera(const json& request,
+                                            json& result,
+                                            std::string& error) {
+  std::string result_path;
+  if (!RequireString(request, "result_output_json", result_path, error)) {
+    return false;
+  }
+  ImuCameraCalibrator imu_cam_calibrator;
+  int flags = 0;
+  double time_offset_imu_to_cam = 0.0;
+  if (!InitImuCameraCalibrator(
+          request, imu_cam_calibrator, flags, time_offset_imu_to_cam, error)) {
+    return false;
+  }
+  const bool global_shutter = request.value("global_shutter", false);
+  double reproj_error = imu_cam_calibrator.Optimize(
+      request.value("spline_iterations", 50), flags);
+  if (request.value("calibrate_cam_line_delay", false) && !global_shutter) {
+    reproj_error =
+        imu_cam_calibrator.Optimize(10, SplineOptimFlags::CAM_LINE_DELAY);
+  }
+  if (request.value("compute_covariance", false) &&
+      !imu_cam_calibrator.ComputeCalibrationCovariance()) {
+    LOG(WARNING) << "Could not compute the calibration covariance.";
+  }
+  if (request.value("bootstrap_replicas", 0) > 0) {
+    ImuCameraBootstrapOptions bootstrap_options;
+    bootstrap_options.num_replicas = request.value("bootstrap_replicas", 0);
+    bootstrap_options.block_s = request.value("bootstrap_block_s", 2.0);
+    if (!imu_cam_calibrator.Bootstrap(bootstrap_options)) {
+      LOG(WARNING) << "Could not bootstrap the calibration.";
+    }
+  }
+  const std::string save_state_path = request.value("save_spline_state", "");
+  if (!save_state_path.empty() &&
+      !imu_cam_calibrator.SaveSplineState(save_state_path)) {
+    error = "could not write " + save_state_path;
+    return false;
+  }
+  if (!imu_cam_calibrator.WriteCalibrationResult(
+          result_path, reproj_error, time_offset_imu_to_cam)) {
+    error = "could not write " + result_path;
+    return false;
+  }
+  result["result_json"] = result_path;
+  if (!save_state_path.empty()) {
+    result["spline_state"] = save_state_path;
+  }
+  result["reprojection_error"] = reproj_error;
+  return true;
+}
+
+bool CalibrationService::CalibrateImuCameraSequences(const json& request,
+                                                     json& result,
+                                                     std::string& error) {
+  const json sequences = request.value("sequences", json::array());
+  if (sequences.empty()) {
+    error = "no sequences to calibrate";
+    return false;
+  }
+  MultiSequenceCalibrator calibrator;
+  calibrator.SetNumThreads(threads_per_job_);
+  std::vector<std::string> result_paths;
+  std::vector<double> time_offsets_imu_to_cam;
+  int flags = 0;
+  for (const json& sequence : sequences) {
+    // a sequence inherits the keys of the request it does not set
+    json sequence_request = request;
+    sequence_request.erase("sequences");
+    sequence_request.update(sequence);
+    std::string result_path;
+    double time_offset_imu_to_cam = 0.0;
+    if (!RequireString(
+            sequence_request, "result_output_json", result_path, error) ||
+        !InitImuCameraCalibrator(sequence_request,
+                                 calibrator.AddSequence(),
+                                 flags,
+                                 time_offset_imu_to_cam,
+                                 error)) {
+      return false;
+    }
+    result_paths.push_back(result_path);
+    time_offsets_imu_to_cam.push_back(time_offset_imu_to_cam);
+  }
+
+  int shared_flags = SplineOptimFlags::T_I_C;
+  if (request.value("calibrate_cam_line_delay", false) &&
+      !request.value("global_shutter", false)) {
+    shared_flags |= SplineOptimFlags::CAM_LINE_DELAY;
+  }
+  if (request.value("shared_imu_intrinsics", false)) {
+    shared_flags |= SplineOptimFlags::IMU_INTRINSICS;
+  }
+  const double reproj_error =
+      calibrator.Optimize(request.value("sequence_rounds", 3),
+                          request.value("spline_iterations", 50),
+                          flags & ~SplineOptimFlags::T_I_C,
+                          shared_flags,
+                          request.value("shared_iterations", 10));
+  for (size_t i = 0; i < result_paths.size(); ++i) {
+    ImuCameraCalibrator& sequence = calibrator.Sequence(i);
+    if (!sequence.WriteCalibrationResult(
+            result_paths[i],
+            sequence.trajectory_.GetMeanReprojectionError(),
+            time_offsets_imu_to_cam[i])) {
+      error = "could not write " + result_paths[i];
+      return false;
+    }
+    result["result_jsons"].push_back(result_paths[i]);
+  }
+  result["reprojection_error"] = reproj_error;
+  return true;
+}
+
+bool CalibrationService::MergeScenes(const json& request,
+                                     json& result,
+                                     std::string& error) {
+  std::string output_path;
+  if (!RequireString(request, "output", output_path, error)) {
+    return false;
+  }
+  const std::vector<std::string> inputs =
+      request.value("inputs", std::vector<std::string>());
+  const std::vector<double> time_offsets_s = request.value(
+      "time_offsets_s", std::vector<double>(inputs.size(), 0.0));
+  if (inputs.empty() || time_offsets_s.size() != inputs.size()) {
+    error = "need one time offset per input scene";
+    return false;
+  }
+  if (!io::MergeSceneFiles(inputs, time_offsets_s, output_path)) {
+    error = "could not merge the scenes into " + output_path;
+    return false;
+  }
+  result["corners"] = output_path;
+  return true;
+}
+
+bool CalibrationService::ConvertTelemetry(const json& request,
+                                          json& result,
+                                          std::string& error) {
+  std::string input_path, output_path;
+  if (!RequireString(request, "input", input_path, error) ||
+      !RequireString(request, "output", output_path, error)) {
+    return false;
+  }
+  io::ChunkCodec codec;
+  if (!io::ParseChunkCodec(request.value("compression", std::string("none")),
+                           codec)) {
+    error = "unknown compression, use none, zstd or lz4";
+    return false;
+  }
+  io::TelemetryBinaryWriter writer;
+  writer.SetCompression(
+      codec,
+      request.value("chunk_samples", io::kTelemetrySamplesPerChunk));
+  if (!writer.Open(output_path) ||
+      !io::StreamTelemetry(input_path, writer) || !writer.Close()) {
+    error = "could not convert " + input_path + " to " + output_path;
+    return false;
+  }
+  result["telemetry"] = output_path;
+  result["num_datapoints"] = writer.NumDatapoints();
+  return true;
+}
+
+bool CalibrationService::FitAllanVariance(const json& request,
+                                          json& result,
+                                          std::string& error) {
+  std::string telemetry_path;
+  if (!RequireString(request, "telemetry", telemetry_path, error)) {
+    return false;
+  }
+  StreamingAllanVarianceFitter fitter;
+  if (!io::StreamTelemetry(telemetry_path, fitter) || !fitter.RunFit()) {
+    error = "allan variance fit failed for " + telemetry_path;
+    return false;
+  }
+  result["telemetry"] = telemetry_path;
+  result["allan_variance"] = fitter.ResultToJson();
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
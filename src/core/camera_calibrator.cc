@@ -22,10 +22,13 @@
 #include <theia/io/write_ply_file.h>
 #include <theia/sfm/bundle_adjustment/bundle_adjuster.h>
 #include <theia/sfm/bundle_adjustment/bundle_adjustment.h>
+#include <theia/sfm/estimators/estimate_calibrated_absolute_pose.h>
 #include <theia/sfm/estimators/estimate_radial_dist_uncalibrated_absolute_pose.h>
 #include <theia/sfm/estimators/estimate_uncalibrated_absolute_pose.h>
 #include <theia/sfm/estimators/feature_correspondence_2d_3d.h>
 #include <theia/solvers/ransac.h>
+#include <theia/util/random.h>
+#include <theia/util/timer.h>
 // camera types
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 #include <theia/sfm/camera/double_sphere_camera_model.h>
@@ -34,14 +37,24 @@
 #include <theia/sfm/camera/pinhole_camera_model.h>
 #include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
 
+#include "OpenCameraCalibrator/core/calibration_bundle_adjuster.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
 #include "OpenCameraCalibrator/io/read_scene.h"
 #include "OpenCameraCalibrator/io/write_camera_calibration.h"
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/intrinsic_initializer.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/reprojection_error.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
-#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <random>
 
 namespace OpenICC {
 namespace core {
@@ -54,17 +67,47 @@ CameraCalibrator::CameraCalibrator(const std::string& camera_model,
   ransac_params_.max_iterations = 1000;
   ransac_params_.min_iterations = 5;
   ransac_params_.error_thresh = 3.0;
+  num_threads_ = utils::Executor::Global().MaxConcurrency();
+}
+
+bool CameraCalibrator::SetPriorCamera(const theia::Camera& prior_camera) {
+  if (prior_camera.GetCameraIntrinsicsModelType() !=
+      theia::StringToCameraIntrinsicsModelType(camera_model_)) {
+    LOG(WARNING) << "Prior calibration has a different camera model than "
+                 << camera_model_ << ". Not using it for a warm start.\n";
+    warm_start_ = false;
+    return false;
+  }
+  prior_camera_ = prior_camera;
+  warm_start_ = true;
+  return true;
+}
+
+void CameraCalibrator::CheckPriorImageSize(const int image_width,
+                                           const int image_height) {
+  if (warm_start_ && (prior_camera_.ImageWidth() != image_width ||
+                      prior_camera_.ImageHeight() != image_height)) {
+    LOG(WARNING) << "Prior calibration has a different image size. "
+                 << "Not using it for a warm start.\n";
+    warm_start_ = false;
+  }
 }
 
 void CameraCalibrator::RemoveViewsReprojError(const double max_reproj_error) {
+  std::vector<theia::ViewId> view_ids = recon_calib_dataset_.ViewIds();
+  RemoveViewsReprojError(max_reproj_error, view_ids);
+}
+
+void CameraCalibrator::RemoveViewsReprojError(
+    const double max_reproj_error, std::vector<theia::ViewId>& view_ids) {
   // reproj error per view, remove some views which have a high error
+  std::vector<utils::ViewReprojectionError> view_errors;
+  utils::ComputeViewReprojectionErrors(
+      recon_calib_dataset_, view_ids, view_errors, num_threads_);
   std::map<theia::ViewId, double> ids_to_remove;
-  for (int i = 0; i < recon_calib_dataset_.NumViews(); ++i) {
-    const theia::ViewId v_id = recon_calib_dataset_.ViewIds()[i];
-    const double view_reproj_error =
-        utils::GetReprojErrorOfView(recon_calib_dataset_, v_id);
-    if (view_reproj_error > max_reproj_error) {
-      ids_to_remove[v_id] = view_reproj_error;
+  for (const utils::ViewReprojectionError& view_error : view_errors) {
+    if (view_error.mean > max_reproj_error) {
+      ids_to_remove[view_error.view_id] = view_error.mean;
     }
   }
   for (auto v_id : ids_to_remove) {
@@ -72,6 +115,138 @@ void CameraCalibrator::RemoveViewsReprojError(const double max_reproj_error) {
     LOG(INFO) << "Removed view: " << v_id.first
               << " with RMSE reproj error: " << v_id.second << "\n";
   }
+  view_ids.erase(std::remove_if(view_ids.begin(),
+                                view_ids.end(),
+                                [&](const theia::ViewId v_id) {
+                                  return ids_to_remove.count(v_id) > 0;
+                                }),
+                 view_ids.end());
+}
+
+void CameraCalibrator::SelectCalibrationViews(
+    std::vector<theia::ViewId>& calib_view_ids,
+    std::vector<theia::ViewId>& held_out_view_ids) {
+  calib_view_ids = recon_calib_dataset_.ViewIds();
+  held_out_view_ids.clear();
+  std::sort(calib_view_ids.begin(), calib_view_ids.end());
+  const size_t num_views = calib_view_ids.size();
+  if (max_calibration_views_ <= 0 ||
+      num_views <= static_cast<size_t>(max_calibration_views_)) {
+    return;
+  }
+
+  // image cells covered by the corners and the rotation of every view
+  const int n_cells = coverage_grid_cells_;
+  std::vector<std::vector<int>> view_cells(num_views);
+  std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d>>
+      view_rotations(num_views);
+  for (size_t v = 0; v < num_views; ++v) {
+    const theia::View* view = recon_calib_dataset_.View(calib_view_ids[v]);
+    const theia::Camera& cam = view->Camera();
+    const double cell_w = cam.ImageWidth() / static_cast<double>(n_cells);
+    const double cell_h = cam.ImageHeight() / static_cast<double>(n_cells);
+    for (const theia::TrackId t_id : view->TrackIds()) {
+      const Eigen::Vector2d& pt = view->GetFeature(t_id)->point_;
+      const int cx = std::min(n_cells - 1, std::max(0, int(pt[0] / cell_w)));
+      const int cy = std::min(n_cells - 1, std::max(0, int(pt[1] / cell_h)));
+      view_cells[v].push_back(cy * n_cells + cx);
+    }
+    std::sort(view_cells[v].begin(), view_cells[v].end());
+    view_cells[v].erase(std::unique(view_cells[v].begin(), view_cells[v].end()),
+                        view_cells[v].end());
+    view_rotations[v] = cam.GetOrientationAsRotationMatrix();
+  }
+
+  // rotation difference at which a view counts as fully diverse
+  const double diverse_angle_rad = 30.0 * M_PI / 180.0;
+  std::vector<int> cell_obs(n_cells * n_cells, 0);
+  std::vector<double> min_angle(num_views, diverse_angle_rad);
+  std::vector<bool> selected(num_views, false);
+  std::vector<theia::ViewId> selected_ids;
+  for (int k = 0; k < max_calibration_views_; ++k) {
+    double best_score = -1.0;
+    size_t best_v = 0;
+    for (size_t v = 0; v < num_views; ++v) {
+      if (selected[v]) continue;
+      double coverage_gain = 0.0;
+      for (const int c : view_cells[v]) {
+        coverage_gain += 1.0 / (1.0 + cell_obs[c]);
+      }
+      const double diversity = min_angle[v] / diverse_angle_rad;
+      const double score = coverage_gain * (0.5 + 0.5 * diversity);
+      if (score > best_score) {
+        best_score = score;
+        best_v = v;
+      }
+    }
+    selected[best_v] = true;
+    selected_ids.push_back(calib_view_ids[best_v]);
+    for (const int c : view_cells[best_v]) ++cell_obs[c];
+    for (size_t v = 0; v < num_views; ++v) {
+      if (selected[v]) continue;
+      const Eigen::AngleAxisd diff(view_rotations[v] *
+                                   view_rotations[best_v].transpose());
+      min_angle[v] = std::min(min_angle[v], std::abs(diff.angle()));
+    }
+  }
+
+  for (size_t v = 0; v < num_views; ++v) {
+    if (!selected[v]) held_out_view_ids.push_back(calib_view_ids[v]);
+  }
+  calib_view_ids = selected_ids;
+  std::sort(calib_view_ids.begin(), calib_view_ids.end());
+  LOG(INFO) << "Selected " << calib_view_ids.size() << " of " << num_views
+            << " views for bundle adjustment.";
+}
+
+void CameraCalibrator::ValidateOnHeldOutViews(
+    const std::vector<theia::ViewId>& calib_view_ids,
+    std::vector<theia::ViewId>& held_out_view_ids,
+    const bool refine_poses) {
+  if (held_out_view_ids.empty() || calib_view_ids.empty()) {
+    return;
+  }
+  const theia::Camera& calib_cam =
+      recon_calib_dataset_.View(calib_view_ids[0])->Camera();
+  const int num_params = calib_cam.CameraIntrinsics()->NumParameters();
+  for (const theia::ViewId v_id : held_out_view_ids) {
+    theia::Camera* cam =
+        recon_calib_dataset_.MutableView(v_id)->MutableCamera();
+    std::copy(calib_cam.intrinsics(),
+              calib_cam.intrinsics() + num_params,
+              cam->mutable_intrinsics());
+  }
+  if (!refine_poses) {
+    return;
+  }
+
+  LOG(INFO) << "Validating the calibration on " << held_out_view_ids.size()
+            << " held out views.";
+  theia::BundleAdjustmentOptions ba_options;
+  ba_options.verbose = false;
+  ba_options.loss_function_type = theia::LossFunctionType::HUBER;
+  ba_options.robust_loss_width = 1.345;
+  ba_options.num_threads =
+      utils::Executor::Global().SolverThreads(num_threads_);
+  ba_options.constant_camera_orientation = false;
+  ba_options.constant_camera_position = false;
+  ba_options.intrinsics_to_optimize = theia::OptimizeIntrinsicsType::NONE;
+  theia::BundleAdjustViews(
+      ba_options, held_out_view_ids, &recon_calib_dataset_);
+
+  RemoveViewsReprojError(2.0, held_out_view_ids);
+  std::vector<utils::ViewReprojectionError> view_errors;
+  utils::ComputeViewReprojectionErrors(
+      recon_calib_dataset_, held_out_view_ids, view_errors, num_threads_);
+  double reproj_error = 0.0;
+  for (const utils::ViewReprojectionError& view_error : view_errors) {
+    reproj_error += view_error.mean;
+  }
+  if (!held_out_view_ids.empty()) {
+    LOG(INFO) << "Held out views RMSE reprojection error: "
+              << reproj_error / held_out_view_ids.size() << " from "
+              << held_out_view_ids.size() << " views.";
+  }
 }
 
 bool CameraCalibrator::AddObservation(const theia::ViewId& view_id,
@@ -128,216 +303,530 @@ theia::ViewId CameraCalibrator::AddView(
 }
 
 bool CameraCalibrator::RunCalibration() {
+  utils::ScopedStageTimer stage_timer("CameraCalibrator::RunCalibration");
+  stage_timer.AddItems(recon_calib_dataset_.NumViews());
   if (recon_calib_dataset_.NumViews() < min_num_view_) {
     LOG(ERROR) << "Not enough views for proper calibration!" << std::endl;
     return false;
   }
 
-  std::cout << "Using " << recon_calib_dataset_.NumViews()
-            << " views for camera calibration.\n";
-  // bundle adjust everything
-  theia::BundleAdjustmentOptions ba_options;
-  ba_options.verbose = true;
-  ba_options.loss_function_type = theia::LossFunctionType::HUBER;
-  ba_options.robust_loss_width = 1.345;
-  ba_options.num_threads = std::thread::hardware_concurrency();
+  std::vector<theia::ViewId> calib_view_ids, held_out_view_ids;
+  SelectCalibrationViews(calib_view_ids, held_out_view_ids);
 
-  /////////////////////////////////////////////////
-  /// 1. Optimize focal length and radial distortion, keep principal point fixed
-  /////////////////////////////////////////////////
-  ba_options.constant_camera_orientation = false;
-  ba_options.constant_camera_position = false;
-  ba_options.intrinsics_to_optimize =
-      theia::OptimizeIntrinsicsType::FOCAL_LENGTH;
-  if (camera_model_ != "PINHOLE") {
-    ba_options.intrinsics_to_optimize |=
-        theia::OptimizeIntrinsicsType::RADIAL_DISTORTION;
+  std::cout << "Using " << calib_view_ids.size()
+            << " views for camera calibration.\n";
+  // all stages run on one problem, views removed from the dataset are also
+  // removed from it
+  CalibrationBundleAdjuster bundle_adjuster(num_threads_);
+  if (!bundle_adjuster.Build(recon_calib_dataset_, calib_view_ids)) {
+    LOG(ERROR) << "Camera model " << camera_model_
+               << " is not supported by the calibration bundle adjustment";
+    return false;
   }
-  LOG(INFO) << "Bundle adjusting focal length and radial distortion.\n";
+  const auto remove_views = [&](const double max_reproj_error) {
+    const std::vector<theia::ViewId> view_ids = calib_view_ids;
+    RemoveViewsReprojError(max_reproj_error, calib_view_ids);
+    for (const theia::ViewId v_id : view_ids) {
+      if (!recon_calib_dataset_.View(v_id)) {
+        bundle_adjuster.RemoveView(v_id);
+      }
+    }
+  };
 
-  theia::BundleAdjustmentSummary summary = BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+  CalibrationBundleAdjustmentStage stage;
+  stage.verbose = true;
+  // a warm start begins with intrinsics close to the final ones, the
+  // staged focal length and principal point optimizations are skipped
+  if (!warm_start_) {
+    /////////////////////////////////////////////////
+    /// 1. Optimize focal length and radial distortion, fixed principal point
+    /////////////////////////////////////////////////
+    stage.optimize_poses = true;
+    stage.intrinsics_to_optimize = theia::OptimizeIntrinsicsType::FOCAL_LENGTH;
+    if (camera_model_ != "PINHOLE") {
+      stage.intrinsics_to_optimize |=
+          theia::OptimizeIntrinsicsType::RADIAL_DISTORTION;
+    }
+    LOG(INFO) << "Bundle adjusting focal length and radial distortion.\n";
 
-  RemoveViewsReprojError(5.0);
+    bundle_adjuster.Solve(stage, recon_calib_dataset_);
 
-  /////////////////////////////////////////////////
-  /// 2. Optimize principal point keeping everything else fixed
-  /////////////////////////////////////////////////
-  LOG(INFO) << "Optimizing principal point.";
-  ba_options.constant_camera_orientation = true;
-  ba_options.constant_camera_position = true;
-  ba_options.intrinsics_to_optimize =
-      theia::OptimizeIntrinsicsType::PRINCIPAL_POINTS;
+    remove_views(5.0);
 
-  summary = theia::BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+    /////////////////////////////////////////////////
+    /// 2. Optimize principal point keeping everything else fixed
+    /////////////////////////////////////////////////
+    LOG(INFO) << "Optimizing principal point.";
+    stage.optimize_poses = false;
+    stage.intrinsics_to_optimize =
+        theia::OptimizeIntrinsicsType::PRINCIPAL_POINTS;
 
-  if (recon_calib_dataset_.NumViews() < min_num_view_) {
-    std::cout << "Not enough views left for proper calibration!" << std::endl;
-    return false;
+    bundle_adjuster.Solve(stage, recon_calib_dataset_);
+
+    if (calib_view_ids.size() < min_num_view_) {
+      std::cout << "Not enough views left for proper calibration!" << std::endl;
+      return false;
+    }
   }
 
   /////////////////////////////////////////////////
   /// 3. Full optimization
   /////////////////////////////////////////////////
-  ba_options.constant_camera_orientation = false;
-  ba_options.constant_camera_position = false;
-  ba_options.intrinsics_to_optimize =
-      theia::OptimizeIntrinsicsType::PRINCIPAL_POINTS |
-      theia::OptimizeIntrinsicsType::FOCAL_LENGTH |
-      theia::OptimizeIntrinsicsType::ASPECT_RATIO;
+  stage.optimize_poses = true;
+  stage.intrinsics_to_optimize = FullIntrinsicsToOptimize();
+  const CalibrationBundleAdjustmentStage full_stage = stage;
+  bundle_adjuster.Solve(full_stage, recon_calib_dataset_);
 
-  if (camera_model_ == "PINHOLE") {
-    ba_options.intrinsics_to_optimize |=
-        theia::OptimizeIntrinsicsType::RADIAL_DISTORTION;
-  } else if (camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
-    ba_options.intrinsics_to_optimize |=
-        theia::OptimizeIntrinsicsType::TANGENTIAL_DISTORTION;
-  }
-  summary = theia::BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
-
-  RemoveViewsReprojError(2.0);
+  remove_views(2.0);
 
-  if (recon_calib_dataset_.NumViews() < min_num_view_) {
+  if (calib_view_ids.size() < min_num_view_) {
     std::cout << "Not enough views left for proper calibration!" << std::endl;
     return false;
   }
 
+  // held out views get refined poses before they enter the board point
+  // optimization
+  ValidateOnHeldOutViews(calib_view_ids, held_out_view_ids, true);
+
   if (optimize_board_pts_) {
     LOG(INFO) << "Optimizing board points.";
-    ba_options.use_homogeneous_local_point_parametrization = false;
-    ba_options.verbose = true;
-    theia::BundleAdjustTracks(
-        ba_options, recon_calib_dataset_.TrackIds(), &recon_calib_dataset_);
-    summary = theia::BundleAdjustViews(
-        ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+    // the board points with fixed views first, then the views again
+    stage.optimize_poses = false;
+    stage.optimize_points = true;
+    stage.intrinsics_to_optimize = theia::OptimizeIntrinsicsType::NONE;
+    bundle_adjuster.Solve(stage, recon_calib_dataset_);
+    bundle_adjuster.Solve(full_stage, recon_calib_dataset_);
+    ValidateOnHeldOutViews(calib_view_ids, held_out_view_ids, false);
   }
 
+  // the last stage was the full one, its covariance conditions on the poses
+  // and board points through the Schur complement
+  Eigen::MatrixXd intrinsics_covariance;
+  if (bundle_adjuster.IntrinsicsCovariance(intrinsics_covariance)) {
+    intrinsics_std_ = intrinsics_covariance.diagonal().cwiseSqrt();
+  } else {
+    intrinsics_std_.resize(0);
+    LOG(WARNING) << "Could not compute the intrinsics covariance.";
+  }
   return true;
 }
 
-bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
-                                               const std::string& output_path) {
-  io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset_);
+void CameraCalibrator::PrepareView(const std::string& view_key,
+                                   const nlohmann::json& view,
+                                   ViewInit& view_init) const {
+  const double timestamp_us = std::stod(view_key);
+  view_init.timestamp_s = timestamp_us * 1e-6;  // to seconds
+  const auto& image_points = view["image_points"];
+  for (const auto& img_pts : image_points.items()) {
+    view_init.board_pt3_ids.push_back(std::stoi(img_pts.key()));
+    view_init.corners.push_back(
+        Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
+  }
+}
 
-  const int image_width = scene_json["image_width"];
-  const int image_height = scene_json["image_height"];
+void CameraCalibrator::InitializeViewUncalibrated(
+    const theia::RansacParameters& ransac_params,
+    const int image_width,
+    const int image_height,
+    ViewInit& view_init) const {
   // initial principal point
   const double px = static_cast<double>(image_width) / 2.0;
   const double py = static_cast<double>(image_height) / 2.0;
 
-  vec3_vector saved_poses;
-  // iterate views and estimate poses
-  const auto views = scene_json["views"];
-  const size_t total_nr_views = views.size();
-  int views_initialized = 0;
-  for (const auto& view : views.items()) {
-    const double timestamp_us = std::stod(view.key());  // to seconds
-    const double timestamp_s = timestamp_us * 1e-6;     // to seconds
-    const auto image_points = view.value()["image_points"];
-    std::vector<int> board_pt3_ids;
-    aligned_vector<Eigen::Vector2d> corners;
-    for (const auto& img_pts : image_points.items()) {
-      board_pt3_ids.push_back(std::stoi(img_pts.key()));
-      corners.push_back(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-    }
+  std::vector<theia::FeatureCorrespondence2D3D> correspondences(
+      view_init.board_pt3_ids.size());
+  for (size_t i = 0; i < view_init.board_pt3_ids.size(); ++i) {
+    correspondences[i].feature[0] = view_init.corners[i][0] - px;
+    correspondences[i].feature[1] = view_init.corners[i][1] - py;
+    correspondences[i].world_point =
+        recon_calib_dataset_.Track(view_init.board_pt3_ids[i])
+            ->Point()
+            .hnormalized();
+  }
 
-    LOG(INFO) << "Initializing view at timestamp: " << timestamp_s << "\n";
-    // initialize cam pose
-    std::vector<theia::FeatureCorrespondence2D3D> correspondences(
-        board_pt3_ids.size());
-    for (size_t i = 0; i < board_pt3_ids.size(); ++i) {
-      theia::FeatureCorrespondence2D3D correspondence;
-      correspondence.feature[0] = corners[i][0] - px;
-      correspondence.feature[1] = corners[i][1] - py;
-      const Eigen::Vector4d track =
-          recon_calib_dataset_.Track(board_pt3_ids[i])->Point();
-      correspondence.world_point = track.hnormalized();
-      correspondences[i] = correspondence;
+  theia::RansacSummary ransac_summary;
+  if (camera_model_ == "PINHOLE" ||
+      camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
+    view_init.success = utils::initialize_pinhole_camera(correspondences,
+                                                         ransac_params,
+                                                         ransac_summary,
+                                                         view_init.rotation,
+                                                         view_init.position,
+                                                         view_init.focal_length,
+                                                         verbose_);
+  } else {
+    //        success_init = utils::initialize_doublesphere_model(
+    //                correspondences, board_pt3_ids, cv::Size(9, 7),
+    //                ransac_params_, image_width, image_height,
+    //                ransac_summary, rotation, position, focal_length,
+    //                verbose_);
+    view_init.success = utils::initialize_radial_undistortion_camera(
+        correspondences,
+        ransac_params,
+        ransac_summary,
+        cv::Size(image_width, image_height),
+        view_init.rotation,
+        view_init.position,
+        view_init.focal_length,
+        view_init.radial_distortion,
+        verbose_);
+  }
+  view_init.is_hypothesis = view_init.success;
+}
+
+void CameraCalibrator::InitializePoseFromCamera(
+    const theia::Camera& camera,
+    const theia::RansacParameters& ransac_params,
+    ViewInit& view_init) const {
+  std::vector<theia::FeatureCorrespondence2D3D> correspondences_undist(
+      view_init.board_pt3_ids.size());
+  for (size_t i = 0; i < view_init.board_pt3_ids.size(); ++i) {
+    correspondences_undist[i].feature =
+        camera.PixelToNormalizedCoordinates(view_init.corners[i])
+            .hnormalized();
+    correspondences_undist[i].world_point =
+        recon_calib_dataset_.Track(view_init.board_pt3_ids[i])
+            ->Point()
+            .hnormalized();
+  }
+
+  // same pixel threshold as the uncalibrated initialization, but in
+  // normalized coordinates
+  theia::RansacParameters calib_ransac_params = ransac_params;
+  calib_ransac_params.error_thresh =
+      ransac_params.error_thresh / camera.FocalLength();
+  theia::RansacSummary ransac_summary;
+  theia::CalibratedAbsolutePose pose;
+  theia::EstimateCalibratedAbsolutePose(calib_ransac_params,
+                                        theia::RansacType::RANSAC,
+                                        theia::PnPType::DLS,
+                                        correspondences_undist,
+                                        &pose,
+                                        &ransac_summary);
+  view_init.success = ransac_summary.inliers.size() >= 6;
+  view_init.is_hypothesis = false;
+  view_init.rotation = pose.rotation;
+  view_init.position = pose.position;
+}
+
+int CameraCalibrator::FindIntrinsicConsensus(
+    const std::vector<ViewInit>& view_inits,
+    double& focal_length,
+    double& radial_distortion) const {
+  std::vector<double> focal_lengths;
+  for (const ViewInit& view_init : view_inits) {
+    if (view_init.is_hypothesis) {
+      focal_lengths.push_back(view_init.focal_length);
     }
+  }
+  if (focal_lengths.empty()) {
+    return 0;
+  }
+  const double median_focal_length = utils::MedianOfDoubleVec(focal_lengths);
 
-    theia::RansacSummary ransac_summary;
-    Eigen::Matrix3d rotation;
-    Eigen::Vector3d position;
-    bool success_init = false;
-    double focal_length = 0.0, radial_distortion = 0.0;
-    LOG(INFO) << "Initializing " << camera_model_ << " camera model.\n";
-
-    // set error thresh 0.3% from image size
-    ransac_params_.error_thresh = 0.003 * image_height;
-    if (camera_model_ == "PINHOLE" ||
-        camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
-      success_init = utils::initialize_pinhole_camera(correspondences,
-                                                      ransac_params_,
-                                                      ransac_summary,
-                                                      rotation,
-                                                      position,
-                                                      focal_length,
-                                                      verbose_);
-    } else if (camera_model_ == "DIVISION_UNDISTORTION") {
-      success_init = utils::initialize_radial_undistortion_camera(
-          correspondences,
-          ransac_params_,
-          ransac_summary,
-          cv::Size(image_width, image_height),
-          rotation,
-          position,
-          focal_length,
-          radial_distortion,
-          verbose_);
-    } else {
-      success_init = utils::initialize_radial_undistortion_camera(
-          correspondences,
-          ransac_params_,
-          ransac_summary,
-          cv::Size(image_width, image_height),
-          rotation,
-          position,
-          focal_length,
-          radial_distortion,
-          verbose_);
-      //        success_init = utils::initialize_doublesphere_model(
-      //                correspondences, board_pt3_ids, cv::Size(9, 7),
-      //                ransac_params_, image_width, image_height,
-      //                ransac_summary, rotation, position, focal_length,
-      //                verbose_);
+  // hypotheses that agree with the median are the inliers
+  std::vector<double> inlier_focal_lengths, inlier_distortions;
+  for (const ViewInit& view_init : view_inits) {
+    if (view_init.is_hypothesis &&
+        std::abs(view_init.focal_length - median_focal_length) <=
+            consensus_focal_tolerance_ * median_focal_length) {
+      inlier_focal_lengths.push_back(view_init.focal_length);
+      inlier_distortions.push_back(view_init.radial_distortion);
     }
-    if (views_initialized % 100 == 0) {
-      std::cout << "View: " << views_initialized << "/" << total_nr_views
-                << " initialized for calibration.\n";
+  }
+  focal_length = utils::MedianOfDoubleVec(inlier_focal_lengths);
+  radial_distortion = utils::MedianOfDoubleVec(inlier_distortions);
+  return static_cast<int>(inlier_focal_lengths.size());
+}
+
+template <typename ParseView>
+void CameraCalibrator::InitializeViews(const size_t num_views,
+                                       const int image_width,
+                                       const int image_height,
+                                       ParseView&& parse_view) {
+  LOG(INFO) << "Initializing " << camera_model_ << " camera model"
+            << (warm_start_ ? " from prior calibration.\n" : ".\n");
+  // set error thresh 0.3% from image size
+  theia::RansacParameters ransac_params = ransac_params_;
+  ransac_params.error_thresh = 0.003 * image_height;
+
+  std::vector<ViewInit> view_inits(num_views);
+  bool has_consensus = warm_start_;
+  theia::Camera consensus_camera = prior_camera_;
+  double focal_length = prior_camera_.FocalLength();
+  double radial_distortion = 0.0;
+  // fixed batch size, so the point at which the consensus is reached does not
+  // depend on the number of threads
+  for (size_t batch_begin = 0; batch_begin < num_views;
+       batch_begin += consensus_batch_size_) {
+    const size_t batch_end =
+        std::min(num_views, batch_begin + consensus_batch_size_);
+    utils::ParallelFor(
+        batch_end - batch_begin,
+        num_threads_,
+        [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+          std::string view_key;
+          nlohmann::json view_storage;
+          theia::RansacParameters view_ransac_params = ransac_params;
+          for (size_t i = batch_begin + begin; i < batch_begin + end; ++i) {
+            const nlohmann::json* view = parse_view(i, view_key, view_storage);
+            if (!view) {
+              continue;
+            }
+            PrepareView(view_key, *view, view_inits[i]);
+            // seeded per view, so the result does not depend on the threads
+            view_ransac_params.rng =
+                std::make_shared<theia::RandomNumberGenerator>(ransac_seed_ +
+                                                               i);
+            if (has_consensus) {
+              InitializePoseFromCamera(
+                  consensus_camera, view_ransac_params, view_inits[i]);
+            } else {
+              InitializeViewUncalibrated(view_ransac_params,
+                                         image_width,
+                                         image_height,
+                                         view_inits[i]);
+            }
+          }
+        });
+    std::cout << "View: " << batch_end << "/" << num_views
+              << " initialized for calibration.\n";
+
+    // enough agreeing hypotheses, the remaining views only need a pose
+    if (!has_consensus &&
+        FindIntrinsicConsensus(view_inits, focal_length, radial_distortion) >=
+            min_consensus_hypotheses_) {
+      has_consensus = true;
+      consensus_camera.SetCameraIntrinsicsModelType(
+          camera_model_ == "PINHOLE" ||
+                  camera_model_ == "PINHOLE_RADIAL_TANGENTIAL"
+              ? theia::CameraIntrinsicsModelType::PINHOLE
+              : theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION);
+      consensus_camera.SetImageSize(image_width, image_height);
+      consensus_camera.SetPrincipalPoint(image_width / 2.0,
+                                         image_height / 2.0);
+      consensus_camera.SetFocalLength(focal_length);
+      if (camera_model_ != "PINHOLE" &&
+          camera_model_ != "PINHOLE_RADIAL_TANGENTIAL") {
+        consensus_camera.CameraIntrinsics()->SetParameter(
+            theia::DivisionUndistortionCameraModel::RADIAL_DISTORTION_1,
+            radial_distortion);
+      }
+      LOG(INFO) << "Intrinsic consensus after " << batch_end
+                << " views, focal length: " << focal_length
+                << " radial distortion: " << radial_distortion << "\n";
     }
-    ++views_initialized;
+  }
+  if (!has_consensus) {
+    // too few agreeing hypotheses, take the median of the inliers anyway
+    FindIntrinsicConsensus(view_inits, focal_length, radial_distortion);
+  }
 
+  vec3_vector saved_poses;
+  std::vector<size_t> selected_corners;
+  size_t num_corners = 0;
+  size_t num_selected_corners = 0;
+  for (const ViewInit& view_init : view_inits) {
+    if (!view_init.success) {
+      continue;
+    }
     // check if a very close by pose is already present
     bool take_image = true;
     for (size_t i = 0; i < saved_poses.size(); ++i) {
-      if ((position - saved_poses[i]).norm() < grid_size_) {
+      if ((view_init.position - saved_poses[i]).norm() < grid_size_) {
         take_image = false;
         break;
       }
     }
-
-    if (!take_image || !success_init) {
+    if (!take_image) {
       continue;
     }
+    saved_poses.push_back(view_init.position);
+
+    const theia::ViewId view_id = AddView(view_init.rotation,
+                                          view_init.position,
+                                          focal_length,
+                                          radial_distortion,
+                                          image_width,
+                                          image_height,
+                                          view_init.timestamp_s);
+    if (warm_start_) {
+      theia::Camera* cam =
+          recon_calib_dataset_.MutableView(view_id)->MutableCamera();
+      std::copy(prior_camera_.intrinsics(),
+                prior_camera_.intrinsics() +
+                    prior_camera_.CameraIntrinsics()->NumParameters(),
+                cam->mutable_intrinsics());
+    }
+    utils::SubsampleCorners(view_init.corners,
+                            image_width,
+                            image_height,
+                            corner_subsampling_,
+                            selected_corners);
+    for (const size_t i : selected_corners) {
+      AddObservation(
+          view_id, view_init.board_pt3_ids[i], view_init.corners[i]);
+    }
+    num_corners += view_init.corners.size();
+    num_selected_corners += selected_corners.size();
+  }
+  if (corner_subsampling_.max_corners_per_view > 0) {
+    LOG(INFO) << "Kept " << num_selected_corners << " of " << num_corners
+              << " corners of the calibration views.";
+  }
+}
 
-    saved_poses.push_back(position);
+bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
+                                               const std::string& output_path) {
+  utils::ScopedStageTimer stage_timer("CameraCalibrator::CalibrateCamera");
+  io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset_);
 
-    theia::ViewId view_id = AddView(rotation,
-                                    position,
-                                    focal_length,
-                                    radial_distortion,
-                                    image_width,
-                                    image_height,
-                                    timestamp_s);
+  const int image_width = scene_json["image_width"];
+  const int image_height = scene_json["image_height"];
+  CheckPriorImageSize(image_width, image_height);
 
-    for (size_t i = 0; i < board_pt3_ids.size(); ++i) {
-      AddObservation(view_id, board_pt3_ids[i], corners[i]);
+  // iterate views and estimate poses
+  const auto& views = scene_json["views"];
+  stage_timer.AddItems(views.size());
+  std::vector<std::string> view_keys;
+  std::vector<const nlohmann::json*> view_values;
+  for (auto it = views.begin(); it != views.end(); ++it) {
+    view_keys.push_back(it.key());
+    view_values.push_back(&it.value());
+  }
+  InitializeViews(view_keys.size(),
+                  image_width,
+                  image_height,
+                  [&](const size_t i,
+                      std::string& view_key,
+                      nlohmann::json& /*view_storage*/) {
+                    view_key = view_keys[i];
+                    return view_values[i];
+                  });
+
+  return FinishCalibration(output_path, scene_json["camera_fps"]);
+}
+
+bool CameraCalibrator::CalibrateCameraFromScene(
+    const io::MappedScene& scene, const std::string& output_path) {
+  utils::ScopedStageTimer stage_timer("CameraCalibrator::CalibrateCamera");
+  const nlohmann::json& header = scene.Header();
+  io::scene_points_to_calib_dataset(header, recon_calib_dataset_);
+
+  const int image_width = header["image_width"];
+  const int image_height = header["image_height"];
+  CheckPriorImageSize(image_width, image_height);
+
+  // iterate views and estimate poses, every thread parses its own views
+  stage_timer.AddItems(scene.NumViews());
+  InitializeViews(scene.NumViews(),
+                  image_width,
+                  image_height,
+                  [&](const size_t i,
+                      std::string& view_key,
+                      nlohmann::json& view_storage) -> const nlohmann::json* {
+                    if (!scene.ParseView(i, view_storage)) {
+                      return nullptr;
+                    }
+                    view_key = scene.ViewKey(i);
+                    return &view_storage;
+                  });
+
+  return FinishCalibration(output_path, header["camera_fps"]);
+}
+
+theia::OptimizeIntrinsicsType CameraCalibrator::FullIntrinsicsToOptimize()
+    const {
+  theia::OptimizeIntrinsicsType intrinsics_to_optimize =
+      theia::OptimizeIntrinsicsType::PRINCIPAL_POINTS |
+      theia::OptimizeIntrinsicsType::FOCAL_LENGTH |
+      theia::OptimizeIntrinsicsType::ASPECT_RATIO;
+  if (camera_model_ == "PINHOLE") {
+    intrinsics_to_optimize |= theia::OptimizeIntrinsicsType::RADIAL_DISTORTION;
+  } else if (camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
+    intrinsics_to_optimize |=
+        theia::OptimizeIntrinsicsType::TANGENTIAL_DISTORTION;
+  }
+  return intrinsics_to_optimize;
+}
+
+bool CameraCalibrator::RunBootstrap() {
+  utils::ScopedStageTimer stage_timer("CameraCalibrator::RunBootstrap");
+  bootstrap_intrinsics_std_.resize(0);
+  const std::vector<theia::ViewId> view_ids = recon_calib_dataset_.ViewIds();
+  const size_t num_replicas = bootstrap_options_.num_replicas;
+  if (num_replicas < 2 || view_ids.empty()) {
+    LOG(ERROR) << "The bootstrap needs two or more replicas and calibrated "
+                  "views.";
+    return false;
+  }
+  stage_timer.AddItems(num_replicas);
+  const theia::Camera& camera =
+      recon_calib_dataset_.View(view_ids[0])->Camera();
+  const int num_parameters = camera.CameraIntrinsics()->NumParameters();
+
+  CalibrationBundleAdjustmentStage stage;
+  stage.optimize_poses = true;
+  stage.optimize_points = optimize_board_pts_;
+  stage.intrinsics_to_optimize = FullIntrinsicsToOptimize();
+  stage.max_num_iterations = bootstrap_options_.max_num_iterations;
+  stage.function_tolerance = bootstrap_options_.function_tolerance;
+
+  // the replicas only read the calibrated dataset, each one bundle adjusts a
+  // copy of its blocks on a single thread
+  Eigen::MatrixXd replicas(num_parameters, num_replicas);
+  std::vector<char> solved(num_replicas, 0);
+  utils::ParallelFor(
+      num_replicas, num_threads_, [&](size_t begin, size_t end, int) {
+        for (size_t r = begin; r < end; ++r) {
+          std::mt19937 rng(bootstrap_options_.seed + r);
+          std::uniform_int_distribution<size_t> draw(0, view_ids.size() - 1);
+          std::vector<theia::ViewId> replica_view_ids(view_ids.size());
+          for (theia::ViewId& view_id : replica_view_ids) {
+            view_id = view_ids[draw(rng)];
+          }
+          CalibrationBundleAdjuster bundle_adjuster(1);
+          if (!bundle_adjuster.Build(recon_calib_dataset_, replica_view_ids) ||
+              !bundle_adjuster.Solve(stage)) {
+            continue;
+          }
+          replicas.col(r) = Eigen::Map<const Eigen::VectorXd>(
+              bundle_adjuster.Camera().intrinsics(), num_parameters);
+          solved[r] = 1;
+        }
+      });
+
+  Eigen::VectorXd mean = Eigen::VectorXd::Zero(num_parameters);
+  int num_solved = 0;
+  for (size_t r = 0; r < num_replicas; ++r) {
+    if (solved[r]) {
+      mean += replicas.col(r);
+      ++num_solved;
+    }
+  }
+  if (num_solved < 2) {
+    LOG(ERROR) << "Only " << num_solved << " of " << num_replicas
+               << " bootstrap replicas were solved.";
+    return false;
+  }
+  mean /= num_solved;
+  Eigen::VectorXd variance = Eigen::VectorXd::Zero(num_parameters);
+  for (size_t r = 0; r < num_replicas; ++r) {
+    if (solved[r]) {
+      variance += (replicas.col(r) - mean).cwiseAbs2();
     }
   }
+  bootstrap_intrinsics_std_ = (variance / (num_solved - 1)).cwiseSqrt();
+  LOG(INFO) << "Bootstrap of " << num_solved
+            << " replicas, intrinsics std: "
+            << bootstrap_intrinsics_std_.transpose();
+  return true;
+}
 
+bool CameraCalibrator::FinishCalibration(const std::string& output_path,
+                                         const double camera_fps) {
+  camera_fps_ = camera_fps;
+  calibrated_ = false;
   theia::WritePlyFile(output_path + "_ransac_poses.ply",
                       recon_calib_dataset_,
                       Eigen::Vector3i(255, 0, 0),
@@ -347,21 +836,30 @@ bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
     LOG(ERROR) << "Calibration failed.\n";
     return false;
   }
+  calibrated_ = true;
+  bootstrap_intrinsics_std_.resize(0);
+  if (bootstrap_options_.num_replicas > 0 && !RunBootstrap()) {
+    LOG(WARNING) << "Could not bootstrap the calibration.";
+  }
 
   // final reprojection error
+  std::vector<utils::ViewReprojectionError> view_errors;
+  utils::ComputeViewReprojectionErrors(recon_calib_dataset_,
+                                       recon_calib_dataset_.ViewIds(),
+                                       view_errors,
+                                       num_threads_);
   double reproj_error = 0;
-  for (int i = 0; i < recon_calib_dataset_.NumViews(); ++i) {
-    const double view_reproj_error = utils::GetReprojErrorOfView(
-        recon_calib_dataset_, recon_calib_dataset_.ViewIds()[i]);
-    reproj_error += view_reproj_error;
+  for (const utils::ViewReprojectionError& view_error : view_errors) {
+    reproj_error += view_error.mean;
     if (verbose_) {
-      LOG(INFO) << "View: " << recon_calib_dataset_.ViewIds()[i]
-                << " RMSE reprojection error: " << view_reproj_error << "\n";
+      LOG(INFO) << "View: " << view_error.view_id
+                << " RMSE reprojection error: " << view_error.mean << "\n";
     }
   }
 
   const double total_repro_error =
       reproj_error / recon_calib_dataset_.NumViews();
+  final_reproj_error_ = total_repro_error;
   std::cout << "Final camera calibration reprojection error: "
             << total_repro_error << " from " << recon_calib_dataset_.NumViews()
             << " view." << std::endl;
@@ -373,9 +871,11 @@ bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
                                output_path + ".calibdata");
     CHECK(io::write_camera_calibration(output_path + ".json",
                                        cam,
-                                       scene_json["camera_fps"],
+                                       camera_fps,
                                        recon_calib_dataset_.NumViews(),
-                                       total_repro_error))
+                                       total_repro_error,
+                                       intrinsics_std_,
+                                       bootstrap_intrinsics_std_))
         << "Could not write calibration file.\n";
     theia::WritePlyFile(output_path + "_final_poses.ply",
                         recon_calib_dataset_,
@@ -386,6 +886,18 @@ bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
   return true;
 }
 
+bool CameraCalibrator::GetCalibratedCamera(theia::Camera& camera,
+                                           double& fps) const {
+  if (!calibrated_ || recon_calib_dataset_.NumViews() == 0) {
+    LOG(ERROR) << "Camera is not calibrated.\n";
+    return false;
+  }
+  camera =
+      recon_calib_dataset_.View(recon_calib_dataset_.ViewIds()[0])->Camera();
+  fps = camera_fps_;
+  return true;
+}
+
 void CameraCalibrator::PrintResult() {
   const theia::Camera cam =
       recon_calib_dataset_.View(recon_calib_dataset_.ViewIds()[0])->Camera();
@@ -456,5 +968,77 @@ void CameraCalibrator::PrintResult() {
         << "\n";
   }
 }
+
+bool CalibrateCameraBatch(
+    const std::vector<CameraBatchJob>& jobs,
+    const std::string& camera_model,
+    const bool optimize_board_pts,
+    const std::function<void(CameraCalibrator&)>& configure,
+    std::vector<CameraBatchResult>& results) {
+  utils::ScopedStageTimer stage_timer("CalibrateCameraBatch");
+  stage_timer.AddItems(jobs.size());
+  results.assign(jobs.size(), CameraBatchResult());
+  // one task per camera, their sizes differ and the executor balances them
+  utils::TaskGroup tasks;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    tasks.Run([&, i]() {
+      const CameraBatchJob& job = jobs[i];
+      CameraBatchResult& result = results[i];
+      result.name = job.name;
+      theia::Timer timer;
+      io::MappedScene scene;
+      if (!scene.Open(job.input_corners)) {
+        LOG(ERROR) << "Failed to load " << job.input_corners;
+        return;
+      }
+      CameraCalibrator camera_calibrator(camera_model, optimize_board_pts);
+      if (configure) {
+        configure(camera_calibrator);
+      }
+      camera_calibrator.SetNumThreads(1);
+      result.success =
+          camera_calibrator.CalibrateCameraFromScene(scene, job.output_path) &&
+          camera_calibrator.GetCalibratedCamera(result.camera, result.fps);
+      if (result.success) {
+        result.reproj_error = camera_calibrator.GetReprojectionError();
+        result.num_views = camera_calibrator.GetNumCalibratedViews();
+      } else {
+        LOG(ERROR) << "Calibration of " << job.name << " failed.";
+      }
+      result.wall_time_s = timer.ElapsedTimeInSeconds();
+    });
+  }
+  tasks.Wait();
+  return std::all_of(
+      results.begin(), results.end(), [](const CameraBatchResult& result) {
+        return result.success;
+      });
+}
+
+bool WriteCameraBatchResults(const std::vector<CameraBatchResult>& results,
+                             const std::string& output_csv) {
+  std::ofstream csv_file(output_csv);
+  if (!csv_file.is_open()) {
+    LOG(ERROR) << "Could not open batch result file: " << output_csv;
+    return false;
+  }
+  csv_file << "name,success,num_views,reproj_error_px,focal_length_px,"
+              "principal_point_x_px,principal_point_y_px,wall_time_s\n";
+  csv_file << std::setprecision(10);
+  for (const CameraBatchResult& result : results) {
+    csv_file << result.name << "," << result.success << ","
+             << result.num_views << "," << result.reproj_error << ",";
+    if (result.success) {
+      csv_file << result.camera.FocalLength() << ","
+               << result.camera.PrincipalPointX() << ","
+               << result.camera.PrincipalPointY();
+    } else {
+      csv_file << ",,";
+    }
+    csv_file << "," << result.wall_time_s << "\n";
+  }
+  return true;
+}
+
 }  // namespace core
 }  // namespace OpenICC
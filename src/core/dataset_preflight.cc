@@ -0,0 +1,278 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/dataset_preflight.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! gravity the mean accelerometer norm is compared to
+const double kGravity = 9.81;
+//! 2000deg/s, the largest range of common gyroscopes
+const double kMaxGyroNorm = 35.0;
+
+//! Collects the telemetry statistics of the report without storing samples
+class TelemetryChecker : public io::TelemetryConsumer {
+ public:
+  explicit TelemetryChecker(PreflightReport& report) : report_(report) {}
+
+  void AddTimestamp(const int64_t timestamp_ns) override {
+    if (report_.num_timestamps == 0) {
+      first_ns_ = timestamp_ns;
+    } else if (timestamp_ns < last_ns_) {
+      ++report_.num_decreasing_timestamps;
+    } else if (timestamp_ns == last_ns_) {
+      ++report_.num_repeated_timestamps;
+    } else {
+      report_.max_telemetry_gap_s = std::max(
+          report_.max_telemetry_gap_s, (timestamp_ns - last_ns_) * NS_TO_S);
+    }
+    first_ns_ = std::min(first_ns_, timestamp_ns);
+    max_ns_ = std::max(max_ns_, timestamp_ns);
+    last_ns_ = timestamp_ns;
+    ++report_.num_timestamps;
+  }
+
+  void AddAccelerometer(const Eigen::Vector3d& accl) override {
+    ++report_.num_accl_samples;
+    if (!accl.allFinite()) {
+      ++report_.num_non_finite_values;
+      return;
+    }
+    accl_norm_sum_ += accl.norm();
+    ++num_finite_accl_;
+  }
+
+  void AddGyroscope(const Eigen::Vector3d& gyro) override {
+    ++report_.num_gyro_samples;
+    if (!gyro.allFinite()) {
+      ++report_.num_non_finite_values;
+      return;
+    }
+    report_.max_gyro_norm = std::max(report_.max_gyro_norm, gyro.norm());
+  }
+
+  void Finish() {
+    if (report_.num_timestamps > 1) {
+      report_.telemetry_duration_s = (max_ns_ - first_ns_) * NS_TO_S;
+    }
+    if (report_.telemetry_duration_s > 0.0) {
+      report_.telemetry_rate_hz =
+          (report_.num_timestamps - 1) / report_.telemetry_duration_s;
+    }
+    if (num_finite_accl_ > 0) {
+      report_.mean_accl_norm = accl_norm_sum_ / num_finite_accl_;
+    }
+  }
+
+  bool Empty() const {
+    return report_.num_timestamps == 0 && report_.num_accl_samples == 0 &&
+           report_.num_gyro_samples == 0;
+  }
+
+ private:
+  PreflightReport& report_;
+  int64_t first_ns_ = 0;
+  int64_t last_ns_ = 0;
+  int64_t max_ns_ = std::numeric_limits<int64_t>::lowest();
+  double accl_norm_sum_ = 0.0;
+  size_t num_finite_accl_ = 0;
+};
+
+template <typename T>
+std::string ToString(const T& value) {
+  std::stringstream ss;
+  ss << value;
+  return ss.str();
+}
+
+}  // namespace
+
+nlohmann::json PreflightReport::ToJson() const {
+  nlohmann::json report_json;
+  report_json["passed"] = Passed();
+  report_json["errors"] = errors;
+  report_json["warnings"] = warnings;
+  report_json["num_timestamps"] = num_timestamps;
+  report_json["num_accl_samples"] = num_accl_samples;
+  report_json["num_gyro_samples"] = num_gyro_samples;
+  report_json["num_decreasing_timestamps"] = num_decreasing_timestamps;
+  report_json["num_repeated_timestamps"] = num_repeated_timestamps;
+  report_json["num_non_finite_values"] = num_non_finite_values;
+  report_json["telemetry_duration_s"] = telemetry_duration_s;
+  report_json["telemetry_rate_hz"] = telemetry_rate_hz;
+  report_json["max_telemetry_gap_s"] = max_telemetry_gap_s;
+  report_json["mean_accl_norm"] = mean_accl_norm;
+  report_json["max_gyro_norm"] = max_gyro_norm;
+  report_json["fps"] = fps;
+  report_json["num_frames"] = num_frames;
+  report_json["image_width"] = image_width;
+  report_json["image_height"] = image_height;
+  report_json["num_sampled_frames"] = num_sampled_frames;
+  report_json["num_sampled_views"] = num_sampled_views;
+  report_json["mean_sampled_corners"] = mean_sampled_corners;
+  report_json["detection_time_s"] = detection_time_s;
+  return report_json;
+}
+
+bool PreflightTelemetry(const std::string& telemetry_path,
+                        const PreflightOptions& options,
+                        PreflightReport& report) {
+  const size_t num_errors = report.errors.size();
+  TelemetryChecker checker(report);
+  if (!io::StreamTelemetry(telemetry_path, checker)) {
+    // remote files and browser recordings can only be read completely
+    CameraTelemetryData telemetry;
+    if (!checker.Empty() || !io::ReadTelemetry(telemetry_path, telemetry)) {
+      report.errors.push_back("Could not read the telemetry " +
+                              telemetry_path);
+      return false;
+    }
+    for (const auto& accl : telemetry.accelerometer) {
+      checker.AddTimestamp(SecondsToNs(accl.timestamp_s()));
+      checker.AddAccelerometer(accl.data());
+    }
+    for (const auto& gyro : telemetry.gyroscope) {
+      checker.AddGyroscope(gyro.data());
+    }
+  }
+  checker.Finish();
+
+  if (report.num_accl_samples != report.num_timestamps ||
+      report.num_gyro_samples != report.num_timestamps) {
+    report.errors.push_back(
+        "The telemetry has " + ToString(report.num_timestamps) +
+        " timestamps, " + ToString(report.num_accl_samples) +
+        " accelerometer and " + ToString(report.num_gyro_samples) +
+        " gyroscope samples");
+  }
+  if (report.num_timestamps < size_t(options.min_telemetry_samples)) {
+    report.errors.push_back("The telemetry has only " +
+                            ToString(report.num_timestamps) + " samples");
+  }
+  if (report.num_decreasing_timestamps > 0) {
+    report.errors.push_back(
+        ToString(report.num_decreasing_timestamps) +
+        " telemetry timestamps are smaller than their predecessor");
+  }
+  if (report.num_non_finite_values > 0) {
+    report.errors.push_back(ToString(report.num_non_finite_values) +
+                            " telemetry samples are not finite");
+  }
+  if (report.num_repeated_timestamps > 0) {
+    report.warnings.push_back(
+        ToString(report.num_repeated_timestamps) +
+        " telemetry timestamps repeat, only the last sample is used");
+  }
+  if (report.max_telemetry_gap_s > options.max_telemetry_gap_s) {
+    report.warnings.push_back("The telemetry has a gap of " +
+                              ToString(report.max_telemetry_gap_s) + "s");
+  }
+  if (report.num_accl_samples > 0 &&
+      (report.mean_accl_norm < 0.5 * kGravity ||
+       report.mean_accl_norm > 1.5 * kGravity)) {
+    report.warnings.push_back(
+        "The mean accelerometer norm is " + ToString(report.mean_accl_norm) +
+        ", are the values in m/s^2?");
+  }
+  if (report.max_gyro_norm > kMaxGyroNorm) {
+    report.warnings.push_back("The gyroscope norm reaches " +
+                              ToString(report.max_gyro_norm) +
+                              ", are the values in rad/s?");
+  }
+  return report.errors.size() == num_errors;
+}
+
+bool PreflightVideo(const std::string& video_path,
+                    const PreflightOptions& options,
+                    BoardExtractor& board_extractor,
+                    PreflightReport& report) {
+  const size_t num_errors = report.errors.size();
+  VideoSample sample;
+  if (!board_extractor.SampleVideo(video_path,
+                                   options.num_sample_frames,
+                                   options.img_downsample_factor,
+                                   sample)) {
+    report.errors.push_back("Could not open the video " + video_path);
+    return false;
+  }
+  report.fps = sample.fps;
+  report.num_frames = sample.num_frames;
+  report.image_width = sample.image_width;
+  report.image_height = sample.image_height;
+  report.num_sampled_frames = sample.num_corners.size();
+  report.detection_time_s = sample.detection_time_s;
+  int num_corners = 0;
+  for (const int n : sample.num_corners) {
+    num_corners += n;
+    if (n >= options.min_corners) {
+      ++report.num_sampled_views;
+    }
+  }
+  if (report.num_sampled_frames > 0) {
+    report.mean_sampled_corners =
+        static_cast<double>(num_corners) / report.num_sampled_frames;
+  }
+
+  if (report.fps <= 0.0 || report.num_frames <= 0) {
+    report.errors.push_back("The video reports " + ToString(report.fps) +
+                            " fps and " + ToString(report.num_frames) +
+                            " frames");
+  }
+  if (report.image_width <= 0 || report.image_height <= 0) {
+    report.errors.push_back("The video has no image size");
+  }
+  if (report.num_sampled_frames == 0) {
+    report.errors.push_back("No frame of the video could be decoded");
+  } else if (report.num_sampled_frames < options.num_sample_frames &&
+             report.num_sampled_frames < report.num_frames) {
+    report.warnings.push_back(
+        "Only " + ToString(report.num_sampled_frames) + " of " +
+        ToString(options.num_sample_frames) + " sample frames were decoded");
+  }
+  if (report.num_sampled_frames > 0 &&
+      report.num_sampled_views <
+          options.min_view_fraction * report.num_sampled_frames) {
+    report.errors.push_back(
+        "Only " + ToString(report.num_sampled_views) + " of " +
+        ToString(report.num_sampled_frames) + " sampled frames show " +
+        ToString(options.min_corners) + " board corners");
+  }
+  if (report.fps > 0.0 && report.telemetry_duration_s > 0.0) {
+    const double video_duration_s = report.num_frames / report.fps;
+    if (report.telemetry_duration_s <
+        options.min_telemetry_coverage * video_duration_s) {
+      report.warnings.push_back(
+          "The telemetry covers " + ToString(report.telemetry_duration_s) +
+          "s of the " + ToString(video_duration_s) + "s video");
+    }
+  }
+  return report.errors.size() == num_errors;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,255 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/detector_tuner.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! One parameter of the search and the values that are tried for it
+struct TunableParameter {
+  const char* name;
+  std::vector<double> values;
+  std::function<double(const cv::aruco::DetectorParameters&)> get;
+  std::function<void(const double, cv::aruco::DetectorParameters&)> set;
+};
+
+std::vector<TunableParameter> TunableParameters() {
+  using Params = cv::aruco::DetectorParameters;
+  return {
+      {"adaptiveThreshWinSizeMin",
+       {3, 5, 7, 11},
+       [](const Params& p) { return p.adaptiveThreshWinSizeMin; },
+       [](const double v, Params& p) { p.adaptiveThreshWinSizeMin = v; }},
+      {"adaptiveThreshWinSizeMax",
+       {9, 13, 17, 23},
+       [](const Params& p) { return p.adaptiveThreshWinSizeMax; },
+       [](const double v, Params& p) { p.adaptiveThreshWinSizeMax = v; }},
+      {"adaptiveThreshWinSizeStep",
+       {10, 14, 20},
+       [](const Params& p) { return p.adaptiveThreshWinSizeStep; },
+       [](const double v, Params& p) { p.adaptiveThreshWinSizeStep = v; }},
+      {"minMarkerPerimeterRate",
+       {0.01, 0.02, 0.03, 0.05, 0.08},
+       [](const Params& p) { return p.minMarkerPerimeterRate; },
+       [](const double v, Params& p) { p.minMarkerPerimeterRate = v; }},
+      {"polygonalApproxAccuracyRate",
+       {0.03, 0.05, 0.08},
+       [](const Params& p) { return p.polygonalApproxAccuracyRate; },
+       [](const double v, Params& p) { p.polygonalApproxAccuracyRate = v; }},
+      {"perspectiveRemovePixelPerCell",
+       {4, 8, 12, 21},
+       [](const Params& p) { return p.perspectiveRemovePixelPerCell; },
+       [](const double v, Params& p) { p.perspectiveRemovePixelPerCell = v; }},
+      {"cornerRefinementMethod",
+       {cv::aruco::CORNER_REFINE_NONE, cv::aruco::CORNER_REFINE_SUBPIX},
+       [](const Params& p) { return p.cornerRefinementMethod; },
+       [](const double v, Params& p) { p.cornerRefinementMethod = v; }},
+      {"cornerRefinementMaxIterations",
+       {5, 10, 20},
+       [](const Params& p) { return p.cornerRefinementMaxIterations; },
+       [](const double v, Params& p) { p.cornerRefinementMaxIterations = v; }},
+  };
+}
+
+//! Corners of all sample frames found with one parameter set
+struct SampleDetections {
+  std::vector<aligned_vector<Eigen::Vector2d>> corners;
+  std::vector<std::vector<int>> ids;
+  double frame_time_s = 0.0;
+};
+
+//! Detects the board on all frames with params, the fastest of the
+//! repetitions is the time per frame
+void DetectSamples(const std::vector<cv::Mat>& detection_images,
+                   const cv::aruco::DetectorParameters& params,
+                   const int num_repetitions,
+                   BoardExtractor& board_extractor,
+                   SampleDetections& detections) {
+  board_extractor.SetDetectorParameters(params);
+  std::unique_ptr<ExtractionContext> context =
+      board_extractor.CreateExtractionContext();
+  const size_t num_frames = detection_images.size();
+  detections.corners.resize(num_frames);
+  detections.ids.resize(num_frames);
+  double min_time_s = std::numeric_limits<double>::max();
+  for (int r = 0; r < std::max(num_repetitions, 1); ++r) {
+    const auto start_time = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < num_frames; ++f) {
+      board_extractor.ExtractBoard(detection_images[f],
+                                   *context,
+                                   detections.corners[f],
+                                   detections.ids[f]);
+    }
+    min_time_s = std::min(
+        min_time_s,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start_time)
+            .count());
+  }
+  detections.frame_time_s = min_time_s / num_frames;
+}
+
+//! Corners of detections that the reference found as well and their mean
+//! distance to the reference corners
+void CompareDetections(const SampleDetections& reference,
+                       const SampleDetections& detections,
+                       size_t& num_matched,
+                       double& mean_shift_px) {
+  num_matched = 0;
+  double sum_shift_px = 0.0;
+  for (size_t f = 0; f < reference.ids.size(); ++f) {
+    std::map<int, size_t> reference_idx;
+    for (size_t i = 0; i < reference.ids[f].size(); ++i) {
+      reference_idx[reference.ids[f][i]] = i;
+    }
+    for (size_t i = 0; i < detections.ids[f].size(); ++i) {
+      const auto it = reference_idx.find(detections.ids[f][i]);
+      if (it == reference_idx.end()) {
+        continue;
+      }
+      ++num_matched;
+      sum_shift_px +=
+          (detections.corners[f][i] - reference.corners[f][it->second]).norm();
+    }
+  }
+  mean_shift_px = num_matched > 0 ? sum_shift_px / num_matched : 0.0;
+}
+
+size_t NumCorners(const SampleDetections& detections) {
+  size_t num_corners = 0;
+  for (const std::vector<int>& ids : detections.ids) {
+    num_corners += ids.size();
+  }
+  return num_corners;
+}
+
+}  // namespace
+
+bool TuneDetectorParameters(const std::vector<cv::Mat>& detection_images,
+                            const DetectorTuningOptions& options,
+                            BoardExtractor& board_extractor,
+                            DetectorTuningResult& result) {
+  const cv::Ptr<cv::aruco::DetectorParameters> initial_params =
+      board_extractor.GetDetectorParameters();
+  if (!initial_params) {
+    LOG(ERROR) << "Only the detector parameters of charuco boards can be "
+                  "tuned.";
+    return false;
+  }
+  if (detection_images.empty()) {
+    LOG(ERROR) << "No frames to tune the detector parameters on.";
+    return false;
+  }
+
+  SampleDetections reference;
+  DetectSamples(detection_images,
+                *initial_params,
+                options.num_repetitions,
+                board_extractor,
+                reference);
+  result = DetectorTuningResult();
+  result.initial_frame_time_s = reference.frame_time_s;
+  result.initial_num_corners = NumCorners(reference);
+  result.tuned_frame_time_s = reference.frame_time_s;
+  result.tuned_num_corners = result.initial_num_corners;
+  result.num_evaluations = 1;
+  if (result.initial_num_corners == 0) {
+    LOG(ERROR) << "The detector does not find the board on any of the "
+               << detection_images.size() << " frames.";
+    board_extractor.SetDetectorParameters(*initial_params);
+    return false;
+  }
+  LOG(INFO) << "Initial detector parameters: " << 1e3 * reference.frame_time_s
+            << "ms per frame, " << result.initial_num_corners << " corners.";
+
+  const size_t min_matched = static_cast<size_t>(
+      std::ceil(options.min_recall * result.initial_num_corners));
+  cv::aruco::DetectorParameters best_params = *initial_params;
+  const std::vector<TunableParameter> parameters = TunableParameters();
+  SampleDetections detections;
+  for (int round = 0; round < options.max_rounds; ++round) {
+    bool changed = false;
+    for (const TunableParameter& parameter : parameters) {
+      const double current_value = parameter.get(best_params);
+      double best_value = current_value;
+      for (const double value : parameter.values) {
+        if (value == current_value) {
+          continue;
+        }
+        cv::aruco::DetectorParameters candidate = best_params;
+        parameter.set(value, candidate);
+        if (candidate.adaptiveThreshWinSizeMin >
+            candidate.adaptiveThreshWinSizeMax) {
+          continue;
+        }
+        DetectSamples(detection_images,
+                      candidate,
+                      options.num_repetitions,
+                      board_extractor,
+                      detections);
+        ++result.num_evaluations;
+        size_t num_matched = 0;
+        double mean_shift_px = 0.0;
+        CompareDetections(reference, detections, num_matched, mean_shift_px);
+        if (num_matched < min_matched ||
+            mean_shift_px > options.max_corner_shift_px ||
+            detections.frame_time_s >=
+                (1.0 - options.min_speedup) * result.tuned_frame_time_s) {
+          continue;
+        }
+        best_value = value;
+        result.tuned_frame_time_s = detections.frame_time_s;
+        result.tuned_num_corners = num_matched;
+      }
+      if (best_value != current_value) {
+        parameter.set(best_value, best_params);
+        changed = true;
+        LOG(INFO) << parameter.name << " = " << best_value << ": "
+                  << 1e3 * result.tuned_frame_time_s << "ms per frame, "
+                  << result.tuned_num_corners << " corners.";
+      }
+    }
+    if (!changed) {
+      break;
+    }
+  }
+
+  result.detector_params =
+      cv::makePtr<cv::aruco::DetectorParameters>(best_params);
+  board_extractor.SetDetectorParameters(*initial_params);
+  LOG(INFO) << "Tuned the detector parameters in " << result.num_evaluations
+            << " evaluations from " << 1e3 * result.initial_frame_time_s
+            << "ms to " << 1e3 * result.tuned_frame_time_s << "ms per frame.";
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,298 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "OpenCameraCalibrator/core/excitation_monitor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <Eigen/Eigenvalues>
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+#include "theia/sfm/reconstruction.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+Eigen::Matrix3d Skew(const Eigen::Vector3d& v) {
+  Eigen::Matrix3d skew;
+  skew << 0.0, -v(2), v(1), v(2), 0.0, -v(0), -v(1), v(0), 0.0;
+  return skew;
+}
+
+//! std of the worst constrained direction of an information matrix
+double MinEigenStd(const Eigen::Matrix3d& information) {
+  const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(
+      information, Eigen::EigenvaluesOnly);
+  const double min_eigenvalue = solver.eigenvalues()(0);
+  if (min_eigenvalue <= 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 1.0 / std::sqrt(min_eigenvalue);
+}
+
+double InformationStd(const double information) {
+  if (information <= 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 1.0 / std::sqrt(information);
+}
+
+}  // namespace
+
+nlohmann::json ExcitationReport::ToJson() const {
+  nlohmann::json report_json;
+  report_json["duration_s"] = duration_s;
+  report_json["num_gyro_samples"] = num_gyro_samples;
+  report_json["num_accl_samples"] = num_accl_samples;
+  report_json["num_views"] = num_views;
+  report_json["gyro_rms"] = {gyro_rms[0], gyro_rms[1], gyro_rms[2]};
+  report_json["accl_std"] = {accl_std[0], accl_std[1], accl_std[2]};
+  report_json["board_coverage"] = board_coverage;
+  report_json["rotation_std_deg"] = rotation_std_deg;
+  report_json["translation_std_m"] = translation_std_m;
+  report_json["line_delay_std_us"] = line_delay_std_us;
+  report_json["focal_length_std"] = focal_length_std;
+  report_json["gyro_scale_std"] = gyro_scale_std;
+  report_json["accl_scale_std"] = accl_scale_std;
+  report_json["sufficient"] = sufficient;
+  return report_json;
+}
+
+ExcitationMonitor::ExcitationMonitor(const ExcitationMonitorOptions& options)
+    : options_(options) {
+  if (options_.image_width > 0 && options_.image_height > 0) {
+    covered_cells_.assign(options_.grid_cells * options_.grid_cells, false);
+  }
+}
+
+void ExcitationMonitor::UpdateTimeSpan(const double timestamp_s) {
+  if (first_time_s_ < 0.0) {
+    first_time_s_ = timestamp_s;
+  }
+  last_time_s_ = std::max(last_time_s_, timestamp_s);
+}
+
+void ExcitationMonitor::AddGyroSample(const double timestamp_s,
+                                      const Eigen::Vector3d& gyro) {
+  UpdateTimeSpan(timestamp_s);
+  const double dt = timestamp_s - last_gyro_time_s_;
+  if (last_gyro_time_s_ >= 0.0 && dt > 0.0) {
+    gyro_rate_ = (gyro - last_gyro_) / dt;
+  }
+  last_gyro_time_s_ = timestamp_s;
+  last_gyro_ = gyro;
+
+  ++num_gyro_samples_;
+  gyro_sq_sum_ += gyro.cwiseAbs2();
+  // d(R * omega) / d(theta) = -(R * omega)^, so the information is
+  // omega^T * omega^ = |omega|^2 * I - omega * omega^T
+  const double inv_var =
+      1.0 / (options_.gyro_noise_std * options_.gyro_noise_std);
+  rotation_information_ +=
+      inv_var * (gyro.squaredNorm() * Eigen::Matrix3d::Identity() -
+                 gyro * gyro.transpose());
+}
+
+void ExcitationMonitor::AddAcclSample(const double timestamp_s,
+                                      const Eigen::Vector3d& accl) {
+  UpdateTimeSpan(timestamp_s);
+  ++num_accl_samples_;
+  const Eigen::Vector3d delta = accl - accl_mean_;
+  accl_mean_ += delta / static_cast<double>(num_accl_samples_);
+  accl_m2_ += delta.cwiseProduct(accl - accl_mean_);
+  accl_sq_sum_ += accl.cwiseAbs2();
+
+  // the lever arm p adds (d omega/dt)^ * p + omega^ * omega^ * p
+  const Eigen::Matrix3d omega_skew = Skew(last_gyro_);
+  const Eigen::Matrix3d jacobian = Skew(gyro_rate_) + omega_skew * omega_skew;
+  const double inv_var =
+      1.0 / (options_.accl_noise_std * options_.accl_noise_std);
+  translation_information_ += inv_var * jacobian.transpose() * jacobian;
+}
+
+void ExcitationMonitor::AddView(
+    const double timestamp_s, const aligned_vector<Eigen::Vector2d>& corners) {
+  if (corners.empty()) {
+    return;
+  }
+  UpdateTimeSpan(timestamp_s);
+  ++num_views_;
+
+  const double inv_var =
+      1.0 / (options_.corner_noise_std_px * options_.corner_noise_std_px);
+  double mean_row = 0.0;
+  for (const Eigen::Vector2d& corner : corners) {
+    mean_row += corner[1];
+  }
+  mean_row /= static_cast<double>(corners.size());
+  // the time offset absorbs the image motion of the mean row
+  const double image_rate = options_.focal_length_px * last_gyro_.norm();
+  for (const Eigen::Vector2d& corner : corners) {
+    const double row_offset = corner[1] - mean_row;
+    line_delay_information_ +=
+        inv_var * image_rate * image_rate * row_offset * row_offset;
+  }
+
+  if (!covered_cells_.empty()) {
+    const Eigen::Vector2d center(0.5 * options_.image_width,
+                                 0.5 * options_.image_height);
+    const int cells = options_.grid_cells;
+    for (const Eigen::Vector2d& corner : corners) {
+      // u - cx = f * x, so d(u - cx) / d(df / f) = u - cx
+      focal_length_information_ += inv_var * (corner - center).squaredNorm();
+      const int cx = std::clamp(
+          static_cast<int>(corner[0] / options_.image_width * cells),
+          0,
+          cells - 1);
+      const int cy = std::clamp(
+          static_cast<int>(corner[1] / options_.image_height * cells),
+          0,
+          cells - 1);
+      if (!covered_cells_[cy * cells + cx]) {
+        covered_cells_[cy * cells + cx] = true;
+        ++num_covered_cells_;
+      }
+    }
+  }
+
+  if (sufficient_time_s_ < 0.0 && Report().sufficient) {
+    sufficient_time_s_ = timestamp_s;
+  }
+}
+
+ExcitationReport ExcitationMonitor::Report() const {
+  ExcitationReport report;
+  report.duration_s = first_time_s_ < 0.0 ? 0.0 : last_time_s_ - first_time_s_;
+  report.num_gyro_samples = num_gyro_samples_;
+  report.num_accl_samples = num_accl_samples_;
+  report.num_views = num_views_;
+  if (num_gyro_samples_ > 0) {
+    report.gyro_rms =
+        (gyro_sq_sum_ / static_cast<double>(num_gyro_samples_)).cwiseSqrt();
+  }
+  if (num_accl_samples_ > 1) {
+    report.accl_std =
+        (accl_m2_ / static_cast<double>(num_accl_samples_ - 1)).cwiseSqrt();
+  }
+  const bool has_image_size = !covered_cells_.empty();
+  if (has_image_size) {
+    report.board_coverage = static_cast<double>(num_covered_cells_) /
+                            static_cast<double>(covered_cells_.size());
+  }
+
+  report.rotation_std_deg = MinEigenStd(rotation_information_) * 180.0 / M_PI;
+  report.translation_std_m = MinEigenStd(translation_information_);
+  report.line_delay_std_us =
+      InformationStd(line_delay_information_) * S_TO_US;
+  report.focal_length_std = InformationStd(focal_length_information_);
+  // the scales multiply the readings, d(s * x) / ds = x
+  const double gyro_inv_var =
+      1.0 / (options_.gyro_noise_std * options_.gyro_noise_std);
+  const double accl_inv_var =
+      1.0 / (options_.accl_noise_std * options_.accl_noise_std);
+  report.gyro_scale_std = 0.0;
+  report.accl_scale_std = 0.0;
+  for (int d = 0; d < 3; ++d) {
+    report.gyro_scale_std = std::max(
+        report.gyro_scale_std, InformationStd(gyro_inv_var * gyro_sq_sum_[d]));
+    report.accl_scale_std = std::max(
+        report.accl_scale_std, InformationStd(accl_inv_var * accl_sq_sum_[d]));
+  }
+
+  report.sufficient =
+      num_views_ >= static_cast<size_t>(options_.min_views) &&
+      report.gyro_rms.minCoeff() >= options_.min_gyro_rms &&
+      report.accl_std.minCoeff() >= options_.min_accl_std &&
+      report.rotation_std_deg <= options_.max_rotation_std_deg &&
+      report.translation_std_m <= options_.max_translation_std_m &&
+      report.gyro_scale_std <= options_.max_imu_scale_std &&
+      report.accl_scale_std <= options_.max_imu_scale_std;
+  if (options_.check_line_delay) {
+    report.sufficient =
+        report.sufficient &&
+        report.line_delay_std_us <= options_.max_line_delay_std_us;
+  }
+  if (has_image_size) {
+    report.sufficient =
+        report.sufficient &&
+        report.board_coverage >= options_.min_board_coverage &&
+        report.focal_length_std <= options_.max_focal_length_std;
+  }
+  return report;
+}
+
+bool FindSufficientDataEnd(const CameraTelemetryData& telemetry,
+                           const theia::Reconstruction& vision_dataset,
+                           const double time_offset_imu_to_cam,
+                           const ExcitationMonitorOptions& options,
+                           double& end_time_s,
+                           ExcitationReport& report) {
+  std::vector<std::pair<double, theia::ViewId>> views;
+  for (const theia::ViewId view_id : vision_dataset.ViewIds()) {
+    views.emplace_back(vision_dataset.View(view_id)->GetTimestamp(), view_id);
+  }
+  std::sort(views.begin(), views.end());
+
+  ExcitationMonitor monitor(options);
+  const CameraGyroData& gyro = telemetry.gyroscope;
+  const CameraAccData& accl = telemetry.accelerometer;
+  size_t gyro_idx = 0;
+  size_t accl_idx = 0;
+  end_time_s = 0.0;
+  aligned_vector<Eigen::Vector2d> corners;
+  for (const auto& [timestamp_s, view_id] : views) {
+    // merge the IMU samples up to the view in time order
+    while (gyro_idx < gyro.size() || accl_idx < accl.size()) {
+      const double t_gyro =
+          gyro_idx < gyro.size()
+              ? gyro[gyro_idx].timestamp_s() + time_offset_imu_to_cam
+              : std::numeric_limits<double>::infinity();
+      const double t_accl =
+          accl_idx < accl.size()
+              ? accl[accl_idx].timestamp_s() + time_offset_imu_to_cam
+              : std::numeric_limits<double>::infinity();
+      if (std::min(t_gyro, t_accl) > timestamp_s) {
+        break;
+      }
+      if (t_gyro <= t_accl) {
+        monitor.AddGyroSample(t_gyro, gyro[gyro_idx++].data());
+      } else {
+        monitor.AddAcclSample(t_accl, accl[accl_idx++].data());
+      }
+    }
+
+    const theia::View* view = vision_dataset.View(view_id);
+    corners.clear();
+    for (const theia::TrackId track_id : view->TrackIds()) {
+      corners.push_back(view->GetFeature(track_id)->point_);
+    }
+    monitor.AddView(timestamp_s, corners);
+    end_time_s = timestamp_s;
+    if (monitor.SufficientTime() >= 0.0) {
+      report = monitor.Report();
+      return true;
+    }
+  }
+  report = monitor.Report();
+  return false;
+}
+
+}  // namespace core
+}  // namespace OpenICC
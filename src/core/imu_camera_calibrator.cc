@@ -15,11 +15,83 @@
 
 #include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
 
+#include <theia/io/reconstruction_reader.h>
+#include <theia/util/timer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <random>
+#include <utility>
+
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/spline_state.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/smoothing_filter.h"
+
 namespace OpenICC {
 namespace core {
 
+bool SplineDatasetFromPoseDataset(const theia::Reconstruction& pose_dataset,
+                                  const io::MappedScene& scene,
+                                  const theia::Camera& camera,
+                                  theia::Reconstruction& calib_dataset,
+                                  const double t_begin_s,
+                                  const double t_end_s) {
+  // fill tracks. we use the ones from pose estimation because they might have
+  // been optimized (to account for non planarity of the target)
+  for (const auto& old_track_id : pose_dataset.TrackIds()) {
+    calib_dataset.AddTrack(old_track_id);
+    theia::Track* new_track = calib_dataset.MutableTrack(old_track_id);
+    *new_track->MutablePoint() = pose_dataset.Track(old_track_id)->Point();
+  }
+
+  nlohmann::json view;
+  for (size_t i = 0; i < scene.NumViews(); ++i) {
+    const double timestamp_us = std::stod(scene.ViewKey(i));
+    if (timestamp_us * US_TO_S < t_begin_s ||
+        timestamp_us * US_TO_S > t_end_s) {
+      continue;
+    }
+    const std::string view_name = std::to_string((uint64_t)timestamp_us);
+    const theia::ViewId old_view_id = pose_dataset.ViewIdFromName(view_name);
+    if (old_view_id == theia::kInvalidViewId || !scene.ParseView(i, view)) {
+      continue;
+    }
+    const theia::ViewId view_id =
+        calib_dataset.AddView(view_name, 0, timestamp_us * US_TO_S);
+    theia::Camera* mutable_cam = calib_dataset.MutableView(view_id)
+                                     ->MutableCamera();
+    const theia::Camera& cam_old = pose_dataset.View(old_view_id)->Camera();
+    mutable_cam->SetOrientationFromAngleAxis(
+        cam_old.GetOrientationAsAngleAxis());
+    mutable_cam->SetPosition(cam_old.GetPosition());
+    mutable_cam->SetFromCameraIntrinsicsPriors(
+        camera.CameraIntrinsicsPriorFromIntrinsics());
+
+    for (const auto& img_pts : view["image_points"].items()) {
+      const int board_pt3_id = std::stoi(img_pts.key());
+      const Eigen::Vector2d corner(img_pts.value()[0], img_pts.value()[1]);
+      const theia::Feature feat(corner, Eigen::Matrix2d::Identity());
+      calib_dataset.AddObservation(view_id, board_pt3_id, feat);
+    }
+  }
+  if (calib_dataset.NumViews() == 0) {
+    LOG(ERROR) << "No view of the scene has an estimated pose.";
+    return false;
+  }
+  return true;
+}
+
 void ImuCameraCalibrator::BatchInitSpline(
-    const theia::Reconstruction& vision_dataset,
+    std::shared_ptr<theia::Reconstruction> vision_dataset,
     const Sophus::SE3<double>& T_i_c_init,
     const SplineWeightingData& spline_weight_data,
     const double time_offset_imu_to_cam,
@@ -27,9 +99,12 @@ void ImuCameraCalibrator::BatchInitSpline(
     const double initial_line_delay,
     const ThreeAxisSensorCalibParams<double> accl_intrinsics,
     const ThreeAxisSensorCalibParams<double> gyro_intrinsics) {
-  image_data_ = vision_dataset;
+  utils::ScopedStageTimer stage_timer("ImuCameraCalibrator::BatchInitSpline");
+  image_data_ = std::move(vision_dataset);
   spline_weight_data_ = spline_weight_data;
+  spline_solved_ = false;
   T_i_c_init_ = T_i_c_init;
+  time_offset_imu_to_cam_s_ = time_offset_imu_to_cam;
 
   trajectory_.SetT_i_c(T_i_c_init);
   trajectory_.SetImuToCameraTimeOffset(
@@ -37,9 +112,9 @@ void ImuCameraCalibrator::BatchInitSpline(
   trajectory_.SetIMUIntrinsics(accl_intrinsics, gyro_intrinsics);
 
   // set camera timestamps and sort them
-  const auto& view_ids = vision_dataset.ViewIds();
+  const auto& view_ids = image_data_->ViewIds();
   for (const theia::ViewId view_id : view_ids) {
-    cam_timestamps_.push_back(vision_dataset.View(view_id)->GetTimestamp());
+    cam_timestamps_.push_back(image_data_->View(view_id)->GetTimestamp());
   }
   std::sort(cam_timestamps_.begin(), cam_timestamps_.end());
 
@@ -47,6 +122,18 @@ void ImuCameraCalibrator::BatchInitSpline(
   inital_cam_line_delay_s_ = initial_line_delay;
   trajectory_.SetCameraLineDelay(inital_cam_line_delay_s_);
 
+  if (warm_start_state_) {
+    // a zero line delay marks a global shutter, on either side it is kept
+    if (inital_cam_line_delay_s_ != 0.0 &&
+        warm_start_state_->cam_line_delay_s != 0.0) {
+      inital_cam_line_delay_s_ = warm_start_state_->cam_line_delay_s;
+    }
+    trajectory_.SetCalibrationFromState(*warm_start_state_);
+    trajectory_.SetCameraLineDelay(inital_cam_line_delay_s_);
+    T_i_c_init_ = warm_start_state_->T_i_c;
+    LOG(INFO) << "Warm started T_i_c, line delay and IMU intrinsics";
+  }
+
   std::cout << "Initialized Line Delay to: "
             << inital_cam_line_delay_s_ * S_TO_US << "ns\n";
 
@@ -55,17 +142,20 @@ void ImuCameraCalibrator::BatchInitSpline(
       std::minmax_element(cam_timestamps_.begin(), cam_timestamps_.end());
   t0_s_ = cam_timestamps_[result.first - cam_timestamps_.begin()];
   tend_s_ = cam_timestamps_[result.second - cam_timestamps_.begin()];
-  const int64_t start_t_ns = t0_s_ * S_TO_NS;
+  SelectSplineViews();
+  const int64_t start_t_ns = SecondsToNs(t0_s_);
   const int64_t end_t_ns =
-      tend_s_ * S_TO_NS + 0.01 * S_TO_NS + inital_cam_line_delay_s_;
-  const int64_t dt_so3_ns = spline_weight_data_.dt_so3 * S_TO_NS;
-  const int64_t dt_r3_ns = spline_weight_data_.dt_r3 * S_TO_NS;
+      SecondsToNs(tend_s_ + 0.01 + inital_cam_line_delay_s_);
+  // start with the coarsest knot spacing, Optimize refines it
+  current_knot_level_ = std::max(knot_spacing_levels_, 1) - 1;
+  const int64_t dt_so3_ns = KnotSpacingNs(spline_weight_data_.dt_so3);
+  const int64_t dt_r3_ns = KnotSpacingNs(spline_weight_data_.dt_r3);
 
   trajectory_.SetTimes(dt_so3_ns, dt_r3_ns, start_t_ns, end_t_ns);
 
   LOG(INFO) << "Spline initialized with. Start/End: " << t0_s_ << "/" << tend_s_
-            << " knots spacing r3/so3: " << spline_weight_data_.dt_r3 << "/"
-            << spline_weight_data_.dt_so3;
+            << " knots spacing r3/so3: " << dt_r3_ns * NS_TO_S << "/"
+            << dt_so3_ns * NS_TO_S;
 
   nr_knots_so3_ = (end_t_ns - start_t_ns) / dt_so3_ns + SPLINE_N;
   nr_knots_r3_ = (end_t_ns - start_t_ns) / dt_r3_ns + SPLINE_N;
@@ -77,53 +167,176 @@ void ImuCameraCalibrator::BatchInitSpline(
   // camera poses (T_w_c)
   trajectory_.SetImageData(image_data_);
   trajectory_.BatchInitSO3R3VisPoses();
-  // TODO make the bias spline dt configurable
   trajectory_.InitBiasSplines(accl_intrinsics.GetBiasVector(),
                               gyro_intrinsics.GetBiasVector(),
-                              10 * 1e9,
-                              10 * 1e9,
+                              SecondsToNs(accl_bias_dt_s_),
+                              SecondsToNs(gyro_bias_dt_s_),
                               1.0,
                               1e-1);
-
-  LOG(INFO) << "Adding Vision measurements to spline";
-
-  // rolling shutter camera
-  if (inital_cam_line_delay_s_ != 0.0) {
-    for (const auto& vid : vision_dataset.ViewIds()) {
-      trajectory_.AddRSCameraMeasurement(vision_dataset.View(vid), 0.0);
-    }
-  } else {
-    for (const auto& vid : vision_dataset.ViewIds()) {
-      trajectory_.AddGSCameraMeasurement(vision_dataset.View(vid), 0.0);
-    }
+  if (init_grid_search_) {
+    SearchInitGrid(telemetry_data, gyro_intrinsics);
   }
-  LOG(INFO) << "Added all Vision measurements to the spline estimator";
 
-  LOG(INFO) << "Adding IMU measurements to spline";
+  // keep the imu samples inside the spline time range, sorted by time
+  std::vector<std::pair<double, size_t>> imu_samples;
+  imu_samples.reserve(telemetry_data.accelerometer.size());
   for (size_t i = 0; i < telemetry_data.accelerometer.size(); ++i) {
-    const double t =
-        telemetry_data.accelerometer[i].timestamp_s() + time_offset_imu_to_cam;
+    const double t = telemetry_data.accelerometer[i].timestamp_s() +
+                     time_offset_imu_to_cam_s_;
     if (t < t0_s_ || t >= tend_s_) continue;
-    gyro_measurements_[t] = telemetry_data.gyroscope[i].data();
-    accl_measurements_[t] = telemetry_data.accelerometer[i].data();
-    if (!trajectory_.AddAccelerometerMeasurement(
-            telemetry_data.accelerometer[i].data(),
-            t * S_TO_NS,
-            1. / spline_weight_data.std_r3)) {
-      std::cerr << "Failed to add accelerometer measurement at time: " << t
-                << "\n";
+    imu_samples.emplace_back(t, i);
+  }
+  const auto earlier = [](const std::pair<double, size_t>& a,
+                          const std::pair<double, size_t>& b) {
+    return a.first < b.first;
+  };
+  if (!std::is_sorted(imu_samples.begin(), imu_samples.end(), earlier)) {
+    std::stable_sort(imu_samples.begin(), imu_samples.end(), earlier);
+  }
+  imu_timestamps_s_.clear();
+  gyro_measurements_.clear();
+  accl_measurements_.clear();
+  imu_timestamps_s_.reserve(imu_samples.size());
+  gyro_measurements_.reserve(imu_samples.size());
+  accl_measurements_.reserve(imu_samples.size());
+  for (size_t j = 0; j < imu_samples.size(); ++j) {
+    // for duplicated timestamps only the last sample is kept
+    if (j + 1 < imu_samples.size() &&
+        imu_samples[j + 1].first == imu_samples[j].first) {
+      continue;
     }
-    if (!trajectory_.AddGyroscopeMeasurement(telemetry_data.gyroscope[i].data(),
-                                             t * S_TO_NS,
-                                             1. / spline_weight_data.std_so3)) {
-      std::cerr << "Failed to add gyroscope measurement at time: " << t << "\n";
+    const size_t i = imu_samples[j].second;
+    imu_timestamps_s_.push_back(imu_samples[j].first);
+    gyro_measurements_.push_back(telemetry_data.gyroscope[i].data());
+    accl_measurements_.push_back(telemetry_data.accelerometer[i].data());
+  }
+  DecimateImuMeasurements();
+  imu_times_ns_.resize(imu_timestamps_s_.size());
+  for (size_t i = 0; i < imu_timestamps_s_.size(); ++i) {
+    imu_times_ns_[i] = SecondsToNs(imu_timestamps_s_[i]);
+  }
+
+  if (fit_knots_to_poses_) {
+    if (!trajectory_.FitKnotsToVisPoses(knot_fit_options_,
+                                        imu_times_ns_,
+                                        gyro_measurements_,
+                                        spline_weight_data_.std_so3)) {
+      LOG(WARNING) << "Knot fit to the vision poses failed";
     }
   }
-  LOG(INFO) << "Added all IMU measurements to the spline estimator";
+
+  if (AddsMeasurementsPerSweep()) {
+    LOG(INFO) << "Measurements are added by every optimization sweep";
+  } else {
+    AddMeasurementsInTimeOrder(trajectory_);
+  }
 
   InitializeGravity(telemetry_data);
 }
 
+int ImuCameraCalibrator::AddRigCamera(
+    std::shared_ptr<theia::Reconstruction> vision_dataset,
+    const Sophus::SE3<double>& T_i_c_init,
+    const double initial_line_delay,
+    const double time_offset_s) {
+  RigCameraData rig_camera;
+  for (const theia::ViewId view_id : vision_dataset->ViewIds()) {
+    rig_camera.timestamps.push_back(
+        vision_dataset->View(view_id)->GetTimestamp());
+  }
+  std::sort(rig_camera.timestamps.begin(), rig_camera.timestamps.end());
+  rig_camera.time_offset_s = time_offset_s;
+  rig_camera.rolling_shutter = initial_line_delay != 0.0;
+  rig_camera.camera = trajectory_.AddRigCamera(
+      vision_dataset, T_i_c_init, initial_line_delay, time_offset_s);
+  rig_camera.image_data = std::move(vision_dataset);
+  LOG(INFO) << "Added rig camera " << rig_camera.camera << " with "
+            << rig_camera.timestamps.size() << " views";
+  rig_cameras_.push_back(std::move(rig_camera));
+  return rig_cameras_.back().camera;
+}
+
+bool ImuCameraCalibrator::AddRigCameraFromFiles(
+    const std::string& input_corners,
+    const std::string& input_pose_dataset,
+    const std::string& camera_calibration_json,
+    const std::string& imu_rotation_init,
+    const double time_offset_imu_to_cam,
+    const bool global_shutter) {
+  io::MappedScene scene;
+  if (!scene.Open(input_corners)) {
+    LOG(ERROR) << "Could not load " << input_corners;
+    return false;
+  }
+  theia::Reconstruction pose_dataset;
+  if (!theia::ReadReconstruction(input_pose_dataset, &pose_dataset)) {
+    LOG(ERROR) << "Could not read " << input_pose_dataset;
+    return false;
+  }
+  theia::Camera camera;
+  double fps;
+  if (!io::read_camera_calibration(camera_calibration_json, camera, fps)) {
+    LOG(ERROR) << "Could not read " << camera_calibration_json;
+    return false;
+  }
+  Eigen::Quaterniond imu2cam;
+  double camera_time_offset_imu_to_cam;
+  if (!io::ReadIMU2CamInit(
+          imu_rotation_init, imu2cam, camera_time_offset_imu_to_cam)) {
+    LOG(ERROR) << "Could not read " << imu_rotation_init;
+    return false;
+  }
+  auto vision_dataset = std::make_shared<theia::Reconstruction>();
+  if (!SplineDatasetFromPoseDataset(
+          pose_dataset, scene, camera, *vision_dataset)) {
+    return false;
+  }
+  const double line_delay_s =
+      global_shutter ? 0.0 : 1. / fps / camera.ImageHeight();
+  // both cameras are related to the imu clock by their own offset
+  const Sophus::SE3<double> T_i_c_init(imu2cam.conjugate(),
+                                       Eigen::Vector3d(0, 0, 0));
+  AddRigCamera(vision_dataset,
+               T_i_c_init,
+               line_delay_s,
+               time_offset_imu_to_cam - camera_time_offset_imu_to_cam);
+  return true;
+}
+
+bool ImuCameraCalibrator::SetWarmStartSplineState(const std::string& path) {
+  auto state = std::make_unique<io::SplineState>();
+  if (!io::ReadSplineState(path, *state)) {
+    return false;
+  }
+  warm_start_state_ = std::move(state);
+  return true;
+}
+
+bool ImuCameraCalibrator::SaveSplineState(const std::string& path) const {
+  io::SplineState state;
+  trajectory_.GetState(state);
+  return io::WriteSplineState(path, state);
+}
+
+bool ImuCameraCalibrator::LoadSplineState(const std::string& path) {
+  io::SplineState state;
+  if (!io::ReadSplineState(path, state)) {
+    return false;
+  }
+  // states are saved with the finest knot spacing, skip the coarser levels
+  if (current_knot_level_ > 0) {
+    current_knot_level_ = 0;
+    trajectory_.ResampleKnots(KnotSpacingNs(spline_weight_data_.dt_so3),
+                              KnotSpacingNs(spline_weight_data_.dt_r3));
+    nr_knots_so3_ = trajectory_.GetNumSO3Knots();
+    nr_knots_r3_ = trajectory_.GetNumR3Knots();
+    if (!AddsMeasurementsPerSweep()) {
+      AddMeasurementsInTimeOrder(trajectory_);
+    }
+  }
+  return trajectory_.SetState(state);
+}
+
 void ImuCameraCalibrator::SetKnownGravityDir(const Eigen::Vector3d& gravity) {
   trajectory_.SetGravity(gravity);
 }
@@ -131,8 +344,8 @@ void ImuCameraCalibrator::SetKnownGravityDir(const Eigen::Vector3d& gravity) {
 void ImuCameraCalibrator::InitializeGravity(
     const OpenICC::CameraTelemetryData& telemetry_data) {
   for (size_t j = 0; j < cam_timestamps_.size(); ++j) {
-    const theia::View* v =
-        image_data_.View(image_data_.ViewIdFromTimestamp(cam_timestamps_[j]));
+    const theia::View* v = image_data_->View(
+        image_data_->ViewIdFromTimestamp(cam_timestamps_[j]));
     if (!v) {
       continue;
     }
@@ -161,20 +374,637 @@ void ImuCameraCalibrator::InitializeGravity(
   trajectory_.SetGravity(gravity_init_);
 }
 
+void ImuCameraCalibrator::DecimateImuMeasurements() {
+  const size_t n = imu_timestamps_s_.size();
+  if (imu_decimation_rate_hz_ <= 0.0 || n < 2) {
+    return;
+  }
+  const double duration_s = imu_timestamps_s_.back() - imu_timestamps_s_[0];
+  const double imu_rate_hz = (n - 1) / duration_s;
+  const int factor =
+      static_cast<int>(std::round(imu_rate_hz / imu_decimation_rate_hz_));
+  if (factor < 2) {
+    return;
+  }
+  std::vector<double> timestamps_s;
+  vec3_vector gyro, accl;
+  utils::DecimateByBlockAverage(
+      imu_timestamps_s_, gyro_measurements_, factor, timestamps_s, gyro);
+  utils::DecimateByBlockAverage(
+      imu_timestamps_s_, accl_measurements_, factor, timestamps_s, accl);
+  imu_timestamps_s_ = std::move(timestamps_s);
+  gyro_measurements_ = std::move(gyro);
+  accl_measurements_ = std::move(accl);
+  // the mean of factor samples has 1/sqrt(factor) of the noise, so the
+  // residuals keep the information of the samples they replace
+  const double noise_scale = 1.0 / std::sqrt(static_cast<double>(factor));
+  spline_weight_data_.std_so3 *= noise_scale;
+  spline_weight_data_.std_r3 *= noise_scale;
+  LOG(INFO) << "Decimated " << n << " IMU samples at " << imu_rate_hz
+            << "Hz by " << factor << " to " << imu_timestamps_s_.size();
+}
+
+void ImuCameraCalibrator::SearchInitGrid(
+    const OpenICC::CameraTelemetryData& telemetry_data,
+    const ThreeAxisSensorCalibParams<double>& gyro_intrinsics) {
+  utils::ScopedStageTimer stage_timer("ImuCameraCalibrator::SearchInitGrid");
+  const InitGridSearchOptions& options = init_grid_search_options_;
+  // the initial value comes first, so a tie keeps it
+  const auto candidates =
+      [](const double initial, const double min, const double max, int num) {
+        std::vector<double> values{initial};
+        for (int i = 0; i < num; ++i) {
+          values.push_back(min + (max - min) * i / std::max(num - 1, 1));
+        }
+        return values;
+      };
+  const auto best_candidate = [](const std::vector<double>& errors) {
+    return std::min_element(errors.begin(), errors.end()) - errors.begin();
+  };
+
+  // the line delay only changes the reprojection errors and the time offset
+  // only the gyroscope errors on the fixed spline, so the best pair of the
+  // grid follows from the best candidate of each axis
+  if (inital_cam_line_delay_s_ != 0.0 && options.num_line_delays > 1) {
+    const std::vector<double> line_delays =
+        candidates(inital_cam_line_delay_s_,
+                   options.line_delay_min_factor * inital_cam_line_delay_s_,
+                   options.line_delay_max_factor * inital_cam_line_delay_s_,
+                   options.num_line_delays);
+    const std::vector<double> errors =
+        trajectory_.EvaluateLineDelays(line_delays, options.view_stride);
+    const size_t best = best_candidate(errors);
+    if (errors[best] < std::numeric_limits<double>::max()) {
+      std::cout << "Grid search line delay: " << line_delays[best] * S_TO_US
+                << "us, reprojection error " << errors[0] << " -> "
+                << errors[best] << "px\n";
+      inital_cam_line_delay_s_ = line_delays[best];
+      trajectory_.SetCameraLineDelay(inital_cam_line_delay_s_);
+    }
+  }
+
+  if (options.num_time_offsets > 1) {
+    // every candidate evaluates the same samples inside the spline
+    const double range_s = std::abs(options.time_offset_range_s);
+    const size_t stride = std::max(options.gyro_stride, 1);
+    std::vector<double> timestamps_s;
+    vec3_vector gyro_measurements;
+    for (size_t i = 0; i < telemetry_data.gyroscope.size(); i += stride) {
+      const double t =
+          telemetry_data.gyroscope[i].timestamp_s() + time_offset_imu_to_cam_s_;
+      if (t - range_s < t0_s_ || t + range_s >= tend_s_) continue;
+      timestamps_s.push_back(t);
+      gyro_measurements.push_back(telemetry_data.gyroscope[i].data());
+    }
+    const std::vector<double> offsets =
+        candidates(0.0, -range_s, range_s, options.num_time_offsets);
+    const std::vector<double> errors = trajectory_.EvaluateGyroTimeOffsets(
+        offsets, timestamps_s, gyro_measurements, gyro_intrinsics);
+    const size_t best = best_candidate(errors);
+    if (errors[best] < std::numeric_limits<double>::max()) {
+      time_offset_imu_to_cam_s_ += offsets[best];
+      std::cout << "Grid search time offset imu to camera: "
+                << time_offset_imu_to_cam_s_ << "s, gyroscope error "
+                << errors[0] << " -> " << errors[best] << "rad/s\n";
+    }
+  }
+}
+
+void ImuCameraCalibrator::SelectSplineViews() {
+  spline_cam_timestamps_ = cam_timestamps_;
+  const size_t num_views = cam_timestamps_.size();
+  const double interval_s =
+      std::min(spline_weight_data_.dt_so3, spline_weight_data_.dt_r3);
+  if (max_views_per_knot_interval_ <= 0 || num_views < 3 ||
+      interval_s <= 0.0) {
+    return;
+  }
+
+  // image cells covered by the corners, pose and motion of every view
+  const int n_cells = SPLINE_VIEW_GRID_CELLS;
+  std::vector<std::vector<int>> view_cells(num_views);
+  std::vector<double> num_features(num_views);
+  std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d>>
+      view_rotations(num_views);
+  vec3_vector view_positions(num_views);
+  for (size_t v = 0; v < num_views; ++v) {
+    const theia::View* view =
+        image_data_->View(image_data_->ViewIdFromTimestamp(cam_timestamps_[v]));
+    const theia::Camera& cam = view->Camera();
+    const double cell_w = cam.ImageWidth() / static_cast<double>(n_cells);
+    const double cell_h = cam.ImageHeight() / static_cast<double>(n_cells);
+    for (const theia::TrackId t_id : view->TrackIds()) {
+      const Eigen::Vector2d& pt = view->GetFeature(t_id)->point_;
+      const int cx = std::min(n_cells - 1, std::max(0, int(pt[0] / cell_w)));
+      const int cy = std::min(n_cells - 1, std::max(0, int(pt[1] / cell_h)));
+      view_cells[v].push_back(cy * n_cells + cx);
+    }
+    std::sort(view_cells[v].begin(), view_cells[v].end());
+    view_cells[v].erase(std::unique(view_cells[v].begin(), view_cells[v].end()),
+                        view_cells[v].end());
+    num_features[v] = view->NumFeatures();
+    view_rotations[v] = cam.GetOrientationAsRotationMatrix();
+    view_positions[v] = cam.GetPosition();
+  }
+
+  // angular and linear speed from the neighboring views, each normalized by
+  // its median over the recording
+  std::vector<double> rot_speed(num_views), trans_speed(num_views);
+  for (size_t v = 0; v < num_views; ++v) {
+    const size_t prev = v > 0 ? v - 1 : v;
+    const size_t next = v + 1 < num_views ? v + 1 : v;
+    const double dt = cam_timestamps_[next] - cam_timestamps_[prev];
+    if (dt <= 0.0) continue;
+    const Eigen::AngleAxisd diff(view_rotations[next] *
+                                 view_rotations[prev].transpose());
+    rot_speed[v] = std::abs(diff.angle()) / dt;
+    trans_speed[v] = (view_positions[next] - view_positions[prev]).norm() / dt;
+  }
+  const auto median = [](std::vector<double> values) {
+    std::nth_element(
+        values.begin(), values.begin() + values.size() / 2, values.end());
+    return std::max(values[values.size() / 2], 1e-9);
+  };
+  const double median_rot_speed = median(rot_speed);
+  const double median_trans_speed = median(trans_speed);
+  const double max_features =
+      *std::max_element(num_features.begin(), num_features.end());
+
+  // greedy selection inside every knot interval, the cell counts start over
+  // in each interval
+  std::vector<double> selected;
+  std::vector<int> cell_obs(n_cells * n_cells);
+  std::vector<bool> taken(num_views);
+  for (size_t first = 0; first < num_views;) {
+    const int interval =
+        static_cast<int>((cam_timestamps_[first] - t0_s_) / interval_s);
+    size_t last = first;
+    while (last < num_views &&
+           static_cast<int>((cam_timestamps_[last] - t0_s_) / interval_s) ==
+               interval) {
+      ++last;
+    }
+    std::fill(cell_obs.begin(), cell_obs.end(), 0);
+    const int budget = std::min<int>(max_views_per_knot_interval_,
+                                     static_cast<int>(last - first));
+    for (int k = 0; k < budget; ++k) {
+      double best_score = -1.0;
+      size_t best_v = first;
+      for (size_t v = first; v < last; ++v) {
+        if (taken[v]) continue;
+        double coverage_gain = 0.0;
+        for (const int c : view_cells[v]) {
+          coverage_gain += 1.0 / (1.0 + cell_obs[c]);
+        }
+        const double excitation = rot_speed[v] / median_rot_speed +
+                                  trans_speed[v] / median_trans_speed;
+        const double score = coverage_gain *
+                             std::sqrt(num_features[v] / max_features) *
+                             (1.0 + std::min(excitation, 4.0));
+        if (score > best_score) {
+          best_score = score;
+          best_v = v;
+        }
+      }
+      taken[best_v] = true;
+      selected.push_back(cam_timestamps_[best_v]);
+      for (const int c : view_cells[best_v]) ++cell_obs[c];
+    }
+    first = last;
+  }
+  std::sort(selected.begin(), selected.end());
+  spline_cam_timestamps_ = selected;
+  LOG(INFO) << "Selected " << spline_cam_timestamps_.size() << " of "
+            << num_views << " views with at most "
+            << max_views_per_knot_interval_ << " per " << interval_s
+            << "s knot interval.";
+}
+
+void ImuCameraCalibrator::AddVisionMeasurements(
+    const double start_s,
+    const double end_s,
+    SplineTrajectoryEstimator<SPLINE_N>& trajectory,
+    const int stride) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::AddVisionMeasurements");
+  VLOG(1) << "Adding Vision measurements to spline";
+  theia::Timer timer;
+  const int num_residual_blocks = trajectory.GetNumResidualBlocks();
+  std::vector<const theia::View*> views;
+  size_t num_in_range = 0;
+  for (const double t : spline_cam_timestamps_) {
+    if (t < start_s || t >= end_s || num_in_range++ % stride != 0) continue;
+    const theia::View* view =
+        image_data_->View(image_data_->ViewIdFromTimestamp(t));
+    if (view) {
+      views.push_back(view);
+    }
+  }
+  stage_timer.AddItems(views.size());
+  // rolling shutter camera if a line delay is set
+  trajectory.AddCameraMeasurements(views, inital_cam_line_delay_s_ != 0.0, 0.0);
+  // the rig cameras keep all of their views
+  for (const RigCameraData& rig_camera : rig_cameras_) {
+    views.clear();
+    num_in_range = 0;
+    for (const double t : rig_camera.timestamps) {
+      const double t_spline = t + rig_camera.time_offset_s;
+      if (t_spline < start_s || t_spline >= end_s ||
+          num_in_range++ % stride != 0) {
+        continue;
+      }
+      const theia::View* view = rig_camera.image_data->View(
+          rig_camera.image_data->ViewIdFromTimestamp(t));
+      if (view) {
+        views.push_back(view);
+      }
+    }
+    stage_timer.AddItems(views.size());
+    trajectory.AddCameraMeasurements(
+        views, rig_camera.rolling_shutter, 0.0, rig_camera.camera);
+  }
+  VLOG(1) << "Added "
+          << trajectory.GetNumResidualBlocks() - num_residual_blocks
+          << " Vision residual blocks to the spline estimator in "
+          << timer.ElapsedTimeInSeconds() << "s";
+}
+
+void ImuCameraCalibrator::AddImuMeasurements(
+    const double start_s,
+    const double end_s,
+    SplineTrajectoryEstimator<SPLINE_N>& trajectory,
+    const int stride) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::AddImuMeasurements");
+  VLOG(1) << "Adding IMU measurements to spline";
+  theia::Timer timer;
+  const int num_residual_blocks = trajectory.GetNumResidualBlocks();
+  const size_t first = std::lower_bound(imu_timestamps_s_.begin(),
+                                        imu_timestamps_s_.end(),
+                                        start_s) -
+                       imu_timestamps_s_.begin();
+  const size_t last = std::lower_bound(imu_timestamps_s_.begin(),
+                                       imu_timestamps_s_.end(),
+                                       end_s) -
+                      imu_timestamps_s_.begin();
+
+  stage_timer.AddItems((last - first + stride - 1) / stride);
+
+  // without the R3 spline the accelerometer residuals are left out
+  const bool use_imu_preintegration =
+      use_imu_preintegration_ && !rotation_only_;
+  const bool fuse_imu_residuals = fuse_imu_residuals_ && !rotation_only_;
+  vec3_vector accl_batch, gyro_batch;
+  std::vector<int64_t> times_ns_batch;
+  for (size_t i = first; i < last; i += stride) {
+    const double t = imu_timestamps_s_[i];
+    const int64_t t_ns = imu_times_ns_[i];
+    if (batch_imu_residuals_ || use_imu_preintegration) {
+      accl_batch.push_back(accl_measurements_[i]);
+      gyro_batch.push_back(gyro_measurements_[i]);
+      times_ns_batch.push_back(t_ns);
+      continue;
+    }
+    if (fuse_imu_residuals) {
+      if (!trajectory.AddImuMeasurement(accl_measurements_[i],
+                                        gyro_measurements_[i],
+                                        t_ns,
+                                        1. / spline_weight_data_.std_so3,
+                                        1. / spline_weight_data_.std_r3)) {
+        std::cerr << "Failed to add IMU measurement at time: " << t << "\n";
+      }
+      continue;
+    }
+    if (!rotation_only_ &&
+        !trajectory.AddAccelerometerMeasurement(
+            accl_measurements_[i],
+            t_ns,
+            1. / spline_weight_data_.std_r3)) {
+      std::cerr << "Failed to add accelerometer measurement at time: " << t
+                << "\n";
+    }
+    if (!trajectory.AddGyroscopeMeasurement(
+            gyro_measurements_[i],
+            t_ns,
+            1. / spline_weight_data_.std_so3)) {
+      std::cerr << "Failed to add gyroscope measurement at time: " << t << "\n";
+    }
+  }
+  if (use_imu_preintegration) {
+    if (!trajectory.AddImuPreintegrationMeasurements(
+            accl_batch,
+            gyro_batch,
+            times_ns_batch,
+            1. / spline_weight_data_.std_so3,
+            1. / spline_weight_data_.std_r3)) {
+      std::cerr << "Failed to add some preintegrated IMU measurements.\n";
+    }
+  } else if (batch_imu_residuals_ && fuse_imu_residuals) {
+    if (!trajectory.AddImuMeasurements(accl_batch,
+                                       gyro_batch,
+                                       times_ns_batch,
+                                       1. / spline_weight_data_.std_so3,
+                                       1. / spline_weight_data_.std_r3)) {
+      std::cerr << "Failed to add some IMU measurements.\n";
+    }
+  } else if (batch_imu_residuals_) {
+    if (!rotation_only_ &&
+        !trajectory.AddAccelerometerMeasurements(
+            accl_batch, times_ns_batch, 1. / spline_weight_data_.std_r3)) {
+      std::cerr << "Failed to add some accelerometer measurements.\n";
+    }
+    if (!trajectory.AddGyroscopeMeasurements(
+            gyro_batch, times_ns_batch, 1. / spline_weight_data_.std_so3)) {
+      std::cerr << "Failed to add some gyroscope measurements.\n";
+    }
+  }
+  VLOG(1) << "Added "
+          << trajectory.GetNumResidualBlocks() - num_residual_blocks
+          << " IMU residual blocks to the spline estimator in "
+          << timer.ElapsedTimeInSeconds() << "s";
+}
+
+void ImuCameraCalibrator::AddMeasurementsInTimeOrder(
+    SplineTrajectoryEstimator<SPLINE_N>& trajectory) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::AddMeasurementsInTimeOrder");
+  theia::Timer timer;
+  const int num_residual_blocks = trajectory.GetNumResidualBlocks();
+  const double block_s = SPLINE_TIME_ORDER_BLOCK_KNOTS *
+                         KnotSpacingNs(spline_weight_data_.dt_so3) * NS_TO_S;
+  for (double start_s = t0_s_; start_s < tend_s_; start_s += block_s) {
+    // the last block also takes the views after the imu samples
+    const double end_s = start_s + block_s < tend_s_
+                             ? start_s + block_s
+                             : std::numeric_limits<double>::max();
+    AddVisionMeasurements(start_s, end_s, trajectory);
+    AddImuMeasurements(start_s, std::min(end_s, tend_s_), trajectory);
+  }
+  LOG(INFO) << "Added "
+            << trajectory.GetNumResidualBlocks() - num_residual_blocks
+            << " residual blocks in time order in "
+            << timer.ElapsedTimeInSeconds() << "s";
+}
+
+int64_t ImuCameraCalibrator::KnotSpacingNs(const double dt_s) const {
+  return SecondsToNs(dt_s) * (int64_t(1) << current_knot_level_);
+}
+
 double ImuCameraCalibrator::Optimize(const int iterations,
                                      const int optim_flags) {
+  optimized_flags_ |= optim_flags;
+  // coarse to fine, every level is initialized with the coarser solution
+  for (; current_knot_level_ > 0; --current_knot_level_) {
+    OptimizeSpline(iterations, optim_flags);
+
+    const int64_t dt_so3_ns = KnotSpacingNs(spline_weight_data_.dt_so3) / 2;
+    const int64_t dt_r3_ns = KnotSpacingNs(spline_weight_data_.dt_r3) / 2;
+    trajectory_.ResampleKnots(dt_so3_ns, dt_r3_ns);
+    nr_knots_so3_ = trajectory_.GetNumSO3Knots();
+    nr_knots_r3_ = trajectory_.GetNumR3Knots();
+    std::cout << "Refined knot spacing r3/so3 to " << dt_r3_ns * NS_TO_S
+              << "/" << dt_so3_ns * NS_TO_S << "s.\n";
+
+    if (!AddsMeasurementsPerSweep()) {
+      AddMeasurementsInTimeOrder(trajectory_);
+    }
+  }
+  return OptimizeSpline(iterations, optim_flags);
+}
+
+double ImuCameraCalibrator::OptimizeSpline(const int iterations,
+                                           const int optim_flags) {
+  utils::ScopedStageTimer stage_timer("ImuCameraCalibrator::OptimizeSpline");
+  stage_timer.AddItems(trajectory_.GetNumResidualBlocks());
+  if (fixed_lag_window_s_ > 0.0) {
+    return OptimizeFixedLag(iterations, optim_flags);
+  }
+  if (decomposition_segment_s_ > 0.0) {
+    return OptimizeDecomposed(iterations, optim_flags);
+  }
+  if (gate_outliers_ && spline_solved_) {
+    trajectory_.GateOutliers(outlier_gating_options_);
+  }
+  if (!spline_solved_) {
+    OptimizeGraduatedLoss(optim_flags);
+  }
   ceres::Solver::Summary summary =
       trajectory_.Optimize(iterations, optim_flags);
+  spline_solved_ = true;
+  return trajectory_.GetMeanReprojectionError();
+}
+
+void ImuCameraCalibrator::OptimizeGraduatedLoss(const int optim_flags) {
+  if (graduated_loss_widths_px_.empty()) {
+    return;
+  }
+  // the residuals share one loss, changing its width keeps the problem
+  for (size_t i = 0; i + 1 < graduated_loss_widths_px_.size(); ++i) {
+    trajectory_.SetCameraLossWidth(graduated_loss_widths_px_[i]);
+    const ceres::Solver::Summary summary =
+        trajectory_.Optimize(graduated_loss_iterations_, optim_flags);
+    std::cout << "Graduated camera loss stage " << i << " (width "
+              << graduated_loss_widths_px_[i] << "px) took "
+              << summary.iterations.size() << " iterations, mean "
+              << "reprojection error "
+              << trajectory_.GetMeanReprojectionError() << "px.\n";
+  }
+  trajectory_.SetCameraLossWidth(graduated_loss_widths_px_.back());
+}
+
+double ImuCameraCalibrator::OptimizeFixedLag(const int iterations,
+                                             const int optim_flags) {
+  // every sweep starts from an empty problem, the knots keep their values
+  trajectory_.ClearMeasurements();
+  double added_until_s = t0_s_;
+  for (double window_start_s = t0_s_; window_start_s < tend_s_;
+       window_start_s += fixed_lag_step_s_) {
+    const double window_end_s =
+        std::min(window_start_s + fixed_lag_window_s_, tend_s_);
+    const bool last_window = window_end_s >= tend_s_;
+    // only add the measurements that entered the window since the last step
+    const double add_until_s =
+        last_window ? std::numeric_limits<double>::max() : window_end_s;
+    AddVisionMeasurements(added_until_s, add_until_s, trajectory_);
+    AddImuMeasurements(added_until_s, add_until_s, trajectory_);
+    added_until_s = add_until_s;
+
+    trajectory_.Optimize(iterations,
+                         optim_flags,
+                         SecondsToNs(window_start_s),
+                         SecondsToNs(window_end_s));
+    if (last_window) {
+      break;
+    }
+  }
+  return trajectory_.GetMeanReprojectionError();
+}
+
+void ImuCameraCalibrator::AppendMeasurements(
+    const std::vector<theia::ViewId>& view_ids,
+    const OpenICC::CameraTelemetryData& telemetry_data) {
+  const theia::View* newest_view = nullptr;
+  for (const theia::ViewId view_id : view_ids) {
+    const theia::View* view = image_data_->View(view_id);
+    if (!view || view->GetTimestamp() <= tend_s_) {
+      continue;
+    }
+    cam_timestamps_.push_back(view->GetTimestamp());
+    spline_cam_timestamps_.push_back(view->GetTimestamp());
+    tend_s_ = view->GetTimestamp();
+    newest_view = view;
+  }
+  // samples after tend_s_ are stored too, AddImuMeasurements stops there
+  for (size_t i = 0; i < telemetry_data.accelerometer.size(); ++i) {
+    const double t = telemetry_data.accelerometer[i].timestamp_s() +
+                     time_offset_imu_to_cam_s_;
+    if (t < t0_s_ ||
+        (!imu_timestamps_s_.empty() && t <= imu_timestamps_s_.back())) {
+      continue;
+    }
+    imu_timestamps_s_.push_back(t);
+    imu_times_ns_.push_back(SecondsToNs(t));
+    gyro_measurements_.push_back(telemetry_data.gyroscope[i].data());
+    accl_measurements_.push_back(telemetry_data.accelerometer[i].data());
+  }
+  if (!newest_view) {
+    return;
+  }
+  // the new knots start at the newest vision pose
+  const auto q_w_c = Eigen::Quaterniond(
+      newest_view->Camera().GetOrientationAsRotationMatrix().transpose());
+  const Sophus::SE3d T_w_i =
+      Sophus::SE3d(q_w_c, newest_view->Camera().GetPosition()) *
+      trajectory_.GetT_i_c().inverse();
+  const int64_t end_t_ns =
+      SecondsToNs(tend_s_ + 0.01 + inital_cam_line_delay_s_);
+  trajectory_.ExtendKnots(end_t_ns, T_w_i);
+  nr_knots_so3_ = trajectory_.GetNumSO3Knots();
+  nr_knots_r3_ = trajectory_.GetNumR3Knots();
+}
+
+double ImuCameraCalibrator::OptimizeLatestWindow(const int iterations,
+                                                 const int optim_flags) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::OptimizeLatestWindow");
+  optimized_flags_ |= optim_flags;
+  trajectory_.ClearMeasurements();
+  const double window_start_s =
+      fixed_lag_window_s_ > 0.0
+          ? std::max(t0_s_, tend_s_ - fixed_lag_window_s_)
+          : t0_s_;
+  AddVisionMeasurements(
+      window_start_s, std::numeric_limits<double>::max(), trajectory_);
+  AddImuMeasurements(window_start_s, tend_s_, trajectory_);
+  stage_timer.AddItems(trajectory_.GetNumResidualBlocks());
+  trajectory_.Optimize(iterations,
+                       optim_flags,
+                       SecondsToNs(window_start_s),
+                       SecondsToNs(tend_s_));
+  spline_solved_ = true;
+  return trajectory_.GetMeanReprojectionError();
+}
+
+double ImuCameraCalibrator::OptimizeDecomposed(const int iterations,
+                                               const int optim_flags) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::OptimizeDecomposed");
+  // the owned knots of a segment only see all of their measurements if the
+  // overlap covers the spline support
+  const double support_s = SPLINE_N *
+                           std::max(KnotSpacingNs(spline_weight_data_.dt_so3),
+                                    KnotSpacingNs(spline_weight_data_.dt_r3)) *
+                           NS_TO_S;
+  const double overlap_s = std::max(decomposition_overlap_s_, support_s);
+
+  std::vector<std::pair<double, double>> segments;
+  for (double start_s = t0_s_; start_s < tend_s_;
+       start_s += decomposition_segment_s_) {
+    segments.emplace_back(start_s, start_s + decomposition_segment_s_);
+  }
+  if (segments.empty()) {
+    return trajectory_.GetMeanReprojectionError();
+  }
+  // the last segment also owns the knots after the last camera timestamp
+  segments.back().second = std::numeric_limits<double>::max();
+  stage_timer.AddItems(segments.size() * decomposition_rounds_);
+
+  const int num_threads = trajectory_.GetNumThreads();
+  const int threads_per_segment =
+      std::max<int>(1, num_threads / segments.size());
+  const int shared_flags = optim_flags & ~SplineOptimFlags::SPLINE;
+
+  for (int round = 0; round < decomposition_rounds_; ++round) {
+    LOG(INFO) << "Decomposition round " << round + 1 << "/"
+              << decomposition_rounds_ << ": solving " << segments.size()
+              << " segments";
+    // segments start from the spline of the last round and write the knots
+    // they own into a copy of it, so they never read each other's knots
+    SplineTrajectoryEstimator<SPLINE_N> solved;
+    solved.CopyStateFrom(trajectory_);
+    utils::ParallelFor(
+        segments.size(), num_threads, [&](size_t begin, size_t end, int) {
+          for (size_t i = begin; i < end; ++i) {
+            SplineTrajectoryEstimator<SPLINE_N> segment;
+            segment.CopyStateFrom(trajectory_);
+            segment.SetNumThreads(threads_per_segment);
+            // the points are constant here, baking them into the residuals
+            // keeps the segments off the shared reconstruction
+            segment.SetRigidBoard(true);
+            AddVisionMeasurements(segments[i].first - overlap_s,
+                                  segments[i].second + overlap_s,
+                                  segment);
+            AddImuMeasurements(segments[i].first - overlap_s,
+                               segments[i].second + overlap_s,
+                               segment);
+            segment.Optimize(iterations, SplineOptimFlags::SPLINE);
+
+            // the first and the last segment also own the knots before and
+            // after them
+            const int64_t start_ns =
+                i == 0 ? std::numeric_limits<int64_t>::min()
+                       : SecondsToNs(segments[i].first);
+            const int64_t end_ns =
+                i + 1 == segments.size()
+                    ? std::numeric_limits<int64_t>::max()
+                    : SecondsToNs(segments[i].second);
+            solved.CopyKnotsFrom(segment, start_ns, end_ns);
+          }
+        });
+    trajectory_.CopyKnotsFrom(solved,
+                              std::numeric_limits<int64_t>::min(),
+                              std::numeric_limits<int64_t>::max());
+
+    if (shared_flags == 0) {
+      continue;
+    }
+    // reduced global problem for the parameters shared by all segments
+    trajectory_.ClearMeasurements();
+    AddVisionMeasurements(t0_s_,
+                          std::numeric_limits<double>::max(),
+                          trajectory_,
+                          decomposition_sample_stride_);
+    AddImuMeasurements(
+        t0_s_, tend_s_, trajectory_, decomposition_sample_stride_);
+    trajectory_.Optimize(iterations, shared_flags);
+  }
+  // leave the problem empty, the next sweep adds the measurements again
+  trajectory_.ClearMeasurements();
   return trajectory_.GetMeanReprojectionError();
 }
 
 void ImuCameraCalibrator::ToTheiaReconDataset(
     theia::Reconstruction& output_recon) {
-  // convert spline to theia output
+  // convert spline to theia output, the camera timestamps are sorted
+  std::vector<int64_t> times_ns(cam_timestamps_.size());
   for (size_t i = 0; i < cam_timestamps_.size(); ++i) {
-    const int64_t t_ns = cam_timestamps_[i] * S_TO_NS;
-    Sophus::SE3d spline_pose;
-    trajectory_.GetPose(t_ns, spline_pose);
+    times_ns[i] = SecondsToNs(cam_timestamps_[i]);
+  }
+  TrajectorySamples poses;
+  trajectory_.EvaluateTrajectory(times_ns, SAMPLE_POSE, poses);
+  for (size_t i = 0; i < times_ns.size(); ++i) {
+    const int64_t t_ns = times_ns[i];
+    const Sophus::SE3d spline_pose = poses.Pose(i);
     theia::ViewId v_id_theia =
         output_recon.AddView(std::to_string(t_ns), 0, t_ns);
     theia::View* view = output_recon.MutableView(v_id_theia);
@@ -187,11 +1017,336 @@ void ImuCameraCalibrator::ToTheiaReconDataset(
 }
 
 void ImuCameraCalibrator::ClearSpline() {
+  // otherwise a new BatchInitSpline would add every residual a second time
+  trajectory_.ClearMeasurements();
   cam_timestamps_.clear();
+  spline_cam_timestamps_.clear();
+  imu_timestamps_s_.clear();
+  imu_times_ns_.clear();
   gyro_measurements_.clear();
   accl_measurements_.clear();
 }
 
+bool ImuCameraCalibrator::GetImuResidualRms(double& gyro_rms,
+                                            double& accl_rms) {
+  TrajectorySamples samples;
+  if (!trajectory_.EvaluateTrajectory(imu_times_ns_,
+                                      SAMPLE_ANGULAR_VELOCITY |
+                                          SAMPLE_ACCELERATION,
+                                      samples)) {
+    return false;
+  }
+  double gyro_sq_sum = 0.0;
+  double accl_sq_sum = 0.0;
+  size_t num_samples = 0;
+  for (size_t i = 0; i < imu_times_ns_.size(); ++i) {
+    if (!samples.valid[i]) continue;
+    const Eigen::Vector3d gyro =
+        trajectory_.GetGyroIntrinsics(imu_times_ns_[i]).UnbiasNormalize(
+            gyro_measurements_[i]);
+    const Eigen::Vector3d accl =
+        trajectory_.GetAcclIntrinsics(imu_times_ns_[i]).UnbiasNormalize(
+            accl_measurements_[i]);
+    gyro_sq_sum +=
+        (samples.angular_velocity.row(i).transpose() - gyro).squaredNorm();
+    accl_sq_sum +=
+        (samples.acceleration.row(i).transpose() - accl).squaredNorm();
+    ++num_samples;
+  }
+  if (num_samples == 0) {
+    LOG(ERROR) << "No imu sample lies inside the spline";
+    return false;
+  }
+  gyro_rms = std::sqrt(gyro_sq_sum / (3.0 * num_samples));
+  accl_rms = std::sqrt(accl_sq_sum / (3.0 * num_samples));
+  return true;
+}
+
+bool ImuCameraCalibrator::ComputeCalibrationCovariance() {
+  utils::ScopedStageTimer stage_timer(
+      "ImuCameraCalibrator::ComputeCalibrationCovariance");
+  if (AddsMeasurementsPerSweep()) {
+    LOG(WARNING) << "The calibration covariance needs a batch solve, the "
+                    "fixed-lag and decomposed solves keep only one window.";
+    return false;
+  }
+  if (rotation_only_) {
+    LOG(WARNING) << "The calibration covariance is not computed for the "
+                    "rotation only calibration.";
+    return false;
+  }
+  const int groups = optimized_flags_ & (SplineOptimFlags::T_I_C |
+                                         SplineOptimFlags::CAM_LINE_DELAY |
+                                         SplineOptimFlags::IMU_INTRINSICS);
+  const int eliminated_groups =
+      optimized_flags_ &
+      (SplineOptimFlags::SPLINE | SplineOptimFlags::POINTS |
+       SplineOptimFlags::GRAVITY_DIR | SplineOptimFlags::IMU_BIASES |
+       SplineOptimFlags::ACC_BIAS | SplineOptimFlags::GYR_BIAS);
+  covariance_groups_ = groups;
+  if (!trajectory_.CalibrationCovariance(
+          groups, eliminated_groups, calibration_covariance_)) {
+    calibration_covariance_.resize(0, 0);
+    return false;
+  }
+  return true;
+}
+
+bool ImuCameraCalibrator::Bootstrap(const ImuCameraBootstrapOptions& options) {
+  utils::ScopedStageTimer stage_timer("ImuCameraCalibrator::Bootstrap");
+  bootstrap_result_ = ImuCameraBootstrapResult();
+  if (AddsMeasurementsPerSweep()) {
+    LOG(WARNING) << "The bootstrap needs a batch solve, the fixed-lag and "
+                    "decomposed solves keep only one window.";
+    return false;
+  }
+  if (options.num_replicas < 2 || options.block_s <= 0.0 ||
+      optimized_flags_ == 0) {
+    LOG(ERROR) << "The bootstrap needs two or more replicas, a positive "
+                  "block length and an optimized calibration.";
+    return false;
+  }
+  const size_t num_replicas = options.num_replicas;
+  const size_t num_blocks = std::max<size_t>(
+      1, std::ceil((tend_s_ - t0_s_) / options.block_s));
+  stage_timer.AddItems(num_replicas);
+
+  const int num_threads = trajectory_.GetNumThreads();
+  const int threads_per_replica =
+      std::max<int>(1, num_threads / num_replicas);
+  SplineConvergenceCriteria criteria;
+  criteria.min_relative_reprojection_improvement =
+      options.min_relative_reprojection_improvement;
+
+  // T_i_c tangent to the main solution, line delay, imu intrinsics
+  using ReplicaParameters = Eigen::Matrix<double, 22, 1>;
+  const Sophus::SE3d T_c_i = trajectory_.GetT_i_c().inverse();
+  aligned_vector<ReplicaParameters> parameters(num_replicas);
+  std::vector<char> solved(num_replicas, 0);
+  utils::ParallelFor(
+      num_replicas, num_threads, [&](size_t begin, size_t end, int) {
+        for (size_t r = begin; r < end; ++r) {
+          std::mt19937 rng(options.seed + r);
+          std::uniform_int_distribution<size_t> draw(0, num_blocks - 1);
+          std::vector<int> counts(num_blocks, 0);
+          for (size_t b = 0; b < num_blocks; ++b) {
+            ++counts[draw(rng)];
+          }
+
+          SplineTrajectoryEstimator<SPLINE_N> replica;
+          replica.CopyStateFrom(trajectory_);
+          replica.SetNumThreads(threads_per_replica);
+          // keeps the replicas off the shared reconstruction
+          replica.SetRigidBoard(true);
+          replica.SetConvergenceCriteria(criteria);
+          // blocks drawn at least k times are added in pass k, neighbouring
+          // blocks of a pass as one time range
+          const int max_count = *std::max_element(counts.begin(), counts.end());
+          for (int k = 1; k <= max_count; ++k) {
+            size_t b = 0;
+            while (b < num_blocks) {
+              if (counts[b] < k) {
+                ++b;
+                continue;
+              }
+              const size_t first = b;
+              while (b < num_blocks && counts[b] >= k) {
+                ++b;
+              }
+              // the first and the last block also own the views before and
+              // after the IMU samples
+              const double start_s =
+                  first == 0 ? std::numeric_limits<double>::lowest()
+                             : t0_s_ + first * options.block_s;
+              const double end_s = b == num_blocks
+                                       ? std::numeric_limits<double>::max()
+                                       : t0_s_ + b * options.block_s;
+              AddVisionMeasurements(start_s, end_s, replica);
+              AddImuMeasurements(start_s, end_s, replica);
+            }
+          }
+          const ceres::Solver::Summary summary =
+              replica.Optimize(options.max_num_iterations, optimized_flags_);
+          if (!summary.IsSolutionUsable()) {
+            continue;
+          }
+          io::SplineState state;
+          replica.GetState(state);
+          parameters[r] << (T_c_i * state.T_i_c).log(), state.cam_line_delay_s,
+              state.accl_intrinsics, state.gyro_intrinsics;
+          solved[r] = 1;
+        }
+      });
+
+  ReplicaParameters mean = ReplicaParameters::Zero();
+  int num_solved = 0;
+  for (size_t r = 0; r < num_replicas; ++r) {
+    if (solved[r]) {
+      mean += parameters[r];
+      ++num_solved;
+    }
+  }
+  if (num_solved < 2) {
+    LOG(ERROR) << "Only " << num_solved << " of " << num_replicas
+               << " bootstrap replicas were solved.";
+    return false;
+  }
+  mean /= num_solved;
+  ReplicaParameters variance = ReplicaParameters::Zero();
+  for (size_t r = 0; r < num_replicas; ++r) {
+    if (solved[r]) {
+      variance += (parameters[r] - mean).cwiseAbs2();
+    }
+  }
+  const ReplicaParameters std_dev =
+      (variance / (num_solved - 1)).cwiseSqrt();
+  bootstrap_result_.num_replicas = num_solved;
+  bootstrap_result_.T_i_c_std = std_dev.head<6>();
+  bootstrap_result_.line_delay_std_s = std_dev[6];
+  bootstrap_result_.accl_intrinsics_std = std_dev.segment<6>(7);
+  bootstrap_result_.gyro_intrinsics_std = std_dev.tail<9>();
+  LOG(INFO) << "Bootstrap of " << num_solved << " replicas, T_i_c std: "
+            << bootstrap_result_.T_i_c_std.transpose()
+            << " line delay std: " << std_dev[6] * S_TO_US << "us";
+  return true;
+}
+
+bool ImuCameraCalibrator::WriteCalibrationResult(
+    const std::string& output_json,
+    const double reproj_error,
+    const double time_offset_imu_to_cam) {
+  std::ofstream output_json_file(output_json);
+  if (!output_json_file.is_open()) {
+    LOG(ERROR) << "Could not open: " << output_json;
+    return false;
+  }
+  const Eigen::Quaterniond q_i_c =
+      trajectory_.GetT_i_c().so3().unit_quaternion();
+  const Eigen::Vector3d t_i_c = trajectory_.GetT_i_c().translation();
+
+  nlohmann::json results;
+  results["q_i_c"]["w"] = q_i_c.w();
+  results["q_i_c"]["x"] = q_i_c.x();
+  results["q_i_c"]["y"] = q_i_c.y();
+  results["q_i_c"]["z"] = q_i_c.z();
+  results["t_i_c"]["x"] = t_i_c[0];
+  results["t_i_c"]["y"] = t_i_c[1];
+  results["t_i_c"]["z"] = t_i_c[2];
+  results["final_reproj_error"] = reproj_error;
+  results["r3_dt"] = spline_weight_data_.dt_r3;
+  results["so3_dt"] = spline_weight_data_.dt_so3;
+  results["init_line_delay_us"] = inital_cam_line_delay_s_ * S_TO_US;
+  results["calib_line_delay_us"] = GetCalibratedRSLineDelay() * S_TO_US;
+  results["time_offset_imu_to_cam_s"] = time_offset_imu_to_cam;
+
+  // standard deviations from the diagonal of the calibration covariance, its
+  // layout has the T_i_c tangent [translation, rotation] and line delay of
+  // every camera followed by the imu intrinsics
+  const Eigen::VectorXd calib_std =
+      calibration_covariance_.diagonal().cwiseSqrt();
+  const int camera_size =
+      ((covariance_groups_ & SplineOptimFlags::T_I_C) ? Sophus::SE3d::DoF
+                                                      : 0) +
+      ((covariance_groups_ & SplineOptimFlags::CAM_LINE_DELAY) ? 1 : 0);
+  const auto write_camera_std = [&](const int camera, nlohmann::json& out) {
+    if (calib_std.size() == 0) {
+      return;
+    }
+    int offset = camera * camera_size;
+    if (covariance_groups_ & SplineOptimFlags::T_I_C) {
+      out["t_i_c_std"] = {{"x", calib_std[offset]},
+                          {"y", calib_std[offset + 1]},
+                          {"z", calib_std[offset + 2]}};
+      out["r_i_c_std_rad"] = {{"x", calib_std[offset + 3]},
+                              {"y", calib_std[offset + 4]},
+                              {"z", calib_std[offset + 5]}};
+      offset += Sophus::SE3d::DoF;
+    }
+    if (covariance_groups_ & SplineOptimFlags::CAM_LINE_DELAY) {
+      out["calib_line_delay_std_us"] = calib_std[offset] * S_TO_US;
+    }
+  };
+  write_camera_std(0, results);
+  if (calib_std.size() > 0 &&
+      (covariance_groups_ & SplineOptimFlags::IMU_INTRINSICS)) {
+    const int offset = trajectory_.GetNumCameras() * camera_size;
+    results["accl_intrinsics_std"] =
+        std::vector<double>(calib_std.data() + offset,
+                            calib_std.data() + offset + 6);
+    results["gyro_intrinsics_std"] =
+        std::vector<double>(calib_std.data() + offset + 6,
+                            calib_std.data() + offset + 15);
+  }
+  if (bootstrap_result_.num_replicas > 0) {
+    const ImuCameraBootstrapResult& bootstrap = bootstrap_result_;
+    nlohmann::json& out = results["bootstrap"];
+    out["num_replicas"] = bootstrap.num_replicas;
+    out["t_i_c_std"] = {{"x", bootstrap.T_i_c_std[0]},
+                        {"y", bootstrap.T_i_c_std[1]},
+                        {"z", bootstrap.T_i_c_std[2]}};
+    out["r_i_c_std_rad"] = {{"x", bootstrap.T_i_c_std[3]},
+                            {"y", bootstrap.T_i_c_std[4]},
+                            {"z", bootstrap.T_i_c_std[5]}};
+    out["calib_line_delay_std_us"] = bootstrap.line_delay_std_s * S_TO_US;
+    out["accl_intrinsics_std"] =
+        std::vector<double>(bootstrap.accl_intrinsics_std.data(),
+                            bootstrap.accl_intrinsics_std.data() + 6);
+    out["gyro_intrinsics_std"] =
+        std::vector<double>(bootstrap.gyro_intrinsics_std.data(),
+                            bootstrap.gyro_intrinsics_std.data() + 9);
+  }
+  for (const RigCameraData& rig_camera : rig_cameras_) {
+    const Sophus::SE3d T_i_c = trajectory_.GetCameraT_i_c(rig_camera.camera);
+    const Eigen::Quaterniond q = T_i_c.so3().unit_quaternion();
+    nlohmann::json camera_result;
+    camera_result["q_i_c"] = {
+        {"w", q.w()}, {"x", q.x()}, {"y", q.y()}, {"z", q.z()}};
+    camera_result["t_i_c"] = {{"x", T_i_c.translation()[0]},
+                              {"y", T_i_c.translation()[1]},
+                              {"z", T_i_c.translation()[2]}};
+    camera_result["calib_line_delay_us"] =
+        trajectory_.GetCameraLineDelay(rig_camera.camera) * S_TO_US;
+    camera_result["time_offset_s"] = rig_camera.time_offset_s;
+    camera_result["final_reproj_error"] =
+        trajectory_.GetReprojectionErrorStatistics(0.5, 20, rig_camera.camera)
+            .mean_error;
+    write_camera_std(rig_camera.camera, camera_result);
+    results["rig_cameras"].push_back(camera_result);
+  }
+
+  // Evaluate spline for all accelerometer and gyro and output them
+  TrajectorySamples imu_samples;
+  trajectory_.EvaluateTrajectory(
+      imu_times_ns_,
+      SAMPLE_ANGULAR_VELOCITY | SAMPLE_ACCELERATION | SAMPLE_BIASES,
+      imu_samples);
+  for (size_t i = 0; i < imu_times_ns_.size(); ++i) {
+    const int64_t t_ns = imu_times_ns_[i];
+    nlohmann::json& sample = results["trajectory"][std::to_string(t_ns)];
+    const Eigen::Vector3d gyro_spline =
+        imu_samples.angular_velocity.row(i).transpose();
+    const Eigen::Vector3d gyro_bias = imu_samples.gyro_bias.row(i).transpose();
+    const Eigen::Vector3d accl_spline =
+        imu_samples.acceleration.row(i).transpose();
+    const Eigen::Vector3d accl_bias = imu_samples.accl_bias.row(i).transpose();
+    const std::pair<const char*, Eigen::Vector3d> values[] = {
+        {"gyro_imu", gyro_measurements_[i]},
+        {"gyro_spline", gyro_spline},
+        {"gyro_bias", gyro_bias},
+        {"accl_imu", accl_measurements_[i]},
+        {"accl_spline", accl_spline},
+        {"accl_bias", accl_bias}};
+    for (const auto& value : values) {
+      sample[value.first]["x"] = value.second[0];
+      sample[value.first]["y"] = value.second[1];
+      sample[value.first]["z"] = value.second[2];
+    }
+  }
+
+  output_json_file << std::setw(4) << results << std::endl;
+  return true;
+}
+
 void ImuCameraCalibrator::GetIMUIntrinsics(
     ThreeAxisSensorCalibParams<double>& acc_intrinsics,
     ThreeAxisSensorCalibParams<double>& gyr_intrinsics,
@@ -15,10 +15,18 @@
 
 #include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
 
-#include "OpenCameraCalibrator/utils/moving_average.h"
+#include "OpenCameraCalibrator/utils/cross_correlation.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/resample.h"
+#include "OpenCameraCalibrator/utils/smoothing_filter.h"
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <numeric>
+#include <random>
+
 #include "OpenCameraCalibrator/utils/utils.h"
 
 using Eigen::Matrix;
@@ -36,10 +44,165 @@ namespace core {
 constexpr double HUBER_K = 1.345;
 constexpr double HUBER_K2 = HUBER_K * HUBER_K;
 
+namespace {
+
+// Sorts the measurements by timestamp and drops duplicated timestamps,
+// keeping the last measurement like an insertion into a map would
+template <typename Vector>
+void SortByTimestamp(std::vector<double>& timestamps_s, Vector& values) {
+  if (std::is_sorted(timestamps_s.begin(), timestamps_s.end()) &&
+      std::adjacent_find(timestamps_s.begin(), timestamps_s.end()) ==
+          timestamps_s.end()) {
+    return;
+  }
+  std::vector<size_t> order(timestamps_s.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return timestamps_s[a] < timestamps_s[b];
+  });
+  std::vector<double> sorted_timestamps_s;
+  Vector sorted_values;
+  sorted_timestamps_s.reserve(order.size());
+  sorted_values.reserve(order.size());
+  for (const size_t idx : order) {
+    if (!sorted_timestamps_s.empty() &&
+        sorted_timestamps_s.back() == timestamps_s[idx]) {
+      sorted_values.back() = values[idx];
+      continue;
+    }
+    sorted_timestamps_s.push_back(timestamps_s[idx]);
+    sorted_values.push_back(values[idx]);
+  }
+  timestamps_s.swap(sorted_timestamps_s);
+  values.swap(sorted_values);
+}
+
+// Rotation that maps the imu onto the visual angular velocities, H is their
+// centered cross covariance
+Matrix3d RotationFromCrossCovariance(const Matrix3d& H) {
+  Eigen::JacobiSVD<Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+  Matrix3d C;
+  C.setIdentity();
+  if ((svd.matrixV() * svd.matrixU().transpose()).determinant() < 0.0)
+    C(2, 2) = -1.0;
+  return svd.matrixV() * C * svd.matrixU().transpose();
+}
+
+}  // namespace
+
+void ImuToCameraRotationEstimator::SetVisualRotations(
+    const quat_map& visual_rotations) {
+  vis_timestamps_s_.clear();
+  visual_rotations_.clear();
+  vis_timestamps_s_.reserve(visual_rotations.size());
+  visual_rotations_.reserve(visual_rotations.size());
+  for (const auto& vis : visual_rotations) {
+    vis_timestamps_s_.push_back(vis.first);
+    visual_rotations_.push_back(vis.second);
+  }
+}
+
+void ImuToCameraRotationEstimator::SetAngularVelocities(
+    const vec3_map& imu_angular_vel) {
+  imu_timestamps_s_.clear();
+  imu_angular_vel_.clear();
+  imu_timestamps_s_.reserve(imu_angular_vel.size());
+  imu_angular_vel_.reserve(imu_angular_vel.size());
+  for (const auto& imu : imu_angular_vel) {
+    imu_timestamps_s_.push_back(imu.first);
+    imu_angular_vel_.push_back(imu.second);
+  }
+}
+
+void ImuToCameraRotationEstimator::SetVisualRotations(
+    const std::vector<double>& timestamps_s,
+    const quat_vector& visual_rotations) {
+  vis_timestamps_s_ = timestamps_s;
+  visual_rotations_ = visual_rotations;
+  SortByTimestamp(vis_timestamps_s_, visual_rotations_);
+}
+
+void ImuToCameraRotationEstimator::SetAngularVelocities(
+    const std::vector<double>& timestamps_s,
+    const vec3_vector& imu_angular_vel) {
+  imu_timestamps_s_ = timestamps_s;
+  imu_angular_vel_ = imu_angular_vel;
+  SortByTimestamp(imu_timestamps_s_, imu_angular_vel_);
+}
+
+bool ImuToCameraRotationEstimator::SetMeasurementsFromPoseDataset(
+    const theia::Reconstruction& pose_dataset,
+    const CameraTelemetryData& telemetry_data,
+    const Vector3d& gyro_bias,
+    const double t_imu_to_cam,
+    double& imu_dt_s) {
+  if (telemetry_data.gyroscope.size() < 2 || pose_dataset.NumViews() < 2) {
+    LOG(ERROR) << "Not enough gyroscope measurements or views to estimate "
+                  "the imu to camera rotation.";
+    return false;
+  }
+
+  // fill measurementes
+  const size_t n_gyro = telemetry_data.gyroscope.size();
+  imu_timestamps_s_.resize(n_gyro);
+  imu_angular_vel_.resize(n_gyro);
+  for (size_t i = 0; i < n_gyro; ++i) {
+    imu_timestamps_s_[i] =
+        telemetry_data.gyroscope[i].timestamp_s() + t_imu_to_cam;
+    imu_angular_vel_[i] = telemetry_data.gyroscope[i].data() - gyro_bias;
+  }
+  SortByTimestamp(imu_timestamps_s_, imu_angular_vel_);
+
+  // get mean hz imu
+  imu_dt_s = 0.0;
+  for (size_t i = 1; i < telemetry_data.gyroscope.size(); ++i) {
+    imu_dt_s += telemetry_data.gyroscope[i].timestamp_s() -
+                telemetry_data.gyroscope[i - 1].timestamp_s();
+  }
+  imu_dt_s /= static_cast<double>(telemetry_data.gyroscope.size() - 1);
+  LOG(INFO) << "Mean IMU data rate: " << 1. / imu_dt_s << "Hz";
+
+  const std::vector<theia::ViewId> view_ids = pose_dataset.ViewIds();
+  std::vector<double> tVis_missing_frames;
+  quat_vector visual_rotations_missing_frames;
+  tVis_missing_frames.reserve(view_ids.size());
+  visual_rotations_missing_frames.reserve(view_ids.size());
+  for (const theia::ViewId view_id : view_ids) {
+    const theia::View* view = pose_dataset.View(view_id);
+    tVis_missing_frames.push_back(view->GetTimestamp());
+    // cam to world trafo, so transposed rotation matrix
+    visual_rotations_missing_frames.push_back(
+        Quaterniond(view->Camera().GetOrientationAsRotationMatrix()));
+  }
+  SortByTimestamp(tVis_missing_frames, visual_rotations_missing_frames);
+
+  // get mean hz camera
+  std::vector<double> cams_dt_s;
+  for (size_t i = 1; i < tVis_missing_frames.size(); ++i) {
+    cams_dt_s.push_back(tVis_missing_frames[i] - tVis_missing_frames[i - 1]);
+  }
+  // we take the median as some images might not have been estimated
+  const double cam_dt_s = utils::MedianOfDoubleVec(cams_dt_s);
+
+  const utils::UniformGrid grid = utils::MakeUniformGrid(
+      tVis_missing_frames.front(), tVis_missing_frames.back(), cam_dt_s);
+  LOG(INFO) << "Interpolating visual quaternions to IMU rate.";
+  // interpolate visual rotations as some views might be missing
+  utils::ResampleUniform(tVis_missing_frames,
+                         visual_rotations_missing_frames,
+                         grid,
+                         visual_rotations_);
+  vis_timestamps_s_.resize(grid.num_samples);
+  for (size_t i = 0; i < grid.num_samples; ++i) {
+    vis_timestamps_s_[i] = grid.Time(i);
+  }
+  return true;
+}
+
 double ImuToCameraRotationEstimator::SolveClosedForm(
     const vec3_vector& angVis,
     const vec3_vector& angImu,
-    const std::vector<double> timestamps_s,
+    const std::vector<double>& timestamps_s,
     const double td,
     const double dt_imu,
     Matrix3d& Rs,
@@ -56,31 +219,28 @@ double ImuToCameraRotationEstimator::SolveClosedForm(
   // compute mean vectors
   Vector3d mean_vis(0.0, 0.0, 0.0);
   Vector3d mean_imu(0.0, 0.0, 0.0);
-  for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
-    mean_imu += angImu[i];
-    mean_vis += interpolated_angVis[i];
-  }
-  mean_imu /= static_cast<double>(interpolated_angVis.size());
-  mean_vis /= static_cast<double>(interpolated_angVis.size());
+  if (ransac_options_.num_hypotheses > 0) {
+    SolveWindowedRansac(
+        interpolated_angVis, angImu, timestamps_s, Rs, mean_imu, mean_vis);
+  } else {
+    for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
+      mean_imu += angImu[i];
+      mean_vis += interpolated_angVis[i];
+    }
+    mean_imu /= static_cast<double>(interpolated_angVis.size());
+    mean_vis /= static_cast<double>(interpolated_angVis.size());
 
-  // centralized
-  MatrixXd P, Q;
-  P.resize(interpolated_angVis.size(), 3);
-  Q.resize(interpolated_angVis.size(), 3);
+    // centralized
+    MatrixXd P, Q;
+    P.resize(interpolated_angVis.size(), 3);
+    Q.resize(interpolated_angVis.size(), 3);
 
-  for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
-    P.row(i) = angImu[i] - mean_imu;
-    Q.row(i) = interpolated_angVis[i] - mean_vis;
+    for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
+      P.row(i) = angImu[i] - mean_imu;
+      Q.row(i) = interpolated_angVis[i] - mean_vis;
+    }
+    Rs = RotationFromCrossCovariance(P.transpose() * Q);
   }
-  Eigen::JacobiSVD<MatrixXd> svd(P.transpose() * Q,
-                                 Eigen::ComputeFullU | Eigen::ComputeFullV);
-
-  Matrix3d C;
-  C.setIdentity();
-  if ((svd.matrixV() * svd.matrixU().transpose()).determinant() < 0.0)
-    C(2, 2) = -1.0;
-
-  Rs = svd.matrixV() * C * svd.matrixU().transpose();
 
   // only estimate bias if it is zero,
   // otherwise we got it from another estimation procedure
@@ -113,6 +273,181 @@ double ImuToCameraRotationEstimator::SolveClosedForm(
   return error;
 }
 
+void ImuToCameraRotationEstimator::SolveWindowedRansac(
+    const vec3_vector& ang_vis,
+    const vec3_vector& ang_imu,
+    const std::vector<double>& timestamps_s,
+    Matrix3d& Rs,
+    Vector3d& mean_imu,
+    Vector3d& mean_vis) {
+  // one pass over the samples, afterwards everything works on the sums
+  const double window_s = std::max(ransac_options_.window_s, 1e-3);
+  const double t_begin = timestamps_s.front();
+  const size_t num_slots =
+      static_cast<size_t>((timestamps_s.back() - t_begin) / window_s) + 1;
+  std::vector<WindowSums> slots(num_slots);
+  for (size_t i = 0; i < ang_vis.size(); ++i) {
+    const size_t w = std::min(
+        static_cast<size_t>((timestamps_s[i] - t_begin) / window_s),
+        num_slots - 1);
+    WindowSums& sums = slots[w];
+    ++sums.num_samples;
+    sums.sum_imu += ang_imu[i];
+    sums.sum_vis += ang_vis[i];
+    sums.cross += ang_imu[i] * ang_vis[i].transpose();
+    sums.sum_sq += ang_imu[i].squaredNorm() + ang_vis[i].squaredNorm();
+  }
+  std::vector<WindowSums> windows;
+  windows.reserve(num_slots);
+  for (const WindowSums& sums : slots) {
+    if (sums.num_samples > 0) {
+      windows.push_back(sums);
+    }
+  }
+  num_windows_ = windows.size();
+
+  // rotation and bias from the sums of a set of windows
+  const auto fit = [this](const WindowSums& total,
+                          Matrix3d& R,
+                          Vector3d& m_imu,
+                          Vector3d& m_vis,
+                          Vector3d& bias) {
+    m_imu = total.sum_imu / total.num_samples;
+    m_vis = total.sum_vis / total.num_samples;
+    R = RotationFromCrossCovariance(total.cross -
+                                    total.sum_imu * m_vis.transpose());
+    bias = estimate_gyro_bias_ ? Vector3d(m_vis - R * m_imu)
+                               : Vector3d::Zero();
+  };
+  const auto add = [](const WindowSums& sums, WindowSums& total) {
+    total.num_samples += sums.num_samples;
+    total.sum_imu += sums.sum_imu;
+    total.sum_vis += sums.sum_vis;
+    total.cross += sums.cross;
+  };
+  // sum of |ang_vis - (R * ang_imu + bias)|^2 over the window
+  const auto residual = [](const WindowSums& sums,
+                           const Matrix3d& R,
+                           const Vector3d& bias) {
+    const double r = sums.sum_sq - 2.0 * (R * sums.cross).trace() -
+                     2.0 * bias.dot(sums.sum_vis - R * sums.sum_imu) +
+                     sums.num_samples * bias.squaredNorm();
+    return std::max(r, 0.0);
+  };
+  const double inlier_sq = ransac_options_.inlier_threshold *
+                           ransac_options_.inlier_threshold;
+  const auto is_inlier = [&](const WindowSums& sums,
+                             const Matrix3d& R,
+                             const Vector3d& bias) {
+    return residual(sums, R, bias) < inlier_sq * sums.num_samples;
+  };
+
+  Vector3d bias;
+  const size_t sample_size =
+      static_cast<size_t>(std::max(ransac_options_.windows_per_hypothesis, 1));
+  if (windows.size() <= sample_size) {
+    WindowSums total;
+    for (const WindowSums& sums : windows) {
+      add(sums, total);
+    }
+    fit(total, Rs, mean_imu, mean_vis, bias);
+    num_inlier_windows_ = windows.size();
+    return;
+  }
+
+  // every hypothesis draws its windows from its own seed, so the result does
+  // not depend on the number of threads
+  const size_t num_hypotheses = ransac_options_.num_hypotheses;
+  std::vector<Matrix3d> rotations(num_hypotheses);
+  std::vector<Vector3d> biases(num_hypotheses);
+  std::vector<size_t> num_inliers(num_hypotheses, 0);
+  std::vector<double> inlier_cost(num_hypotheses, 0.0);
+  utils::ParallelFor(
+      num_hypotheses, num_threads_, [&](size_t begin, size_t end, int) {
+        std::vector<size_t> ids(windows.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        for (size_t h = begin; h < end; ++h) {
+          std::mt19937 rng(ransac_options_.seed + h);
+          WindowSums total;
+          for (size_t k = 0; k < sample_size; ++k) {
+            std::uniform_int_distribution<size_t> draw(k, ids.size() - 1);
+            std::swap(ids[k], ids[draw(rng)]);
+            add(windows[ids[k]], total);
+          }
+          Vector3d m_imu, m_vis;
+          fit(total, rotations[h], m_imu, m_vis, biases[h]);
+          for (const WindowSums& sums : windows) {
+            if (is_inlier(sums, rotations[h], biases[h])) {
+              ++num_inliers[h];
+              inlier_cost[h] += residual(sums, rotations[h], biases[h]);
+            }
+          }
+        }
+      });
+
+  size_t best = 0;
+  for (size_t h = 1; h < num_hypotheses; ++h) {
+    if (num_inliers[h] > num_inliers[best] ||
+        (num_inliers[h] == num_inliers[best] &&
+         inlier_cost[h] < inlier_cost[best])) {
+      best = h;
+    }
+  }
+
+  // refit to the inlier windows of the best hypothesis, all windows if the
+  // threshold rejected every one of them
+  WindowSums inliers;
+  for (const WindowSums& sums : windows) {
+    if (num_inliers[best] == 0 ||
+        is_inlier(sums, rotations[best], biases[best])) {
+      add(sums, inliers);
+    }
+  }
+  num_inlier_windows_ = num_inliers[best];
+  fit(inliers, Rs, mean_imu, mean_vis, bias);
+}
+
+bool ImuToCameraRotationEstimator::CoarseTimeOffset(
+    const vec3_vector& ang_imu,
+    const vec3_vector& ang_vis,
+    const std::vector<double>& timestamps_s,
+    const double dt_imu,
+    double& time_offset) {
+  if (dt_imu <= 0.0 || timestamps_s.size() < 2) {
+    return false;
+  }
+  // resample the magnitudes to a uniform grid
+  std::vector<double> norm_imu(timestamps_s.size()),
+      norm_vis(timestamps_s.size());
+  for (size_t i = 0; i < timestamps_s.size(); ++i) {
+    norm_imu[i] = ang_imu[i].norm();
+    norm_vis[i] = ang_vis[i].norm();
+  }
+  const utils::UniformGrid grid = utils::MakeUniformGrid(
+      timestamps_s.front(), timestamps_s.back(), dt_imu);
+  std::vector<double> mag_imu, mag_vis;
+  utils::ResampleUniform(timestamps_s, norm_imu, grid, mag_imu);
+  utils::ResampleUniform(timestamps_s, norm_vis, grid, mag_vis);
+
+  const int max_lag = std::ceil(max_time_offset_s_ / dt_imu);
+  double lag = 0.0, peak_correlation = 0.0;
+  if (!utils::CrossCorrelationLag(
+          mag_imu, mag_vis, max_lag, lag, peak_correlation)) {
+    LOG(WARNING) << "Could not cross correlate the angular velocities.";
+    return false;
+  }
+  if (peak_correlation < min_peak_correlation_) {
+    LOG(WARNING) << "Angular velocity cross correlation is too weak ("
+                 << peak_correlation << "), searching the full time offset "
+                 << "window.";
+    return false;
+  }
+  time_offset = lag * dt_imu;
+  LOG(INFO) << "Coarse time offset from cross correlation: " << time_offset
+            << "s (correlation " << peak_correlation << ").";
+  return true;
+}
+
 bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
     const double dt_imu,
     Matrix3d& R_imu_to_camera,
@@ -120,57 +455,61 @@ bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
     Vector3d& gyro_bias,
     vec3_vector& smoothed_ang_imu,
     vec3_vector& smoothed_vis_vel) {
+  utils::ScopedStageTimer stage_timer(
+      "ImuToCameraRotationEstimator::EstimateCameraImuRotation");
+  stage_timer.AddItems(visual_rotations_.size());
+  if (vis_timestamps_s_.empty() || imu_timestamps_s_.empty()) {
+    LOG(ERROR) << "No visual rotations or imu angular velocities set.";
+    return false;
+  }
   // find start and end points of camera and imu
-  const double start_time_cam = visual_rotations_.begin()->first;
-  const double end_time_cam = visual_rotations_.rbegin()->first;
-  const double start_time_imu = imu_angular_vel_.begin()->first;
-  const double end_time_imu = imu_angular_vel_.rbegin()->first;
+  const double start_time_cam = vis_timestamps_s_.front();
+  const double end_time_cam = vis_timestamps_s_.back();
+  const double start_time_imu = imu_timestamps_s_.front();
+  const double end_time_imu = imu_timestamps_s_.back();
 
   double t0 =
       (start_time_cam >= start_time_imu) ? start_time_cam : start_time_imu;
   double tend = (end_time_cam >= end_time_imu) ? end_time_cam : end_time_imu;
 
-  // create zero-based maps
-  quat_map visual_rotations_clamped;
-  vec3_map imu_angular_vel_clamped;
-
-  for (auto const& imu_rot : imu_angular_vel_) {
-    if (imu_rot.first >= t0 && imu_rot.first <= tend) {
-      imu_angular_vel_clamped[imu_rot.first - t0] = imu_rot.second;
-    }
-  }
-  vec3_vector angImu;
-  for (const auto& imu : imu_angular_vel_clamped) {
-    angImu.push_back(imu.second);
+  // clamp to [t0, tend] as index ranges into the sorted measurements
+  const auto index_range = [](const std::vector<double>& timestamps_s,
+                              const double t_begin,
+                              const double t_end,
+                              size_t& begin,
+                              size_t& end) {
+    const auto first = timestamps_s.begin(), last = timestamps_s.end();
+    begin = std::lower_bound(first, last, t_begin) - first;
+    end = std::upper_bound(first, last, t_end) - first;
+  };
+  size_t imu_begin, imu_end, vis_begin, vis_end;
+  index_range(imu_timestamps_s_, t0, tend, imu_begin, imu_end);
+  index_range(vis_timestamps_s_, t0, tend, vis_begin, vis_end);
+  if (imu_end - imu_begin < 2 || vis_end - vis_begin < 2) {
+    LOG(ERROR) << "Camera and imu measurements do not overlap in time.";
+    return false;
   }
 
-  // interpolate visual rotations
-  for (auto const& v_rot : visual_rotations_) {
-    if (v_rot.first >= t0 && v_rot.first <= tend) {
-      visual_rotations_clamped[v_rot.first - t0] = v_rot.second;
-    }
+  // zero-based timestamps of the clamped ranges
+  std::vector<double> tIMU(imu_end - imu_begin), tVis(vis_end - vis_begin);
+  for (size_t i = 0; i < tIMU.size(); ++i) {
+    tIMU[i] = imu_timestamps_s_[imu_begin + i] - t0;
   }
-
-  // get vectors of clamped imu angular velocities
-  std::vector<double> tIMU;
-  for (auto const& imu : imu_angular_vel_clamped) {
-    tIMU.push_back(imu.first);
-  }
-
-  std::vector<double> tVis;
-  quat_vector qtVis;
-
-  for (auto const& vis : visual_rotations_clamped) {
-    tVis.push_back(vis.first);
-    qtVis.push_back(vis.second);
+  for (size_t i = 0; i < tVis.size(); ++i) {
+    tVis[i] = vis_timestamps_s_[vis_begin + i] - t0;
   }
+  const quat_vector qtVis(visual_rotations_.begin() + vis_begin,
+                          visual_rotations_.begin() + vis_end);
+  const Vector3d* angImu = imu_angular_vel_.data() + imu_begin;
 
   quat_vector qtVis_interp;
   OpenICC::utils::InterpolateQuaternions(tVis, tIMU, qtVis, qtVis_interp);
 
   // compute angular velocities
   quat_vector qtDiffs;
+  qtDiffs.reserve(qtVis_interp.size());
   vec3_vector angVis;
+  angVis.reserve(qtVis_interp.size());
   for (size_t i = 1; i < qtVis_interp.size(); ++i) {
     Quaterniond q;
     q.w() = qtVis_interp[i].w() - qtVis_interp[i - 1].w();
@@ -191,7 +530,7 @@ bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
         std::abs(angVisVec[1]) > 2 * M_PI ||
         std::abs(angVisVec[2]) > 2 * M_PI) {
       if (i > 1) {
-        angVis[i] = angVis[i - 1];
+        angVisVec = angVis[i - 1];
       } else {
         angVisVec.setZero();
       }
@@ -199,37 +538,33 @@ bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
     angVis.push_back(angVisVec);
   }
 
-  // calculate moving average to smooth the values a bit
-  SimpleMovingAverage x_imu(15), y_imu(15), z_imu(15);
-  SimpleMovingAverage x_vis(15), y_vis(15), z_vis(15);
-
-  // vec3_vector smoothed_ang_imu, smoothed_vis_vel;
-  for (size_t i = 0; i < angImu.size(); ++i) {
-    x_imu.add(angImu[i][0]);
-    y_imu.add(angImu[i][1]);
-    z_imu.add(angImu[i][2]);
-    smoothed_ang_imu.push_back(
-        Eigen::Vector3d(x_imu.avg(), y_imu.avg(), z_imu.avg()));
-    x_vis.add(angVis[i][0]);
-    y_vis.add(angVis[i][1]);
-    z_vis.add(angVis[i][2]);
-    smoothed_vis_vel.push_back(
-        Eigen::Vector3d(x_vis.avg(), y_vis.avg(), z_vis.avg()));
+  // smooth the values a bit
+  const utils::MultiChannelFilter<double, 3> smoothing_filter(
+      smoothing_filter_);
+  smoothing_filter.Apply(angImu, tIMU.size(), smoothed_ang_imu);
+  smoothing_filter.Apply(angVis, smoothed_vis_vel);
+
+  // Coarse time offset: the angular velocity magnitudes do not depend on the
+  // unknown rotation, so they can be aligned by cross correlation
+  double a = -max_time_offset_s_;
+  double b = max_time_offset_s_;
+  double coarse_offset = 0.0;
+  if (CoarseTimeOffset(
+          smoothed_ang_imu, smoothed_vis_vel, tIMU, dt_imu, coarse_offset)) {
+    a = std::max(a, coarse_offset - fine_search_window_s_);
+    b = std::min(b, coarse_offset + fine_search_window_s_);
   }
 
   const double gRatio = (1.0 + std::sqrt(5.0)) / 2.0;
   const double tolerance = 1e-4;
 
-  const double maxOffset = 1.0;
-  double a = -maxOffset;
-  double b = maxOffset;
-
   double c = b - (b - a) / gRatio;
   double d = a + (b - a) / gRatio;
 
   unsigned int iter = 0;
   double error = 0.0;
-  LOG(INFO) << "Estimating camera to IMU rotation.";
+  LOG(INFO) << "Estimating camera to IMU rotation in the time offset window ["
+            << a << ", " << b << "]s.";
   while (std::abs(c - d) > tolerance) {
     Eigen::Matrix3d Rsc, Rsd;
     Eigen::Vector3d biasc, biasd;
@@ -269,6 +604,10 @@ bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
             << gyro_bias[1] << ", " << gyro_bias[2] << "rad/s\n";
   LOG(INFO) << "Estimated time offset: " << time_offset_imu_to_camera << "s\n";
   LOG(INFO) << "Final alignment error: " << error << "\n";
+  if (ransac_options_.num_hypotheses > 0) {
+    LOG(INFO) << "Windowed RANSAC kept " << num_inlier_windows_ << " of "
+              << num_windows_ << " windows.";
+  }
 
   return true;
 }
@@ -0,0 +1,157 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/multi_sequence_calibrator.h"
+
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+namespace OpenICC {
+namespace core {
+
+ImuCameraCalibrator& MultiSequenceCalibrator::AddSequence() {
+  sequences_.push_back(std::make_unique<ImuCameraCalibrator>());
+  return *sequences_.back();
+}
+
+double MultiSequenceCalibrator::Optimize(const int rounds,
+                                         const int iterations,
+                                         const int sequence_flags,
+                                         const int shared_flags,
+                                         const int shared_iterations) {
+  utils::ScopedStageTimer stage_timer("MultiSequenceCalibrator::Optimize");
+  if (sequences_.empty()) {
+    LOG(ERROR) << "No sequences to calibrate.";
+    return 0.0;
+  }
+  const int num_sequences = sequences_.size();
+  stage_timer.AddItems(num_sequences * rounds);
+  const int threads_per_sequence = std::max(1, num_threads_ / num_sequences);
+  for (int i = 0; i < num_sequences; ++i) {
+    sequences_[i]->trajectory_.SetNumThreads(threads_per_sequence);
+    if (i > 0) {
+      sequences_[i]->trajectory_.CopyCalibrationFrom(
+          sequences_[0]->trajectory_);
+    }
+  }
+
+  for (int round = 0; round < rounds; ++round) {
+    LOG(INFO) << "Multi-sequence round " << round + 1 << "/" << rounds
+              << ": solving " << num_sequences << " sequences";
+    // the sequences only share the calibration, which is constant here
+    utils::ParallelFor(
+        num_sequences, num_threads_, [&](size_t begin, size_t end, int) {
+          for (size_t i = begin; i < end; ++i) {
+            sequences_[i]->Optimize(iterations, sequence_flags);
+          }
+        });
+    const double cost = OptimizeShared(shared_flags, shared_iterations);
+    LOG(INFO) << "Cost of all sequences after round " << round + 1 << ": "
+              << cost;
+  }
+
+  double sum_error = 0.0;
+  for (auto& sequence : sequences_) {
+    sum_error += sequence->trajectory_.GetMeanReprojectionError();
+  }
+  return sum_error / num_sequences;
+}
+
+double MultiSequenceCalibrator::OptimizeShared(const int shared_flags,
+                                               const int iterations) {
+  const size_t num_sequences = sequences_.size();
+  std::vector<Eigen::MatrixXd> JtJ(num_sequences);
+  std::vector<Eigen::VectorXd> Jtr(num_sequences);
+  std::vector<double> costs(num_sequences, 0.0);
+  std::vector<char> evaluated(num_sequences, 0);
+  const auto for_each_sequence = [&](auto&& func) {
+    utils::ParallelFor(
+        num_sequences, num_threads_, [&](size_t begin, size_t end, int) {
+          for (size_t i = begin; i < end; ++i) {
+            func(i);
+          }
+        });
+  };
+  const auto sum_costs = [&]() {
+    double cost = 0.0;
+    for (const double sequence_cost : costs) {
+      cost += sequence_cost;
+    }
+    return cost;
+  };
+
+  Eigen::MatrixXd H;
+  Eigen::VectorXd g;
+  double cost = 0.0;
+  double lambda = 1e-4;
+  bool relinearize = true;
+  for (int iter = 0; iter < iterations; ++iter) {
+    if (relinearize) {
+      for_each_sequence([&](const size_t i) {
+        evaluated[i] = sequences_[i]->trajectory_.CalibrationNormalEquations(
+            shared_flags, JtJ[i], Jtr[i], costs[i]);
+      });
+      if (std::count(evaluated.begin(), evaluated.end(), 0) > 0) {
+        LOG(ERROR) << "Could not linearize the shared calibration.";
+        break;
+      }
+      // all sequences have the same layout of the shared parameters
+      H = JtJ[0];
+      g = Jtr[0];
+      for (size_t i = 1; i < num_sequences; ++i) {
+        H += JtJ[i];
+        g += Jtr[i];
+      }
+      cost = sum_costs();
+      relinearize = false;
+    }
+
+    Eigen::MatrixXd damped = H;
+    for (int d = 0; d < H.rows(); ++d) {
+      // parameters without residuals keep their value
+      damped(d, d) = H(d, d) > 0.0 ? (1.0 + lambda) * H(d, d) : 1.0;
+    }
+    const Eigen::VectorXd dx = damped.ldlt().solve(-g);
+    for (auto& sequence : sequences_) {
+      sequence->trajectory_.ApplyCalibrationStep(shared_flags, dx);
+    }
+    for_each_sequence([&](const size_t i) {
+      costs[i] = sequences_[i]->trajectory_.EvaluateCost();
+    });
+    const double new_cost = sum_costs();
+    if (new_cost < cost) {
+      LOG(INFO) << "Shared calibration step " << iter << " cost " << cost
+                << " -> " << new_cost;
+      cost = new_cost;
+      lambda = std::max(lambda / 10.0, 1e-10);
+      relinearize = true;
+      if (dx.norm() < 1e-10) {
+        break;
+      }
+    } else {
+      // the steps are exp maps on the right, so the inverse step is exact
+      for (auto& sequence : sequences_) {
+        sequence->trajectory_.ApplyCalibrationStep(shared_flags, -dx);
+      }
+      lambda *= 10.0;
+    }
+  }
+  return cost;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -15,7 +15,14 @@
 
 #include "OpenCameraCalibrator/core/pose_estimator.h"
 
+#include "OpenCameraCalibrator/io/mapped_scene.h"
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/camera_model_dispatch.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/reprojection_error.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 #include <theia/io/reconstruction_reader.h>
@@ -25,6 +32,10 @@
 #include <theia/sfm/estimators/estimate_calibrated_absolute_pose.h>
 #include <theia/sfm/estimators/feature_correspondence_2d_3d.h>
 #include <theia/sfm/reconstruction.h>
+#include <theia/util/random.h>
+
+#include <ceres/ceres.h>
+#include <ceres/rotation.h>
 
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 #include <theia/sfm/camera/double_sphere_camera_model.h>
@@ -33,11 +44,146 @@
 #include <theia/sfm/camera/pinhole_camera_model.h>
 #include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
+#include <utility>
 
 namespace OpenICC {
 namespace core {
 
+namespace {
+
+//! Pixel residual of a board point in a view with fixed intrinsics, theia
+//! camera conventions: the extrinsics are the camera position and the angle
+//! axis rotation from world to camera
+template <class CameraModel, typename T>
+bool ReprojectionResidual(const T* extrinsics,
+                          const double* intrinsics,
+                          const T* point,
+                          const Eigen::Vector2d& feature,
+                          T* residuals) {
+  const T* position = extrinsics + theia::Camera::POSITION;
+  const T adjusted_point[3] = {
+      point[0] - position[0], point[1] - position[1], point[2] - position[2]};
+  T rotated_point[3];
+  ceres::AngleAxisRotatePoint(
+      extrinsics + theia::Camera::ORIENTATION, adjusted_point, rotated_point);
+
+  T camera_intrinsics[CameraModel::kIntrinsicsSize];
+  for (int i = 0; i < CameraModel::kIntrinsicsSize; ++i) {
+    camera_intrinsics[i] = T(intrinsics[i]);
+  }
+  T pixel[2];
+  if (!CameraModel::CameraToPixelCoordinates(
+          camera_intrinsics, rotated_point, pixel)) {
+    return false;
+  }
+  residuals[0] = pixel[0] - T(feature[0]);
+  residuals[1] = pixel[1] - T(feature[1]);
+  return true;
+}
+
+//! Residual of a fixed board point, only the extrinsics are a parameter
+//! block, so the jacobian is 2x6
+template <class CameraModel>
+struct PoseReprojectionError {
+  PoseReprojectionError(const Eigen::Vector3d& point,
+                        const Eigen::Vector2d& feature,
+                        const double* intrinsics)
+      : point(point), feature(feature), intrinsics(intrinsics) {}
+
+  template <typename T>
+  bool operator()(const T* extrinsics, T* residuals) const {
+    const T board_point[3] = {T(point[0]), T(point[1]), T(point[2])};
+    return ReprojectionResidual<CameraModel>(
+        extrinsics, intrinsics, board_point, feature, residuals);
+  }
+
+  const Eigen::Vector3d point;
+  const Eigen::Vector2d feature;
+  const double* intrinsics;
+};
+
+//! Residual of a board point in a fixed view, only the point is a parameter
+//! block, so the jacobian is 2x3
+template <class CameraModel>
+struct BoardPointReprojectionError {
+  BoardPointReprojectionError(const double* extrinsics,
+                              const Eigen::Vector2d& feature,
+                              const double* intrinsics)
+      : extrinsics(extrinsics), feature(feature), intrinsics(intrinsics) {}
+
+  template <typename T>
+  bool operator()(const T* point, T* residuals) const {
+    T camera_extrinsics[theia::Camera::kExtrinsicsSize];
+    for (int i = 0; i < theia::Camera::kExtrinsicsSize; ++i) {
+      camera_extrinsics[i] = T(extrinsics[i]);
+    }
+    return ReprojectionResidual<CameraModel>(
+        camera_extrinsics, intrinsics, point, feature, residuals);
+  }
+
+  const double* extrinsics;
+  const Eigen::Vector2d feature;
+  const double* intrinsics;
+};
+
+//! Residual of a fixed board point in normalized image coordinates, like
+//! the PnP correspondences. Only the extrinsics are a parameter block
+struct NormalizedPoseError {
+  explicit NormalizedPoseError(
+      const theia::FeatureCorrespondence2D3D& correspondence)
+      : point(correspondence.world_point), feature(correspondence.feature) {}
+
+  template <typename T>
+  bool operator()(const T* extrinsics, T* residuals) const {
+    const T* position = extrinsics + theia::Camera::POSITION;
+    const T adjusted_point[3] = {T(point[0]) - position[0],
+                                 T(point[1]) - position[1],
+                                 T(point[2]) - position[2]};
+    T rotated_point[3];
+    ceres::AngleAxisRotatePoint(
+        extrinsics + theia::Camera::ORIENTATION, adjusted_point, rotated_point);
+    if (rotated_point[2] <= T(0.0)) {
+      return false;
+    }
+    residuals[0] = rotated_point[0] / rotated_point[2] - T(feature[0]);
+    residuals[1] = rotated_point[1] / rotated_point[2] - T(feature[1]);
+    return true;
+  }
+
+  const Eigen::Vector3d point;
+  const Eigen::Vector2d feature;
+};
+
+}  // namespace
+
+struct PoseEstimator::ViewQueue {
+  explicit ViewQueue(const size_t capacity) : views(capacity) {}
+
+  //! Stops the workers, e.g. if FinishViews was never called
+  ~ViewQueue() {
+    views.Close();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  theia::Camera camera;
+  utils::BoundedQueue<std::pair<std::string, nlohmann::json>> views;
+  //! last added view, queued once a view with another key arrives
+  std::string pending_key;
+  nlohmann::json pending_view;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::deque<ViewPnP> solved;
+};
+
 PoseEstimator::PoseEstimator() {
   ransac_params_.failure_probability = 0.001;
   ransac_params_.use_mle = true;
@@ -49,21 +195,119 @@ PoseEstimator::PoseEstimator() {
   ba_options_.loss_function_type = theia::LossFunctionType::HUBER;
   ba_options_.robust_loss_width = 1.345;
   ba_options_.intrinsics_to_optimize = theia::OptimizeIntrinsicsType::NONE;
+
+  num_threads_ = utils::Executor::Global().MaxConcurrency();
 }
 
+PoseEstimator::~PoseEstimator() = default;
+
 bool PoseEstimator::EstimatePosePinhole(
     const theia::ViewId& view_id,
     const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
     const std::vector<int>& board_pts3_ids) {
+  ViewPnP view_pnp;
+  view_pnp.correspondences_undist = correspondences_undist;
+  view_pnp.board_pts3_ids = board_pts3_ids;
+  // seeded per view like the parallel estimation
+  theia::RansacParameters ransac_params = ransac_params_;
+  ransac_params.rng =
+      std::make_shared<theia::RandomNumberGenerator>(ransac_seed_ + view_id);
+  SolvePnP(ransac_params, view_pnp);
+  return AddPnPResult(view_id, view_pnp);
+}
+
+void PoseEstimator::SolvePnP(const theia::RansacParameters& ransac_params,
+                             ViewPnP& view_pnp) const {
   // Estimate camera pose using
-  theia::CalibratedAbsolutePose pose;
   theia::RansacSummary ransac_summary;
   theia::PnPType pnpr = theia::PnPType::DLS;
-  theia::EstimateCalibratedAbsolutePose(
-      ransac_params_, theia::RansacType::RANSAC, pnpr, correspondences_undist, &pose,
-      &ransac_summary);
+  theia::EstimateCalibratedAbsolutePose(ransac_params,
+                                        theia::RansacType::RANSAC,
+                                        pnpr,
+                                        view_pnp.correspondences_undist,
+                                        &view_pnp.pose,
+                                        &ransac_summary);
+  view_pnp.inliers = ransac_summary.inliers;
+  view_pnp.pose_found = ransac_summary.inliers.size() >= 6;
+}
+
+bool PoseEstimator::TrackPnP(const ViewPnP& previous,
+                             ViewPnP& view_pnp) const {
+  if (!previous.pose_found ||
+      std::abs(view_pnp.timestamp_s - previous.timestamp_s) >
+          max_tracking_gap_s_) {
+    return false;
+  }
+  double extrinsics[theia::Camera::kExtrinsicsSize];
+  Eigen::Map<Eigen::Vector3d>(extrinsics + theia::Camera::POSITION) =
+      previous.pose.position;
+  ceres::RotationMatrixToAngleAxis(
+      ceres::ColumnMajorAdapter3x3(previous.pose.rotation.data()),
+      extrinsics + theia::Camera::ORIENTATION);
 
-  if (ransac_summary.inliers.size() < 6) {
+  // the loss keeps outliers from pulling the pose before they are gated
+  ceres::HuberLoss loss_function(ransac_params_.error_thresh);
+  ceres::Problem::Options problem_options;
+  problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  ceres::Problem problem(problem_options);
+  for (const auto& correspondence : view_pnp.correspondences_undist) {
+    problem.AddResidualBlock(
+        new ceres::AutoDiffCostFunction<NormalizedPoseError,
+                                        2,
+                                        theia::Camera::kExtrinsicsSize>(
+            new NormalizedPoseError(correspondence)),
+        &loss_function,
+        extrinsics);
+  }
+  ceres::Solver::Options options;
+  options.linear_solver_type = ceres::DENSE_QR;
+  options.max_num_iterations = 10;
+  options.logging_type = ceres::SILENT;
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+  if (!summary.IsSolutionUsable()) {
+    return false;
+  }
+
+  const double max_sq_error =
+      ransac_params_.error_thresh * ransac_params_.error_thresh;
+  std::vector<int> inliers;
+  for (size_t i = 0; i < view_pnp.correspondences_undist.size(); ++i) {
+    Eigen::Vector2d error;
+    if (NormalizedPoseError(view_pnp.correspondences_undist[i])(
+            static_cast<const double*>(extrinsics), error.data()) &&
+        error.squaredNorm() < max_sq_error) {
+      inliers.push_back(i);
+    }
+  }
+  if (inliers.size() < 6 ||
+      inliers.size() < min_tracking_inlier_ratio_ *
+                           view_pnp.correspondences_undist.size()) {
+    return false;
+  }
+  view_pnp.pose.position =
+      Eigen::Map<const Eigen::Vector3d>(extrinsics + theia::Camera::POSITION);
+  ceres::AngleAxisToRotationMatrix(
+      extrinsics + theia::Camera::ORIENTATION,
+      ceres::ColumnMajorAdapter3x3(view_pnp.pose.rotation.data()));
+  view_pnp.inliers = std::move(inliers);
+  view_pnp.pose_found = true;
+  view_pnp.tracked = true;
+  return true;
+}
+
+void PoseEstimator::SolveViewPnP(const theia::RansacParameters& ransac_params,
+                                 const ViewPnP* previous,
+                                 ViewPnP& view_pnp) const {
+  if (pose_tracking_ && previous && TrackPnP(*previous, view_pnp)) {
+    return;
+  }
+  SolvePnP(ransac_params, view_pnp);
+}
+
+bool PoseEstimator::AddPnPResult(const theia::ViewId& view_id,
+                                 const ViewPnP& view_pnp) {
+  if (!view_pnp.pose_found) {
     return false;
   }
 
@@ -71,16 +315,16 @@ bool PoseEstimator::EstimatePosePinhole(
   theia_view->SetEstimated(true);
 
   theia::Camera* cam = theia_view->MutableCamera();
-  cam->SetPosition(pose.position);
-  cam->SetOrientationFromRotationMatrix(pose.rotation);
+  cam->SetPosition(view_pnp.pose.position);
+  cam->SetOrientationFromRotationMatrix(view_pnp.pose.rotation);
 
-  for (size_t i = 0; i < ransac_summary.inliers.size(); ++i) {
-    int inlier = ransac_summary.inliers[i];
+  for (size_t i = 0; i < view_pnp.inliers.size(); ++i) {
+    int inlier = view_pnp.inliers[i];
 
     pose_dataset_.AddObservation(
         view_id,
-        board_pts3_ids[inlier],
-        theia::Feature(correspondences_undist[inlier].feature));
+        view_pnp.board_pts3_ids[inlier],
+        theia::Feature(view_pnp.correspondences_undist[inlier].feature));
   }
 
   // optimize pose
@@ -90,108 +334,335 @@ bool PoseEstimator::EstimatePosePinhole(
   return summary.success;
 }
 
-bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
-                                          const theia::Camera camera) {
+void PoseEstimator::InitializeFromScene(const nlohmann::json& scene_header,
+                                        const theia::Camera& camera) {
   const double image_diag =
       std::sqrt(camera.ImageWidth() * camera.ImageWidth() +
                 camera.ImageHeight() * camera.ImageHeight());
-  const double max_reproj_error = 0.004 * camera.ImageHeight();
+  max_reproj_error_ = 0.004 * camera.ImageHeight();
   std::cout << "PoseEstimator setting max reprojection error to: "
-            << max_reproj_error << "\n";
+            << max_reproj_error_ << "\n";
+  refined_view_errors_.clear();
   // set error thresh 0.4% from image size and normalize
-  ransac_params_.error_thresh = max_reproj_error / image_diag;
+  ransac_params_.error_thresh = max_reproj_error_ / image_diag;
   // get scene points and fill them into
-  io::scene_points_to_calib_dataset(scene_json, pose_dataset_);
+  io::scene_points_to_calib_dataset(scene_header, pose_dataset_);
   // init the number of observations per point to zero.
   // It might happen, that some point are not seen at all and
   // then BA will crash as no observations are available
   for (const auto t_id : pose_dataset_.TrackIds()) {
     tracks_to_nr_obs_[t_id] = 0;
   }
+  previous_stream_view_ = ViewPnP();
+  if (undistortion_map_cell_px_ > 0.0) {
+    undistortion_map_.Build(
+        camera, undistortion_map_cell_px_, 1, std::max(1, num_threads_));
+  } else {
+    undistortion_map_.Clear();
+  }
+}
 
-  const auto views = scene_json["views"];
-  double total_repro_error = 0.0;
-  int processed_frames = 0;
-
-  for (const auto& view : views.items()) {
-    const double timestamp_us = std::stod(view.key());
-    const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
-    const auto image_points = view.value()["image_points"];
-    std::vector<int> board_pts3_ids;
-    aligned_vector<Eigen::Vector2d> corners;
-    std::vector<theia::FeatureCorrespondence2D3D> correspondences_undist;
-
-    for (const auto& img_pts : image_points.items()) {
-      const int board_pt3_id = std::stoi(img_pts.key());
-      board_pts3_ids.push_back(std::stoi(img_pts.key()));
-      const Eigen::Vector2d corner(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-      corners.push_back(corner);
-      Eigen::Vector3d undist_pt = camera.PixelToNormalizedCoordinates(corner);
-      undist_pt /= undist_pt[2];
-
-      const Eigen::Vector4d track = pose_dataset_.Track(board_pt3_id)->Point();
-
-      theia::FeatureCorrespondence2D3D corr_undist;
-      corr_undist.world_point = track.hnormalized();
-      corr_undist.feature[0] = undist_pt[0];
-      corr_undist.feature[1] = undist_pt[1];
-      correspondences_undist.push_back(corr_undist);
-    }
-    if (correspondences_undist.size() < min_num_points_) {
-      LOG(INFO) << "Skipping view at timestamp : " << timestamp_s
-                << "s. Not enough points found.";
-      continue;
-    }
-    std::string view_name = std::to_string((uint64_t)(timestamp_s * S_TO_US));
-    theia::ViewId view_id = pose_dataset_.AddView(view_name, 0, timestamp_s);
-
-    theia::Camera* cam = pose_dataset_.MutableView(view_id)->MutableCamera();
-    cam->SetCameraIntrinsicsModelType(
-        theia::CameraIntrinsicsModelType::PINHOLE);
-    cam->SetFocalLength(1.0);
-    cam->SetPrincipalPoint(0.0, 0.0);
-    cam->SetImageSize(1.0, 1.0);
-    if (!EstimatePosePinhole(view_id, correspondences_undist, board_pts3_ids)) {
-      LOG(INFO) << "Pose estimation failed for view at timestamp "
-                << timestamp_s << "s from " << correspondences_undist.size()
-                << " points. Max reproj error was: "
-                << ransac_params_.error_thresh;
-      pose_dataset_.RemoveView(view_id);
-      continue;
-    }
-    // test back projection
-    double reproj_error = 0;
-    for (size_t i = 0; i < pose_dataset_.View(view_id)->TrackIds().size();
-         ++i) {
-      theia::TrackId track_id = pose_dataset_.View(view_id)->TrackIds()[i];
-      tracks_to_nr_obs_[track_id] += 1;
-
-      const theia::Track* track = pose_dataset_.Track(track_id);
-      Eigen::Vector2d reproj_point;
-      pose_dataset_.View(view_id)->Camera().ProjectPoint(track->Point(),
-                                                         &reproj_point);
-
-      reproj_error +=
-          (reproj_point -
-           (*pose_dataset_.View(view_id)->GetFeature(track_id)).point_)
-              .norm();
-    }
-    const double repro_error_n =
-        reproj_error / pose_dataset_.View(view_id)->TrackIds().size();
-    if (repro_error_n > max_reproj_error) {
-      LOG(INFO) << "Removing view " << view_id
-                << " due to large reprojection error: " << repro_error_n
-                << "px > " << max_reproj_error << " px\n";
-      pose_dataset_.RemoveView(view_id);
-    }
-    total_repro_error += repro_error_n;
-    ++processed_frames;
+template <typename ParseView>
+void PoseEstimator::EstimatePoses(const size_t num_views,
+                                  const theia::Camera& camera,
+                                  ParseView&& parse_view) {
+  std::vector<ViewPnP> views_pnp(num_views);
+  std::vector<char> prepared(num_views, 0);
+  utils::ParallelFor(
+      num_views,
+      num_threads_,
+      [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+        std::string view_key;
+        nlohmann::json view_storage;
+        theia::RansacParameters ransac_params = ransac_params_;
+        // the views of a range are consecutive frames for the tracking
+        const ViewPnP* previous = nullptr;
+        for (size_t i = begin; i < end; ++i) {
+          const nlohmann::json* view = parse_view(i, view_key, view_storage);
+          if (!view || !PrepareView(view_key, *view, camera, views_pnp[i])) {
+            continue;
+          }
+          // seeded per view, so the result does not depend on the threads
+          ransac_params.rng = std::make_shared<theia::RandomNumberGenerator>(
+              ViewSeed(views_pnp[i]));
+          SolveViewPnP(ransac_params, previous, views_pnp[i]);
+          if (views_pnp[i].pose_found) {
+            previous = &views_pnp[i];
+          }
+          prepared[i] = 1;
+        }
+      });
+
+  std::vector<const ViewPnP*> solved;
+  size_t num_tracked = 0;
+  for (size_t i = 0; i < num_views; ++i) {
+    if (!prepared[i]) continue;
+    solved.push_back(&views_pnp[i]);
+    num_tracked += views_pnp[i].tracked;
+  }
+  if (pose_tracking_) {
+    LOG(INFO) << "Tracked " << num_tracked << " of " << solved.size()
+              << " view poses without RANSAC.";
+  }
+  AddViewsInTimeOrder(solved);
+}
+
+void PoseEstimator::AddViewsInTimeOrder(
+    std::vector<const ViewPnP*>& views_pnp) {
+  // the key breaks ties, so the order does not depend on the input order
+  std::sort(views_pnp.begin(),
+            views_pnp.end(),
+            [](const ViewPnP* a, const ViewPnP* b) {
+              if (a->timestamp_s != b->timestamp_s) {
+                return a->timestamp_s < b->timestamp_s;
+              }
+              return a->view_key < b->view_key;
+            });
+  for (const ViewPnP* view_pnp : views_pnp) {
+    AddViewPnP(*view_pnp);
+  }
+}
+
+unsigned int PoseEstimator::ViewSeed(const ViewPnP& view_pnp) const {
+  const uint64_t timestamp_us =
+      static_cast<uint64_t>(std::stod(view_pnp.view_key));
+  return ransac_seed_ + static_cast<unsigned int>(timestamp_us);
+}
+
+bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
+                                          const theia::Camera camera) {
+  utils::ScopedStageTimer stage_timer("PoseEstimator::EstimatePoses");
+  InitializeFromScene(scene_json, camera);
+  const auto& views = scene_json["views"];
+  stage_timer.AddItems(views.size());
+  std::vector<std::string> view_keys;
+  std::vector<const nlohmann::json*> view_values;
+  for (auto it = views.begin(); it != views.end(); ++it) {
+    view_keys.push_back(it.key());
+    view_values.push_back(&it.value());
+  }
+  EstimatePoses(
+      view_keys.size(),
+      camera,
+      [&](const size_t i,
+          std::string& view_key,
+          nlohmann::json& /*view_storage*/) {
+        view_key = view_keys[i];
+        return view_values[i];
+      });
+  return true;
+}
+
+bool PoseEstimator::EstimatePosesFromScene(const io::MappedScene& scene,
+                                           const theia::Camera camera) {
+  utils::ScopedStageTimer stage_timer("PoseEstimator::EstimatePoses");
+  stage_timer.AddItems(scene.NumViews());
+  InitializeFromScene(scene.Header(), camera);
+  EstimatePoses(
+      scene.NumViews(),
+      camera,
+      [&](const size_t i,
+          std::string& view_key,
+          nlohmann::json& view_storage) -> const nlohmann::json* {
+        if (!scene.ParseView(i, view_storage)) {
+          return nullptr;
+        }
+        view_key = scene.ViewKey(i);
+        return &view_storage;
+      });
+  return true;
+}
+
+void PoseEstimator::StartViews(const nlohmann::json& scene_header,
+                               const theia::Camera& camera) {
+  view_queue_.reset();
+  InitializeFromScene(scene_header, camera);
+  const int num_workers = std::max(1, num_threads_);
+  view_queue_ = std::make_unique<ViewQueue>(2 * num_workers);
+  ViewQueue& queue = *view_queue_;
+  queue.camera = camera;
+  // plain threads instead of executor tasks, the workers block on the queue
+  // and must not hold pool threads the corner extraction needs
+  for (int t = 0; t < num_workers; ++t) {
+    queue.workers.emplace_back([this, &queue] {
+      std::pair<std::string, nlohmann::json> item;
+      theia::RansacParameters ransac_params = ransac_params_;
+      // only the pose and time of the last view this worker solved
+      ViewPnP previous;
+      while (queue.views.Pop(item)) {
+        ViewPnP view_pnp;
+        if (!PrepareView(item.first, item.second, queue.camera, view_pnp)) {
+          continue;
+        }
+        ransac_params.rng =
+            std::make_shared<theia::RandomNumberGenerator>(ViewSeed(view_pnp));
+        SolveViewPnP(ransac_params, &previous, view_pnp);
+        if (view_pnp.pose_found) {
+          previous.timestamp_s = view_pnp.timestamp_s;
+          previous.pose = view_pnp.pose;
+          previous.pose_found = true;
+        }
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.solved.push_back(std::move(view_pnp));
+      }
+    });
+  }
+}
+
+void PoseEstimator::AddView(const std::string& view_key,
+                            const nlohmann::json& view) {
+  if (!view_queue_) {
+    LOG(ERROR) << "AddView called without StartViews.";
+    return;
+  }
+  ViewQueue& queue = *view_queue_;
+  if (view_key == queue.pending_key) {
+    queue.pending_view.merge_patch(view);
+    return;
+  }
+  if (!queue.pending_key.empty()) {
+    queue.views.Push(
+        {std::move(queue.pending_key), std::move(queue.pending_view)});
+  }
+  queue.pending_key = view_key;
+  queue.pending_view = view;
+}
+
+bool PoseEstimator::FinishViews() {
+  if (!view_queue_) {
+    LOG(ERROR) << "FinishViews called without StartViews.";
+    return false;
+  }
+  utils::ScopedStageTimer stage_timer("PoseEstimator::FinishViews");
+  ViewQueue& queue = *view_queue_;
+  if (!queue.pending_key.empty()) {
+    queue.views.Push(
+        {std::move(queue.pending_key), std::move(queue.pending_view)});
+  }
+  queue.views.Close();
+  for (auto& worker : queue.workers) {
+    worker.join();
+  }
+  queue.workers.clear();
+  stage_timer.AddItems(queue.solved.size());
+
+  std::vector<const ViewPnP*> solved;
+  for (const ViewPnP& view_pnp : queue.solved) {
+    solved.push_back(&view_pnp);
+  }
+  AddViewsInTimeOrder(solved);
+  view_queue_.reset();
+  return true;
+}
+
+bool PoseEstimator::EstimateStreamViewPose(const std::string& view_key,
+                                           const nlohmann::json& view,
+                                           const theia::Camera& camera,
+                                           Eigen::Vector3d& orientation,
+                                           Eigen::Vector3d& position) {
+  ViewPnP view_pnp;
+  if (!PrepareView(view_key, view, camera, view_pnp)) {
+    return false;
+  }
+  theia::RansacParameters ransac_params = ransac_params_;
+  ransac_params.rng = std::make_shared<theia::RandomNumberGenerator>(
+      ransac_seed_ + num_stream_views_++);
+  SolveViewPnP(ransac_params, &previous_stream_view_, view_pnp);
+  if (!AddViewPnP(view_pnp)) {
+    return false;
+  }
+  const theia::ViewId view_id = pose_dataset_.ViewIdFromName(
+      std::to_string((uint64_t)(view_pnp.timestamp_s * S_TO_US)));
+  const theia::Camera& view_camera = pose_dataset_.View(view_id)->Camera();
+  orientation = view_camera.GetOrientationAsAngleAxis();
+  position = view_camera.GetPosition();
+  // the refined pose is the prior of the next view
+  previous_stream_view_.timestamp_s = view_pnp.timestamp_s;
+  previous_stream_view_.pose.position = position;
+  previous_stream_view_.pose.rotation =
+      view_camera.GetOrientationAsRotationMatrix();
+  previous_stream_view_.pose_found = true;
+  pose_dataset_.RemoveView(view_id);
+  return true;
+}
+
+bool PoseEstimator::PrepareView(const std::string& view_key,
+                                const nlohmann::json& view,
+                                const theia::Camera& camera,
+                                ViewPnP& view_pnp) const {
+  const double timestamp_us = std::stod(view_key);
+  const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
+  const auto& image_points = view["image_points"];
+  view_pnp.view_key = view_key;
+  view_pnp.timestamp_s = timestamp_s;
+  view_pnp.board_pts3_ids.reserve(image_points.size());
+  view_pnp.correspondences_undist.reserve(image_points.size());
+  // the stream camera may differ from the one the map was built for
+  const bool use_map = undistortion_map_.Matches(camera);
+
+  for (const auto& img_pts : image_points.items()) {
+    const int board_pt3_id = std::stoi(img_pts.key());
+    view_pnp.board_pts3_ids.push_back(board_pt3_id);
+    const Eigen::Vector2d corner(
+        Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
+    const Eigen::Vector2d undist_pt =
+        use_map ? undistortion_map_.PixelToNormalized(corner)
+                : camera.PixelToNormalizedCoordinates(corner).hnormalized();
+
+    const Eigen::Vector4d track = pose_dataset_.Track(board_pt3_id)->Point();
+
+    theia::FeatureCorrespondence2D3D corr_undist;
+    corr_undist.world_point = track.hnormalized();
+    corr_undist.feature[0] = undist_pt[0];
+    corr_undist.feature[1] = undist_pt[1];
+    view_pnp.correspondences_undist.push_back(corr_undist);
+  }
+  if (view_pnp.correspondences_undist.size() < min_num_points_) {
+    LOG(INFO) << "Skipping view at timestamp : " << timestamp_s
+              << "s. Not enough points found.";
+    return false;
+  }
+  return true;
+}
+
+bool PoseEstimator::AddViewPnP(const ViewPnP& view_pnp) {
+  const double timestamp_s = view_pnp.timestamp_s;
+  std::string view_name = std::to_string((uint64_t)(timestamp_s * S_TO_US));
+  theia::ViewId view_id = pose_dataset_.AddView(view_name, 0, timestamp_s);
+
+  theia::Camera* cam = pose_dataset_.MutableView(view_id)->MutableCamera();
+  cam->SetCameraIntrinsicsModelType(theia::CameraIntrinsicsModelType::PINHOLE);
+  cam->SetFocalLength(1.0);
+  cam->SetPrincipalPoint(0.0, 0.0);
+  cam->SetImageSize(1.0, 1.0);
+  if (!AddPnPResult(view_id, view_pnp)) {
+    LOG(INFO) << "Pose estimation failed for view at timestamp " << timestamp_s
+              << "s from " << view_pnp.correspondences_undist.size()
+              << " points. Max reproj error was: "
+              << ransac_params_.error_thresh;
+    pose_dataset_.RemoveView(view_id);
+    return false;
+  }
+  // test back projection
+  for (const theia::TrackId track_id :
+       pose_dataset_.View(view_id)->TrackIds()) {
+    tracks_to_nr_obs_[track_id] += 1;
+  }
+  const double repro_error_n =
+      utils::ComputeViewReprojectionError(pose_dataset_, view_id).mean;
+  if (repro_error_n > max_reproj_error_) {
+    LOG(INFO) << "Removing view " << view_id
+              << " due to large reprojection error: " << repro_error_n
+              << "px > " << max_reproj_error_ << " px\n";
+    pose_dataset_.RemoveView(view_id);
+    return false;
   }
   return true;
 }
 
 void PoseEstimator::OptimizeBoardPoints() {
+  utils::ScopedStageTimer stage_timer("PoseEstimator::OptimizeBoardPoints");
+  refined_view_errors_.clear();
   ba_options_.constant_camera_orientation = true;
   ba_options_.constant_camera_position = true;
   ba_options_.verbose = true;
@@ -205,11 +676,18 @@ void PoseEstimator::OptimizeBoardPoints() {
       track_ids_to_optimize.push_back(pair.first);
     }
   }
-  theia::BundleAdjustTracks(ba_options_,
-                            track_ids_to_optimize,
-                            &pose_dataset_,
-                            &emp_covariance_matrices,
-                            &empirical_variance_factor);
+  stage_timer.AddItems(track_ids_to_optimize.size());
+  if (alternating_board_refinement_) {
+    AlternateBoardRefinement(track_ids_to_optimize,
+                             emp_covariance_matrices,
+                             empirical_variance_factor);
+  } else {
+    theia::BundleAdjustTracks(ba_options_,
+                              track_ids_to_optimize,
+                              &pose_dataset_,
+                              &emp_covariance_matrices,
+                              &empirical_variance_factor);
+  }
   std::cout << "Empirical variance factor after board point optimization: "
             << empirical_variance_factor << "\n";
   Eigen::Vector3d mean_std(0.0, 0.0, 0.0);
@@ -225,6 +703,35 @@ void PoseEstimator::OptimizeBoardPoints() {
 }
 
 void PoseEstimator::OptimizeAllPoses() {
+  utils::ScopedStageTimer stage_timer("PoseEstimator::OptimizeAllPoses");
+  stage_timer.AddItems(pose_dataset_.NumViews());
+  refined_view_errors_.clear();
+  if (independent_pose_refinement_) {
+    // the board points are fixed, so the poses do not depend on each other
+    LOG(INFO) << "Optimizing all estimated poses independently.";
+    const std::vector<theia::ViewId> view_ids = pose_dataset_.ViewIds();
+    std::vector<utils::ViewReprojectionError> view_errors(view_ids.size());
+    std::vector<char> refined(view_ids.size(), 0);
+    utils::ParallelFor(
+        view_ids.size(),
+        num_threads_,
+        [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+          for (size_t i = begin; i < end; ++i) {
+            refined[i] = RefineViewPose(view_ids[i], view_errors[i]);
+          }
+        });
+    for (size_t i = 0; i < view_ids.size(); ++i) {
+      if (refined[i]) {
+        refined_view_errors_.push_back(view_errors[i]);
+      } else {
+        LOG(INFO) << "Removing view " << view_ids[i]
+                  << " as its pose refinement failed.\n";
+        pose_dataset_.RemoveView(view_ids[i]);
+      }
+    }
+    LOG(INFO) << "Finished optimizing camera poses.";
+    return;
+  }
   ba_options_.constant_camera_orientation = false;
   ba_options_.constant_camera_position = false;
   ba_options_.verbose = true;
@@ -234,6 +741,231 @@ void PoseEstimator::OptimizeAllPoses() {
   LOG(INFO) << "Finished optimizing camera poses.";
 }
 
+bool PoseEstimator::RefineViewPose(const theia::ViewId view_id,
+                                   utils::ViewReprojectionError& view_error) {
+  theia::View* view = pose_dataset_.MutableView(view_id);
+  theia::Camera* camera = view->MutableCamera();
+  const double* intrinsics = camera->intrinsics();
+  double* extrinsics = camera->mutable_extrinsics();
+  view_error = utils::ViewReprojectionError();
+  view_error.view_id = view_id;
+
+  return utils::DispatchCameraModel(
+      camera->GetCameraIntrinsicsModelType(), [&](auto model_tag) {
+        using CameraModel = typename decltype(model_tag)::CameraModel;
+        using ResidualT = PoseReprojectionError<CameraModel>;
+        std::vector<ResidualT> residuals;
+        residuals.reserve(view->NumFeatures());
+        for (const theia::TrackId track_id : view->TrackIds()) {
+          residuals.emplace_back(
+              pose_dataset_.Track(track_id)->Point().hnormalized(),
+              view->GetFeature(track_id)->point_,
+              intrinsics);
+        }
+
+        ceres::HuberLoss loss_function(ba_options_.robust_loss_width);
+        ceres::Problem::Options problem_options;
+        problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        ceres::Problem problem(problem_options);
+        for (const ResidualT& residual : residuals) {
+          problem.AddResidualBlock(
+              new ceres::AutoDiffCostFunction<ResidualT,
+                                              2,
+                                              theia::Camera::kExtrinsicsSize>(
+                  new ResidualT(residual)),
+              &loss_function,
+              extrinsics);
+        }
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::DENSE_QR;
+        options.max_num_iterations = ba_options_.max_num_iterations;
+        options.logging_type = ceres::SILENT;
+        ceres::Solver::Summary summary;
+        ceres::Solve(options, &problem, &summary);
+        if (!summary.IsSolutionUsable()) {
+          return false;
+        }
+
+        // the error of the refined pose, so FilterBadPoses does not need
+        // to reproject the view again
+        std::vector<double> errors;
+        errors.reserve(residuals.size());
+        double sum_sq = 0.0;
+        for (const ResidualT& residual : residuals) {
+          Eigen::Vector2d error;
+          if (!residual(static_cast<const double*>(extrinsics),
+                        error.data())) {
+            ++view_error.num_invalid;
+            continue;
+          }
+          errors.push_back(error.norm());
+          sum_sq += error.squaredNorm();
+          view_error.mean += errors.back();
+          view_error.max = std::max(view_error.max, errors.back());
+        }
+        view_error.num_observations = errors.size();
+        if (!errors.empty()) {
+          view_error.mean /= errors.size();
+          view_error.rmse = std::sqrt(sum_sq / errors.size());
+          view_error.median = utils::MedianOfDoubleVec(errors);
+        }
+        return true;
+      });
+}
+
+void PoseEstimator::AlternateBoardRefinement(
+    const std::vector<theia::TrackId>& track_ids,
+    std::map<theia::TrackId, Eigen::Matrix3d>& covariances,
+    double& variance_factor) {
+  // well conditioned views observe at least the median number of board
+  // points, a subset spread evenly over the recording is enough
+  std::vector<theia::ViewId> view_ids = pose_dataset_.ViewIds();
+  std::sort(view_ids.begin(), view_ids.end());
+  std::vector<double> num_features;
+  for (const theia::ViewId view_id : view_ids) {
+    num_features.push_back(pose_dataset_.View(view_id)->NumFeatures());
+  }
+  const double median_num_features = utils::MedianOfDoubleVec(num_features);
+  std::vector<theia::ViewId> candidate_ids;
+  for (const theia::ViewId view_id : view_ids) {
+    if (pose_dataset_.View(view_id)->NumFeatures() >= median_num_features) {
+      candidate_ids.push_back(view_id);
+    }
+  }
+  std::vector<theia::ViewId> refinement_ids = candidate_ids;
+  if (max_board_refinement_views_ > 0 &&
+      candidate_ids.size() > size_t(max_board_refinement_views_)) {
+    refinement_ids.clear();
+    const double stride =
+        double(candidate_ids.size()) / max_board_refinement_views_;
+    for (int i = 0; i < max_board_refinement_views_; ++i) {
+      refinement_ids.push_back(candidate_ids[size_t(i * stride)]);
+    }
+  }
+  const std::unordered_set<theia::ViewId> refinement_views(
+      refinement_ids.begin(), refinement_ids.end());
+  LOG(INFO) << "Refining the board points on " << refinement_ids.size()
+            << " of " << view_ids.size() << " views.";
+
+  // the points of fixed views and the poses of fixed points are
+  // independent problems, so both steps run in parallel. The last step
+  // refines the points, its information gives the covariances
+  std::vector<Eigen::Matrix3d> informations(track_ids.size());
+  std::vector<double> squared_errors(track_ids.size(), 0.0);
+  std::vector<int> num_residuals(track_ids.size(), 0);
+  std::vector<char> refined(track_ids.size(), 0);
+  std::vector<utils::ViewReprojectionError> view_errors(refinement_ids.size());
+  for (int round = 0; round < board_refinement_rounds_; ++round) {
+    if (round > 0) {
+      utils::ParallelFor(
+          refinement_ids.size(),
+          num_threads_,
+          [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+            for (size_t i = begin; i < end; ++i) {
+              RefineViewPose(refinement_ids[i], view_errors[i]);
+            }
+          });
+    }
+    utils::ParallelFor(
+        track_ids.size(),
+        num_threads_,
+        [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+          for (size_t i = begin; i < end; ++i) {
+            refined[i] = RefineBoardPoint(track_ids[i],
+                                          refinement_views,
+                                          informations[i],
+                                          squared_errors[i],
+                                          num_residuals[i]);
+          }
+        });
+  }
+
+  double squared_error = 0.0;
+  int num_dof = 0;
+  for (size_t i = 0; i < track_ids.size(); ++i) {
+    if (refined[i]) {
+      squared_error += squared_errors[i];
+      num_dof += 2 * num_residuals[i] - 3;
+    }
+  }
+  variance_factor = num_dof > 0 ? squared_error / num_dof : 0.0;
+  covariances.clear();
+  for (size_t i = 0; i < track_ids.size(); ++i) {
+    if (refined[i] && informations[i].determinant() > 0.0) {
+      covariances[track_ids[i]] = informations[i].inverse() * variance_factor;
+    }
+  }
+}
+
+bool PoseEstimator::RefineBoardPoint(
+    const theia::TrackId track_id,
+    const std::unordered_set<theia::ViewId>& view_ids,
+    Eigen::Matrix3d& information,
+    double& squared_error,
+    int& num_residuals) {
+  information.setZero();
+  squared_error = 0.0;
+  num_residuals = 0;
+  theia::Track* track = pose_dataset_.MutableTrack(track_id);
+  std::vector<const theia::View*> views;
+  for (const theia::ViewId view_id : track->ViewIds()) {
+    if (view_ids.count(view_id)) {
+      views.push_back(pose_dataset_.View(view_id));
+    }
+  }
+  // a point needs a few views from different directions
+  if (views.size() < 3) {
+    return false;
+  }
+  Eigen::Vector3d point = track->Point().hnormalized();
+
+  return utils::DispatchCameraModel(
+      views[0]->Camera().GetCameraIntrinsicsModelType(), [&](auto model_tag) {
+        using CameraModel = typename decltype(model_tag)::CameraModel;
+        using ResidualT = BoardPointReprojectionError<CameraModel>;
+        using CostFunctionT = ceres::AutoDiffCostFunction<ResidualT, 2, 3>;
+        ceres::HuberLoss loss_function(ba_options_.robust_loss_width);
+        ceres::Problem::Options problem_options;
+        problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        ceres::Problem problem(problem_options);
+        std::vector<const CostFunctionT*> cost_functions;
+        for (const theia::View* view : views) {
+          CostFunctionT* cost_function = new CostFunctionT(
+              new ResidualT(view->Camera().extrinsics(),
+                            view->GetFeature(track_id)->point_,
+                            view->Camera().intrinsics()));
+          cost_functions.push_back(cost_function);
+          problem.AddResidualBlock(
+              cost_function, &loss_function, point.data());
+        }
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::DENSE_QR;
+        options.max_num_iterations = ba_options_.max_num_iterations;
+        options.logging_type = ceres::SILENT;
+        ceres::Solver::Summary summary;
+        ceres::Solve(options, &problem, &summary);
+        if (!summary.IsSolutionUsable()) {
+          return false;
+        }
+
+        const double* parameters[] = {point.data()};
+        for (const CostFunctionT* cost_function : cost_functions) {
+          Eigen::Vector2d residual;
+          Eigen::Matrix<double, 2, 3, Eigen::RowMajor> jacobian;
+          double* jacobians[] = {jacobian.data()};
+          if (!cost_function->Evaluate(
+                  parameters, residual.data(), jacobians)) {
+            continue;
+          }
+          information += jacobian.transpose() * jacobian;
+          squared_error += residual.squaredNorm();
+          ++num_residuals;
+        }
+        *track->MutablePoint() = point.homogeneous();
+        return true;
+      });
+}
+
 void PoseEstimator::FilterBadPoses() {
 
   // sometimes it happens that poses are far away or
@@ -257,6 +989,36 @@ void PoseEstimator::FilterBadPoses() {
       }
   }
 
+  // views that reproject much worse than the others after the optimization
+  std::vector<utils::ViewReprojectionError> view_errors;
+  if (refined_view_errors_.empty()) {
+    utils::ComputeViewReprojectionErrors(
+        pose_dataset_, pose_dataset_.ViewIds(), view_errors, num_threads_);
+  } else {
+    for (const utils::ViewReprojectionError& view_error :
+         refined_view_errors_) {
+      if (pose_dataset_.View(view_error.view_id)) {
+        view_errors.push_back(view_error);
+      }
+    }
+    refined_view_errors_.clear();
+  }
+  std::vector<double> mean_errors;
+  for (const utils::ViewReprojectionError& view_error : view_errors) {
+    mean_errors.push_back(view_error.mean);
+  }
+  if (mean_errors.empty()) {
+    return;
+  }
+  const double median_error = utils::MedianOfDoubleVec(mean_errors);
+  for (const utils::ViewReprojectionError& view_error : view_errors) {
+    if (view_error.mean > max_reproj_error_factor_ * median_error) {
+      LOG(INFO) << "Removing view " << view_error.view_id
+                << " due to large reprojection error: " << view_error.mean
+                << " vs median reprojection error " << median_error << "\n";
+      pose_dataset_.RemoveView(view_error.view_id);
+    }
+  }
 }
 
 }  // namespace core
@@ -0,0 +1,215 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/reprojection_video_renderer.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/ring_queue.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <glog/logging.h>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! One frame passed through the rendering pipeline
+struct ReprojectionFrame {
+  size_t frame_idx = 0;
+  theia::ViewId view_id = theia::kInvalidViewId;
+  cv::Mat image;
+};
+
+void RenderFrame(const theia::Reconstruction& calib_dataset,
+                 const Sophus::SE3d& T_w_c,
+                 theia::Camera& camera,
+                 ReprojectionFrame& frame) {
+  const theia::View* view = calib_dataset.View(frame.view_id);
+  camera.SetOrientationFromRotationMatrix(
+      T_w_c.rotationMatrix().transpose());
+  camera.SetPosition(T_w_c.translation());
+  cv::resize(frame.image,
+             frame.image,
+             cv::Size(camera.ImageWidth(), camera.ImageHeight()));
+
+  const std::vector<theia::TrackId> track_ids = view->TrackIds();
+  double reproj_error = 0.0;
+  for (const theia::TrackId id : track_ids) {
+    Eigen::Vector2d pixel;
+    camera.ProjectPoint(calib_dataset.Track(id)->Point(), &pixel);
+    const theia::Feature measurement = (*view->GetFeature(id));
+    cv::drawMarker(frame.image,
+                   cv::Point(cvRound(pixel[0]), cvRound(pixel[1])),
+                   cv::Scalar(0, 0, 255),
+                   cv::MARKER_CROSS,
+                   10,
+                   1);
+
+    reproj_error += (measurement.point_ - pixel).norm();
+  }
+  if (!track_ids.empty()) {
+    reproj_error /= static_cast<double>(track_ids.size());
+  }
+  cv::putText(frame.image,
+              "Reprojection error: " + std::to_string(reproj_error) +
+                  " pixel",
+              cv::Point(20, 20),
+              cv::FONT_HERSHEY_COMPLEX_SMALL,
+              1.0,
+              cv::Scalar(255, 0, 0));
+}
+
+}  // namespace
+
+bool RenderReprojectionVideo(
+    const std::string& input_video_path,
+    const theia::Reconstruction& calib_dataset,
+    const std::unordered_map<theia::ViewId, Sophus::SE3d>& T_w_c,
+    const theia::Camera& camera,
+    const ReprojectionVideoOptions& options) {
+  cv::VideoCapture input_video;
+  if (!input_video.open(input_video_path)) {
+    LOG(ERROR) << "Could not open the video " << input_video_path;
+    return false;
+  }
+  const int frame_step = std::max(1, options.frame_step);
+  const int num_threads = std::max(1, options.num_threads);
+  const double output_fps =
+      std::max(1.0, input_video.get(cv::CAP_PROP_FPS) / frame_step);
+
+  utils::BoundedQueue<ReprojectionFrame> decoded_frames(2 * num_threads);
+  // several workers pop the decoded frames, only the writer the rendered ones
+  utils::MpscQueue<ReprojectionFrame> rendered_frames(2 * num_threads);
+  rendered_frames.SetMetricsName("reprojection_rendered_frames");
+
+  // views by their timestamp in microseconds, the resolution of the corner
+  // file keys
+  std::unordered_map<int64_t, theia::ViewId> view_ids_us;
+  for (const theia::ViewId view_id : calib_dataset.ViewIds()) {
+    view_ids_us[std::llround(calib_dataset.View(view_id)->GetTimestamp() *
+                             S_TO_US)] = view_id;
+  }
+
+  // the timestamp is queried from the capture right after each read, so
+  // decoding stays on one thread
+  std::thread reader([&]() {
+    int cnt_wrong = 0;
+    size_t video_frame_idx = 0;
+    size_t frame_idx = 0;
+    while (options.max_frames <= 0 ||
+           frame_idx < static_cast<size_t>(options.max_frames)) {
+      ReprojectionFrame frame;
+      if (!input_video.read(frame.image)) {
+        cnt_wrong++;
+        if (cnt_wrong > 500) break;
+        continue;
+      }
+      const double timestamp_s =
+          input_video.get(cv::CAP_PROP_POS_MSEC) * MS_TO_S;
+      if (options.end_s > 0.0 && timestamp_s > options.end_s) break;
+      if (timestamp_s < options.start_s ||
+          video_frame_idx++ % frame_step != 0) {
+        continue;
+      }
+
+      const auto view_it =
+          view_ids_us.find(std::llround(timestamp_s * S_TO_US));
+      if (view_it == view_ids_us.end() ||
+          T_w_c.find(view_it->second) == T_w_c.end()) {
+        continue;
+      }
+      frame.view_id = view_it->second;
+      frame.frame_idx = frame_idx++;
+      if (!decoded_frames.Push(std::move(frame))) break;
+    }
+    decoded_frames.Close();
+  });
+
+  std::atomic<int> active_workers(num_threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; ++t) {
+    workers.emplace_back([&]() {
+      // every worker poses its own copy of the camera
+      theia::Camera worker_camera(camera);
+      ReprojectionFrame frame;
+      while (decoded_frames.Pop(frame)) {
+        RenderFrame(calib_dataset,
+                    T_w_c.at(frame.view_id),
+                    worker_camera,
+                    frame);
+        rendered_frames.Push(std::move(frame));
+      }
+      if (--active_workers == 0) {
+        rendered_frames.Close();
+      }
+    });
+  }
+
+  // ordered writer. The video writer and the window are only used from this
+  // thread and get the frames in video order.
+  cv::VideoWriter output_video;
+  bool output_ok = true;
+  std::map<size_t, ReprojectionFrame> pending_frames;
+  size_t next_frame_idx = 0;
+  ReprojectionFrame frame;
+  while (rendered_frames.Pop(frame)) {
+    pending_frames[frame.frame_idx] = std::move(frame);
+    auto it = pending_frames.find(next_frame_idx);
+    while (it != pending_frames.end()) {
+      const cv::Mat& image = it->second.image;
+      if (options.output_path.empty()) {
+        cv::imshow("spline reprojection", image);
+        cv::waitKey(0);
+      } else if (output_ok) {
+        if (!output_video.isOpened()) {
+          if (!output_video.open(options.output_path,
+                                 cv::VideoWriter::fourcc('m', 'p', '4', 'v'),
+                                 output_fps,
+                                 image.size())) {
+            LOG(ERROR) << "Could not open " << options.output_path
+                       << " for writing.";
+            output_ok = false;
+          }
+        }
+        if (output_ok) {
+          output_video.write(image);
+        }
+      }
+      pending_frames.erase(it);
+      it = pending_frames.find(++next_frame_idx);
+    }
+  }
+
+  reader.join();
+  for (auto& w : workers) {
+    w.join();
+  }
+  LOG(INFO) << "Rendered " << next_frame_idx << " debug video frames.";
+  return output_ok;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,101 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/residual_timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace OpenICC {
+namespace core {
+
+void ResidualTimer::Record(const bool jacobians, const int64_t time_ns) {
+  if (jacobians) {
+    ++num_jacobian_evaluations_;
+    jacobian_time_ns_ += time_ns;
+  } else {
+    ++num_residual_evaluations_;
+    residual_time_ns_ += time_ns;
+  }
+}
+
+void ResidualTimer::Reset() {
+  num_residual_evaluations_ = 0;
+  num_jacobian_evaluations_ = 0;
+  residual_time_ns_ = 0;
+  jacobian_time_ns_ = 0;
+}
+
+ResidualTiming ResidualTimer::Timing() const {
+  ResidualTiming timing;
+  timing.name = name_;
+  timing.num_jacobian_evaluations = num_jacobian_evaluations_;
+  timing.num_evaluations =
+      num_residual_evaluations_ + timing.num_jacobian_evaluations;
+  timing.residual_time_s = residual_time_ns_ * 1e-9;
+  timing.jacobian_time_s = jacobian_time_ns_ * 1e-9;
+  return timing;
+}
+
+TimedCostFunction::TimedCostFunction(
+    const ceres::CostFunction* cost_function, ResidualTimer* timer)
+    : cost_function_(cost_function), timer_(timer) {
+  set_num_residuals(cost_function_->num_residuals());
+  *mutable_parameter_block_sizes() = cost_function_->parameter_block_sizes();
+}
+
+bool TimedCostFunction::Evaluate(double const* const* parameters,
+                                 double* residuals,
+                                 double** jacobians) const {
+  const auto start = std::chrono::steady_clock::now();
+  const bool success =
+      cost_function_->Evaluate(parameters, residuals, jacobians);
+  timer_->Record(jacobians != nullptr,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count());
+  return success;
+}
+
+void ReportResidualTimings(std::vector<ResidualTiming> timings) {
+  const auto total_time = [](const ResidualTiming& timing) {
+    return timing.residual_time_s + timing.jacobian_time_s;
+  };
+  std::sort(timings.begin(),
+            timings.end(),
+            [&](const ResidualTiming& a, const ResidualTiming& b) {
+              return total_time(a) > total_time(b);
+            });
+  std::cout << "Residual evaluations:\n";
+  for (const ResidualTiming& timing : timings) {
+    if (timing.num_evaluations == 0) {
+      continue;
+    }
+    const int64_t num_residual_evaluations =
+        timing.num_evaluations - timing.num_jacobian_evaluations;
+    std::cout << std::setw(20) << timing.name << ": "
+              << num_residual_evaluations << " residual in "
+              << timing.residual_time_s << "s, "
+              << timing.num_jacobian_evaluations << " jacobian in "
+              << timing.jacobian_time_s << "s, "
+              << 1e6 * total_time(timing) / timing.num_evaluations
+              << "us per evaluation\n";
+  }
+}
+
+}  // namespace core
+}  // namespace OpenICC
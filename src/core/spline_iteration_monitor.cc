@@ -0,0 +1,95 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_iteration_monitor.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace OpenICC {
+namespace core {
+
+SplineIterationMonitor::SplineIterationMonitor(
+    const SplineConvergenceCriteria& criteria,
+    SplineIterationCallback callback,
+    std::function<double()> reprojection_error)
+    : criteria_(criteria),
+      callback_(std::move(callback)),
+      reprojection_error_(std::move(reprojection_error)) {}
+
+ceres::CallbackReturnType SplineIterationMonitor::operator()(
+    const ceres::IterationSummary& summary) {
+  SplineIterationSummary iteration;
+  iteration.iteration = summary.iteration;
+  iteration.cost = summary.cost;
+  iteration.cost_change = summary.cost_change;
+  iteration.step_norm = summary.step_norm;
+  // the first iteration evaluates the initial state
+  iteration.step_is_successful =
+      summary.step_is_successful || summary.iteration == 0;
+  iteration.cumulative_time_s = summary.cumulative_time_in_seconds;
+  // an unsuccessful step leaves the parameters untouched
+  if (iteration.step_is_successful && Active()) {
+    iteration.reprojection_error = reprojection_error_();
+  }
+
+  if (callback_ && !callback_(iteration)) {
+    LOG(INFO) << "Spline optimization stopped by the iteration callback.";
+    return ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+  }
+  if (iteration.step_is_successful &&
+      Converged(iteration.reprojection_error)) {
+    return ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+  }
+  return ceres::SOLVER_CONTINUE;
+}
+
+bool SplineIterationMonitor::Converged(const double reprojection_error) {
+  if (!criteria_.Enabled() || reprojection_error < 0.0) {
+    return false;
+  }
+  if (criteria_.target_reprojection_error > 0.0 &&
+      reprojection_error < criteria_.target_reprojection_error) {
+    LOG(INFO) << "Reprojection error " << reprojection_error
+              << " reached the target of "
+              << criteria_.target_reprojection_error << ".";
+    return true;
+  }
+  if (criteria_.min_relative_reprojection_improvement <= 0.0) {
+    return false;
+  }
+
+  const size_t window = std::max(criteria_.window, 1);
+  errors_.push_back(reprojection_error);
+  if (errors_.size() > window + 1) {
+    errors_.pop_front();
+  }
+  if (errors_.size() <= window || errors_.front() <= 0.0) {
+    return false;
+  }
+  const double improvement =
+      (errors_.front() - errors_.back()) / errors_.front();
+  if (improvement < criteria_.min_relative_reprojection_improvement) {
+    LOG(INFO) << "Reprojection error improved by " << improvement * 100.0
+              << "% over the last " << window << " iterations, stopping.";
+    return true;
+  }
+  return false;
+}
+
+}  // namespace core
+}  // namespace OpenICC
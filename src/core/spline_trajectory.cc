@@ -0,0 +1,301 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_trajectory.h"
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_spline_helper.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace core {
+
+template <int _N>
+bool SplineTrajectory<_N>::Initialize(const io::SplineState& state) {
+  if (state.spline_order != _N) {
+    LOG(ERROR) << "The spline state has order " << state.spline_order
+               << ", the trajectory " << _N << ".";
+    return false;
+  }
+  if (state.so3_knots.size() < size_t(N_) ||
+      state.r3_knots.size() < size_t(N_) || state.dt_so3_ns <= 0 ||
+      state.dt_r3_ns <= 0) {
+    LOG(ERROR) << "The spline state has too few knots.";
+    return false;
+  }
+  start_t_ns_ = state.start_t_ns;
+  dt_so3_ns_ = state.dt_so3_ns;
+  dt_r3_ns_ = state.dt_r3_ns;
+  inv_so3_dt_ = S_TO_NS / double(dt_so3_ns_);
+  inv_r3_dt_ = S_TO_NS / double(dt_r3_ns_);
+
+  so3_segments_.resize(state.so3_knots.size() - N_ + 1);
+  for (size_t s = 0; s < so3_segments_.size(); ++s) {
+    SO3Segment& segment = so3_segments_[s];
+    segment.start = state.so3_knots[s];
+    for (int k = 0; k < DEG_; ++k) {
+      segment.delta[k] = Sophus::LieFastPath<Sophus::SO3d>::log(
+          state.so3_knots[s + k].inverse() * state.so3_knots[s + k + 1]);
+    }
+  }
+
+  // the position is the blending weights times the knots, with the weights
+  // polynomials in u the knots fold into the polynomial coefficients
+  const Eigen::Matrix<double, N_, N_> blending =
+      CeresSplineHelper<double, N_>::blending_matrix_.transpose();
+  r3_segments_.resize(state.r3_knots.size() - N_ + 1);
+  for (size_t s = 0; s < r3_segments_.size(); ++s) {
+    Eigen::Matrix<double, N_, 3> knots;
+    for (int k = 0; k < N_; ++k) {
+      knots.row(k) = state.r3_knots[s + k].transpose();
+    }
+    r3_segments_[s] = blending * knots;
+  }
+
+  T_i_c_ = state.T_i_c;
+  gravity_ = state.gravity;
+  cam_line_delay_s_ = state.cam_line_delay_s;
+  imu_to_camera_time_offset_s_ = state.imu_to_camera_time_offset_s;
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::Initialize(
+    const SplineTrajectoryEstimator<_N>& estimator) {
+  io::SplineState state;
+  estimator.GetState(state);
+  return Initialize(state);
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::Load(const std::string& spline_state_path) {
+  io::SplineState state;
+  if (!io::ReadSplineState(spline_state_path, state)) {
+    LOG(ERROR) << "Could not read the spline state " << spline_state_path;
+    return false;
+  }
+  return Initialize(state);
+}
+
+template <int _N>
+int64_t SplineTrajectory<_N>::GetMaxTimeNs() const {
+  return start_t_ns_ +
+         std::min(int64_t(so3_segments_.size()) * dt_so3_ns_,
+                  int64_t(r3_segments_.size()) * dt_r3_ns_) -
+         1;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::Segment(const int64_t time_ns,
+                                   const int64_t dt_ns,
+                                   const size_t num_segments,
+                                   size_t& s,
+                                   double& u) const {
+  const int64_t st_ns = time_ns - start_t_ns_;
+  if (st_ns < 0 || size_t(st_ns / dt_ns) >= num_segments) {
+    return false;
+  }
+  s = st_ns / dt_ns;
+  u = double(st_ns % dt_ns) / double(dt_ns);
+  return true;
+}
+
+template <int _N>
+void SplineTrajectory<_N>::EvaluateSO3(const SO3Segment& segment,
+                                       const double u,
+                                       Sophus::SO3d& orientation,
+                                       Eigen::Vector3d* velocity) const {
+  using VecN = Eigen::Matrix<double, N_, 1>;
+  VecN coeff, dcoeff;
+  CeresSplineHelper<double, N_>::template computeCoeffs<0, true>(
+      u, inv_so3_dt_, coeff);
+  if (velocity) {
+    CeresSplineHelper<double, N_>::template computeCoeffs<1, true>(
+        u, inv_so3_dt_, dcoeff);
+    velocity->setZero();
+  }
+  orientation = segment.start;
+  for (int k = 0; k < DEG_; ++k) {
+    const Sophus::SO3d exp_kdelta = Sophus::LieFastPath<Sophus::SO3d>::exp(
+        segment.delta[k] * coeff[k + 1]);
+    orientation *= exp_kdelta;
+    if (velocity) {
+      *velocity = exp_kdelta.inverse() * (*velocity) +
+                  segment.delta[k] * dcoeff[k + 1];
+    }
+  }
+}
+
+template <int _N>
+template <int Derivative>
+Eigen::Vector3d SplineTrajectory<_N>::EvaluateR3(const R3Segment& segment,
+                                                 const double u) {
+  Eigen::Vector3d value = Eigen::Vector3d::Zero();
+  for (int d = N_ - 1; d >= Derivative; --d) {
+    double factor = 1.0;
+    for (int k = 0; k < Derivative; ++k) {
+      factor *= d - k;
+    }
+    value = value * u + factor * segment.row(d).transpose();
+  }
+  return value;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetPose(const int64_t time_ns,
+                                   Sophus::SE3d& pose) const {
+  Sophus::SO3d orientation;
+  Eigen::Vector3d position;
+  if (!GetOrientation(time_ns, orientation) ||
+      !GetPosition(time_ns, position)) {
+    return false;
+  }
+  pose = Sophus::SE3d(orientation, position);
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetOrientation(const int64_t time_ns,
+                                          Sophus::SO3d& orientation) const {
+  size_t s;
+  double u;
+  if (!Segment(time_ns, dt_so3_ns_, so3_segments_.size(), s, u)) {
+    return false;
+  }
+  EvaluateSO3(so3_segments_[s], u, orientation, nullptr);
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetPosition(const int64_t time_ns,
+                                       Eigen::Vector3d& position) const {
+  size_t s;
+  double u;
+  if (!Segment(time_ns, dt_r3_ns_, r3_segments_.size(), s, u)) {
+    return false;
+  }
+  position = EvaluateR3<0>(r3_segments_[s], u);
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetAngularVelocity(
+    const int64_t time_ns, Eigen::Vector3d& velocity) const {
+  size_t s;
+  double u;
+  if (!Segment(time_ns, dt_so3_ns_, so3_segments_.size(), s, u)) {
+    return false;
+  }
+  Sophus::SO3d orientation;
+  EvaluateSO3(so3_segments_[s], u, orientation, &velocity);
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetVelocity(const int64_t time_ns,
+                                       Eigen::Vector3d& velocity) const {
+  size_t s;
+  double u;
+  if (!Segment(time_ns, dt_r3_ns_, r3_segments_.size(), s, u)) {
+    return false;
+  }
+  velocity = inv_r3_dt_ * EvaluateR3<1>(r3_segments_[s], u);
+  return true;
+}
+
+template <int _N>
+bool SplineTrajectory<_N>::GetAcceleration(
+    const int64_t time_ns, Eigen::Vector3d& acceleration) const {
+  size_t s;
+  double u;
+  Sophus::SO3d orientation;
+  if (!GetOrientation(time_ns, orientation) ||
+      !Segment(time_ns, dt_r3_ns_, r3_segments_.size(), s, u)) {
+    return false;
+  }
+  const Eigen::Vector3d accel_world =
+      inv_r3_dt_ * inv_r3_dt_ * EvaluateR3<2>(r3_segments_[s], u);
+  acceleration = orientation.inverse() * (accel_world + gravity_);
+  return true;
+}
+
+template <int _N>
+void SplineTrajectory<_N>::Evaluate(const std::vector<int64_t>& times_ns,
+                                    const int flags,
+                                    TrajectorySamples& samples,
+                                    const int num_threads) const {
+  const size_t num_samples = times_ns.size();
+  samples.valid.assign(num_samples, 0);
+  if (flags & SAMPLE_POSE) {
+    samples.rotation.setZero(num_samples, 4);
+    samples.rotation.col(3).setOnes();
+    samples.position.setZero(num_samples, 3);
+  }
+  if (flags & SAMPLE_ANGULAR_VELOCITY) {
+    samples.angular_velocity.setZero(num_samples, 3);
+  }
+  if (flags & SAMPLE_ACCELERATION) {
+    samples.acceleration.setZero(num_samples, 3);
+  }
+
+  utils::ParallelFor(
+      num_samples, num_threads, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) {
+          size_t s_so3, s_r3;
+          double u_so3, u_r3;
+          if (!Segment(times_ns[i],
+                       dt_so3_ns_,
+                       so3_segments_.size(),
+                       s_so3,
+                       u_so3) ||
+              !Segment(
+                  times_ns[i], dt_r3_ns_, r3_segments_.size(), s_r3, u_r3)) {
+            continue;
+          }
+          samples.valid[i] = 1;
+          Sophus::SO3d orientation;
+          Eigen::Vector3d velocity;
+          EvaluateSO3(so3_segments_[s_so3],
+                      u_so3,
+                      orientation,
+                      (flags & SAMPLE_ANGULAR_VELOCITY) ? &velocity : nullptr);
+          const R3Segment& r3_segment = r3_segments_[s_r3];
+          if (flags & SAMPLE_POSE) {
+            samples.rotation.row(i) =
+                orientation.unit_quaternion().coeffs().transpose();
+            samples.position.row(i) =
+                EvaluateR3<0>(r3_segment, u_r3).transpose();
+          }
+          if (flags & SAMPLE_ANGULAR_VELOCITY) {
+            samples.angular_velocity.row(i) = velocity.transpose();
+          }
+          if (flags & SAMPLE_ACCELERATION) {
+            const Eigen::Vector3d accel_world =
+                inv_r3_dt_ * inv_r3_dt_ * EvaluateR3<2>(r3_segment, u_r3);
+            samples.acceleration.row(i) =
+                (orientation.inverse() * (accel_world + gravity_))
+                    .transpose();
+          }
+        }
+      });
+}
+
+template class SplineTrajectory<4>;
+template class SplineTrajectory<5>;
+template class SplineTrajectory<6>;
+
+}  // namespace core
+}  // namespace OpenICC
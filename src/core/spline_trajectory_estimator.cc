@@ -0,0 +1,107 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
+#include "OpenCameraCalibrator/core/spline_trajectory_estimator.impl.h"
+
+namespace OpenICC {
+namespace core {
+
+const char kTrajectoryMagic[8] = {'O', 'I', 'C', 'C', 'T', 'R', 'J', '1'};
+
+namespace {
+
+template <typename T>
+void AppendColumns(const T* data, const size_t num, std::vector<char>& raw) {
+  const char* bytes = reinterpret_cast<const char*>(data);
+  raw.insert(raw.end(), bytes, bytes + num * sizeof(T));
+}
+
+}  // namespace
+
+void PackTrajectoryChunk(const std::vector<int64_t>& times_ns,
+                         const TrajectorySamples& samples,
+                         const int flags,
+                         std::vector<char>& raw) {
+  const size_t n = times_ns.size();
+  AppendColumns(times_ns.data(), n, raw);
+  AppendColumns(samples.valid.data(), n, raw);
+  // the sample matrices are column major, every column is one block
+  if (flags & SAMPLE_POSE) {
+    AppendColumns(samples.rotation.data(), 4 * n, raw);
+    AppendColumns(samples.position.data(), 3 * n, raw);
+  }
+  if (flags & SAMPLE_ANGULAR_VELOCITY) {
+    AppendColumns(samples.angular_velocity.data(), 3 * n, raw);
+  }
+  if (flags & SAMPLE_ACCELERATION) {
+    AppendColumns(samples.acceleration.data(), 3 * n, raw);
+  }
+  if (flags & SAMPLE_BIASES) {
+    AppendColumns(samples.gyro_bias.data(), 3 * n, raw);
+    AppendColumns(samples.accl_bias.data(), 3 * n, raw);
+  }
+}
+
+bool SplineSolverProfileFromString(const std::string& profile_name,
+                                   const std::string& sparse_backend,
+                                   SplineSolverProfile& profile) {
+  profile = SplineSolverProfile();
+  profile.name = profile_name;
+  if (profile_name == "ordered_normal_cholesky") {
+    profile.use_elimination_ordering = true;
+  } else if (profile_name == "sparse_schur") {
+    profile.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else if (profile_name == "iterative_schur") {
+    profile.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    profile.preconditioner_type = ceres::SCHUR_JACOBI;
+  } else if (profile_name == "dense_normal_cholesky") {
+    profile.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
+  } else if (profile_name == "dense_schur") {
+    profile.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (profile_name != "sparse_normal_cholesky") {
+    LOG(ERROR) << "Unknown solver profile: " << profile_name;
+    return false;
+  }
+  if (!ceres::StringToSparseLinearAlgebraLibraryType(
+          sparse_backend, &profile.sparse_linear_algebra_library_type)) {
+    LOG(ERROR) << "Unknown sparse linear algebra library: " << sparse_backend;
+    return false;
+  }
+  return true;
+}
+
+bool SplineDenseBackendFromString(const std::string& dense_backend,
+                                  SplineSolverProfile& profile) {
+  if (!ceres::StringToDenseLinearAlgebraLibraryType(
+          dense_backend, &profile.dense_linear_algebra_library_type)) {
+    LOG(ERROR) << "Unknown dense linear algebra library: " << dense_backend;
+    return false;
+  }
+  if (!ceres::IsDenseLinearAlgebraLibraryTypeAvailable(
+          profile.dense_linear_algebra_library_type)) {
+    LOG(ERROR) << "Ceres was built without the dense linear algebra library "
+               << dense_backend;
+    return false;
+  }
+  return true;
+}
+
+template class SplineTrajectoryEstimator<4>;
+template class SplineTrajectoryEstimator<5>;
+template class SplineTrajectoryEstimator<6>;
+
+}  // namespace core
+}  // namespace OpenICC
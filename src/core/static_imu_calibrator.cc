@@ -1,9 +1,12 @@
 #include "OpenCameraCalibrator/core/static_imu_calibrator.h"
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/gyro_integration.h"
 #include "OpenCameraCalibrator/utils/imu_data_interval.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 
 #include "ceres/ceres.h"
 #include <glog/logging.h>
+#include <algorithm>
 #include <iostream>
 #include <limits>
 
@@ -49,94 +52,174 @@ StaticImuCalibrator::StaticImuCalibrator()
       acc_use_means_(false),
       gyro_dt_(-1.0),
       optimize_gyro_bias_(false),
+      num_threads_(utils::Executor::Global().MaxConcurrency()),
       verbose_output_(true) {}
 
+namespace {
+
+bool SameIntervals(const std::vector<DataInterval>& a,
+                   const std::vector<DataInterval>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].start_idx != b[i].start_idx || a[i].end_idx != b[i].end_idx)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 bool StaticImuCalibrator::CalibrateAcc(const ImuReadings& acc_samples) {
   std::cout << "Accelerometers calibration: calibrating...";
 
   min_cost_static_intervals_.clear();
-  calib_acc_samples_.clear();
-  calib_gyro_samples_.clear();
 
-  int n_samps = acc_samples.size();
+  acc_arrays_ = ImuSampleArraysd(acc_samples);
+  const ImuSamplesViewd acc_view(acc_arrays_);
 
   utils::DataInterval init_static_interval =
-      DataInterval::InitialInterval(acc_samples, init_interval_duration_);
-  Vector3d acc_mean = DataMean(acc_samples, init_static_interval);
+      DataInterval::InitialInterval(acc_view, init_interval_duration_);
+  Vector3d acc_mean = DataMean(acc_view, init_static_interval);
   Eigen::Vector3d::Index max_index;
   acc_mean.maxCoeff(&max_index);
   acc_mean[max_index] -= g_mag_;
   init_acc_calib_.SetBias(acc_mean);
   std::cout << "Setting initial accelerometer bias: "
             << init_acc_calib_.GetBiasVector().transpose() << "\n";
-  Vector3d acc_variance = DataVariance(acc_samples, init_static_interval);
+  Vector3d acc_variance = DataVariance(acc_view, init_static_interval);
   double norm_th = acc_variance.norm();
 
   double min_cost = std::numeric_limits<double>::max();
   int min_cost_th = -1;
   std::vector<double> min_cost_calib_params;
 
-  for (int th_mult = 1; th_mult <= 10; th_mult++) {
-    std::vector<DataInterval> static_intervals;
-    ImuReadings static_samples;
-    std::vector<double> acc_calib_params(9);
-
-    acc_calib_params[0] = init_acc_calib_.misYZ();
-    acc_calib_params[1] = init_acc_calib_.misZY();
-    acc_calib_params[2] = init_acc_calib_.misZX();
-
-    acc_calib_params[3] = init_acc_calib_.scaleX();
-    acc_calib_params[4] = init_acc_calib_.scaleY();
-    acc_calib_params[5] = init_acc_calib_.scaleZ();
-
-    acc_calib_params[6] = init_acc_calib_.biasX();
-    acc_calib_params[7] = init_acc_calib_.biasY();
-    acc_calib_params[8] = init_acc_calib_.biasZ();
-
+  std::vector<std::vector<DataInterval>> static_intervals_per_th;
+  if (shared_static_intervals_s_.empty()) {
+    // Detect the static intervals for all threshold multipliers in one pass
+    const int max_th_mult = 10;
+    std::vector<double> thresholds;
+    for (int th_mult = 1; th_mult <= max_th_mult; th_mult++) {
+      thresholds.push_back(th_mult * norm_th);
+    }
+    StaticIntervalsDetector(acc_view, thresholds, static_intervals_per_th);
+    // Too few samples: no static intervals for any threshold
+    static_intervals_per_th.resize(thresholds.size());
+  } else {
+    // The only candidate are the shared intervals
+    std::vector<DataInterval> shared_intervals;
+    for (const auto& interval_s : shared_static_intervals_s_) {
+      shared_intervals.push_back(DataInterval::FromTimestamps(
+          acc_samples, interval_s.first, interval_s.second));
+    }
+    static_intervals_per_th.push_back(shared_intervals);
+  }
+  const int max_th_mult = static_intervals_per_th.size();
+
+  // Select the samples of every candidate, they stay in acc_view. Different
+  // thresholds often lead to the same intervals, those share a single fit.
+  std::vector<std::vector<DataInterval>> sample_ranges(max_th_mult);
+  std::vector<int> fit_of_th(max_th_mult, -1);
+  std::vector<int> fit_th_idx;
+  for (int th_idx = 0; th_idx < max_th_mult; th_idx++) {
     std::vector<DataInterval> extracted_intervals;
-    StaticIntervalsDetector(acc_samples, th_mult * norm_th, static_intervals);
-    ExtractIntervalsSamples(acc_samples,
-                            static_intervals,
-                            static_samples,
-                            extracted_intervals,
-                            interval_n_samples_,
-                            acc_use_means_);
+    SelectIntervals(static_intervals_per_th[th_idx],
+                    extracted_intervals,
+                    sample_ranges[th_idx],
+                    interval_n_samples_,
+                    acc_use_means_);
 
     if (verbose_output_) {
       std::cout << "Accelerometers calibration: extracted "
                 << extracted_intervals.size()
-                << " intervals using threshold multiplier " << th_mult
-                << " -> ";
+                << " intervals using threshold multiplier " << th_idx + 1
+                << "\n";
     }
     // TODO Perform here a quality test
     if (extracted_intervals.size() < min_num_intervals_) {
       if (verbose_output_)
-        std::cout << "Not enough intervals, calibration is not possible";
+        std::cout << "Not enough intervals, calibration is not possible\n";
       continue;
     }
 
-    ceres::Problem problem;
-    for (int i = 0; i < static_samples.size(); i++) {
-      ceres::CostFunction* cost_function =
-          MultiPosAccResidual::Create(g_mag_, static_samples[i].data());
-
-      problem.AddResidualBlock(
-          cost_function, NULL /* squared loss */, acc_calib_params.data());
+    for (size_t f = 0; f < fit_th_idx.size(); ++f) {
+      if (SameIntervals(static_intervals_per_th[fit_th_idx[f]],
+                        static_intervals_per_th[th_idx])) {
+        fit_of_th[th_idx] = f;
+        break;
+      }
     }
+    if (fit_of_th[th_idx] < 0) {
+      fit_of_th[th_idx] = fit_th_idx.size();
+      fit_th_idx.push_back(th_idx);
+    }
+  }
+
+  // The candidate fits are independent, run them concurrently
+  std::vector<std::vector<double>> fit_params(fit_th_idx.size());
+  std::vector<double> fit_cost(fit_th_idx.size());
+  ParallelFor(
+      fit_th_idx.size(),
+      num_threads_,
+      [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+        for (size_t f = begin; f < end; ++f) {
+          const std::vector<DataInterval>& ranges =
+              sample_ranges[fit_th_idx[f]];
+          std::vector<double>& acc_calib_params = fit_params[f];
+          acc_calib_params.resize(9);
+
+          acc_calib_params[0] = init_acc_calib_.misYZ();
+          acc_calib_params[1] = init_acc_calib_.misZY();
+          acc_calib_params[2] = init_acc_calib_.misZX();
+
+          acc_calib_params[3] = init_acc_calib_.scaleX();
+          acc_calib_params[4] = init_acc_calib_.scaleY();
+          acc_calib_params[5] = init_acc_calib_.scaleZ();
+
+          acc_calib_params[6] = init_acc_calib_.biasX();
+          acc_calib_params[7] = init_acc_calib_.biasY();
+          acc_calib_params[8] = init_acc_calib_.biasZ();
+
+          ceres::Problem problem;
+          const auto add_residual = [&](const Vector3d& sample) {
+            problem.AddResidualBlock(
+                MultiPosAccResidual::Create(g_mag_, sample),
+                NULL /* squared loss */,
+                acc_calib_params.data());
+          };
+          for (const DataInterval& range : ranges) {
+            if (acc_use_means_) {
+              add_residual(DataMean(acc_view, range));
+              continue;
+            }
+            for (int i = range.start_idx; i <= range.end_idx; i++) {
+              add_residual(acc_view.data(i));
+            }
+          }
+
+          ceres::Solver::Options options;
+          options.linear_solver_type = ceres::DENSE_QR;
+          options.minimizer_progress_to_stdout = false;
+
+          ceres::Solver::Summary summary;
+          ceres::Solve(options, &problem, &summary);
+          fit_cost[f] = summary.final_cost;
+        }
+      });
 
-    ceres::Solver::Options options;
-    options.linear_solver_type = ceres::DENSE_QR;
-    options.minimizer_progress_to_stdout = verbose_output_;
-
-    ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
-    if (summary.final_cost < min_cost) {
-      min_cost = summary.final_cost;
-      min_cost_th = th_mult;
-      min_cost_static_intervals_ = static_intervals;
-      min_cost_calib_params = acc_calib_params;
+  // Pick the best candidate in threshold order, as the serial search did
+  for (int th_idx = 0; th_idx < max_th_mult; th_idx++) {
+    const int f = fit_of_th[th_idx];
+    if (f < 0) continue;
+    if (verbose_output_) {
+      std::cout << "Accelerometer residual using threshold multiplier "
+                << th_idx + 1 << ": " << fit_cost[f] << "\n";
+    }
+    if (fit_cost[f] < min_cost) {
+      min_cost = fit_cost[f];
+      min_cost_th = th_idx + 1;
+      min_cost_static_intervals_ = static_intervals_per_th[th_idx];
+      min_cost_calib_params = fit_params[f];
     }
-    std::cout << "Accelerometer residual " << summary.final_cost << "\n";
   }
 
   if (min_cost_th < 0) {
@@ -147,6 +230,13 @@ bool StaticImuCalibrator::CalibrateAcc(const ImuReadings& acc_samples) {
     return false;
   }
 
+  static_intervals_s_.clear();
+  for (const DataInterval& interval : min_cost_static_intervals_) {
+    static_intervals_s_.emplace_back(
+        acc_samples[interval.start_idx].timestamp_s(),
+        acc_samples[interval.end_idx].timestamp_s());
+  }
+
   acc_calib_ = ThreeAxisSensorCalibParams<double>(min_cost_calib_params[0],
                                                   min_cost_calib_params[1],
                                                   min_cost_calib_params[2],
@@ -160,15 +250,6 @@ bool StaticImuCalibrator::CalibrateAcc(const ImuReadings& acc_samples) {
                                                   min_cost_calib_params[7],
                                                   min_cost_calib_params[8]);
 
-  calib_acc_samples_.reserve(n_samps);
-
-  // Calibrate the input accelerometer data with the obtained calibration
-  for (int i = 0; i < n_samps; i++) {
-    calib_acc_samples_.push_back(
-        ImuReading(acc_samples[i].timestamp_s(),
-                   acc_calib_.UnbiasNormalize(acc_samples[i].data())));
-  }
-
   // final accelerometer calibration
 
   std::cout << "Accelerometer misalignment matrix: \n"
@@ -194,21 +275,31 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
 
   std::cout << "Gyroscopes calibration: calibrating...";
 
-  ImuReadings static_acc_means;
-  std::vector<DataInterval> extracted_intervals;
-  ExtractIntervalsSamples(calib_acc_samples_,
-                          min_cost_static_intervals_,
-                          static_acc_means,
-                          extracted_intervals,
-                          interval_n_samples_,
-                          true);
+  // The calibration is affine, so the mean of the calibrated samples of an
+  // interval is the calibrated mean of the raw samples
+  const ImuSamplesViewd acc_view(acc_arrays_);
+  std::vector<DataInterval> extracted_intervals, mean_ranges;
+  SelectIntervals(min_cost_static_intervals_,
+                  extracted_intervals,
+                  mean_ranges,
+                  interval_n_samples_,
+                  true);
+  vec3_vector static_acc_means;
+  for (const DataInterval& range : mean_ranges) {
+    static_acc_means.push_back(
+        acc_calib_.UnbiasNormalize(DataMean(acc_view, range)));
+  }
 
-  int n_static_pos = static_acc_means.size(), n_samps = gyro_samples.size();
+  // The residuals only keep a view on these arrays, they have to outlive the
+  // solver
+  const ImuSampleArraysd gyro_arrays(gyro_samples);
+  const ImuSamplesViewd gyro_view(gyro_arrays);
+  int n_static_pos = static_acc_means.size(), n_samps = gyro_view.size();
 
   // Compute the gyroscopes biases in the (static) initialization interval
   DataInterval init_static_interval =
       DataInterval::InitialInterval(gyro_samples, init_interval_duration_);
-  Vector3d gyro_bias = DataMean(gyro_samples, init_static_interval);
+  Vector3d gyro_bias = DataMean(gyro_view, init_static_interval);
 
   gyro_calib_ = ThreeAxisSensorCalibParams<double>(0,
                                                    0,
@@ -223,14 +314,6 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
                                                    gyro_bias(1),
                                                    gyro_bias(2));
 
-  // calib_gyro_samples_ already cleared in calibrateAcc()
-  calib_gyro_samples_.reserve(n_samps);
-  // Remove the bias
-  for (int i = 0; i < n_samps; i++)
-    calib_gyro_samples_.push_back(
-        ImuReading(gyro_samples[i].timestamp_s(),
-                   gyro_calib_.Unbias(gyro_samples[i].data())));
-
   std::vector<double> gyro_calib_params(12);
 
   gyro_calib_params[0] = init_gyro_calib_.misYZ();
@@ -252,24 +335,22 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
   ceres::Problem problem;
 
   for (int i = 0, t_idx = 0; i < n_static_pos - 1; i++) {
-    Vector3d g_versor_pos0 = static_acc_means[i].data(),
-             g_versor_pos1 = static_acc_means[i + 1].data();
+    Vector3d g_versor_pos0 = static_acc_means[i],
+             g_versor_pos1 = static_acc_means[i + 1];
 
     g_versor_pos0 /= g_versor_pos0.norm();
     g_versor_pos1 /= g_versor_pos1.norm();
 
     int gyro_idx0 = -1, gyro_idx1 = -1;
-    double ts0 =
-               calib_acc_samples_[extracted_intervals[i].end_idx].timestamp_s(),
-           ts1 = calib_acc_samples_[extracted_intervals[i + 1].start_idx]
-                     .timestamp_s();
+    double ts0 = acc_view.timestamp_s(extracted_intervals[i].end_idx),
+           ts1 = acc_view.timestamp_s(extracted_intervals[i + 1].start_idx);
 
     // Assume monotone signal time
     for (; t_idx < n_samps; t_idx++) {
       if (gyro_idx0 < 0) {
-        if (calib_gyro_samples_[t_idx].timestamp_s() >= ts0) gyro_idx0 = t_idx;
+        if (gyro_view.timestamp_s(t_idx) >= ts0) gyro_idx0 = t_idx;
       } else {
-        if (calib_gyro_samples_[t_idx].timestamp_s() >= ts1) {
+        if (gyro_view.timestamp_s(t_idx) >= ts1) {
           gyro_idx1 = t_idx - 1;
           break;
         }
@@ -281,10 +362,11 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
     ceres::CostFunction* cost_function =
         MultiPosGyroResidual::Create(g_versor_pos0,
                                      g_versor_pos1,
-                                     calib_gyro_samples_,
+                                     gyro_view,
                                      gyro_interval,
                                      gyro_dt_,
-                                     optimize_gyro_bias_);
+                                     optimize_gyro_bias_,
+                                     gyro_bias);
 
     problem.AddResidualBlock(
         cost_function, NULL /* squared loss */, gyro_calib_params.data());
@@ -311,13 +393,6 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
                                          gyro_bias(1) + gyro_calib_params[10],
                                          gyro_bias(2) + gyro_calib_params[11]);
 
-  // Calibrate the input gyroscopes data with the obtained calibration
-  for (int i = 0; i < n_samps; i++) {
-    calib_gyro_samples_.push_back(
-        ImuReading(gyro_samples[i].timestamp_s(),
-                   gyro_calib_.UnbiasNormalize(gyro_samples[i].data())));
-  }
-
   if (verbose_output_) {
     std::cout << summary.FullReport();
   }
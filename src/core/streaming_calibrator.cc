@@ -0,0 +1,307 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/streaming_calibrator.h"
+
+#include <algorithm>
+#include <string>
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/metrics.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+// detections waiting for the solver, it only takes them between two window
+// solves
+const size_t kDetectionQueueSize = 4096;
+
+}  // namespace
+
+StreamingCalibrator::StreamingCalibrator(
+    const StreamingCalibratorOptions& options)
+    : options_(options),
+      frames_(std::max(1, options.frame_queue_size)),
+      imu_samples_(std::max(1, options.imu_queue_size)),
+      detections_(kDetectionQueueSize) {
+  frames_.SetMetricsName("stream_frames");
+  imu_samples_.SetMetricsName("stream_imu_samples");
+  detections_.SetMetricsName("stream_detections");
+}
+
+StreamingCalibrator::~StreamingCalibrator() { Finish(); }
+
+bool StreamingCalibrator::Start(
+    BoardExtractor* board_extractor,
+    const theia::Camera& camera,
+    const Sophus::SE3d& T_i_c_init,
+    const SplineWeightingData& spline_weight_data,
+    const double time_offset_imu_to_cam,
+    const double initial_line_delay,
+    const ThreeAxisSensorCalibParams<double>& accl_intrinsics,
+    const ThreeAxisSensorCalibParams<double>& gyro_intrinsics) {
+  if (solver_thread_.joinable()) {
+    LOG(ERROR) << "The streaming calibration was already started.";
+    return false;
+  }
+  board_extractor_ = board_extractor;
+  camera_ = camera;
+  T_i_c_init_ = T_i_c_init;
+  spline_weight_data_ = spline_weight_data;
+  time_offset_imu_to_cam_ = time_offset_imu_to_cam;
+  initial_line_delay_ = initial_line_delay;
+  accl_intrinsics_ = accl_intrinsics;
+  gyro_intrinsics_ = gyro_intrinsics;
+
+  // the board points are the tracks of the pose estimation and the spline
+  nlohmann::json scene_header;
+  board_extractor_->BoardToJson(scene_header);
+  pose_estimator_ = std::make_unique<PoseEstimator>();
+  pose_estimator_->InitializeStream(scene_header, camera_);
+  vision_dataset_ = std::make_shared<theia::Reconstruction>();
+  io::scene_points_to_calib_dataset(scene_header, *vision_dataset_);
+
+  ExcitationMonitorOptions excitation_options = options_.excitation;
+  if (excitation_options.image_width <= 0 ||
+      excitation_options.image_height <= 0) {
+    excitation_options.focal_length_px = camera_.FocalLength();
+    excitation_options.image_width = camera_.ImageWidth();
+    excitation_options.image_height = camera_.ImageHeight();
+  }
+  excitation_monitor_ = std::make_unique<ExcitationMonitor>(excitation_options);
+
+  // the measurements enter the problem with the window they fall into
+  calibrator_.SetFixedLagWindow(options_.window_s, options_.step_s);
+  detector_thread_ = std::thread(&StreamingCalibrator::DetectorLoop, this);
+  solver_thread_ = std::thread(&StreamingCalibrator::SolverLoop, this);
+  return true;
+}
+
+bool StreamingCalibrator::PushFrame(const double timestamp_s,
+                                    const cv::Mat& image) {
+  return frames_.Push(Frame{timestamp_s, image});
+}
+
+bool StreamingCalibrator::TryPushFrame(const double timestamp_s,
+                                       const cv::Mat& image) {
+  if (!frames_.TryPush(Frame{timestamp_s, image})) {
+    utils::Metrics::Instance().AddCounter(
+        "openicc_stream_dropped_frames_total", "", 1.0);
+    return false;
+  }
+  return true;
+}
+
+bool StreamingCalibrator::PushImuSample(const double timestamp_s,
+                                        const Eigen::Vector3d& accl,
+                                        const Eigen::Vector3d& gyro) {
+  return imu_samples_.Push(ImuSample{timestamp_s, accl, gyro});
+}
+
+bool StreamingCalibrator::GetEstimate(StreamingEstimate& estimate) {
+  std::lock_guard<std::mutex> lock(estimate_mutex_);
+  estimate = estimate_;
+  return has_estimate_;
+}
+
+bool StreamingCalibrator::Finish() {
+  std::lock_guard<std::mutex> lock(finish_mutex_);
+  if (!solver_thread_.joinable()) {
+    return initialized_;
+  }
+  // the queued frames are still detected and the queued detections solved
+  frames_.Close();
+  detector_thread_.join();
+  detections_.Close();
+  imu_samples_.Close();
+  solver_thread_.join();
+  if (!initialized_) {
+    LOG(ERROR) << "The stream ended before the spline was initialized, it "
+               << "needs " << options_.init_duration_s << "s of views.";
+  }
+  return initialized_;
+}
+
+void StreamingCalibrator::DetectorLoop() {
+  Frame frame;
+  cv::Mat gray;
+  nlohmann::json view;
+  while (frames_.Pop(frame)) {
+    if (options_.downsample_factor != 1.0) {
+      const double fxfy = 1. / options_.downsample_factor;
+      cv::resize(frame.image, frame.image, cv::Size(), fxfy, fxfy);
+    }
+    if (frame.image.channels() == 3) {
+      cv::cvtColor(frame.image, gray, cv::COLOR_BGR2GRAY);
+    } else {
+      gray = frame.image;
+    }
+    Detection detection;
+    detection.timestamp_s = frame.timestamp_s;
+    if (!board_extractor_->ExtractBoard(
+            gray, detection.corners, detection.ids) ||
+        detection.ids.empty()) {
+      continue;
+    }
+    view = nlohmann::json();
+    for (size_t c = 0; c < detection.ids.size(); ++c) {
+      view["image_points"][std::to_string(detection.ids[c])] = {
+          detection.corners[c][0], detection.corners[c][1]};
+    }
+    const std::string view_key =
+        std::to_string((uint64_t)(frame.timestamp_s * S_TO_US));
+    if (!pose_estimator_->EstimateStreamViewPose(view_key,
+                                                 view,
+                                                 camera_,
+                                                 detection.orientation,
+                                                 detection.position)) {
+      continue;
+    }
+    utils::Metrics::Instance().AddCounter(
+        "openicc_stream_detected_frames_total", "", 1.0);
+    if (!detections_.Push(std::move(detection))) {
+      return;
+    }
+  }
+}
+
+void StreamingCalibrator::DrainImuQueue() {
+  ImuSample sample;
+  while (imu_samples_.TryPop(sample)) {
+    telemetry_.accelerometer.emplace_back(sample.timestamp_s, sample.accl);
+    telemetry_.gyroscope.emplace_back(sample.timestamp_s, sample.gyro);
+    const double t_cam_s = sample.timestamp_s + time_offset_imu_to_cam_;
+    excitation_monitor_->AddGyroSample(t_cam_s, sample.gyro);
+    excitation_monitor_->AddAcclSample(t_cam_s, sample.accl);
+  }
+}
+
+theia::ViewId StreamingCalibrator::AddView(const Detection& detection) {
+  const std::string view_name =
+      std::to_string((uint64_t)(detection.timestamp_s * S_TO_US));
+  const theia::ViewId view_id =
+      vision_dataset_->AddView(view_name, 0, detection.timestamp_s);
+  if (view_id == theia::kInvalidViewId) {
+    return view_id;
+  }
+  theia::Camera* mutable_cam =
+      vision_dataset_->MutableView(view_id)->MutableCamera();
+  mutable_cam->SetOrientationFromAngleAxis(detection.orientation);
+  mutable_cam->SetPosition(detection.position);
+  mutable_cam->SetFromCameraIntrinsicsPriors(
+      camera_.CameraIntrinsicsPriorFromIntrinsics());
+  for (size_t c = 0; c < detection.ids.size(); ++c) {
+    const theia::Feature feat(detection.corners[c],
+                              Eigen::Matrix2d::Identity());
+    vision_dataset_->AddObservation(view_id, detection.ids[c], feat);
+  }
+  excitation_monitor_->AddView(detection.timestamp_s, detection.corners);
+  if (excitation_monitor_->SufficientTime() >= 0.0 && !data_sufficient_) {
+    LOG(INFO) << "The data is sufficient at " << detection.timestamp_s
+              << "s";
+    data_sufficient_ = true;
+  }
+  return view_id;
+}
+
+void StreamingCalibrator::SolverLoop() {
+  Detection detection;
+  while (detections_.Pop(detection)) {
+    DrainImuQueue();
+    if (detection.timestamp_s <= newest_view_s_ && first_view_s_ >= 0.0) {
+      continue;
+    }
+    const theia::ViewId view_id = AddView(detection);
+    if (view_id == theia::kInvalidViewId) {
+      continue;
+    }
+    new_view_ids_.push_back(view_id);
+    newest_view_s_ = detection.timestamp_s;
+    if (first_view_s_ < 0.0) {
+      first_view_s_ = detection.timestamp_s;
+    }
+
+    if (!initialized_) {
+      if (newest_view_s_ - first_view_s_ < options_.init_duration_s ||
+          telemetry_.accelerometer.empty()) {
+        continue;
+      }
+      LOG(INFO) << "Initializing the streaming spline with "
+                << new_view_ids_.size() << " views and "
+                << telemetry_.accelerometer.size() << " IMU samples";
+      calibrator_.BatchInitSpline(vision_dataset_,
+                                  T_i_c_init_,
+                                  spline_weight_data_,
+                                  time_offset_imu_to_cam_,
+                                  telemetry_,
+                                  initial_line_delay_,
+                                  accl_intrinsics_,
+                                  gyro_intrinsics_);
+      // the samples after the newest view are stored with the next views
+      new_view_ids_.clear();
+      initialized_ = true;
+    } else if (newest_view_s_ - last_solve_s_ < options_.step_s) {
+      continue;
+    } else {
+      calibrator_.AppendMeasurements(new_view_ids_, telemetry_);
+      new_view_ids_.clear();
+      telemetry_ = CameraTelemetryData();
+    }
+    Solve();
+  }
+  // the views since the last step
+  DrainImuQueue();
+  if (initialized_ && !new_view_ids_.empty()) {
+    calibrator_.AppendMeasurements(new_view_ids_, telemetry_);
+    new_view_ids_.clear();
+    Solve();
+  }
+}
+
+void StreamingCalibrator::Solve() {
+  StreamingEstimate estimate;
+  estimate.reprojection_error = calibrator_.OptimizeLatestWindow(
+      options_.iterations, options_.optim_flags);
+  last_solve_s_ = newest_view_s_;
+  estimate.time_s = newest_view_s_;
+  estimate.num_solves = ++num_solves_;
+  estimate.num_views = vision_dataset_->NumViews();
+  estimate.T_i_c = calibrator_.trajectory_.GetT_i_c();
+  estimate.line_delay_s = calibrator_.trajectory_.GetRSLineDelay();
+  estimate.gravity = calibrator_.trajectory_.GetGravity();
+  estimate.excitation = excitation_monitor_->Report();
+  LOG(INFO) << "Streaming solve " << estimate.num_solves << " at "
+            << estimate.time_s << "s, mean reprojection error "
+            << estimate.reprojection_error << "px";
+  {
+    std::lock_guard<std::mutex> lock(estimate_mutex_);
+    estimate_ = estimate;
+    has_estimate_ = true;
+  }
+  if (estimate_callback_) {
+    estimate_callback_(estimate);
+  }
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,422 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/chunked_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef OPENICC_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef OPENICC_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+const uint32_t kChunkedVersion = 1;
+// chunks are small enough to be decompressed one per task, fast levels are
+// enough as the files are mostly limited by the network
+const int kZstdLevel = 3;
+
+const size_t kMetaOffset = 8 + sizeof(uint32_t) + sizeof(uint32_t);
+const size_t kFooterSize = 2 * sizeof(uint64_t);
+static_assert(sizeof(ChunkInfo) == 6 * sizeof(uint64_t),
+              "ChunkInfo is written as is");
+
+bool Compress(const ChunkCodec codec,
+              const std::vector<char>& raw,
+              std::vector<char>& compressed) {
+  switch (codec) {
+    case ChunkCodec::kNone:
+      compressed = raw;
+      return true;
+#ifdef OPENICC_WITH_ZSTD
+    case ChunkCodec::kZstd: {
+      compressed.resize(ZSTD_compressBound(raw.size()));
+      const size_t num_bytes = ZSTD_compress(compressed.data(),
+                                             compressed.size(),
+                                             raw.data(),
+                                             raw.size(),
+                                             kZstdLevel);
+      if (ZSTD_isError(num_bytes)) {
+        std::cerr << "zstd compression failed: "
+                  << ZSTD_getErrorName(num_bytes) << "\n";
+        return false;
+      }
+      compressed.resize(num_bytes);
+      return true;
+    }
+#endif
+#ifdef OPENICC_WITH_LZ4
+    case ChunkCodec::kLz4: {
+      compressed.resize(LZ4_compressBound(static_cast<int>(raw.size())));
+      const int num_bytes =
+          LZ4_compress_default(raw.data(),
+                               compressed.data(),
+                               static_cast<int>(raw.size()),
+                               static_cast<int>(compressed.size()));
+      if (num_bytes <= 0) {
+        std::cerr << "lz4 compression failed.\n";
+        return false;
+      }
+      compressed.resize(num_bytes);
+      return true;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+bool Decompress(const ChunkCodec codec,
+                const char* compressed,
+                const size_t compressed_bytes,
+                std::vector<char>& raw) {
+  switch (codec) {
+    case ChunkCodec::kNone:
+      if (compressed_bytes != raw.size()) return false;
+      std::memcpy(raw.data(), compressed, compressed_bytes);
+      return true;
+#ifdef OPENICC_WITH_ZSTD
+    case ChunkCodec::kZstd: {
+      const size_t num_bytes =
+          ZSTD_decompress(raw.data(), raw.size(), compressed, compressed_bytes);
+      return !ZSTD_isError(num_bytes) && num_bytes == raw.size();
+    }
+#endif
+#ifdef OPENICC_WITH_LZ4
+    case ChunkCodec::kLz4: {
+      const int num_bytes =
+          LZ4_decompress_safe(compressed,
+                              raw.data(),
+                              static_cast<int>(compressed_bytes),
+                              static_cast<int>(raw.size()));
+      return num_bytes >= 0 && static_cast<size_t>(num_bytes) == raw.size();
+    }
+#endif
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+bool ParseChunkCodec(const std::string& name, ChunkCodec& codec) {
+  if (name == "none") {
+    codec = ChunkCodec::kNone;
+  } else if (name == "zstd") {
+    codec = ChunkCodec::kZstd;
+  } else if (name == "lz4") {
+    codec = ChunkCodec::kLz4;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ChunkCodecAvailable(const ChunkCodec codec) {
+  switch (codec) {
+    case ChunkCodec::kNone:
+      return true;
+    case ChunkCodec::kZstd:
+#ifdef OPENICC_WITH_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case ChunkCodec::kLz4:
+#ifdef OPENICC_WITH_LZ4
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+bool HasMagic(const std::string& path,
+              const char magic[8],
+              const uint64_t offset) {
+  std::ifstream file(path, std::ios::binary);
+  char file_magic[8];
+  file.seekg(offset);
+  file.read(file_magic, sizeof(file_magic));
+  return file && std::memcmp(file_magic, magic, sizeof(file_magic)) == 0;
+}
+
+bool MappedRegion::Open(const std::string& path,
+                        const uint64_t offset,
+                        const uint64_t bytes) {
+  Close();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Can not open " << path << "\n";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      offset + bytes > static_cast<uint64_t>(file_stat.st_size) ||
+      (bytes == 0 && offset >= static_cast<uint64_t>(file_stat.st_size))) {
+    std::cerr << "Truncated file " << path << "\n";
+    close(fd);
+    return false;
+  }
+  size_ = bytes == 0 ? file_stat.st_size - offset : bytes;
+  // mmap needs a page aligned offset, map from the page the region starts in
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  const uint64_t map_offset = offset - offset % page_size;
+  mapping_size_ = size_ + (offset - map_offset);
+  void* mapped =
+      mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE, fd, map_offset);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "Can not map " << path << "\n";
+    size_ = 0;
+    mapping_size_ = 0;
+    return false;
+  }
+  mapping_ = mapped;
+  data_ = static_cast<const char*>(mapped) + (offset - map_offset);
+  return true;
+}
+
+void MappedRegion::Advise(const int advice) {
+  if (mapping_) {
+    madvise(mapping_, mapping_size_, advice);
+  }
+}
+
+void MappedRegion::Close() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+    mapping_ = nullptr;
+  }
+  mapping_size_ = 0;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+ChunkedFileWriter::~ChunkedFileWriter() {
+  if (output_.is_open()) {
+    output_.close();
+  }
+}
+
+bool ChunkedFileWriter::Open(const std::string& path,
+                             const char magic[8],
+                             const ChunkCodec codec,
+                             const std::vector<char>& meta) {
+  if (!ChunkCodecAvailable(codec)) {
+    std::cerr << "Compression codec " << static_cast<uint32_t>(codec)
+              << " is not available in this build.\n";
+    return false;
+  }
+  path_ = path;
+  codec_ = codec;
+  index_.clear();
+  num_records_ = 0;
+  output_.open(path_, std::ios::out | std::ios::binary);
+  if (!output_.is_open()) {
+    std::cerr << "Could not open " << path_ << " for writing.\n";
+    return false;
+  }
+  const uint32_t codec_id = static_cast<uint32_t>(codec_);
+  const uint64_t meta_bytes = meta.size();
+  output_.write(magic, 8);
+  output_.write(reinterpret_cast<const char*>(&kChunkedVersion),
+                sizeof(kChunkedVersion));
+  output_.write(reinterpret_cast<const char*>(&codec_id), sizeof(codec_id));
+  output_.write(reinterpret_cast<const char*>(&meta_bytes),
+                sizeof(meta_bytes));
+  output_.write(meta.data(), meta.size());
+  return static_cast<bool>(output_);
+}
+
+bool ChunkedFileWriter::AddChunk(const std::vector<char>& raw,
+                                 const uint64_t num_records,
+                                 const int64_t first_key,
+                                 const int64_t last_key) {
+  if (!Compress(codec_, raw, compressed_)) {
+    return false;
+  }
+  ChunkInfo chunk;
+  chunk.offset = static_cast<uint64_t>(output_.tellp());
+  chunk.compressed_bytes = compressed_.size();
+  chunk.raw_bytes = raw.size();
+  chunk.num_records = num_records;
+  chunk.first_key = first_key;
+  chunk.last_key = last_key;
+  output_.write(compressed_.data(), compressed_.size());
+  index_.push_back(chunk);
+  num_records_ += num_records;
+  return static_cast<bool>(output_);
+}
+
+bool ChunkedFileWriter::Close() {
+  const uint64_t index_offset = static_cast<uint64_t>(output_.tellp());
+  const uint64_t num_chunks = index_.size();
+  output_.write(reinterpret_cast<const char*>(index_.data()),
+                index_.size() * sizeof(ChunkInfo));
+  output_.write(reinterpret_cast<const char*>(&num_chunks),
+                sizeof(num_chunks));
+  output_.write(reinterpret_cast<const char*>(&index_offset),
+                sizeof(index_offset));
+  output_.close();
+  if (output_.fail()) {
+    std::cerr << "Failed to write " << path_ << "\n";
+    return false;
+  }
+  return true;
+}
+
+ChunkedFileReader::~ChunkedFileReader() { Close(); }
+
+void ChunkedFileReader::Close() {
+  region_.Close();
+  data_ = nullptr;
+  size_ = 0;
+  meta_.clear();
+  index_.clear();
+}
+
+bool ChunkedFileReader::Open(const std::string& path, const char magic[8]) {
+  return Open(path, magic, 0, 0);
+}
+
+bool ChunkedFileReader::Open(const std::string& path,
+                             const char magic[8],
+                             const uint64_t offset,
+                             const uint64_t bytes) {
+  Close();
+  if (!region_.Open(path, offset, bytes)) {
+    return false;
+  }
+  data_ = region_.Data();
+  size_ = region_.Size();
+  if (size_ < kMetaOffset + sizeof(uint64_t) + kFooterSize) {
+    std::cerr << "Truncated chunked file " << path << "\n";
+    Close();
+    return false;
+  }
+  // chunks are accessed by time range, not front to back
+  region_.Advise(MADV_RANDOM);
+
+  uint32_t version = 0, codec_id = 0;
+  uint64_t meta_bytes = 0, num_chunks = 0, index_offset = 0;
+  std::memcpy(&version, data_ + 8, sizeof(version));
+  std::memcpy(&codec_id, data_ + 8 + sizeof(version), sizeof(codec_id));
+  std::memcpy(&meta_bytes, data_ + kMetaOffset, sizeof(meta_bytes));
+  std::memcpy(&num_chunks, data_ + size_ - kFooterSize, sizeof(num_chunks));
+  std::memcpy(&index_offset,
+              data_ + size_ - sizeof(index_offset),
+              sizeof(index_offset));
+  const size_t chunks_begin = kMetaOffset + sizeof(meta_bytes) + meta_bytes;
+  if (std::memcmp(data_, magic, 8) != 0 || version != kChunkedVersion ||
+      chunks_begin > index_offset ||
+      index_offset + num_chunks * sizeof(ChunkInfo) + kFooterSize != size_) {
+    std::cerr << "Invalid chunked file " << path << "\n";
+    Close();
+    return false;
+  }
+  codec_ = static_cast<ChunkCodec>(codec_id);
+  if (!ChunkCodecAvailable(codec_)) {
+    std::cerr << path << " uses compression codec " << codec_id
+              << ", which is not available in this build.\n";
+    Close();
+    return false;
+  }
+  meta_.assign(data_ + kMetaOffset + sizeof(meta_bytes), data_ + chunks_begin);
+  index_.resize(num_chunks);
+  std::memcpy(index_.data(),
+              data_ + index_offset,
+              num_chunks * sizeof(ChunkInfo));
+  for (const ChunkInfo& chunk : index_) {
+    if (chunk.offset < chunks_begin ||
+        chunk.offset + chunk.compressed_bytes > index_offset) {
+      std::cerr << "Invalid chunk index in " << path << "\n";
+      Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t ChunkedFileReader::NumRecords() const {
+  uint64_t num_records = 0;
+  for (const ChunkInfo& chunk : index_) {
+    num_records += chunk.num_records;
+  }
+  return num_records;
+}
+
+void ChunkedFileReader::FindChunks(const int64_t first_key,
+                                   const int64_t last_key,
+                                   size_t& begin,
+                                   size_t& end) const {
+  // first chunk that ends at or after first_key, first chunk that starts
+  // after last_key
+  begin = std::partition_point(index_.begin(),
+                               index_.end(),
+                               [first_key](const ChunkInfo& chunk) {
+                                 return chunk.last_key < first_key;
+                               }) -
+          index_.begin();
+  end = std::partition_point(index_.begin() + begin,
+                             index_.end(),
+                             [last_key](const ChunkInfo& chunk) {
+                               return chunk.first_key <= last_key;
+                             }) -
+        index_.begin();
+}
+
+bool ChunkedFileReader::ReadChunk(const size_t chunk_idx,
+                                  std::vector<char>& raw) const {
+  if (!data_ || chunk_idx >= index_.size()) return false;
+  const ChunkInfo& chunk = index_[chunk_idx];
+  raw.resize(chunk.raw_bytes);
+  return Decompress(
+      codec_, data_ + chunk.offset, chunk.compressed_bytes, raw);
+}
+
+bool ChunkedFileReader::ReadChunks(const size_t begin,
+                                   const size_t end,
+                                   std::vector<std::vector<char>>& raw,
+                                   const int num_threads) const {
+  if (begin > end || end > index_.size()) return false;
+  raw.resize(end - begin);
+  std::vector<char> chunk_ok(end - begin, 0);
+  utils::ParallelFor(
+      end - begin, num_threads, [&](size_t first, size_t last, int) {
+        for (size_t i = first; i < last; ++i) {
+          chunk_ok[i] = ReadChunk(begin + i, raw[i]);
+        }
+      });
+  return std::all_of(
+      chunk_ok.begin(), chunk_ok.end(), [](char ok) { return ok != 0; });
+}
+
+}  // namespace io
+}  // namespace OpenICC
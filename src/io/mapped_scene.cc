@@ -0,0 +1,300 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/io/session_file.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+// Finds the byte ranges of ubjson values without building a json document
+class UbjsonScanner {
+ public:
+  UbjsonScanner(const std::uint8_t* data, const size_t size)
+      : data_(data), size_(size) {}
+
+  size_t Position() const { return pos_; }
+
+  bool ReadMarker(std::uint8_t& marker) {
+    do {
+      if (pos_ >= size_) return false;
+      marker = data_[pos_++];
+    } while (marker == 'N');
+    return true;
+  }
+
+  bool ReadInteger(const std::uint8_t marker, int64_t& value) {
+    size_t num_bytes = 0;
+    switch (marker) {
+      case 'i':
+      case 'U':
+        num_bytes = 1;
+        break;
+      case 'I':
+        num_bytes = 2;
+        break;
+      case 'l':
+        num_bytes = 4;
+        break;
+      case 'L':
+        num_bytes = 8;
+        break;
+      default:
+        return false;
+    }
+    if (pos_ + num_bytes > size_) return false;
+    uint64_t v = 0;
+    for (size_t b = 0; b < num_bytes; ++b) {
+      v = (v << 8) | data_[pos_++];
+    }
+    // sign extend everything except uint8
+    if (marker != 'U' && num_bytes < 8 && (v >> (8 * num_bytes - 1)) & 1) {
+      v |= ~uint64_t(0) << (8 * num_bytes);
+    }
+    value = static_cast<int64_t>(v);
+    return true;
+  }
+
+  bool ReadLength(int64_t& length) {
+    std::uint8_t marker;
+    return ReadMarker(marker) && ReadInteger(marker, length) && length >= 0;
+  }
+
+  bool ReadKey(std::string& key) {
+    int64_t length;
+    if (!ReadLength(length) || pos_ + length > size_) return false;
+    key.assign(reinterpret_cast<const char*>(data_ + pos_), length);
+    pos_ += length;
+    return true;
+  }
+
+  //! Reads the optional type ($) and count (#) of a container
+  bool ReadContainerHeader(std::uint8_t& type, int64_t& count) {
+    type = 0;
+    count = -1;
+    if (pos_ < size_ && data_[pos_] == '$') {
+      ++pos_;
+      if (pos_ >= size_) return false;
+      type = data_[pos_++];
+      if (pos_ >= size_ || data_[pos_] != '#') return false;
+    }
+    if (pos_ < size_ && data_[pos_] == '#') {
+      ++pos_;
+      return ReadLength(count);
+    }
+    return true;
+  }
+
+  //! Returns true if the end of an unsized container was reached
+  bool AtContainerEnd(const std::uint8_t end_marker) {
+    while (pos_ < size_ && data_[pos_] == 'N') ++pos_;
+    if (pos_ < size_ && data_[pos_] == end_marker) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool SkipValue(const std::uint8_t marker) {
+    switch (marker) {
+      case 'Z':
+      case 'T':
+      case 'F':
+      case 'N':
+        return true;
+      case 'i':
+      case 'U':
+      case 'C':
+        return Skip(1);
+      case 'I':
+        return Skip(2);
+      case 'l':
+      case 'd':
+        return Skip(4);
+      case 'L':
+      case 'D':
+        return Skip(8);
+      case 'S':
+      case 'H': {
+        int64_t length;
+        return ReadLength(length) && Skip(length);
+      }
+      case '[':
+      case '{':
+        return SkipContainer(marker == '{');
+      default:
+        return false;
+    }
+  }
+
+ private:
+  bool Skip(const int64_t num_bytes) {
+    if (pos_ + num_bytes > size_) return false;
+    pos_ += num_bytes;
+    return true;
+  }
+
+  bool SkipContainer(const bool is_object) {
+    std::uint8_t type;
+    int64_t count;
+    if (!ReadContainerHeader(type, count)) return false;
+    std::string key;
+    for (int64_t i = 0; count < 0 || i < count; ++i) {
+      if (count < 0 && AtContainerEnd(is_object ? '}' : ']')) return true;
+      if (is_object && !ReadKey(key)) return false;
+      std::uint8_t marker = type;
+      if (marker == 0 && !ReadMarker(marker)) return false;
+      if (!SkipValue(marker)) return false;
+    }
+    return true;
+  }
+
+  const std::uint8_t* data_;
+  const size_t size_;
+  size_t pos_ = 0;
+};
+}  // namespace
+
+MappedScene::~MappedScene() { Close(); }
+
+void MappedScene::Close() {
+  region_.Close();
+  data_ = nullptr;
+  size_ = 0;
+  header_.clear();
+  views_.clear();
+}
+
+bool MappedScene::Open(const std::string& input_bson) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(input_bson, kSessionCorners, offset, bytes)) {
+    return false;
+  }
+  return Open(input_bson, offset, bytes);
+}
+
+bool MappedScene::Open(const std::string& input_bson,
+                       const uint64_t offset,
+                       const uint64_t bytes) {
+  Close();
+  if (!region_.Open(input_bson, offset, bytes)) {
+    return false;
+  }
+  data_ = reinterpret_cast<const std::uint8_t*>(region_.Data());
+  size_ = region_.Size();
+  // the file is read front to back
+  region_.Advise(MADV_SEQUENTIAL);
+
+  if (!IndexViews()) {
+    std::cerr << "Invalid scene file " << input_bson << "\n";
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedScene::IndexViews() {
+  UbjsonScanner scanner(data_, size_);
+  std::uint8_t marker;
+  if (!scanner.ReadMarker(marker) || marker != '{') return false;
+  std::uint8_t type;
+  int64_t count;
+  if (!scanner.ReadContainerHeader(type, count)) return false;
+
+  std::string key;
+  for (int64_t i = 0; count < 0 || i < count; ++i) {
+    if (count < 0 && scanner.AtContainerEnd('}')) break;
+    if (!scanner.ReadKey(key)) return false;
+    const size_t value_begin = scanner.Position();
+    marker = type;
+    if (marker == 0 && !scanner.ReadMarker(marker)) return false;
+
+    if (key == "views" && marker == '{') {
+      std::uint8_t view_type;
+      int64_t num_views;
+      if (!scanner.ReadContainerHeader(view_type, num_views)) return false;
+      for (int64_t v = 0; num_views < 0 || v < num_views; ++v) {
+        if (num_views < 0 && scanner.AtContainerEnd('}')) break;
+        ViewRange view;
+        if (!scanner.ReadKey(view.key)) return false;
+        view.begin = scanner.Position();
+        view.type = view_type;
+        std::uint8_t view_marker = view_type;
+        if (view_marker == 0 && !scanner.ReadMarker(view_marker)) {
+          return false;
+        }
+        if (!scanner.SkipValue(view_marker)) return false;
+        view.end = scanner.Position();
+        views_.push_back(view);
+      }
+      continue;
+    }
+
+    if (!scanner.SkipValue(marker)) return false;
+    header_[key] = ParseRange(type, value_begin, scanner.Position());
+  }
+
+  // same order as iterating the views of the json document. For duplicate
+  // keys the last view wins, as in the json parser.
+  std::stable_sort(views_.begin(),
+                   views_.end(),
+                   [](const ViewRange& a, const ViewRange& b) {
+                     return a.key < b.key;
+                   });
+  auto last = std::unique(views_.rbegin(),
+                          views_.rend(),
+                          [](const ViewRange& a, const ViewRange& b) {
+                            return a.key == b.key;
+                          });
+  views_.erase(views_.begin(), last.base());
+  return true;
+}
+
+bool MappedScene::ParseAll(nlohmann::json& scene_json) const {
+  if (!data_) return false;
+  scene_json = nlohmann::json::from_ubjson(data_, data_ + size_);
+  return true;
+}
+
+bool MappedScene::ParseView(const size_t view_idx, nlohmann::json& view) const {
+  if (!data_ || view_idx >= views_.size()) return false;
+  const ViewRange& range = views_[view_idx];
+  view = ParseRange(range.type, range.begin, range.end);
+  return true;
+}
+
+nlohmann::json MappedScene::ParseRange(const std::uint8_t type,
+                                       const size_t begin,
+                                       const size_t end) const {
+  if (type == 0) {
+    return nlohmann::json::from_ubjson(data_ + begin, data_ + end);
+  }
+  // values of typed containers come without their marker
+  std::vector<std::uint8_t> value;
+  value.reserve(end - begin + 1);
+  value.push_back(type);
+  value.insert(value.end(), data_ + begin, data_ + end);
+  return nlohmann::json::from_ubjson(value);
+}
+
+}  // namespace io
+}  // namespace OpenICC
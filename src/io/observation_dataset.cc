@@ -0,0 +1,422 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/observation_dataset.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+#include "OpenCameraCalibrator/io/session_file.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+const char kObservationMagic[8] = {'O', 'I', 'C', 'C', 'O', 'B', 'S', '1'};
+const uint32_t kObservationVersion = 1;
+const char kObservationChunkedMagic[8] = {
+    'O', 'I', 'C', 'C', 'O', 'B', 'S', 'C'};
+
+template <typename T>
+void WriteArray(std::ofstream& out, const std::vector<T>& values) {
+  out.write(reinterpret_cast<const char*>(values.data()),
+            values.size() * sizeof(T));
+}
+
+// Fails without allocating if less than size values are left before the
+// byte position end, the counts come from the file
+template <typename T>
+bool ReadArray(std::ifstream& in,
+               const uint64_t size,
+               const uint64_t end,
+               std::vector<T>& values) {
+  const std::streamoff pos = in.tellg();
+  if (pos < 0 || static_cast<uint64_t>(pos) > end ||
+      size > (end - static_cast<uint64_t>(pos)) / sizeof(T)) {
+    return false;
+  }
+  values.resize(size);
+  in.read(reinterpret_cast<char*>(values.data()), size * sizeof(T));
+  return static_cast<bool>(in);
+}
+
+template <typename T>
+bool ReadScalar(std::ifstream& in, T& value) {
+  in.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return static_cast<bool>(in);
+}
+
+template <typename T>
+void AppendBytes(std::vector<char>& raw, const T* values, const size_t size) {
+  const char* bytes = reinterpret_cast<const char*>(values);
+  raw.insert(raw.end(), bytes, bytes + size * sizeof(T));
+}
+
+// Packs views [begin, end) into a raw chunk, see WriteObservationDataset
+void PackObservationChunk(const ObservationDataset& dataset,
+                          const size_t begin,
+                          const size_t end,
+                          std::vector<char>& raw) {
+  const uint64_t first_obs = dataset.view_offsets[begin];
+  const uint64_t num_obs = dataset.view_offsets[end] - first_obs;
+  std::vector<uint64_t> offsets(end - begin + 1);
+  for (size_t v = begin; v <= end; ++v) {
+    offsets[v - begin] = dataset.view_offsets[v] - first_obs;
+  }
+  raw.clear();
+  AppendBytes(raw, dataset.timestamps_ns.data() + begin, end - begin);
+  AppendBytes(raw, offsets.data(), offsets.size());
+  AppendBytes(raw, dataset.corner_ids.data() + first_obs, num_obs);
+  AppendBytes(raw, dataset.corner_xy.data() + 2 * first_obs, 2 * num_obs);
+}
+
+// Appends the views of a raw chunk with a timestamp in [first_ns, last_ns]
+bool UnpackObservationChunk(const std::vector<char>& raw,
+                            const size_t num_views,
+                            const int64_t first_ns,
+                            const int64_t last_ns,
+                            ObservationDataset& dataset) {
+  const size_t offsets_begin = num_views * sizeof(int64_t);
+  const size_t ids_begin = offsets_begin + (num_views + 1) * sizeof(uint64_t);
+  if (raw.size() < ids_begin) return false;
+  uint64_t num_obs = 0;
+  std::memcpy(&num_obs,
+              raw.data() + offsets_begin + num_views * sizeof(uint64_t),
+              sizeof(num_obs));
+  if (num_obs > raw.size()) return false;
+  const size_t xy_begin = ids_begin + num_obs * sizeof(uint16_t);
+  if (raw.size() != xy_begin + 2 * num_obs * sizeof(double)) return false;
+
+  // the chunk is not aligned for the arrays, values are copied out
+  std::vector<uint64_t> offsets(num_views + 1);
+  std::memcpy(offsets.data(),
+              raw.data() + offsets_begin,
+              offsets.size() * sizeof(uint64_t));
+  for (size_t v = 0; v < num_views; ++v) {
+    int64_t timestamp_ns;
+    std::memcpy(&timestamp_ns,
+                raw.data() + v * sizeof(int64_t),
+                sizeof(timestamp_ns));
+    if (timestamp_ns < first_ns || timestamp_ns > last_ns) continue;
+    if (offsets[v] > offsets[v + 1] || offsets[v + 1] > num_obs) return false;
+    const size_t n = offsets[v + 1] - offsets[v];
+    if (n > 0) {
+      const size_t ids_size = dataset.corner_ids.size();
+      const size_t xy_size = dataset.corner_xy.size();
+      dataset.corner_ids.resize(ids_size + n);
+      dataset.corner_xy.resize(xy_size + 2 * n);
+      std::memcpy(dataset.corner_ids.data() + ids_size,
+                  raw.data() + ids_begin + offsets[v] * sizeof(uint16_t),
+                  n * sizeof(uint16_t));
+      std::memcpy(dataset.corner_xy.data() + xy_size,
+                  raw.data() + xy_begin + 2 * offsets[v] * sizeof(double),
+                  2 * n * sizeof(double));
+    }
+    dataset.timestamps_ns.push_back(timestamp_ns);
+    dataset.view_offsets.push_back(dataset.corner_ids.size());
+  }
+  return true;
+}
+
+bool ReadObservationChunks(const std::string& input_path,
+                           const uint64_t offset,
+                           const uint64_t bytes,
+                           const int64_t first_ns,
+                           const int64_t last_ns,
+                           ObservationDataset& dataset) {
+  ChunkedFileReader reader;
+  if (!reader.Open(input_path, kObservationChunkedMagic, offset, bytes)) {
+    return false;
+  }
+  dataset.Clear();
+  const std::vector<char>& meta = reader.Meta();
+  dataset.header =
+      nlohmann::json::from_ubjson(meta.begin(), meta.end(), true, false);
+  if (dataset.header.is_discarded()) {
+    std::cerr << "Invalid observation header in " << input_path << "\n";
+    return false;
+  }
+
+  size_t begin, end;
+  reader.FindChunks(first_ns, last_ns, begin, end);
+  std::vector<std::vector<char>> raw;
+  if (!reader.ReadChunks(
+          begin, end, raw, utils::Executor::Global().MaxConcurrency())) {
+    std::cerr << "Corrupt observation chunk in " << input_path << "\n";
+    return false;
+  }
+  for (size_t c = begin; c < end; ++c) {
+    if (!UnpackObservationChunk(raw[c - begin],
+                                reader.Chunk(c).num_records,
+                                first_ns,
+                                last_ns,
+                                dataset)) {
+      std::cerr << "Corrupt observation chunk in " << input_path << "\n";
+      return false;
+    }
+    std::vector<char>().swap(raw[c - begin]);
+  }
+  return true;
+}
+}  // namespace
+
+void ObservationDataset::AddView(const int64_t timestamp_ns,
+                                 const std::vector<uint16_t>& ids,
+                                 const std::vector<double>& xy) {
+  timestamps_ns.push_back(timestamp_ns);
+  corner_ids.insert(corner_ids.end(), ids.begin(), ids.end());
+  corner_xy.insert(corner_xy.end(), xy.begin(), xy.end());
+  view_offsets.push_back(corner_ids.size());
+}
+
+void ObservationDataset::Clear() {
+  header.clear();
+  timestamps_ns.clear();
+  view_offsets = {0};
+  corner_ids.clear();
+  corner_xy.clear();
+}
+
+bool WriteObservationDataset(const std::string& output_path,
+                             const ObservationDataset& dataset) {
+  if (dataset.view_offsets.size() != dataset.NumViews() + 1 ||
+      dataset.corner_xy.size() != 2 * dataset.NumObservations()) {
+    std::cerr << "Inconsistent observation dataset.\n";
+    return false;
+  }
+  std::ofstream out(output_path, std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Could not open: " << output_path << "\n";
+    return false;
+  }
+  const std::vector<std::uint8_t> header =
+      nlohmann::json::to_ubjson(dataset.header);
+  const uint64_t header_size = header.size();
+  const uint64_t num_views = dataset.NumViews();
+  const uint64_t num_obs = dataset.NumObservations();
+
+  out.write(kObservationMagic, sizeof(kObservationMagic));
+  out.write(reinterpret_cast<const char*>(&kObservationVersion),
+            sizeof(kObservationVersion));
+  out.write(reinterpret_cast<const char*>(&header_size), sizeof(header_size));
+  WriteArray(out, header);
+  out.write(reinterpret_cast<const char*>(&num_views), sizeof(num_views));
+  out.write(reinterpret_cast<const char*>(&num_obs), sizeof(num_obs));
+  WriteArray(out, dataset.timestamps_ns);
+  WriteArray(out, dataset.view_offsets);
+  WriteArray(out, dataset.corner_ids);
+  WriteArray(out, dataset.corner_xy);
+  out.close();
+  return !out.fail();
+}
+
+bool WriteObservationDataset(const std::string& output_path,
+                             const ObservationDataset& dataset,
+                             const ChunkCodec codec,
+                             const size_t views_per_chunk) {
+  if (codec == ChunkCodec::kNone) {
+    return WriteObservationDataset(output_path, dataset);
+  }
+  if (dataset.view_offsets.size() != dataset.NumViews() + 1 ||
+      dataset.corner_xy.size() != 2 * dataset.NumObservations()) {
+    std::cerr << "Inconsistent observation dataset.\n";
+    return false;
+  }
+  const std::vector<std::uint8_t> header =
+      nlohmann::json::to_ubjson(dataset.header);
+  ChunkedFileWriter writer;
+  if (!writer.Open(output_path,
+                   kObservationChunkedMagic,
+                   codec,
+                   std::vector<char>(header.begin(), header.end()))) {
+    return false;
+  }
+  const size_t chunk_size = std::max<size_t>(views_per_chunk, 1);
+  std::vector<char> raw;
+  for (size_t v = 0; v < dataset.NumViews(); v += chunk_size) {
+    const size_t end = std::min(dataset.NumViews(), v + chunk_size);
+    PackObservationChunk(dataset, v, end, raw);
+    if (!writer.AddChunk(raw,
+                         end - v,
+                         dataset.timestamps_ns[v],
+                         dataset.timestamps_ns[end - 1])) {
+      return false;
+    }
+  }
+  return writer.Close();
+}
+
+bool ReadObservationDataset(const std::string& input_path,
+                            ObservationDataset& dataset) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(
+          input_path, kSessionObservations, offset, bytes)) {
+    return false;
+  }
+  if (HasMagic(input_path, kObservationChunkedMagic, offset)) {
+    return ReadObservationChunks(input_path,
+                                 offset,
+                                 bytes,
+                                 std::numeric_limits<int64_t>::min(),
+                                 std::numeric_limits<int64_t>::max(),
+                                 dataset);
+  }
+  std::ifstream in(input_path, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    std::cerr << "Can not open " << input_path << "\n";
+    return false;
+  }
+  // end of the dataset, the whole file if it is not a session section
+  in.seekg(0, std::ios::end);
+  const std::streamoff file_size = in.tellg();
+  if (file_size < 0) {
+    std::cerr << "Can not read " << input_path << "\n";
+    return false;
+  }
+  const uint64_t end =
+      bytes > 0 ? std::min<uint64_t>(offset + bytes, file_size) : file_size;
+  in.seekg(offset);
+  char magic[sizeof(kObservationMagic)];
+  uint32_t version = 0;
+  in.read(magic, sizeof(magic));
+  if (!in ||
+      std::memcmp(magic, kObservationMagic, sizeof(kObservationMagic)) != 0 ||
+      !ReadScalar(in, version) || version != kObservationVersion) {
+    std::cerr << input_path << " is not an observation dataset.\n";
+    return false;
+  }
+
+  uint64_t header_size = 0, num_views = 0, num_obs = 0;
+  std::vector<std::uint8_t> header;
+  if (!ReadScalar(in, header_size) ||
+      !ReadArray(in, header_size, end, header) || !ReadScalar(in, num_views) ||
+      !ReadScalar(in, num_obs)) {
+    std::cerr << "Truncated observation dataset " << input_path << "\n";
+    return false;
+  }
+  dataset.header = nlohmann::json::from_ubjson(header, true, false);
+  if (dataset.header.is_discarded()) {
+    std::cerr << "Invalid observation header in " << input_path << "\n";
+    return false;
+  }
+
+  // earlier arrays fail first if a count is so large that the later ones
+  // would overflow
+  if (!ReadArray(in, num_views, end, dataset.timestamps_ns) ||
+      !ReadArray(in, num_views + 1, end, dataset.view_offsets) ||
+      !ReadArray(in, num_obs, end, dataset.corner_ids) ||
+      !ReadArray(in, 2 * num_obs, end, dataset.corner_xy)) {
+    std::cerr << "Truncated observation dataset " << input_path << "\n";
+    return false;
+  }
+  if (dataset.view_offsets.front() != 0 ||
+      dataset.view_offsets.back() != num_obs ||
+      !std::is_sorted(dataset.view_offsets.begin(),
+                      dataset.view_offsets.end())) {
+    std::cerr << "Invalid view offsets in " << input_path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool ReadObservationDatasetRange(const std::string& input_path,
+                                 const int64_t first_ns,
+                                 const int64_t last_ns,
+                                 ObservationDataset& dataset) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(
+          input_path, kSessionObservations, offset, bytes)) {
+    return false;
+  }
+  if (HasMagic(input_path, kObservationChunkedMagic, offset)) {
+    return ReadObservationChunks(
+        input_path, offset, bytes, first_ns, last_ns, dataset);
+  }
+  ObservationDataset all_views;
+  if (!ReadObservationDataset(input_path, all_views)) {
+    return false;
+  }
+  dataset.Clear();
+  dataset.header = std::move(all_views.header);
+  for (size_t v = 0; v < all_views.NumViews(); ++v) {
+    const int64_t timestamp_ns = all_views.timestamps_ns[v];
+    if (timestamp_ns < first_ns || timestamp_ns > last_ns) continue;
+    const uint64_t begin = all_views.view_offsets[v];
+    const uint64_t end = all_views.view_offsets[v + 1];
+    dataset.timestamps_ns.push_back(timestamp_ns);
+    dataset.corner_ids.insert(dataset.corner_ids.end(),
+                              all_views.corner_ids.begin() + begin,
+                              all_views.corner_ids.begin() + end);
+    dataset.corner_xy.insert(dataset.corner_xy.end(),
+                             all_views.corner_xy.begin() + 2 * begin,
+                             all_views.corner_xy.begin() + 2 * end);
+    dataset.view_offsets.push_back(dataset.corner_ids.size());
+  }
+  return true;
+}
+
+bool SceneToObservationDataset(const MappedScene& scene,
+                               ObservationDataset& dataset) {
+  dataset.Clear();
+  dataset.header = scene.Header();
+  dataset.timestamps_ns.reserve(scene.NumViews());
+  dataset.view_offsets.reserve(scene.NumViews() + 1);
+
+  // views are stored in temporal order. Keys are the timestamp in
+  // microseconds.
+  std::vector<std::pair<double, size_t>> time_ordered_views;
+  time_ordered_views.reserve(scene.NumViews());
+  for (size_t i = 0; i < scene.NumViews(); ++i) {
+    time_ordered_views.emplace_back(std::stod(scene.ViewKey(i)), i);
+  }
+  std::sort(time_ordered_views.begin(), time_ordered_views.end());
+
+  nlohmann::json view;
+  std::vector<uint16_t> ids;
+  std::vector<double> xy;
+  for (const auto& time_view : time_ordered_views) {
+    const double timestamp_us = time_view.first;
+    if (!scene.ParseView(time_view.second, view)) {
+      return false;
+    }
+    ids.clear();
+    xy.clear();
+    for (const auto& img_pts : view["image_points"].items()) {
+      const int id = std::stoi(img_pts.key());
+      if (id < 0 || id > std::numeric_limits<uint16_t>::max()) {
+        std::cerr << "Corner id " << id << " does not fit into uint16.\n";
+        return false;
+      }
+      ids.push_back(static_cast<uint16_t>(id));
+      xy.push_back(img_pts.value()[0]);
+      xy.push_back(img_pts.value()[1]);
+    }
+    dataset.AddView(
+        static_cast<int64_t>(std::llround(timestamp_us * US_TO_S * S_TO_NS)),
+        ids,
+        xy);
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
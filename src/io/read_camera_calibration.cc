@@ -18,6 +18,7 @@
 #include <iostream>
 
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/session_file.h"
 #include "OpenCameraCalibrator/utils/json.h"
 
 #include "theia/sfm/camera/division_undistortion_camera_model.h"
@@ -35,13 +36,12 @@ namespace io {
 bool read_camera_calibration(const std::string& input_json,
                              theia::Camera& camera,
                              double& fps) {
-  std::ifstream input(input_json);
-  if (!input.is_open()) {
+  json json_content;
+  if (!ReadJsonFileOrSection(
+          input_json, kSessionCameraCalibration, json_content)) {
     std::cerr << "Could not open: " << input_json << "\n";
     return false;
   }
-  json json_content;
-  input >> json_content;
 
   std::string camera_model_type = json_content["intrinsic_type"];
 
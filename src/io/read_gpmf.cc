@@ -0,0 +1,482 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/read_gpmf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+
+constexpr uint32_t FourCC(const char* code) {
+  return (uint32_t(uint8_t(code[0])) << 24) |
+         (uint32_t(uint8_t(code[1])) << 16) |
+         (uint32_t(uint8_t(code[2])) << 8) | uint32_t(uint8_t(code[3]));
+}
+
+// the moov box is read into memory as a whole, it is only a few MB even for
+// long recordings
+const uint64_t kMaxMoovSize = uint64_t(1) << 30;
+
+uint16_t ReadBE16(const uint8_t* data) {
+  return (uint16_t(data[0]) << 8) | uint16_t(data[1]);
+}
+
+uint32_t ReadBE32(const uint8_t* data) {
+  return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) |
+         (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+uint64_t ReadBE64(const uint8_t* data) {
+  return (uint64_t(ReadBE32(data)) << 32) | uint64_t(ReadBE32(data + 4));
+}
+
+// payload range [begin, end) of a box inside a buffer
+struct Box {
+  uint32_t type = 0;
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Reads the box at pos and advances pos past it. Returns false at the end of
+// the parent or for a box that does not fit into it.
+bool NextBox(const std::vector<uint8_t>& buffer,
+             const size_t end,
+             size_t& pos,
+             Box& box) {
+  if (pos + 8 > end) return false;
+  uint64_t size = ReadBE32(&buffer[pos]);
+  box.type = ReadBE32(&buffer[pos + 4]);
+  size_t header_size = 8;
+  if (size == 1) {
+    if (pos + 16 > end) return false;
+    size = ReadBE64(&buffer[pos + 8]);
+    header_size = 16;
+  } else if (size == 0) {
+    size = end - pos;
+  }
+  if (size < header_size || size > end - pos) return false;
+  box.begin = pos + header_size;
+  box.end = pos + size;
+  pos = box.end;
+  return true;
+}
+
+bool FindChild(const std::vector<uint8_t>& buffer,
+               const Box& parent,
+               const uint32_t type,
+               Box& child) {
+  size_t pos = parent.begin;
+  while (NextBox(buffer, parent.end, pos, child)) {
+    if (child.type == type) return true;
+  }
+  return false;
+}
+
+// file offset, size and timing of one sample of the telemetry track
+struct TrackSample {
+  uint64_t offset = 0;
+  uint32_t size = 0;
+  double start_s = 0.0;
+  double duration_s = 0.0;
+};
+
+// Sample table of a trak box if it is a gpmd track
+bool ReadGpmdTrack(const std::vector<uint8_t>& buffer,
+                   const Box& trak,
+                   std::vector<TrackSample>& samples) {
+  Box mdia, mdhd, minf, stbl, stsd;
+  if (!FindChild(buffer, trak, FourCC("mdia"), mdia) ||
+      !FindChild(buffer, mdia, FourCC("mdhd"), mdhd) ||
+      !FindChild(buffer, mdia, FourCC("minf"), minf) ||
+      !FindChild(buffer, minf, FourCC("stbl"), stbl) ||
+      !FindChild(buffer, stbl, FourCC("stsd"), stsd)) {
+    return false;
+  }
+  // first sample description: version/flags, entry count, size, format
+  if (stsd.end - stsd.begin < 16 ||
+      ReadBE32(&buffer[stsd.begin + 12]) != FourCC("gpmd")) {
+    return false;
+  }
+
+  const uint8_t mdhd_version = buffer[mdhd.begin];
+  const size_t timescale_pos = mdhd.begin + (mdhd_version == 1 ? 20 : 12);
+  if (timescale_pos + 4 > mdhd.end) return false;
+  const uint32_t timescale = ReadBE32(&buffer[timescale_pos]);
+  if (timescale == 0) return false;
+
+  Box stts, stsc, stsz, stco;
+  bool co64 = false;
+  if (!FindChild(buffer, stbl, FourCC("stco"), stco)) {
+    if (!FindChild(buffer, stbl, FourCC("co64"), stco)) return false;
+    co64 = true;
+  }
+  if (!FindChild(buffer, stbl, FourCC("stts"), stts) ||
+      !FindChild(buffer, stbl, FourCC("stsc"), stsc) ||
+      !FindChild(buffer, stbl, FourCC("stsz"), stsz) ||
+      stts.end - stts.begin < 8 || stsc.end - stsc.begin < 8 ||
+      stco.end - stco.begin < 8 || stsz.end - stsz.begin < 12) {
+    return false;
+  }
+
+  // sample sizes
+  const uint32_t fixed_size = ReadBE32(&buffer[stsz.begin + 4]);
+  const uint32_t nr_samples = ReadBE32(&buffer[stsz.begin + 8]);
+  if (fixed_size == 0 && stsz.begin + 12 + 4 * uint64_t(nr_samples) >
+                             stsz.end) {
+    return false;
+  }
+  samples.resize(nr_samples);
+  for (uint32_t i = 0; i < nr_samples; ++i) {
+    samples[i].size =
+        fixed_size ? fixed_size : ReadBE32(&buffer[stsz.begin + 12 + 4 * i]);
+  }
+
+  // sample timing
+  const uint32_t nr_stts = ReadBE32(&buffer[stts.begin + 4]);
+  if (stts.begin + 8 + 8 * uint64_t(nr_stts) > stts.end) return false;
+  uint64_t time = 0;
+  size_t sample_idx = 0;
+  for (uint32_t e = 0; e < nr_stts; ++e) {
+    const uint32_t count = ReadBE32(&buffer[stts.begin + 8 + 8 * e]);
+    const uint32_t delta = ReadBE32(&buffer[stts.begin + 12 + 8 * e]);
+    for (uint32_t i = 0; i < count && sample_idx < nr_samples; ++i) {
+      samples[sample_idx].start_s = double(time) / timescale;
+      samples[sample_idx].duration_s = double(delta) / timescale;
+      time += delta;
+      ++sample_idx;
+    }
+  }
+
+  // sample offsets from the chunk offsets and the samples per chunk
+  const uint32_t nr_chunks = ReadBE32(&buffer[stco.begin + 4]);
+  const size_t offset_size = co64 ? 8 : 4;
+  if (stco.begin + 8 + offset_size * uint64_t(nr_chunks) > stco.end) {
+    return false;
+  }
+  const uint32_t nr_stsc = ReadBE32(&buffer[stsc.begin + 4]);
+  if (stsc.begin + 8 + 12 * uint64_t(nr_stsc) > stsc.end) return false;
+  sample_idx = 0;
+  uint32_t stsc_idx = 0;
+  for (uint32_t c = 0; c < nr_chunks && sample_idx < nr_samples; ++c) {
+    // stsc entries are 1 based chunk numbers
+    while (stsc_idx + 1 < nr_stsc &&
+           ReadBE32(&buffer[stsc.begin + 8 + 12 * (stsc_idx + 1)]) <= c + 1) {
+      ++stsc_idx;
+    }
+    const uint32_t samples_per_chunk =
+        nr_stsc ? ReadBE32(&buffer[stsc.begin + 12 + 12 * stsc_idx]) : 1;
+    const size_t pos = stco.begin + 8 + offset_size * c;
+    uint64_t offset = co64 ? ReadBE64(&buffer[pos]) : ReadBE32(&buffer[pos]);
+    for (uint32_t i = 0; i < samples_per_chunk && sample_idx < nr_samples;
+         ++i) {
+      samples[sample_idx].offset = offset;
+      offset += samples[sample_idx].size;
+      ++sample_idx;
+    }
+  }
+  samples.resize(sample_idx);
+  return true;
+}
+
+// Reads the top level boxes until moov and returns the gpmd sample table
+bool ReadGpmdSampleTable(std::ifstream& file,
+                         const std::string& path_to_mp4,
+                         std::vector<TrackSample>& samples) {
+  file.seekg(0, std::ios::end);
+  const uint64_t file_size = file.tellg();
+  uint64_t pos = 0;
+  std::vector<uint8_t> moov;
+  while (pos + 8 <= file_size) {
+    uint8_t header[16];
+    file.seekg(pos);
+    file.read(reinterpret_cast<char*>(header), 8);
+    if (!file) break;
+    uint64_t size = ReadBE32(header);
+    const uint32_t type = ReadBE32(header + 4);
+    uint64_t header_size = 8;
+    if (size == 1) {
+      file.read(reinterpret_cast<char*>(header + 8), 8);
+      if (!file) break;
+      size = ReadBE64(header + 8);
+      header_size = 16;
+    } else if (size == 0) {
+      size = file_size - pos;
+    }
+    if (size < header_size || size > file_size - pos) break;
+    if (type == FourCC("moov")) {
+      if (size - header_size > kMaxMoovSize) break;
+      moov.resize(size - header_size);
+      file.read(reinterpret_cast<char*>(moov.data()), moov.size());
+      if (!file) moov.clear();
+      break;
+    }
+    pos += size;
+  }
+  if (moov.empty()) {
+    std::cerr << "No moov box found in " << path_to_mp4 << "\n";
+    return false;
+  }
+
+  Box parent;
+  parent.begin = 0;
+  parent.end = moov.size();
+  size_t box_pos = parent.begin;
+  Box trak;
+  while (NextBox(moov, parent.end, box_pos, trak)) {
+    if (trak.type == FourCC("trak") && ReadGpmdTrack(moov, trak, samples)) {
+      return true;
+    }
+  }
+  std::cerr << "No GPMF metadata track found in " << path_to_mp4 << "\n";
+  return false;
+}
+
+// size in bytes of one value of a GPMF type, 0 for unsupported types
+size_t GpmfTypeSize(const char type) {
+  switch (type) {
+    case 'b':
+    case 'B':
+      return 1;
+    case 's':
+    case 'S':
+      return 2;
+    case 'l':
+    case 'L':
+    case 'f':
+      return 4;
+    case 'd':
+    case 'j':
+    case 'J':
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+double GpmfValue(const char type, const uint8_t* data) {
+  switch (type) {
+    case 'b':
+      return double(int8_t(data[0]));
+    case 'B':
+      return double(data[0]);
+    case 's':
+      return double(int16_t(ReadBE16(data)));
+    case 'S':
+      return double(ReadBE16(data));
+    case 'l':
+      return double(int32_t(ReadBE32(data)));
+    case 'L':
+      return double(ReadBE32(data));
+    case 'f': {
+      const uint32_t bits = ReadBE32(data);
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return double(value);
+    }
+    case 'd': {
+      const uint64_t bits = ReadBE64(data);
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    case 'j':
+      return double(int64_t(ReadBE64(data)));
+    case 'J':
+      return double(ReadBE64(data));
+    default:
+      return 0.0;
+  }
+}
+
+// scaled three axis samples of the ACCL and GYRO streams of one payload
+struct GpmfPayload {
+  std::vector<Eigen::Vector3d> accl;
+  std::vector<Eigen::Vector3d> gyro;
+};
+
+void ParseGpmf(const uint8_t* data,
+               const size_t size,
+               std::vector<double>& scale,
+               GpmfPayload& payload) {
+  size_t pos = 0;
+  while (pos + 8 <= size) {
+    const uint32_t key = ReadBE32(data + pos);
+    const char type = char(data[pos + 4]);
+    const size_t struct_size = data[pos + 5];
+    const size_t repeat = ReadBE16(data + pos + 6);
+    const size_t length = struct_size * repeat;
+    const uint8_t* value = data + pos + 8;
+    pos += 8;
+    if (length > size - pos) return;
+    // payloads are aligned to 32 bit
+    pos += (length + 3) & ~size_t(3);
+
+    if (type == 0) {
+      // a new stream starts without scale
+      if (key == FourCC("STRM")) scale.clear();
+      ParseGpmf(value, length, scale, payload);
+      continue;
+    }
+    const size_t type_size = GpmfTypeSize(type);
+    if (type_size == 0) continue;
+    if (key == FourCC("SCAL")) {
+      scale.clear();
+      for (size_t i = 0; i < length / type_size; ++i) {
+        scale.push_back(GpmfValue(type, value + i * type_size));
+      }
+    } else if (key == FourCC("ACCL") || key == FourCC("GYRO")) {
+      if (struct_size != 3 * type_size) continue;
+      std::vector<Eigen::Vector3d>& target =
+          key == FourCC("ACCL") ? payload.accl : payload.gyro;
+      for (size_t i = 0; i < repeat; ++i) {
+        double v[3];
+        for (size_t d = 0; d < 3; ++d) {
+          v[d] = GpmfValue(type, value + i * struct_size + d * type_size);
+          const double s =
+              scale.empty() ? 1.0 : scale[std::min(d, scale.size() - 1)];
+          if (s != 0.0) v[d] /= s;
+        }
+        target.emplace_back(v[1], v[2], v[0]);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+bool IsMP4File(const std::string& path_to_file) {
+  std::ifstream file(path_to_file, std::ios::binary);
+  uint8_t header[8];
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  return file && ReadBE32(header + 4) == FourCC("ftyp");
+}
+
+bool StreamGoProMP4Telemetry(const std::string& path_to_mp4,
+                             TelemetryConsumer& consumer) {
+  std::ifstream file(path_to_mp4, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::vector<TrackSample> samples;
+  if (!ReadGpmdSampleTable(file, path_to_mp4, samples)) {
+    return false;
+  }
+
+  std::vector<uint8_t> buffer;
+  std::vector<double> scale;
+  GpmfPayload payload;
+  size_t nr_mismatched = 0;
+  for (const TrackSample& sample : samples) {
+    buffer.resize(sample.size);
+    file.seekg(sample.offset);
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if (!file) {
+      std::cerr << "Truncated GPMF payload in " << path_to_mp4 << "\n";
+      return false;
+    }
+    payload.accl.clear();
+    payload.gyro.clear();
+    scale.clear();
+    ParseGpmf(buffer.data(), buffer.size(), scale, payload);
+
+    // both sensors run at the same rate, the timestamps follow ACCL
+    const size_t n = std::min(payload.accl.size(), payload.gyro.size());
+    if (payload.accl.size() != payload.gyro.size()) ++nr_mismatched;
+    for (size_t i = 0; i < n; ++i) {
+      const double t_s =
+          sample.start_s + sample.duration_s * i / payload.accl.size();
+      consumer.AddTimestamp(std::llround(t_s * S_TO_NS));
+      consumer.AddAccelerometer(payload.accl[i]);
+      consumer.AddGyroscope(payload.gyro[i]);
+    }
+  }
+  if (nr_mismatched > 0) {
+    std::cerr << nr_mismatched << " GPMF payloads of " << path_to_mp4
+              << " have different ACCL and GYRO sample counts, the surplus "
+                 "samples were dropped.\n";
+  }
+  return true;
+}
+
+bool ReadGoProMP4TelemetryDuration(const std::string& path_to_mp4,
+                                   double& duration_s) {
+  std::ifstream file(path_to_mp4, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::vector<TrackSample> samples;
+  if (!ReadGpmdSampleTable(file, path_to_mp4, samples)) {
+    return false;
+  }
+  duration_s = samples.empty()
+                   ? 0.0
+                   : samples.back().start_s + samples.back().duration_s;
+  return true;
+}
+
+bool GoProChapterOffsets(const std::vector<std::string>& chapter_mp4s,
+                         std::vector<double>& offsets_s) {
+  offsets_s.resize(chapter_mp4s.size());
+  double offset_s = 0.0;
+  for (size_t i = 0; i < chapter_mp4s.size(); ++i) {
+    double duration_s = 0.0;
+    if (!ReadGoProMP4TelemetryDuration(chapter_mp4s[i], duration_s)) {
+      std::cerr << "Could not read the duration of " << chapter_mp4s[i]
+                << "\n";
+      return false;
+    }
+    offsets_s[i] = offset_s;
+    offset_s += duration_s;
+  }
+  return true;
+}
+
+bool ReadGoProChapterTelemetry(const std::vector<std::string>& chapter_mp4s,
+                               const std::vector<double>& offsets_s,
+                               CameraTelemetryData& telemetry) {
+  std::vector<CameraTelemetryData> chapters(chapter_mp4s.size());
+  std::atomic<bool> success(true);
+  utils::ParallelFor(
+      chapter_mp4s.size(),
+      static_cast<int>(chapter_mp4s.size()),
+      [&](const size_t begin, const size_t end, const int) {
+        for (size_t i = begin; i < end; ++i) {
+          if (!ReadTelemetryMP4(chapter_mp4s[i], chapters[i])) {
+            std::cerr << "Could not read the telemetry of " << chapter_mp4s[i]
+                      << "\n";
+            success = false;
+          }
+        }
+      });
+  if (!success) {
+    return false;
+  }
+  return MergeTelemetry(chapters, offsets_s, telemetry);
+}
+
+}  // namespace io
+}  // namespace OpenICC
@@ -14,6 +14,7 @@
  */
 
 #include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/session_file.h"
 
 #include "OpenCameraCalibrator/utils/json.h"
 #include "OpenCameraCalibrator/utils/types.h"
@@ -30,13 +31,11 @@ using json = nlohmann::json;
 bool ReadSplineErrorWeighting(
     const std::string& path_to_spline_error_weighting_json,
     SplineWeightingData& spline_weighting) {
-  std::ifstream file;
-  file.open(path_to_spline_error_weighting_json.c_str());
-  if (!file.is_open()) {
+  json j;
+  if (!ReadJsonFileOrSection(
+          path_to_spline_error_weighting_json, kSessionSplineWeighting, j)) {
     return false;
   }
-  json j;
-  file >> j;
   spline_weighting.cam_fps = j["camera_fps"];
   spline_weighting.dt_r3 = j["r3"]["knot_spacing"];
   spline_weighting.dt_so3 = j["so3"]["knot_spacing"];
@@ -49,13 +48,10 @@ bool ReadSplineErrorWeighting(
 bool ReadIMUBias(const std::string& path_to_imu_bias,
                  Eigen::Vector3d& gyro_bias,
                  Eigen::Vector3d& accl_bias) {
-  std::ifstream file;
-  file.open(path_to_imu_bias.c_str());
-  if (!file.is_open()) {
+  json j;
+  if (!ReadJsonFileOrSection(path_to_imu_bias, kSessionImuBias, j)) {
     return false;
   }
-  json j;
-  file >> j;
   accl_bias << j["accl_bias"]["x"], j["accl_bias"]["y"], j["accl_bias"]["z"];
   gyro_bias << j["gyro_bias"]["x"], j["gyro_bias"]["y"], j["gyro_bias"]["z"];
 
@@ -65,13 +61,10 @@ bool ReadIMUBias(const std::string& path_to_imu_bias,
 bool ReadIMU2CamInit(const std::string& path_to_file,
                      Eigen::Quaterniond& imu_to_cam_rotation,
                      double& time_offset_imu_to_cam) {
-  std::ifstream file;
-  file.open(path_to_file.c_str());
-  if (!file.is_open()) {
+  json j;
+  if (!ReadJsonFileOrSection(path_to_file, kSessionGyroToCam, j)) {
     return false;
   }
-  json j;
-  file >> j;
   imu_to_cam_rotation = Eigen::Quaterniond(j["gyro_to_camera_rotation"]["w"],
                                            j["gyro_to_camera_rotation"]["x"],
                                            j["gyro_to_camera_rotation"]["y"],
@@ -103,13 +96,11 @@ bool ReadIMUIntrinsics(const std::string& path_to_imu_intrinsics,
 
   if (path_to_imu_intrinsics != "") {
     LOG(INFO) << "Loading IMU intrinsics.";
-    std::ifstream file;
-    file.open(path_to_imu_intrinsics.c_str());
-    if (!file.is_open()) {
+    json j;
+    if (!ReadJsonFileOrSection(
+            path_to_imu_intrinsics, kSessionImuIntrinsics, j)) {
       return false;
     }
-    json j;
-    file >> j;
 
     auto m_acc = j["accelerometer"]["misalignment_matrix"];
     auto s_acc = j["accelerometer"]["scale_matrix"];
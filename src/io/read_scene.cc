@@ -13,30 +13,52 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstdlib>
 #include <fstream>
 #include <ios>
 #include <iostream>
 
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/mapped_scene.h"
+#include "OpenCameraCalibrator/utils/types.h"
 
 namespace OpenICC {
 namespace io {
 
 bool read_scene_bson(const std::string& input_bson,
                      nlohmann::json& scene_json) {
-  std::ifstream input_corner_json(input_bson, std::ios::binary);
-  if (!input_corner_json.is_open()) {
-    std::cerr << "Can not open " << input_bson << "\n";
+  // parse directly from the mapped file
+  MappedScene scene;
+  if (!scene.Open(input_bson)) {
     return false;
   }
-  // read the contents of the file into the vector
-  std::uint8_t cont;
-  std::vector<std::uint8_t> uson_file_content;
-  while (input_corner_json.read(reinterpret_cast<char*>(&cont), sizeof(cont))) {
-    uson_file_content.push_back(cont);
+  return scene.ParseAll(scene_json);
+}
+
+bool read_scene_bson(const std::string& input_bson,
+                     const double t_begin_s,
+                     const double t_end_s,
+                     nlohmann::json& scene_json) {
+  MappedScene scene;
+  if (!scene.Open(input_bson)) {
+    return false;
+  }
+  scene_json = scene.Header();
+  nlohmann::json& views = scene_json["views"];
+  views = nlohmann::json::object();
+  // the view keys are the timestamps in microseconds
+  for (size_t i = 0; i < scene.NumViews(); ++i) {
+    const double t_s =
+        std::strtod(scene.ViewKey(i).c_str(), nullptr) * US_TO_S;
+    if (t_s < t_begin_s || t_s > t_end_s) {
+      continue;
+    }
+    if (!scene.ParseView(i, views[scene.ViewKey(i)])) {
+      std::cerr << "Could not parse view " << scene.ViewKey(i) << " of "
+                << input_bson << "\n";
+      return false;
+    }
   }
-  scene_json = nlohmann::json::from_ubjson(uson_file_content);
-  input_corner_json.close();
   return true;
 }
 
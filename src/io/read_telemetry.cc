@@ -15,48 +15,1039 @@
 
 #include "OpenCameraCalibrator/io/read_telemetry.h"
 
+#include "OpenCameraCalibrator/io/read_gpmf.h"
+#include "OpenCameraCalibrator/io/remote_file.h"
+#include "OpenCameraCalibrator/io/session_file.h"
+#include "OpenCameraCalibrator/utils/executor.h"
 #include "OpenCameraCalibrator/utils/json.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <istream>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
 
 namespace OpenICC {
 namespace io {
 using json = nlohmann::json;
 
+namespace {
+const char kTelemetryMagic[8] = {'O', 'I', 'C', 'C', 'T', 'E', 'L', '1'};
+const uint32_t kTelemetryVersion = 1;
+const char kTelemetryChunkedMagic[8] = {
+    'O', 'I', 'C', 'C', 'T', 'E', 'L', 'C'};
+const size_t kBytesPerSample = sizeof(int64_t) + 6 * sizeof(double);
+const char kRecorderMagic[8] = {'O', 'I', 'C', 'C', 'R', 'E', 'C', '1'};
+const uint32_t kRecorderVersion = 1;
+const size_t kRecorderHeaderSize =
+    sizeof(kRecorderMagic) + 2 * sizeof(uint32_t);
+// rough number of json characters per imu sample (timestamp + 6 values),
+// only used to reserve memory before parsing
+const size_t kApproxJsonBytesPerSample = 120;
+
+// Passes the imu arrays to a consumer while parsing, everything else is
+// skipped
+class TelemetrySaxHandler : public nlohmann::json_sax<json> {
+ public:
+  explicit TelemetrySaxHandler(TelemetryConsumer& consumer)
+      : consumer_(consumer) {}
+
+  bool null() override { return true; }
+  bool boolean(bool) override { return true; }
+  bool number_integer(number_integer_t val) override {
+    return AddNumber(static_cast<double>(val), val);
+  }
+  bool number_unsigned(number_unsigned_t val) override {
+    return AddNumber(static_cast<double>(val), static_cast<int64_t>(val));
+  }
+  bool number_float(number_float_t val, const string_t&) override {
+    return AddNumber(val, static_cast<int64_t>(std::llround(val)));
+  }
+  bool string(string_t&) override { return true; }
+  bool start_object(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool key(string_t& val) override {
+    if (depth_ == 1) {
+      current_ = Target::NONE;
+      if (val == "accelerometer") {
+        current_ = Target::ACCL;
+      } else if (val == "gyroscope") {
+        current_ = Target::GYRO;
+      } else if (val == "timestamps_ns") {
+        current_ = Target::TIMESTAMPS;
+      }
+    }
+    return true;
+  }
+  bool end_object() override {
+    --depth_;
+    return true;
+  }
+  bool start_array(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool end_array() override {
+    --depth_;
+    if (depth_ == 1) {
+      current_ = Target::NONE;
+      if (nr_vec_values_ != 0) {
+        std::cerr << "Telemetry vector arrays need 3 values per sample.\n";
+        return false;
+      }
+    }
+    return true;
+  }
+  bool parse_error(std::size_t position,
+                   const std::string&,
+                   const nlohmann::detail::exception& ex) override {
+    std::cerr << "Telemetry parse error at byte " << position << ": "
+              << ex.what() << "\n";
+    return false;
+  }
+
+ private:
+  enum class Target { NONE, ACCL, GYRO, TIMESTAMPS };
+
+  bool AddNumber(const double val, const int64_t int_val) {
+    if (depth_ < 2) return true;
+    switch (current_) {
+      case Target::ACCL:
+      case Target::GYRO:
+        vec_[nr_vec_values_++] = val;
+        if (nr_vec_values_ == 3) {
+          nr_vec_values_ = 0;
+          if (current_ == Target::ACCL) {
+            consumer_.AddAccelerometer(vec_);
+          } else {
+            consumer_.AddGyroscope(vec_);
+          }
+        }
+        break;
+      case Target::TIMESTAMPS:
+        consumer_.AddTimestamp(int_val);
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  TelemetryConsumer& consumer_;
+  int depth_ = 0;
+  Target current_ = Target::NONE;
+  Eigen::Vector3d vec_;
+  int nr_vec_values_ = 0;
+};
+
+// Collects the imu arrays to fill a CameraTelemetryData
+class TelemetryCollector : public TelemetryConsumer {
+ public:
+  explicit TelemetryCollector(const size_t expected_samples) {
+    accl_.reserve(3 * expected_samples);
+    gyro_.reserve(3 * expected_samples);
+    timestamps_ns_.reserve(expected_samples);
+  }
+
+  void AddTimestamp(const int64_t timestamp_ns) override {
+    timestamps_ns_.push_back(timestamp_ns);
+  }
+  void AddAccelerometer(const Eigen::Vector3d& accl) override {
+    accl_.insert(accl_.end(), accl.data(), accl.data() + 3);
+  }
+  void AddGyroscope(const Eigen::Vector3d& gyro) override {
+    gyro_.insert(gyro_.end(), gyro.data(), gyro.data() + 3);
+  }
+
+  const std::vector<double>& Accl() const { return accl_; }
+  const std::vector<double>& Gyro() const { return gyro_; }
+  const std::vector<int64_t>& TimestampsNs() const { return timestamps_ns_; }
+
+ private:
+  std::vector<double> accl_;
+  std::vector<double> gyro_;
+  std::vector<int64_t> timestamps_ns_;
+};
+
+bool FillTelemetry(const size_t nr_datapoints,
+                   const int64_t* timestamps_ns,
+                   const double* accl,
+                   const double* gyro,
+                   CameraTelemetryData& telemetry) {
+  telemetry.accelerometer.clear();
+  telemetry.gyroscope.clear();
+  telemetry.accelerometer.reserve(nr_datapoints);
+  telemetry.gyroscope.reserve(nr_datapoints);
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    const double t_s = (double)timestamps_ns[i] * NS_TO_S;
+    telemetry.accelerometer.emplace_back(t_s, accl + 3 * i);
+    telemetry.gyroscope.emplace_back(t_s, gyro + 3 * i);
+  }
+  return true;
+}
+
+// Read only memory mapping of a binary telemetry file with a valid header
+class MappedTelemetryBinary {
+ public:
+  MappedTelemetryBinary() {}
+
+  MappedTelemetryBinary(const MappedTelemetryBinary&) = delete;
+  MappedTelemetryBinary& operator=(const MappedTelemetryBinary&) = delete;
+
+  bool Open(const std::string& path_to_telemetry_file,
+            const uint64_t offset,
+            const uint64_t bytes) {
+    if (!region_.Open(path_to_telemetry_file, offset, bytes)) {
+      return false;
+    }
+    data_ = region_.Data();
+    const size_t file_size = region_.Size();
+    if (file_size < kHeaderSize) {
+      std::cerr << "Truncated telemetry file " << path_to_telemetry_file
+                << "\n";
+      return false;
+    }
+
+    uint32_t version = 0;
+    std::memcpy(&version, data_ + sizeof(kTelemetryMagic), sizeof(version));
+    std::memcpy(&nr_datapoints_,
+                data_ + sizeof(kTelemetryMagic) + sizeof(version),
+                sizeof(nr_datapoints_));
+    const size_t expected_size =
+        kHeaderSize +
+        nr_datapoints_ * (sizeof(int64_t) + 6 * sizeof(double));
+    if (std::memcmp(data_, kTelemetryMagic, sizeof(kTelemetryMagic)) != 0 ||
+        version != kTelemetryVersion || file_size != expected_size) {
+      std::cerr << "Invalid telemetry file " << path_to_telemetry_file
+                << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  size_t NumDatapoints() const { return nr_datapoints_; }
+
+  // the arrays are 8 byte aligned, the header is 20 bytes. Values have to be
+  // copied out instead of casting the mapped memory.
+  const char* Timestamps() const { return data_ + kHeaderSize; }
+  const char* Accelerometer() const {
+    return Timestamps() + nr_datapoints_ * sizeof(int64_t);
+  }
+  const char* Gyroscope() const {
+    return Accelerometer() + 3 * nr_datapoints_ * sizeof(double);
+  }
+
+ private:
+  static constexpr size_t kHeaderSize =
+      sizeof(kTelemetryMagic) + sizeof(uint32_t) + sizeof(uint64_t);
+
+  MappedRegion region_;
+  const char* data_ = nullptr;
+  uint64_t nr_datapoints_ = 0;
+};
+
+// Raw chunk of compressed telemetry: int64 timestamps_ns[n] |
+// float64 accelerometer[3n] | float64 gyroscope[3n]
+void PackTelemetryChunk(const size_t nr_datapoints,
+                        const int64_t* timestamps_ns,
+                        const double* accl,
+                        const double* gyro,
+                        std::vector<char>& raw) {
+  raw.resize(nr_datapoints * kBytesPerSample);
+  char* out = raw.data();
+  std::memcpy(out, timestamps_ns, nr_datapoints * sizeof(int64_t));
+  out += nr_datapoints * sizeof(int64_t);
+  std::memcpy(out, accl, 3 * nr_datapoints * sizeof(double));
+  out += 3 * nr_datapoints * sizeof(double);
+  std::memcpy(out, gyro, 3 * nr_datapoints * sizeof(double));
+}
+
+// Appends the samples of a raw chunk with a timestamp in [first_ns, last_ns]
+bool UnpackTelemetryChunk(const std::vector<char>& raw,
+                          const size_t nr_datapoints,
+                          const int64_t first_ns,
+                          const int64_t last_ns,
+                          std::vector<int64_t>& timestamps_ns,
+                          std::vector<double>& accl,
+                          std::vector<double>& gyro) {
+  if (raw.size() != nr_datapoints * kBytesPerSample) {
+    return false;
+  }
+  const char* ts_in = raw.data();
+  const char* accl_in = ts_in + nr_datapoints * sizeof(int64_t);
+  const char* gyro_in = accl_in + 3 * nr_datapoints * sizeof(double);
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    int64_t timestamp_ns;
+    std::memcpy(&timestamp_ns, ts_in + i * sizeof(int64_t), sizeof(int64_t));
+    if (timestamp_ns < first_ns || timestamp_ns > last_ns) {
+      continue;
+    }
+    timestamps_ns.push_back(timestamp_ns);
+    double values[3];
+    std::memcpy(values, accl_in + 3 * i * sizeof(double), sizeof(values));
+    accl.insert(accl.end(), values, values + 3);
+    std::memcpy(values, gyro_in + 3 * i * sizeof(double), sizeof(values));
+    gyro.insert(gyro.end(), values, values + 3);
+  }
+  return true;
+}
+
+// Decompresses the chunks that overlap [first_ns, last_ns] in parallel
+bool ReadTelemetryChunked(const std::string& path_to_telemetry_file,
+                          const uint64_t offset,
+                          const uint64_t bytes,
+                          const int64_t first_ns,
+                          const int64_t last_ns,
+                          CameraTelemetryData& telemetry) {
+  ChunkedFileReader reader;
+  if (!reader.Open(
+          path_to_telemetry_file, kTelemetryChunkedMagic, offset, bytes)) {
+    return false;
+  }
+  size_t begin, end;
+  reader.FindChunks(first_ns, last_ns, begin, end);
+  std::vector<std::vector<char>> raw;
+  if (!reader.ReadChunks(
+          begin, end, raw, utils::Executor::Global().MaxConcurrency())) {
+    std::cerr << "Corrupt telemetry chunk in " << path_to_telemetry_file
+              << "\n";
+    return false;
+  }
+  size_t nr_datapoints = 0;
+  for (size_t c = begin; c < end; ++c) {
+    nr_datapoints += reader.Chunk(c).num_records;
+  }
+  std::vector<int64_t> timestamps_ns;
+  std::vector<double> accl, gyro;
+  timestamps_ns.reserve(nr_datapoints);
+  accl.reserve(3 * nr_datapoints);
+  gyro.reserve(3 * nr_datapoints);
+  for (size_t c = begin; c < end; ++c) {
+    if (!UnpackTelemetryChunk(raw[c - begin],
+                              reader.Chunk(c).num_records,
+                              first_ns,
+                              last_ns,
+                              timestamps_ns,
+                              accl,
+                              gyro)) {
+      std::cerr << "Corrupt telemetry chunk in " << path_to_telemetry_file
+                << "\n";
+      return false;
+    }
+    // already copied out, free the chunk early
+    std::vector<char>().swap(raw[c - begin]);
+  }
+  return FillTelemetry(timestamps_ns.size(),
+                       timestamps_ns.data(),
+                       accl.data(),
+                       gyro.data(),
+                       telemetry);
+}
+
+// Flattens the telemetry into the arrays of the binary layout
+bool TelemetryToArrays(const CameraTelemetryData& telemetry,
+                       std::vector<int64_t>& timestamps_ns,
+                       std::vector<double>& accl,
+                       std::vector<double>& gyro) {
+  const size_t nr_datapoints = telemetry.accelerometer.size();
+  if (telemetry.gyroscope.size() != nr_datapoints) {
+    std::cerr << "Binary telemetry needs the same amount of accelerometer "
+                 "and gyroscope values.\n";
+    return false;
+  }
+  timestamps_ns.resize(nr_datapoints);
+  accl.resize(3 * nr_datapoints);
+  gyro.resize(3 * nr_datapoints);
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    const auto& acc_reading = telemetry.accelerometer[i];
+    const auto& gyr_reading = telemetry.gyroscope[i];
+    if (acc_reading.timestamp_s() != gyr_reading.timestamp_s()) {
+      std::cerr << "Binary telemetry needs the same timestamps for "
+                   "accelerometer and gyroscope.\n";
+      return false;
+    }
+    timestamps_ns[i] = std::llround(acc_reading.timestamp_s() * S_TO_NS);
+    for (int d = 0; d < 3; ++d) {
+      accl[3 * i + d] = acc_reading(d);
+      gyro[3 * i + d] = gyr_reading(d);
+    }
+  }
+  return true;
+}
+
+void MergeReadings(const std::vector<const CameraAccData*>& streams,
+                   const std::vector<double>& offsets_s,
+                   CameraAccData& merged) {
+  size_t nr_readings = 0;
+  for (const CameraAccData* stream : streams) {
+    nr_readings += stream->size();
+  }
+  merged.clear();
+  merged.reserve(nr_readings);
+
+  // min heap of (next timestamp, stream) with the next reading of every
+  // stream, the stream index breaks ties
+  using HeapEntry = std::pair<double, size_t>;
+  std::priority_queue<HeapEntry,
+                      std::vector<HeapEntry>,
+                      std::greater<HeapEntry>>
+      heap;
+  std::vector<size_t> next(streams.size(), 0);
+  for (size_t i = 0; i < streams.size(); ++i) {
+    if (!streams[i]->empty()) {
+      heap.emplace((*streams[i])[0].timestamp_s() + offsets_s[i], i);
+    }
+  }
+  while (!heap.empty()) {
+    const HeapEntry entry = heap.top();
+    heap.pop();
+    const size_t i = entry.second;
+    merged.emplace_back(entry.first, (*streams[i])[next[i]].data());
+    if (++next[i] < streams[i]->size()) {
+      heap.emplace((*streams[i])[next[i]].timestamp_s() + offsets_s[i], i);
+    }
+  }
+}
+
+// Timestamp in nanoseconds, saturated at the int64 range such that open
+// time ranges can be passed as the lowest and largest double
+int64_t SaturatedNs(const double t_s) {
+  const double t_ns = t_s * S_TO_NS;
+  if (t_ns <= static_cast<double>(std::numeric_limits<int64_t>::min())) {
+    return std::numeric_limits<int64_t>::min();
+  }
+  if (t_ns >= static_cast<double>(std::numeric_limits<int64_t>::max())) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return std::llround(t_ns);
+}
+
+// Removes the readings outside of [t_begin_s, t_end_s]
+void CropReadings(const double t_begin_s,
+                  const double t_end_s,
+                  std::vector<ImuReading<double>>& readings) {
+  readings.erase(std::remove_if(readings.begin(),
+                                readings.end(),
+                                [&](const ImuReading<double>& reading) {
+                                  return reading.timestamp_s() < t_begin_s ||
+                                         reading.timestamp_s() > t_end_s;
+                                }),
+                 readings.end());
+}
+
+bool IsTelemetryBinary(const std::string& path_to_telemetry_file) {
+  std::ifstream file(path_to_telemetry_file, std::ios::binary);
+  char magic[sizeof(kTelemetryMagic)];
+  file.read(magic, sizeof(magic));
+  return file &&
+         (std::memcmp(magic, kTelemetryMagic, sizeof(kTelemetryMagic)) == 0 ||
+          std::memcmp(magic,
+                      kTelemetryChunkedMagic,
+                      sizeof(kTelemetryChunkedMagic)) == 0);
+}
+}  // namespace
+
 bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
                        CameraTelemetryData& telemetry) {
-  std::ifstream file;
-  file.open(path_to_telemetry_file.c_str());
-  if (!file.is_open()) {
+  return ReadTelemetryJSON(path_to_telemetry_file,
+                           std::numeric_limits<double>::lowest(),
+                           std::numeric_limits<double>::max(),
+                           telemetry);
+}
+
+bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
+                       const double t_begin_s,
+                       const double t_end_s,
+                       CameraTelemetryData& telemetry) {
+  struct stat file_stat;
+  size_t expected_samples = 0;
+  if (stat(path_to_telemetry_file.c_str(), &file_stat) == 0) {
+    expected_samples = file_stat.st_size / kApproxJsonBytesPerSample;
+  }
+  TelemetryCollector collector(expected_samples);
+  if (!StreamTelemetryJSON(path_to_telemetry_file, collector)) {
     return false;
   }
-  json j;
-  file >> j;
-  const auto accl = j["accelerometer"];
-  const auto gyro = j["gyroscope"];
-  const auto timestamps_ns = j["timestamps_ns"];
 
-  const size_t nr_datapoints = timestamps_ns.size();
-  if (gyro.size() != nr_datapoints || accl.size() != nr_datapoints) {
+  const size_t nr_datapoints = collector.TimestampsNs().size();
+  if (collector.Gyro().size() != 3 * nr_datapoints ||
+      collector.Accl().size() != 3 * nr_datapoints) {
     std::cerr << "Telemetry should have the same amount of timestamps, "
                  "accelerometer and gyroscope values.\n";
     return false;
   }
 
-  for (size_t i = 0; i < timestamps_ns.size(); ++i) {
-    double t_s = (double)timestamps_ns[i] * NS_TO_S;
-    ImuReading<double> acc_reading(t_s, accl[i][0], accl[i][1], accl[i][2]);
-    ImuReading<double> gyr_reading(t_s, gyro[i][0], gyro[i][1], gyro[i][2]);
-    telemetry.accelerometer.push_back(acc_reading);
-    telemetry.gyroscope.push_back(gyr_reading);
+  // the timestamps are sorted, the range is one block of samples
+  const std::vector<int64_t>& timestamps_ns = collector.TimestampsNs();
+  const auto first = timestamps_ns.begin(), last = timestamps_ns.end();
+  const size_t begin =
+      std::lower_bound(first, last, SaturatedNs(t_begin_s)) - first;
+  const size_t end = std::max<size_t>(
+      begin, std::upper_bound(first, last, SaturatedNs(t_end_s)) - first);
+  return FillTelemetry(end - begin,
+                       timestamps_ns.data() + begin,
+                       collector.Accl().data() + 3 * begin,
+                       collector.Gyro().data() + 3 * begin,
+                       telemetry);
+}
+
+bool StreamTelemetryJSON(const std::string& path_to_telemetry_file,
+                         TelemetryConsumer& consumer) {
+  FILE* file = std::fopen(path_to_telemetry_file.c_str(), "rb");
+  if (!file) {
+    return false;
   }
+  // stream the file through a sax parser instead of building the dom
+  TelemetrySaxHandler handler(consumer);
+  const bool parsed = json::sax_parse(file, &handler);
+  std::fclose(file);
+  return parsed;
+}
 
+bool ReadTelemetryMP4(const std::string& path_to_mp4,
+                      CameraTelemetryData& telemetry) {
+  TelemetryCollector collector(0);
+  if (!StreamGoProMP4Telemetry(path_to_mp4, collector)) {
+    return false;
+  }
+  return FillTelemetry(collector.TimestampsNs().size(),
+                       collector.TimestampsNs().data(),
+                       collector.Accl().data(),
+                       collector.Gyro().data(),
+                       telemetry);
+}
+
+bool ReadTelemetryBinary(const std::string& path_to_telemetry_file,
+                         CameraTelemetryData& telemetry) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(
+          path_to_telemetry_file, kSessionTelemetry, offset, bytes)) {
+    return false;
+  }
+  if (HasMagic(path_to_telemetry_file, kTelemetryChunkedMagic, offset)) {
+    return ReadTelemetryChunked(path_to_telemetry_file,
+                                offset,
+                                bytes,
+                                std::numeric_limits<int64_t>::min(),
+                                std::numeric_limits<int64_t>::max(),
+                                telemetry);
+  }
+  MappedTelemetryBinary mapped;
+  if (!mapped.Open(path_to_telemetry_file, offset, bytes)) {
+    return false;
+  }
+  const size_t nr_datapoints = mapped.NumDatapoints();
+  std::vector<int64_t> timestamps_ns(nr_datapoints);
+  std::vector<double> accl(3 * nr_datapoints), gyro(3 * nr_datapoints);
+  std::memcpy(timestamps_ns.data(),
+              mapped.Timestamps(),
+              nr_datapoints * sizeof(int64_t));
+  std::memcpy(
+      accl.data(), mapped.Accelerometer(), accl.size() * sizeof(double));
+  std::memcpy(gyro.data(), mapped.Gyroscope(), gyro.size() * sizeof(double));
+  return FillTelemetry(nr_datapoints,
+                       timestamps_ns.data(),
+                       accl.data(),
+                       gyro.data(),
+                       telemetry);
+}
+
+bool ReadTelemetryBinaryRange(const std::string& path_to_telemetry_file,
+                              const double t_begin_s,
+                              const double t_end_s,
+                              CameraTelemetryData& telemetry) {
+  const int64_t first_ns = SaturatedNs(t_begin_s);
+  const int64_t last_ns = SaturatedNs(t_end_s);
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(
+          path_to_telemetry_file, kSessionTelemetry, offset, bytes)) {
+    return false;
+  }
+  if (HasMagic(path_to_telemetry_file, kTelemetryChunkedMagic, offset)) {
+    return ReadTelemetryChunked(
+        path_to_telemetry_file, offset, bytes, first_ns, last_ns, telemetry);
+  }
+  MappedTelemetryBinary mapped;
+  if (!mapped.Open(path_to_telemetry_file, offset, bytes)) {
+    return false;
+  }
+  // binary search on the sorted timestamps, only the pages of the range are
+  // read from the accelerometer and gyroscope arrays
+  const size_t nr_datapoints = mapped.NumDatapoints();
+  auto timestamp_at = [&mapped](const size_t i) {
+    int64_t timestamp_ns;
+    std::memcpy(&timestamp_ns,
+                mapped.Timestamps() + i * sizeof(int64_t),
+                sizeof(int64_t));
+    return timestamp_ns;
+  };
+  auto first_after = [&](const int64_t t_ns, const bool inclusive) {
+    size_t lo = 0, hi = nr_datapoints;
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      const int64_t t_mid = timestamp_at(mid);
+      if (t_mid < t_ns || (!inclusive && t_mid == t_ns)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  };
+  const size_t begin = first_after(first_ns, true);
+  const size_t end = std::max(begin, first_after(last_ns, false));
+  const size_t nr_range = end - begin;
+  std::vector<int64_t> timestamps_ns(nr_range);
+  std::vector<double> accl(3 * nr_range), gyro(3 * nr_range);
+  std::memcpy(timestamps_ns.data(),
+              mapped.Timestamps() + begin * sizeof(int64_t),
+              nr_range * sizeof(int64_t));
+  std::memcpy(accl.data(),
+              mapped.Accelerometer() + 3 * begin * sizeof(double),
+              accl.size() * sizeof(double));
+  std::memcpy(gyro.data(),
+              mapped.Gyroscope() + 3 * begin * sizeof(double),
+              gyro.size() * sizeof(double));
+  return FillTelemetry(
+      nr_range, timestamps_ns.data(), accl.data(), gyro.data(), telemetry);
+}
+
+bool StreamTelemetryBinary(const std::string& path_to_telemetry_file,
+                           TelemetryConsumer& consumer) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(
+          path_to_telemetry_file, kSessionTelemetry, offset, bytes)) {
+    return false;
+  }
+  if (HasMagic(path_to_telemetry_file, kTelemetryChunkedMagic, offset)) {
+    ChunkedFileReader reader;
+    if (!reader.Open(
+            path_to_telemetry_file, kTelemetryChunkedMagic, offset, bytes)) {
+      return false;
+    }
+    // one chunk at a time, in the order of the arrays inside the chunk
+    std::vector<char> raw;
+    std::vector<int64_t> timestamps_ns;
+    std::vector<double> accl, gyro;
+    for (size_t c = 0; c < reader.NumChunks(); ++c) {
+      timestamps_ns.clear();
+      accl.clear();
+      gyro.clear();
+      if (!reader.ReadChunk(c, raw) ||
+          !UnpackTelemetryChunk(raw,
+                                reader.Chunk(c).num_records,
+                                std::numeric_limits<int64_t>::min(),
+                                std::numeric_limits<int64_t>::max(),
+                                timestamps_ns,
+                                accl,
+                                gyro)) {
+        std::cerr << "Corrupt telemetry chunk in " << path_to_telemetry_file
+                  << "\n";
+        return false;
+      }
+      for (const int64_t timestamp_ns : timestamps_ns) {
+        consumer.AddTimestamp(timestamp_ns);
+      }
+      for (size_t i = 0; i < timestamps_ns.size(); ++i) {
+        consumer.AddAccelerometer(Eigen::Vector3d(accl.data() + 3 * i));
+      }
+      for (size_t i = 0; i < timestamps_ns.size(); ++i) {
+        consumer.AddGyroscope(Eigen::Vector3d(gyro.data() + 3 * i));
+      }
+    }
+    return true;
+  }
+  MappedTelemetryBinary mapped;
+  if (!mapped.Open(path_to_telemetry_file, offset, bytes)) {
+    return false;
+  }
+  // same order as in the file, so the mapping is read sequentially
+  const size_t nr_datapoints = mapped.NumDatapoints();
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    int64_t timestamp_ns;
+    std::memcpy(&timestamp_ns,
+                mapped.Timestamps() + i * sizeof(int64_t),
+                sizeof(int64_t));
+    consumer.AddTimestamp(timestamp_ns);
+  }
+  Eigen::Vector3d vec;
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    std::memcpy(vec.data(),
+                mapped.Accelerometer() + 3 * i * sizeof(double),
+                3 * sizeof(double));
+    consumer.AddAccelerometer(vec);
+  }
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    std::memcpy(vec.data(),
+                mapped.Gyroscope() + 3 * i * sizeof(double),
+                3 * sizeof(double));
+    consumer.AddGyroscope(vec);
+  }
+  return true;
+}
+
+bool WriteTelemetryBinary(const std::string& path_to_telemetry_file,
+                          const CameraTelemetryData& telemetry) {
+  std::vector<int64_t> timestamps_ns;
+  std::vector<double> accl, gyro;
+  if (!TelemetryToArrays(telemetry, timestamps_ns, accl, gyro)) {
+    return false;
+  }
+
+  std::ofstream file(path_to_telemetry_file, std::ios::out | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  const uint64_t n = timestamps_ns.size();
+  file.write(kTelemetryMagic, sizeof(kTelemetryMagic));
+  file.write(reinterpret_cast<const char*>(&kTelemetryVersion),
+             sizeof(kTelemetryVersion));
+  file.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  file.write(reinterpret_cast<const char*>(timestamps_ns.data()),
+             timestamps_ns.size() * sizeof(int64_t));
+  file.write(reinterpret_cast<const char*>(accl.data()),
+             accl.size() * sizeof(double));
+  file.write(reinterpret_cast<const char*>(gyro.data()),
+             gyro.size() * sizeof(double));
   file.close();
+  return !file.fail();
+}
+
+bool WriteTelemetryBinary(const std::string& path_to_telemetry_file,
+                          const CameraTelemetryData& telemetry,
+                          const ChunkCodec codec,
+                          const size_t samples_per_chunk) {
+  if (codec == ChunkCodec::kNone) {
+    return WriteTelemetryBinary(path_to_telemetry_file, telemetry);
+  }
+  std::vector<int64_t> timestamps_ns;
+  std::vector<double> accl, gyro;
+  if (!TelemetryToArrays(telemetry, timestamps_ns, accl, gyro)) {
+    return false;
+  }
+  ChunkedFileWriter writer;
+  if (!writer.Open(path_to_telemetry_file,
+                   kTelemetryChunkedMagic,
+                   codec,
+                   std::vector<char>())) {
+    return false;
+  }
+  const size_t chunk_size = std::max<size_t>(samples_per_chunk, 1);
+  std::vector<char> raw;
+  for (size_t i = 0; i < timestamps_ns.size(); i += chunk_size) {
+    const size_t n = std::min(chunk_size, timestamps_ns.size() - i);
+    PackTelemetryChunk(
+        n, &timestamps_ns[i], &accl[3 * i], &gyro[3 * i], raw);
+    if (!writer.AddChunk(
+            raw, n, timestamps_ns[i], timestamps_ns[i + n - 1])) {
+      return false;
+    }
+  }
+  return writer.Close();
+}
+
+bool MergeTelemetry(const std::vector<CameraTelemetryData>& streams,
+                    const std::vector<double>& offsets_s,
+                    CameraTelemetryData& merged) {
+  if (streams.size() != offsets_s.size()) {
+    std::cerr << "Telemetry merge needs one time offset per stream.\n";
+    return false;
+  }
+  std::vector<const CameraAccData*> accl_streams, gyro_streams;
+  for (const CameraTelemetryData& stream : streams) {
+    accl_streams.push_back(&stream.accelerometer);
+    gyro_streams.push_back(&stream.gyroscope);
+  }
+  MergeReadings(accl_streams, offsets_s, merged.accelerometer);
+  MergeReadings(gyro_streams, offsets_s, merged.gyroscope);
+  return true;
+}
+
+TelemetryBinaryWriter::~TelemetryBinaryWriter() {
+  if (output_.is_open()) {
+    output_.close();
+    RemoveParts();
+  }
+}
+
+bool TelemetryBinaryWriter::Open(const std::string& path_to_telemetry_file) {
+  output_path_ = path_to_telemetry_file;
+  if (!ChunkCodecAvailable(codec_)) {
+    std::cerr << "Telemetry compression is not available in this build.\n";
+    return false;
+  }
+  const bool compressed = codec_ != ChunkCodec::kNone;
+  output_.open(compressed ? output_path_ + ".ts.part" : output_path_,
+               std::ios::out | std::ios::binary);
+  accl_part_.open(output_path_ + ".accl.part",
+                  std::ios::out | std::ios::binary);
+  gyro_part_.open(output_path_ + ".gyro.part",
+                  std::ios::out | std::ios::binary);
+  if (!output_.is_open() || !accl_part_.is_open() || !gyro_part_.is_open()) {
+    std::cerr << "Could not open " << output_path_ << " for writing.\n";
+    return false;
+  }
+  nr_timestamps_ = nr_accl_ = nr_gyro_ = 0;
+  if (compressed) {
+    return true;
+  }
+  // the number of samples is written on Close
+  const uint64_t n = 0;
+  output_.write(kTelemetryMagic, sizeof(kTelemetryMagic));
+  output_.write(reinterpret_cast<const char*>(&kTelemetryVersion),
+                sizeof(kTelemetryVersion));
+  output_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  return true;
+}
+
+void TelemetryBinaryWriter::AddTimestamp(const int64_t timestamp_ns) {
+  output_.write(reinterpret_cast<const char*>(&timestamp_ns),
+                sizeof(timestamp_ns));
+  ++nr_timestamps_;
+}
+
+void TelemetryBinaryWriter::AddAccelerometer(const Eigen::Vector3d& accl) {
+  accl_part_.write(reinterpret_cast<const char*>(accl.data()),
+                   3 * sizeof(double));
+  ++nr_accl_;
+}
+
+void TelemetryBinaryWriter::AddGyroscope(const Eigen::Vector3d& gyro) {
+  gyro_part_.write(reinterpret_cast<const char*>(gyro.data()),
+                   3 * sizeof(double));
+  ++nr_gyro_;
+}
+
+bool TelemetryBinaryWriter::Close() {
+  accl_part_.close();
+  gyro_part_.close();
+  if (nr_accl_ != nr_timestamps_ || nr_gyro_ != nr_timestamps_) {
+    std::cerr << "Telemetry should have the same amount of timestamps, "
+                 "accelerometer and gyroscope values.\n";
+    output_.close();
+    RemoveParts();
+    return false;
+  }
+  if (codec_ != ChunkCodec::kNone) {
+    output_.close();
+    const bool written = WriteChunks();
+    RemoveParts();
+    return written;
+  }
+  std::vector<char> buffer(1 << 20);
+  for (const std::string& part :
+       {output_path_ + ".accl.part", output_path_ + ".gyro.part"}) {
+    std::ifstream input(part, std::ios::binary);
+    while (input) {
+      input.read(buffer.data(), buffer.size());
+      output_.write(buffer.data(), input.gcount());
+    }
+  }
+  output_.seekp(sizeof(kTelemetryMagic) + sizeof(kTelemetryVersion));
+  output_.write(reinterpret_cast<const char*>(&nr_timestamps_),
+                sizeof(nr_timestamps_));
+  output_.close();
+  RemoveParts();
+  return !output_.fail();
+}
+
+bool TelemetryBinaryWriter::WriteChunks() {
+  std::ifstream ts_part(output_path_ + ".ts.part", std::ios::binary);
+  std::ifstream accl_part(output_path_ + ".accl.part", std::ios::binary);
+  std::ifstream gyro_part(output_path_ + ".gyro.part", std::ios::binary);
+  ChunkedFileWriter writer;
+  if (!ts_part || !accl_part || !gyro_part ||
+      !writer.Open(output_path_,
+                   kTelemetryChunkedMagic,
+                   codec_,
+                   std::vector<char>())) {
+    return false;
+  }
+  const size_t chunk_size = std::max<size_t>(samples_per_chunk_, 1);
+  std::vector<int64_t> timestamps_ns(chunk_size);
+  std::vector<double> accl(3 * chunk_size), gyro(3 * chunk_size);
+  std::vector<char> raw;
+  for (uint64_t i = 0; i < nr_timestamps_; i += chunk_size) {
+    const size_t n = std::min<uint64_t>(chunk_size, nr_timestamps_ - i);
+    ts_part.read(reinterpret_cast<char*>(timestamps_ns.data()),
+                 n * sizeof(int64_t));
+    accl_part.read(reinterpret_cast<char*>(accl.data()),
+                   3 * n * sizeof(double));
+    gyro_part.read(reinterpret_cast<char*>(gyro.data()),
+                   3 * n * sizeof(double));
+    if (!ts_part || !accl_part || !gyro_part) {
+      return false;
+    }
+    PackTelemetryChunk(
+        n, timestamps_ns.data(), accl.data(), gyro.data(), raw);
+    if (!writer.AddChunk(raw, n, timestamps_ns[0], timestamps_ns[n - 1])) {
+      return false;
+    }
+  }
+  return writer.Close();
+}
+
+void TelemetryBinaryWriter::RemoveParts() {
+  std::remove((output_path_ + ".ts.part").c_str());
+  std::remove((output_path_ + ".accl.part").c_str());
+  std::remove((output_path_ + ".gyro.part").c_str());
+}
+
+bool ReadRecorderTelemetry(const std::string& path_to_recording,
+                           CameraTelemetryData& telemetry) {
+  MappedRegion region;
+  if (!region.Open(path_to_recording)) {
+    return false;
+  }
+  const char* data = region.Data();
+  const size_t file_size = region.Size();
+  if (file_size < kRecorderHeaderSize) {
+    std::cerr << "Truncated recording " << path_to_recording << "\n";
+    return false;
+  }
+
+  uint32_t version = 0, capacity = 0;
+  std::memcpy(&version, data + sizeof(kRecorderMagic), sizeof(version));
+  std::memcpy(&capacity,
+              data + sizeof(kRecorderMagic) + sizeof(version),
+              sizeof(capacity));
+  const size_t chunk_bytes =
+      2 * sizeof(uint32_t) + 4 * sizeof(double) * capacity;
+  if (std::memcmp(data, kRecorderMagic, sizeof(kRecorderMagic)) != 0 ||
+      version != kRecorderVersion || capacity == 0 ||
+      (file_size - kRecorderHeaderSize) % chunk_bytes != 0) {
+    std::cerr << "Invalid recording " << path_to_recording << "\n";
+    return false;
+  }
+  const size_t num_chunks = (file_size - kRecorderHeaderSize) / chunk_bytes;
+
+  // count the samples of both sensors first, so every array is allocated once
+  size_t nr_samples[2] = {0, 0};
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const char* chunk = data + kRecorderHeaderSize + c * chunk_bytes;
+    uint32_t sensor = 0, nr_chunk_samples = 0;
+    std::memcpy(&sensor, chunk, sizeof(sensor));
+    std::memcpy(&nr_chunk_samples, chunk + sizeof(sensor), sizeof(uint32_t));
+    if (sensor > 1 || nr_chunk_samples > capacity) {
+      std::cerr << "Corrupt chunk " << c << " in " << path_to_recording
+                << "\n";
+        return false;
+    }
+    nr_samples[sensor] += nr_chunk_samples;
+  }
+  telemetry.accelerometer.clear();
+  telemetry.gyroscope.clear();
+  telemetry.accelerometer.reserve(nr_samples[0]);
+  telemetry.gyroscope.reserve(nr_samples[1]);
+
+  // the chunks of each sensor are in time order, so they are concatenated
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const char* chunk = data + kRecorderHeaderSize + c * chunk_bytes;
+    uint32_t sensor = 0, nr_chunk_samples = 0;
+    std::memcpy(&sensor, chunk, sizeof(sensor));
+    std::memcpy(&nr_chunk_samples, chunk + sizeof(sensor), sizeof(uint32_t));
+    ImuReadings& readings =
+        sensor == 0 ? telemetry.accelerometer : telemetry.gyroscope;
+    const char* arrays = chunk + 2 * sizeof(uint32_t);
+    for (uint32_t i = 0; i < nr_chunk_samples; ++i) {
+      double values[4];
+      for (int a = 0; a < 4; ++a) {
+        std::memcpy(&values[a],
+                    arrays + (a * capacity + i) * sizeof(double),
+                    sizeof(double));
+      }
+      readings.emplace_back(values[0] * MS_TO_S, values + 1);
+    }
+  }
   return true;
 }
 
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   CameraTelemetryData& telemetry) {
+  if (IsRemoteUrl(path_to_telemetry_file)) {
+    // telemetry is small, fetch it in parallel and read the local copy
+    const std::string local_path = RemoteTempPath(path_to_telemetry_file);
+    if (!FetchRemoteFile(path_to_telemetry_file, local_path)) {
+      return false;
+    }
+    const bool read = ReadTelemetry(local_path, telemetry);
+    std::remove(local_path.c_str());
+    return read;
+  }
+  if (IsTelemetryBinary(path_to_telemetry_file) ||
+      IsSessionFile(path_to_telemetry_file)) {
+    return ReadTelemetryBinary(path_to_telemetry_file, telemetry);
+  }
+  if (HasMagic(path_to_telemetry_file, kRecorderMagic)) {
+    return ReadRecorderTelemetry(path_to_telemetry_file, telemetry);
+  }
+  if (IsMP4File(path_to_telemetry_file)) {
+    return ReadTelemetryMP4(path_to_telemetry_file, telemetry);
+  }
+  return ReadTelemetryJSON(path_to_telemetry_file, telemetry);
+}
+
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   const double t_begin_s,
+                   const double t_end_s,
+                   CameraTelemetryData& telemetry) {
+  if (IsRemoteUrl(path_to_telemetry_file)) {
+    const std::string local_path = RemoteTempPath(path_to_telemetry_file);
+    if (!FetchRemoteFile(path_to_telemetry_file, local_path)) {
+      return false;
+    }
+    const bool read = ReadTelemetry(local_path, t_begin_s, t_end_s, telemetry);
+    std::remove(local_path.c_str());
+    return read;
+  }
+  if (IsTelemetryBinary(path_to_telemetry_file) ||
+      IsSessionFile(path_to_telemetry_file)) {
+    return ReadTelemetryBinaryRange(
+        path_to_telemetry_file, t_begin_s, t_end_s, telemetry);
+  }
+  if (!HasMagic(path_to_telemetry_file, kRecorderMagic) &&
+      !IsMP4File(path_to_telemetry_file)) {
+    return ReadTelemetryJSON(
+        path_to_telemetry_file, t_begin_s, t_end_s, telemetry);
+  }
+  if (!ReadTelemetry(path_to_telemetry_file, telemetry)) {
+    return false;
+  }
+  // recordings have independent accelerometer and gyroscope timestamps
+  CropReadings(t_begin_s, t_end_s, telemetry.accelerometer);
+  CropReadings(t_begin_s, t_end_s, telemetry.gyroscope);
+  return true;
+}
+
+bool StreamTelemetry(const std::string& path_to_telemetry_file,
+                     TelemetryConsumer& consumer) {
+  if (IsTelemetryBinary(path_to_telemetry_file) ||
+      IsSessionFile(path_to_telemetry_file)) {
+    return StreamTelemetryBinary(path_to_telemetry_file, consumer);
+  }
+  if (HasMagic(path_to_telemetry_file, kRecorderMagic)) {
+    std::cerr << "Recordings have independent accelerometer and gyroscope "
+                 "timestamps and can only be read with ReadTelemetry.\n";
+    return false;
+  }
+  if (IsMP4File(path_to_telemetry_file)) {
+    return StreamGoProMP4Telemetry(path_to_telemetry_file, consumer);
+  }
+  return StreamTelemetryJSON(path_to_telemetry_file, consumer);
+}
+
 }  // namespace io
 }  // namespace OpenICC
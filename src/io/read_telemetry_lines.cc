@@ -0,0 +1,285 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/read_telemetry_lines.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+using json = nlohmann::json;
+
+namespace {
+
+// Read only memory mapping of a text file that is read front to back
+class MappedTextFile {
+ public:
+  MappedTextFile() {}
+  ~MappedTextFile() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedTextFile(const MappedTextFile&) = delete;
+  MappedTextFile& operator=(const MappedTextFile&) = delete;
+
+  bool Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Could not open " << path << "\n";
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      close(fd);
+      return false;
+    }
+    size_ = file_stat.st_size;
+    if (size_ == 0) {
+      close(fd);
+      return true;
+    }
+    void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      size_ = 0;
+      return false;
+    }
+    // pages are only touched once, let the kernel read ahead
+    madvise(mapped, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(mapped);
+    return true;
+  }
+
+  //! Calls func(begin, end) for every line without the line break. Stops
+  //! and returns false if func returns false.
+  template <class Func>
+  bool ForEachLine(Func&& func) const {
+    const char* pos = data_;
+    const char* end = data_ + size_;
+    while (pos < end) {
+      const char* line_end =
+          static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+      if (!line_end) {
+        // the last line has no line break, so the parsers could read past
+        // the mapping. It is the only line that is copied.
+        const std::string last_line(pos, end);
+        return func(last_line.data(), last_line.data() + last_line.size());
+      }
+      const char* content_end = line_end;
+      if (content_end > pos && content_end[-1] == '\r') --content_end;
+      if (!func(pos, content_end)) return false;
+      pos = line_end + 1;
+    }
+    return true;
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Exact powers of ten of the fast path below
+const double kPowersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                              1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                              1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parses one number at pos. Numbers with up to 15 significant digits and a
+// decimal exponent of at most 22, which covers the usual sensor logs, are
+// converted with one correctly rounded division or multiplication of two
+// exact doubles. Everything else falls back to strtod.
+bool ParseDouble(const char*& pos, const char* end, double& value) {
+  const char* p = pos;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int nr_digits = 0;
+  int exponent = 0;
+  bool any_digit = false;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    any_digit = true;
+    if (mantissa == 0 && *p == '0') continue;
+    mantissa = 10 * mantissa + (*p - '0');
+    ++nr_digits;
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+      any_digit = true;
+      --exponent;
+      if (mantissa == 0 && *p == '0') continue;
+      mantissa = 10 * mantissa + (*p - '0');
+      ++nr_digits;
+    }
+  }
+  const bool has_exponent = p < end && (*p == 'e' || *p == 'E');
+  if (any_digit && !has_exponent && nr_digits <= 15 && exponent >= -22) {
+    value = exponent < 0 ? double(mantissa) / kPowersOf10[-exponent]
+                         : double(mantissa);
+    if (negative) value = -value;
+    pos = p;
+    return true;
+  }
+  // strtod skips leading white space, including line breaks
+  char* number_end = nullptr;
+  value = std::strtod(pos, &number_end);
+  if (number_end == pos || number_end > end) return false;
+  pos = number_end;
+  return true;
+}
+
+// Parses nr_values comma or space separated numbers of the line [pos, end)
+bool ParseNumbers(const char* pos,
+                  const char* end,
+                  const int nr_values,
+                  double* values) {
+  for (int i = 0; i < nr_values; ++i) {
+    while (pos < end && (*pos == ',' || *pos == ' ' || *pos == '\t')) ++pos;
+    if (pos >= end || !ParseDouble(pos, end, values[i])) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool StreamTelemetryCSV(const std::string& path_to_csv,
+                        TelemetryConsumer& consumer) {
+  MappedTextFile file;
+  if (!file.Open(path_to_csv)) {
+    return false;
+  }
+  size_t line_nr = 0;
+  return file.ForEachLine([&](const char* begin, const char* end) {
+    ++line_nr;
+    if (begin == end) return true;
+    const char first = *begin;
+    if (!std::isdigit(static_cast<unsigned char>(first)) && first != '-' &&
+        first != '+' && first != '.') {
+      return true;
+    }
+    double values[7];
+    if (!ParseNumbers(begin, end, 7, values)) {
+      std::cerr << "Telemetry csv line " << line_nr << " of " << path_to_csv
+                << " needs 7 values.\n";
+      return false;
+    }
+    consumer.AddTimestamp(std::llround(values[0]));
+    consumer.AddAccelerometer(Eigen::Vector3d(values[4], values[5], values[6]));
+    consumer.AddGyroscope(Eigen::Vector3d(values[1], values[2], values[3]));
+    return true;
+  });
+}
+
+bool StreamZedTelemetryJSONL(const std::string& path_to_jsonl,
+                             TelemetryConsumer& consumer) {
+  MappedTextFile file;
+  if (!file.Open(path_to_jsonl)) {
+    return false;
+  }
+
+  // the first pass only finds the camera time range
+  double first_frame_s = 0.0;
+  double last_frame_s = 0.0;
+  bool has_frames = false;
+  bool parsed = file.ForEachLine([&](const char* begin, const char* end) {
+    if (begin == end) return true;
+    const json line = json::parse(begin, end, nullptr, false);
+    if (line.is_discarded()) {
+      std::cerr << "Invalid json line in " << path_to_jsonl << "\n";
+      return false;
+    }
+    if (line.contains("frames") && !line.contains("sensor")) {
+      const double time_s = line["time"].get<double>();
+      if (!has_frames) first_frame_s = time_s;
+      last_frame_s = time_s;
+      has_frames = true;
+    }
+    return true;
+  });
+  if (!parsed) {
+    return false;
+  }
+  if (!has_frames) {
+    std::cerr << "No camera frames found in " << path_to_jsonl << "\n";
+    return false;
+  }
+
+  // samples are paired by their index, the queues only hold the samples of
+  // the sensor that is currently ahead
+  std::deque<std::pair<double, Eigen::Vector3d>> gyro_queue;
+  std::deque<Eigen::Vector3d> accl_queue;
+  bool has_first_sample = false;
+  double first_sample_s = 0.0;
+  return file.ForEachLine([&](const char* begin, const char* end) {
+    if (begin == end) return true;
+    const json line = json::parse(begin, end, nullptr, false);
+    if (!line.contains("sensor")) return true;
+    const json& sensor = line["sensor"];
+    const std::string type = sensor.value("type", "");
+    if (type != "gyroscope" && type != "accelerometer") return true;
+    const json& values = sensor["values"];
+    if (!values.is_array() || values.size() < 3) {
+      std::cerr << "ZED sensor samples need 3 values.\n";
+      return false;
+    }
+    const Eigen::Vector3d xyz(values[0].get<double>(),
+                              values[1].get<double>(),
+                              values[2].get<double>());
+    if (type == "gyroscope") {
+      gyro_queue.emplace_back(line["time"].get<double>(), xyz);
+    } else {
+      accl_queue.push_back(xyz);
+    }
+
+    while (!gyro_queue.empty() && !accl_queue.empty()) {
+      const double time_s = gyro_queue.front().first;
+      if (time_s >= first_frame_s && time_s <= last_frame_s) {
+        if (!has_first_sample) {
+          first_sample_s = time_s;
+          has_first_sample = true;
+        }
+        consumer.AddTimestamp(
+            std::llround((time_s - first_sample_s) * S_TO_NS));
+        consumer.AddAccelerometer(accl_queue.front());
+        consumer.AddGyroscope(gyro_queue.front().second);
+      }
+      gyro_queue.pop_front();
+      accl_queue.pop_front();
+    }
+    return true;
+  });
+}
+
+}  // namespace io
+}  // namespace OpenICC
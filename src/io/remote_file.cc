@@ -0,0 +1,324 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/remote_file.h"
+
+#ifdef OPENICC_WITH_CURL
+#include <curl/curl.h>
+#endif
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+
+// failed requests are repeated before the download fails
+const int kMaxAttempts = 3;
+
+#ifdef OPENICC_WITH_CURL
+struct RangeResponse {
+  std::vector<char>* body = nullptr;
+  //! total size of the object from the Content-Range header
+  int64_t total_bytes = -1;
+};
+
+size_t AppendBody(char* data, size_t size, size_t nmemb, void* user) {
+  RangeResponse* response = static_cast<RangeResponse*>(user);
+  response->body->insert(response->body->end(), data, data + size * nmemb);
+  return size * nmemb;
+}
+
+// Content-Range: bytes <first>-<last>/<total>
+size_t ParseContentRange(char* data, size_t size, size_t nmemb, void* user) {
+  RangeResponse* response = static_cast<RangeResponse*>(user);
+  const std::string header(data, size * nmemb);
+  const std::string prefix = "content-range:";
+  if (header.size() > prefix.size()) {
+    std::string name = header.substr(0, prefix.size());
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    const size_t slash = header.find('/');
+    if (name == prefix && slash != std::string::npos) {
+      response->total_bytes = std::atoll(header.c_str() + slash + 1);
+    }
+  }
+  return size * nmemb;
+}
+
+// GET of the bytes [first, last], the handle is reused by a worker to keep
+// its connection alive. A GET of a single byte also gives the object size,
+// unlike HEAD this works with URLs that are only signed for GET.
+bool FetchRange(CURL* curl,
+                const std::string& url,
+                const uint64_t first,
+                const uint64_t last,
+                std::vector<char>& body,
+                int64_t* total_bytes = nullptr) {
+  const std::string range = std::to_string(first) + "-" + std::to_string(last);
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    body.clear();
+    body.reserve(last - first + 1);
+    RangeResponse response;
+    response.body = &body;
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendBody);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, ParseContentRange);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
+    const CURLcode code = curl_easy_perform(curl);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    // 206 for a partial response, servers without range support answer 200
+    // with the complete object
+    if (code == CURLE_OK && status == 206 &&
+        body.size() == last - first + 1) {
+      if (total_bytes) {
+        *total_bytes = response.total_bytes;
+      }
+      return true;
+    }
+    std::cerr << "Request of bytes " << range << " of " << url
+              << " failed: "
+              << (code == CURLE_OK ? "HTTP " + std::to_string(status)
+                                   : std::string(curl_easy_strerror(code)))
+              << "\n";
+  }
+  return false;
+}
+
+void InitCurl() {
+  static std::once_flag once;
+  std::call_once(once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+#endif
+
+}  // namespace
+
+bool IsRemoteUrl(const std::string& path) {
+  return path.rfind("http://", 0) == 0 || path.rfind("https://", 0) == 0;
+}
+
+bool RemoteFetchAvailable() {
+#ifdef OPENICC_WITH_CURL
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool RemoteFile::Open(const std::string& url,
+                      const RemoteFetchOptions& options) {
+  Close();
+#ifdef OPENICC_WITH_CURL
+  InitCurl();
+  url_ = url;
+  options_ = options;
+  options_.chunk_bytes = std::max<size_t>(options_.chunk_bytes, 1);
+  options_.num_connections = std::max(options_.num_connections, 1);
+  options_.read_ahead_chunks =
+      std::max(options_.read_ahead_chunks, options_.num_connections);
+
+  CURL* curl = curl_easy_init();
+  std::vector<char> first_byte;
+  int64_t total_bytes = -1;
+  const bool fetched = curl && FetchRange(curl, url_, 0, 0, first_byte,
+                                          &total_bytes);
+  if (curl) {
+    curl_easy_cleanup(curl);
+  }
+  if (!fetched || total_bytes < 0) {
+    std::cerr << "Could not get the size of " << url_
+              << ", the server has to support range requests.\n";
+    return false;
+  }
+  size_ = total_bytes;
+  chunks_.assign((size_ + options_.chunk_bytes - 1) / options_.chunk_bytes,
+                 Chunk());
+  read_chunk_ = 0;
+  failed_ = false;
+  closed_ = false;
+  for (int i = 0; i < options_.num_connections; ++i) {
+    workers_.emplace_back(&RemoteFile::WorkerLoop, this);
+  }
+  return true;
+#else
+  (void)options;
+  std::cerr << "Reading " << url << " needs a build with libcurl.\n";
+  return false;
+#endif
+}
+
+void RemoteFile::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  window_moved_.notify_all();
+  chunk_done_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  chunks_.clear();
+  size_ = 0;
+}
+
+int64_t RemoteFile::Read(const uint64_t offset,
+                         char* buffer,
+                         const size_t size) {
+  if (offset >= size_) {
+    return 0;
+  }
+  const size_t num_bytes = std::min<uint64_t>(size, size_ - offset);
+  size_t num_read = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (num_read < num_bytes) {
+    const uint64_t position = offset + num_read;
+    const size_t chunk_idx = position / options_.chunk_bytes;
+    if (chunk_idx != read_chunk_) {
+      read_chunk_ = chunk_idx;
+      EvictChunks();
+      window_moved_.notify_all();
+    }
+    chunk_done_.wait(lock, [&] {
+      return failed_ || closed_ ||
+             chunks_[chunk_idx].state == ChunkState::kDone;
+    });
+    if (failed_ || closed_) {
+      return -1;
+    }
+    const std::vector<char>& data = chunks_[chunk_idx].data;
+    const size_t chunk_offset = position - chunk_idx * options_.chunk_bytes;
+    const size_t n = std::min(num_bytes - num_read, data.size() - chunk_offset);
+    std::memcpy(buffer + num_read, data.data() + chunk_offset, n);
+    num_read += n;
+  }
+  return num_read;
+}
+
+bool RemoteFile::NextChunk(size_t& chunk_idx) {
+  const size_t end = std::min(chunks_.size(),
+                              read_chunk_ + options_.read_ahead_chunks);
+  for (size_t c = read_chunk_; c < end; ++c) {
+    if (chunks_[c].state == ChunkState::kMissing) {
+      chunks_[c].state = ChunkState::kFetching;
+      chunk_idx = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+void RemoteFile::EvictChunks() {
+  // keep the previous chunk, a reader often reads a little backwards
+  const size_t begin = read_chunk_ > 0 ? read_chunk_ - 1 : 0;
+  const size_t end = read_chunk_ + options_.read_ahead_chunks;
+  for (size_t c = 0; c < chunks_.size(); ++c) {
+    if ((c < begin || c >= end) && chunks_[c].state == ChunkState::kDone) {
+      chunks_[c].state = ChunkState::kMissing;
+      std::vector<char>().swap(chunks_[c].data);
+    }
+  }
+}
+
+void RemoteFile::WorkerLoop() {
+#ifdef OPENICC_WITH_CURL
+  CURL* curl = curl_easy_init();
+  std::vector<char> body;
+  while (true) {
+    size_t chunk_idx = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      window_moved_.wait(lock, [&] {
+        return closed_ || failed_ || NextChunk(chunk_idx);
+      });
+      if (closed_ || failed_) {
+        break;
+      }
+    }
+    const uint64_t first = chunk_idx * options_.chunk_bytes;
+    const uint64_t last =
+        std::min<uint64_t>(first + options_.chunk_bytes, size_) - 1;
+    const bool fetched = curl && FetchRange(curl, url_, first, last, body);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (fetched) {
+        chunks_[chunk_idx].data.swap(body);
+        chunks_[chunk_idx].state = ChunkState::kDone;
+      } else {
+        failed_ = true;
+      }
+    }
+    chunk_done_.notify_all();
+    window_moved_.notify_all();
+  }
+  if (curl) {
+    curl_easy_cleanup(curl);
+  }
+#endif
+}
+
+bool FetchRemoteFile(const std::string& url,
+                     const std::string& local_path,
+                     const RemoteFetchOptions& options) {
+  RemoteFile remote;
+  if (!remote.Open(url, options)) {
+    return false;
+  }
+  std::ofstream output(local_path, std::ios::out | std::ios::binary);
+  if (!output.is_open()) {
+    std::cerr << "Could not open " << local_path << " for writing.\n";
+    return false;
+  }
+  // sequential reads, the read ahead keeps all connections busy
+  std::vector<char> buffer(options.chunk_bytes);
+  uint64_t offset = 0;
+  while (offset < remote.Size()) {
+    const int64_t n = remote.Read(offset, buffer.data(), buffer.size());
+    if (n <= 0) {
+      output.close();
+      std::remove(local_path.c_str());
+      return false;
+    }
+    output.write(buffer.data(), n);
+    offset += n;
+  }
+  output.close();
+  return !output.fail();
+}
+
+std::string RemoteTempPath(const std::string& url) {
+  std::string name = url.substr(url.find_last_of('/') + 1);
+  name = name.substr(0, name.find('?'));
+  const std::string prefix = "openicc_" + std::to_string(getpid()) + "_" +
+                             std::to_string(std::hash<std::string>()(url)) +
+                             "_";
+  return (std::filesystem::temp_directory_path() / (prefix + name)).string();
+}
+
+}  // namespace io
+}  // namespace OpenICC
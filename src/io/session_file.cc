@@ -0,0 +1,313 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "OpenCameraCalibrator/io/session_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "OpenCameraCalibrator/io/chunked_file.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+const char kSessionMagic[8] = {'O', 'I', 'C', 'C', 'S', 'E', 'S', '1'};
+const uint32_t kSessionVersion = 1;
+// the common page size, MappedRegion also maps sections at other offsets
+const uint32_t kSessionAlignment = 4096;
+const size_t kSessionHeaderSize = 8 + 2 * sizeof(uint32_t);
+const size_t kSessionFooterSize = 2 * sizeof(uint64_t);
+const size_t kCopyBlockSize = 1 << 20;
+static_assert(sizeof(SessionSection) == 48 + 4 * sizeof(uint64_t),
+              "SessionSection is written as is");
+}  // namespace
+
+SessionWriter::~SessionWriter() {
+  if (output_.is_open()) {
+    output_.close();
+  }
+}
+
+bool SessionWriter::Open(const std::string& path) {
+  path_ = path;
+  toc_.clear();
+  output_.open(path_, std::ios::out | std::ios::binary);
+  if (!output_.is_open()) {
+    std::cerr << "Could not open " << path_ << " for writing.\n";
+    return false;
+  }
+  output_.write(kSessionMagic, sizeof(kSessionMagic));
+  output_.write(reinterpret_cast<const char*>(&kSessionVersion),
+                sizeof(kSessionVersion));
+  output_.write(reinterpret_cast<const char*>(&kSessionAlignment),
+                sizeof(kSessionAlignment));
+  return static_cast<bool>(output_);
+}
+
+bool SessionWriter::BeginSection(const std::string& name) {
+  SessionSection section;
+  if (name.empty() || name.size() >= sizeof(section.name)) {
+    std::cerr << "Invalid session section name " << name << "\n";
+    return false;
+  }
+  for (const SessionSection& other : toc_) {
+    if (name == other.name) {
+      std::cerr << "Session section " << name << " was already added.\n";
+      return false;
+    }
+  }
+  // pad to the alignment
+  const uint64_t position = static_cast<uint64_t>(output_.tellp());
+  const uint64_t padding =
+      (kSessionAlignment - position % kSessionAlignment) % kSessionAlignment;
+  const std::vector<char> zeros(padding, 0);
+  output_.write(zeros.data(), zeros.size());
+  std::memcpy(section.name, name.c_str(), name.size());
+  section.offset = position + padding;
+  toc_.push_back(section);
+  return static_cast<bool>(output_);
+}
+
+bool SessionWriter::EndSection(const int64_t first_key,
+                               const int64_t last_key) {
+  SessionSection& section = toc_.back();
+  section.bytes = static_cast<uint64_t>(output_.tellp()) - section.offset;
+  section.first_key = first_key;
+  section.last_key = last_key;
+  return static_cast<bool>(output_);
+}
+
+bool SessionWriter::AddSection(const std::string& name,
+                               const char* data,
+                               const size_t bytes,
+                               const int64_t first_key,
+                               const int64_t last_key) {
+  if (!BeginSection(name)) {
+    return false;
+  }
+  output_.write(data, bytes);
+  return EndSection(first_key, last_key);
+}
+
+bool SessionWriter::AddFile(const std::string& name,
+                            const std::string& file_path,
+                            const int64_t first_key,
+                            const int64_t last_key) {
+  std::ifstream input(file_path, std::ios::in | std::ios::binary);
+  if (!input.is_open()) {
+    std::cerr << "Can not open " << file_path << "\n";
+    return false;
+  }
+  if (!BeginSection(name)) {
+    return false;
+  }
+  std::vector<char> block(kCopyBlockSize);
+  while (input) {
+    input.read(block.data(), block.size());
+    output_.write(block.data(), input.gcount());
+  }
+  if (!input.eof()) {
+    std::cerr << "Failed to read " << file_path << "\n";
+    return false;
+  }
+  return EndSection(first_key, last_key);
+}
+
+bool SessionWriter::Close() {
+  const uint64_t toc_offset = static_cast<uint64_t>(output_.tellp());
+  const uint64_t num_sections = toc_.size();
+  output_.write(reinterpret_cast<const char*>(toc_.data()),
+                toc_.size() * sizeof(SessionSection));
+  output_.write(reinterpret_cast<const char*>(&num_sections),
+                sizeof(num_sections));
+  output_.write(reinterpret_cast<const char*>(&toc_offset),
+                sizeof(toc_offset));
+  output_.close();
+  if (output_.fail()) {
+    std::cerr << "Failed to write " << path_ << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool SessionReader::Open(const std::string& path) {
+  path_ = path;
+  toc_.clear();
+  std::ifstream input(path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!input.is_open()) {
+    std::cerr << "Can not open " << path << "\n";
+    return false;
+  }
+  const uint64_t file_size = static_cast<uint64_t>(input.tellg());
+  if (file_size < kSessionHeaderSize + kSessionFooterSize) {
+    std::cerr << "Truncated session " << path << "\n";
+    return false;
+  }
+  char magic[sizeof(kSessionMagic)];
+  uint32_t version = 0;
+  uint64_t num_sections = 0, toc_offset = 0;
+  input.seekg(0);
+  input.read(magic, sizeof(magic));
+  input.read(reinterpret_cast<char*>(&version), sizeof(version));
+  input.seekg(file_size - kSessionFooterSize);
+  input.read(reinterpret_cast<char*>(&num_sections), sizeof(num_sections));
+  input.read(reinterpret_cast<char*>(&toc_offset), sizeof(toc_offset));
+  if (!input || std::memcmp(magic, kSessionMagic, sizeof(magic)) != 0 ||
+      version != kSessionVersion ||
+      toc_offset + num_sections * sizeof(SessionSection) +
+              kSessionFooterSize !=
+          file_size) {
+    std::cerr << "Invalid session " << path << "\n";
+    return false;
+  }
+  toc_.resize(num_sections);
+  input.seekg(toc_offset);
+  input.read(reinterpret_cast<char*>(toc_.data()),
+             num_sections * sizeof(SessionSection));
+  if (!input) {
+    std::cerr << "Truncated session " << path << "\n";
+    return false;
+  }
+  for (SessionSection& section : toc_) {
+    section.name[sizeof(section.name) - 1] = '\0';
+    if (section.offset < kSessionHeaderSize ||
+        section.offset + section.bytes > toc_offset) {
+      std::cerr << "Invalid table of contents in " << path << "\n";
+      toc_.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SessionReader::FindSection(const std::string& name,
+                                SessionSection& section) const {
+  const auto it = std::find_if(
+      toc_.begin(), toc_.end(), [&name](const SessionSection& entry) {
+        return name == entry.name;
+      });
+  if (it == toc_.end()) {
+    return false;
+  }
+  section = *it;
+  return true;
+}
+
+bool SessionReader::ReadJson(const std::string& name,
+                             nlohmann::json& section_json) const {
+  SessionSection section;
+  if (!FindSection(name, section)) {
+    std::cerr << path_ << " has no section " << name << "\n";
+    return false;
+  }
+  MappedRegion region;
+  if (section.bytes == 0 ||
+      !region.Open(path_, section.offset, section.bytes)) {
+    return false;
+  }
+  const char* begin = region.Data();
+  const char* end = begin + region.Size();
+  section_json = nlohmann::json::parse(begin, end, nullptr, false);
+  if (section_json.is_discarded()) {
+    section_json = nlohmann::json::from_ubjson(begin, end, true, false);
+  }
+  if (section_json.is_discarded()) {
+    std::cerr << "Section " << name << " of " << path_
+              << " is neither json nor ubjson.\n";
+    return false;
+  }
+  return true;
+}
+
+bool SessionReader::ExtractSection(const std::string& name,
+                                   const std::string& output_path) const {
+  SessionSection section;
+  if (!FindSection(name, section)) {
+    std::cerr << path_ << " has no section " << name << "\n";
+    return false;
+  }
+  std::ifstream input(path_, std::ios::in | std::ios::binary);
+  std::ofstream output(output_path, std::ios::out | std::ios::binary);
+  if (!input.is_open() || !output.is_open()) {
+    std::cerr << "Can not extract " << name << " to " << output_path << "\n";
+    return false;
+  }
+  input.seekg(section.offset);
+  std::vector<char> block(kCopyBlockSize);
+  uint64_t remaining = section.bytes;
+  while (remaining > 0 && input) {
+    const size_t num_bytes =
+        static_cast<size_t>(std::min<uint64_t>(remaining, block.size()));
+    input.read(block.data(), num_bytes);
+    output.write(block.data(), input.gcount());
+    remaining -= input.gcount();
+  }
+  output.close();
+  return remaining == 0 && !output.fail();
+}
+
+std::string CameraCornersSection(const int camera_idx) {
+  if (camera_idx == 0) {
+    return kSessionCorners;
+  }
+  return std::string(kSessionCorners) + "_cam" + std::to_string(camera_idx);
+}
+
+bool IsSessionFile(const std::string& path) {
+  return HasMagic(path, kSessionMagic);
+}
+
+bool ResolveSessionSection(const std::string& path,
+                           const std::string& section_name,
+                           uint64_t& offset,
+                           uint64_t& bytes) {
+  offset = 0;
+  bytes = 0;
+  if (!IsSessionFile(path)) {
+    return true;
+  }
+  SessionReader session;
+  SessionSection section;
+  if (!session.Open(path)) {
+    return false;
+  }
+  if (!session.FindSection(section_name, section) || section.bytes == 0) {
+    std::cerr << path << " has no section " << section_name << "\n";
+    return false;
+  }
+  offset = section.offset;
+  bytes = section.bytes;
+  return true;
+}
+
+bool ReadJsonFileOrSection(const std::string& path,
+                           const std::string& section_name,
+                           nlohmann::json& file_json) {
+  if (IsSessionFile(path)) {
+    SessionReader session;
+    return session.Open(path) && session.ReadJson(section_name, file_json);
+  }
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+  file >> file_json;
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
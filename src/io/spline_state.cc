@@ -0,0 +1,173 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/spline_state.h"
+#include "OpenCameraCalibrator/io/session_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+const char kSplineStateMagic[8] = {'O', 'I', 'C', 'C', 'S', 'P', 'L', '1'};
+const uint32_t kSplineStateVersion = 1;
+// more knots are not a plausible spline but a corrupted file
+const uint64_t kMaxNumKnots = uint64_t(1) << 32;
+
+template <typename T>
+void WriteValue(std::ofstream& file, const T& value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::ifstream& file, T& value) {
+  file.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return static_cast<bool>(file);
+}
+
+void WriteDoubles(std::ofstream& file, const double* data, const size_t n) {
+  file.write(reinterpret_cast<const char*>(data), n * sizeof(double));
+}
+
+bool ReadDoubles(std::ifstream& file, double* data, const size_t n) {
+  file.read(reinterpret_cast<char*>(data), n * sizeof(double));
+  return static_cast<bool>(file);
+}
+
+void WriteVec3s(std::ofstream& file, const vec3_vector& values) {
+  for (const Eigen::Vector3d& value : values) {
+    WriteDoubles(file, value.data(), 3);
+  }
+}
+
+bool ReadVec3s(std::ifstream& file, vec3_vector& values) {
+  for (Eigen::Vector3d& value : values) {
+    if (!ReadDoubles(file, value.data(), 3)) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool WriteSplineState(const std::string& path, const SplineState& state) {
+  std::ofstream file(path, std::ios::out | std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Could not open " << path << " for writing.\n";
+    return false;
+  }
+  file.write(kSplineStateMagic, sizeof(kSplineStateMagic));
+  WriteValue(file, kSplineStateVersion);
+  WriteValue(file, state.spline_order);
+  WriteValue(file, state.start_t_ns);
+  WriteValue(file, state.end_t_ns);
+  WriteValue(file, state.dt_so3_ns);
+  WriteValue(file, state.dt_r3_ns);
+  WriteValue(file, state.dt_accl_bias_ns);
+  WriteValue(file, state.dt_gyro_bias_ns);
+  WriteValue(file, static_cast<uint64_t>(state.so3_knots.size()));
+  WriteValue(file, static_cast<uint64_t>(state.r3_knots.size()));
+  WriteValue(file, static_cast<uint64_t>(state.accl_bias_knots.size()));
+  WriteValue(file, static_cast<uint64_t>(state.gyro_bias_knots.size()));
+
+  for (const Sophus::SO3d& knot : state.so3_knots) {
+    WriteDoubles(file, knot.data(), Sophus::SO3d::num_parameters);
+  }
+  WriteVec3s(file, state.r3_knots);
+  WriteVec3s(file, state.accl_bias_knots);
+  WriteVec3s(file, state.gyro_bias_knots);
+
+  WriteDoubles(file, state.T_i_c.data(), Sophus::SE3d::num_parameters);
+  WriteDoubles(file, state.gravity.data(), 3);
+  WriteDoubles(file, state.accl_intrinsics.data(), 6);
+  WriteDoubles(file, state.gyro_intrinsics.data(), 9);
+  WriteValue(file, state.cam_line_delay_s);
+  WriteValue(file, state.imu_to_camera_time_offset_s);
+  WriteValue(file, state.max_accl_bias_range);
+  WriteValue(file, state.max_gyro_bias_range);
+  file.close();
+  return !file.fail();
+}
+
+bool ReadSplineState(const std::string& path, SplineState& state) {
+  uint64_t offset, bytes;
+  if (!ResolveSessionSection(path, kSessionSplineState, offset, bytes)) {
+    return false;
+  }
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Could not open spline state " << path << "\n";
+    return false;
+  }
+  file.seekg(offset);
+  char magic[sizeof(kSplineStateMagic)];
+  uint32_t version = 0;
+  file.read(magic, sizeof(magic));
+  if (!file ||
+      std::memcmp(magic, kSplineStateMagic, sizeof(kSplineStateMagic)) != 0 ||
+      !ReadValue(file, version) || version != kSplineStateVersion) {
+    std::cerr << path << " is not a spline state file of version "
+              << kSplineStateVersion << "\n";
+    return false;
+  }
+
+  uint64_t n_so3 = 0, n_r3 = 0, n_accl_bias = 0, n_gyro_bias = 0;
+  if (!ReadValue(file, state.spline_order) ||
+      !ReadValue(file, state.start_t_ns) || !ReadValue(file, state.end_t_ns) ||
+      !ReadValue(file, state.dt_so3_ns) || !ReadValue(file, state.dt_r3_ns) ||
+      !ReadValue(file, state.dt_accl_bias_ns) ||
+      !ReadValue(file, state.dt_gyro_bias_ns) || !ReadValue(file, n_so3) ||
+      !ReadValue(file, n_r3) || !ReadValue(file, n_accl_bias) ||
+      !ReadValue(file, n_gyro_bias)) {
+    std::cerr << "Truncated spline state " << path << "\n";
+    return false;
+  }
+  if (n_so3 > kMaxNumKnots || n_r3 > kMaxNumKnots ||
+      n_accl_bias > kMaxNumKnots || n_gyro_bias > kMaxNumKnots) {
+    std::cerr << "Corrupted spline state " << path << "\n";
+    return false;
+  }
+
+  state.so3_knots.resize(n_so3);
+  state.r3_knots.resize(n_r3);
+  state.accl_bias_knots.resize(n_accl_bias);
+  state.gyro_bias_knots.resize(n_gyro_bias);
+  bool ok = true;
+  for (Sophus::SO3d& knot : state.so3_knots) {
+    ok = ok && ReadDoubles(file, knot.data(), Sophus::SO3d::num_parameters);
+  }
+  ok = ok && ReadVec3s(file, state.r3_knots) &&
+       ReadVec3s(file, state.accl_bias_knots) &&
+       ReadVec3s(file, state.gyro_bias_knots) &&
+       ReadDoubles(file, state.T_i_c.data(), Sophus::SE3d::num_parameters) &&
+       ReadDoubles(file, state.gravity.data(), 3) &&
+       ReadDoubles(file, state.accl_intrinsics.data(), 6) &&
+       ReadDoubles(file, state.gyro_intrinsics.data(), 9) &&
+       ReadValue(file, state.cam_line_delay_s) &&
+       ReadValue(file, state.imu_to_camera_time_offset_s) &&
+       ReadValue(file, state.max_accl_bias_range) &&
+       ReadValue(file, state.max_gyro_bias_range);
+  if (!ok) {
+    std::cerr << "Truncated spline state " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
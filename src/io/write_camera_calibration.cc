@@ -35,7 +35,9 @@ bool write_camera_calibration(const std::string& output_file,
                               const theia::Camera& camera,
                               const double fps,
                               const int nr_calib_images,
-                              const double total_reproj_error) {
+                              const double total_reproj_error,
+                              const Eigen::VectorXd& intrinsics_std,
+                              const Eigen::VectorXd& bootstrap_intrinsics_std) {
   std::ofstream json_file(output_file);
   if (!json_file.is_open()) {
     std::cerr << "Could not open: " << output_file << "\n";
@@ -131,6 +133,15 @@ bool write_camera_calibration(const std::string& output_file,
   }
 
   json_obj["intrinsics"]["focal_length"] = camera.FocalLength();
+  if (intrinsics_std.size() > 0) {
+    json_obj["intrinsics_std"] = std::vector<double>(
+        intrinsics_std.data(), intrinsics_std.data() + intrinsics_std.size());
+  }
+  if (bootstrap_intrinsics_std.size() > 0) {
+    json_obj["intrinsics_bootstrap_std"] = std::vector<double>(
+        bootstrap_intrinsics_std.data(),
+        bootstrap_intrinsics_std.data() + bootstrap_intrinsics_std.size());
+  }
 
   json_file << std::setw(2) << json_obj << std::endl;
   json_file.close();
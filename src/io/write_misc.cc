@@ -0,0 +1,51 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/write_misc.h"
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace OpenICC {
+namespace io {
+using json = nlohmann::json;
+
+bool WriteIMU2CamInit(const std::string& path_to_file,
+                      const Eigen::Vector3d& gyro_bias,
+                      const Eigen::Quaterniond& imu_to_cam_rotation,
+                      const double time_offset_imu_to_cam) {
+  std::ofstream out_file(path_to_file);
+  if (!out_file.is_open()) {
+    std::cerr << "Could not open: " << path_to_file << "\n";
+    return false;
+  }
+  json output_json;
+  output_json["gyro_bias"] = {gyro_bias[0], gyro_bias[1], gyro_bias[2]};
+  output_json["gyro_to_camera_rotation"]["w"] = imu_to_cam_rotation.w();
+  output_json["gyro_to_camera_rotation"]["x"] = imu_to_cam_rotation.x();
+  output_json["gyro_to_camera_rotation"]["y"] = imu_to_cam_rotation.y();
+  output_json["gyro_to_camera_rotation"]["z"] = imu_to_cam_rotation.z();
+  output_json["time_offset_gyro_to_cam"] = time_offset_imu_to_cam;
+
+  // write prettified JSON
+  out_file << std::setw(4) << output_json << std::endl;
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
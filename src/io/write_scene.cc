@@ -0,0 +1,222 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/write_scene.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+SceneStreamWriter::~SceneStreamWriter() {
+  if (output_.is_open()) {
+    output_.close();
+  }
+}
+
+bool SceneStreamWriter::Open(const std::string& output_bson) {
+  // write to a temporary file first, such that an interrupted extraction does
+  // not leave a truncated file at the final location
+  output_path_ = output_bson;
+  output_.open(output_path_ + ".part", std::ios::out | std::ios::binary);
+  if (!output_.is_open()) {
+    std::cerr << "Could not open: " << output_path_ << ".part\n";
+    return false;
+  }
+  output_.put('{');
+  return true;
+}
+
+bool SceneStreamWriter::Resume(const std::string& output_bson,
+                               const nlohmann::json& state) {
+  output_path_ = output_bson;
+  const std::string tmp_path = output_path_ + ".part";
+  // drop everything that was written after the checkpoint
+  const uint64_t num_bytes = state["num_bytes"];
+  std::error_code error;
+  std::filesystem::resize_file(tmp_path, num_bytes, error);
+  if (error) {
+    std::cerr << "Could not resume: " << tmp_path << ". " << error.message()
+              << "\n";
+    return false;
+  }
+  output_.open(tmp_path, std::ios::out | std::ios::binary | std::ios::app);
+  if (!output_.is_open()) {
+    std::cerr << "Could not open: " << tmp_path << "\n";
+    return false;
+  }
+  views_started_ = state["views_started"];
+  pending_view_us_ = state["pending_view_us"];
+  pending_view_ = state["pending_view"];
+  return true;
+}
+
+nlohmann::json SceneStreamWriter::Checkpoint() {
+  output_.flush();
+  nlohmann::json state;
+  state["num_bytes"] = static_cast<uint64_t>(output_.tellp());
+  state["views_started"] = views_started_;
+  state["pending_view_us"] = pending_view_us_;
+  state["pending_view"] = pending_view_;
+  return state;
+}
+
+void SceneStreamWriter::WriteKey(const std::string& key) {
+  // ubjson object keys are strings without the 'S' marker, the length is
+  // written with the smallest fitting integer type (big endian)
+  const uint64_t n = key.size();
+  if (n <= static_cast<uint64_t>(std::numeric_limits<int8_t>::max())) {
+    output_.put('i');
+    output_.put(static_cast<char>(n));
+  } else if (n <= std::numeric_limits<uint8_t>::max()) {
+    output_.put('U');
+    output_.put(static_cast<char>(n));
+  } else if (n <= static_cast<uint64_t>(std::numeric_limits<int16_t>::max())) {
+    output_.put('I');
+    for (int b = 1; b >= 0; --b) output_.put(static_cast<char>(n >> (8 * b)));
+  } else if (n <= static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+    output_.put('l');
+    for (int b = 3; b >= 0; --b) output_.put(static_cast<char>(n >> (8 * b)));
+  } else {
+    output_.put('L');
+    for (int b = 7; b >= 0; --b) output_.put(static_cast<char>(n >> (8 * b)));
+  }
+  output_.write(key.data(), key.size());
+}
+
+void SceneStreamWriter::WriteValue(const nlohmann::json& value) {
+  const std::vector<std::uint8_t> v_bson = nlohmann::json::to_ubjson(value);
+  output_.write(reinterpret_cast<const char*>(v_bson.data()), v_bson.size());
+}
+
+void SceneStreamWriter::FlushView() {
+  if (pending_view_us_.empty()) {
+    return;
+  }
+  if (!views_started_) {
+    WriteKey("views");
+    output_.put('{');
+    views_started_ = true;
+  }
+  WriteKey(pending_view_us_);
+  WriteValue(pending_view_);
+  pending_view_us_.clear();
+  pending_view_.clear();
+}
+
+void SceneStreamWriter::AddView(const std::string& view_us,
+                                const nlohmann::json& view) {
+  if (view_us == pending_view_us_) {
+    pending_view_.merge_patch(view);
+    return;
+  }
+  FlushView();
+  pending_view_us_ = view_us;
+  pending_view_ = view;
+}
+
+bool SceneStreamWriter::Close(const nlohmann::json& header) {
+  FlushView();
+  if (views_started_) {
+    output_.put('}');
+  }
+  for (const auto& item : header.items()) {
+    if (item.key() == "views") {
+      continue;
+    }
+    WriteKey(item.key());
+    WriteValue(item.value());
+  }
+  output_.put('}');
+  output_.close();
+  if (output_.fail()) {
+    std::cerr << "Failed to write: " << output_path_ << ".part\n";
+    return false;
+  }
+  const std::string tmp_path = output_path_ + ".part";
+  return std::rename(tmp_path.c_str(), output_path_.c_str()) == 0;
+}
+
+bool MergeSceneFiles(const std::vector<std::string>& input_bsons,
+                     const std::string& output_bson) {
+  return MergeSceneFiles(
+      input_bsons, std::vector<double>(input_bsons.size(), 0.0), output_bson);
+}
+
+bool MergeSceneFiles(const std::vector<std::string>& input_bsons,
+                     const std::vector<double>& time_offsets_s,
+                     const std::string& output_bson) {
+  if (input_bsons.empty()) {
+    std::cerr << "No scene files to merge.\n";
+    return false;
+  }
+  if (time_offsets_s.size() != input_bsons.size()) {
+    std::cerr << "Scene merge needs one time offset per scene file.\n";
+    return false;
+  }
+  nlohmann::json header;
+  // views ordered by their numeric timestamp, the keys do not sort by time
+  std::map<double, nlohmann::json> views;
+  for (size_t i = 0; i < input_bsons.size(); ++i) {
+    nlohmann::json scene;
+    if (!read_scene_bson(input_bsons[i], scene)) {
+      std::cerr << "Could not read: " << input_bsons[i] << "\n";
+      return false;
+    }
+    if (scene.contains("views")) {
+      const double offset_us = time_offsets_s[i] * S_TO_US;
+      for (auto& view : scene["views"].items()) {
+        nlohmann::json& merged = views[std::stod(view.key()) + offset_us];
+        if (merged.is_null()) {
+          merged = std::move(view.value());
+        } else {
+          merged.merge_patch(view.value());
+        }
+      }
+      scene.erase("views");
+    }
+    for (const auto& item : scene.items()) {
+      if (!header.contains(item.key())) {
+        header[item.key()] = item.value();
+      } else if (item.key() == "frame_filter") {
+        for (const auto& count : item.value().items()) {
+          header["frame_filter"][count.key()] =
+              header["frame_filter"].value(count.key(), size_t(0)) +
+              count.value().get<size_t>();
+        }
+      }
+    }
+  }
+
+  SceneStreamWriter writer;
+  if (!writer.Open(output_bson)) {
+    return false;
+  }
+  for (const auto& view : views) {
+    writer.AddView(std::to_string(view.first), view.second);
+  }
+  return writer.Close(header);
+}
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,105 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/banded_least_squares.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+BandedLeastSquares::BandedLeastSquares(const int num_unknowns,
+                                       const int bandwidth)
+    : num_unknowns_(std::max(num_unknowns, 0)),
+      bandwidth_(std::max(bandwidth, 0)) {
+  SetZero();
+}
+
+void BandedLeastSquares::SetZero() {
+  band_.setZero(bandwidth_ + 1, num_unknowns_);
+  g_.setZero(num_unknowns_);
+  cost_ = 0.0;
+}
+
+bool BandedLeastSquares::AddResidualBlock(const int first,
+                                          const Eigen::MatrixXd& J,
+                                          const Eigen::VectorXd& r,
+                                          const double weight) {
+  const int cols = static_cast<int>(J.cols());
+  if (first < 0 || first + cols > num_unknowns_ || cols > bandwidth_ + 1 ||
+      J.rows() != r.rows()) {
+    return false;
+  }
+  const double w2 = weight * weight;
+  const Eigen::MatrixXd JtJ = w2 * J.transpose() * J;
+  g_.segment(first, cols) += w2 * J.transpose() * r;
+  for (int j = 0; j < cols; ++j) {
+    for (int i = 0; i <= j; ++i) {
+      band_(j - i, first + i) += JtJ(i, j);
+    }
+  }
+  cost_ += w2 * r.squaredNorm();
+  return true;
+}
+
+void BandedLeastSquares::AddDamping(const double lambda) {
+  band_.row(0).array() += lambda;
+}
+
+bool BandedLeastSquares::Solve(Eigen::VectorXd& dx) const {
+  // H = U^T U with U(i, i + d) stored in U_band(d, i)
+  Eigen::MatrixXd U_band(band_.rows(), band_.cols());
+  for (int i = 0; i < num_unknowns_; ++i) {
+    const int last = std::min(num_unknowns_ - 1, i + bandwidth_);
+    for (int j = i; j <= last; ++j) {
+      double s = band_(j - i, i);
+      for (int k = std::max(0, j - bandwidth_); k < i; ++k) {
+        s -= U_band(i - k, k) * U_band(j - k, k);
+      }
+      if (j == i) {
+        if (!(s > 0.0)) {
+          return false;
+        }
+        U_band(0, i) = std::sqrt(s);
+      } else {
+        U_band(j - i, i) = s / U_band(0, i);
+      }
+    }
+  }
+
+  // U^T y = -g
+  dx.resize(num_unknowns_);
+  for (int i = 0; i < num_unknowns_; ++i) {
+    double s = -g_[i];
+    for (int k = std::max(0, i - bandwidth_); k < i; ++k) {
+      s -= U_band(i - k, k) * dx[k];
+    }
+    dx[i] = s / U_band(0, i);
+  }
+  // U dx = y
+  for (int i = num_unknowns_ - 1; i >= 0; --i) {
+    double s = dx[i];
+    const int last = std::min(num_unknowns_ - 1, i + bandwidth_);
+    for (int j = i + 1; j <= last; ++j) {
+      s -= U_band(j - i, i) * dx[j];
+    }
+    dx[i] = s / U_band(0, i);
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,112 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/corner_subsampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace OpenICC {
+namespace utils {
+
+void SubsampleCorners(const vec2_vector& corners,
+                      const int image_width,
+                      const int image_height,
+                      const CornerSubsamplingOptions& options,
+                      std::vector<size_t>& selected) {
+  selected.clear();
+  const size_t max_corners = std::max(0, options.max_corners_per_view);
+  if (max_corners == 0 || corners.size() <= max_corners || image_width <= 0 ||
+      image_height <= 0) {
+    for (size_t i = 0; i < corners.size(); ++i) {
+      selected.push_back(i);
+    }
+    return;
+  }
+
+  const double border_px =
+      options.border_fraction * std::min(image_width, image_height);
+  const int cols = std::max(1, options.grid_cols);
+  const int rows = std::max(1, options.grid_rows);
+  const double cell_w = image_width / static_cast<double>(cols);
+  const double cell_h = image_height / static_cast<double>(rows);
+  // distance to the cell center and index of the interior corners per cell
+  std::vector<std::vector<std::pair<double, size_t>>> cells(cols * rows);
+  for (size_t i = 0; i < corners.size(); ++i) {
+    const Eigen::Vector2d& c = corners[i];
+    if (std::min({c[0], c[1], image_width - c[0], image_height - c[1]}) <
+        border_px) {
+      selected.push_back(i);
+      continue;
+    }
+    const int col = std::min(cols - 1, std::max(0, int(c[0] / cell_w)));
+    const int row = std::min(rows - 1, std::max(0, int(c[1] / cell_h)));
+    const Eigen::Vector2d center((col + 0.5) * cell_w, (row + 0.5) * cell_h);
+    cells[row * cols + col].emplace_back((c - center).squaredNorm(), i);
+  }
+  for (auto& cell : cells) {
+    std::sort(cell.begin(), cell.end());
+  }
+
+  // one corner per cell and turn, so sparse regions keep their corners
+  for (size_t turn = 0; selected.size() < max_corners; ++turn) {
+    bool taken = false;
+    for (const auto& cell : cells) {
+      if (turn >= cell.size()) continue;
+      selected.push_back(cell[turn].second);
+      taken = true;
+      if (selected.size() >= max_corners) break;
+    }
+    if (!taken) break;
+  }
+  std::sort(selected.begin(), selected.end());
+}
+
+size_t SubsampleViewCorners(const CornerSubsamplingOptions& options,
+                            theia::Reconstruction& reconstruction) {
+  if (options.max_corners_per_view <= 0) {
+    return 0;
+  }
+  size_t num_removed = 0;
+  std::vector<size_t> selected;
+  for (const theia::ViewId view_id : reconstruction.ViewIds()) {
+    const theia::View* view = reconstruction.View(view_id);
+    const std::vector<theia::TrackId> track_ids = view->TrackIds();
+    vec2_vector corners;
+    corners.reserve(track_ids.size());
+    for (const theia::TrackId track_id : track_ids) {
+      corners.push_back(view->GetFeature(track_id)->point_);
+    }
+    SubsampleCorners(corners,
+                     view->Camera().ImageWidth(),
+                     view->Camera().ImageHeight(),
+                     options,
+                     selected);
+    std::vector<char> keep(track_ids.size(), 0);
+    for (const size_t i : selected) {
+      keep[i] = 1;
+    }
+    for (size_t i = 0; i < track_ids.size(); ++i) {
+      if (!keep[i] && reconstruction.RemoveObservation(view_id, track_ids[i])) {
+        ++num_removed;
+      }
+    }
+  }
+  return num_removed;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,181 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/cpu_affinity.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <glog/logging.h>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+// cpus of every NUMA node, read once from sysfs
+struct NumaTopology {
+  std::vector<std::vector<int>> node_cpus;
+  std::vector<int> cpu_node;
+
+  NumaTopology() {
+    for (int node = 0;; ++node) {
+      std::ifstream cpulist("/sys/devices/system/node/node" +
+                            std::to_string(node) + "/cpulist");
+      std::string list;
+      std::vector<int> cpus;
+      if (!std::getline(cpulist, list) || !ParseCpuList(list, cpus)) {
+        break;
+      }
+      for (const int cpu : cpus) {
+        if (cpu >= static_cast<int>(cpu_node.size())) {
+          cpu_node.resize(cpu + 1, 0);
+        }
+        cpu_node[cpu] = node;
+      }
+      node_cpus.push_back(cpus);
+    }
+  }
+};
+
+const NumaTopology& Topology() {
+  static const NumaTopology topology;
+  return topology;
+}
+
+}  // namespace
+
+bool ParseCpuList(const std::string& list, std::vector<int>& cpus) {
+  cpus.clear();
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    int first = 0, last = 0;
+    char dash = 0;
+    std::stringstream range_ss(range);
+    if (!(range_ss >> first)) {
+      return false;
+    }
+    last = first;
+    if (range_ss >> dash && (dash != '-' || !(range_ss >> last))) {
+      return false;
+    }
+    if (first < 0 || last < first) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return !cpus.empty();
+}
+
+int NumNumaNodes() {
+  return std::max<int>(1, Topology().node_cpus.size());
+}
+
+std::vector<int> NumaNodeCpus(const int node) {
+  const NumaTopology& topology = Topology();
+  if (node < 0 || node >= static_cast<int>(topology.node_cpus.size())) {
+    return std::vector<int>();
+  }
+  return topology.node_cpus[node];
+}
+
+int NumaNodeOfCpu(const int cpu) {
+  const NumaTopology& topology = Topology();
+  if (cpu < 0 || cpu >= static_cast<int>(topology.cpu_node.size())) {
+    return 0;
+  }
+  return topology.cpu_node[cpu];
+}
+
+int NumProcessCpus() {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0 &&
+      CPU_COUNT(&cpu_set) > 0) {
+    return CPU_COUNT(&cpu_set);
+  }
+#endif
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+int CurrentCpu() {
+#ifdef __linux__
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+int CurrentNumaNode() { return NumaNodeOfCpu(CurrentCpu()); }
+
+bool PinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  if (CPU_COUNT(&cpu_set) == 0 ||
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) !=
+          0) {
+    LOG(WARNING) << "Could not pin the thread to " << cpus.size()
+                 << " cpus.";
+    return false;
+  }
+  return true;
+#else
+  LOG(WARNING) << "Thread pinning is only supported on linux.";
+  return false;
+#endif
+}
+
+bool ResolveCpuPlacement(const std::string& placement,
+                         std::vector<int>& cpus) {
+  cpus.clear();
+  if (placement.empty()) {
+    return true;
+  }
+  if (placement.compare(0, 5, "node:") == 0) {
+    int node = -1;
+    std::stringstream(placement.substr(5)) >> node;
+    cpus = NumaNodeCpus(node);
+  } else {
+    ParseCpuList(placement, cpus);
+  }
+  if (cpus.empty()) {
+    LOG(ERROR) << "Invalid cpu placement: " << placement;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
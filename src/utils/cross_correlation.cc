@@ -0,0 +1,102 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/cross_correlation.h"
+
+#include <unsupported/Eigen/FFT>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+
+namespace OpenICC {
+namespace utils {
+
+bool CrossCorrelationLag(const std::vector<double>& a,
+                         const std::vector<double>& b,
+                         const int max_lag,
+                         double& lag,
+                         double& peak_correlation) {
+  const int n_a = a.size(), n_b = b.size();
+  if (n_a < 3 || n_b < 3 || max_lag < 1) {
+    return false;
+  }
+
+  // zero padding to a power of two, long enough to avoid circular wrap
+  size_t n_fft = 1;
+  while (n_fft < static_cast<size_t>(n_a + n_b)) n_fft <<= 1;
+
+  double mean_a = 0.0, mean_b = 0.0;
+  for (const double v : a) mean_a += v;
+  for (const double v : b) mean_b += v;
+  mean_a /= n_a;
+  mean_b /= n_b;
+
+  std::vector<double> a_pad(n_fft, 0.0), b_pad(n_fft, 0.0);
+  double energy_a = 0.0, energy_b = 0.0;
+  for (int i = 0; i < n_a; ++i) {
+    a_pad[i] = a[i] - mean_a;
+    energy_a += a_pad[i] * a_pad[i];
+  }
+  for (int i = 0; i < n_b; ++i) {
+    b_pad[i] = b[i] - mean_b;
+    energy_b += b_pad[i] * b_pad[i];
+  }
+  const double norm = std::sqrt(energy_a * energy_b);
+  if (norm <= 0.0) {
+    return false;
+  }
+
+  // corr[k] = sum_t a[t] * b[t + k], negative lags wrap to the end
+  Eigen::FFT<double> fft;
+  std::vector<std::complex<double>> spec_a, spec_b;
+  fft.fwd(spec_a, a_pad);
+  fft.fwd(spec_b, b_pad);
+  for (size_t i = 0; i < spec_a.size(); ++i) {
+    spec_b[i] *= std::conj(spec_a[i]);
+  }
+  std::vector<double> corr;
+  fft.inv(corr, spec_b);
+
+  auto corr_at = [&](const int k) {
+    return corr[k >= 0 ? k : static_cast<int>(n_fft) + k];
+  };
+
+  const int lag_min = -std::min(max_lag, n_a - 1);
+  const int lag_max = std::min(max_lag, n_b - 1);
+  int best_k = 0;
+  double best = -std::numeric_limits<double>::max();
+  for (int k = lag_min; k <= lag_max; ++k) {
+    if (corr_at(k) > best) {
+      best = corr_at(k);
+      best_k = k;
+    }
+  }
+
+  lag = best_k;
+  if (best_k > lag_min && best_k < lag_max) {
+    const double c_m = corr_at(best_k - 1), c_p = corr_at(best_k + 1);
+    const double denom = c_m - 2.0 * best + c_p;
+    if (denom < 0.0) {
+      lag += 0.5 * (c_m - c_p) / denom;
+    }
+  }
+  peak_correlation = best / norm;
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,317 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/executor.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "OpenCameraCalibrator/utils/cpu_affinity.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+constexpr int kNumTaskPriorities = 3;
+
+// executor and queue of the worker the calling thread belongs to
+thread_local const Executor* tls_executor = nullptr;
+thread_local int tls_worker_idx = -1;
+// nesting depth of the tasks the calling thread is executing
+thread_local int tls_task_depth = 0;
+thread_local TaskPriority tls_priority = TaskPriority::kNormal;
+
+// only the cpus of the process, such that a job started with a cpu budget
+// (taskset, the stage scheduler of the python pipelines) stays within it
+int HardwareThreads() { return NumProcessCpus(); }
+
+}  // namespace
+
+Executor& Executor::Global() {
+  static Executor executor;
+  return executor;
+}
+
+Executor::Executor(const int max_concurrency)
+    : max_concurrency_(max_concurrency > 0 ? max_concurrency
+                                           : HardwareThreads()),
+      numa_aware_(NumNumaNodes() > 1) {
+  const int num_injection_queues = numa_aware_ ? NumNumaNodes() : 1;
+  for (int n = 0; n < num_injection_queues; ++n) {
+    injection_queues_.emplace_back(new TaskQueue);
+    injection_queues_.back()->numa_node = n;
+  }
+  StartWorkers();
+}
+
+Executor::~Executor() { StopWorkers(); }
+
+void Executor::SetMaxConcurrency(int max_concurrency) {
+  if (max_concurrency <= 0) {
+    max_concurrency = HardwareThreads();
+  }
+  if (max_concurrency == max_concurrency_) {
+    return;
+  }
+  StopWorkers();
+  max_concurrency_ = max_concurrency;
+  StartWorkers();
+}
+
+void Executor::SetWorkerCpuSets(
+    const std::vector<std::vector<int>>& cpu_sets) {
+  StopWorkers();
+  worker_cpu_sets_ = cpu_sets;
+  StartWorkers();
+}
+
+int Executor::SolverThreads(const int requested) const {
+  if (deterministic_) {
+    return 1;
+  }
+  int busy = num_running_;
+  if (tls_executor == this && tls_task_depth > 0) {
+    // the calling thread runs the solver
+    --busy;
+  }
+  const int cap = requested > 0 ? std::min(requested, max_concurrency_)
+                                : max_concurrency_;
+  return std::max(1, std::min(cap, max_concurrency_ - busy));
+}
+
+void Executor::Submit(std::function<void()> task,
+                      const TaskPriority priority) {
+  const int numa_node = ThreadNumaNode();
+  TaskQueue& queue = tls_executor == this && tls_worker_idx >= 0
+                         ? *worker_queues_[tls_worker_idx]
+                         : *injection_queues_[numa_node];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks[static_cast<int>(priority)].push_back(
+        Task{std::move(task), numa_node});
+  }
+  ++num_pending_;
+  // taking the lock orders the notification after the check of the workers
+  std::lock_guard<std::mutex> lock(wake_mutex_);
+  wake_.notify_one();
+}
+
+bool Executor::RunPendingTask() {
+  const int worker_idx = tls_executor == this ? tls_worker_idx : -1;
+  Task task;
+  TaskPriority priority;
+  if (!PopTask(worker_idx, task, priority)) {
+    return false;
+  }
+  RunTask(task, priority);
+  return true;
+}
+
+void Executor::StartWorkers() {
+  const int num_workers = max_concurrency_ - 1;
+  for (int i = 0; i < num_workers; ++i) {
+    worker_queues_.emplace_back(new TaskQueue);
+    if (!worker_cpu_sets_.empty()) {
+      const std::vector<int>& cpus =
+          worker_cpu_sets_[i % worker_cpu_sets_.size()];
+      worker_queues_.back()->numa_node =
+          cpus.empty() ? -1 : NumaNodeOfCpu(cpus.front());
+    }
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&Executor::WorkerLoop, this, i);
+  }
+}
+
+void Executor::StopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stop_ = true;
+    wake_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  stop_ = false;
+
+  // tasks left in the queues of the workers are kept for the next workers
+  for (auto& queue : worker_queues_) {
+    for (int p = 0; p < kNumTaskPriorities; ++p) {
+      for (Task& task : queue->tasks[p]) {
+        TaskQueue& injection_queue = *injection_queues_[task.numa_node];
+        std::lock_guard<std::mutex> lock(injection_queue.mutex);
+        injection_queue.tasks[p].push_back(std::move(task));
+      }
+    }
+  }
+  worker_queues_.clear();
+}
+
+void Executor::WorkerLoop(const size_t worker_idx) {
+  tls_executor = this;
+  tls_worker_idx = static_cast<int>(worker_idx);
+  if (!worker_cpu_sets_.empty()) {
+    PinCurrentThread(worker_cpu_sets_[worker_idx % worker_cpu_sets_.size()]);
+  }
+  Task task;
+  TaskPriority priority;
+  while (true) {
+    if (PopTask(tls_worker_idx, task, priority)) {
+      RunTask(task, priority);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait(lock, [this] { return stop_ || num_pending_ > 0; });
+    if (stop_) {
+      break;
+    }
+  }
+  tls_executor = nullptr;
+  tls_worker_idx = -1;
+}
+
+int Executor::ThreadNumaNode() const {
+  if (!numa_aware_) {
+    return 0;
+  }
+  if (tls_executor == this && tls_worker_idx >= 0 &&
+      worker_queues_[tls_worker_idx]->numa_node >= 0) {
+    return worker_queues_[tls_worker_idx]->numa_node;
+  }
+  return std::min<int>(CurrentNumaNode(), injection_queues_.size() - 1);
+}
+
+bool Executor::PopTask(const int worker_idx,
+                       Task& task,
+                       TaskPriority& priority) {
+  if (num_pending_ == 0) {
+    return false;
+  }
+  const auto take = [&task](TaskQueue& queue, const int p, const bool newest) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks[p].empty()) {
+      return false;
+    }
+    if (newest) {
+      task = std::move(queue.tasks[p].back());
+      queue.tasks[p].pop_back();
+    } else {
+      task = std::move(queue.tasks[p].front());
+      queue.tasks[p].pop_front();
+    }
+    return true;
+  };
+  const int numa_node = ThreadNumaNode();
+  const int num_workers = worker_queues_.size();
+  // the workers other than the calling one
+  const int num_victims = worker_idx >= 0 ? num_workers - 1 : num_workers;
+  bool found = false;
+  for (int p = 0; p < kNumTaskPriorities && !found; ++p) {
+    priority = static_cast<TaskPriority>(p);
+    // newest task of the own queue, it is still warm in the cache
+    if (worker_idx >= 0) {
+      found = take(*worker_queues_[worker_idx], p, true);
+    }
+    // then the oldest tasks of the own node before those of other nodes
+    for (int pass = 0; pass < (numa_aware_ ? 2 : 1) && !found; ++pass) {
+      const auto on_pass_node = [numa_node, pass](const TaskQueue& queue) {
+        const bool local =
+            queue.numa_node < 0 || queue.numa_node == numa_node;
+        return local == (pass == 0);
+      };
+      for (size_t n = 0; n < injection_queues_.size() && !found; ++n) {
+        if (on_pass_node(*injection_queues_[n])) {
+          found = take(*injection_queues_[n], p, false);
+        }
+      }
+      for (int i = 0; i < num_victims && !found; ++i) {
+        TaskQueue& victim =
+            *worker_queues_[(worker_idx + 1 + i) % num_workers];
+        if (on_pass_node(victim)) {
+          found = take(victim, p, false);
+        }
+      }
+    }
+  }
+  if (!found) {
+    return false;
+  }
+  --num_pending_;
+  return true;
+}
+
+void Executor::RunTask(Task& task, const TaskPriority priority) {
+  const Executor* previous_executor = tls_executor;
+  tls_executor = this;
+  if (tls_task_depth++ == 0) {
+    ++num_running_;
+  }
+  if (numa_aware_ && task.numa_node != ThreadNumaNode()) {
+    ++num_cross_node_tasks_;
+  }
+  {
+    // nested submissions inherit the priority of the task
+    ScopedTaskPriority scoped_priority(priority);
+    task.func();
+  }
+  task.func = nullptr;
+  if (--tls_task_depth == 0) {
+    --num_running_;
+  }
+  tls_executor = previous_executor;
+}
+
+ScopedTaskPriority::ScopedTaskPriority(const TaskPriority priority)
+    : previous_(tls_priority) {
+  tls_priority = priority;
+}
+
+ScopedTaskPriority::~ScopedTaskPriority() { tls_priority = previous_; }
+
+TaskPriority ScopedTaskPriority::Current() { return tls_priority; }
+
+void TaskGroup::Run(std::function<void()> task) {
+  ++num_unfinished_;
+  executor_.Submit(
+      [this, task]() {
+        task();
+        // the group may be destroyed once the waiter saw the last one finish
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--num_unfinished_ == 0) {
+          finished_.notify_all();
+        }
+      },
+      priority_);
+}
+
+void TaskGroup::Wait() {
+  while (num_unfinished_ > 0) {
+    if (executor_.RunPendingTask()) {
+      continue;
+    }
+    // the remaining tasks run on other threads, wake up regularly to help
+    // with tasks they submit meanwhile
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait_for(lock, std::chrono::milliseconds(1), [this] {
+      return num_unfinished_ == 0;
+    });
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,84 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/gyro_integration.h"
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace utils {
+
+void IntegrateGyroIntervals(const ImuSamplesViewd& gyro_samples,
+                            const std::vector<DataInterval>& intervals,
+                            Eigen::Matrix<double, 4, Eigen::Dynamic>& quats_res,
+                            double data_dt) {
+  using ArrayXd = Eigen::ArrayXd;
+  const int n_lanes = intervals.size();
+  quats_res.resize(4, n_lanes);
+  if (n_lanes == 0) return;
+
+  std::vector<DataInterval> rev_intervals(n_lanes);
+  int max_steps = 0;
+  for (int k = 0; k < n_lanes; ++k) {
+    rev_intervals[k] = CheckInterval(gyro_samples, intervals[k]);
+    max_steps = std::max(
+        max_steps, rev_intervals[k].end_idx - rev_intervals[k].start_idx);
+  }
+
+  // Identity quaternions
+  ArrayXd quat[4] = {ArrayXd::Ones(n_lanes),
+                     ArrayXd::Zero(n_lanes),
+                     ArrayXd::Zero(n_lanes),
+                     ArrayXd::Zero(n_lanes)};
+  ArrayXd omega0[3], omega1[3], quat_step[4];
+  for (int d = 0; d < 3; ++d) {
+    omega0[d].resize(n_lanes);
+    omega1[d].resize(n_lanes);
+  }
+  ArrayXd dt(n_lanes);
+  Eigen::Array<bool, Eigen::Dynamic, 1> active(n_lanes);
+
+  for (int step = 0; step < max_steps; ++step) {
+    // Gather the samples of this step, finished lanes take a zero step
+    for (int k = 0; k < n_lanes; ++k) {
+      const int i = rev_intervals[k].start_idx + step;
+      active[k] = i < rev_intervals[k].end_idx;
+      if (!active[k]) {
+        dt[k] = 0.0;
+        for (int d = 0; d < 3; ++d) omega0[d][k] = omega1[d][k] = 0.0;
+        continue;
+      }
+      dt[k] = data_dt > 0.0 ? data_dt
+                            : gyro_samples.timestamp_s(i + 1) -
+                                  gyro_samples.timestamp_s(i);
+      for (int d = 0; d < 3; ++d) {
+        omega0[d][k] = gyro_samples.axis(d)[i];
+        omega1[d][k] = gyro_samples.axis(d)[i + 1];
+      }
+    }
+
+    QuatComponentsStepRK4(quat, omega0, omega1, dt, quat_step);
+    for (int j = 0; j < 4; ++j) {
+      quat[j] = active.select(quat_step[j], quat[j]);
+    }
+  }
+
+  for (int j = 0; j < 4; ++j) {
+    quats_res.row(j) = quat[j].matrix().transpose();
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
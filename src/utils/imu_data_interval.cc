@@ -45,6 +45,21 @@ Vector3d DataMean(const ImuReadings& samples, const DataInterval& interval) {
   return mean;
 }
 
+Vector3d DataMean(const ImuSamplesViewd& samples,
+                  const DataInterval& interval) {
+  const DataInterval rev_interval = CheckInterval(samples, interval);
+  const int n_samp = rev_interval.end_idx - rev_interval.start_idx + 1;
+  Vector3d mean;
+  for (int d = 0; d < 3; ++d) {
+    mean[d] = Eigen::Map<const Eigen::ArrayXd>(
+                  samples.axis(d) + rev_interval.start_idx, n_samp)
+                  .sum();
+  }
+  mean /= double(n_samp);
+
+  return mean;
+}
+
 Vector3d DataVariance(const ImuReadings& samples,
                       const DataInterval& interval) {
   DataInterval rev_interval = CheckInterval(samples, interval);
@@ -61,49 +76,76 @@ Vector3d DataVariance(const ImuReadings& samples,
   return variance;
 }
 
+Vector3d DataVariance(const ImuSamplesViewd& samples,
+                      const DataInterval& interval) {
+  const DataInterval rev_interval = CheckInterval(samples, interval);
+  const int n_samp = rev_interval.end_idx - rev_interval.start_idx + 1;
+  const Vector3d mean = DataMean(samples, rev_interval);
+
+  Vector3d variance;
+  for (int d = 0; d < 3; ++d) {
+    variance[d] = (Eigen::Map<const Eigen::ArrayXd>(
+                       samples.axis(d) + rev_interval.start_idx, n_samp) -
+                   mean[d])
+                      .square()
+                      .sum();
+  }
+  variance /= double(n_samp - 1);
+
+  return variance;
+}
+
+void SelectIntervals(const std::vector<DataInterval>& intervals,
+                     std::vector<DataInterval>& extracted_intervals,
+                     std::vector<DataInterval>& sample_ranges,
+                     int interval_n_samps,
+                     bool only_means) {
+  extracted_intervals.clear();
+  sample_ranges.clear();
+  // Valid intervals have at least interval_n_samps samples
+  for (const DataInterval& interval : intervals) {
+    if (interval.end_idx - interval.start_idx + 1 < interval_n_samps) {
+      continue;
+    }
+    extracted_intervals.push_back(interval);
+    if (only_means) {
+      sample_ranges.push_back(interval);
+    } else {
+      sample_ranges.emplace_back(interval.start_idx,
+                                 interval.start_idx + interval_n_samps - 1);
+    }
+  }
+}
+
 void ExtractIntervalsSamples(const ImuReadings& samples,
                              const std::vector<DataInterval>& intervals,
                              ImuReadings& extracted_samples,
                              std::vector<DataInterval>& extracted_intervals,
                              int interval_n_samps,
                              bool only_means) {
-  // Check for valid intervals  (i.e., intervals with at least interval_n_samps
-  // samples)
-  int n_valid_intervals = 0, n_static_samples;
-  for (size_t i = 0; i < intervals.size(); i++) {
-    if ((intervals[i].end_idx - intervals[i].start_idx + 1) >= interval_n_samps)
-      n_valid_intervals++;
-  }
-
-  if (only_means)
-    n_static_samples = n_valid_intervals;
-  else
-    n_static_samples = n_valid_intervals * interval_n_samps;
+  std::vector<DataInterval> sample_ranges;
+  SelectIntervals(intervals,
+                  extracted_intervals,
+                  sample_ranges,
+                  interval_n_samps,
+                  only_means);
 
   extracted_samples.clear();
-  extracted_intervals.clear();
-  extracted_samples.reserve(n_static_samples);
-  extracted_intervals.reserve(n_valid_intervals);
-
-  // For each valid interval, extract the first interval_n_samps samples
-  for (size_t i = 0; i < intervals.size(); i++) {
-    int interval_size = intervals[i].end_idx - intervals[i].start_idx + 1;
-    if (interval_size >= interval_n_samps) {
-      extracted_intervals.push_back(intervals[i]);
-      if (only_means) {
-        DataInterval mean_inerval(intervals[i].start_idx, intervals[i].end_idx);
-        // Take the timestamp centered in the interval where the mean is
-        // computed
-        double timestamp =
-            samples[intervals[i].start_idx + interval_size / 2].timestamp_s();
-        Vector3d mean_val = DataMean(samples, mean_inerval);
-        extracted_samples.push_back(ImuReading(timestamp, mean_val));
-      } else {
-        for (int j = intervals[i].start_idx;
-             j < intervals[i].start_idx + interval_n_samps;
-             j++)
-          extracted_samples.push_back(samples[j]);
-      }
+  extracted_samples.reserve(only_means
+                                ? sample_ranges.size()
+                                : sample_ranges.size() * interval_n_samps);
+  for (const DataInterval& range : sample_ranges) {
+    if (only_means) {
+      // Take the timestamp centered in the interval where the mean is
+      // computed
+      const int interval_size = range.end_idx - range.start_idx + 1;
+      const double timestamp =
+          samples[range.start_idx + interval_size / 2].timestamp_s();
+      extracted_samples.push_back(
+          ImuReading(timestamp, DataMean(samples, range)));
+    } else {
+      for (int j = range.start_idx; j <= range.end_idx; j++)
+        extracted_samples.push_back(samples[j]);
     }
   }
 }
@@ -112,6 +154,63 @@ void StaticIntervalsDetector(const ImuReadings& samples,
                              double threshold,
                              std::vector<DataInterval>& intervals,
                              int win_size) {
+  const ImuSampleArraysd sample_arrays(samples);
+  StaticIntervalsDetector(
+      ImuSamplesViewd(sample_arrays), threshold, intervals, win_size);
+}
+
+namespace {
+
+//! Variance magnitude of the window of 2 * h + 1 samples centered in each
+//! sample i in [h, size - h). Keeps running sums of the samples and of their
+//! squares, so the whole signal is processed in a single linear pass. The
+//! values are shifted by the first sample to limit the cancellation in
+//! sum(x^2) - sum(x)^2 / n.
+void SlidingVarianceNorms(const ImuSamplesViewd& samples,
+                          const int h,
+                          std::vector<double>& norms) {
+  const size_t n_samps = samples.size();
+  const double n = 2 * h + 1;
+  norms.assign(n_samps, 0.0);
+
+  Vector3d ref = samples.data(0);
+  Vector3d sum(0, 0, 0), sum_sq(0, 0, 0);
+  for (int i = 0; i < 2 * h + 1; ++i) {
+    const Vector3d v = samples.data(i) - ref;
+    sum += v;
+    sum_sq += v.cwiseAbs2();
+  }
+
+  for (size_t i = h; i < n_samps - h; ++i) {
+    const Vector3d variance =
+        ((sum_sq - sum.cwiseAbs2() / n) / (n - 1.0)).cwiseMax(0.0);
+    norms[i] = variance.norm();
+
+    if (i + h + 1 < n_samps) {
+      const Vector3d v_out = samples.data(i - h) - ref;
+      const Vector3d v_in = samples.data(i + h + 1) - ref;
+      sum += v_in - v_out;
+      sum_sq += v_in.cwiseAbs2() - v_out.cwiseAbs2();
+    }
+  }
+}
+
+}  // namespace
+
+void StaticIntervalsDetector(const ImuSamplesViewd& samples,
+                             double threshold,
+                             std::vector<DataInterval>& intervals,
+                             int win_size) {
+  std::vector<std::vector<DataInterval>> intervals_per_th;
+  StaticIntervalsDetector(samples, {threshold}, intervals_per_th, win_size);
+  if (!intervals_per_th.empty()) intervals = std::move(intervals_per_th[0]);
+}
+
+void StaticIntervalsDetector(
+    const ImuSamplesViewd& samples,
+    const std::vector<double>& thresholds,
+    std::vector<std::vector<DataInterval>>& intervals,
+    int win_size) {
   if (win_size < 11) win_size = 11;
   if (!(win_size % 2)) win_size++;
 
@@ -119,34 +218,39 @@ void StaticIntervalsDetector(const ImuReadings& samples,
 
   if (win_size >= samples.size()) return;
 
-  intervals.clear();
+  const size_t n_th = thresholds.size();
+  intervals.assign(n_th, std::vector<DataInterval>());
 
-  bool look_for_start = true;
-  DataInterval current_interval;
+  std::vector<double> norms;
+  SlidingVarianceNorms(samples, h, norms);
 
-  for (size_t i = h; i < samples.size() - h; i++) {
-    Vector3d variance = DataVariance(samples, DataInterval(i - h, i + h));
-    double norm = variance.norm();
+  std::vector<bool> look_for_start(n_th, true);
+  std::vector<DataInterval> current_interval(n_th);
 
-    if (look_for_start) {
-      if (norm < threshold) {
-        current_interval.start_idx = i;
-        look_for_start = false;
-      }
-    } else {
-      if (norm >= threshold) {
-        current_interval.end_idx = i - 1;
-        look_for_start = true;
-        intervals.push_back(current_interval);
+  for (size_t i = h; i < samples.size() - h; i++) {
+    const double norm = norms[i];
+    for (size_t t = 0; t < n_th; ++t) {
+      if (look_for_start[t]) {
+        if (norm < thresholds[t]) {
+          current_interval[t].start_idx = i;
+          look_for_start[t] = false;
+        }
+      } else {
+        if (norm >= thresholds[t]) {
+          current_interval[t].end_idx = i - 1;
+          look_for_start[t] = true;
+          intervals[t].push_back(current_interval[t]);
+        }
       }
     }
   }
 
   // If the last interval has not been included in the intervals vector
-  if (!look_for_start) {
-    current_interval.end_idx = samples.size() - h - 1;
-    // current_interval.end_ts = samples[current_interval.end_idx].timestamp();
-    intervals.push_back(current_interval);
+  for (size_t t = 0; t < n_th; ++t) {
+    if (!look_for_start[t]) {
+      current_interval[t].end_idx = samples.size() - h - 1;
+      intervals[t].push_back(current_interval[t]);
+    }
   }
 }
 
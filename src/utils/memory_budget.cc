@@ -0,0 +1,123 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+namespace OpenICC {
+namespace utils {
+
+MemoryBudget& MemoryBudget::Instance() {
+  static MemoryBudget budget;
+  return budget;
+}
+
+void MemoryBudget::SetSpillDirectory(const std::string& spill_dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  spill_dir_ = spill_dir;
+}
+
+std::string MemoryBudget::SpillDirectory() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!spill_dir_.empty()) {
+    return spill_dir_;
+  }
+  const char* tmp_dir = std::getenv("TMPDIR");
+  return tmp_dir != nullptr ? tmp_dir : "/tmp";
+}
+
+bool MemoryBudget::WouldExceed(const size_t num_bytes) const {
+  const int64_t budget_mb = budget_mb_;
+  if (budget_mb <= 0) {
+    return false;
+  }
+  return ResidentSetSizeKb() + static_cast<int64_t>(num_bytes / 1024) >
+         budget_mb * 1024;
+}
+
+bool SpillBuffer::Allocate(const size_t num_bytes) {
+  Release();
+  if (num_bytes == 0) {
+    return true;
+  }
+  MemoryBudget& budget = MemoryBudget::Instance();
+  if (!budget.WouldExceed(num_bytes)) {
+    data_ = std::malloc(num_bytes);
+    num_bytes_ = num_bytes;
+    return data_ != nullptr;
+  }
+
+  // the file is unlinked right away, it disappears with the mapping
+  std::string path = budget.SpillDirectory() + "/openicc_spill_XXXXXX";
+  std::vector<char> path_template(path.begin(), path.end());
+  path_template.push_back('\0');
+  const int fd = mkstemp(path_template.data());
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create a spill file in "
+               << budget.SpillDirectory();
+    return false;
+  }
+  unlink(path_template.data());
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, num_bytes) == 0) {
+    data = mmap(
+        nullptr, num_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Could not map a spill file of " << num_bytes << " bytes.";
+    return false;
+  }
+  data_ = data;
+  num_bytes_ = num_bytes;
+  spilled_ = true;
+  budget.spilled_bytes_ += num_bytes;
+  return true;
+}
+
+void SpillBuffer::Release() {
+  if (data_ == nullptr) {
+    return;
+  }
+  if (spilled_) {
+    munmap(data_, num_bytes_);
+    MemoryBudget::Instance().spilled_bytes_ -= num_bytes_;
+  } else {
+    std::free(data_);
+  }
+  data_ = nullptr;
+  num_bytes_ = 0;
+  spilled_ = false;
+}
+
+void SpillBuffer::Swap(SpillBuffer& other) {
+  std::swap(data_, other.data_);
+  std::swap(num_bytes_, other.num_bytes_);
+  std::swap(spilled_, other.spilled_);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,185 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/metrics.h"
+
+#include <sstream>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+// upper bounds of the duration histograms in seconds, followed by +Inf
+const double kDurationBuckets[] = {
+    0.01, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0, 300.0, 900.0, 3600.0};
+const size_t kNumDurationBuckets =
+    sizeof(kDurationBuckets) / sizeof(kDurationBuckets[0]);
+
+std::string Series(const std::string& name, const std::string& labels) {
+  return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+std::string JoinLabels(const std::string& labels, const std::string& label) {
+  return labels.empty() ? label : labels + "," + label;
+}
+
+}  // namespace
+
+Metrics& Metrics::Instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+void Metrics::AddCounter(const std::string& name,
+                         const std::string& labels,
+                         const double value) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_[name][labels] += value;
+}
+
+void Metrics::SetGauge(const std::string& name,
+                       const std::string& labels,
+                       const double value) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  gauges_[name][labels] = value;
+}
+
+void Metrics::ObserveDuration(const std::string& name,
+                              const std::string& labels,
+                              const double seconds) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  Histogram& histogram = histograms_[name][labels];
+  if (histogram.counts.empty()) {
+    histogram.counts.assign(kNumDurationBuckets + 1, 0);
+  }
+  size_t bucket = 0;
+  while (bucket < kNumDurationBuckets && seconds > kDurationBuckets[bucket]) {
+    ++bucket;
+  }
+  ++histogram.counts[bucket];
+  ++histogram.count;
+  histogram.sum += seconds;
+}
+
+void Metrics::ObserveStage(const StageRecord& stage) {
+  const std::string labels = Label("stage", stage.name);
+  AddCounter("openicc_stage_runs_total", labels, 1.0);
+  AddCounter(
+      "openicc_stage_cpu_seconds_total", labels, stage.cpu_time_us * 1e-6);
+  AddCounter("openicc_stage_items_total", labels, stage.num_items);
+  ObserveDuration(
+      "openicc_stage_duration_seconds", labels, stage.wall_time_us * 1e-6);
+}
+
+std::string Metrics::PrometheusText() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream text;
+  text.precision(12);
+  for (const auto& counter : counters_) {
+    text << "# TYPE " << counter.first << " counter\n";
+    for (const auto& series : counter.second) {
+      text << Series(counter.first, series.first) << " " << series.second
+           << "\n";
+    }
+  }
+  for (const auto& gauge : gauges_) {
+    text << "# TYPE " << gauge.first << " gauge\n";
+    for (const auto& series : gauge.second) {
+      text << Series(gauge.first, series.first) << " " << series.second
+           << "\n";
+    }
+  }
+  for (const auto& histogram : histograms_) {
+    text << "# TYPE " << histogram.first << " histogram\n";
+    for (const auto& series : histogram.second) {
+      const Histogram& h = series.second;
+      int64_t cumulative = 0;
+      for (size_t b = 0; b <= kNumDurationBuckets; ++b) {
+        cumulative += h.counts[b];
+        std::ostringstream bound;
+        if (b < kNumDurationBuckets) {
+          bound << kDurationBuckets[b];
+        } else {
+          bound << "+Inf";
+        }
+        text << Series(histogram.first + "_bucket",
+                       JoinLabels(series.first, Label("le", bound.str())))
+             << " " << cumulative << "\n";
+      }
+      text << Series(histogram.first + "_sum", series.first) << " " << h.sum
+           << "\n";
+      text << Series(histogram.first + "_count", series.first) << " "
+           << h.count << "\n";
+    }
+  }
+  return text.str();
+}
+
+nlohmann::json Metrics::ToJson() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json metrics;
+  metrics["counters"] = nlohmann::json::object();
+  metrics["gauges"] = nlohmann::json::object();
+  metrics["histograms"] = nlohmann::json::object();
+  for (const auto& counter : counters_) {
+    for (const auto& series : counter.second) {
+      metrics["counters"][Series(counter.first, series.first)] =
+          series.second;
+    }
+  }
+  for (const auto& gauge : gauges_) {
+    for (const auto& series : gauge.second) {
+      metrics["gauges"][Series(gauge.first, series.first)] = series.second;
+    }
+  }
+  for (const auto& histogram : histograms_) {
+    for (const auto& series : histogram.second) {
+      metrics["histograms"][Series(histogram.first, series.first)] = {
+          {"count", series.second.count}, {"sum", series.second.sum}};
+    }
+  }
+  return metrics;
+}
+
+std::string Label(const std::string& key, const std::string& value) {
+  std::string escaped;
+  for (const char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return key + "=\"" + escaped + "\"";
+}
+
+}  // namespace utils
+}  // namespace OpenICC
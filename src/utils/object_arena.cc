@@ -0,0 +1,152 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/object_arena.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+const size_t kBlockBytes = 1 << 20;
+
+std::atomic<uint64_t> next_arena_id{1};
+
+uintptr_t Align(const uintptr_t address, const size_t alignment) {
+  return (address + alignment - 1) & ~uintptr_t(alignment - 1);
+}
+}  // namespace
+
+//! The shard the calling thread allocates from, cached for the arena it
+//! used last. The shard goes back to its arena once the thread switches to
+//! another arena or exits.
+struct ShardLease {
+  uint64_t arena_id = 0;
+  std::weak_ptr<ObjectArena::State> state;
+  ObjectArena::Shard* shard = nullptr;
+
+  ~ShardLease() { Release(); }
+
+  void Release() {
+    if (const std::shared_ptr<ObjectArena::State> locked = state.lock()) {
+      std::lock_guard<std::mutex> lock(locked->mutex);
+      locked->free_shards.push_back(shard);
+    }
+    arena_id = 0;
+    state.reset();
+    shard = nullptr;
+  }
+};
+
+namespace {
+thread_local ShardLease thread_lease;
+}  // namespace
+
+void* ObjectArena::Shard::Allocate(const size_t size,
+                                   const size_t alignment) {
+  if (!blocks.empty()) {
+    const Block& block = blocks.back();
+    const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+    const uintptr_t start = Align(base + used, alignment);
+    if (start + size <= base + block.size) {
+      used = start + size - base;
+      return reinterpret_cast<void*>(start);
+    }
+  }
+
+  const size_t padded_size = size + alignment;
+  Block block;
+  block.size = std::max(kBlockBytes, padded_size);
+  block.data.reset(new char[block.size]);
+  const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+  const uintptr_t start = Align(base, alignment);
+  if (padded_size > kBlockBytes && !blocks.empty()) {
+    // an object larger than a block gets its own, the partially used block
+    // stays the one to allocate from
+    blocks.insert(blocks.end() - 1, std::move(block));
+  } else {
+    blocks.push_back(std::move(block));
+    used = start + size - base;
+  }
+  return reinterpret_cast<void*>(start);
+}
+
+void ObjectArena::Shard::Clear() {
+  for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+    it->second(it->first);
+  }
+  destructors.clear();
+  if (blocks.size() > 1) {
+    blocks.resize(1);
+  }
+  used = 0;
+}
+
+ObjectArena::ObjectArena()
+    : id_(next_arena_id.fetch_add(1)), state_(std::make_shared<State>()) {}
+
+ObjectArena::~ObjectArena() { Clear(); }
+
+void ObjectArena::Clear() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (const auto& shard : state_->shards) {
+    shard->Clear();
+  }
+}
+
+size_t ObjectArena::NumObjects() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  size_t num_objects = 0;
+  for (const auto& shard : state_->shards) {
+    num_objects += shard->destructors.size();
+  }
+  return num_objects;
+}
+
+size_t ObjectArena::NumBytes() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  size_t num_bytes = 0;
+  for (const auto& shard : state_->shards) {
+    for (const Block& block : shard->blocks) {
+      num_bytes += block.size;
+    }
+  }
+  return num_bytes;
+}
+
+ObjectArena::Shard* ObjectArena::ThreadShard() {
+  ShardLease& lease = thread_lease;
+  if (lease.arena_id == id_) {
+    return lease.shard;
+  }
+  lease.Release();
+
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  if (state_->free_shards.empty()) {
+    state_->shards.emplace_back(new Shard);
+    lease.shard = state_->shards.back().get();
+  } else {
+    lease.shard = state_->free_shards.back();
+    state_->free_shards.pop_back();
+  }
+  lease.arena_id = id_;
+  lease.state = state_;
+  return lease.shard;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
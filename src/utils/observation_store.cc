@@ -0,0 +1,112 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/observation_store.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+void ObservationStore::Build(theia::Reconstruction* reconstruction) {
+  Clear();
+  reconstruction_ = reconstruction;
+
+  std::vector<theia::ViewId> view_ids = reconstruction->ViewIds();
+  std::sort(view_ids.begin(),
+            view_ids.end(),
+            [&](const theia::ViewId a, const theia::ViewId b) {
+              const double t_a = reconstruction->View(a)->GetTimestamp();
+              const double t_b = reconstruction->View(b)->GetTimestamp();
+              return t_a < t_b || (t_a == t_b && a < b);
+            });
+
+  size_t num_observations = 0;
+  for (const theia::ViewId view_id : view_ids) {
+    num_observations += reconstruction->View(view_id)->NumFeatures();
+  }
+  track_ids_.reserve(num_observations);
+  point_indices_.reserve(num_observations);
+  observations_.reserve(kStride * num_observations);
+  views_.reserve(view_ids.size());
+
+  std::unordered_map<theia::TrackId, uint32_t> point_of_track;
+  for (const theia::ViewId view_id : view_ids) {
+    const theia::View* view = reconstruction->View(view_id);
+    View entry;
+    entry.view_id = view_id;
+    entry.camera = &view->Camera();
+    entry.timestamp_s = view->GetTimestamp();
+    entry.first = track_ids_.size();
+    for (const theia::TrackId track_id : view->TrackIds()) {
+      theia::Track* track = reconstruction->MutableTrack(track_id);
+      if (track == nullptr) {
+        continue;
+      }
+      const auto point = point_of_track.emplace(track_id, points_.size());
+      if (point.second) {
+        points_.push_back(track->MutablePoint()->data());
+      }
+      const theia::Feature& feature = *view->GetFeature(track_id);
+      track_ids_.push_back(track_id);
+      point_indices_.push_back(point.first->second);
+      observations_.push_back(feature.x());
+      observations_.push_back(feature.y());
+      observations_.push_back(1. / std::sqrt(feature.covariance_(0, 0)));
+      observations_.push_back(1. / std::sqrt(feature.covariance_(1, 1)));
+    }
+    entry.num = track_ids_.size() - entry.first;
+    view_indices_[view] = views_.size();
+    view_id_indices_[view_id] = views_.size();
+    views_.push_back(entry);
+  }
+}
+
+void ObservationStore::Clear() {
+  reconstruction_ = nullptr;
+  views_.clear();
+  view_indices_.clear();
+  view_id_indices_.clear();
+  track_ids_.clear();
+  observations_.clear();
+  point_indices_.clear();
+  points_.clear();
+}
+
+int ObservationStore::ViewIndex(const theia::View* view) const {
+  const auto it = view_indices_.find(view);
+  if (it != view_indices_.end()) {
+    return it->second;
+  }
+  if (reconstruction_ == nullptr || view == nullptr) {
+    return -1;
+  }
+  const auto id_it =
+      view_id_indices_.find(reconstruction_->ViewIdFromName(view->Name()));
+  return id_it != view_id_indices_.end() ? static_cast<int>(id_it->second)
+                                         : -1;
+}
+
+size_t ObservationStore::NumBytes() const {
+  return views_.capacity() * sizeof(View) +
+         track_ids_.capacity() * sizeof(theia::TrackId) +
+         observations_.capacity() * sizeof(double) +
+         point_indices_.capacity() * sizeof(uint32_t) +
+         points_.capacity() * sizeof(double*);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
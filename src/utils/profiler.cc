@@ -0,0 +1,191 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/utils/cpu_affinity.h"
+#include "OpenCameraCalibrator/utils/executor.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/memory_budget.h"
+#include "OpenCameraCalibrator/utils/metrics.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+// nesting depth of the running stages of this thread
+thread_local int stage_depth = 0;
+// innermost stage listener of this thread
+thread_local ScopedStageListener* stage_listener = nullptr;
+}  // namespace
+
+Profiler& Profiler::Instance() {
+  static Profiler profiler;
+  return profiler;
+}
+
+void Profiler::AddStage(const StageRecord& stage) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stages_.push_back(stage);
+}
+
+std::vector<StageRecord> Profiler::Stages() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stages_;
+}
+
+bool Profiler::WriteChromeTrace(const std::string& output_path) {
+  nlohmann::json trace;
+  trace["displayTimeUnit"] = "ms";
+  trace["traceEvents"] = nlohmann::json::array();
+  for (const StageRecord& stage : Stages()) {
+    nlohmann::json event;
+    event["name"] = stage.name;
+    event["ph"] = "X";
+    event["ts"] = stage.start_us;
+    event["dur"] = stage.wall_time_us;
+    event["pid"] = 0;
+    event["tid"] = 0;
+    event["args"]["cpu_time_us"] = stage.cpu_time_us;
+    event["args"]["peak_rss_kb"] = stage.peak_rss_kb;
+    event["args"]["rss_kb"] = stage.rss_kb;
+    event["args"]["spilled_kb"] = stage.spilled_kb;
+    event["args"]["num_items"] = stage.num_items;
+    event["args"]["depth"] = stage.depth;
+    event["args"]["numa_node"] = stage.numa_node;
+    event["args"]["cross_node_tasks"] = stage.cross_node_tasks;
+    trace["traceEvents"].push_back(event);
+  }
+
+  std::ofstream trace_file(output_path);
+  if (!trace_file.is_open()) {
+    LOG(ERROR) << "Could not open profile output file: " << output_path;
+    return false;
+  }
+  trace_file << std::setw(2) << trace << std::endl;
+  return true;
+}
+
+int64_t Profiler::NowUs() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+int64_t ProcessCpuTimeUs() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+int64_t PeakResidentSetSizeKb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // kilobytes on linux
+  return usage.ru_maxrss;
+}
+
+int64_t ResidentSetSizeKb() {
+  std::ifstream statm("/proc/self/statm");
+  int64_t size_pages = 0, resident_pages = 0;
+  if (!(statm >> size_pages >> resident_pages)) {
+    return 0;
+  }
+  return resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+ScopedStageListener::ScopedStageListener(
+    std::function<void(const StageRecord&)> listener)
+    : listener_(std::move(listener)), previous_(stage_listener) {
+  stage_listener = this;
+}
+
+ScopedStageListener::~ScopedStageListener() { stage_listener = previous_; }
+
+bool ScopedStageListener::Active() { return stage_listener != nullptr; }
+
+void ScopedStageListener::Notify(const StageRecord& stage) {
+  if (stage_listener) {
+    stage_listener->listener_(stage);
+  }
+}
+
+ScopedStageTimer::ScopedStageTimer(const std::string& name)
+    : enabled_(Profiler::Instance().Enabled() ||
+               Metrics::Instance().Enabled() ||
+               ScopedStageListener::Active()) {
+  if (!enabled_) {
+    return;
+  }
+  stage_.name = name;
+  stage_.depth = stage_depth++;
+  stage_.cpu_time_us = ProcessCpuTimeUs();
+  stage_.numa_node = CurrentNumaNode();
+  stage_.cross_node_tasks = Executor::Global().NumCrossNodeTasks();
+  stage_.start_us = Profiler::Instance().NowUs();
+}
+
+ScopedStageTimer::~ScopedStageTimer() {
+  if (!enabled_) {
+    return;
+  }
+  --stage_depth;
+  stage_.wall_time_us = Profiler::Instance().NowUs() - stage_.start_us;
+  stage_.cpu_time_us = ProcessCpuTimeUs() - stage_.cpu_time_us;
+  stage_.peak_rss_kb = PeakResidentSetSizeKb();
+  stage_.rss_kb = ResidentSetSizeKb();
+  stage_.spilled_kb = MemoryBudget::Instance().SpilledBytes() / 1024;
+  stage_.cross_node_tasks =
+      Executor::Global().NumCrossNodeTasks() - stage_.cross_node_tasks;
+  if (Profiler::Instance().Enabled()) {
+    Profiler::Instance().AddStage(stage_);
+  }
+  Metrics::Instance().ObserveStage(stage_);
+  ScopedStageListener::Notify(stage_);
+}
+
+ScopedProfileWriter::ScopedProfileWriter(const std::string& output_path,
+                                         const std::string& run_name)
+    : output_path_(output_path) {
+  if (output_path_.empty()) {
+    return;
+  }
+  Profiler::Instance().Enable();
+  run_timer_ = std::make_unique<ScopedStageTimer>(run_name);
+}
+
+ScopedProfileWriter::~ScopedProfileWriter() {
+  if (output_path_.empty()) {
+    return;
+  }
+  // record the whole run before writing
+  run_timer_.reset();
+  if (Profiler::Instance().WriteChromeTrace(output_path_)) {
+    LOG(INFO) << "Wrote profile to " << output_path_;
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,138 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/reprojection_error.h"
+
+#include "OpenCameraCalibrator/utils/camera_model_dispatch.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+//! Per thread buffers, reused over the views of a thread
+struct ReprojectionBuffers {
+  Eigen::Matrix4Xd points_world;
+  Eigen::Matrix3Xd points_cam;
+  Eigen::Matrix2Xd observations;
+  std::vector<double> errors;
+};
+
+ViewReprojectionError ReprojectView(const theia::Reconstruction& recon_dataset,
+                                    const theia::ViewId v_id,
+                                    ReprojectionBuffers& buffers) {
+  ViewReprojectionError view_error;
+  view_error.view_id = v_id;
+  const theia::View* view = recon_dataset.View(v_id);
+  if (!view) {
+    return view_error;
+  }
+  const std::vector<theia::TrackId> track_ids = view->TrackIds();
+  const size_t num_obs = track_ids.size();
+
+  // gather once, the lookups are the expensive part
+  buffers.points_world.resize(4, num_obs);
+  buffers.observations.resize(2, num_obs);
+  for (size_t i = 0; i < num_obs; ++i) {
+    buffers.points_world.col(i) = recon_dataset.Track(track_ids[i])->Point();
+    buffers.observations.col(i) = view->GetFeature(track_ids[i])->point_;
+  }
+
+  // world to camera frame for all points at once, homogeneous points as in
+  // theia::Camera::ProjectPoint
+  const theia::Camera& camera = view->Camera();
+  const Eigen::Matrix3d R_c_w = camera.GetOrientationAsRotationMatrix();
+  const Eigen::Vector3d position = camera.GetPosition();
+  buffers.points_cam.noalias() =
+      R_c_w * (buffers.points_world.topRows<3>() -
+               position * buffers.points_world.row(3));
+
+  buffers.errors.clear();
+  const double* intrinsics = camera.intrinsics();
+  const bool supported = DispatchCameraModel(
+      camera.GetCameraIntrinsicsModelType(), [&](auto model_tag) {
+        using CameraModel = typename decltype(model_tag)::CameraModel;
+        for (size_t i = 0; i < num_obs; ++i) {
+          Eigen::Vector2d pixel;
+          if (CameraModel::CameraToPixelCoordinates(
+                  intrinsics, buffers.points_cam.col(i).data(), pixel.data())) {
+            buffers.errors.push_back(
+                (pixel - buffers.observations.col(i)).norm());
+          }
+        }
+        return true;
+      });
+  if (!supported) {
+    // other camera models go through the camera
+    for (size_t i = 0; i < num_obs; ++i) {
+      Eigen::Vector2d pixel;
+      camera.ProjectPoint(buffers.points_world.col(i), &pixel);
+      buffers.errors.push_back((pixel - buffers.observations.col(i)).norm());
+    }
+  }
+
+  view_error.num_observations = buffers.errors.size();
+  view_error.num_invalid = num_obs - buffers.errors.size();
+  if (buffers.errors.empty()) {
+    return view_error;
+  }
+  double sum = 0.0, sum_sq = 0.0;
+  for (const double e : buffers.errors) {
+    sum += e;
+    sum_sq += e * e;
+    view_error.max = std::max(view_error.max, e);
+  }
+  const double n = static_cast<double>(buffers.errors.size());
+  view_error.mean = sum / n;
+  view_error.rmse = std::sqrt(sum_sq / n);
+  auto median_it = buffers.errors.begin() + buffers.errors.size() / 2;
+  std::nth_element(buffers.errors.begin(), median_it, buffers.errors.end());
+  view_error.median = *median_it;
+  return view_error;
+}
+
+}  // namespace
+
+ViewReprojectionError ComputeViewReprojectionError(
+    const theia::Reconstruction& recon_dataset, const theia::ViewId v_id) {
+  ReprojectionBuffers buffers;
+  return ReprojectView(recon_dataset, v_id, buffers);
+}
+
+void ComputeViewReprojectionErrors(
+    const theia::Reconstruction& recon_dataset,
+    const std::vector<theia::ViewId>& view_ids,
+    std::vector<ViewReprojectionError>& errors,
+    const int num_threads) {
+  errors.resize(view_ids.size());
+  ParallelFor(
+      view_ids.size(),
+      num_threads,
+      [&](const size_t begin, const size_t end, const int /*thread_idx*/) {
+        ReprojectionBuffers buffers;
+        for (size_t i = begin; i < end; ++i) {
+          errors[i] = ReprojectView(recon_dataset, view_ids[i], buffers);
+        }
+      });
+}
+
+}  // namespace utils
+}  // namespace OpenICC
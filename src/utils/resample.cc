@@ -0,0 +1,204 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/resample.h"
+
+#include <cmath>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+//! Calls emit(i, idx, fraction) for every grid sample i, which lies at
+//! fraction between the source samples idx and idx + 1
+template <class TimeAt, class Emit>
+void MergeGrid(const size_t num_source,
+               const TimeAt& time_at,
+               const UniformGrid& grid,
+               const int num_threads,
+               const Emit& emit) {
+  ParallelFor(
+      grid.num_samples, num_threads, [&](size_t begin, size_t end, int) {
+        // last source sample not after the first grid time of the chunk
+        const double t_begin = grid.Time(begin);
+        size_t lo = 0, hi = num_source;
+        while (lo < hi) {
+          const size_t mid = lo + (hi - lo) / 2;
+          if (time_at(mid) <= t_begin) {
+            lo = mid + 1;
+          } else {
+            hi = mid;
+          }
+        }
+        size_t idx = lo > 0 ? lo - 1 : 0;
+        for (size_t i = begin; i < end; ++i) {
+          const double t = grid.Time(i);
+          while (idx + 1 < num_source && time_at(idx + 1) <= t) {
+            ++idx;
+          }
+          double fraction = 0.0;
+          if (idx + 1 < num_source && t > time_at(idx)) {
+            fraction =
+                (t - time_at(idx)) / (time_at(idx + 1) - time_at(idx));
+          }
+          emit(i, idx, fraction);
+        }
+      });
+}
+
+template <class T, class Alloc, class Interpolate>
+void ResampleValues(const std::vector<double>& timestamps_s,
+                    const std::vector<T, Alloc>& values,
+                    const UniformGrid& grid,
+                    std::vector<T, Alloc>& resampled,
+                    const int num_threads,
+                    const Interpolate& interpolate) {
+  if (timestamps_s.empty()) {
+    resampled.clear();
+    return;
+  }
+  resampled.resize(grid.num_samples);
+  MergeGrid(
+      timestamps_s.size(),
+      [&timestamps_s](const size_t i) { return timestamps_s[i]; },
+      grid,
+      num_threads,
+      [&](const size_t i, const size_t idx, const double fraction) {
+        resampled[i] = fraction > 0.0
+                           ? interpolate(values[idx], values[idx + 1], fraction)
+                           : values[idx];
+      });
+}
+
+}  // namespace
+
+UniformGrid MakeUniformGrid(const double first_s,
+                            const double last_s,
+                            const double dt_s) {
+  UniformGrid grid;
+  grid.start_s = first_s;
+  grid.dt_s = dt_s;
+  if (dt_s > 0.0 && last_s >= first_s) {
+    // a small tolerance keeps last_s on the grid despite rounding
+    grid.num_samples =
+        static_cast<size_t>(std::floor((last_s - first_s) / dt_s + 1e-9)) + 1;
+  }
+  return grid;
+}
+
+UniformGrid MakeUniformGrid(const std::vector<double>& timestamps_s) {
+  UniformGrid grid;
+  grid.num_samples = timestamps_s.size();
+  if (!timestamps_s.empty()) {
+    grid.start_s = timestamps_s.front();
+  }
+  if (timestamps_s.size() > 1) {
+    grid.dt_s = (timestamps_s.back() - timestamps_s.front()) /
+                (timestamps_s.size() - 1);
+  }
+  return grid;
+}
+
+UniformGrid MakeUniformGrid(const ImuReadings& readings) {
+  UniformGrid grid;
+  grid.num_samples = readings.size();
+  if (!readings.empty()) {
+    grid.start_s = readings.front().timestamp_s();
+  }
+  if (readings.size() > 1) {
+    grid.dt_s =
+        (readings.back().timestamp_s() - readings.front().timestamp_s()) /
+        (readings.size() - 1);
+  }
+  return grid;
+}
+
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const std::vector<double>& values,
+                     const UniformGrid& grid,
+                     std::vector<double>& resampled,
+                     const int num_threads) {
+  ResampleValues(
+      timestamps_s,
+      values,
+      grid,
+      resampled,
+      num_threads,
+      [](const double v0, const double v1, const double fraction) {
+        return (1.0 - fraction) * v0 + fraction * v1;
+      });
+}
+
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const vec3_vector& values,
+                     const UniformGrid& grid,
+                     vec3_vector& resampled,
+                     const int num_threads) {
+  ResampleValues(timestamps_s,
+                 values,
+                 grid,
+                 resampled,
+                 num_threads,
+                 [](const Eigen::Vector3d& v0,
+                    const Eigen::Vector3d& v1,
+                    const double fraction) -> Eigen::Vector3d {
+                   return (1.0 - fraction) * v0 + fraction * v1;
+                 });
+}
+
+void ResampleUniform(const std::vector<double>& timestamps_s,
+                     const quat_vector& values,
+                     const UniformGrid& grid,
+                     quat_vector& resampled,
+                     const int num_threads) {
+  ResampleValues(timestamps_s,
+                 values,
+                 grid,
+                 resampled,
+                 num_threads,
+                 [](const Eigen::Quaterniond& q0,
+                    const Eigen::Quaterniond& q1,
+                    const double fraction) { return q0.slerp(fraction, q1); });
+}
+
+void ResampleUniform(const ImuReadings& readings,
+                     const UniformGrid& grid,
+                     ImuReadings& resampled,
+                     const int num_threads) {
+  if (readings.empty()) {
+    resampled.clear();
+    return;
+  }
+  resampled.resize(grid.num_samples);
+  MergeGrid(
+      readings.size(),
+      [&readings](const size_t i) { return readings[i].timestamp_s(); },
+      grid,
+      num_threads,
+      [&](const size_t i, const size_t idx, const double fraction) {
+        Eigen::Vector3d value = readings[idx].data();
+        if (fraction > 0.0) {
+          value =
+              (1.0 - fraction) * value + fraction * readings[idx + 1].data();
+        }
+        resampled[i] = ImuReading<double>(grid.Time(i), value);
+      });
+}
+
+}  // namespace utils
+}  // namespace OpenICC
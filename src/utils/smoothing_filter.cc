@@ -0,0 +1,89 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/smoothing_filter.h"
+
+#include <Eigen/Dense>
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+Eigen::MatrixXd SavitzkyGolayCoefficients(const int window,
+                                          const int polynomial_order) {
+  // Vandermonde matrix of the sample positions, scaled to [-1, 1] to keep
+  // it well conditioned for larger windows
+  const double half = 0.5 * (window - 1);
+  Eigen::MatrixXd V(window, polynomial_order + 1);
+  for (int j = 0; j < window; ++j) {
+    const double x = half > 0.0 ? (j - half) / half : 0.0;
+    double x_pow = 1.0;
+    for (int p = 0; p <= polynomial_order; ++p) {
+      V(j, p) = x_pow;
+      x_pow *= x;
+    }
+  }
+  // hat matrix V (V^T V)^-1 V^T of the least squares fit
+  const Eigen::MatrixXd VtV = V.transpose() * V;
+  return V * VtV.ldlt().solve(V.transpose());
+}
+
+void ButterworthLowPassCoefficients(const double cutoff,
+                                    Eigen::Vector3d& b,
+                                    Eigen::Vector3d& a) {
+  // bilinear transform of the analog prototype with prewarped cutoff
+  const double c = std::min(std::max(cutoff, 1e-6), 0.5 - 1e-6);
+  const double K = std::tan(M_PI * c);
+  const double K2 = K * K;
+  const double norm = 1.0 / (1.0 + M_SQRT2 * K + K2);
+  b[0] = K2 * norm;
+  b[1] = 2.0 * b[0];
+  b[2] = b[0];
+  a[0] = 1.0;
+  a[1] = 2.0 * (K2 - 1.0) * norm;
+  a[2] = (1.0 - M_SQRT2 * K + K2) * norm;
+}
+
+void DecimateByBlockAverage(const std::vector<double>& timestamps,
+                            const vec3_vector& samples,
+                            const int factor,
+                            std::vector<double>& decimated_timestamps,
+                            vec3_vector& decimated_samples) {
+  if (factor < 2) {
+    decimated_timestamps = timestamps;
+    decimated_samples = samples;
+    return;
+  }
+  const size_t n = std::min(timestamps.size(), samples.size());
+  const size_t nr_blocks = (n + factor - 1) / factor;
+  decimated_timestamps.resize(nr_blocks);
+  decimated_samples.resize(nr_blocks);
+  for (size_t b = 0; b < nr_blocks; ++b) {
+    const size_t first = b * factor;
+    const size_t last = std::min(first + factor, n);
+    double t_sum = 0.0;
+    Eigen::Vector3d sample_sum = Eigen::Vector3d::Zero();
+    for (size_t i = first; i < last; ++i) {
+      t_sum += timestamps[i];
+      sample_sum += samples[i];
+    }
+    const double inv_count = 1.0 / static_cast<double>(last - first);
+    decimated_timestamps[b] = t_sum * inv_count;
+    decimated_samples[b] = sample_sum * inv_count;
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,224 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/spline_error_weighting.h"
+
+#include <unsupported/Eigen/FFT>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/resample.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+// frequency response of cubic B-spline interpolation with knot spacing dt,
+// normalized to 1 at f = 0 [Mihajlovic1999]
+double SplineInterpolationResponse(const double freq_hz, const double dt) {
+  const double x = freq_hz * dt;
+  const double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+  return 3.0 * std::pow(sinc, 4) / (2.0 + std::cos(2.0 * M_PI * x));
+}
+
+// one sided spectrum of a real signal of length n, the bins between DC and
+// Nyquist stand for their negative frequency as well
+struct HalfSpectrum {
+  size_t n = 0;
+  std::vector<double> magnitude;
+  std::vector<double> freqs_hz;
+  std::vector<double> multiplicity;
+};
+
+// energy of the reference spectrum that the spline does not reproduce
+double RemovedEnergy(const HalfSpectrum& spectrum, const double dt) {
+  double energy = 0.0;
+  for (size_t k = 0; k < spectrum.magnitude.size(); ++k) {
+    const double removed =
+        (1.0 - SplineInterpolationResponse(spectrum.freqs_hz[k], dt)) *
+        spectrum.magnitude[k];
+    energy += spectrum.multiplicity[k] * removed * removed;
+  }
+  return energy / spectrum.n;
+}
+
+// largest length <= n without prime factors above 5, the mixed radix FFT
+// is fast for these and slow for lengths with large prime factors
+size_t FastFftLength(const size_t n) {
+  for (size_t m = n; m > 1; --m) {
+    size_t r = m;
+    for (const size_t p : {2, 3, 5}) {
+      while (r % p == 0) {
+        r /= p;
+      }
+    }
+    if (r == 1) {
+      return m;
+    }
+  }
+  return n;
+}
+
+}  // namespace
+
+bool KnotSpacingAndVariance(const ImuReadings& signal,
+                            const double quality,
+                            const double min_dt,
+                            const double max_dt,
+                            double& dt,
+                            double& variance,
+                            const int num_threads) {
+  if (signal.size() < 4 || min_dt <= 0.0 || max_dt < min_dt) {
+    return false;
+  }
+  // the spectrum needs a uniform sampling, the few samples beyond a fast FFT
+  // length are dropped
+  UniformGrid grid = MakeUniformGrid(signal);
+  if (grid.dt_s <= 0.0) {
+    return false;
+  }
+  grid.num_samples = FastFftLength(grid.num_samples);
+  const size_t n = grid.num_samples;
+  const double sample_rate = 1.0 / grid.dt_s;
+  ImuReadings uniform_signal;
+  ResampleUniform(signal, grid, uniform_signal, num_threads);
+
+  // reference spectrum, the norm over the axes without the DC component.
+  // The axes are transformed in parallel, each with its own FFT plan
+  HalfSpectrum spectrum;
+  spectrum.n = n;
+  const size_t num_bins = n / 2 + 1;
+  std::vector<std::vector<double>> axis_power(3);
+  ParallelFor(3, num_threads, [&](size_t begin, size_t end, int) {
+    Eigen::FFT<double> fft;
+    fft.SetFlag(Eigen::FFT<double>::HalfSpectrum);
+    std::vector<double> axis(n);
+    std::vector<std::complex<double>> axis_spectrum;
+    for (size_t d = begin; d < end; ++d) {
+      for (size_t i = 0; i < n; ++i) {
+        axis[i] = uniform_signal[i](d);
+      }
+      fft.fwd(axis_spectrum, axis);
+      axis_power[d].resize(num_bins);
+      for (size_t k = 0; k < num_bins; ++k) {
+        axis_power[d][k] = std::norm(axis_spectrum[k]);
+      }
+    }
+  });
+  spectrum.magnitude.resize(num_bins);
+  spectrum.freqs_hz.resize(num_bins);
+  spectrum.multiplicity.resize(num_bins);
+  double energy = 0.0;
+  for (size_t k = 0; k < num_bins; ++k) {
+    const double power =
+        k == 0 ? 0.0 : axis_power[0][k] + axis_power[1][k] + axis_power[2][k];
+    const double magnitude = std::sqrt(power / 3.0);
+    spectrum.magnitude[k] = magnitude;
+    spectrum.freqs_hz[k] = k * sample_rate / n;
+    spectrum.multiplicity[k] = k == 0 || 2 * k == n ? 1.0 : 2.0;
+    energy += spectrum.multiplicity[k] * magnitude * magnitude;
+  }
+  energy /= n;
+  if (energy <= 0.0) {
+    return false;
+  }
+
+  const double max_removed = energy * (1.0 - quality);
+  auto keeps_quality = [&](const double dt_test) {
+    return RemovedEnergy(spectrum, dt_test) <= max_removed;
+  };
+
+  // backtrack from max_dt with halving steps until the quality is reached,
+  // then bisect between that spacing and max_dt
+  dt = max_dt;
+  if (!keeps_quality(dt)) {
+    double best_dt = min_dt;
+    double min_removed = RemovedEnergy(spectrum, min_dt);
+    double step = 0.5 * max_dt;
+    double dt_good = -1.0;
+    while (dt > min_dt) {
+      dt = std::max(dt - step, min_dt);
+      const double removed = RemovedEnergy(spectrum, dt);
+      if (removed <= max_removed) {
+        dt_good = dt;
+        break;
+      }
+      if (removed < min_removed) {
+        min_removed = removed;
+        best_dt = dt;
+      }
+      step *= 0.5;
+    }
+    if (dt_good < 0.0) {
+      // no spacing reaches the quality, use the best one
+      dt = best_dt;
+    } else {
+      double dt_bad = max_dt;
+      while (dt_bad - dt_good > 1e-6 * max_dt) {
+        const double dt_mid = 0.5 * (dt_good + dt_bad);
+        if (keeps_quality(dt_mid)) {
+          dt_good = dt_mid;
+        } else {
+          dt_bad = dt_mid;
+        }
+      }
+      dt = dt_good;
+    }
+  }
+  variance = RemovedEnergy(spectrum, dt) / n;
+  return true;
+}
+
+bool SplineWeightingFromTelemetry(const CameraTelemetryData& telemetry,
+                                  const double quality_so3,
+                                  const double quality_r3,
+                                  SplineWeightingData& weighting,
+                                  const int num_threads) {
+  // both signals in parallel, the threads left over go to their axes
+  const ImuReadings* signals[2] = {&telemetry.gyroscope,
+                                   &telemetry.accelerometer};
+  const double qualities[2] = {quality_so3, quality_r3};
+  const double max_dts[2] = {0.2, 0.15};
+  double dts[2], variances[2];
+  bool estimated[2] = {false, false};
+  const int threads_per_signal = std::max(1, num_threads / 2);
+  ParallelFor(2, num_threads, [&](size_t begin, size_t end, int) {
+    for (size_t i = begin; i < end; ++i) {
+      estimated[i] = KnotSpacingAndVariance(*signals[i],
+                                            qualities[i],
+                                            0.01,
+                                            max_dts[i],
+                                            dts[i],
+                                            variances[i],
+                                            threads_per_signal);
+    }
+  });
+  if (!estimated[0] || !estimated[1]) {
+    return false;
+  }
+  weighting.dt_so3 = dts[0];
+  weighting.dt_r3 = dts[1];
+  weighting.std_so3 = std::sqrt(variances[0]);
+  weighting.std_r3 = std::sqrt(variances[1]);
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
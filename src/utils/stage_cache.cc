@@ -0,0 +1,169 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/stage_cache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include <glog/logging.h>
+
+namespace fs = std::filesystem;
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+const uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+const size_t kReadChunkBytes = 1 << 20;
+}  // namespace
+
+StageCache::StageCache(const std::string& cache_dir,
+                       const std::string& stage_name)
+    : cache_dir_(cache_dir), stage_name_(stage_name), hash_(kFnvOffsetBasis) {
+  AddString(stage_name_);
+}
+
+void StageCache::AddBytes(const char* data, const size_t num_bytes) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    hash_ ^= static_cast<uint8_t>(data[i]);
+    hash_ *= kFnvPrime;
+  }
+}
+
+void StageCache::AddString(const std::string& str) {
+  // prefix the length so that consecutive strings can not run into another
+  const uint64_t size = str.size();
+  AddBytes(reinterpret_cast<const char*>(&size), sizeof(size));
+  AddBytes(str.data(), str.size());
+}
+
+void StageCache::AddFile(const std::string& path) {
+  if (!Enabled()) {
+    return;
+  }
+  // remote objects are keyed by their URL without the query, presigned URLs
+  // carry a new signature every time
+  if (path.find("://") != std::string::npos) {
+    AddString(path.substr(0, path.find('?')));
+    return;
+  }
+  std::error_code error;
+  if (fs::is_directory(path, error)) {
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::recursive_directory_iterator(path, error)) {
+      if (entry.is_regular_file()) {
+        files.push_back(entry.path());
+      }
+    }
+    std::sort(files.begin(), files.end());
+    AddValue("num_files", files.size());
+    for (const fs::path& file : files) {
+      AddString(fs::relative(file, path).string());
+      AddFile(file.string());
+    }
+    return;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    AddString("missing");
+    return;
+  }
+  std::vector<char> buffer(kReadChunkBytes);
+  uint64_t num_bytes = 0;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    AddBytes(buffer.data(), file.gcount());
+    num_bytes += file.gcount();
+  }
+  AddValue("num_bytes", num_bytes);
+}
+
+std::string StageCache::Key() const {
+  std::ostringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash_;
+  return ss.str();
+}
+
+std::string StageCache::EntryDir() const {
+  return (fs::path(cache_dir_) / stage_name_ / Key()).string();
+}
+
+bool StageCache::Fetch(const std::vector<std::string>& output_paths) const {
+  if (!Enabled()) {
+    return false;
+  }
+  const fs::path entry_dir(EntryDir());
+  std::error_code error;
+  for (size_t i = 0; i < output_paths.size(); ++i) {
+    if (!fs::is_regular_file(entry_dir / std::to_string(i), error)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < output_paths.size(); ++i) {
+    if (!fs::copy_file(entry_dir / std::to_string(i),
+                       output_paths[i],
+                       fs::copy_options::overwrite_existing,
+                       error)) {
+      LOG(ERROR) << "Could not copy cache entry " << entry_dir << " to "
+                 << output_paths[i] << ": " << error.message();
+      return false;
+    }
+  }
+  LOG(INFO) << "Fetched " << stage_name_ << " outputs from cache entry "
+            << Key();
+  return true;
+}
+
+bool StageCache::Store(const std::vector<std::string>& output_paths) const {
+  if (!Enabled()) {
+    return true;
+  }
+  const fs::path entry_dir(EntryDir());
+  // the entry is assembled next to its final place and renamed at once,
+  // concurrent runs of the same stage each use their own part directory
+  const fs::path part_dir(entry_dir.string() + ".part" +
+                          std::to_string(getpid()));
+  std::error_code error;
+  fs::remove_all(part_dir, error);
+  if (!fs::create_directories(part_dir, error)) {
+    LOG(ERROR) << "Could not create cache directory " << part_dir << ": "
+               << error.message();
+    return false;
+  }
+  for (size_t i = 0; i < output_paths.size(); ++i) {
+    if (!fs::copy_file(output_paths[i], part_dir / std::to_string(i), error)) {
+      LOG(ERROR) << "Could not store " << output_paths[i]
+                 << " in the cache: " << error.message();
+      fs::remove_all(part_dir, error);
+      return false;
+    }
+  }
+  fs::rename(part_dir, entry_dir, error);
+  if (error) {
+    // another run stored the same entry in the meantime
+    fs::remove_all(part_dir, error);
+    return fs::is_directory(entry_dir, error);
+  }
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,132 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/undistortion_map.h"
+
+#include "OpenCameraCalibrator/utils/camera_model_dispatch.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace OpenICC {
+namespace utils {
+
+void UndistortionMap::Build(const theia::Camera& camera,
+                            const double cell_size_px,
+                            const int newton_steps,
+                            const int num_threads) {
+  camera_ = camera;
+  cell_size_px_ = cell_size_px > 0.0 ? cell_size_px : 16.0;
+  newton_steps_ = newton_steps;
+  project_ = nullptr;
+  DispatchCameraModel(
+      camera_.GetCameraIntrinsicsModelType(), [this](auto model_tag) {
+        using CameraModel = typename decltype(model_tag)::CameraModel;
+        project_ = &CameraModel::template CameraToPixelCoordinates<double>;
+        return true;
+      });
+
+  cols_ = static_cast<int>(std::ceil(camera_.ImageWidth() / cell_size_px_)) +
+          1;
+  rows_ = static_cast<int>(std::ceil(camera_.ImageHeight() / cell_size_px_)) +
+          1;
+  nodes_.resize(static_cast<size_t>(cols_) * rows_);
+  ParallelFor(rows_, num_threads, [&](size_t begin, size_t end, int) {
+    for (size_t r = begin; r < end; ++r) {
+      for (int c = 0; c < cols_; ++c) {
+        const Eigen::Vector3d ray = camera_.PixelToNormalizedCoordinates(
+            Eigen::Vector2d(c * cell_size_px_, r * cell_size_px_));
+        // rays behind the camera can not be interpolated
+        nodes_[r * cols_ + c] =
+            ray[2] > 0.0 && ray.allFinite()
+                ? Eigen::Vector2d(ray.hnormalized())
+                : Eigen::Vector2d::Constant(
+                      std::numeric_limits<double>::quiet_NaN());
+      }
+    }
+  });
+}
+
+void UndistortionMap::Clear() {
+  nodes_.clear();
+  cols_ = 0;
+  rows_ = 0;
+}
+
+bool UndistortionMap::Matches(const theia::Camera& camera) const {
+  if (Empty() ||
+      camera.GetCameraIntrinsicsModelType() !=
+          camera_.GetCameraIntrinsicsModelType() ||
+      camera.ImageWidth() != camera_.ImageWidth() ||
+      camera.ImageHeight() != camera_.ImageHeight()) {
+    return false;
+  }
+  const int num_parameters = camera.CameraIntrinsics()->NumParameters();
+  return std::equal(camera.intrinsics(),
+                    camera.intrinsics() + num_parameters,
+                    camera_.intrinsics());
+}
+
+Eigen::Vector2d UndistortionMap::PixelToNormalized(
+    const Eigen::Vector2d& pixel) const {
+  const double gx = pixel[0] / cell_size_px_;
+  const double gy = pixel[1] / cell_size_px_;
+  const int c = static_cast<int>(std::floor(gx));
+  const int r = static_cast<int>(std::floor(gy));
+  if (c < 0 || r < 0 || c + 1 >= cols_ || r + 1 >= rows_) {
+    return camera_.PixelToNormalizedCoordinates(pixel).hnormalized();
+  }
+  const Eigen::Vector2d& n00 = nodes_[r * cols_ + c];
+  const Eigen::Vector2d& n10 = nodes_[r * cols_ + c + 1];
+  const Eigen::Vector2d& n01 = nodes_[(r + 1) * cols_ + c];
+  const Eigen::Vector2d& n11 = nodes_[(r + 1) * cols_ + c + 1];
+  if (!(n00.allFinite() && n10.allFinite() && n01.allFinite() &&
+        n11.allFinite())) {
+    return camera_.PixelToNormalizedCoordinates(pixel).hnormalized();
+  }
+
+  const double fx = gx - c;
+  const double fy = gy - r;
+  Eigen::Vector2d normalized =
+      (1.0 - fy) * ((1.0 - fx) * n00 + fx * n10) +
+      fy * ((1.0 - fx) * n01 + fx * n11);
+  if (!project_ || newton_steps_ <= 0) {
+    return normalized;
+  }
+
+  // the derivative of the interpolation w.r.t. the pixel approximates the
+  // inverse of the projection Jacobian
+  Eigen::Matrix2d d_normalized_d_pixel;
+  d_normalized_d_pixel.col(0) =
+      ((1.0 - fy) * (n10 - n00) + fy * (n11 - n01)) / cell_size_px_;
+  d_normalized_d_pixel.col(1) =
+      ((1.0 - fx) * (n01 - n00) + fx * (n11 - n10)) / cell_size_px_;
+  for (int i = 0; i < newton_steps_; ++i) {
+    const Eigen::Vector3d point(normalized[0], normalized[1], 1.0);
+    Eigen::Vector2d projected;
+    if (!project_(camera_.intrinsics(), point.data(), projected.data())) {
+      break;
+    }
+    normalized -= d_normalized_d_pixel * (projected - pixel);
+  }
+  return normalized;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -14,6 +14,7 @@
  */
 
 #include "OpenCameraCalibrator/utils/utils.h"
+#include "OpenCameraCalibrator/utils/reprojection_error.h"
 
 #include <opencv2/aruco.hpp>
 #include <opencv2/opencv.hpp>
@@ -24,6 +25,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <limits>
 #include <vector>
 
 using namespace cv;
@@ -74,6 +76,40 @@ bool ReadDetectorParameters(std::string filename,
   return true;
 }
 
+bool WriteDetectorParameters(const std::string& filename,
+                             const aruco::DetectorParameters& params,
+                             const std::string& comment) {
+  FileStorage fs(filename, FileStorage::WRITE);
+  if (!fs.isOpened()) return false;
+  if (!comment.empty()) {
+    fs.writeComment(comment);
+  }
+  fs << "adaptiveThreshWinSizeMin" << params.adaptiveThreshWinSizeMin;
+  fs << "adaptiveThreshWinSizeMax" << params.adaptiveThreshWinSizeMax;
+  fs << "adaptiveThreshWinSizeStep" << params.adaptiveThreshWinSizeStep;
+  fs << "adaptiveThreshConstant" << params.adaptiveThreshConstant;
+  fs << "minMarkerPerimeterRate" << params.minMarkerPerimeterRate;
+  fs << "maxMarkerPerimeterRate" << params.maxMarkerPerimeterRate;
+  fs << "polygonalApproxAccuracyRate" << params.polygonalApproxAccuracyRate;
+  fs << "minCornerDistanceRate" << params.minCornerDistanceRate;
+  fs << "minDistanceToBorder" << params.minDistanceToBorder;
+  fs << "minMarkerDistanceRate" << params.minMarkerDistanceRate;
+  fs << "cornerRefinementMethod" << params.cornerRefinementMethod;
+  fs << "cornerRefinementWinSize" << params.cornerRefinementWinSize;
+  fs << "cornerRefinementMaxIterations"
+     << params.cornerRefinementMaxIterations;
+  fs << "cornerRefinementMinAccuracy" << params.cornerRefinementMinAccuracy;
+  fs << "markerBorderBits" << params.markerBorderBits;
+  fs << "perspectiveRemovePixelPerCell"
+     << params.perspectiveRemovePixelPerCell;
+  fs << "perspectiveRemoveIgnoredMarginPerCell"
+     << params.perspectiveRemoveIgnoredMarginPerCell;
+  fs << "maxErroneousBitsInBorderRate" << params.maxErroneousBitsInBorderRate;
+  fs << "minOtsuStdDev" << params.minOtsuStdDev;
+  fs << "errorCorrectionRate" << params.errorCorrectionRate;
+  return true;
+}
+
 double MedianOfDoubleVec(std::vector<double>& double_vec) {
   assert(!double_vec.empty());
   if (double_vec.size() % 2 == 0) {
@@ -162,18 +198,7 @@ int GravDirStringToInt(const std::string& string) {
 
 double GetReprojErrorOfView(const theia::Reconstruction& recon_dataset,
                             const theia::ViewId v_id) {
-  const theia::View* v = recon_dataset.View(v_id);
-  std::vector<theia::TrackId> track_ids = v->TrackIds();
-  double view_reproj_error = 0.0;
-  for (size_t t = 0; t < track_ids.size(); ++t) {
-    const theia::Feature* feat = v->GetFeature(track_ids[t]);
-    const theia::Track* track = recon_dataset.Track(track_ids[t]);
-    Eigen::Vector2d pt;
-    v->Camera().ProjectPoint(track->Point(), &pt);
-    view_reproj_error += (pt - (*feat).point_).norm();
-  }
-  view_reproj_error /= track_ids.size();
-  return view_reproj_error;
+  return ComputeViewReprojectionError(recon_dataset, v_id).mean;
 }
 
 std::vector<std::string> load_images(const std::string& img_dir_path) {
@@ -192,23 +217,75 @@ std::vector<std::string> load_images(const std::string& img_dir_path) {
 }
 
 size_t FindClosestTimestamp(const double t_imu,
-                         const std::vector<double>& vis_timestamps,
-                         double& distance_to_nearest_timestamp) {
-  double dist = std::numeric_limits<double>::max();
+                            const std::vector<double>& vis_timestamps,
+                            double& distance_to_nearest_timestamp) {
+  if (vis_timestamps.empty()) {
+    distance_to_nearest_timestamp = std::numeric_limits<double>::max();
+    return 0;
+  }
+  const auto upper = std::lower_bound(
+      vis_timestamps.begin(), vis_timestamps.end(), t_imu);
+  size_t idx = std::distance(vis_timestamps.begin(), upper);
+  if (idx == vis_timestamps.size()) {
+    --idx;
+  } else if (idx > 0 &&
+             t_imu - vis_timestamps[idx - 1] <= vis_timestamps[idx] - t_imu) {
+    // on a tie the earlier timestamp wins
+    --idx;
+  }
+  distance_to_nearest_timestamp = std::abs(t_imu - vis_timestamps[idx]);
+  return idx;
+}
+
+namespace {
+
+TimestampBracket BracketFromIndex(const double t,
+                                  const std::vector<double>& timestamps,
+                                  const size_t idx) {
+  TimestampBracket bracket;
+  bracket.idx = idx;
+  if (idx + 1 < timestamps.size() && t > timestamps[idx]) {
+    bracket.fraction =
+        (t - timestamps[idx]) / (timestamps[idx + 1] - timestamps[idx]);
+  }
+  return bracket;
+}
+
+}  // namespace
+
+TimestampBracket FindTimestampBracket(const double t,
+                                      const std::vector<double>& timestamps) {
+  const auto upper =
+      std::upper_bound(timestamps.begin(), timestamps.end(), t);
+  const size_t idx =
+      upper == timestamps.begin() ? 0 : upper - timestamps.begin() - 1;
+  return BracketFromIndex(t, timestamps, idx);
+}
+
+void AssociateSortedTimestamps(const std::vector<double>& t_old,
+                               const std::vector<double>& t_new,
+                               std::vector<TimestampBracket>& brackets) {
+  brackets.resize(t_new.size());
   size_t idx = 0;
-  for (size_t i = 0; i < vis_timestamps.size(); ++i) {
-    double new_dist = std::abs(t_imu - vis_timestamps[i]);
-    if (new_dist < dist) {
-      distance_to_nearest_timestamp = new_dist;
-      idx = i;
-      dist = new_dist;
-      if (distance_to_nearest_timestamp == 0.0) {
-        break;
-      }
+  for (size_t i = 0; i < t_new.size(); ++i) {
+    while (idx + 1 < t_old.size() && t_old[idx + 1] <= t_new[i]) {
+      ++idx;
     }
+    brackets[i] = BracketFromIndex(t_new[i], t_old, idx);
   }
+}
 
-  return idx;
+void AssociateTimestamps(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
+                         std::vector<TimestampBracket>& brackets) {
+  if (std::is_sorted(t_new.begin(), t_new.end())) {
+    AssociateSortedTimestamps(t_old, t_new, brackets);
+    return;
+  }
+  brackets.resize(t_new.size());
+  for (size_t i = 0; i < t_new.size(); ++i) {
+    brackets[i] = FindTimestampBracket(t_new[i], t_old);
+  }
 }
 
 Eigen::Vector3d lerp3d(const Eigen::Vector3d& v0,
@@ -217,45 +294,49 @@ Eigen::Vector3d lerp3d(const Eigen::Vector3d& v0,
   return (1.0 - fraction) * v0 + fraction * v1;
 }
 
-void InterpolateQuaternions(std::vector<double> t_old,
-                            std::vector<double> t_new,
+void InterpolateQuaternions(const std::vector<double>& t_old,
+                            const std::vector<double>& t_new,
                             const quat_vector& input_q,
                             quat_vector& interpolated_q) {
   assert(input_q.size() == t_old.size());
+  if (t_old.empty()) {
+    interpolated_q.clear();
+    return;
+  }
 
+  std::vector<TimestampBracket> brackets;
+  AssociateTimestamps(t_old, t_new, brackets);
+  interpolated_q.resize(t_new.size());
   for (size_t i = 0; i < t_new.size(); ++i) {
-    double dist_to_nearest_vis_t;
-    size_t nearest_old_idx =
-        FindClosestTimestamp(t_new[i], t_old, dist_to_nearest_vis_t);
-    if (nearest_old_idx < t_old.size()-1) {
-      const double fraction =
-          dist_to_nearest_vis_t /
-          (t_old[nearest_old_idx + 1] - t_old[nearest_old_idx]);
-      interpolated_q.push_back(input_q[nearest_old_idx].slerp(
-          fraction, input_q[nearest_old_idx + 1]));
+    const TimestampBracket& b = brackets[i];
+    if (b.fraction > 0.0) {
+      interpolated_q[i] = input_q[b.idx].slerp(b.fraction, input_q[b.idx + 1]);
     } else {
-      interpolated_q.push_back(input_q[nearest_old_idx]);
+      interpolated_q[i] = input_q[b.idx];
     }
   }
 }
 
-void InterpolateVector3d(std::vector<double> t_old,
-                         std::vector<double> t_new,
+void InterpolateVector3d(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
                          const vec3_vector& input_vec,
                          vec3_vector& interpolated_vec) {
+  assert(input_vec.size() == t_old.size());
+  if (t_old.empty()) {
+    interpolated_vec.clear();
+    return;
+  }
+
+  std::vector<TimestampBracket> brackets;
+  AssociateTimestamps(t_old, t_new, brackets);
+  interpolated_vec.resize(t_new.size());
   for (size_t i = 0; i < t_new.size(); ++i) {
-    double dist_to_nearest_vis_t;
-    int nearest_old_idx =
-        FindClosestTimestamp(t_new[i], t_old, dist_to_nearest_vis_t);
-    const double fraction =
-        dist_to_nearest_vis_t /
-        (t_old[nearest_old_idx + 1] - t_old[nearest_old_idx]);
-    if (nearest_old_idx < t_new.size()) {
-      interpolated_vec.push_back(lerp3d(input_vec[nearest_old_idx],
-                                        input_vec[nearest_old_idx + 1],
-                                        fraction));
+    const TimestampBracket& b = brackets[i];
+    if (b.fraction > 0.0) {
+      interpolated_vec[i] =
+          lerp3d(input_vec[b.idx], input_vec[b.idx + 1], b.fraction);
     } else {
-      interpolated_vec.push_back(input_vec[nearest_old_idx]);
+      interpolated_vec[i] = input_vec[b.idx];
     }
   }
 }
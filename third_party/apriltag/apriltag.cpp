@@ -35,6 +35,16 @@ struct ApriltagDetectorData {
 
 ApriltagDetector::ApriltagDetector() { data = new ApriltagDetectorData; }
 
+ApriltagDetector::ApriltagDetector(const ApriltagDetectorOptions& options) {
+  data = new ApriltagDetectorData;
+  SetOptions(options);
+}
+
+void ApriltagDetector::SetOptions(const ApriltagDetectorOptions& options) {
+  data->_tagDetector->setNumThreads(options.num_threads);
+  data->_tagDetector->setQuadDecimate(options.quad_decimate);
+}
+
 ApriltagDetector::~ApriltagDetector() { delete data; }
 
 void ApriltagDetector::detectTags(
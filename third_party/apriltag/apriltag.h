@@ -6,10 +6,22 @@ namespace OpenICC {
 
 struct ApriltagDetectorData;
 
+struct ApriltagDetectorOptions {
+  //! threads of the gradient, segmentation and quad decoding steps
+  int num_threads = 1;
+  //! detect the quads on an image downsampled by this factor, the tags are
+  //! decoded and refined on the full resolution image. 1 disables it.
+  int quad_decimate = 1;
+};
+
 class ApriltagDetector {
  public:
   ApriltagDetector();
 
+  explicit ApriltagDetector(const ApriltagDetectorOptions& options);
+
+  void SetOptions(const ApriltagDetectorOptions& options);
+
   ~ApriltagDetector();
 
   void detectTags(const cv::Mat& img_raw,
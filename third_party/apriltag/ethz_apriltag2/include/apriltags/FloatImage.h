@@ -47,8 +47,10 @@ class FloatImage {
   //! Rescale all values so that they are between [0,1]
   void normalize();
 
+  //! Rows and columns are filtered by numThreads threads
   void filterFactoredCentered(const std::vector<float>& fhoriz,
-                              const std::vector<float>& fvert);
+                              const std::vector<float>& fvert,
+                              const int numThreads = 1);
 
   template <typename T>
   void copyToSketch(DualCoding::Sketch<T>& sketch) {
@@ -0,0 +1,42 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace AprilTags {
+
+//! Splits [0, numItems) into one contiguous chunk per thread and calls
+//! func(begin, end, chunkIdx) for each chunk. Chunks are ascending in
+//! chunkIdx, so per chunk results can be concatenated in serial order.
+template <class Func>
+void parallelFor(const int numItems, const int numThreads, Func&& func) {
+  const int nThreads = std::max(1, std::min(numThreads, numItems));
+  if (nThreads <= 1) {
+    func(0, numItems, 0);
+    return;
+  }
+
+  const int chunkSize = (numItems + nThreads - 1) / nThreads;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < nThreads; ++t) {
+    const int begin = t * chunkSize;
+    const int end = std::min(numItems, begin + chunkSize);
+    if (begin >= end) break;
+    workers.emplace_back([&func, begin, end, t]() { func(begin, end, t); });
+  }
+  for (auto& worker : workers) worker.join();
+}
+
+//! Number of chunks parallelFor uses
+inline int parallelForChunks(const int numItems, const int numThreads) {
+  const int nThreads = std::max(1, std::min(numThreads, numItems));
+  if (nThreads <= 1) return 1;
+  const int chunkSize = (numItems + nThreads - 1) / nThreads;
+  return (numItems + chunkSize - 1) / chunkSize;
+}
+
+} // namespace
+
+#endif
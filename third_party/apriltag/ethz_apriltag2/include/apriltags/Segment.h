@@ -1,6 +1,7 @@
 #ifndef SEGMENT_H
 #define SEGMENT_H
 
+#include <atomic>
 #include <cmath>
 #include <vector>
 
@@ -48,7 +49,7 @@ private:
   float theta; // gradient direction (points towards white)
   float length; // length of line segment in pixels
   int segmentId;
-  static int idCounter;
+  static std::atomic<int> idCounter;
 };
 
 } // namsepace
@@ -1,6 +1,7 @@
 #ifndef TAGDETECTOR_H
 #define TAGDETECTOR_H
 
+#include <algorithm>
 #include <vector>
 
 #include "opencv2/opencv.hpp"
@@ -11,6 +12,8 @@
 
 namespace AprilTags {
 
+class Quad;
+
 class TagDetector {
 public:
 	
@@ -21,6 +24,21 @@ public:
 	TagDetector(const TagCodes& tagCodes, const size_t blackBorder=2) : thisTagFamily(tagCodes, blackBorder) {}
 	
 	std::vector<TagDetection> extractTags(const cv::Mat& image);
+
+	//! Number of threads used for the gradient, segmentation and decoding steps.
+	/*! The detections do not depend on the number of threads. */
+	void setNumThreads(const int threads) { numThreads = std::max(1, threads); }
+
+	//! Quads are detected on an image downsampled by this factor (1 == off).
+	/*! The quads are scaled back and decoded on the full resolution image. */
+	void setQuadDecimate(const int decimate) { quadDecimate = std::max(1, decimate); }
+
+private:
+	//! Reads the tag code of a quad from fim. Returns false if it can not be decoded.
+	bool decodeQuad(Quad& quad, const FloatImage& fim, TagDetection& detection) const;
+
+	int numThreads = 1;
+	int quadDecimate = 1;
 	
 };
 
@@ -1,5 +1,6 @@
 #include "apriltags/FloatImage.h"
 #include "apriltags/Gaussian.h"
+#include "apriltags/ParallelFor.h"
 #include <iostream>
 
 namespace AprilTags {
@@ -43,29 +44,34 @@ void FloatImage::normalize() {
     pixels[i] = (pixels[i]-minVal) * rescale;
 }
 
-void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert) {
+void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert,
+                                        const int numThreads) {
   // do horizontal
   std::vector<float> r(pixels);
 
-  for (int y = 0; y < height; y++) {
-    Gaussian::convolveSymmetricCentered(pixels, y*width, width, fhoriz, r, y*width);
-  }
+  parallelFor(height, numThreads, [&](int y0, int y1, int) {
+    for (int y = y0; y < y1; y++) {
+      Gaussian::convolveSymmetricCentered(pixels, y*width, width, fhoriz, r, y*width);
+    }
+  });
 
   // do vertical
-  std::vector<float> tmp(height); // column before convolution
-  std::vector<float> tmp2(height); // column after convolution
+  parallelFor(width, numThreads, [&](int x0, int x1, int) {
+    std::vector<float> tmp(height); // column before convolution
+    std::vector<float> tmp2(height); // column after convolution
 
-  for (int x = 0; x < width; x++) {
+    for (int x = x0; x < x1; x++) {
 
-    // copy the column out for locality
-    for (int y = 0; y < height; y++)
-      tmp[y] = r[y*width + x];
+      // copy the column out for locality
+      for (int y = 0; y < height; y++)
+        tmp[y] = r[y*width + x];
 
-    Gaussian::convolveSymmetricCentered(tmp, 0, height, fvert, tmp2, 0);
+      Gaussian::convolveSymmetricCentered(tmp, 0, height, fvert, tmp2, 0);
 
-    for (int y = 0; y < height; y++)
-      pixels[y*width + x] = tmp2[y];
-  }
+      for (int y = 0; y < height; y++)
+        pixels[y*width + x] = tmp2[y];
+    }
+  });
 }
 
 void FloatImage::printMinMax() const {
@@ -16,6 +16,6 @@ void Segment::printSegment() {
   std::cout <<"("<< x0 <<","<< y0 <<"), "<<"("<< x1 <<","<< y1 <<")" << std::endl;
 }
 
-int Segment::idCounter = 0;
+std::atomic<int> Segment::idCounter(0);
 
 } // namespace
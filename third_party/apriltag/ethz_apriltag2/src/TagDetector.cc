@@ -16,6 +16,7 @@
 #include "apriltags/Gridder.h"
 #include "apriltags/Homography33.h"
 #include "apriltags/MathUtil.h"
+#include "apriltags/ParallelFor.h"
 #include "apriltags/Quad.h"
 #include "apriltags/Segment.h"
 #include "apriltags/TagFamily.h"
@@ -35,21 +36,204 @@ using namespace std;
 
 namespace AprilTags {
 
+namespace {
+
+//! Converts an 8 bit gray image to the internal AprilTags image
+FloatImage toFloatImage(const cv::Mat &image, const int numThreads) {
+  FloatImage fim(image.cols, image.rows);
+  parallelFor(image.rows, numThreads, [&](int y0, int y1, int) {
+    for (int y = y0; y < y1; y++) {
+      const unsigned char *row = image.ptr<unsigned char>(y);
+      for (int x = 0; x < image.cols; x++) {
+        fim.set(x, y, row[x] / 255.);
+      }
+    }
+  });
+  return fim;
+}
+
+//! Fits a line to a cluster. Returns false if the line is too short.
+bool fitSegment(const std::vector<XYWeight> &points, const FloatImage &fimTheta,
+                const FloatImage &fimMag, Segment &seg) {
+  GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
+
+  // filter short lines
+  float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
+  if (length < Segment::minimumLineLength) return false;
+
+  float dy = gseg.getP1().second - gseg.getP0().second;
+  float dx = gseg.getP1().first - gseg.getP0().first;
+
+  float tmpTheta = std::atan2(dy, dx);
+
+  seg.setTheta(tmpTheta);
+  seg.setLength(length);
+
+  // We add an extra semantic to segments: the vector
+  // p1->p2 will have dark on the left, white on the right.
+  // To do this, we'll look at every gradient and each one
+  // will vote for which way they think the gradient should
+  // go. This is way more retentive than necessary: we
+  // could probably sample just one point!
+
+  float flip = 0, noflip = 0;
+  for (unsigned int i = 0; i < points.size(); i++) {
+    XYWeight xyw = points[i];
+
+    float theta = fimTheta.get((int)xyw.x, (int)xyw.y);
+    float mag = fimMag.get((int)xyw.x, (int)xyw.y);
+
+    // err *should* be +M_PI/2 for the correct winding, but if we
+    // got the wrong winding, it'll be around -M_PI/2.
+    float err = MathUtil::mod2pi(theta - seg.getTheta());
+
+    if (err < 0)
+      noflip += mag;
+    else
+      flip += mag;
+  }
+
+  if (flip > noflip) {
+    float temp = seg.getTheta() + (float)M_PI;
+    seg.setTheta(temp);
+  }
+
+  float dot = dx * std::cos(seg.getTheta()) + dy * std::sin(seg.getTheta());
+  if (dot > 0) {
+    seg.setX0(gseg.getP1().first);
+    seg.setY0(gseg.getP1().second);
+    seg.setX1(gseg.getP0().first);
+    seg.setY1(gseg.getP0().second);
+  } else {
+    seg.setX0(gseg.getP0().first);
+    seg.setY0(gseg.getP0().second);
+    seg.setX1(gseg.getP1().first);
+    seg.setY1(gseg.getP1().second);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool TagDetector::decodeQuad(Quad &quad, const FloatImage &fim,
+                             TagDetection &thisTagDetection) const {
+  const int width = fim.getWidth();
+  const int height = fim.getHeight();
+
+  // Find a threshold
+  GrayModel blackModel, whiteModel;
+  const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
+
+  for (int iy = -1; iy <= dd; iy++) {
+    float y = (iy + 0.5f) / dd;
+    for (int ix = -1; ix <= dd; ix++) {
+      float x = (ix + 0.5f) / dd;
+      std::pair<float, float> pxy = quad.interpolate01(x, y);
+      int irx = (int)(pxy.first + 0.5);
+      int iry = (int)(pxy.second + 0.5);
+      if (irx < 0 || irx >= width || iry < 0 || iry >= height) continue;
+      float v = fim.get(irx, iry);
+      if (iy == -1 || iy == dd || ix == -1 || ix == dd)
+        whiteModel.addObservation(x, y, v);
+      else if (iy == 0 || iy == (dd - 1) || ix == 0 || ix == (dd - 1))
+        blackModel.addObservation(x, y, v);
+    }
+  }
+
+  bool bad = false;
+  unsigned long long tagCode = 0;
+  for (int iy = thisTagFamily.dimension - 1; iy >= 0; iy--) {
+    float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
+    for (int ix = 0; ix < thisTagFamily.dimension; ix++) {
+      float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
+      std::pair<float, float> pxy = quad.interpolate01(x, y);
+      int irx = (int)(pxy.first + 0.5);
+      int iry = (int)(pxy.second + 0.5);
+      if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
+        // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
+        bad = true;
+        continue;
+      }
+      float threshold =
+          (blackModel.interpolate(x, y) + whiteModel.interpolate(x, y)) *
+          0.5f;
+      float v = fim.get(irx, iry);
+      tagCode = tagCode << 1;
+      if (v > threshold) tagCode |= 1;
+    }
+  }
+
+  if (bad) return false;
+
+  thisTagFamily.decode(thisTagDetection, tagCode);
+
+  // compute the homography (and rotate it appropriately)
+  thisTagDetection.homography = quad.homography.getH();
+  thisTagDetection.hxy = quad.homography.getCXY();
+
+  float c = std::cos(thisTagDetection.rotation * (float)M_PI / 2);
+  float s = std::sin(thisTagDetection.rotation * (float)M_PI / 2);
+  Eigen::Matrix3d R;
+  R.setZero();
+  R(0, 0) = R(1, 1) = c;
+  R(0, 1) = -s;
+  R(1, 0) = s;
+  R(2, 2) = 1;
+  Eigen::Matrix3d tmp;
+  tmp = thisTagDetection.homography * R;
+  thisTagDetection.homography = tmp;
+
+  // Rotate points in detection according to decoded
+  // orientation.  Thus the order of the points in the
+  // detection object can be used to determine the
+  // orientation of the target.
+  std::pair<float, float> bottomLeft = thisTagDetection.interpolate(-1, -1);
+  int bestRot = -1;
+  float bestDist = FLT_MAX;
+  for (int i = 0; i < 4; i++) {
+    float const dist =
+        AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
+    if (dist < bestDist) {
+      bestDist = dist;
+      bestRot = i;
+    }
+  }
+
+  for (int i = 0; i < 4; i++)
+    thisTagDetection.p[i] = quad.quadPoints[(i + bestRot) % 4];
+
+  if (!thisTagDetection.good) return false;
+
+  thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
+  thisTagDetection.observedPerimeter = quad.observedPerimeter;
+  return true;
+}
+
 std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // convert to internal AprilTags image (todo: slow, change internally to
   // OpenCV)
   int width = image.cols;
   int height = image.rows;
-  AprilTags::FloatImage fimOrig(width, height);
-  int i = 0;
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      fimOrig.set(x, y, image.data[i] / 255.);
-      i++;
-    }
-  }
+  AprilTags::FloatImage fimOrig = toFloatImage(image, numThreads);
   std::pair<int, int> opticalCenter(width / 2, height / 2);
 
+  // Steps two to seven (the quad detection) run on fimQuad, which is
+  // downsampled if quadDecimate > 1. The quads are decoded on fim.
+  AprilTags::FloatImage fimQuad;
+  if (quadDecimate > 1) {
+    cv::Mat imageDecimated;
+    cv::resize(image, imageDecimated,
+               cv::Size(std::max(1, width / quadDecimate),
+                        std::max(1, height / quadDecimate)),
+               0, 0, cv::INTER_AREA);
+    fimQuad = toFloatImage(imageDecimated, numThreads);
+  } else {
+    fimQuad = fimOrig;
+  }
+  const int quadWidth = fimQuad.getWidth();
+  const int quadHeight = fimQuad.getHeight();
+  std::pair<int, int> quadOpticalCenter(quadWidth / 2, quadHeight / 2);
+
 #ifdef DEBUG_APRIL
 #if 0
   { // debug - write
@@ -121,7 +305,7 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   if (sigma > 0) {
     int filtsz = ((int)max(3.0f, 3 * sigma)) | 1;
     std::vector<float> filt = Gaussian::makeGaussianFilter(sigma, filtsz);
-    fim.filterFactoredCentered(filt, filt);
+    fim.filterFactoredCentered(filt, filt, numThreads);
   }
 
   //================================================================
@@ -132,38 +316,40 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
 
   FloatImage fimSeg;
   if (segSigma > 0) {
-    if (segSigma == sigma) {
+    if (segSigma == sigma && quadDecimate == 1) {
       fimSeg = fim;
     } else {
       // blur anew
       int filtsz = ((int)max(3.0f, 3 * segSigma)) | 1;
       std::vector<float> filt = Gaussian::makeGaussianFilter(segSigma, filtsz);
-      fimSeg = fimOrig;
-      fimSeg.filterFactoredCentered(filt, filt);
+      fimSeg = fimQuad;
+      fimSeg.filterFactoredCentered(filt, filt, numThreads);
     }
   } else {
-    fimSeg = fimOrig;
+    fimSeg = fimQuad;
   }
 
   FloatImage fimTheta(fimSeg.getWidth(), fimSeg.getHeight());
   FloatImage fimMag(fimSeg.getWidth(), fimSeg.getHeight());
 
-  for (int y = 1; y < fimSeg.getHeight() - 1; y++) {
-    for (int x = 1; x < fimSeg.getWidth() - 1; x++) {
-      float Ix = fimSeg.get(x + 1, y) - fimSeg.get(x - 1, y);
-      float Iy = fimSeg.get(x, y + 1) - fimSeg.get(x, y - 1);
+  parallelFor(fimSeg.getHeight() - 2, numThreads, [&](int r0, int r1, int) {
+    for (int y = r0 + 1; y < r1 + 1; y++) {
+      for (int x = 1; x < fimSeg.getWidth() - 1; x++) {
+        float Ix = fimSeg.get(x + 1, y) - fimSeg.get(x - 1, y);
+        float Iy = fimSeg.get(x, y + 1) - fimSeg.get(x, y - 1);
 
-      float mag = Ix * Ix + Iy * Iy;
+        float mag = Ix * Ix + Iy * Iy;
 #if 0  // kaess: fast version, but maybe less accurate?
-      float theta = MathUtil::fast_atan2(Iy, Ix);
+        float theta = MathUtil::fast_atan2(Iy, Ix);
 #else
-      float theta = atan2(Iy, Ix);
+        float theta = atan2(Iy, Ix);
 #endif
 
-      fimTheta.set(x, y, theta);
-      fimMag.set(x, y, mag);
+        fimTheta.set(x, y, theta);
+        fimMag.set(x, y, mag);
+      }
     }
-  }
+  });
 
 #ifdef DEBUG_APRIL
   int height_ = fimSeg.getHeight();
@@ -192,9 +378,9 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // Step three. Extract edges by grouping pixels with similar
   // thetas together. This is a greedy algorithm: we start with
   // the most similar pixels.  We use 4-connectivity.
-  UnionFindSimple uf(fimSeg.getWidth() * fimSeg.getHeight());
+  UnionFindSimple uf(quadWidth * quadHeight);
 
-  vector<Edge> edges(width * height * 4);
+  vector<Edge> edges;
   size_t nEdges = 0;
 
   // Bounds on the thetas assigned to this group. Note that because
@@ -206,33 +392,50 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
       * That's already a problem for OS X (default 512KB thread stack size),
       * could be a problem elsewhere for bigger images... so store on heap */
     vector<float> storage(
-        width * height *
+        quadWidth * quadHeight *
         4);  // do all the memory in one big block, exception safe
-    float *tmin = &storage[width * height * 0];
-    float *tmax = &storage[width * height * 1];
-    float *mmin = &storage[width * height * 2];
-    float *mmax = &storage[width * height * 3];
-
-    for (int y = 0; y + 1 < height; y++) {
-      for (int x = 0; x + 1 < width; x++) {
-        float mag0 = fimMag.get(x, y);
-        if (mag0 < Edge::minMag) continue;
-        mmax[y * width + x] = mag0;
-        mmin[y * width + x] = mag0;
-
-        float theta0 = fimTheta.get(x, y);
-        tmin[y * width + x] = theta0;
-        tmax[y * width + x] = theta0;
-
-        // Calculates then adds edges to 'vector<Edge> edges'
-        Edge::calcEdges(theta0, x, y, fimTheta, fimMag, edges, nEdges);
-
-        // XXX Would 8 connectivity help for rotated tags?
-        // Probably not much, so long as input filtering hasn't been disabled.
+    float *tmin = &storage[quadWidth * quadHeight * 0];
+    float *tmax = &storage[quadWidth * quadHeight * 1];
+    float *mmin = &storage[quadWidth * quadHeight * 2];
+    float *mmax = &storage[quadWidth * quadHeight * 3];
+
+    // Every band of rows collects its own edges. Concatenating the bands in
+    // order gives the same edge list as a single pass over the image.
+    const int numRows = quadHeight - 1;
+    std::vector<std::vector<Edge> > bandEdges(
+        parallelForChunks(numRows, numThreads));
+    parallelFor(numRows, numThreads, [&](int y0, int y1, int band) {
+      std::vector<Edge> &localEdges = bandEdges[band];
+      localEdges.resize((y1 - y0) * quadWidth * 4);
+      size_t nLocalEdges = 0;
+      for (int y = y0; y < y1; y++) {
+        for (int x = 0; x + 1 < quadWidth; x++) {
+          float mag0 = fimMag.get(x, y);
+          if (mag0 < Edge::minMag) continue;
+          mmax[y * quadWidth + x] = mag0;
+          mmin[y * quadWidth + x] = mag0;
+
+          float theta0 = fimTheta.get(x, y);
+          tmin[y * quadWidth + x] = theta0;
+          tmax[y * quadWidth + x] = theta0;
+
+          // Calculates then adds edges to 'vector<Edge> edges'
+          Edge::calcEdges(theta0, x, y, fimTheta, fimMag, localEdges,
+                          nLocalEdges);
+
+          // XXX Would 8 connectivity help for rotated tags?
+          // Probably not much, so long as input filtering hasn't been
+          // disabled.
+        }
       }
-    }
+      localEdges.resize(nLocalEdges);
+    });
+
+    for (const auto &localEdges : bandEdges) nEdges += localEdges.size();
+    edges.reserve(nEdges);
+    for (const auto &localEdges : bandEdges)
+      edges.insert(edges.end(), localEdges.begin(), localEdges.end());
 
-    edges.resize(nEdges);
     std::stable_sort(edges.begin(), edges.end());
     Edge::mergeEdges(edges, uf, tmin, tmax, mmin, mmax);
   }
@@ -263,69 +466,26 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
 
   //================================================================
   // Step five: Loop over the clusters, fitting lines (which we call Segments).
-  std::vector<Segment> segments;  // used in Step six
+  std::vector<const std::vector<XYWeight> *> clusterPoints;
+  clusterPoints.reserve(clusters.size());
   std::map<int, std::vector<XYWeight> >::const_iterator clustersItr;
   for (clustersItr = clusters.begin(); clustersItr != clusters.end();
        clustersItr++) {
-    std::vector<XYWeight> points = clustersItr->second;
-    GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
-
-    // filter short lines
-    float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
-    if (length < Segment::minimumLineLength) continue;
-
-    Segment seg;
-    float dy = gseg.getP1().second - gseg.getP0().second;
-    float dx = gseg.getP1().first - gseg.getP0().first;
-
-    float tmpTheta = std::atan2(dy, dx);
-
-    seg.setTheta(tmpTheta);
-    seg.setLength(length);
-
-    // We add an extra semantic to segments: the vector
-    // p1->p2 will have dark on the left, white on the right.
-    // To do this, we'll look at every gradient and each one
-    // will vote for which way they think the gradient should
-    // go. This is way more retentive than necessary: we
-    // could probably sample just one point!
-
-    float flip = 0, noflip = 0;
-    for (unsigned int i = 0; i < points.size(); i++) {
-      XYWeight xyw = points[i];
-
-      float theta = fimTheta.get((int)xyw.x, (int)xyw.y);
-      float mag = fimMag.get((int)xyw.x, (int)xyw.y);
-
-      // err *should* be +M_PI/2 for the correct winding, but if we
-      // got the wrong winding, it'll be around -M_PI/2.
-      float err = MathUtil::mod2pi(theta - seg.getTheta());
-
-      if (err < 0)
-        noflip += mag;
-      else
-        flip += mag;
-    }
+    clusterPoints.push_back(&clustersItr->second);
+  }
 
-    if (flip > noflip) {
-      float temp = seg.getTheta() + (float)M_PI;
-      seg.setTheta(temp);
+  std::vector<Segment> fittedSegments(clusterPoints.size());
+  std::vector<char> fitted(clusterPoints.size(), 0);
+  parallelFor((int)clusterPoints.size(), numThreads, [&](int c0, int c1, int) {
+    for (int c = c0; c < c1; c++) {
+      fitted[c] =
+          fitSegment(*clusterPoints[c], fimTheta, fimMag, fittedSegments[c]);
     }
+  });
 
-    float dot = dx * std::cos(seg.getTheta()) + dy * std::sin(seg.getTheta());
-    if (dot > 0) {
-      seg.setX0(gseg.getP1().first);
-      seg.setY0(gseg.getP1().second);
-      seg.setX1(gseg.getP0().first);
-      seg.setY1(gseg.getP0().second);
-    } else {
-      seg.setX0(gseg.getP0().first);
-      seg.setY0(gseg.getP0().second);
-      seg.setX1(gseg.getP1().first);
-      seg.setY1(gseg.getP1().second);
-    }
-
-    segments.push_back(seg);
+  std::vector<Segment> segments;  // used in Step six
+  for (size_t c = 0; c < fittedSegments.size(); c++) {
+    if (fitted[c]) segments.push_back(fittedSegments[c]);
   }
 
 #ifdef DEBUG_APRIL
@@ -347,7 +507,7 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // (We will chain segments together next...) The gridder accelerates the
   // search by
   // building (essentially) a 2D hash table.
-  Gridder<Segment> gridder(0, 0, width, height, 10);
+  Gridder<Segment> gridder(0, 0, quadWidth, quadHeight, 10);
 
   // add every segment to the hash table according to the position of the
   // segment's
@@ -359,45 +519,48 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   }
 
   // Now, find child segments that begin where each parent segment ends.
-  for (unsigned i = 0; i < segments.size(); i++) {
-    Segment &parentseg = segments[i];
-
-    // compute length of the line segment
-    GLine2D parentLine(
-        std::pair<float, float>(parentseg.getX0(), parentseg.getY0()),
-        std::pair<float, float>(parentseg.getX1(), parentseg.getY1()));
-
-    Gridder<Segment>::iterator iter = gridder.find(
-        parentseg.getX1(), parentseg.getY1(), 0.5f * parentseg.getLength());
-    while (iter.hasNext()) {
-      Segment &child = iter.next();
-      if (MathUtil::mod2pi(child.getTheta() - parentseg.getTheta()) > 0) {
-        continue;
-      }
+  // Every parent only modifies its own children, the gridder is read only.
+  parallelFor((int)segments.size(), numThreads, [&](int s0, int s1, int) {
+    for (int i = s0; i < s1; i++) {
+      Segment &parentseg = segments[i];
+
+      // compute length of the line segment
+      GLine2D parentLine(
+          std::pair<float, float>(parentseg.getX0(), parentseg.getY0()),
+          std::pair<float, float>(parentseg.getX1(), parentseg.getY1()));
+
+      Gridder<Segment>::iterator iter = gridder.find(
+          parentseg.getX1(), parentseg.getY1(), 0.5f * parentseg.getLength());
+      while (iter.hasNext()) {
+        Segment &child = iter.next();
+        if (MathUtil::mod2pi(child.getTheta() - parentseg.getTheta()) > 0) {
+          continue;
+        }
 
-      // compute intersection of points
-      GLine2D childLine(std::pair<float, float>(child.getX0(), child.getY0()),
-                        std::pair<float, float>(child.getX1(), child.getY1()));
+        // compute intersection of points
+        GLine2D childLine(std::pair<float, float>(child.getX0(), child.getY0()),
+                          std::pair<float, float>(child.getX1(), child.getY1()));
 
-      std::pair<float, float> p = parentLine.intersectionWith(childLine);
-      if (p.first == -1) {
-        continue;
-      }
+        std::pair<float, float> p = parentLine.intersectionWith(childLine);
+        if (p.first == -1) {
+          continue;
+        }
 
-      float parentDist = MathUtil::distance2D(
-          p, std::pair<float, float>(parentseg.getX1(), parentseg.getY1()));
-      float childDist = MathUtil::distance2D(
-          p, std::pair<float, float>(child.getX0(), child.getY0()));
+        float parentDist = MathUtil::distance2D(
+            p, std::pair<float, float>(parentseg.getX1(), parentseg.getY1()));
+        float childDist = MathUtil::distance2D(
+            p, std::pair<float, float>(child.getX0(), child.getY0()));
 
-      if (max(parentDist, childDist) > parentseg.getLength()) {
-        // cout << "intersection too far" << endl;
-        continue;
-      }
+        if (max(parentDist, childDist) > parentseg.getLength()) {
+          // cout << "intersection too far" << endl;
+          continue;
+        }
 
-      // everything's OK, this child is a reasonable successor.
-      parentseg.children.push_back(&child);
+        // everything's OK, this child is a reasonable successor.
+        parentseg.children.push_back(&child);
+      }
     }
-  }
+  });
 
   //================================================================
   // Step seven: Search all connected segments to see if any form a loop of
@@ -405,10 +568,36 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // Add those to the quads list.
   vector<Quad> quads;
 
-  vector<Segment *> tmp(5);
-  for (unsigned int i = 0; i < segments.size(); i++) {
-    tmp[0] = &segments[i];
-    Quad::search(fimOrig, tmp, segments[i], 0, quads, opticalCenter);
+  std::vector<std::vector<Quad> > chunkQuads(
+      parallelForChunks((int)segments.size(), numThreads));
+  parallelFor((int)segments.size(), numThreads, [&](int s0, int s1, int c) {
+    vector<Segment *> tmp(5);
+    for (int i = s0; i < s1; i++) {
+      tmp[0] = &segments[i];
+      Quad::search(fimQuad, tmp, segments[i], 0, chunkQuads[c],
+                   quadOpticalCenter);
+    }
+  });
+  for (const auto &localQuads : chunkQuads)
+    quads.insert(quads.end(), localQuads.begin(), localQuads.end());
+
+  // scale the quads back to the full resolution image (pixel centers as in
+  // cv::resize)
+  if (quadDecimate > 1) {
+    const float scaleX = (float)width / quadWidth;
+    const float scaleY = (float)height / quadHeight;
+    for (size_t qi = 0; qi < quads.size(); qi++) {
+      std::vector<std::pair<float, float> > points = quads[qi].quadPoints;
+      for (auto &p : points) {
+        p.first = (p.first + 0.5f) * scaleX - 0.5f;
+        p.second = (p.second + 0.5f) * scaleY - 0.5f;
+      }
+      Quad scaledQuad(points, opticalCenter);
+      scaledQuad.segments = quads[qi].segments;
+      scaledQuad.observedPerimeter =
+          quads[qi].observedPerimeter * 0.5f * (scaleX + scaleY);
+      quads[qi] = scaledQuad;
+    }
   }
 
 #ifdef DEBUG_APRIL
@@ -452,107 +641,15 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
 
   std::vector<TagDetection> detections;
 
-  for (unsigned int qi = 0; qi < quads.size(); qi++) {
-    Quad &quad = quads[qi];
-
-    // Find a threshold
-    GrayModel blackModel, whiteModel;
-    const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
-
-    for (int iy = -1; iy <= dd; iy++) {
-      float y = (iy + 0.5f) / dd;
-      for (int ix = -1; ix <= dd; ix++) {
-        float x = (ix + 0.5f) / dd;
-        std::pair<float, float> pxy = quad.interpolate01(x, y);
-        int irx = (int)(pxy.first + 0.5);
-        int iry = (int)(pxy.second + 0.5);
-        if (irx < 0 || irx >= width || iry < 0 || iry >= height) continue;
-        float v = fim.get(irx, iry);
-        if (iy == -1 || iy == dd || ix == -1 || ix == dd)
-          whiteModel.addObservation(x, y, v);
-        else if (iy == 0 || iy == (dd - 1) || ix == 0 || ix == (dd - 1))
-          blackModel.addObservation(x, y, v);
-      }
-    }
-
-    bool bad = false;
-    unsigned long long tagCode = 0;
-    for (int iy = thisTagFamily.dimension - 1; iy >= 0; iy--) {
-      float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
-      for (int ix = 0; ix < thisTagFamily.dimension; ix++) {
-        float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
-        std::pair<float, float> pxy = quad.interpolate01(x, y);
-        int irx = (int)(pxy.first + 0.5);
-        int iry = (int)(pxy.second + 0.5);
-        if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
-          // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
-          bad = true;
-          continue;
-        }
-        float threshold =
-            (blackModel.interpolate(x, y) + whiteModel.interpolate(x, y)) *
-            0.5f;
-        float v = fim.get(irx, iry);
-        tagCode = tagCode << 1;
-        if (v > threshold) tagCode |= 1;
-#ifdef DEBUG_APRIL
-        {
-          if (v > threshold)
-            cv::circle(dbgImage, cv::Point2f(irx, iry), 1,
-                       cv::Scalar(0, 0, 255, 0), 2);
-          else
-            cv::circle(dbgImage, cv::Point2f(irx, iry), 1,
-                       cv::Scalar(0, 255, 0, 0), 2);
-        }
-#endif
-      }
-    }
-
-    if (!bad) {
-      TagDetection thisTagDetection;
-      thisTagFamily.decode(thisTagDetection, tagCode);
-
-      // compute the homography (and rotate it appropriately)
-      thisTagDetection.homography = quad.homography.getH();
-      thisTagDetection.hxy = quad.homography.getCXY();
-
-      float c = std::cos(thisTagDetection.rotation * (float)M_PI / 2);
-      float s = std::sin(thisTagDetection.rotation * (float)M_PI / 2);
-      Eigen::Matrix3d R;
-      R.setZero();
-      R(0, 0) = R(1, 1) = c;
-      R(0, 1) = -s;
-      R(1, 0) = s;
-      R(2, 2) = 1;
-      Eigen::Matrix3d tmp;
-      tmp = thisTagDetection.homography * R;
-      thisTagDetection.homography = tmp;
-
-      // Rotate points in detection according to decoded
-      // orientation.  Thus the order of the points in the
-      // detection object can be used to determine the
-      // orientation of the target.
-      std::pair<float, float> bottomLeft = thisTagDetection.interpolate(-1, -1);
-      int bestRot = -1;
-      float bestDist = FLT_MAX;
-      for (int i = 0; i < 4; i++) {
-        float const dist =
-            AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
-        if (dist < bestDist) {
-          bestDist = dist;
-          bestRot = i;
-        }
-      }
-
-      for (int i = 0; i < 4; i++)
-        thisTagDetection.p[i] = quad.quadPoints[(i + bestRot) % 4];
-
-      if (thisTagDetection.good) {
-        thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
-        thisTagDetection.observedPerimeter = quad.observedPerimeter;
-        detections.push_back(thisTagDetection);
-      }
+  std::vector<TagDetection> quadDetections(quads.size());
+  std::vector<char> decoded(quads.size(), 0);
+  parallelFor((int)quads.size(), numThreads, [&](int q0, int q1, int) {
+    for (int qi = q0; qi < q1; qi++) {
+      decoded[qi] = decodeQuad(quads[qi], fim, quadDetections[qi]);
     }
+  });
+  for (size_t qi = 0; qi < quads.size(); qi++) {
+    if (decoded[qi]) detections.push_back(quadDetections[qi]);
   }
 
 #ifdef DEBUG_APRIL